@@ -493,6 +493,9 @@ public:
     // Whether to emit instrumentation code if -fprofile-instr-generate is specified,
     // the value is set with pragma(LDC_profile_instr, true|false)
     bool emitInstrumentation;
+
+    // true if the function calls a pragma(LDC_yield) template
+    bool isGenerator;
 #endif
 
     VarDeclaration *vresult;            // result variable for out contracts
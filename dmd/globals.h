@@ -251,11 +251,16 @@ struct Param
 
     // Codegen cl options
     bool disableRedZone;
+    bool realIsDouble; // -real-precision=double
     uint32_t dwarfVersion;
 
     uint32_t hashThreshold; // MD5 hash symbols larger than this threshold (0 = no hashing)
 
     bool outputSourceLocations; // if true, output line tables.
+
+    bool vtemplates; // print template instantiation statistics
+
+    bool linkParallelRuntime; // pragma(LDC_parallel) used
 #endif
 };
 
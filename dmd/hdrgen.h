@@ -18,6 +18,9 @@ class Module;
 
 void genhdrfile(Module *m);
 void moduleToBuffer(OutBuffer *buf, Module *m);
+#if IN_LLVM
+void moduleInterfaceToBuffer(OutBuffer *buf, Module *m);
+#endif
 
 const char *parametersTypeToChars(ParameterList pl);
 const char *stcToChars(StorageClass& stc);
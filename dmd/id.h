@@ -61,6 +61,7 @@ struct Id
     static Identifier *LDC_va_end;
     static Identifier *LDC_va_arg;
     static Identifier *LDC_fence;
+    static Identifier *LDC_yield;
     static Identifier *LDC_atomic_load;
     static Identifier *LDC_atomic_store;
     static Identifier *LDC_atomic_cmp_xchg;
@@ -70,6 +71,8 @@ struct Id
     static Identifier *LDC_inline_ir;
     static Identifier *LDC_extern_weak;
     static Identifier *LDC_profile_instr;
+    static Identifier *LDC_loop;
+    static Identifier *LDC_parallel;
     static Identifier *dcReflect;
     static Identifier *criticalenter;
     static Identifier *criticalexit;
@@ -77,6 +80,9 @@ struct Id
     static Identifier *udaSection;
     static Identifier *udaOptStrategy;
     static Identifier *udaTarget;
+    static Identifier *udaTargetClones;
+    static Identifier *udaPackLayout;
+    static Identifier *udaCold;
     static Identifier *udaAssumeUsed;
     static Identifier *udaWeak;
     static Identifier *udaAllocSize;
@@ -84,8 +90,12 @@ struct Id
     static Identifier *udaLLVMFastMathFlag;
     static Identifier *udaKernel;
     static Identifier *udaCompute;
+    static Identifier *udaLaunchBounds;
+    static Identifier *udaReqdWorkGroupSize;
+    static Identifier *udaWorkGroupSizeHint;
     static Identifier *udaDynamicCompile;
     static Identifier *udaDynamicCompileConst;
     static Identifier *udaDynamicCompileEmit;
+    static Identifier *udaDynamicCompileInline;
 #endif
 };
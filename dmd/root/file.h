@@ -33,6 +33,10 @@ struct File
      */
 
     bool read();
+#if IN_LLVM
+    bool readMapped();
+    void releaseBuffer();
+#endif
 
     /* Write file, return true if error
      */
@@ -264,6 +264,9 @@ public:
     Statement *_body;
     Expression *condition;
     Loc endloc;                 // location of ';' after while
+#if IN_LLVM
+    PragmaStatement *loopPragma; // pragma(LDC_loop) hints, if any
+#endif
 
     Statement *syntaxCopy();
     bool hasBreak();
@@ -285,6 +288,9 @@ public:
     // which may have an associated label. Internal break/continue statements
     // treat that label as referring to this loop.
     Statement *relatedLabeled;
+#if IN_LLVM
+    PragmaStatement *loopPragma; // pragma(LDC_loop) hints, if any
+#endif
 
     Statement *syntaxCopy();
     Statement *scopeCode(Scope *sc, Statement **sentry, Statement **sexit, Statement **sfinally);
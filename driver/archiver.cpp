@@ -9,6 +9,7 @@
 
 #include "dmd/errors.h"
 #include "dmd/globals.h"
+#include "driver/archiver.h"
 #include "driver/cl_options.h"
 #include "driver/tool.h"
 #include "gen/logger.h"
@@ -21,6 +22,8 @@
 #include "llvm/Support/Path.h"
 #include "llvm/Support/raw_ostream.h"
 #include <cstring>
+#include <map>
+#include <mutex>
 
 #if LDC_LLVM_VER >= 500
 #include "llvm/ToolDrivers/llvm-lib/LibDriver.h"
@@ -39,6 +42,14 @@ using namespace llvm;
  */
 namespace llvm_ar {
 
+// Object files emitted in memory, see retainArchiveMember().
+struct RetainedMember {
+  std::string name;
+  SmallVector<char, 0> contents;
+};
+std::mutex RetainedMembersMutex;
+std::map<std::string, RetainedMember> RetainedMembers;
+
 StringRef ArchiveName;
 std::vector<const char *> Members;
 
@@ -66,13 +77,28 @@ void fail(Error E, StringRef Context = {}) {
 
 int addMember(std::vector<NewArchiveMember> &Members, StringRef FileName,
               int Pos = -1) {
+  const auto retained = RetainedMembers.find(FileName.str());
+  if (retained != RetainedMembers.end()) {
+    const auto &member = retained->second;
+    NewArchiveMember NM(MemoryBufferRef(
+        StringRef(member.contents.data(), member.contents.size()),
+        member.name));
+    if (Pos == -1)
+      Members.push_back(std::move(NM));
+    else
+      Members[Pos] = std::move(NM);
+    return 0;
+  }
+
   Expected<NewArchiveMember> NMOrErr =
       NewArchiveMember::getFile(FileName, Deterministic);
   failIfError(NMOrErr.takeError(), FileName);
 
 #if LDC_LLVM_VER >= 500
-  // Use the basename of the object path for the member name.
-  NMOrErr->MemberName = sys::path::filename(NMOrErr->MemberName);
+  // Use the basename of the object path for the member name. Thin archives
+  // refer to the object files by their paths.
+  if (!Thin)
+    NMOrErr->MemberName = sys::path::filename(NMOrErr->MemberName);
 #endif
 
   if (Pos == -1)
@@ -225,13 +251,14 @@ namespace {
 
 int internalAr(ArrayRef<const char *> args) {
   if (args.size() < 4 || strcmp(args[0], "llvm-ar") != 0 ||
-      strcmp(args[1], "rcs") != 0) {
+      (strcmp(args[1], "rcs") != 0 && strcmp(args[1], "rcsT") != 0)) {
     llvm_unreachable(
-        "Expected archiver command line: llvm-ar rcs <archive file> "
+        "Expected archiver command line: llvm-ar rcs[T] <archive file> "
         "<object file> ...");
     return -1;
   }
 
+  llvm_ar::Thin = args[1][3] == 'T';
   llvm_ar::ArchiveName = args[2];
 
   auto membersSlice = args.slice(3);
@@ -258,6 +285,11 @@ int internalLib(ArrayRef<const char *> args) {
 static llvm::cl::opt<std::string> ar("ar", llvm::cl::desc("Archiver"),
                                      llvm::cl::Hidden, llvm::cl::ZeroOrMore);
 
+static llvm::cl::opt<bool> libThin(
+    "lib-thin", llvm::cl::ZeroOrMore,
+    llvm::cl::desc("With -lib, create a GNU thin archive referring to the "
+                   "object files instead of containing copies of them"));
+
 int createStaticLibrary() {
   Logger::println("*** Creating static library ***");
 
@@ -282,9 +314,21 @@ int createStaticLibrary() {
   // build arguments
   std::vector<std::string> args;
 
+  if (libThin) {
+    if (isTargetMSVC || global.params.targetTriple->isOSDarwin()) {
+      error(Loc(), "-lib-thin is only supported for GNU archives");
+      return 1;
+    }
+    if (global.params.cleanupObjectFiles) {
+      error(Loc(), "-lib-thin requires the object files to be kept, which "
+                   "-cleanup-obj prevents");
+      return 1;
+    }
+  }
+
   // ask ar to create a new library
   if (!isTargetMSVC) {
-    args.push_back("rcs");
+    args.push_back(libThin ? "rcsT" : "rcs");
   }
 
   // ask lib.exe to be quiet
@@ -352,3 +396,23 @@ int createStaticLibrary() {
   // invoke external archiver
   return executeToolAndWait(tool, args, global.params.verbose);
 }
+
+////////////////////////////////////////////////////////////////////////////////
+
+bool isArchivingObjectsInMemory() {
+  return global.params.lib && !global.params.link && ar.empty() && !libThin &&
+         !global.params.targetTriple->isWindowsMSVCEnvironment();
+}
+
+bool canSkipWritingArchiveMembers() {
+  return isArchivingObjectsInMemory() && global.params.cleanupObjectFiles &&
+         opts::cacheDir.empty();
+}
+
+void retainArchiveMember(llvm::StringRef path,
+                         llvm::SmallVector<char, 0> &&contents) {
+  std::lock_guard<std::mutex> lock(llvm_ar::RetainedMembersMutex);
+  auto &member = llvm_ar::RetainedMembers[path.str()];
+  member.name = sys::path::filename(path).str();
+  member.contents = std::move(contents);
+}
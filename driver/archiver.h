@@ -9,8 +9,31 @@
 
 #pragma once
 
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringRef.h"
+
 /**
  * Create a static library from object files.
  * @return 0 on success.
  */
 int createStaticLibrary();
+
+/**
+ * Returns whether emitted object files are handed to createStaticLibrary() in
+ * memory (-lib with the internal llvm-ar archiver).
+ */
+bool isArchivingObjectsInMemory();
+
+/**
+ * Returns whether object files don't need to be written to disk at all, as
+ * they are only needed as members of the static library (-lib -cleanup-obj
+ * without -cache).
+ */
+bool canSkipWritingArchiveMembers();
+
+/**
+ * Hands the contents of the object file emitted as `path` to
+ * createStaticLibrary(). Thread-safe.
+ */
+void retainArchiveMember(llvm::StringRef path,
+                         llvm::SmallVector<char, 0> &&contents);
@@ -0,0 +1,260 @@
+//===-- batch.cpp ---------------------------------------------------------===//
+//
+//                         LDC – the LLVM D compiler
+//
+// This file is distributed under the BSD-style LDC license. See the LICENSE
+// file for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "driver/batch.h"
+
+#include "dmd/errors.h"
+#include "dmd/globals.h"
+#include "driver/exe_path.h"
+#include "driver/tool.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/Allocator.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/StringSaver.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if LDC_POSIX
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+llvm::cl::list<std::string>
+    batchObjects("batch-object", llvm::cl::ZeroOrMore, llvm::cl::Hidden,
+                 llvm::cl::value_desc("source>=<object"),
+                 llvm::cl::desc("Object file of a root module (--batch)"));
+
+llvm::cl::opt<bool>
+    batchMerged("batch-merged", llvm::cl::ZeroOrMore, llvm::cl::Hidden,
+                llvm::cl::desc("Invocation merged from several jobs (--batch)"));
+
+struct Job {
+  std::vector<std::string> flags;
+  std::vector<std::string> sources;
+  std::string objectFile; // -of, if any
+};
+
+/// Jobs merged into a single compiler invocation.
+struct Invocation {
+  const std::vector<std::string> *flags;
+  std::vector<const Job *> jobs;
+  std::set<std::string> sources;
+};
+
+bool isSourceFile(llvm::StringRef arg) {
+  if (arg.startswith("-"))
+    return false;
+  const auto ext = llvm::sys::path::extension(arg);
+  return ext == ".d" || ext == ".di";
+}
+
+bool parseJob(llvm::StringRef line, unsigned lineNumber, Job &job) {
+  llvm::BumpPtrAllocator allocator;
+  llvm::StringSaver saver(allocator);
+  llvm::SmallVector<const char *, 32> args;
+  llvm::cl::TokenizeGNUCommandLine(line, saver, args);
+
+  for (size_t i = 0; i < args.size(); ++i) {
+    llvm::StringRef arg = args[i];
+    if (isSourceFile(arg)) {
+      job.sources.push_back(arg);
+    } else if (arg == "-of" && i + 1 < args.size()) {
+      job.objectFile = args[++i];
+    } else if (arg.startswith("-of")) {
+      job.objectFile = arg.substr(arg.startswith("-of=") ? 4 : 3);
+    } else {
+      job.flags.push_back(arg);
+    }
+  }
+
+  if (job.sources.empty()) {
+    error(Loc(), "batch job on line %u has no source files", lineNumber);
+    return false;
+  }
+  if (!job.objectFile.empty() && job.sources.size() != 1) {
+    error(Loc(), "batch job on line %u: `-of` requires a single source file",
+          lineNumber);
+    return false;
+  }
+  return true;
+}
+
+bool readJobs(const char *batchFile, std::vector<Job> &jobs) {
+  auto buffer = llvm::MemoryBuffer::getFile(batchFile);
+  if (!buffer) {
+    error(Loc(), "cannot read batch file `%s`", batchFile);
+    return false;
+  }
+
+  llvm::SmallVector<llvm::StringRef, 64> lines;
+  buffer.get()->getBuffer().split(lines, '\n');
+  for (size_t i = 0; i < lines.size(); ++i) {
+    const auto line = lines[i].trim();
+    if (line.empty() || line.startswith("#"))
+      continue;
+    jobs.emplace_back();
+    if (!parseJob(line, i + 1, jobs.back()))
+      return false;
+  }
+  return true;
+}
+
+/// Merges the jobs with the same flags, as long as their source files differ
+/// (a module can only be compiled once per invocation).
+std::vector<Invocation> mergeJobs(const std::vector<Job> &jobs) {
+  std::vector<Invocation> invocations;
+  for (const auto &job : jobs) {
+    Invocation *target = nullptr;
+    for (auto &inv : invocations) {
+      if (*inv.flags != job.flags)
+        continue;
+      bool conflicting = false;
+      for (const auto &s : job.sources)
+        conflicting |= inv.sources.count(s) != 0;
+      if (!conflicting) {
+        target = &inv;
+        break;
+      }
+    }
+    if (!target) {
+      invocations.push_back({&job.flags, {}, {}});
+      target = &invocations.back();
+    }
+    target->jobs.push_back(&job);
+    target->sources.insert(job.sources.begin(), job.sources.end());
+  }
+  return invocations;
+}
+
+/// Returns the arguments (without argv[0]) of a merged invocation.
+std::vector<std::string> getArguments(const Invocation &inv,
+                                      const std::vector<std::string> &common) {
+  std::vector<std::string> args = common;
+  args.push_back("-c");
+  if (inv.jobs.size() > 1)
+    args.push_back("-batch-merged");
+  args.insert(args.end(), inv.flags->begin(), inv.flags->end());
+  for (const Job *job : inv.jobs) {
+    if (!job->objectFile.empty())
+      args.push_back("-batch-object=" + job->sources[0] + "=" +
+                     job->objectFile);
+  }
+  for (const Job *job : inv.jobs)
+    args.insert(args.end(), job->sources.begin(), job->sources.end());
+  return args;
+}
+
+} // anonymous namespace
+
+namespace batch {
+
+const char *getBatchFile(int argc, char **argv) {
+  static const char prefix[] = "--batch=";
+  if (argc < 2)
+    return nullptr;
+  if (strncmp(argv[1], prefix, sizeof(prefix) - 1) == 0)
+    return argv[1] + sizeof(prefix) - 1;
+  if (argc > 2 && strcmp(argv[1], "--batch") == 0)
+    return argv[2];
+  return nullptr;
+}
+
+bool run(const char *batchFile, int &argc, char **&argv, int &status) {
+  status = EXIT_FAILURE;
+
+  std::vector<Job> jobs;
+  if (!readJobs(batchFile, jobs))
+    return false;
+  const auto invocations = mergeJobs(jobs);
+
+  const int firstCommonArg = strcmp(argv[1], "--batch") == 0 ? 3 : 2;
+  const std::vector<std::string> common(argv + firstCommonArg, argv + argc);
+
+  status = EXIT_SUCCESS;
+#if LDC_POSIX
+  const unsigned maxRunning = std::max(1u, std::thread::hardware_concurrency());
+  unsigned running = 0;
+  auto waitForChild = [&]() {
+    int waitStatus;
+    if (wait(&waitStatus) < 0)
+      return;
+    --running;
+    if (!WIFEXITED(waitStatus))
+      status = EXIT_FAILURE;
+    else if (status == EXIT_SUCCESS)
+      status = WEXITSTATUS(waitStatus);
+  };
+
+  for (const auto &inv : invocations) {
+    if (running == maxRunning)
+      waitForChild();
+
+    // The arguments must outlive the returned argv.
+    static std::vector<std::string> args;
+    args = getArguments(inv, common);
+
+    const pid_t pid = fork();
+    if (pid == 0) {
+      static std::vector<char *> childArgv;
+      childArgv.push_back(argv[0]);
+      for (auto &arg : args)
+        childArgv.push_back(&arg[0]);
+      childArgv.push_back(nullptr);
+      argc = static_cast<int>(childArgv.size() - 1);
+      argv = childArgv.data();
+      return true;
+    }
+    if (pid < 0) {
+      error(Loc(), "cannot fork batch job: %s", strerror(errno));
+      status = EXIT_FAILURE;
+      break;
+    }
+    ++running;
+  }
+  while (running)
+    waitForChild();
+#else
+  // Without fork(), run the merged invocations as separate processes.
+  const std::string exe = exe_path::getExePath();
+  for (const auto &inv : invocations) {
+    const int rc = executeToolAndWait(exe, getArguments(inv, common));
+    if (status == EXIT_SUCCESS)
+      status = rc;
+  }
+#endif
+  return false;
+}
+
+bool isMergedInvocation() { return batchMerged; }
+
+} // namespace batch
+
+const char *batchObjectFile(const char *srcfile) {
+  static llvm::StringMap<std::string> objectFiles = [] {
+    llvm::StringMap<std::string> map;
+    for (const auto &mapping : batchObjects) {
+      const auto parts = llvm::StringRef(mapping).split('=');
+      map[parts.first] = parts.second;
+    }
+    return map;
+  }();
+  const auto it = objectFiles.find(srcfile);
+  return it == objectFiles.end() ? nullptr : it->second.c_str();
+}
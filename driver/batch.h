@@ -0,0 +1,42 @@
+//===-- driver/batch.h - Batch compilation ----------------------*- C++ -*-===//
+//
+//                         LDC – the LLVM D compiler
+//
+// This file is distributed under the BSD-style LDC license. See the LICENSE
+// file for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// `ldc2 --batch <file> [<common args>...]` compiles a list of independent
+// separate-compilation jobs, one ldc2 command line per line of the file.
+// Jobs with the same flags (apart from their source files and -of) are merged
+// into a single compiler invocation sharing the imported modules, each root
+// module still getting its own object file. On POSIX systems, these
+// invocations are forked from the batch process after LLVM has been
+// initialized, and run in parallel.
+//
+//===----------------------------------------------------------------------===//
+
+#pragma once
+
+namespace batch {
+
+/// Returns the batch file if argv[1] is `--batch=<file>` or `--batch <file>`.
+const char *getBatchFile(int argc, char **argv);
+
+/// Compiles all jobs of the batch file. Returns true in a forked child, with
+/// `argc`/`argv` set up for the merged invocation to be compiled. Returns
+/// false in the batch process once all jobs have finished, with their combined
+/// exit `status`.
+bool run(const char *batchFile, int &argc, char **&argv, int &status);
+
+/// Returns whether this (child) invocation compiles several merged jobs. Each
+/// root module's object file then gets the template instances of all root
+/// modules, as it would if compiled separately.
+bool isMergedInvocation();
+
+} // namespace batch
+
+/// Returns the object file requested by -of for a root module of a merged
+/// batch job, or null.
+const char *batchObjectFile(const char *srcfile);
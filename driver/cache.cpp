@@ -18,36 +18,77 @@
 // changes that trigger recompilation of many files but with little effective
 // changes (in the extreme case, adding a comment in a "globals.d").
 //
-// The current limitation is that hashing and cache look-up are done with
-// whole-module granularity. Future work could attempt to do this for module
-// "fragments".
+// By default, hashing and cache look-up are done with whole-module
+// granularity. With -cache-fragments=<N>, a module missing in the cache is
+// optimized and then split into <N> fragments (functions and globals are
+// assigned by name hash), which are hashed and cached separately and combined
+// to the final object file. After a small change, only the affected fragments
+// need machine codegen (but the whole module is still optimized).
 //
 // The hash depends on the IR code (obviously), but also on the compiler+LLVM
 // versions and several compile flags (e.g. -O*, -mcpu, and -mattr).
 //
+// With -cache-early-lookup, an additional 'source' hash is computed before IR
+// generation, from the contents of all source files the compilation depends
+// on (all loaded modules and string imports) and the full commandline. On a
+// hit, IR generation is skipped entirely for the module.
+//
+// With -cache-remote=<location>, the local cache directory becomes a
+// read-through cache of a store shared by multiple machines: entries missing
+// locally are looked up remotely, and new entries are uploaded.
+//
+// With -cache-compress, entries are stored zlib-compressed (with a separate
+// file extension). They are decompressed directly into the memory-mapped
+// output file upon recovery, so links to such entries aren't possible.
+//
+// With -cache-link, the linked executable/shared library is cached too (in
+// the local cache directory only). Its hash covers the linker commandline and
+// the contents of all input files; libraries referenced via -l are tracked by
+// size and modification time in the -L directories. Changes of the linker
+// itself and of the system libraries in its default search paths aren't
+// detected.
+//
 //===----------------------------------------------------------------------===//
 
 #include "driver/cache.h"
 
 #include "dmd/errors.h"
+#include "dmd/module.h"
+#include "dmd/root/file.h"
+#include "driver/cache_backend.h"
+#include "driver/cache_hash.h"
 #include "driver/cache_pruning.h"
 #include "driver/cl_options.h"
 #include "driver/cl_options_sanitizers.h"
+#include "driver/exe_path.h"
 #include "driver/ldc-version.h"
+#include "driver/statsfile.h"
+#include "driver/timetrace.h"
+#include "driver/toobj.h"
 #include "gen/logger.h"
 #include "gen/optimizer.h"
 
 #if LDC_LLVM_VER >= 400
-#include "llvm/Bitcode/BitcodeWriter.h"
 #include "llvm/Support/Chrono.h"
 #else
-#include "llvm/Bitcode/ReaderWriter.h"
 #include "llvm/Support/TimeValue.h"
 #endif
+#include "llvm/Support/Compression.h"
+#include "llvm/Support/Endian.h"
+#include "llvm/Support/FileOutputBuffer.h"
 #include "llvm/Support/FileSystem.h"
 #include "llvm/Support/MD5.h"
+#include "llvm/Support/MemoryBuffer.h"
 #include "llvm/Support/Path.h"
+#include "llvm/Support/Program.h"
 #include "llvm/Support/raw_ostream.h"
+#include "llvm/Target/TargetMachine.h"
+#include <atomic>
+#include <cstdlib>
+#include <ctime>
+#include <mutex>
+#include <string>
+#include <vector>
 
 // Include close() declaration.
 #if !defined(_MSC_VER) && !defined(__MINGW32__)
@@ -57,6 +98,7 @@
 #endif
 
 #if LDC_POSIX
+#include <sys/stat.h>
 #include <unistd.h>
 // Returns true upon error.
 static bool createHardLink(const char *to, const char *from) {
@@ -138,6 +180,47 @@ llvm::cl::opt<unsigned> pruneSizeLimitPercentage(
         "Sets the cache size limit to <perc> percent of the available "
         "space (default: 75%). Implies -cache-prune."),
     llvm::cl::value_desc("perc"), llvm::cl::init(75));
+llvm::cl::opt<bool> pruneInBackground(
+    "cache-prune-background", llvm::cl::ZeroOrMore,
+    llvm::cl::desc("Prune the cache in a detached ldc-prune-cache process "
+                   "instead of at the end of the compilation (default: "
+                   "true)"),
+    llvm::cl::init(true));
+
+llvm::cl::opt<unsigned> numModuleFragments(
+    "cache-fragments", llvm::cl::ZeroOrMore, llvm::cl::value_desc("N"),
+    llvm::cl::desc("Cache the object code of modules in <N> separate "
+                   "fragments, so that small changes of big modules only "
+                   "require machine codegen for the affected fragments "
+                   "(default: 0 = whole modules)"),
+    llvm::cl::init(0));
+
+llvm::cl::opt<bool> earlyLookup(
+    "cache-early-lookup", llvm::cl::ZeroOrMore,
+    llvm::cl::desc("Look up modules in the cache before IR generation, based "
+                   "on a hash of all source files and the commandline "
+                   "(experimental)"));
+
+llvm::cl::opt<std::string> remoteLocation(
+    "cache-remote", llvm::cl::ZeroOrMore, llvm::cl::value_desc("location"),
+    llvm::cl::desc("Share the cache via a remote store: a http(s):// URL "
+                   "(GET/PUT via curl) or a shared directory. The -cache "
+                   "directory is used as local read-through cache."));
+
+llvm::cl::opt<bool> cacheLinking(
+    "cache-link", llvm::cl::ZeroOrMore,
+    llvm::cl::desc("Cache the linked executable/shared library too, keyed by "
+                   "the linker commandline and the contents of its input "
+                   "files (experimental)"));
+
+llvm::cl::opt<bool>
+    printStats("cache-stats", llvm::cl::ZeroOrMore,
+               llvm::cl::desc("Print cache hit/miss statistics."));
+
+llvm::cl::opt<bool> compressEntries(
+    "cache-compress", llvm::cl::ZeroOrMore,
+    llvm::cl::desc("Store cache entries zlib-compressed. Implies "
+                   "-cache-retrieval=copy."));
 
 enum class RetrievalMode { Copy, HardLink, AnyLink, SymLink };
 llvm::cl::opt<RetrievalMode> cacheRecoveryMode(
@@ -178,6 +261,140 @@ llvm::sys::TimePoint<std::chrono::seconds> getTimeNow() {
 llvm::sys::TimeValue getTimeNow() { return llvm::sys::TimeValue::now(); }
 #endif
 
+// Cache lookups may happen concurrently (-codegen-threads).
+struct Statistics {
+  std::atomic<unsigned> localHits{0};
+  std::atomic<unsigned> remoteHits{0};
+  std::atomic<unsigned> misses{0};
+  std::atomic<unsigned> uploadFailures{0};
+  std::atomic<uint64_t> bytesDownloaded{0};
+  std::atomic<uint64_t> bytesUploaded{0};
+} stats;
+
+// The individual lookups, for -stats-file.
+struct LookupRecord {
+  std::string hash;
+  const char *result;
+  std::string objectFile; // set upon recovery
+  uint64_t bytesRecovered;
+};
+std::mutex lookupRecordsMutex;
+std::vector<LookupRecord> lookupRecords;
+
+void recordLookup(llvm::StringRef cacheObjectHash, const char *result) {
+  if (!statsfile::isEnabled())
+    return;
+  std::lock_guard<std::mutex> lock(lookupRecordsMutex);
+  lookupRecords.push_back({cacheObjectHash.str(), result, "", 0});
+}
+
+// Appends an access of a cache entry to the journal, so that the pruner
+// (driver/cache_pruning.d) doesn't need to scan the whole cache directory.
+// Single lines are appended atomically by the OS.
+void appendToJournal(llvm::StringRef cacheFile) {
+  if (!isPruningEnabled())
+    return;
+
+  llvm::SmallString<128> journal(opts::cacheDir);
+  llvm::sys::path::append(journal, "ircache_journal");
+
+  const std::string line =
+      (llvm::Twine(static_cast<long long>(std::time(nullptr))) + " " +
+       llvm::Twine(getFileSize(cacheFile)) + " " +
+       llvm::sys::path::filename(cacheFile) + "\n")
+          .str();
+
+  std::error_code errcode;
+  llvm::raw_fd_ostream os(journal, errcode, llvm::sys::fs::F_Append);
+  if (!errcode)
+    os << line;
+}
+
+// Spawns a detached ldc-prune-cache process (if the pruning interval has
+// passed), so that pruning never delays the compilation. Returns false if the
+// tool couldn't be launched.
+bool spawnPruningProcess() {
+  // Don't spawn a process for every compilation; the tool checks the interval
+  // (and takes a lock) again.
+  llvm::SmallString<128> timestampFile(opts::cacheDir);
+  llvm::sys::path::append(timestampFile, "ircache_prune_timestamp");
+  llvm::sys::fs::file_status status;
+  if (pruneInterval > 0 && !llvm::sys::fs::status(timestampFile, status) &&
+      llvm::sys::fs::exists(status)) {
+#if LDC_LLVM_VER >= 400
+    if (getTimeNow() - status.getLastModificationTime() <
+        std::chrono::seconds(pruneInterval.getValue()))
+#else
+    if ((getTimeNow() - status.getLastModificationTime()).seconds() <
+        pruneInterval)
+#endif
+      return true;
+  }
+
+#if _WIN32
+  const std::string tool = exe_path::prependBinDir("ldc-prune-cache.exe");
+#else
+  const std::string tool = exe_path::prependBinDir("ldc-prune-cache");
+#endif
+  if (!llvm::sys::fs::exists(tool))
+    return false;
+
+  const std::vector<std::string> args = {
+      tool,
+      "--interval=" + std::to_string(pruneInterval.getValue()),
+      "--expiry=" + std::to_string(pruneExpiration.getValue()),
+      "--max-bytes=" + std::to_string(pruneSizeLimitInBytes.getValue()),
+      "--max-percentage-of-avail=" +
+          std::to_string(pruneSizeLimitPercentage.getValue()),
+      opts::cacheDir};
+#if LDC_LLVM_VER >= 700
+  std::vector<llvm::StringRef> argv(args.begin(), args.end());
+  auto envVars = llvm::None;
+#else
+  std::vector<const char *> argv;
+  for (const auto &arg : args)
+    argv.push_back(arg.c_str());
+  argv.push_back(nullptr);
+  auto envVars = nullptr;
+#endif
+
+  // Don't inherit the output streams, a build system might wait for them to
+  // be closed.
+#if LDC_LLVM_VER >= 600
+  const llvm::Optional<llvm::StringRef> redirects[] = {
+      llvm::StringRef(""), llvm::StringRef(""), llvm::StringRef("")};
+#else
+  const llvm::StringRef devNull;
+  const llvm::StringRef *redirects[] = {&devNull, &devNull, &devNull};
+#endif
+
+  std::string errstr;
+  bool executionFailed = false;
+  llvm::sys::ExecuteNoWait(tool,
+#if LDC_LLVM_VER >= 700
+                           argv,
+#else
+                           argv.data(),
+#endif
+                           envVars, redirects, 0, &errstr, &executionFailed);
+  IF_LOG Logger::println("Spawned %s for cache pruning %s", tool.c_str(),
+                         errstr.c_str());
+  return !executionFailed;
+}
+
+cache::RemoteBackend *getRemoteBackend() {
+  static std::unique_ptr<cache::RemoteBackend> backend =
+      remoteLocation.empty() ? nullptr
+                             : cache::createRemoteBackend(remoteLocation);
+  return backend.get();
+}
+
+uint64_t getFileSize(llvm::StringRef file) {
+  uint64_t size = 0;
+  llvm::sys::fs::file_size(file, size);
+  return size;
+}
+
 /// A raw_ostream that creates a hash of what is written to it.
 /// This class does not encounter output errors.
 /// There is no buffering and the hasher can be used at any time.
@@ -206,11 +423,225 @@ public:
   }
 };
 
+bool isCompressionEnabled() {
+  if (!compressEntries)
+    return false;
+  if (!llvm::zlib::isAvailable()) {
+    error(Loc(), "-cache-compress requires LLVM to be built with zlib");
+    fatal();
+  }
+  return true;
+}
+
+// The key of a cache entry in the cache directory and remote stores.
+std::string getCacheKey(llvm::StringRef cacheObjectHash) {
+  return ("ircache_" + cacheObjectHash + "." + global.obj_ext +
+          (isCompressionEnabled() ? ".z" : ""))
+      .str();
+}
+
+// Compressed entries start with a header containing the uncompressed size.
+const char compressedMagic[4] = {'L', 'D', 'C', 'Z'};
+const size_t compressedHeaderSize = sizeof(compressedMagic) + sizeof(uint64_t);
+
+// Writes a compressed copy of `inputFile` to `outputFile`. Returns true upon
+// error.
+bool writeCompressedFile(llvm::StringRef inputFile,
+                         llvm::StringRef outputFile) {
+  auto input = llvm::MemoryBuffer::getFile(inputFile);
+  if (!input)
+    return true;
+
+  llvm::SmallVector<char, 0> compressed;
+  compressed.resize(compressedHeaderSize);
+  memcpy(compressed.data(), compressedMagic, sizeof(compressedMagic));
+  llvm::support::endian::write64le(compressed.data() + sizeof(compressedMagic),
+                                   (*input)->getBufferSize());
+
+  llvm::SmallVector<char, 0> data;
+#if LDC_LLVM_VER >= 600
+  if (llvm::Error err = llvm::zlib::compress((*input)->getBuffer(), data)) {
+    llvm::consumeError(std::move(err));
+    return true;
+  }
+#else
+  if (llvm::zlib::compress((*input)->getBuffer(), data) !=
+      llvm::zlib::StatusOK)
+    return true;
+#endif
+  compressed.append(data.begin(), data.end());
+
+  std::error_code errcode;
+  llvm::raw_fd_ostream os(outputFile, errcode, llvm::sys::fs::F_None);
+  if (errcode)
+    return true;
+  os.write(compressed.data(), compressed.size());
+  os.close();
+  return os.has_error();
+}
+
+// Decompresses `inputFile` directly into the memory-mapped `outputFile`.
+// Returns true upon error.
+bool writeDecompressedFile(llvm::StringRef inputFile,
+                           llvm::StringRef outputFile) {
+  auto input = llvm::MemoryBuffer::getFile(inputFile);
+  if (!input)
+    return true;
+  llvm::StringRef buffer = (*input)->getBuffer();
+  if (buffer.size() < compressedHeaderSize ||
+      memcmp(buffer.data(), compressedMagic, sizeof(compressedMagic)) != 0)
+    return true;
+  size_t size = llvm::support::endian::read64le(buffer.data() +
+                                                sizeof(compressedMagic));
+  buffer = buffer.drop_front(compressedHeaderSize);
+
+  auto output = llvm::FileOutputBuffer::create(outputFile, size);
+  if (!output) {
+#if LDC_LLVM_VER >= 600
+    llvm::consumeError(output.takeError());
+#endif
+    return true;
+  }
+  auto outputStart = reinterpret_cast<char *>((*output)->getBufferStart());
+#if LDC_LLVM_VER >= 600
+  if (llvm::Error err = llvm::zlib::uncompress(buffer, outputStart, size)) {
+    llvm::consumeError(std::move(err));
+    return true;
+  }
+  if (llvm::Error err = (*output)->commit()) {
+    llvm::consumeError(std::move(err));
+    return true;
+  }
+  return false;
+#else
+  if (llvm::zlib::uncompress(buffer, outputStart, size) != llvm::zlib::StatusOK)
+    return true;
+  return static_cast<bool>((*output)->commit());
+#endif
+}
+
+// The cache entries are spread over 256 subdirectories named after the first
+// two hash digits, so that no single directory gets huge and the pruner can
+// scan them in parallel (see driver/cache_pruning.d).
 void storeCacheFileName(llvm::StringRef cacheObjectHash,
                         llvm::SmallString<128> &filePath) {
   filePath = opts::cacheDir;
-  llvm::sys::path::append(filePath, llvm::Twine("ircache_") + cacheObjectHash +
-                                        "." + global.obj_ext);
+  llvm::sys::path::append(filePath, cacheObjectHash.substr(0, 2),
+                          getCacheKey(cacheObjectHash));
+}
+
+// Linked binaries are stored next to the object files, uncompressed.
+void storeLinkCacheFileName(llvm::StringRef cacheLinkHash,
+                            llvm::SmallString<128> &filePath) {
+  filePath = opts::cacheDir;
+  llvm::sys::path::append(filePath, cacheLinkHash.substr(0, 2),
+                          "ircache_" + cacheLinkHash + ".bin");
+}
+
+// Copies the file permissions (e.g., the executable bit of a linked binary),
+// which llvm::sys::fs::copy_file() doesn't preserve.
+void copyPermissions(llvm::StringRef from, llvm::StringRef to) {
+#if LDC_POSIX
+  llvm::sys::fs::file_status status;
+  if (!llvm::sys::fs::status(from, status))
+    chmod(to.str().c_str(), status.permissions());
+#endif
+}
+
+// Resets the modification and access times of a cache file to "now", so that
+// the pruning algorithm sees that the file should be kept over older files.
+bool touchCacheFile(const llvm::SmallString<128> &cacheFile) {
+  int FD;
+  if (llvm::sys::fs::openFileForWrite(cacheFile.c_str(), FD,
+#if LDC_LLVM_VER >= 700
+                                      llvm::sys::fs::CD_OpenExisting,
+#endif
+                                      llvm::sys::fs::F_Append)) {
+    writeModuleError("Failed to open the cached file for writing: %s",
+                     cacheFile.c_str());
+    return false;
+  }
+
+#if LDC_LLVM_VER < 800
+#define SET_LAST_ACCESS_AND_MOD_TIME setLastModificationAndAccessTime
+#else
+#define SET_LAST_ACCESS_AND_MOD_TIME setLastAccessAndModificationTime
+#endif
+
+  if (llvm::sys::fs::SET_LAST_ACCESS_AND_MOD_TIME(FD, getTimeNow())) {
+    writeModuleError("Failed to set the cached file modification time: %s",
+                     cacheFile.c_str());
+    close(FD);
+    return false;
+  }
+
+  close(FD);
+  return true;
+}
+
+uint64_t getModificationTime(const llvm::sys::fs::file_status &status) {
+#if LDC_LLVM_VER >= 400
+  return status.getLastModificationTime().time_since_epoch().count();
+#else
+  return status.getLastModificationTime().toEpochTime();
+#endif
+}
+
+// Output to `hash_os` the size and modification time of the library files
+// the linker may pick for `-l<name>` in the given search directories.
+void outputLinkLibraryStatus(llvm::raw_ostream &hash_os, llvm::StringRef name,
+                             llvm::ArrayRef<llvm::StringRef> libDirs) {
+  std::vector<std::string> fileNames;
+  if (name.startswith(":")) {
+    fileNames.push_back(name.drop_front(1));
+  } else {
+    for (const char *ext : {".so", ".a", ".dylib", ".tbd"})
+      fileNames.push_back(("lib" + name + ext).str());
+  }
+
+  for (const auto dir : libDirs) {
+    for (const auto &fileName : fileNames) {
+      llvm::SmallString<128> path(dir);
+      llvm::sys::path::append(path, fileName);
+      llvm::sys::fs::file_status status;
+      if (!llvm::sys::fs::status(path, status)) {
+        hash_os << path << '\0' << status.getSize() << '\0'
+                << getModificationTime(status) << '\0';
+      }
+    }
+  }
+}
+
+// Downloads the entry from the remote store (if any) into the local cache
+// directory. Returns true if found.
+bool fetchRemoteObjectFile(llvm::StringRef cacheObjectHash,
+                           llvm::StringRef cacheFile) {
+  auto backend = getRemoteBackend();
+  if (!backend)
+    return false;
+
+  const auto shardDir = llvm::sys::path::parent_path(cacheFile);
+  if (!llvm::sys::fs::exists(shardDir) &&
+      llvm::sys::fs::create_directories(shardDir))
+    return false;
+
+  // Add the file to the local cache atomically, see cacheObjectFile().
+  llvm::SmallString<128> tempFile;
+  if (llvm::sys::fs::createUniqueFile(llvm::Twine(cacheFile) + ".tmp%%%%%%%",
+                                      tempFile))
+    return false;
+  if (!backend->fetch(getCacheKey(cacheObjectHash), tempFile)) {
+    llvm::sys::fs::remove(tempFile);
+    return false;
+  }
+
+  const uint64_t size = getFileSize(tempFile);
+  if (llvm::sys::fs::rename(tempFile, cacheFile)) {
+    llvm::sys::fs::remove(tempFile);
+    return false;
+  }
+  stats.bytesDownloaded += size;
+  return true;
 }
 
 // Output to `hash_os` all commandline flags, and try to skip the ones that have
@@ -220,6 +651,82 @@ void storeCacheFileName(llvm::StringRef cacheObjectHash,
 // default settings between compiler versions are already taken care of.
 // (Note: config and response files may also add compiler flags.)
 void outputIR2ObjRelevantCmdlineArgs(llvm::raw_ostream &hash_os) {
+  cache::forEachIR2ObjRelevantCmdlineArg(
+      [&](const char *arg) { hash_os << arg; });
+
+  // Adding these options to the hash should not be needed after adding all
+  // cmdline args. We keep this code here however, in case we find a different
+  // solution for dealing with LLVM commandline flags. See GH #1773.
+  // Also, having these options explicitly added to the hash protects against
+  // the possibility of different default settings on different platforms (while
+  // sharing the cache).
+  outputOptimizationSettings(hash_os);
+  opts::outputSanitizerSettings(hash_os);
+  hash_os << opts::getCPUStr();
+  hash_os << opts::getFeaturesStr();
+  hash_os << opts::floatABI;
+  const auto relocModel = opts::getRelocModel();
+  if (relocModel.hasValue())
+    hash_os << relocModel.getValue();
+#if LDC_LLVM_VER >= 600
+  const auto codeModel = opts::getCodeModel();
+  if (codeModel.hasValue())
+    hash_os << codeModel.getValue();
+#else
+  hash_os << opts::getCodeModel();
+#endif
+#if LDC_LLVM_VER >= 900
+  const auto framePointerUsage = opts::framePointerUsage();
+  if (framePointerUsage.hasValue())
+    hash_os << framePointerUsage.getValue();
+#else
+  hash_os << opts::disableFPElim();
+#endif
+}
+
+// Output to `hash_os` all commandline flags, except for the ones that only
+// affect output file names and verbosity. Used for the source hash, which
+// cannot rely on the IR to capture the effects of e.g. -d-version.
+void outputAllCodegenRelevantCmdlineArgs(llvm::raw_ostream &hash_os) {
+  for (size_t i = 1; i < opts::allArguments.size(); ++i) {
+    const char *arg = opts::allArguments[i];
+    if (!arg || !arg[0])
+      continue;
+    if (arg[0] == '-') {
+      if (strncmp(arg + 1, "of", 2) == 0 || strncmp(arg + 1, "od", 2) == 0 ||
+          strncmp(arg + 1, "cache", 5) == 0 || strcmp(arg + 1, "c") == 0 ||
+          strcmp(arg + 1, "v") == 0 || strcmp(arg + 1, "vv") == 0)
+        continue;
+      if (strcmp(arg + 1, "run") == 0)
+        break;
+    }
+    hash_os << arg << '\0';
+  }
+  outputIR2ObjRelevantCmdlineArgs(hash_os);
+}
+
+// Output the contents of the given file to `hash_os`. Returns false if the
+// file cannot be read.
+bool outputFileContents(llvm::raw_ostream &hash_os, const char *filename) {
+  auto buffer = llvm::MemoryBuffer::getFile(filename);
+  if (!buffer)
+    return false;
+  hash_os << filename << '\0' << (*buffer)->getBuffer();
+  return true;
+}
+
+// Output to `hash_os` all environment flags that influence object code output
+// in ways that are not observable in the pre-LLVM passes IR used for hashing.
+void outputIR2ObjRelevantEnvironmentOpts(llvm::raw_ostream &hash_os) {
+  // There are no relevant environment options at the moment.
+}
+
+} // anonymous namespace
+
+namespace cache {
+
+void forEachIR2ObjRelevantCmdlineArg(
+    llvm::function_ref<void(const char *)> callback) {
   // Use a "whitelist" of cmdline args that do not need to be added to the hash,
   // and add all others. There is no harm (other than missed cache
   // opportunities) in adding commandline arguments that also change the hashed
@@ -270,8 +777,9 @@ void outputIR2ObjRelevantCmdlineArgs(llvm::raw_ostream &hash_os) {
       // "-od..." can be ignored
       if (arg[1] == 'o' && arg[2] == 'd')
         continue;
-      // All  "-cache..." options can be ignored
-      if (strncmp(arg + 1, "cache", 5) == 0)
+      // All  "-cache..." and "-remote-codegen..." options can be ignored
+      if (strncmp(arg + 1, "cache", 5) == 0 ||
+          strncmp(arg + 1, "remote-codegen", 14) == 0)
         continue;
       // Ignore "-lib"
       if (arg[1] == 'l' && arg[2] == 'i' && arg[3] == 'b' && !arg[4])
@@ -290,217 +798,407 @@ void outputIR2ObjRelevantCmdlineArgs(llvm::raw_ostream &hash_os) {
       }
     }
 
-    // If we reach here, add the argument to the hash.
-    hash_os << arg;
+    // If we reach here, the argument is relevant.
+    callback(arg);
   }
-
-  // Adding these options to the hash should not be needed after adding all
-  // cmdline args. We keep this code here however, in case we find a different
-  // solution for dealing with LLVM commandline flags. See GH #1773.
-  // Also, having these options explicitly added to the hash protects against
-  // the possibility of different default settings on different platforms (while
-  // sharing the cache).
-  outputOptimizationSettings(hash_os);
-  opts::outputSanitizerSettings(hash_os);
-  hash_os << opts::getCPUStr();
-  hash_os << opts::getFeaturesStr();
-  hash_os << opts::floatABI;
-  const auto relocModel = opts::getRelocModel();
-  if (relocModel.hasValue())
-    hash_os << relocModel.getValue();
-#if LDC_LLVM_VER >= 600
-  const auto codeModel = opts::getCodeModel();
-  if (codeModel.hasValue())
-    hash_os << codeModel.getValue();
-#else
-  hash_os << opts::getCodeModel();
-#endif
-#if LDC_LLVM_VER >= 900
-  const auto framePointerUsage = opts::framePointerUsage();
-  if (framePointerUsage.hasValue())
-    hash_os << framePointerUsage.getValue();
-#else
-  hash_os << opts::disableFPElim();
-#endif
 }
 
-// Output to `hash_os` all environment flags that influence object code output
-// in ways that are not observable in the pre-LLVM passes IR used for hashing.
-void outputIR2ObjRelevantEnvironmentOpts(llvm::raw_ostream &hash_os) {
-  // There are no relevant environment options at the moment.
-}
-
-} // anonymous namespace
-
-namespace cache {
-
-void calculateModuleHash(llvm::Module *m, llvm::SmallString<32> &str) {
+void calculateModuleHash(llvm::Module *m, const llvm::TargetMachine &target,
+                         llvm::SmallString<32> &str) {
   raw_hash_ostream hash_os;
 
   // Let hash depend on the compiler version:
   hash_os << global.ldc_version << global.version << global.llvm_version
           << ldc::built_with_Dcompiler_version;
 
+  // The DCompute targets share the commandline, but differ in their target
+  // machines (e.g., the CUDA target's sm_ version is only its CPU).
+  hash_os << target.getTargetTriple().str() << '\0' << target.getTargetCPU()
+          << '\0' << target.getTargetFeatureString() << '\0';
+
   // Let hash depend on compile flags that change the outputted obj file,
   // but whose changes are not always observable in the pre-optimized IR used
   // for hashing:
   outputIR2ObjRelevantCmdlineArgs(hash_os);
   outputIR2ObjRelevantEnvironmentOpts(hash_os);
 
-#if LDC_LLVM_VER >= 700
-  llvm::WriteBitcodeToFile(*m, hash_os);
-#else
-  llvm::WriteBitcodeToFile(m, hash_os);
-#endif
+  // Hash the IR structurally, serializing it to bitcode would be a lot slower.
+  hash_os << "structural IR hash";
+  hashModuleStructurally(*m, hash_os);
+  hash_os.resultAsString(str);
+  IF_LOG Logger::println("Module's LLVM IR hash is: %s", str.c_str());
+}
+
+bool isEarlyLookupEnabled() { return !opts::cacheDir.empty() && earlyLookup; }
+
+bool calculateSourcesHash(llvm::SmallString<32> &str) {
+  raw_hash_ostream hash_os;
+
+  // Distinguish from IR hashes.
+  hash_os << "source hash";
+  hash_os << global.ldc_version << global.version << global.llvm_version
+          << ldc::built_with_Dcompiler_version;
+
+  outputAllCodegenRelevantCmdlineArgs(hash_os);
+  outputIR2ObjRelevantEnvironmentOpts(hash_os);
+
+  // A module's object code may also depend on all other loaded modules
+  // (e.g., which module a template instance is emitted into).
+  for (Module *other : Module::amodules) {
+    if (!outputFileContents(hash_os, other->srcfile->toChars()))
+      return false;
+    for (const char *file : other->contentImportedFiles) {
+      if (!outputFileContents(hash_os, file))
+        return false;
+    }
+  }
+
   hash_os.resultAsString(str);
-  IF_LOG Logger::println("Module's LLVM bitcode hash is: %s", str.c_str());
+  IF_LOG Logger::println("Sources hash is: %s", str.c_str());
+  return true;
 }
 
-std::string cacheLookup(llvm::StringRef cacheObjectHash) {
+void calculateModuleSourceHash(Module *m, llvm::StringRef sourcesHash,
+                               llvm::SmallString<32> &str) {
+  raw_hash_ostream hash_os;
+  hash_os << sourcesHash << m->srcfile->toChars() << '\0';
+  hash_os.resultAsString(str);
+  IF_LOG Logger::println("Module's source hash is: %s", str.c_str());
+}
+
+void setupRemoteBackend() { getRemoteBackend(); }
+
+std::string cacheLookup(llvm::StringRef cacheObjectHash, bool countMiss) {
   if (opts::cacheDir.empty())
     return "";
 
-  if (!llvm::sys::fs::exists(opts::cacheDir)) {
-    IF_LOG Logger::println("Cache directory does not exist, no object found.");
-    return "";
-  }
+  timetrace::Scope timeScope("Cache lookup", cacheObjectHash);
 
   llvm::SmallString<128> filePath;
   storeCacheFileName(cacheObjectHash, filePath);
-  if (llvm::sys::fs::exists(filePath.c_str())) {
+
+  if (!llvm::sys::fs::exists(opts::cacheDir)) {
+    IF_LOG Logger::println("Cache directory does not exist, no object found.");
+  } else if (llvm::sys::fs::exists(filePath.c_str())) {
     IF_LOG Logger::println("Cache object found! %s", filePath.c_str());
+    ++stats.localHits;
+    recordLookup(cacheObjectHash, "local hit");
+    appendToJournal(filePath);
+    return filePath.str().str();
+  }
+
+  if (fetchRemoteObjectFile(cacheObjectHash, filePath)) {
+    IF_LOG Logger::println("Cache object found in remote store! %s",
+                           filePath.c_str());
+    ++stats.remoteHits;
+    recordLookup(cacheObjectHash, "remote hit");
+    appendToJournal(filePath);
     return filePath.str().str();
   }
 
   IF_LOG Logger::println("Cache object not found.");
+  if (countMiss)
+    ++stats.misses;
+  recordLookup(cacheObjectHash, "miss");
   return "";
 }
 
-void cacheObjectFile(llvm::StringRef objectFile,
+bool cacheObjectFile(llvm::StringRef objectFile,
                      llvm::StringRef cacheObjectHash) {
   if (opts::cacheDir.empty())
-    return;
+    return true;
 
-  if (!llvm::sys::fs::exists(opts::cacheDir) &&
-      llvm::sys::fs::create_directories(opts::cacheDir)) {
-    error(Loc(), "Unable to create cache directory: %s",
-          opts::cacheDir.c_str());
-    fatal();
+  llvm::SmallString<128> cacheFile;
+  storeCacheFileName(cacheObjectHash, cacheFile);
+
+  const auto shardDir = llvm::sys::path::parent_path(cacheFile);
+  if (!llvm::sys::fs::exists(shardDir) &&
+      llvm::sys::fs::create_directories(shardDir)) {
+    writeModuleError("Unable to create cache directory: %s",
+                     shardDir.str().c_str());
+    return false;
   }
 
   // To prevent bad cache files, add files to the cache atomically: first copy
   // to a temporary file and then rename that temp file to the cache entry
   // filename (rename is atomic).
 
-  llvm::SmallString<128> cacheFile;
-  storeCacheFileName(cacheObjectHash, cacheFile);
-
   llvm::SmallString<128> tempFile;
   if (llvm::sys::fs::createUniqueFile(llvm::Twine(cacheFile) + ".tmp%%%%%%%",
                                       tempFile)) {
-    error(Loc(), "Could not create name of temporary file in the cache.");
-    fatal();
+    writeModuleError("Could not create name of temporary file in the cache.");
+    return false;
   }
 
-  IF_LOG Logger::println("Copy object file to temp file: %s to %s",
-                         objectFile.str().c_str(), tempFile.c_str());
-  if (llvm::sys::fs::copy_file(objectFile, tempFile.c_str())) {
-    error(Loc(), "Failed to copy object file to cache: %s to %s",
-          objectFile.str().c_str(), tempFile.c_str());
-    fatal();
+  if (isCompressionEnabled()) {
+    IF_LOG Logger::println("Compress object file to temp file: %s to %s",
+                           objectFile.str().c_str(), tempFile.c_str());
+    if (writeCompressedFile(objectFile, tempFile)) {
+      writeModuleError("Failed to compress object file to cache: %s to %s",
+                       objectFile.str().c_str(), tempFile.c_str());
+      return false;
+    }
+  } else {
+    IF_LOG Logger::println("Copy object file to temp file: %s to %s",
+                           objectFile.str().c_str(), tempFile.c_str());
+    if (llvm::sys::fs::copy_file(objectFile, tempFile.c_str())) {
+      writeModuleError("Failed to copy object file to cache: %s to %s",
+                       objectFile.str().c_str(), tempFile.c_str());
+      return false;
+    }
   }
   IF_LOG Logger::println("Rename temp file to cache file: %s to %s",
                          tempFile.c_str(), cacheFile.c_str());
   if (llvm::sys::fs::rename(tempFile.c_str(), cacheFile.c_str())) {
-    error(Loc(), "Failed to rename temp file to cache file: %s to %s",
-          tempFile.c_str(), cacheFile.c_str());
-    fatal();
+    writeModuleError("Failed to rename temp file to cache file: %s to %s",
+                     tempFile.c_str(), cacheFile.c_str());
+    return false;
+  }
+  appendToJournal(cacheFile);
+
+  // A failing upload only costs other machines a rebuild, so don't error out.
+  if (auto backend = getRemoteBackend()) {
+    IF_LOG Logger::println("Upload cache file to remote store: %s",
+                           cacheFile.c_str());
+    if (backend->store(getCacheKey(cacheObjectHash), cacheFile)) {
+      stats.bytesUploaded += getFileSize(cacheFile);
+    } else {
+      IF_LOG Logger::println("Upload failed.");
+      ++stats.uploadFailures;
+    }
   }
+  return true;
 }
 
-void recoverObjectFile(llvm::StringRef cacheObjectHash,
+bool recoverObjectFile(llvm::StringRef cacheObjectHash,
                        llvm::StringRef objectFile) {
   llvm::SmallString<128> cacheFile;
   storeCacheFileName(cacheObjectHash, cacheFile);
 
+  if (statsfile::isEnabled()) {
+    std::lock_guard<std::mutex> lock(lookupRecordsMutex);
+    for (auto it = lookupRecords.rbegin(); it != lookupRecords.rend(); ++it) {
+      if (it->hash == cacheObjectHash) {
+        it->objectFile = objectFile.str();
+        it->bytesRecovered = getFileSize(cacheFile);
+        break;
+      }
+    }
+  }
+
   // Remove the potentially pre-existing output file.
   llvm::sys::fs::remove(objectFile);
 
-  switch (cacheRecoveryMode) {
-  case RetrievalMode::Copy: {
-    IF_LOG Logger::println("Copy cached object file: %s -> %s",
+  if (isCompressionEnabled()) {
+    IF_LOG Logger::println("Decompress cached object file: %s -> %s",
                            cacheFile.c_str(), objectFile.str().c_str());
-    if (llvm::sys::fs::copy_file(cacheFile.c_str(), objectFile)) {
-      error(Loc(), "Failed to copy the cached file: %s -> %s",
-            cacheFile.c_str(), objectFile.str().c_str());
-      fatal();
-    }
-  } break;
-  case RetrievalMode::HardLink: {
-    IF_LOG Logger::println("HardLink output to cached object file: %s -> %s",
-                           objectFile.str().c_str(), cacheFile.c_str());
-    if (createHardLink(cacheFile.c_str(), objectFile.str().c_str())) {
-      error(Loc(), "Failed to create a hard link to the cached file: %s -> %s",
-            cacheFile.c_str(), objectFile.str().c_str());
-      fatal();
+    if (writeDecompressedFile(cacheFile, objectFile)) {
+      writeModuleError("Failed to decompress the cached file: %s -> %s",
+                       cacheFile.c_str(), objectFile.str().c_str());
+      return false;
     }
-  } break;
-  case RetrievalMode::AnyLink: {
-    IF_LOG Logger::println("Link output to cached object file: %s -> %s",
-                           objectFile.str().c_str(), cacheFile.c_str());
-    if (llvm::sys::fs::create_link(cacheFile.c_str(), objectFile)) {
-      error(Loc(), "Failed to create a link to the cached file: %s -> %s",
+  } else {
+    switch (cacheRecoveryMode) {
+    case RetrievalMode::Copy: {
+      IF_LOG Logger::println("Copy cached object file: %s -> %s",
+                             cacheFile.c_str(), objectFile.str().c_str());
+      if (llvm::sys::fs::copy_file(cacheFile.c_str(), objectFile)) {
+        writeModuleError("Failed to copy the cached file: %s -> %s",
+                         cacheFile.c_str(), objectFile.str().c_str());
+        return false;
+      }
+    } break;
+    case RetrievalMode::HardLink: {
+      IF_LOG Logger::println("HardLink output to cached object file: %s -> %s",
+                             objectFile.str().c_str(), cacheFile.c_str());
+      if (createHardLink(cacheFile.c_str(), objectFile.str().c_str())) {
+        writeModuleError(
+            "Failed to create a hard link to the cached file: %s -> %s",
             cacheFile.c_str(), objectFile.str().c_str());
-      fatal();
-    }
-  } break;
-  case RetrievalMode::SymLink: {
-    IF_LOG Logger::println("SymLink output to cached object file: %s -> %s",
-                           objectFile.str().c_str(), cacheFile.c_str());
-    if (createSymLink(cacheFile.c_str(), objectFile.str().c_str())) {
-      error(Loc(),
+        return false;
+      }
+    } break;
+    case RetrievalMode::AnyLink: {
+      IF_LOG Logger::println("Link output to cached object file: %s -> %s",
+                             objectFile.str().c_str(), cacheFile.c_str());
+      if (llvm::sys::fs::create_link(cacheFile.c_str(), objectFile)) {
+        writeModuleError("Failed to create a link to the cached file: %s -> %s",
+                         cacheFile.c_str(), objectFile.str().c_str());
+        return false;
+      }
+    } break;
+    case RetrievalMode::SymLink: {
+      IF_LOG Logger::println("SymLink output to cached object file: %s -> %s",
+                             objectFile.str().c_str(), cacheFile.c_str());
+      if (createSymLink(cacheFile.c_str(), objectFile.str().c_str())) {
+        writeModuleError(
             "Failed to create a symbolic link to the cached file: %s -> %s",
             cacheFile.c_str(), objectFile.str().c_str());
-      fatal();
+        return false;
+      }
+    } break;
     }
-  } break;
   }
 
-  // We reset the modification time to "now" such that the pruning algorithm
-  // sees that the file should be kept over older files.
   // On some systems the last accessed time is not automatically updated so set
   // it explicitly here. Because the file will really only be accessed later
   // during linking, it's not perfect but it's the best we can do.
-  {
-    int FD;
-    if (llvm::sys::fs::openFileForWrite(cacheFile.c_str(), FD,
-#if LDC_LLVM_VER >= 700
-                                        llvm::sys::fs::CD_OpenExisting,
-#endif
-                                        llvm::sys::fs::F_Append)) {
-      error(Loc(), "Failed to open the cached file for writing: %s",
-            cacheFile.c_str());
-      fatal();
-    }
+  return touchCacheFile(cacheFile);
+}
 
-#if LDC_LLVM_VER < 800
-#define SET_LAST_ACCESS_AND_MOD_TIME setLastModificationAndAccessTime
-#else
-#define SET_LAST_ACCESS_AND_MOD_TIME setLastAccessAndModificationTime
-#endif
+bool isLinkCacheEnabled() { return !opts::cacheDir.empty() && cacheLinking; }
+
+bool calculateLinkHash(llvm::StringRef linker,
+                       llvm::ArrayRef<std::string> args,
+                       llvm::StringRef outputFile, llvm::SmallString<32> &str) {
+  timetrace::Scope timeScope("Link hash", outputFile);
+
+  raw_hash_ostream hash_os;
 
-    if (llvm::sys::fs::SET_LAST_ACCESS_AND_MOD_TIME(FD, getTimeNow())) {
-      error(Loc(), "Failed to set the cached file modification time: %s",
-            cacheFile.c_str());
-      fatal();
+  // Distinguish from IR hashes.
+  hash_os << "link hash";
+  hash_os << global.ldc_version << global.version << global.llvm_version
+          << ldc::built_with_Dcompiler_version;
+  hash_os << linker << '\0';
+  if (const char *libraryPath = getenv("LIBRARY_PATH"))
+    hash_os << libraryPath;
+  hash_os << '\0';
+
+  std::vector<llvm::StringRef> libDirs;
+  for (llvm::StringRef arg : args) {
+    if (arg.size() > 2 && arg.startswith("-L"))
+      libDirs.push_back(arg.drop_front(2));
+  }
+
+  for (const auto &arg : args) {
+    // The binary can be recovered to another path, and must not be hashed
+    // when overwriting it.
+    if (arg == outputFile)
+      continue;
+    hash_os << arg << '\0';
+    if (arg.size() > 2 && arg[0] == '-' && arg[1] == 'l') {
+      outputLinkLibraryStatus(hash_os, llvm::StringRef(arg).drop_front(2),
+                              libDirs);
+    } else if (arg[0] != '-' && llvm::sys::fs::is_regular_file(arg)) {
+      // object file, static library etc.
+      if (!outputFileContents(hash_os, arg.c_str()))
+        return false;
     }
+  }
 
-    close(FD);
+  hash_os.resultAsString(str);
+  IF_LOG Logger::println("Link hash is: %s", str.c_str());
+  return true;
+}
+
+bool recoverLinkedBinary(llvm::StringRef cacheLinkHash,
+                         llvm::StringRef outputFile) {
+  llvm::SmallString<128> cacheFile;
+  storeLinkCacheFileName(cacheLinkHash, cacheFile);
+  if (!llvm::sys::fs::exists(cacheFile)) {
+    IF_LOG Logger::println("Linked binary not found in cache.");
+    return false;
+  }
+
+  // Always copy, as links to the cache entry could be modified in-place by
+  // later (non-cached) links.
+  IF_LOG Logger::println("Copy cached binary: %s -> %s", cacheFile.c_str(),
+                         outputFile.str().c_str());
+  llvm::sys::fs::remove(outputFile);
+  if (llvm::sys::fs::copy_file(cacheFile.c_str(), outputFile)) {
+    error(Loc(), "Failed to copy the cached file: %s -> %s", cacheFile.c_str(),
+          outputFile.str().c_str());
+    fatal();
+  }
+  copyPermissions(cacheFile, outputFile);
+
+  appendToJournal(cacheFile);
+  if (!touchCacheFile(cacheFile))
+    fatal();
+  return true;
+}
+
+void cacheLinkedBinary(llvm::StringRef outputFile,
+                       llvm::StringRef cacheLinkHash) {
+  // Failing to cache the binary only costs a later relink, so don't error
+  // out.
+  llvm::SmallString<128> cacheFile;
+  storeLinkCacheFileName(cacheLinkHash, cacheFile);
+
+  const auto shardDir = llvm::sys::path::parent_path(cacheFile);
+  if (!llvm::sys::fs::exists(shardDir) &&
+      llvm::sys::fs::create_directories(shardDir))
+    return;
+
+  // Add the file atomically, see cacheObjectFile().
+  llvm::SmallString<128> tempFile;
+  if (llvm::sys::fs::createUniqueFile(llvm::Twine(cacheFile) + ".tmp%%%%%%%",
+                                      tempFile))
+    return;
+  IF_LOG Logger::println("Copy linked binary to cache: %s -> %s",
+                         outputFile.str().c_str(), cacheFile.c_str());
+  if (llvm::sys::fs::copy_file(outputFile, tempFile.c_str())) {
+    llvm::sys::fs::remove(tempFile);
+    return;
+  }
+  copyPermissions(outputFile, tempFile);
+  if (llvm::sys::fs::rename(tempFile.c_str(), cacheFile.c_str())) {
+    llvm::sys::fs::remove(tempFile);
+    return;
+  }
+  appendToJournal(cacheFile);
+}
+
+unsigned getNumModuleFragments() { return numModuleFragments; }
+
+void printStatistics() {
+  if (opts::cacheDir.empty() || !printStats)
+    return;
+
+  message("cache     %u local hits, %u remote hits, %u misses",
+          stats.localHits.load(), stats.remoteHits.load(),
+          stats.misses.load());
+  if (getRemoteBackend()) {
+    message("cache     %llu bytes downloaded, %llu bytes uploaded, %u failed "
+            "uploads",
+            static_cast<unsigned long long>(stats.bytesDownloaded.load()),
+            static_cast<unsigned long long>(stats.bytesUploaded.load()),
+            stats.uploadFailures.load());
+  }
+}
+
+void writeStatisticsJSON(llvm::raw_ostream &os) {
+  os << "{\"localHits\": " << stats.localHits.load()
+     << ", \"remoteHits\": " << stats.remoteHits.load()
+     << ", \"misses\": " << stats.misses.load()
+     << ", \"bytesDownloaded\": " << stats.bytesDownloaded.load()
+     << ", \"bytesUploaded\": " << stats.bytesUploaded.load()
+     << ", \"uploadFailures\": " << stats.uploadFailures.load()
+     << ",\n  \"lookups\": [";
+
+  std::lock_guard<std::mutex> lock(lookupRecordsMutex);
+  bool first = true;
+  for (const auto &record : lookupRecords) {
+    os << (first ? "\n    " : ",\n    ");
+    first = false;
+    os << "{\"hash\": ";
+    statsfile::writeJSONString(os, record.hash);
+    os << ", \"result\": ";
+    statsfile::writeJSONString(os, record.result);
+    if (!record.objectFile.empty()) {
+      os << ", \"objectFile\": ";
+      statsfile::writeJSONString(os, record.objectFile);
+      os << ", \"bytesRecovered\": " << record.bytesRecovered;
+    }
+    os << "}";
   }
+  os << "]}";
 }
 
 void pruneCache() {
   if (!opts::cacheDir.empty() && isPruningEnabled()) {
+    if (pruneInBackground && spawnPruningProcess())
+      return;
     ::pruneCache(opts::cacheDir.data(), opts::cacheDir.size(), pruneInterval,
                  pruneExpiration, pruneSizeLimitInBytes,
                  pruneSizeLimitPercentage);
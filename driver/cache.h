@@ -9,23 +9,91 @@
 
 #pragma once
 
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/STLExtras.h"
 #include <string>
 
+class Module;
+
 namespace llvm {
 class Module;
+class raw_ostream;
 class StringRef;
+class TargetMachine;
 template <unsigned> class SmallString;
 }
 
 namespace cache {
 
-void calculateModuleHash(llvm::Module *m, llvm::SmallString<32> &str);
-std::string cacheLookup(llvm::StringRef cacheObjectHash);
-void cacheObjectFile(llvm::StringRef objectFile,
+/// Calculates the IR-to-object cache key of a module to be compiled by
+/// `target` (which is not always implied by the commandline, e.g., for the
+/// DCompute targets).
+void calculateModuleHash(llvm::Module *m, const llvm::TargetMachine &target,
+                         llvm::SmallString<32> &str);
+
+/// Returns whether cache lookups before IR generation are enabled
+/// (-cache-early-lookup).
+bool isEarlyLookupEnabled();
+
+/// Hashes the contents of all source files the compilation depends on and the
+/// commandline. Returns false if some source file couldn't be read.
+bool calculateSourcesHash(llvm::SmallString<32> &str);
+
+/// Calculates the pre-IR-generation cache key for a D module from the hash
+/// returned by calculateSourcesHash().
+void calculateModuleSourceHash(Module *m, llvm::StringRef sourcesHash,
+                               llvm::SmallString<32> &str);
+
+/// Calls `callback` for each commandline argument which may affect the object
+/// code generated from a module's IR, except for the -O switches. Non-option
+/// arguments (e.g. source files) are included too, as they may be values of
+/// the preceding option.
+void forEachIR2ObjRelevantCmdlineArg(
+    llvm::function_ref<void(const char *)> callback);
+
+/// Sets up the -cache-remote store (if any). To be called on the main thread
+/// before any worker threads access the cache, as it may emit a warning.
+void setupRemoteBackend();
+
+/// A miss is only counted in the statistics if `countMiss` is set, so that a
+/// miss of the early lookup followed by the IR-based one of the same module
+/// is counted once.
+std::string cacheLookup(llvm::StringRef cacheObjectHash, bool countMiss = true);
+/// These return false (after reporting an error via writeModuleError()) on
+/// failure.
+bool cacheObjectFile(llvm::StringRef objectFile,
                      llvm::StringRef cacheObjectHash);
-void recoverObjectFile(llvm::StringRef cacheObjectHash,
+bool recoverObjectFile(llvm::StringRef cacheObjectHash,
                        llvm::StringRef objectFile);
 
+/// Returns whether linked binaries are cached too (-cache-link).
+bool isLinkCacheEnabled();
+
+/// Calculates the cache key of a linker invocation producing `outputFile`,
+/// from the linker, its commandline and the input files referenced by it.
+/// Returns false if some input file couldn't be read.
+bool calculateLinkHash(llvm::StringRef linker,
+                       llvm::ArrayRef<std::string> args,
+                       llvm::StringRef outputFile, llvm::SmallString<32> &str);
+
+/// Copies the cached binary to `outputFile`. Returns false if there's no such
+/// cache entry.
+bool recoverLinkedBinary(llvm::StringRef cacheLinkHash,
+                         llvm::StringRef outputFile);
+void cacheLinkedBinary(llvm::StringRef outputFile,
+                       llvm::StringRef cacheLinkHash);
+
+/// Returns the number of fragments a module's object code is to be split into
+/// for separate caching (-cache-fragments), or 0 for whole-module caching.
+unsigned getNumModuleFragments();
+
 /// Prune the cache to avoid filling up disk space.
 void pruneCache();
+
+/// Prints the cache hit/miss statistics of this invocation (-cache-stats).
+void printStatistics();
+
+/// Writes the cache statistics and individual lookups of this invocation as
+/// JSON object (-stats-file).
+void writeStatisticsJSON(llvm::raw_ostream &os);
 }
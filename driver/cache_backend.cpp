@@ -0,0 +1,143 @@
+//===-- driver/cache_backend.cpp ------------------------------------------===//
+//
+//                         LDC – the LLVM D compiler
+//
+// This file is distributed under the BSD-style LDC license. See the LICENSE
+// file for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// HTTP stores are expected to serve entries via GET <url>/<key> and accept new
+// ones via PUT <url>/<key> (e.g., a plain WebDAV share or a bazel-remote style
+// cache server). Transfers are done by the curl executable, so that LDC needs
+// no networking dependencies.
+//
+//===----------------------------------------------------------------------===//
+
+#include "driver/cache_backend.h"
+
+#include "dmd/errors.h"
+#include "dmd/globals.h"
+#include "gen/logger.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/Program.h"
+
+#include <string>
+#include <vector>
+
+namespace cache {
+
+namespace {
+
+/// A cache directory shared via the filesystem (e.g. NFS).
+class DirectoryBackend : public RemoteBackend {
+  std::string dir;
+
+  void getEntryPath(llvm::StringRef key, llvm::SmallString<128> &path) {
+    path = dir;
+    llvm::sys::path::append(path, key);
+  }
+
+public:
+  explicit DirectoryBackend(llvm::StringRef dir) : dir(dir.str()) {}
+
+  bool fetch(llvm::StringRef key, llvm::StringRef localFile) override {
+    llvm::SmallString<128> entry;
+    getEntryPath(key, entry);
+    if (!llvm::sys::fs::exists(entry))
+      return false;
+    return !llvm::sys::fs::copy_file(entry, localFile);
+  }
+
+  bool store(llvm::StringRef key, llvm::StringRef localFile) override {
+    if (!llvm::sys::fs::exists(dir) && llvm::sys::fs::create_directories(dir))
+      return false;
+
+    // Other machines may look up the entry concurrently, so add it atomically.
+    llvm::SmallString<128> entry;
+    getEntryPath(key, entry);
+    llvm::SmallString<128> tempFile;
+    if (llvm::sys::fs::createUniqueFile(llvm::Twine(entry) + ".tmp%%%%%%%",
+                                        tempFile))
+      return false;
+    if (llvm::sys::fs::copy_file(localFile, tempFile) ||
+        llvm::sys::fs::rename(tempFile, entry)) {
+      llvm::sys::fs::remove(tempFile);
+      return false;
+    }
+    return true;
+  }
+};
+
+/// A HTTP content-addressed store, accessed via curl.
+class HttpBackend : public RemoteBackend {
+  std::string url;
+  std::string curl;
+
+  bool runCurl(std::vector<std::string> args) {
+    args.insert(args.begin(), {curl, "--silent", "--fail", "--location"});
+#if LDC_LLVM_VER >= 700
+    std::vector<llvm::StringRef> argv(args.begin(), args.end());
+    auto envVars = llvm::None;
+#else
+    std::vector<const char *> argv;
+    for (const auto &arg : args)
+      argv.push_back(arg.c_str());
+    argv.push_back(nullptr);
+    auto envVars = nullptr;
+#endif
+
+    std::string errstr;
+    const int status = llvm::sys::ExecuteAndWait(curl,
+#if LDC_LLVM_VER >= 700
+                                                 argv,
+#else
+                                                 argv.data(),
+#endif
+                                                 envVars,
+#if LDC_LLVM_VER >= 600
+                                                 {},
+#else
+                                                 nullptr,
+#endif
+                                                 0, 0, &errstr);
+    IF_LOG Logger::println("curl exited with status %d %s", status,
+                           errstr.c_str());
+    return status == 0;
+  }
+
+public:
+  HttpBackend(llvm::StringRef url, std::string curl)
+      : url(url.rtrim('/').str()), curl(std::move(curl)) {}
+
+  bool fetch(llvm::StringRef key, llvm::StringRef localFile) override {
+    if (runCurl({"--output", localFile.str(), url + "/" + key.str()}))
+      return true;
+    // curl may leave a partial file behind.
+    llvm::sys::fs::remove(localFile);
+    return false;
+  }
+
+  bool store(llvm::StringRef key, llvm::StringRef localFile) override {
+    return runCurl({"--upload-file", localFile.str(), url + "/" + key.str()});
+  }
+};
+
+} // anonymous namespace
+
+std::unique_ptr<RemoteBackend> createRemoteBackend(llvm::StringRef location) {
+  if (location.startswith("http://") || location.startswith("https://")) {
+    auto curl = llvm::sys::findProgramByName("curl");
+    if (!curl) {
+      warning(Loc(), "failed to locate curl, ignoring -cache-remote=%s",
+              location.str().c_str());
+      return nullptr;
+    }
+    return std::unique_ptr<RemoteBackend>(new HttpBackend(location, *curl));
+  }
+  return std::unique_ptr<RemoteBackend>(new DirectoryBackend(location));
+}
+
+} // namespace cache
@@ -0,0 +1,44 @@
+//===-- driver/cache_backend.h - Shared object cache stores -----*- C++ -*-===//
+//
+//                         LDC – the LLVM D compiler
+//
+// This file is distributed under the BSD-style LDC license. See the LICENSE
+// file for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Remote stores for the IR-to-object cache, shared by multiple machines. The
+// local cache directory acts as read-through cache in front of them.
+//
+//===----------------------------------------------------------------------===//
+
+#pragma once
+
+#include <memory>
+
+namespace llvm {
+class StringRef;
+}
+
+namespace cache {
+
+/// A content-addressed store of cache entries, identified by their cache file
+/// name.
+class RemoteBackend {
+public:
+  virtual ~RemoteBackend() = default;
+
+  /// Downloads entry `key` to `localFile`. Returns false if there is no such
+  /// entry (or it couldn't be retrieved).
+  virtual bool fetch(llvm::StringRef key, llvm::StringRef localFile) = 0;
+
+  /// Uploads `localFile` as entry `key`. Returns false upon error.
+  virtual bool store(llvm::StringRef key, llvm::StringRef localFile) = 0;
+};
+
+/// Creates the store for the given location: a http(s):// URL (accessed via
+/// curl) or a (network-mounted) directory. Returns null (after a warning) if
+/// curl can't be found.
+std::unique_ptr<RemoteBackend> createRemoteBackend(llvm::StringRef location);
+
+} // namespace cache
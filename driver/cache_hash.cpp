@@ -0,0 +1,515 @@
+//===-- cache_hash.cpp ----------------------------------------------------===//
+//
+//                         LDC – the LLVM D compiler
+//
+// This file is distributed under the BSD-style LDC license. See the LICENSE
+// file for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Walks an LLVM IR module and writes a compact description of it (similar to
+// LLVM's StructuralHash, but complete) to a hash stream, which is much cheaper
+// than serializing the module to bitcode just to hash that.
+//
+// Values are referred to by their per-module (globals) or per-function (local
+// values) index, types are described recursively (identified structs once).
+// Metadata nodes are printed once each using a module-wide slot tracker (their
+// fields aren't necessarily operands, e.g. for debug info) and then visited
+// recursively. Instructions with extra state not explicitly handled here are
+// printed too.
+//
+//===----------------------------------------------------------------------===//
+
+#include "driver/cache_hash.h"
+
+#include "gen/attributes.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/IR/CallSite.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/InlineAsm.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Metadata.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/ModuleSlotTracker.h"
+#include "llvm/IR/Operator.h"
+#include "llvm/Support/raw_ostream.h"
+#include <cassert>
+#include <vector>
+
+using namespace llvm;
+
+namespace {
+
+enum Tag : uint8_t {
+  Tag_Null,
+  Tag_Global,
+  Tag_Local,
+  Tag_Constant,
+  Tag_BlockAddress,
+  Tag_InlineAsm,
+  Tag_Metadata,
+  Tag_MDString,
+  Tag_ValueAsMetadata,
+  Tag_MDNode,
+  Tag_MDNodeRef,
+  Tag_Instruction,
+  Tag_PrintedInstruction,
+};
+
+class StructuralHasher {
+  raw_ostream &os;
+  const Module &module;
+  ModuleSlotTracker slotTracker;
+  SmallVector<StringRef, 32> mdKindNames;
+
+  DenseMap<const GlobalValue *, unsigned> globalIds;
+  DenseMap<StructType *, unsigned> structIds;
+  DenseMap<const MDNode *, unsigned> mdNodeIds;
+  std::vector<const MDNode *> pendingMDNodes;
+
+  // Arguments, basic blocks and instructions of the current function.
+  DenseMap<const Value *, unsigned> localIds;
+  const Function *currentFunction = nullptr;
+  bool slotTrackerHasFunction = false;
+
+  template <typename T> void write(T value) {
+    os.write(reinterpret_cast<const char *>(&value), sizeof(T));
+  }
+
+  void writeString(StringRef str) {
+    write<uint64_t>(str.size());
+    os << str;
+  }
+
+  void hashAPInt(const APInt &value) {
+    write<uint32_t>(value.getBitWidth());
+    os.write(reinterpret_cast<const char *>(value.getRawData()),
+             value.getNumWords() * sizeof(uint64_t));
+  }
+
+  void hashType(Type *type) {
+    write<uint8_t>(type->getTypeID());
+    switch (type->getTypeID()) {
+    case Type::IntegerTyID:
+      write<uint32_t>(type->getIntegerBitWidth());
+      break;
+    case Type::PointerTyID:
+      write<uint32_t>(type->getPointerAddressSpace());
+      hashType(type->getPointerElementType());
+      break;
+    case Type::ArrayTyID:
+      write<uint64_t>(type->getArrayNumElements());
+      hashType(type->getArrayElementType());
+      break;
+    case Type::VectorTyID:
+      write<uint64_t>(type->getVectorNumElements());
+      hashType(type->getVectorElementType());
+      break;
+    case Type::FunctionTyID: {
+      auto ft = cast<FunctionType>(type);
+      write<uint8_t>(ft->isVarArg());
+      write<uint32_t>(ft->getNumParams());
+      for (Type *t : ft->subtypes())
+        hashType(t);
+      break;
+    }
+    case Type::StructTyID: {
+      auto st = cast<StructType>(type);
+      if (!st->isLiteral()) {
+        // Identified structs may be recursive; describe them once only.
+        const auto it = structIds.find(st);
+        if (it != structIds.end()) {
+          write<uint32_t>(it->second);
+          break;
+        }
+        const unsigned id = structIds.size();
+        structIds[st] = id;
+        write<uint32_t>(id);
+        writeString(st->getName());
+        write<uint8_t>(st->isOpaque());
+      }
+      write<uint8_t>(st->isPacked());
+      write<uint32_t>(st->getNumElements());
+      for (Type *t : st->elements())
+        hashType(t);
+      break;
+    }
+    default:
+      break;
+    }
+  }
+
+  void hashAttributes(const LLAttributeSet &attrs) {
+#if LDC_LLVM_VER >= 500
+    for (unsigned i = attrs.index_begin(), e = attrs.index_end(); i != e;
+         ++i) {
+      write<uint32_t>(i);
+      writeString(attrs.getAsString(i));
+    }
+#else
+    for (unsigned slot = 0, e = attrs.getNumSlots(); slot != e; ++slot) {
+      const unsigned i = attrs.getSlotIndex(slot);
+      write<uint32_t>(i);
+      writeString(attrs.getAsString(i));
+    }
+#endif
+  }
+
+  void hashValue(const Value *value) {
+    if (!value) {
+      write<uint8_t>(Tag_Null);
+    } else if (auto gv = dyn_cast<GlobalValue>(value)) {
+      write<uint8_t>(Tag_Global);
+      write<uint32_t>(globalIds.lookup(gv));
+    } else if (auto c = dyn_cast<Constant>(value)) {
+      hashConstant(c);
+    } else if (auto mav = dyn_cast<MetadataAsValue>(value)) {
+      write<uint8_t>(Tag_Metadata);
+      hashMetadata(mav->getMetadata());
+    } else if (auto ia = dyn_cast<InlineAsm>(value)) {
+      write<uint8_t>(Tag_InlineAsm);
+      hashType(ia->getFunctionType());
+      writeString(ia->getAsmString());
+      writeString(ia->getConstraintString());
+      write<uint8_t>(ia->hasSideEffects());
+      write<uint8_t>(ia->isAlignStack());
+      write<uint8_t>(ia->getDialect());
+    } else {
+      const auto it = localIds.find(value);
+      assert(it != localIds.end() && "unexpected value kind or scope");
+      write<uint8_t>(Tag_Local);
+      write<uint32_t>(it->second);
+    }
+  }
+
+  void hashConstant(const Constant *c) {
+    if (auto ba = dyn_cast<BlockAddress>(c)) {
+      write<uint8_t>(Tag_BlockAddress);
+      const Function *f = ba->getFunction();
+      write<uint32_t>(globalIds.lookup(f));
+      unsigned bbIndex = 0;
+      for (const BasicBlock &bb : *f) {
+        if (&bb == ba->getBasicBlock())
+          break;
+        ++bbIndex;
+      }
+      write<uint32_t>(bbIndex);
+      return;
+    }
+
+    write<uint8_t>(Tag_Constant);
+    write<uint8_t>(c->getValueID());
+    hashType(c->getType());
+
+    if (auto ci = dyn_cast<ConstantInt>(c)) {
+      hashAPInt(ci->getValue());
+    } else if (auto cfp = dyn_cast<ConstantFP>(c)) {
+      hashAPInt(cfp->getValueAPF().bitcastToAPInt());
+    } else if (auto cds = dyn_cast<ConstantDataSequential>(c)) {
+      writeString(cds->getRawDataValues());
+    } else {
+      if (auto ce = dyn_cast<ConstantExpr>(c)) {
+        write<uint32_t>(ce->getOpcode());
+        write<uint8_t>(ce->getRawSubclassOptionalData()); // inbounds, nsw...
+        if (ce->isCompare())
+          write<uint32_t>(ce->getPredicate());
+        if (ce->hasIndices()) {
+          for (unsigned i : ce->getIndices())
+            write<uint32_t>(i);
+        }
+        if (auto gep = dyn_cast<GEPOperator>(ce)) {
+          hashType(gep->getSourceElementType());
+#if LDC_LLVM_VER >= 500
+          const auto inRangeIndex = gep->getInRangeIndex();
+          write<uint32_t>(inRangeIndex ? *inRangeIndex + 1 : 0);
+#endif
+        }
+      }
+      // aggregates and constant expressions
+      write<uint32_t>(c->getNumOperands());
+      for (const Use &op : c->operands())
+        hashValue(op.get());
+    }
+  }
+
+  void hashMetadata(const Metadata *md) {
+    if (auto str = dyn_cast<MDString>(md)) {
+      write<uint8_t>(Tag_MDString);
+      writeString(str->getString());
+    } else if (auto vam = dyn_cast<ValueAsMetadata>(md)) {
+      write<uint8_t>(Tag_ValueAsMetadata);
+      hashValue(vam->getValue());
+    } else if (auto node = dyn_cast<MDNode>(md)) {
+      const auto it = mdNodeIds.find(node);
+      if (it != mdNodeIds.end()) {
+        write<uint8_t>(Tag_MDNodeRef);
+        write<uint32_t>(it->second);
+        return;
+      }
+      const unsigned id = mdNodeIds.size();
+      mdNodeIds[node] = id;
+      write<uint8_t>(Tag_MDNode);
+      write<uint32_t>(id);
+      // Described by hashPendingMetadata(), avoiding deep recursion.
+      pendingMDNodes.push_back(node);
+    } else {
+      write<uint8_t>(Tag_Null);
+    }
+  }
+
+  void hashPendingMetadata() {
+    while (!pendingMDNodes.empty()) {
+      const MDNode *node = pendingMDNodes.back();
+      pendingMDNodes.pop_back();
+      node->print(os, slotTracker, &module);
+      for (const MDOperand &op : node->operands()) {
+        if (op)
+          hashMetadata(op.get());
+        else
+          write<uint8_t>(Tag_Null);
+      }
+    }
+  }
+
+  template <typename T> void hashMetadataAttachments(const T &object) {
+    SmallVector<std::pair<unsigned, MDNode *>, 4> attachments;
+    object.getAllMetadata(attachments);
+    write<uint32_t>(attachments.size());
+    for (const auto &attachment : attachments) {
+      // Custom kind IDs depend on their registration order.
+      writeString(mdKindNames[attachment.first]);
+      hashMetadata(attachment.second);
+    }
+  }
+
+  void hashMemoryAccess(unsigned alignment, bool isVolatile,
+                        AtomicOrdering ordering, unsigned syncScope) {
+    write<uint32_t>(alignment);
+    write<uint8_t>(isVolatile);
+    write<uint8_t>(static_cast<unsigned>(ordering));
+    write<uint8_t>(syncScope);
+  }
+
+  void hashOperandBundles(const Instruction &inst) {
+    ImmutableCallSite cs(&inst);
+    write<uint32_t>(cs.getNumOperandBundles());
+    for (unsigned i = 0, e = cs.getNumOperandBundles(); i != e; ++i) {
+      const OperandBundleUse bundle = cs.getOperandBundleAt(i);
+      writeString(bundle.getTagName());
+      write<uint32_t>(bundle.Inputs.size());
+    }
+  }
+
+  // Returns false if the instruction has state not covered by its opcode, type
+  // and operands, which isn't handled explicitly.
+  bool hashInstructionState(const Instruction &inst) {
+    if (auto ai = dyn_cast<AllocaInst>(&inst)) {
+      hashType(ai->getAllocatedType());
+      write<uint32_t>(ai->getAlignment());
+      write<uint8_t>(ai->isUsedWithInAlloca());
+      write<uint8_t>(ai->isSwiftError());
+    } else if (auto li = dyn_cast<LoadInst>(&inst)) {
+#if LDC_LLVM_VER >= 500
+      hashMemoryAccess(li->getAlignment(), li->isVolatile(), li->getOrdering(),
+                       li->getSyncScopeID());
+#else
+      hashMemoryAccess(li->getAlignment(), li->isVolatile(), li->getOrdering(),
+                       li->getSynchScope());
+#endif
+    } else if (auto si = dyn_cast<StoreInst>(&inst)) {
+#if LDC_LLVM_VER >= 500
+      hashMemoryAccess(si->getAlignment(), si->isVolatile(), si->getOrdering(),
+                       si->getSyncScopeID());
+#else
+      hashMemoryAccess(si->getAlignment(), si->isVolatile(), si->getOrdering(),
+                       si->getSynchScope());
+#endif
+    } else if (auto gep = dyn_cast<GetElementPtrInst>(&inst)) {
+      hashType(gep->getSourceElementType());
+    } else if (auto ci = dyn_cast<CmpInst>(&inst)) {
+      write<uint32_t>(ci->getPredicate());
+    } else if (auto ci = dyn_cast<CallInst>(&inst)) {
+      write<uint32_t>(ci->getCallingConv());
+      write<uint8_t>(ci->getTailCallKind());
+      hashType(ci->getFunctionType());
+      hashAttributes(ci->getAttributes());
+      hashOperandBundles(inst);
+    } else if (auto ii = dyn_cast<InvokeInst>(&inst)) {
+      write<uint32_t>(ii->getCallingConv());
+      hashType(ii->getFunctionType());
+      hashAttributes(ii->getAttributes());
+      hashOperandBundles(inst);
+    } else if (auto phi = dyn_cast<PHINode>(&inst)) {
+      for (const BasicBlock *bb : phi->blocks())
+        hashValue(bb);
+    } else if (auto evi = dyn_cast<ExtractValueInst>(&inst)) {
+      for (unsigned i : evi->indices())
+        write<uint32_t>(i);
+    } else if (auto ivi = dyn_cast<InsertValueInst>(&inst)) {
+      for (unsigned i : ivi->indices())
+        write<uint32_t>(i);
+    } else if (auto lpi = dyn_cast<LandingPadInst>(&inst)) {
+      write<uint8_t>(lpi->isCleanup());
+    } else if (!isa<BinaryOperator>(inst) && !isa<CastInst>(inst) &&
+               !isa<SelectInst>(inst) && !isa<BranchInst>(inst) &&
+               !isa<SwitchInst>(inst) && !isa<ReturnInst>(inst) &&
+               !isa<UnreachableInst>(inst) && !isa<ResumeInst>(inst) &&
+               !isa<ExtractElementInst>(inst) &&
+               !isa<InsertElementInst>(inst) &&
+               !isa<ShuffleVectorInst>(inst)) {
+      return false;
+    }
+    return true;
+  }
+
+  void hashInstruction(const Instruction &inst) {
+    write<uint8_t>(Tag_Instruction);
+    write<uint32_t>(inst.getOpcode());
+    hashType(inst.getType());
+    // nuw/nsw, exact, inbounds, fast-math flags
+    write<uint8_t>(inst.getRawSubclassOptionalData());
+    write<uint32_t>(inst.getNumOperands());
+    for (const Use &op : inst.operands())
+      hashValue(op.get());
+
+    if (!hashInstructionState(inst)) {
+      // e.g., atomics, fences and funclet pads
+      if (!slotTrackerHasFunction) {
+        slotTracker.incorporateFunction(*currentFunction);
+        slotTrackerHasFunction = true;
+      }
+      write<uint8_t>(Tag_PrintedInstruction);
+      inst.print(os, slotTracker);
+    }
+
+    hashMetadataAttachments(inst);
+  }
+
+  void hashFunctionBody(const Function &f) {
+    currentFunction = &f;
+    slotTrackerHasFunction = false;
+    localIds.clear();
+
+    // Number all local values upfront, for forward references.
+    unsigned id = 0;
+    for (const Argument &arg : f.args())
+      localIds[&arg] = id++;
+    for (const BasicBlock &bb : f) {
+      localIds[&bb] = id++;
+      for (const Instruction &inst : bb)
+        localIds[&inst] = id++;
+    }
+
+    for (const BasicBlock &bb : f) {
+      write<uint32_t>(bb.size());
+      for (const Instruction &inst : bb)
+        hashInstruction(inst);
+    }
+
+    currentFunction = nullptr;
+  }
+
+  void hashGlobalValue(const GlobalValue &gv) {
+    writeString(gv.getName());
+    write<uint8_t>(gv.getValueID());
+    hashType(gv.getValueType());
+    write<uint32_t>(gv.getType()->getAddressSpace());
+    write<uint8_t>(gv.getLinkage());
+    write<uint8_t>(gv.getVisibility());
+    write<uint8_t>(gv.getDLLStorageClass());
+    write<uint8_t>(gv.getThreadLocalMode());
+    write<uint8_t>(static_cast<unsigned>(gv.getUnnamedAddr()));
+#if LDC_LLVM_VER >= 700
+    write<uint8_t>(gv.isDSOLocal());
+#endif
+
+    if (auto go = dyn_cast<GlobalObject>(&gv)) {
+      write<uint32_t>(go->getAlignment());
+      writeString(go->getSection());
+      if (const Comdat *comdat = go->getComdat()) {
+        writeString(comdat->getName());
+        write<uint8_t>(comdat->getSelectionKind());
+      } else {
+        write<uint8_t>(Tag_Null);
+      }
+      hashMetadataAttachments(*go);
+    }
+
+    if (auto var = dyn_cast<GlobalVariable>(&gv)) {
+      write<uint8_t>(var->isConstant());
+      write<uint8_t>(var->isExternallyInitialized());
+#if LDC_LLVM_VER >= 500
+      writeString(var->getAttributes().getAsString());
+#endif
+      hashValue(var->hasInitializer() ? var->getInitializer() : nullptr);
+    } else if (auto f = dyn_cast<Function>(&gv)) {
+      write<uint32_t>(f->getCallingConv());
+      hashAttributes(f->getAttributes());
+      writeString(f->hasGC() ? f->getGC() : "");
+      hashValue(f->hasPersonalityFn() ? f->getPersonalityFn() : nullptr);
+      hashValue(f->hasPrefixData() ? f->getPrefixData() : nullptr);
+      hashValue(f->hasPrologueData() ? f->getPrologueData() : nullptr);
+      if (!f->isDeclaration())
+        hashFunctionBody(*f);
+    } else if (auto ga = dyn_cast<GlobalAlias>(&gv)) {
+      hashValue(ga->getAliasee());
+    } else if (auto gi = dyn_cast<GlobalIFunc>(&gv)) {
+      hashValue(gi->getResolver());
+    }
+
+    hashPendingMetadata();
+  }
+
+public:
+  StructuralHasher(raw_ostream &os, const Module &module)
+      : os(os), module(module),
+        slotTracker(&module, /*ShouldInitializeAllMetadata=*/true) {
+    module.getMDKindNames(mdKindNames);
+  }
+
+  void run() {
+    writeString(module.getTargetTriple());
+    writeString(module.getDataLayoutStr());
+    writeString(module.getSourceFileName());
+    writeString(module.getModuleInlineAsm());
+
+    // Number all globals upfront, for forward references.
+    unsigned id = 0;
+    for (const GlobalVariable &gv : module.globals())
+      globalIds[&gv] = id++;
+    for (const Function &f : module.functions())
+      globalIds[&f] = id++;
+    for (const GlobalAlias &ga : module.aliases())
+      globalIds[&ga] = id++;
+    for (const GlobalIFunc &gi : module.ifuncs())
+      globalIds[&gi] = id++;
+    write<uint32_t>(id);
+
+    for (const GlobalVariable &gv : module.globals())
+      hashGlobalValue(gv);
+    for (const Function &f : module.functions())
+      hashGlobalValue(f);
+    for (const GlobalAlias &ga : module.aliases())
+      hashGlobalValue(ga);
+    for (const GlobalIFunc &gi : module.ifuncs())
+      hashGlobalValue(gi);
+
+    // e.g., module flags and llvm.dbg.cu
+    for (const NamedMDNode &nmd : module.named_metadata()) {
+      writeString(nmd.getName());
+      write<uint32_t>(nmd.getNumOperands());
+      for (const MDNode *node : nmd.operands())
+        hashMetadata(node);
+    }
+    hashPendingMetadata();
+  }
+};
+}
+
+namespace cache {
+
+void hashModuleStructurally(const Module &m, raw_ostream &os) {
+  StructuralHasher(os, m).run();
+}
+}
@@ -0,0 +1,30 @@
+//===-- driver/cache_hash.h - Structural LLVM IR hashing --------*- C++ -*-===//
+//
+//                         LDC – the LLVM D compiler
+//
+// This file is distributed under the BSD-style LDC license. See the LICENSE
+// file for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Feeds a structural description of an LLVM IR module to a stream, used to
+// compute the IR-to-object cache key without serializing the module to
+// bitcode.
+//
+//===----------------------------------------------------------------------===//
+
+#pragma once
+
+namespace llvm {
+class Module;
+class raw_ostream;
+}
+
+namespace cache {
+
+/// Writes a description of everything in `m` which may affect the generated
+/// object code to `os` (the module's types, globals, functions, attributes and
+/// metadata). Modules with an identical description are structurally
+/// identical; local value names are ignored.
+void hashModuleStructurally(const llvm::Module &m, llvm::raw_ostream &os);
+}
@@ -95,6 +95,17 @@ cl::opt<ubyte> defaultToHiddenVisibility(
                  clEnumValN(1, "hidden",
                             "Only export symbols marked with 'export'")));
 
+cl::opt<bool> noPLT(
+    "fno-plt", cl::ZeroOrMore,
+    cl::desc("Call external functions through the GOT instead of the PLT "
+             "(only for PIC)"));
+
+cl::opt<bool> noObjectFactory(
+    "fno-object-factory", cl::ZeroOrMore,
+    cl::desc("Don't list the classes of a module in its ModuleInfo, so that "
+             "unused classes can be eliminated. Object.factory() and "
+             "TypeInfo_Class.find() won't find them"));
+
 static cl::opt<bool, true> verbose("v", cl::desc("Verbose"), cl::ZeroOrMore,
                                    cl::location(global.params.verbose));
 
@@ -107,6 +118,14 @@ static cl::opt<bool, true>
     vgc("vgc", cl::desc("List all gc allocations including hidden ones"),
         cl::ZeroOrMore, cl::location(global.params.vgc));
 
+static cl::opt<bool, true> vtemplates(
+    "vtemplates", cl::ZeroOrMore, cl::location(global.params.vtemplates),
+    cl::desc("List statistics on template instantiations"));
+
+cl::opt<bool> verboseTypeInfo(
+    "vtypeinfo", cl::ZeroOrMore,
+    cl::desc("List the size of the TypeInfos emitted into each object file"));
+
 static cl::opt<bool, true> verbose_cg("v-cg", cl::desc("Verbose codegen"),
                                       cl::ZeroOrMore,
                                       cl::location(global.params.verbose_cg));
@@ -147,6 +166,16 @@ static cl::opt<ubyte, true> debugInfo(
         clEnumValN(3, "gline-tables-only", "Add line tables only")),
     cl::location(global.params.symdebug), cl::init(0));
 
+cl::opt<bool> splitDwarf(
+    "gsplit-dwarf", cl::ZeroOrMore,
+    cl::desc("Write the DWARF debug info of each object file to a separate "
+             ".dwo file, leaving only a skeleton in the object file"));
+
+cl::opt<bool> limitDebugInfo(
+    "flimit-debug-info", cl::ZeroOrMore,
+    cl::desc("Only declare classes from non-root modules in the debug info; "
+             "their full descriptions come with their own modules' objects"));
+
 cl::opt<bool> noAsm("noasm", cl::desc("Disallow use of inline assembler"),
                     cl::ZeroOrMore);
 
@@ -240,6 +269,29 @@ cl::opt<std::string>
                       "store cache files (experimental)"),
              cl::value_desc("cache dir"), cl::ZeroOrMore);
 
+cl::opt<unsigned> codegenThreads(
+    "codegen-threads", cl::ZeroOrMore, cl::init(1), cl::value_desc("N"),
+    cl::desc("Optimize and emit up to <N> modules in parallel (0: one thread "
+             "per core, default: 1). With -singleobj, the optimized module "
+             "is split into <N> partitions for machine code generation"));
+
+cl::opt<unsigned> codegenSplitThreshold(
+    "codegen-split-threshold", cl::ZeroOrMore, cl::init(0),
+    cl::value_desc("N"),
+    cl::desc("With -codegen-threads, also split modules defining at least "
+             "<N> functions into partitions for machine code generation "
+             "(default: 0, only -singleobj modules)"));
+
+cl::opt<bool> freeCodegenData(
+    "free-codegen-data", cl::ZeroOrMore,
+    cl::desc("Free the IR data of all symbols (functions, aggregates, "
+             "variables) after each module has been code-generated, instead "
+             "of keeping it until exit. Lowers the peak memory usage when "
+             "compiling many modules to separate object files"));
+
+static cl::alias codegenThreadsShort("j", cl::desc("Alias for -codegen-threads"),
+                                     cl::aliasopt(codegenThreads), cl::Prefix);
+
 static StringsAdapter strImpPathStore("J", global.params.fileImppath);
 static cl::list<std::string, StringsAdapter> stringImportPaths(
     "J", cl::desc("Look for string imports also in <directory>"),
@@ -390,16 +442,59 @@ cl::opt<uint32_t, true> hashThreshold(
     "hash-threshold", cl::ZeroOrMore, cl::location(global.params.hashThreshold),
     cl::desc("Hash symbol names longer than this threshold (experimental)"));
 
+cl::opt<RealPrecision> realPrecision(
+    "real-precision", cl::ZeroOrMore,
+    cl::desc("Floating-point format of the `real` type"),
+    cl::init(RealPrecision_Default),
+    clEnumValues(
+        clEnumValN(RealPrecision_Default, "default",
+                   "Target default (x87 80-bit, quad or double precision)"),
+        clEnumValN(RealPrecision_Double, "double",
+                   "64-bit IEEE double precision, predefines version "
+                   "LDC_RealIsDouble (not ABI-compatible with C `long "
+                   "double` and libraries compiled without this switch; "
+                   "requires druntime and Phobos built with it, e.g. via "
+                   "`ldc-build-runtime --dFlags=-real-precision=double`)")));
+
+cl::opt<SymbolHashAlgorithm> hashAlgorithm(
+    "hash-algorithm", cl::ZeroOrMore,
+    cl::desc("Hash function used for -hash-threshold"),
+    cl::init(SymbolHash_MD5),
+    clEnumValues(clEnumValN(SymbolHash_MD5, "md5",
+                            "128-bit MD5 (default, as used by druntime/Phobos "
+                            "builds with -hash-threshold)"),
+                 clEnumValN(SymbolHash_XXHash, "xxhash",
+                            "64-bit xxHash, faster and shorter")));
+
+cl::opt<std::string> hashMapFile(
+    "hash-map", cl::ZeroOrMore, cl::value_desc("file"),
+    cl::desc("Write the original names of the symbols hashed due to "
+             "-hash-threshold to <file>, as one tab-separated line "
+             "`<hashed> <original>` per symbol"));
+
 cl::opt<bool> linkonceTemplates(
     "linkonce-templates", cl::ZeroOrMore,
     cl::desc(
         "Use linkonce_odr linkage for template symbols instead of weak_odr"));
 
+cl::opt<bool> dedupTypeInfo(
+    "dedup-typeinfo", cl::ZeroOrMore,
+    cl::desc("When emitting multiple object files, define each TypeInfo "
+             "(and the struct members it references) only in the first "
+             "object file needing it and declare it in the others"));
+
 cl::opt<bool> disableLinkerStripDead(
     "disable-linker-strip-dead", cl::ZeroOrMore,
     cl::desc("Do not try to remove unused symbols during linking"),
     cl::cat(linkingCategory));
 
+cl::opt<bool> emitAddrsig(
+    "faddrsig", cl::ZeroOrMore,
+    cl::desc("Emit an address-significance table, allowing the linker to "
+             "safely fold identical functions and constants "
+             "(lld --icf=safe)"),
+    cl::cat(linkingCategory));
+
 // Math options
 bool fFastMath; // Storage for the dynamically created ffast-math option.
 llvm::FastMathFlags defaultFMF;
@@ -453,6 +548,14 @@ cl::opt<LTOKind> ltoMode(
         clEnumValN(LTO_Thin, "thin",
                    "Parallel importing and codegen (faster than 'full')")));
 
+#if LDC_LLVM_VER >= 400
+cl::opt<bool> wholeProgramVtables(
+    "fwhole-program-vtables", cl::ZeroOrMore,
+    cl::desc("Enable whole-program vtable optimizations for classes of the "
+             "compiled modules; all classes deriving from them must be part "
+             "of the LTO link (requires -flto)"));
+#endif
+
 #if LDC_LLVM_VER >= 400
 cl::opt<std::string>
     saveOptimizationRecord("fsave-optimization-record",
@@ -461,6 +564,28 @@ cl::opt<std::string>
                                     "of optimizations performed by LLVM"),
                            cl::ValueOptional);
 #endif
+#if LDC_LLVM_VER >= 600
+cl::opt<std::string> saveOptimizationRecordPasses(
+    "fsave-optimization-record-passes", cl::ZeroOrMore,
+    cl::value_desc("regex"),
+    cl::desc("Only include the remarks of passes matching <regex> in the "
+             "-fsave-optimization-record file"));
+#endif
+#if LDC_LLVM_VER >= 900
+cl::opt<std::string> saveOptimizationRecordFormat(
+    "fsave-optimization-record-format", cl::ZeroOrMore,
+    cl::value_desc("format"),
+    cl::desc("Set the -fsave-optimization-record file format: 'yaml' "
+             "(default) or the more compact 'bitstream'"),
+    cl::init("yaml"));
+#endif
+#if LDC_LLVM_VER >= 500
+cl::opt<unsigned> diagnosticsHotnessThreshold(
+    "fdiagnostics-hotness-threshold", cl::ZeroOrMore, cl::value_desc("N"),
+    cl::desc("Only emit the optimization remarks with a profile hotness of "
+             "at least <N> (requires -fprofile-instr-use)"),
+    cl::init(0));
+#endif
 
 #if LDC_LLVM_SUPPORTED_TARGET_SPIRV || LDC_LLVM_SUPPORTED_TARGET_NVPTX
 cl::list<std::string>
@@ -474,6 +599,21 @@ cl::opt<std::string>
                        cl::desc("Prefix to prepend to the generated kernel files."),
                        cl::init("kernels"),
                        cl::value_desc("prefix"));
+cl::opt<bool> dcomputeEmbed(
+    "mdcompute-embed", cl::ZeroOrMore,
+    cl::desc("Additionally embed the generated kernel files into a host object "
+             "file (<prefix>_kernels), registering them with a lookup table "
+             "keyed by target and kernel mangle at startup"));
+cl::opt<DComputeBoundsFailure> dcomputeBoundsFailure(
+    "mdcompute-bounds-failure", cl::ZeroOrMore,
+    cl::desc("Action on failed array bounds checks in DCompute device code"),
+    cl::init(DComputeBoundsFailure_Trap),
+    clEnumValues(
+        clEnumValN(DComputeBoundsFailure_Trap, "trap",
+                   "Abort the kernel with a trap instruction"),
+        clEnumValN(DComputeBoundsFailure_Flag, "flag",
+                   "Record the source line in the global "
+                   "`__dcompute_bounds_error` and return from the function")));
 #endif
 
 #if defined(LDC_DYNAMIC_COMPILE)
@@ -47,6 +47,8 @@ extern cl::opt<bool> invokedByLDMD;
 extern cl::opt<bool> compileOnly;
 extern cl::opt<bool> useDIP1000;
 extern cl::opt<bool> noAsm;
+extern cl::opt<bool> splitDwarf;
+extern cl::opt<bool> limitDebugInfo;
 extern cl::opt<bool> dontWriteObj;
 extern cl::opt<std::string> objectFile;
 extern cl::opt<std::string> objectDir;
@@ -67,6 +69,9 @@ extern cl::list<std::string> versions;
 extern cl::list<std::string> transitions;
 extern cl::opt<std::string> moduleDeps;
 extern cl::opt<std::string> cacheDir;
+extern cl::opt<unsigned> codegenThreads;
+extern cl::opt<unsigned> codegenSplitThreshold;
+extern cl::opt<bool> freeCodegenData;
 extern cl::list<std::string> linkerSwitches;
 extern cl::list<std::string> ccSwitches;
 extern cl::list<std::string> includeModulePatterns;
@@ -77,8 +82,24 @@ extern cl::opt<std::string> mTargetTriple;
 extern cl::opt<std::string> mABI;
 extern FloatABI::Type floatABI;
 extern cl::opt<bool> linkonceTemplates;
+enum RealPrecision {
+  RealPrecision_Default,
+  RealPrecision_Double,
+};
+extern cl::opt<RealPrecision> realPrecision;
+enum SymbolHashAlgorithm {
+  SymbolHash_MD5,
+  SymbolHash_XXHash,
+};
+extern cl::opt<SymbolHashAlgorithm> hashAlgorithm;
+extern cl::opt<std::string> hashMapFile;
+extern cl::opt<bool> dedupTypeInfo;
+extern cl::opt<bool> verboseTypeInfo;
 extern cl::opt<bool> disableLinkerStripDead;
+extern cl::opt<bool> emitAddrsig;
 extern cl::opt<ubyte> defaultToHiddenVisibility;
+extern cl::opt<bool> noPLT;
+extern cl::opt<bool> noObjectFactory;
 
 // Math options
 extern bool fFastMath;
@@ -101,13 +122,31 @@ enum LTOKind {
 extern cl::opt<LTOKind> ltoMode;
 inline bool isUsingLTO() { return ltoMode != LTO_None; }
 inline bool isUsingThinLTO() { return ltoMode == LTO_Thin; }
+#if LDC_LLVM_VER >= 400
+extern cl::opt<bool> wholeProgramVtables;
+#endif
 
 #if LDC_LLVM_VER >= 400
 extern cl::opt<std::string> saveOptimizationRecord;
 #endif
+#if LDC_LLVM_VER >= 600
+extern cl::opt<std::string> saveOptimizationRecordPasses;
+#endif
+#if LDC_LLVM_VER >= 900
+extern cl::opt<std::string> saveOptimizationRecordFormat;
+#endif
+#if LDC_LLVM_VER >= 500
+extern cl::opt<unsigned> diagnosticsHotnessThreshold;
+#endif
 #if LDC_LLVM_SUPPORTED_TARGET_SPIRV || LDC_LLVM_SUPPORTED_TARGET_NVPTX
 extern cl::list<std::string> dcomputeTargets;
 extern cl::opt<std::string> dcomputeFilePrefix;
+extern cl::opt<bool> dcomputeEmbed;
+enum DComputeBoundsFailure {
+  DComputeBoundsFailure_Trap,
+  DComputeBoundsFailure_Flag,
+};
+extern cl::opt<DComputeBoundsFailure> dcomputeBoundsFailure;
 #endif
 
 #if defined(LDC_DYNAMIC_COMPILE)
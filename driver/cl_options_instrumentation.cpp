@@ -37,6 +37,16 @@ cl::opt<std::string> IRPGOInstrUseFile(
     cl::desc("Use instrumentation data for profile-guided optimization"),
     cl::ValueRequired);
 
+/// Option for generating context-sensitive IR-based PGO instrumentation, i.e.,
+/// after inlining (LLVM pass)
+cl::opt<std::string> CSPGOInstrGenFile(
+    "fcs-profile-generate", cl::value_desc("filename"),
+    cl::desc("Generate instrumented code to collect a context-sensitive "
+             "runtime profile into default.profraw (overriden by "
+             "'=<filename>' or LLVM_PROFILE_FILE env var; requires "
+             "-fprofile-use)"),
+    cl::ZeroOrMore, cl::ValueOptional);
+
 /// Option for generating frontend-based PGO instrumentation
 cl::opt<std::string> ASTPGOInstrGenFile(
     "fprofile-instr-generate", cl::value_desc("filename"),
@@ -51,6 +61,13 @@ cl::opt<std::string> ASTPGOInstrUseFile(
     cl::desc("Use instrumentation data for profile-guided optimization"),
     cl::ValueRequired);
 
+/// Option for using a sample profile (e.g., converted from perf data with
+/// AutoFDO's create_llvm_prof) for profile-guided optimization
+cl::opt<std::string> SamplePGOUseFile(
+    "fprofile-sample-use", cl::ZeroOrMore, cl::value_desc("filename"),
+    cl::desc("Use sample profile data for profile-guided optimization"),
+    cl::ValueRequired);
+
 #if LDC_LLVM_VER >= 500
 cl::opt<int> fXRayInstructionThreshold(
     "fxray-instruction-threshold", cl::value_desc("value"),
@@ -65,12 +82,40 @@ constexpr int fXRayInstructionThreshold = 200;
 namespace opts {
 
 PGOKind pgoMode = PGO_None;
+bool instrumentingForCSPGO = false;
+std::string csPGOInstrGenFile;
 
 cl::opt<bool>
     instrumentFunctions("finstrument-functions", cl::ZeroOrMore,
                         cl::desc("Instrument function entry and exit with "
                                  "GCC-compatible profiling calls"));
 
+cl::opt<bool> instrumentGCAllocations(
+    "finstrument-gc-allocations", cl::ZeroOrMore,
+    cl::desc("Pass the source location of each GC allocation to "
+             "`ldc_gc_alloc_site_hook` (weak no-op default) right before the "
+             "allocation"));
+
+cl::opt<ProfileUpdateMode> profileUpdate(
+    "fprofile-update", cl::ZeroOrMore,
+    cl::desc("Set the update method of the -fprofile-instr-generate counters "
+             "in multi-threaded programs:"),
+    cl::init(ProfileUpdateMode::Single),
+    clEnumValues(
+        clEnumValN(ProfileUpdateMode::Single, "single",
+                   "Plain increments of shared counters; racy (default)"),
+        clEnumValN(ProfileUpdateMode::Atomic, "atomic",
+                   "Atomic increments of shared counters"),
+        clEnumValN(ProfileUpdateMode::PerThread, "per-thread",
+                   "Increments of thread-local counters, merged into the "
+                   "shared ones when a D thread terminates (requires "
+                   "druntime)")));
+
+cl::opt<bool> coverageMapping(
+    "fcoverage-mapping", cl::ZeroOrMore,
+    cl::desc("Generate coverage mapping to enable code coverage analysis with "
+             "llvm-cov (requires -fprofile-instr-generate)"));
+
 // DMD-style profiling (`dmd -profile`)
 static cl::opt<bool> dmdFunctionTrace(
     "fdmd-trace-functions", cl::ZeroOrMore,
@@ -80,6 +125,12 @@ static cl::opt<bool> dmdFunctionTrace(
 cl::opt<bool> fXRayInstrument(
     "fxray-instrument", cl::ZeroOrMore,
     cl::desc("Generate XRay instrumentation sleds on function entry and exit"));
+
+cl::opt<bool> fXRayDmdTrace(
+    "fxray-dmd-trace", cl::ZeroOrMore,
+    cl::desc("DMD-style runtime performance profiling based on XRay sleds, "
+             "only patched if the LDC_TRACE_LOG environment variable is set "
+             "(implies -fxray-instrument)"));
 #endif
 
 llvm::StringRef getXRayInstructionThresholdString() {
@@ -112,10 +163,69 @@ void initializeInstrumentationOptionsFromCmdline(const llvm::Triple &triple) {
   } else if (!IRPGOInstrUseFile.empty()) {
     pgoMode = PGO_IRBasedUse;
     initFromPathString(global.params.datafileInstrProf, IRPGOInstrUseFile);
+  } else if (!SamplePGOUseFile.empty()) {
+#if LDC_LLVM_VER < 400
+    error(Loc(), "-fprofile-sample-use requires LDC to be built against LLVM "
+                 "4 or later");
+#endif
+    pgoMode = PGO_SampleBasedUse;
+    initFromPathString(global.params.datafileInstrProf, SamplePGOUseFile);
+    // The samples are matched to the code via the debug locations, so emit
+    // at least line tables.
+    if (!global.params.symdebug)
+      global.params.symdebug = 3;
+  }
+
+  if (CSPGOInstrGenFile.getNumOccurrences() > 0) {
+#if LDC_LLVM_VER < 900
+    error(Loc(), "-fcs-profile-generate requires LDC to be built against "
+                 "LLVM 9 or later");
+#else
+    if (pgoMode != PGO_IRBasedUse)
+      error(Loc(), "-fcs-profile-generate requires -fprofile-use");
+#endif
+    instrumentingForCSPGO = true;
+    csPGOInstrGenFile = CSPGOInstrGenFile.empty() ? "default_%m.profraw"
+                                                  : CSPGOInstrGenFile.c_str();
+  }
+
+  if (profileUpdate != ProfileUpdateMode::Single) {
+#if LDC_LLVM_VER < 500
+    error(Loc(), "-fprofile-update=atomic|per-thread requires LDC to be built "
+                 "against LLVM 5 or later");
+#else
+    if (pgoMode != PGO_ASTBasedInstr)
+      error(Loc(), "-fprofile-update requires -fprofile-instr-generate");
+    // The thread-local counters are merged by module TLS destructors.
+    if (profileUpdate == ProfileUpdateMode::PerThread && global.params.betterC)
+      error(Loc(), "-fprofile-update=per-thread is not supported with "
+                   "-betterC");
+#endif
+  }
+
+  if (coverageMapping) {
+#if LDC_LLVM_VER < 500
+    error(Loc(), "-fcoverage-mapping requires LDC to be built against LLVM 5 "
+                 "or later");
+#else
+    if (pgoMode != PGO_ASTBasedInstr)
+      error(Loc(), "-fcoverage-mapping requires -fprofile-instr-generate");
+#endif
   }
 
   if (dmdFunctionTrace)
     global.params.trace = true;
+
+#if LDC_LLVM_VER >= 500
+  if (fXRayDmdTrace) {
+    if (dmdFunctionTrace)
+      error(Loc(), "-fxray-dmd-trace and -fdmd-trace-functions are exclusive");
+    fXRayInstrument = true;
+    // Like -fdmd-trace-functions, trace all functions by default.
+    if (fXRayInstructionThreshold.getNumOccurrences() == 0)
+      fXRayInstructionThreshold = 1;
+  }
+#endif
 }
 
 } // namespace opts
@@ -25,11 +25,15 @@ namespace opts {
 namespace cl = llvm::cl;
 
 extern cl::opt<bool> instrumentFunctions;
+extern cl::opt<bool> coverageMapping;
+extern cl::opt<bool> instrumentGCAllocations;
 
 #if LDC_LLVM_VER >= 500
 extern cl::opt<bool> fXRayInstrument;
+extern cl::opt<bool> fXRayDmdTrace;
 #else
 constexpr bool fXRayInstrument = false;
+constexpr bool fXRayDmdTrace = false;
 #endif
 llvm::StringRef getXRayInstructionThresholdString();
 
@@ -44,13 +48,20 @@ enum PGOKind {
   PGO_ASTBasedUse,
   PGO_IRBasedInstr,
   PGO_IRBasedUse,
+  PGO_SampleBasedUse,
 };
 extern PGOKind pgoMode;
+/// Context-sensitive IR-based PGO instrumentation (after inlining), on top of
+/// PGO_IRBasedUse.
+extern bool instrumentingForCSPGO;
+extern std::string csPGOInstrGenFile;
 inline bool isInstrumentingForPGO() {
-  return pgoMode == PGO_ASTBasedInstr || pgoMode == PGO_IRBasedInstr;
+  return pgoMode == PGO_ASTBasedInstr || pgoMode == PGO_IRBasedInstr ||
+         instrumentingForCSPGO;
 }
 inline bool isUsingPGOProfile() {
-  return pgoMode == PGO_ASTBasedUse || pgoMode == PGO_IRBasedUse;
+  return pgoMode == PGO_ASTBasedUse || pgoMode == PGO_IRBasedUse ||
+         pgoMode == PGO_SampleBasedUse;
 }
 inline bool isInstrumentingForASTBasedPGO() {
   return pgoMode == PGO_ASTBasedInstr;
@@ -60,5 +71,18 @@ inline bool isInstrumentingForIRBasedPGO() {
   return pgoMode == PGO_IRBasedInstr;
 }
 inline bool isUsingIRBasedPGOProfile() { return pgoMode == PGO_IRBasedUse; }
+inline bool isUsingSampleBasedPGOProfile() {
+  return pgoMode == PGO_SampleBasedUse;
+}
+
+/// How the counters of the AST-based PGO instrumentation are updated
+/// (-fprofile-update).
+enum class ProfileUpdateMode {
+  Single,   /// plain increments of the shared counters
+  Atomic,   /// atomic increments of the shared counters
+  PerThread /// plain increments of thread-local counters, atomically added to
+            /// the shared ones when a thread terminates
+};
+extern cl::opt<ProfileUpdateMode> profileUpdate;
 
 } // namespace opts
@@ -14,18 +14,35 @@
 #include "dmd/mars.h"
 #include "dmd/module.h"
 #include "dmd/scope.h"
+#include "dmd/template.h"
+#include "driver/batch.h"
 #include "driver/cl_options.h"
 #include "driver/cl_options_instrumentation.h"
 #include "driver/linker.h"
+#include "driver/sizereport.h"
+#include "driver/timetrace.h"
 #include "driver/toobj.h"
 #include "gen/dynamiccompile.h"
+#include "gen/llvmhelpers.h"
 #include "gen/logger.h"
 #include "gen/modules.h"
+#include "gen/optremarks.h"
 #include "gen/runtime.h"
+#include "gen/targetclones.h"
+#include "llvm/IR/DiagnosticInfo.h"
 #include "llvm/Support/FileSystem.h"
 #include "llvm/Support/Path.h"
+#include "llvm/Support/Regex.h"
 #include "llvm/Support/ToolOutputFile.h"
 #include "llvm/Support/YAMLTraits.h"
+#include "llvm/Target/TargetMachine.h"
+#if LDC_LLVM_VER >= 1100
+#include "llvm/IR/LLVMRemarkStreamer.h"
+#elif LDC_LLVM_VER >= 900
+#include "llvm/IR/RemarkStreamer.h"
+#elif LDC_LLVM_VER >= 600
+#include "llvm/IR/DiagnosticHandler.h"
+#endif
 
 #if LDC_LLVM_VER < 600
 namespace llvm {
@@ -35,6 +52,63 @@ namespace llvm {
 
 namespace {
 
+#if LDC_LLVM_VER >= 600 && LDC_LLVM_VER < 900
+/// Writes the optimization remarks of the passes matching a regex to the
+/// optimization record file (-fsave-optimization-record-passes); LLVM only
+/// supports filtering the remarks printed to stderr (-pass-remarks*).
+class RemarkFilterHandler : public llvm::DiagnosticHandler {
+  mutable llvm::Regex passes; // match() isn't const before LLVM 10
+  std::unique_ptr<llvm::yaml::Output> output;
+
+  // Returns true if the remark is to be printed because of -pass-remarks*.
+  bool isPrintedRemark(const llvm::DiagnosticInfoOptimizationBase &remark) {
+    const llvm::StringRef pass = remark.getPassName();
+    switch (remark.getKind()) {
+    case llvm::DK_OptimizationRemark:
+    case llvm::DK_MachineOptimizationRemark:
+      return DiagnosticHandler::isPassedOptRemarkEnabled(pass);
+    case llvm::DK_OptimizationRemarkMissed:
+    case llvm::DK_MachineOptimizationRemarkMissed:
+      return DiagnosticHandler::isMissedOptRemarkEnabled(pass);
+    default:
+      return DiagnosticHandler::isAnalysisRemarkEnabled(pass);
+    }
+  }
+
+public:
+  RemarkFilterHandler(llvm::StringRef passesRegex,
+                      std::unique_ptr<llvm::yaml::Output> output)
+      : passes(passesRegex), output(std::move(output)) {}
+
+  bool isAnalysisRemarkEnabled(llvm::StringRef pass) const override {
+    return passes.match(pass) ||
+           DiagnosticHandler::isAnalysisRemarkEnabled(pass);
+  }
+  bool isMissedOptRemarkEnabled(llvm::StringRef pass) const override {
+    return passes.match(pass) ||
+           DiagnosticHandler::isMissedOptRemarkEnabled(pass);
+  }
+  bool isPassedOptRemarkEnabled(llvm::StringRef pass) const override {
+    return passes.match(pass) ||
+           DiagnosticHandler::isPassedOptRemarkEnabled(pass);
+  }
+  bool isAnyRemarkEnabled() const override { return true; }
+
+  bool handleDiagnostics(const llvm::DiagnosticInfo &di) override {
+    auto remark = llvm::dyn_cast<llvm::DiagnosticInfoOptimizationBase>(&di);
+    if (!remark)
+      return false;
+    if (passes.match(remark->getPassName())) {
+      // The yaml operator takes a reference to a pointer.
+      auto p = const_cast<llvm::DiagnosticInfoOptimizationBase *>(remark);
+      *output << p;
+    }
+    // Let LLVM print the remarks requested via -pass-remarks*.
+    return !isPrintedRemark(*remark);
+  }
+};
+#endif
+
 std::unique_ptr<llvm::ToolOutputFile>
 createAndSetDiagnosticsOutputFile(IRState &irs, llvm::LLVMContext &ctx,
                                   llvm::StringRef filename) {
@@ -43,14 +117,36 @@ createAndSetDiagnosticsOutputFile(IRState &irs, llvm::LLVMContext &ctx,
 #if LDC_LLVM_VER >= 400
   // Set LLVM Diagnostics outputfile if requested
   if (opts::saveOptimizationRecord.getNumOccurrences() > 0) {
+#if LDC_LLVM_VER >= 900
+    const bool isBitstream = opts::saveOptimizationRecordFormat == "bitstream";
+#else
+    const bool isBitstream = false;
+#endif
     llvm::SmallString<128> diagnosticsFilename;
     if (!opts::saveOptimizationRecord.empty()) {
       diagnosticsFilename = opts::saveOptimizationRecord.getValue();
     } else {
       diagnosticsFilename = filename;
-      llvm::sys::path::replace_extension(diagnosticsFilename, "opt.yaml");
+      llvm::sys::path::replace_extension(
+          diagnosticsFilename, isBitstream ? "opt.bitstream" : "opt.yaml");
     }
 
+    // If there is instrumentation data available, also output function hotness
+    const bool withHotness = opts::isUsingPGOProfile();
+
+#if LDC_LLVM_VER >= 900
+    auto fileOrError = llvm::setupOptimizationRemarks(
+        ctx, diagnosticsFilename, opts::saveOptimizationRecordPasses,
+        opts::saveOptimizationRecordFormat, withHotness,
+        opts::diagnosticsHotnessThreshold);
+    if (llvm::Error e = fileOrError.takeError()) {
+      irs.dmodule->error("Could not set up optimization record file %s: %s",
+                         diagnosticsFilename.c_str(),
+                         llvm::toString(std::move(e)).c_str());
+      fatal();
+    }
+    diagnosticsOutputFile = std::move(*fileOrError);
+#else
     std::error_code EC;
     diagnosticsOutputFile = llvm::make_unique<llvm::ToolOutputFile>(
         diagnosticsFilename, EC, llvm::sys::fs::F_None);
@@ -60,17 +156,36 @@ createAndSetDiagnosticsOutputFile(IRState &irs, llvm::LLVMContext &ctx,
       fatal();
     }
 
-    ctx.setDiagnosticsOutputFile(
-        llvm::make_unique<llvm::yaml::Output>(diagnosticsOutputFile->os()));
+    auto yamlOutput =
+        llvm::make_unique<llvm::yaml::Output>(diagnosticsOutputFile->os());
+#if LDC_LLVM_VER >= 600
+    if (!opts::saveOptimizationRecordPasses.empty()) {
+      std::string regexError;
+      if (!llvm::Regex(opts::saveOptimizationRecordPasses)
+               .isValid(regexError)) {
+        irs.dmodule->error(
+            "Invalid -fsave-optimization-record-passes regex: %s",
+            regexError.c_str());
+        fatal();
+      }
+      ctx.setDiagnosticHandler(llvm::make_unique<RemarkFilterHandler>(
+          opts::saveOptimizationRecordPasses, std::move(yamlOutput)));
+    } else
+#endif
+      ctx.setDiagnosticsOutputFile(std::move(yamlOutput));
 
-    // If there is instrumentation data available, also output function hotness
-    if (opts::isUsingPGOProfile()) {
+    if (withHotness) {
 #if LDC_LLVM_VER >= 500
       ctx.setDiagnosticsHotnessRequested(true);
 #else
       ctx.setDiagnosticHotnessRequested(true);
 #endif
     }
+#if LDC_LLVM_VER >= 500
+    // Remarks below the threshold aren't emitted at all.
+    ctx.setDiagnosticsHotnessThreshold(opts::diagnosticsHotnessThreshold);
+#endif
+#endif // LDC_LLVM_VER < 900
   }
 #endif
 
@@ -167,6 +282,21 @@ void emitLLVMUsedArray(IRState &irs) {
   llvmUsed->setSection("llvm.metadata");
 }
 
+/// Emits the template instances appended to the other root modules into \p m.
+/// The frontend appends each instance to a single root module only; with
+/// separate compilation, every module gets the instances it needs.
+void emitOtherRootsInstances(Module *m) {
+  for (Module *root : Module::amodules) {
+    if (root == m || !root->isRoot() || root->isHdrFile || !root->members)
+      continue;
+    // NOTE: members may grow during codegen
+    for (d_size_t k = 0; k < root->members->dim; k++) {
+      if (auto ti = (*root->members)[k]->isTemplateInstance())
+        Declaration_codegen(ti);
+    }
+  }
+}
+
 }
 
 namespace ldc {
@@ -176,9 +306,24 @@ CodeGenerator::CodeGenerator(llvm::LLVMContext &context, bool singleObj)
   if (!global.params.output_ll) {
     context_.setDiscardValueNames(true);
   }
+
+  // Optimize and emit the modules in parallel if requested. Optimization
+  // records are written per LLVMContext and thus not supported.
+  const unsigned numThreads = ParallelModuleWriter::getNumThreads();
+  if (numThreads > 1 && !singleObj_
+#if LDC_LLVM_VER >= 400
+      && opts::saveOptimizationRecord.getNumOccurrences() == 0
+#endif
+      ) {
+    parallelWriter_ = llvm::make_unique<ParallelModuleWriter>(numThreads);
+  }
 }
 
 CodeGenerator::~CodeGenerator() {
+  if (parallelWriter_) {
+    parallelWriter_->wait();
+  }
+
   if (singleObj_) {
     // For singleObj builds, the first object file name is the one for the first
     // source file (e.g., `b.o` for `ldc2 a.o b.d c.d`).
@@ -196,6 +341,8 @@ void CodeGenerator::prepareLLModule(Module *m) {
   ++moduleCount_;
 
   if (singleObj_ && ir_) {
+    // Each module gets its own compile unit.
+    ir_->DBuilder.EmitCompileUnit(m);
     return;
   }
 
@@ -208,11 +355,30 @@ void CodeGenerator::prepareLLModule(Module *m) {
   ir_->module.setTargetTriple(global.params.targetTriple->str());
   ir_->module.setDataLayout(*gDataLayout);
 
-  // TODO: Make ldc::DIBuilder per-Module to be able to emit several CUs for
-  // single-object compilations?
+  // Position-independent code to be linked into an executable right away is
+  // PIE, allowing LLVM to assume that its definitions aren't preemptible. Most
+  // importantly, TLS variables are then accessed via the local-exec (defined
+  // in the executable) or initial-exec model instead of __tls_get_addr().
+  if (global.params.link && !global.params.dll &&
+      gTargetMachine->getRelocationModel() == llvm::Reloc::PIC_ &&
+      global.params.targetTriple->isOSBinFormatELF()) {
+    ir_->module.setPIELevel(llvm::PIELevel::Large);
+  }
+
+#if LDC_LLVM_VER >= 600
+  // -fno-plt: call the runtime library functions emitted by LLVM itself (e.g.,
+  // memcpy) through the GOT too.
+  if (opts::noPLT &&
+      gTargetMachine->getRelocationModel() == llvm::Reloc::PIC_) {
+    ir_->module.addModuleFlag(llvm::Module::Max, "RtLibUseGOT", 1);
+  }
+#endif
+
   ir_->DBuilder.EmitCompileUnit(m);
 
-  IrDsymbol::resetAll();
+  // No IR data of a previous module is reused, so it can be freed right away
+  // (with -free-codegen-data).
+  IrDsymbol::resetAll(opts::freeCodegenData);
 }
 
 void CodeGenerator::finishLLModule(Module *m) {
@@ -232,6 +398,8 @@ void CodeGenerator::finishLLModule(Module *m) {
 void CodeGenerator::writeAndFreeLLModule(const char *filename) {
   ir_->objc.finalize();
 
+  emitTargetClones(*ir_);
+
   // Issue #1829: make sure all replaced global variables are replaced
   // everywhere.
   ir_->replaceGlobals();
@@ -250,14 +418,30 @@ void CodeGenerator::writeAndFreeLLModule(const char *filename) {
   llvm::Metadata *IdentNode[] = {llvm::MDString::get(ir_->context(), Version)};
   IdentMetadata->addOperand(llvm::MDNode::get(ir_->context(), IdentNode));
 
+  if (parallelWriter_) {
+    emitCodegenRemarks();
+    parallelWriter_->enqueue(ir_->module, filename);
+    delete ir_;
+    ir_ = nullptr;
+    return;
+  }
+
   std::unique_ptr<llvm::ToolOutputFile> diagnosticsOutputFile =
       createAndSetDiagnosticsOutputFile(*ir_, context_, filename);
 
+  emitCodegenRemarks();
+
   writeModule(&ir_->module, filename);
 
   if (diagnosticsOutputFile)
     diagnosticsOutputFile->keep();
 
+#if LDC_LLVM_VER >= 600 && LDC_LLVM_VER < 900
+  // The remark filter writes to the file closed now.
+  if (diagnosticsOutputFile && !opts::saveOptimizationRecordPasses.empty())
+    context_.setDiagnosticHandler(llvm::make_unique<llvm::DiagnosticHandler>());
+#endif
+
   delete ir_;
   ir_ = nullptr;
 }
@@ -288,6 +472,8 @@ void CodeGenerator::emit(Module *m) {
   IF_LOG Logger::println("CodeGenerator::emit(%s)", m->toPrettyChars());
   LOG_SCOPE;
 
+  timetrace::Scope timeScope("Generate IR", m->toPrettyChars());
+
   if (global.params.verbose_cg) {
     printf("codegen: %s (%s)\n", m->toPrettyChars(), m->srcfile->toChars());
   }
@@ -300,6 +486,9 @@ void CodeGenerator::emit(Module *m) {
   prepareLLModule(m);
 
   codegenModule(ir_, m);
+  if (!singleObj_ && batch::isMergedInvocation()) {
+    emitOtherRootsInstances(m);
+  }
   if (m == rootHasMain) {
     codegenModule(ir_, entrypoint);
 
@@ -327,6 +516,8 @@ void CodeGenerator::emit(Module *m) {
     }
   }
 
+  sizereport::recordModule(ir_->module, m);
+
   finishLLModule(m);
 
   if (m->llvmForceLogging && !loggerWasEnabled) {
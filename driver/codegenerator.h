@@ -20,9 +20,12 @@
 #pragma once
 
 #include "gen/irstate.h"
+#include <memory>
 
 namespace ldc {
 
+class ParallelModuleWriter;
+
 class CodeGenerator {
 public:
   CodeGenerator(llvm::LLVMContext &context, bool singleObj);
@@ -38,5 +41,7 @@ private:
   int moduleCount_;
   bool const singleObj_;
   IRState *ir_;
+  /// Set if the modules are emitted concurrently (-codegen-threads).
+  std::unique_ptr<ParallelModuleWriter> parallelWriter_;
 };
 }
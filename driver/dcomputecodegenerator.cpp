@@ -9,10 +9,19 @@
 
 #include "driver/dcomputecodegenerator.h"
 #include "driver/cl_options.h"
+#include "driver/toobj.h"
 #include "dmd/errors.h"
+#include "dmd/globals.h"
+#include "dmd/root/filename.h"
 #include "gen/cl_helpers.h"
 #include "ir/irdsymbol.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Module.h"
 #include "llvm/Support/CommandLine.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Target/TargetMachine.h"
+#include "llvm/Transforms/Utils/ModuleUtils.h"
 #include <array>
 #include <string>
 #include <algorithm>
@@ -88,9 +97,134 @@ void DComputeCodeGenManager::emit(Module *m) {
 }
 
 void DComputeCodeGenManager::writeModules() {
+  // IR generation above relies on global state and stays serial, but the
+  // per-target modules are independent and can be optimized and emitted in
+  // parallel (-codegen-threads). Each target emits with its own
+  // TargetMachine, OpenCL falls back to the host one.
+  gTargetMachine = oldGTargetMachine;
+  const unsigned numThreads = std::min<unsigned>(
+      ldc::ParallelModuleWriter::getNumThreads(), targets.size());
+  if (numThreads > 1) {
+    ldc::ParallelModuleWriter writer(numThreads);
+    for (auto &target : targets) {
+      target->writeModule(&writer);
+    }
+    writer.wait();
+  } else {
+    for (auto &target : targets) {
+      target->writeModule();
+    }
+  }
+
   for (auto &target : targets) {
-    target->writeModule();
+    target->finalizeOutput();
   }
+
+  if (opts::dcomputeEmbed)
+    embedKernels();
+}
+
+// Emits a host object file with the contents of all kernel files and a table
+// which is linked into a global list at startup, so a DCompute runtime can
+// find the binaries without any file access:
+//
+//   struct DComputeKernel
+//   {
+//       const(char)* target; // e.g. "cuda350_64", "cuda350_64_cubin"
+//       const(char)* kernel; // mangled name
+//       const(void)* binary; // kernel file, followed by a NUL byte
+//       size_t size;         // without the NUL byte
+//   }
+//   struct DComputeKernelList
+//   {
+//       DComputeKernelList* next;
+//       const(DComputeKernel)* kernels;
+//       size_t length;
+//   }
+//   extern(C) __gshared DComputeKernelList* _d_dcompute_kernels;
+//
+// The list head is weak, so any number of these objects can be linked.
+void DComputeCodeGenManager::embedKernels() {
+  llvm::Module module("dcompute_kernels", ctx);
+  module.setTargetTriple(global.params.targetTriple->str());
+  module.setDataLayout(oldGTargetMachine->createDataLayout());
+
+  auto i8PtrTy = llvm::Type::getInt8PtrTy(ctx);
+  auto sizeTy = module.getDataLayout().getIntPtrType(ctx);
+  auto entryTy = llvm::StructType::create(
+      ctx, {i8PtrTy, i8PtrTy, i8PtrTy, sizeTy}, "DComputeKernel");
+  auto createData = [&](llvm::StringRef data, const char *name,
+                        unsigned alignment) {
+    auto init = llvm::ConstantDataArray::getString(ctx, data, true);
+    auto var = new llvm::GlobalVariable(module, init->getType(), true,
+                                        llvm::GlobalValue::PrivateLinkage,
+                                        init, name);
+    var->setAlignment(alignment);
+    return llvm::ConstantExpr::getBitCast(var, i8PtrTy);
+  };
+
+  std::vector<llvm::Constant *> entries;
+  auto addBinary = [&](const DComputeTarget &target,
+                       const std::string &targetName, const char *path) {
+    auto buffer = llvm::MemoryBuffer::getFile(path);
+    if (!buffer) {
+      error(Loc(), "cannot read DCompute kernel file `%s`: %s", path,
+            buffer.getError().message().c_str());
+      fatal();
+    }
+    auto data = (*buffer)->getBuffer();
+    auto binary = createData(data, ".dcompute_binary", 16);
+    auto name = createData(targetName, ".dcompute_target", 1);
+    auto size = llvm::ConstantInt::get(sizeTy, data.size());
+    for (auto &kernel : target.kernelNames) {
+      llvm::Constant *fields[] = {
+          name, createData(kernel, ".dcompute_kernel", 1), binary, size};
+      entries.push_back(llvm::ConstantStruct::get(entryTy, fields));
+    }
+  };
+  for (auto &target : targets) {
+    assert(target->outputPath);
+    addBinary(*target, target->getName(), target->outputPath);
+    for (auto &extra : target->extraOutputs) {
+      addBinary(*target, extra.first, extra.second);
+    }
+  }
+
+  auto tableTy = llvm::ArrayType::get(entryTy, entries.size());
+  auto table = new llvm::GlobalVariable(
+      module, tableTy, true, llvm::GlobalValue::PrivateLinkage,
+      llvm::ConstantArray::get(tableTy, entries), ".dcompute_kernels");
+
+  auto listTy = llvm::StructType::create(ctx, "DComputeKernelList");
+  auto listPtrTy = listTy->getPointerTo();
+  listTy->setBody({listPtrTy, entryTy->getPointerTo(), sizeTy});
+  llvm::Constant *listFields[] = {
+      llvm::ConstantPointerNull::get(listPtrTy),
+      llvm::ConstantExpr::getBitCast(table, entryTy->getPointerTo()),
+      llvm::ConstantInt::get(sizeTy, entries.size())};
+  auto list = new llvm::GlobalVariable(
+      module, listTy, false, llvm::GlobalValue::InternalLinkage,
+      llvm::ConstantStruct::get(listTy, listFields), ".dcompute_kernel_list");
+  auto head = new llvm::GlobalVariable(
+      module, listPtrTy, false, llvm::GlobalValue::WeakAnyLinkage,
+      llvm::ConstantPointerNull::get(listPtrTy), "_d_dcompute_kernels");
+
+  // list.next = head; head = &list;
+  auto ctor = llvm::Function::Create(
+      llvm::FunctionType::get(llvm::Type::getVoidTy(ctx), false),
+      llvm::GlobalValue::InternalLinkage, ".dcompute_kernels_ctor", &module);
+  llvm::IRBuilder<> builder(llvm::BasicBlock::Create(ctx, "", ctor));
+  builder.CreateStore(builder.CreateLoad(head),
+                      builder.CreateStructGEP(listTy, list, 0));
+  builder.CreateStore(list, head);
+  builder.CreateRetVoid();
+  llvm::appendToGlobalCtors(module, ctor, 65535);
+
+  const std::string filename = opts::dcomputeFilePrefix + "_kernels." +
+                               global.obj_ext;
+  const char *path = FileName::combine(global.params.objdir, filename.c_str());
+  ::writeModule(*oldGTargetMachine, &module, path);
+  global.params.objfiles.push(path);
 }
 
 DComputeCodeGenManager::~DComputeCodeGenManager() {
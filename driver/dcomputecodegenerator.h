@@ -25,6 +25,7 @@ class DComputeCodeGenManager {
   DComputeTarget *createComputeTarget(const std::string &s);
   IRState *oldGIR = nullptr;
   llvm::TargetMachine *oldGTargetMachine = nullptr;
+  void embedKernels();
 public:
   void emit(Module *m);
   void writeModules();
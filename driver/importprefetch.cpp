@@ -0,0 +1,457 @@
+//===-- driver/importprefetch.cpp -----------------------------------------===//
+//
+//                         LDC – the LLVM D compiler
+//
+// This file is distributed under the BSD-style LDC license. See the LICENSE
+// file for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "driver/importprefetch.h"
+
+#include "dmd/errors.h"
+#include "dmd/globals.h"
+#include "dmd/module.h"
+#include "dmd/root/file.h"
+#include "driver/timetrace.h"
+#include "driver/toobj.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringSet.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/ThreadPool.h"
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+llvm::cl::opt<bool> prefetchImportsOpt(
+    "prefetch-imports", llvm::cl::ZeroOrMore,
+    llvm::cl::desc("Discover the transitively imported modules before the "
+                   "semantic analysis and read their source files in "
+                   "parallel (on -codegen-threads threads)"));
+
+struct PrefetchedFile {
+  unsigned char *buffer;
+  size_t length;
+  bool mapped; // else malloc'd
+};
+
+// Written by the worker threads, only accessed by the frontend once all of
+// them have finished.
+std::mutex prefetchedMutex;
+std::map<llvm::sys::fs::UniqueID, PrefetchedFile> prefetchedFiles;
+
+bool isIdentifierStart(char c) {
+  return std::isalpha(static_cast<unsigned char>(c)) || c == '_' ||
+         static_cast<unsigned char>(c) >= 0x80; // Unicode identifier
+}
+
+bool isIdentifierChar(char c) {
+  return isIdentifierStart(c) || std::isdigit(static_cast<unsigned char>(c));
+}
+
+/// Finds the names of the modules imported anywhere in a D source file. Only
+/// tokenizes as far as needed to skip comments and string literals; imports
+/// in inactive conditional code are found too.
+/// The buffer must be terminated by 2 zero bytes, as for the lexer.
+class ImportScanner {
+  const char *p;
+  const char *const end;
+
+public:
+  std::vector<std::string> imports;
+
+  ImportScanner(const char *begin, size_t length)
+      : p(begin), end(begin + length) {}
+
+  void scan() {
+    while (true) {
+      skipWhitespaceAndComments();
+      if (p >= end)
+        return;
+      const char c = *p;
+      if (c == '"' || c == '\'') {
+        skipString(c, true);
+      } else if (c == '`') {
+        skipString(c, false);
+      } else if (c == 'r' && p[1] == '"') {
+        ++p;
+        skipString('"', false);
+      } else if (c == 'q' && p[1] == '"') {
+        skipDelimitedString();
+      } else if (isIdentifierChar(c)) {
+        const std::string ident = identifier();
+        if (ident == "import") {
+          scanImportDeclaration();
+        } else if (ident == "__EOF__") {
+          return;
+        }
+      } else {
+        ++p;
+      }
+    }
+  }
+
+private:
+  std::string identifier() {
+    const char *start = p;
+    while (p < end && isIdentifierChar(*p))
+      ++p;
+    return std::string(start, p);
+  }
+
+  void skipWhitespaceAndComments() {
+    while (p < end) {
+      if (std::isspace(static_cast<unsigned char>(*p))) {
+        ++p;
+      } else if (p[0] == '/' && p[1] == '/') {
+        while (p < end && *p != '\n')
+          ++p;
+      } else if (p[0] == '/' && p[1] == '*') {
+        p += 2;
+        while (p < end && !(p[0] == '*' && p[1] == '/'))
+          ++p;
+        p += 2;
+      } else if (p[0] == '/' && p[1] == '+') {
+        p += 2;
+        for (int nesting = 1; p < end && nesting;) {
+          if (p[0] == '/' && p[1] == '+') {
+            ++nesting;
+            p += 2;
+          } else if (p[0] == '+' && p[1] == '/') {
+            --nesting;
+            p += 2;
+          } else {
+            ++p;
+          }
+        }
+      } else {
+        break;
+      }
+    }
+  }
+
+  // Skips the literal starting at p (at the opening quote).
+  void skipString(char quote, bool escapes) {
+    for (++p; p < end && *p != quote; ++p) {
+      if (escapes && *p == '\\')
+        ++p;
+    }
+    ++p;
+  }
+
+  // q"(...)", q"/.../", q"EOS ... EOS"
+  void skipDelimitedString() {
+    p += 2;
+    if (p >= end)
+      return;
+    const char open = *p;
+    if (isIdentifierStart(open)) {
+      const std::string delimiter = identifier();
+      while (p < end) {
+        while (p < end && *p != '\n')
+          ++p;
+        ++p;
+        if (static_cast<size_t>(end - p) > delimiter.size() &&
+            std::strncmp(p, delimiter.c_str(), delimiter.size()) == 0 &&
+            p[delimiter.size()] == '"') {
+          p += delimiter.size() + 1;
+          return;
+        }
+      }
+      return;
+    }
+    const char close = open == '(' ? ')'
+                     : open == '[' ? ']'
+                     : open == '{' ? '}'
+                     : open == '<' ? '>' : open;
+    int nesting = 0;
+    for (++p; p < end; ++p) {
+      if (close != open && *p == open) {
+        ++nesting;
+      } else if (*p == close && (nesting-- == 0) && p[1] == '"') {
+        p += 2;
+        return;
+      }
+    }
+  }
+
+  // import [alias =] a.b.c [, ...] [: bindings];
+  void scanImportDeclaration() {
+    skipWhitespaceAndComments();
+    if (p < end && *p == '(')
+      return; // import("file") expression
+    while (true) {
+      skipWhitespaceAndComments();
+      if (p >= end || !isIdentifierStart(*p))
+        return;
+      std::string name = identifier();
+      skipWhitespaceAndComments();
+      if (p < end && *p == '=') {
+        ++p;
+        skipWhitespaceAndComments();
+        if (p >= end || !isIdentifierStart(*p))
+          return;
+        name = identifier();
+        skipWhitespaceAndComments();
+      }
+      while (p < end && *p == '.') {
+        ++p;
+        skipWhitespaceAndComments();
+        if (p >= end || !isIdentifierStart(*p))
+          return;
+        name += '.';
+        name += identifier();
+        skipWhitespaceAndComments();
+      }
+      imports.push_back(std::move(name));
+      if (p >= end || *p != ',')
+        return; // ';' or the selective imports of the last module
+      ++p;
+    }
+  }
+};
+
+#ifndef _WIN32
+/// Maps a regular file into memory, like File::readMapped(): if the last page
+/// has at least 2 bytes of zero-filled slack, which the lexer expects.
+bool mapFile(const std::string &path, PrefetchedFile &result) {
+  const int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd == -1)
+    return false;
+  void *p = MAP_FAILED;
+  struct stat st;
+  if (::fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+    const size_t size = static_cast<size_t>(st.st_size);
+    const size_t pageSize = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+    const size_t tail = size % pageSize;
+    if (tail != 0 && pageSize - tail >= 2) {
+      p = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+      if (p != MAP_FAILED)
+        result = {static_cast<unsigned char *>(p), size, true};
+    }
+  }
+  ::close(fd);
+  return p != MAP_FAILED;
+}
+#endif
+
+/// Maps a file into memory like File::readMapped() if possible. Otherwise
+/// reads it into a malloc'd buffer terminated by 2 zero bytes, like
+/// File::read().
+bool readFile(const std::string &path, PrefetchedFile &result) {
+#ifndef _WIN32
+  if (mapFile(path, result))
+    return true;
+#endif
+  FILE *f = std::fopen(path.c_str(), "rb");
+  if (!f)
+    return false;
+  bool ok = false;
+  if (std::fseek(f, 0, SEEK_END) == 0) {
+    const long size = std::ftell(f);
+    if (size >= 0 && std::fseek(f, 0, SEEK_SET) == 0) {
+      auto buffer = static_cast<unsigned char *>(std::malloc(size + 2));
+      if (buffer && std::fread(buffer, 1, size, f) == size_t(size)) {
+        buffer[size] = 0;
+        buffer[size + 1] = 0;
+        result = {buffer, size_t(size), false};
+        ok = true;
+      } else {
+        std::free(buffer);
+      }
+    }
+  }
+  std::fclose(f);
+  return ok;
+}
+
+void releaseFile(PrefetchedFile &file) {
+#ifndef _WIN32
+  if (file.mapped) {
+    ::munmap(file.buffer, file.length);
+    return;
+  }
+#endif
+  std::free(file.buffer);
+}
+
+class Prefetcher {
+  llvm::ThreadPool pool;
+  std::vector<std::string> importPaths;
+
+  std::mutex mutex;
+  llvm::StringSet<> scheduledModules;
+  std::set<llvm::sys::fs::UniqueID> scannedFiles;
+
+public:
+  explicit Prefetcher(unsigned numThreads) : pool(numThreads) {
+    importPaths.push_back(""); // relative to the working directory first
+    if (global.path) {
+      for (const char *path : *global.path)
+        importPaths.push_back(path);
+    }
+  }
+
+  void wait() { pool.wait(); }
+
+  /// Scans a root module's source file for imports.
+  void scheduleRootFile(const char *path) {
+    llvm::sys::fs::UniqueID id;
+    if (llvm::sys::fs::getUniqueID(path, id))
+      return;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (!scannedFiles.insert(id).second)
+        return;
+    }
+    std::string file = path;
+    pool.async([this, file] {
+      PrefetchedFile contents;
+      if (!readFile(file, contents))
+        return;
+      scan(contents);
+      releaseFile(contents);
+    });
+  }
+
+private:
+  void scheduleModule(const std::string &fqn) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (!scheduledModules.insert(fqn).second)
+        return;
+    }
+    pool.async([this, fqn] { prefetchModule(fqn); });
+  }
+
+  void scan(const PrefetchedFile &contents) {
+    ImportScanner scanner(reinterpret_cast<const char *>(contents.buffer),
+                          contents.length);
+    scanner.scan();
+    for (const auto &fqn : scanner.imports)
+      scheduleModule(fqn);
+  }
+
+  // The same lookup as lookForSourceFile() in dmd/dmodule.d.
+  std::string findSourceFile(const std::string &fqn) {
+    llvm::SmallString<128> relative;
+    for (llvm::StringRef rest = fqn; !rest.empty();) {
+      const auto parts = rest.split('.');
+      llvm::sys::path::append(relative, parts.first);
+      rest = parts.second;
+    }
+    for (const auto &importPath : importPaths) {
+      llvm::SmallString<256> base(importPath);
+      llvm::sys::path::append(base, relative);
+      for (const char *ext : {".di", ".d"}) {
+        const std::string path = (base + ext).str();
+        if (llvm::sys::fs::is_regular_file(path))
+          return path;
+      }
+      if (llvm::sys::fs::is_directory(base)) {
+        for (const char *name : {"package.di", "package.d"}) {
+          llvm::SmallString<256> path(base);
+          llvm::sys::path::append(path, name);
+          if (llvm::sys::fs::is_regular_file(path))
+            return path.str().str();
+        }
+      }
+    }
+    return std::string();
+  }
+
+  void prefetchModule(const std::string &fqn) {
+    const std::string path = findSourceFile(fqn);
+    llvm::sys::fs::UniqueID id;
+    if (path.empty() || llvm::sys::fs::getUniqueID(path, id))
+      return;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (!scannedFiles.insert(id).second)
+        return; // a root module, or imported under another name
+    }
+
+    PrefetchedFile contents;
+    if (!readFile(path, contents))
+      return;
+    scan(contents);
+
+    std::lock_guard<std::mutex> lock(prefetchedMutex);
+    prefetchedFiles.emplace(id, contents);
+  }
+};
+
+} // anonymous namespace
+
+void prefetchImports(Modules &modules) {
+  releasePrefetchedImports(); // of a previous compilation (-compile-server)
+  if (!prefetchImportsOpt)
+    return;
+
+  if (timetrace::isEnabled())
+    timetrace::begin("Prefetch imports");
+  const auto start = std::chrono::steady_clock::now();
+
+  Prefetcher prefetcher(ldc::ParallelModuleWriter::getNumThreads());
+  for (Module *m : modules) {
+    if (m->srcfile && !m->isDocFile)
+      prefetcher.scheduleRootFile(m->srcfile->name.toChars());
+  }
+  prefetcher.wait();
+
+  if (timetrace::isEnabled())
+    timetrace::end();
+
+  if (global.params.verbose) {
+    const std::chrono::duration<double, std::milli> elapsed =
+        std::chrono::steady_clock::now() - start;
+    size_t numMapped = 0;
+    for (const auto &entry : prefetchedFiles)
+      numMapped += entry.second.mapped;
+    message("prefetch  %llu imported files (%llu mapped) in %.1f ms",
+            static_cast<unsigned long long>(prefetchedFiles.size()),
+            static_cast<unsigned long long>(numMapped), elapsed.count());
+  }
+}
+
+bool takePrefetchedImport(File *file) {
+  if (prefetchedFiles.empty() || file->len)
+    return false;
+
+  llvm::sys::fs::UniqueID id;
+  if (llvm::sys::fs::getUniqueID(file->name.toChars(), id))
+    return false;
+  const auto it = prefetchedFiles.find(id);
+  if (it == prefetchedFiles.end())
+    return false;
+
+  // The File owns the buffer now, releaseBuffer() unmaps or frees it.
+  file->releaseBuffer();
+  file->setbuffer(it->second.buffer, it->second.length);
+  file->ref = it->second.mapped ? 2 : 0;
+  prefetchedFiles.erase(it);
+  return true;
+}
+
+void releasePrefetchedImports() {
+  for (auto &entry : prefetchedFiles)
+    releaseFile(entry.second);
+  prefetchedFiles.clear();
+}
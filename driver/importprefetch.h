@@ -0,0 +1,33 @@
+//===-- driver/importprefetch.h - Concurrent reading of imports -*- C++ -*-===//
+//
+//                         LDC – the LLVM D compiler
+//
+// This file is distributed under the BSD-style LDC license. See the LICENSE
+// file for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Opt-in (-prefetch-imports) discovery of the transitively imported modules
+// before the semantic analysis. The import declarations are found by a cheap
+// scan of the source files, which are read concurrently and handed over to
+// the frontend once it loads the module.
+//
+//===----------------------------------------------------------------------===//
+
+#pragma once
+
+#include "dmd/arraytypes.h"
+
+struct File;
+
+/// Reads the source files imported by the (parsed) root `modules`, and the
+/// ones imported by those etc., on up to -codegen-threads threads.
+void prefetchImports(Modules &modules);
+
+/// Moves the prefetched contents of `file` into its buffer. Returns false if
+/// the file hasn't been prefetched.
+bool takePrefetchedImport(File *file);
+
+/// Frees the prefetched files never imported (e.g., in inactive version
+/// blocks).
+void releasePrefetchedImports();
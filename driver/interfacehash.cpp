@@ -0,0 +1,66 @@
+//===-- driver/interfacehash.cpp ------------------------------------------===//
+//
+//                         LDC – the LLVM D compiler
+//
+// This file is distributed under the BSD-style LDC license. See the LICENSE
+// file for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "driver/interfacehash.h"
+
+#include "dmd/errors.h"
+#include "dmd/globals.h"
+#include "dmd/hdrgen.h"
+#include "dmd/module.h"
+#include "dmd/root/file.h"
+#include "dmd/root/outbuffer.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MD5.h"
+#include "llvm/Support/raw_ostream.h"
+#include <string>
+
+namespace {
+
+llvm::cl::opt<std::string> depsHashes(
+    "deps-hashes", llvm::cl::ZeroOrMore, llvm::cl::value_desc("filename"),
+    llvm::cl::desc("Write a hash of the interface of each module (as in a "
+                   "generated .di file) to <filename>"));
+
+std::string hashInterface(Module *m) {
+  OutBuffer buf;
+  moduleInterfaceToBuffer(&buf, m);
+
+  llvm::MD5 hasher;
+  hasher.update(llvm::StringRef(reinterpret_cast<const char *>(buf.data),
+                                buf.offset));
+  llvm::MD5::MD5Result result;
+  hasher.final(result);
+  llvm::SmallString<32> hex;
+  llvm::MD5::stringifyResult(result, hex);
+  return hex.str().str();
+}
+
+} // anonymous namespace
+
+void writeInterfaceHashes() {
+  if (depsHashes.empty())
+    return;
+
+  std::error_code ec;
+  llvm::raw_fd_ostream os(depsHashes, ec, llvm::sys::fs::F_Text);
+  if (ec) {
+    error(Loc(), "cannot write interface hashes file '%s': %s",
+          depsHashes.c_str(), ec.message().c_str());
+    return;
+  }
+
+  for (Module *m : Module::amodules) {
+    if (!m->srcfile || m->isDocFile)
+      continue;
+    os << m->toPrettyChars() << " (" << m->srcfile->name.toChars()
+       << ") : " << hashInterface(m) << '\n';
+  }
+}
@@ -0,0 +1,23 @@
+//===-- driver/interfacehash.h - Hashes of module interfaces ----*- C++ -*-===//
+//
+//                         LDC – the LLVM D compiler
+//
+// This file is distributed under the BSD-style LDC license. See the LICENSE
+// file for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// -deps-hashes=<file> writes a hash of the interface of each module of the
+// compilation, next to the -deps output. The interface is the module as it
+// would appear in a generated .di file keeping all function bodies (importers
+// may evaluate them via CTFE or inline them), so that edits of comments,
+// unittests and formatting leave the hash of an imported module unchanged, and
+// a build tool can skip recompiling its dependents.
+//
+//===----------------------------------------------------------------------===//
+
+#pragma once
+
+/// Writes the interface hashes of all modules to the -deps-hashes file, if
+/// requested.
+void writeInterfaceHashes();
@@ -739,17 +739,33 @@ std::string locateBinary(std::string exeName) {
 // In driver/main.d
 int main(int argc, char **argv);
 
+#if LDC_LDMD_MULTICALL
+// In driver/main.cpp
+int cppmain(int argc, char **argv);
+
+/// Entry point if this is a multi-call binary invoked as ldmd2 (see cppmain()
+/// in driver/main.cpp). The translated command line is compiled in-process.
+int ldmdMain(int argc, char **argv) {
+#else
 int cppmain(int argc, char **argv) {
+#endif
   exe_path::initialize(argv[0]);
 
   std::string ldcExeName = LDC_EXE_NAME;
 #ifdef _WIN32
   ldcExeName += ".exe";
 #endif
-  const std::string ldcPath = locateBinary(ldcExeName);
+  std::string ldcPath = locateBinary(ldcExeName);
+#if LDC_LDMD_MULTICALL
+  // The ldc2 executable is this one, possibly under another name.
+  if (ldcPath.empty()) {
+    ldcPath = exe_path::getExePath();
+  }
+#else
   if (ldcPath.empty()) {
     error("Could not locate " LDC_EXE_NAME " executable.");
   }
+#endif
 
   // We need to manually set up argv[0] and the terminating NULL.
   std::vector<const char *> args;
@@ -759,6 +775,12 @@ int cppmain(int argc, char **argv) {
 
   args.push_back(nullptr);
 
+#if LDC_LDMD_MULTICALL
+  // No command line length limit in-process.
+  return cppmain(static_cast<int>(args.size() - 1),
+                 const_cast<char **>(args.data()));
+#endif
+
   // Check if we can get away without a response file.
   const size_t totalLen = std::accumulate(
       args.begin(), args.end() - 1,
@@ -15,15 +15,22 @@
 #include "driver/exe_path.h"
 #include "driver/ldc-version.h"
 #include "driver/linker.h"
+#include "driver/toobj.h"
 #include "driver/tool.h"
 #include "gen/irstate.h"
 #include "gen/logger.h"
 #include "gen/optimizer.h"
 #include "llvm/ProfileData/InstrProf.h"
+#include "llvm/ProfileData/InstrProfReader.h"
 #include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
 #include "llvm/Support/Path.h"
+#include "llvm/Support/Program.h"
 #include "llvm/Target/TargetMachine.h"
 #include "llvm/Target/TargetOptions.h"
+#include <algorithm>
+#include <future>
+#include <set>
 
 #if LDC_WITH_LLD && LDC_LLVM_VER >= 600
 #include "lld/Common/Driver.h"
@@ -37,6 +44,13 @@ static llvm::cl::opt<std::string>
                               "LLVMgold.so (Unixes) or libLTO.dylib (Darwin))"),
                llvm::cl::value_desc("file"));
 
+static llvm::cl::opt<std::string> symbolOrderingFile(
+    "fprofile-symbol-ordering-file", llvm::cl::ZeroOrMore,
+    llvm::cl::desc("Write the functions of the PGO profile (-fprofile-use or "
+                   "-fprofile-instr-use), hottest first, to <file> and pass "
+                   "it to LLD via --symbol-ordering-file"),
+    llvm::cl::value_desc("file"));
+
 static llvm::cl::opt<bool> linkNoCpp(
     "link-no-cpp", llvm::cl::ZeroOrMore, llvm::cl::Hidden,
     llvm::cl::desc("Disable automatic linking with the C++ standard library."));
@@ -61,6 +75,7 @@ private:
   virtual void addCppStdlibLinkFlags(const llvm::Triple &triple);
   virtual void addProfileRuntimeLinkFlags(const llvm::Triple &triple);
   virtual void addXRayLinkFlags(const llvm::Triple &triple);
+  virtual void addSymbolOrderingFlags();
   virtual bool addCompilerRTArchiveLinkFlags(llvm::StringRef baseName,
                                              const llvm::Triple &triple);
 
@@ -71,7 +86,7 @@ private:
 
   void addLTOGoldPluginFlags();
   void addDarwinLTOFlags();
-  void addLTOLinkFlags();
+  virtual void addLTOLinkFlags();
 
   virtual void addLdFlag(const llvm::Twine &flag) {
     args.push_back(("-Wl," + flag).str());
@@ -124,8 +139,17 @@ std::string getLTOGoldPluginPath() {
 void ArgsBuilder::addLTOGoldPluginFlags() {
   addLdFlag("-plugin", getLTOGoldPluginPath());
 
-  if (opts::isUsingThinLTO())
+  if (opts::isUsingThinLTO()) {
     addLdFlag("-plugin-opt=thinlto");
+    // Reuse the backend codegen of unchanged modules.
+    const std::string thinLTOCacheDir = getThinLTOCacheDir();
+    if (!thinLTOCacheDir.empty())
+      addLdFlag("-plugin-opt=cache-dir=" + thinLTOCacheDir);
+    if (opts::codegenThreads.getNumOccurrences()) {
+      addLdFlag("-plugin-opt=jobs=" +
+                llvm::Twine(ldc::ParallelModuleWriter::getNumThreads()));
+    }
+  }
 
   const auto cpu = gTargetMachine->getTargetCPU();
   if (!cpu.empty())
@@ -170,6 +194,12 @@ void ArgsBuilder::addDarwinLTOFlags() {
     args.push_back("-lto_library");
     args.push_back(std::move(dylibPath));
   }
+
+  if (opts::isUsingThinLTO()) {
+    const std::string thinLTOCacheDir = getThinLTOCacheDir();
+    if (!thinLTOCacheDir.empty())
+      addLdFlag("-cache_path_lto", thinLTOCacheDir);
+  }
 }
 
 /// Adds the required linker flags for LTO builds to args.
@@ -341,6 +371,14 @@ void ArgsBuilder::addXRayLinkFlags(const llvm::Triple &triple) {
   if (!triple.isOSLinux())
     warning(Loc(), "XRay may not be fully supported on non-Linux target OS.");
 
+  if (opts::fXRayDmdTrace) {
+    // Pull in the trace.log handler (its initializer isn't referenced), and
+    // export the function symbols for naming them in trace.log.
+    addLdFlag("-u", "ldc_xray_trace_init");
+    args.push_back("-lldc-xray-trace");
+    addLdFlag("--export-dynamic");
+  }
+
   bool libraryFoundAndLinked = addCompilerRTArchiveLinkFlags("xray", triple);
 #if LDC_LLVM_VER >= 700
   // Since LLVM 7, each XRay mode was split into its own library.
@@ -434,6 +472,70 @@ void ArgsBuilder::addProfileRuntimeLinkFlags(const llvm::Triple &triple) {
   }
 }
 
+// Writes the symbol names of the profiled functions to `path`, one per line,
+// ordered by the maximum counter value of each function, so that the linker
+// can cluster the hot code. Functions never executed are omitted.
+bool writeSymbolOrderingFile(llvm::StringRef path) {
+  auto reader = llvm::IndexedInstrProfReader::create(
+      global.params.datafileInstrProf);
+  if (!reader) {
+    error(Loc(), "cannot read profile `%s`: %s",
+          global.params.datafileInstrProf,
+          llvm::toString(reader.takeError()).c_str());
+    return false;
+  }
+
+  llvm::StringMap<uint64_t> hotness;
+  for (const auto &record : **reader) {
+    uint64_t maxCount = 0;
+    for (uint64_t count : record.Counts)
+      maxCount = std::max(maxCount, count);
+    if (maxCount == 0)
+      continue;
+    // The PGO names of functions with internal linkage are prefixed with
+    // `<filename>:`, mangled D names never contain a colon.
+    llvm::StringRef name = record.Name;
+    name = name.substr(name.rfind(':') + 1);
+    uint64_t &entry = hotness[name];
+    entry = std::max(entry, maxCount);
+  }
+
+  std::vector<std::pair<llvm::StringRef, uint64_t>> symbols;
+  symbols.reserve(hotness.size());
+  for (const auto &entry : hotness)
+    symbols.emplace_back(entry.getKey(), entry.getValue());
+  std::stable_sort(symbols.begin(), symbols.end(),
+                   [](const std::pair<llvm::StringRef, uint64_t> &a,
+                      const std::pair<llvm::StringRef, uint64_t> &b) {
+                     return a.second > b.second ||
+                            (a.second == b.second && a.first < b.first);
+                   });
+
+  std::error_code errinfo;
+  llvm::raw_fd_ostream os(path, errinfo, llvm::sys::fs::F_Text);
+  if (errinfo) {
+    error(Loc(), "cannot write symbol ordering file `%s`: %s",
+          path.str().c_str(), errinfo.message().c_str());
+    return false;
+  }
+  for (const auto &symbol : symbols)
+    os << symbol.first << '\n';
+  return true;
+}
+
+// Adds the hot-function ordering derived from the PGO profile. Only LLD
+// supports --symbol-ordering-file.
+void ArgsBuilder::addSymbolOrderingFlags() {
+  const auto linkerName = llvm::sys::path::filename(opts::linker);
+  if (linkerName != "lld" && linkerName != "ld.lld") {
+    warning(Loc(), "-fprofile-symbol-ordering-file requires linking with LLD "
+                   "(-linker=lld), ignoring");
+    return;
+  }
+  if (writeSymbolOrderingFile(symbolOrderingFile))
+    addLdFlag("--symbol-ordering-file", symbolOrderingFile);
+}
+
 void ArgsBuilder::addSanitizers(const llvm::Triple &triple) {
   if (opts::isSanitizerEnabled(opts::AddressSanitizer)) {
     addASanLinkFlags(triple);
@@ -475,6 +577,10 @@ void ArgsBuilder::build(llvm::StringRef outputPath,
     args.push_back("-lldc-jit");
   }
 
+  if (global.params.linkParallelRuntime) {
+    args.push_back("-lldc-parallel-rt");
+  }
+
   // user libs
   for (auto libfile : global.params.libfiles) {
     args.push_back(libfile);
@@ -506,6 +612,16 @@ void ArgsBuilder::build(llvm::StringRef outputPath,
     addLTOLinkFlags();
 
   addLinker();
+
+  if (!symbolOrderingFile.empty()) {
+    if (opts::isUsingASTBasedPGOProfile() || opts::isUsingIRBasedPGOProfile()) {
+      addSymbolOrderingFlags();
+    } else {
+      error(Loc(), "-fprofile-symbol-ordering-file requires -fprofile-use or "
+                   "-fprofile-instr-use");
+    }
+  }
+
   addUserSwitches();
 
   // lib dirs
@@ -685,14 +801,222 @@ class LdArgsBuilder : public ArgsBuilder {
   }
 };
 
+#if LDC_WITH_LLD && LDC_LLVM_VER >= 600
+//////////////////////////////////////////////////////////////////////////////
+// Specialization for linking ELF binaries with the internal LLD. The args are
+// still for the gcc driver, which is only queried for the ld command line it
+// would run (startup files, C libraries, dynamic linker etc.).
+
+class LLDArgsBuilder : public ArgsBuilder {
+  // Both the thread count for linking and the ThinLTO backend jobs derive
+  // from -j, if given. LLD uses all cores by default.
+  void addLinker() override {
+    if (!opts::codegenThreads.getNumOccurrences())
+      return;
+    const unsigned numThreads = ldc::ParallelModuleWriter::getNumThreads();
+    addLdFlag(numThreads > 1 ? "--threads" : "--no-threads");
+    if (opts::isUsingThinLTO())
+      addLdFlag("--thinlto-jobs=" + llvm::Twine(numThreads));
+  }
+
+  // LLD implements LTO natively, no plugin needed.
+  void addLTOLinkFlags() override {
+    if (opts::isUsingThinLTO()) {
+      const std::string thinLTOCacheDir = getThinLTOCacheDir();
+      if (!thinLTOCacheDir.empty())
+        addLdFlag("--thinlto-cache-dir=" + thinLTOCacheDir);
+    }
+
+    const auto cpu = gTargetMachine->getTargetCPU();
+    if (!cpu.empty())
+      addLdFlag("-mllvm", llvm::Twine("-mcpu=") + cpu);
+
+    addLdFlag("--lto-O" + llvm::Twine(std::min<int>(optLevel(), 3)));
+  }
+
+  void addSymbolOrderingFlags() override {
+    if (writeSymbolOrderingFile(symbolOrderingFile))
+      addLdFlag("--symbol-ordering-file", symbolOrderingFile);
+  }
+};
+
+// Splits a command line as printed by `gcc -###` ("arg1" "arg2" ...).
+std::vector<std::string> splitGccCommandLine(llvm::StringRef line) {
+  std::vector<std::string> result;
+  for (size_t i = 0; i < line.size(); ++i) {
+    if (line[i] != '"')
+      continue;
+    std::string arg;
+    for (++i; i < line.size() && line[i] != '"'; ++i) {
+      if (line[i] == '\\' && i + 1 < line.size())
+        ++i;
+      arg += line[i];
+    }
+    result.push_back(std::move(arg));
+  }
+  return result;
+}
+
+/// Asks the gcc driver for the ld command line it would run for `gccArgs`,
+/// without the gcc-specific linker plugin args. Returns false on failure.
+/// This doesn't require the input files to exist yet.
+bool getLdArgsFromGcc(const std::string &gcc,
+                      const std::vector<std::string> &gccArgs,
+                      std::vector<std::string> &ldArgs) {
+
+  llvm::SmallString<128> outputPath;
+  if (llvm::sys::fs::createTemporaryFile("ldc-link", "txt", outputPath))
+    return false;
+
+  std::vector<std::string> args = gccArgs;
+  args.push_back("-###");
+  auto realargs = getFullArgs(gcc.c_str(), args, false);
+  const llvm::StringRef output = outputPath;
+#if LDC_LLVM_VER >= 700
+  std::vector<llvm::StringRef> argv(realargs.begin(), realargs.end());
+  const llvm::Optional<llvm::StringRef> redirects[] = {llvm::None, llvm::None,
+                                                       output};
+  const int status =
+      llvm::sys::ExecuteAndWait(gcc, argv, llvm::None, redirects);
+#else
+  realargs.push_back(nullptr); // terminate with null
+  const llvm::Optional<llvm::StringRef> redirects[] = {llvm::None, llvm::None,
+                                                       output};
+  const int status =
+      llvm::sys::ExecuteAndWait(gcc, &realargs[0], nullptr, redirects);
+#endif
+
+  auto buffer = llvm::MemoryBuffer::getFile(outputPath);
+  llvm::sys::fs::remove(outputPath);
+  if (status != 0 || !buffer)
+    return false;
+
+  // The linker invocation (collect2 or ld) is the last command.
+  llvm::SmallVector<llvm::StringRef, 16> lines;
+  (*buffer)->getBuffer().split(lines, '\n', -1, false);
+  std::vector<std::string> command;
+  for (auto it = lines.rbegin(); it != lines.rend() && command.empty(); ++it) {
+    if (it->startswith(" \""))
+      command = splitGccCommandLine(*it);
+  }
+  if (command.size() < 2)
+    return false;
+
+  for (size_t i = 1; i < command.size(); ++i) {
+    const llvm::StringRef arg = command[i];
+    if (arg == "-plugin") {
+      ++i; // skip the plugin path too
+    } else if (!arg.startswith("-plugin-opt=") && !arg.startswith("-fuse-ld=")) {
+      ldArgs.push_back(arg);
+    }
+  }
+  return true;
+}
+
+struct LdArgsQuery {
+  std::vector<std::string> gccArgs;
+  std::future<bool> success;
+  std::vector<std::string> ldArgs;
+};
+
+// The query started by startLinkPreparationGcc(), if any.
+std::unique_ptr<LdArgsQuery> pendingLdArgsQuery;
+
+/// Builds the gcc driver command line for querying the ld command line.
+std::vector<std::string>
+buildGccArgsForQuery(llvm::StringRef outputPath,
+                     const std::vector<std::string> &defaultLibNames) {
+  LLDArgsBuilder argsBuilder;
+  argsBuilder.build(outputPath, defaultLibNames);
+
+  // The object files are usually still being generated. gcc checks that its
+  // input files exist, so pass them through to ld verbatim instead, which
+  // keeps their order relative to the other linker inputs.
+  std::set<llvm::StringRef> inputFiles;
+  for (auto files : {&global.params.objfiles, &global.params.libfiles,
+                     &global.params.dllfiles}) {
+    for (const char *file : *files)
+      inputFiles.insert(file);
+  }
+  std::vector<std::string> gccArgs;
+  gccArgs.reserve(argsBuilder.args.size());
+  for (auto &arg : argsBuilder.args) {
+    if (inputFiles.count(arg))
+      gccArgs.push_back("-Xlinker");
+    gccArgs.push_back(std::move(arg));
+  }
+  return gccArgs;
+}
+
+/// Starts querying the gcc driver for the ld command line in the background.
+std::unique_ptr<LdArgsQuery> startLdArgsQuery(std::vector<std::string> gccArgs) {
+  auto query = llvm::make_unique<LdArgsQuery>();
+  query->gccArgs = std::move(gccArgs);
+  auto q = query.get();
+  query->success = std::async(std::launch::async, [q](std::string gcc) {
+    return getLdArgsFromGcc(gcc, q->gccArgs, q->ldArgs);
+  }, getGcc());
+  return query;
+}
+
+/// Links the ELF binary with the internal LLD, using the gcc driver's linker
+/// command line. Returns -1 if that command line cannot be determined, in
+/// which case the caller falls back to the external toolchain.
+int linkObjToBinaryGccWithLLD(llvm::StringRef outputPath,
+                              const std::vector<std::string> &defaultLibNames) {
+  // Reuse the query started before code generation if nothing has changed.
+  auto gccArgs = buildGccArgsForQuery(outputPath, defaultLibNames);
+  std::unique_ptr<LdArgsQuery> query = std::move(pendingLdArgsQuery);
+  if (!query || query->gccArgs != gccArgs)
+    query = startLdArgsQuery(std::move(gccArgs));
+
+  const bool success = query->success.get();
+  const std::vector<std::string> &ldArgs = query->ldArgs;
+  if (!success) {
+    if (global.params.verbose) {
+      message("cannot query %s for the linker command line, linking "
+              "externally",
+              getGcc().c_str());
+    }
+    return -1;
+  }
+
+  return linkWithCache("lld", ldArgs, outputPath, [&] {
+    const auto fullArgs = getFullArgs("lld", ldArgs, global.params.verbose);
+    const bool CanExitEarly = false;
+    if (!lld::elf::link(fullArgs, CanExitEarly)) {
+      error(Loc(), "linking with LLD failed");
+      return 1;
+    }
+    return 0;
+  });
+}
+#endif // LDC_WITH_LLD && LDC_LLVM_VER >= 600
+
 } // anonymous namespace
 
 //////////////////////////////////////////////////////////////////////////////
 
+void startLinkPreparationGcc(llvm::StringRef outputPath,
+                             const std::vector<std::string> &defaultLibNames) {
+#if LDC_WITH_LLD && LDC_LLVM_VER >= 600
+  if (global.params.targetTriple->isOSBinFormatELF())
+    pendingLdArgsQuery =
+        startLdArgsQuery(buildGccArgsForQuery(outputPath, defaultLibNames));
+#endif
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
 int linkObjToBinaryGcc(llvm::StringRef outputPath,
                        const std::vector<std::string> &defaultLibNames) {
 #if LDC_WITH_LLD && LDC_LLVM_VER >= 600
-  if (useInternalLLDForLinking()) {
+  const auto &triple = *global.params.targetTriple;
+  if (useInternalLLDForLinking() && triple.isOSBinFormatELF()) {
+    const int status = linkObjToBinaryGccWithLLD(outputPath, defaultLibNames);
+    if (status >= 0)
+      return status;
+  } else if (useInternalLLDForLinking()) {
     LdArgsBuilder argsBuilder;
     argsBuilder.build(outputPath, defaultLibNames);
 
@@ -760,5 +1084,8 @@ int linkObjToBinaryGcc(llvm::StringRef outputPath,
   logstr << "\n"; // FIXME where's flush ?
 
   // try to call linker
-  return executeToolAndWait(tool, argsBuilder->args, global.params.verbose);
+  const auto &args = argsBuilder->args;
+  return linkWithCache(tool, args, outputPath, [&] {
+    return executeToolAndWait(tool, args, global.params.verbose);
+  });
 }
@@ -129,6 +129,13 @@ int linkObjToBinaryMSVC(llvm::StringRef outputPath,
 
   args.push_back(("/OUT:" + outputPath).str());
 
+  // reuse the ThinLTO backend codegen of unchanged modules (lld-link only)
+  if (opts::isUsingThinLTO()) {
+    const std::string thinLTOCacheDir = getThinLTOCacheDir();
+    if (!thinLTOCacheDir.empty())
+      args.push_back("/lldltocache:" + thinLTOCacheDir);
+  }
+
   // object files
   for (auto objfile : global.params.objfiles) {
     args.push_back(objfile);
@@ -145,6 +152,10 @@ int linkObjToBinaryMSVC(llvm::StringRef outputPath,
     args.push_back("ldc-jit.lib");
   }
 
+  if (global.params.linkParallelRuntime) {
+    args.push_back("ldc-parallel-rt.lib");
+  }
+
   // user libs
   for (auto libfile : global.params.libfiles) {
     args.push_back(libfile);
@@ -10,13 +10,16 @@
 #include "driver/linker.h"
 
 #include "dmd/errors.h"
+#include "driver/cache.h"
 #include "driver/cl_options.h"
+#include "driver/timetrace.h"
 #include "driver/tool.h"
 #include "gen/llvm.h"
 #include "gen/logger.h"
 #include "llvm/IRReader/IRReader.h"
 #include "llvm/Linker/Linker.h"
 #include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Path.h"
 #include "llvm/Support/SourceMgr.h"
 #include <sstream>
 
@@ -62,12 +65,33 @@ static cl::opt<cl::boolOrDefault> linkDefaultLibShared(
     cl::desc("Link with shared versions of default libraries"),
     cl::cat(opts::linkingCategory));
 
+static cl::opt<bool> linkDefaultLibLTO(
+    "defaultlib-lto", cl::ZeroOrMore,
+    cl::desc("Link with the LLVM bitcode versions of the static default "
+             "libraries (-lto suffix), for LTO across the runtime (requires "
+             "-flto and a runtime built with BUILD_LTO_LIBS=ON)"),
+    cl::cat(opts::linkingCategory));
+
+static cl::opt<bool> linkDefaultLibCPU(
+    "link-defaultlib-cpu", cl::ZeroOrMore,
+    cl::desc("Link with the versions of the release default libraries "
+             "optimized for the -mcpu CPU (-<cpu> suffix, requires a runtime "
+             "built with RT_CPU_VARIANTS containing that CPU)"),
+    cl::cat(opts::linkingCategory));
+
 static cl::opt<cl::boolOrDefault>
     staticFlag("static", cl::ZeroOrMore,
                cl::desc("Create a statically linked binary, including "
                         "all system dependencies"),
                cl::cat(opts::linkingCategory));
 
+static cl::opt<bool> bitcodeOnlyNeeded(
+    "link-bitcode-only-needed", cl::ZeroOrMore,
+    cl::desc("Only link in the definitions of the LLVM bitcode files passed "
+             "on the command line which are referenced by the (first) module, "
+             "e.g., for bitcode libraries used for inlining"),
+    cl::cat(opts::linkingCategory));
+
 static llvm::cl::opt<std::string>
     mscrtlib("mscrtlib", llvm::cl::ZeroOrMore,
              llvm::cl::desc("MS C runtime library to link with"),
@@ -77,6 +101,8 @@ static llvm::cl::opt<std::string>
 //////////////////////////////////////////////////////////////////////////////
 
 // linker-gcc.cpp
+void startLinkPreparationGcc(llvm::StringRef outputPath,
+                             const std::vector<std::string> &defaultLibNames);
 int linkObjToBinaryGcc(llvm::StringRef outputPath,
                        const std::vector<std::string> &defaultLibNames);
 
@@ -147,6 +173,31 @@ static std::vector<std::string> getDefaultLibNames() {
         (linkDefaultLibDebug && debugLib.getNumOccurrences() == 0);
     const bool addSharedSuffix = linkAgainstSharedDefaultLibs();
 
+    bool addLTOSuffix = false;
+    if (linkDefaultLibLTO) {
+      if (!opts::isUsingLTO()) {
+        error(Loc(), "-defaultlib-lto requires -flto");
+      } else if (addSharedSuffix) {
+        warning(Loc(), "-defaultlib-lto: there are no shared bitcode default "
+                       "libraries, linking the regular shared ones");
+      } else {
+        addLTOSuffix = true;
+      }
+    }
+
+    std::string cpuSuffix;
+    if (linkDefaultLibCPU) {
+      const std::string cpu = opts::getCPUStr();
+      if (cpu.empty()) {
+        error(Loc(), "-link-defaultlib-cpu requires -mcpu");
+      } else if (linkDefaultLibDebug) {
+        warning(Loc(), "-link-defaultlib-cpu: there are no CPU-specific debug "
+                       "default libraries, linking the generic ones");
+      } else {
+        cpuSuffix = "-" + cpu;
+      }
+    }
+
     // Parse comma-separated default library list.
     std::stringstream libNames(
         linkDefaultLibDebug && !addDebugSuffix ? debugLib : defaultLib);
@@ -157,7 +208,8 @@ static std::vector<std::string> getDefaultLibNames() {
         continue;
       }
 
-      result.push_back((llvm::Twine(lib) + (addDebugSuffix ? "-debug" : "") +
+      result.push_back((llvm::Twine(lib) + (addLTOSuffix ? "-lto" : "") +
+                        (addDebugSuffix ? "-debug" : "") + cpuSuffix +
                         (addSharedSuffix ? "-shared" : ""))
                            .str());
     }
@@ -205,11 +257,25 @@ llvm::StringRef getMscrtLibName() {
 
 //////////////////////////////////////////////////////////////////////////////
 
+std::string getThinLTOCacheDir() {
+  if (opts::cacheDir.empty())
+    return "";
+  llvm::SmallString<128> dir(opts::cacheDir.c_str());
+  llvm::sys::fs::make_absolute(dir);
+  llvm::sys::path::append(dir, "thinlto");
+  return dir.str().str();
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
 /// Insert an LLVM bitcode file into the module
 static void insertBitcodeIntoModule(const char *bcFile, llvm::Module &M,
                                     llvm::LLVMContext &Context) {
   Logger::println("*** Linking-in bitcode file %s ***", bcFile);
 
+  // The file is memory-mapped and the function bodies are only materialized
+  // when linked in, so that unneeded parts of large bitcode libraries are
+  // never parsed with -link-bitcode-only-needed.
   llvm::SMDiagnostic Err;
   std::unique_ptr<llvm::Module> loadedModule(
       getLazyIRFileModule(bcFile, Err, Context));
@@ -217,7 +283,12 @@ static void insertBitcodeIntoModule(const char *bcFile, llvm::Module &M,
     error(Loc(), "Error when loading LLVM bitcode file: %s", bcFile);
     fatal();
   }
-  llvm::Linker(M).linkInModule(std::move(loadedModule));
+  const unsigned flags = bitcodeOnlyNeeded ? llvm::Linker::LinkOnlyNeeded
+                                           : llvm::Linker::None;
+  if (llvm::Linker(M).linkInModule(std::move(loadedModule), flags)) {
+    error(Loc(), "Error when linking in LLVM bitcode file: %s", bcFile);
+    fatal();
+  }
 }
 
 /// Insert LLVM bitcode files into the module
@@ -235,12 +306,46 @@ static std::string gExePath;
 
 //////////////////////////////////////////////////////////////////////////////
 
+int linkWithCache(llvm::StringRef linker, llvm::ArrayRef<std::string> args,
+                  llvm::StringRef outputPath, llvm::function_ref<int()> link) {
+  llvm::SmallString<32> hash;
+  if (!cache::isLinkCacheEnabled() ||
+      !cache::calculateLinkHash(linker, args, outputPath, hash)) {
+    return link();
+  }
+
+  if (cache::recoverLinkedBinary(hash, outputPath)) {
+    Logger::println("Recovered linked binary from cache");
+    return 0;
+  }
+
+  const int status = link();
+  if (status == 0) {
+    cache::cacheLinkedBinary(outputPath, hash);
+  }
+  return status;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+void startLinkPreparation() {
+  if (!useInternalLLDForLinking() ||
+      global.params.targetTriple->isWindowsMSVCEnvironment()) {
+    return;
+  }
+  startLinkPreparationGcc(getOutputName(), getDefaultLibNames());
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
 int linkObjToBinary() {
   Logger::println("*** Linking executable ***");
 
   // remember output path for later
   gExePath = getOutputName();
 
+  timetrace::Scope timeScope("Link", gExePath);
+
   createDirectoryForFileOrFail(gExePath);
 
   const auto defaultLibNames = getDefaultLibNames();
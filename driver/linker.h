@@ -14,7 +14,10 @@
 
 #pragma once
 
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/STLExtras.h"
 #include "llvm/Support/CommandLine.h" // for llvm::cl::boolOrDefault
+#include <string>
 
 namespace llvm {
 class Module;
@@ -50,12 +53,34 @@ bool useInternalToolchainForMSVC();
  */
 llvm::StringRef getMscrtLibName();
 
+/**
+ * Returns the directory for the linker's ThinLTO cache (a subdirectory of the
+ * -cache directory), or an empty string if caching is disabled.
+ */
+std::string getThinLTOCacheDir();
+
 /**
  * Inserts bitcode files passed on the commandline into a module.
  */
 void insertBitcodeFiles(llvm::Module &M, llvm::LLVMContext &Ctx,
                         Array<const char *> &bitcodeFiles);
 
+/**
+ * Starts preparing the link step in the background, so that it overlaps with
+ * code generation. Currently this is only done for -link-internally on ELF
+ * targets, whose linker command line is queried from the gcc driver.
+ */
+void startLinkPreparation();
+
+/**
+ * Runs `link`, which links `outputPath` with the given linker and arguments,
+ * unless the -cache-link cache contains the result of an identical
+ * invocation.
+ * @return 0 on success.
+ */
+int linkWithCache(llvm::StringRef linker, llvm::ArrayRef<std::string> args,
+                  llvm::StringRef outputPath, llvm::function_ref<int()> link);
+
 /**
  * Link an executable only from object files.
  * @return 0 on success.
@@ -21,6 +21,7 @@
 #include "dmd/root/root.h"
 #include "dmd/scope.h"
 #include "dmd/target.h"
+#include "driver/batch.h"
 #include "driver/cache.h"
 #include "driver/cl_options.h"
 #include "driver/cl_options_instrumentation.h"
@@ -29,12 +30,20 @@
 #include "driver/configfile.h"
 #include "driver/dcomputecodegenerator.h"
 #include "driver/exe_path.h"
+#include "driver/importprefetch.h"
 #include "driver/ldc-version.h"
 #include "driver/linker.h"
 #include "driver/plugins.h"
+#include "driver/remote_codegen.h"
+#include "driver/server.h"
+#include "driver/sizereport.h"
+#include "driver/statsfile.h"
 #include "driver/targetmachine.h"
+#include "driver/timetrace.h"
+#include "driver/toobj.h"
 #include "gen/abi.h"
 #include "gen/cl_helpers.h"
+#include "gen/ctfejit.h"
 #include "gen/irstate.h"
 #include "gen/ldctraits.h"
 #include "gen/linkage.h"
@@ -289,6 +298,56 @@ tryGetExplicitTriple(const llvm::SmallVectorImpl<const char *> &args) {
   return triple;
 }
 
+/// Registers the LLVM passes. Passes also register themselves when created,
+/// so this is only needed for looking them up by name or ID; without
+/// optimizations, the optimization pass groups are skipped.
+void initializePasses(bool optimizing) {
+  using namespace llvm;
+  // Initialize passes
+  PassRegistry &Registry = *PassRegistry::getPassRegistry();
+  initializeCore(Registry);
+  initializeTransformUtils(Registry);
+  if (optimizing) {
+    initializeScalarOpts(Registry);
+    initializeObjCARCOpts(Registry);
+    initializeVectorization(Registry);
+    initializeInstCombine(Registry);
+  }
+  initializeIPO(Registry);
+  initializeInstrumentation(Registry);
+  initializeAnalysis(Registry);
+  initializeCodeGen(Registry);
+  initializeGlobalISel(Registry);
+  initializeTarget(Registry);
+
+// Initialize passes not included above
+#if LDC_LLVM_VER >= 400
+  initializeRewriteSymbolsLegacyPassPass(Registry);
+#else
+  initializeRewriteSymbolsPass(Registry);
+#endif
+  initializeSjLjEHPreparePass(Registry);
+}
+
+/// Returns true if the command line contains options taking LLVM pass names
+/// (e.g., -print-after=<pass>), which need the passes to be registered before
+/// parsing it, or asks for the help output listing them.
+bool needsRegisteredPasses(const llvm::SmallVectorImpl<const char *> &args) {
+  for (size_t i = 1; i < args.size(); ++i) {
+    llvm::StringRef arg = args[i];
+    if (!arg.startswith("-"))
+      continue;
+    arg = arg.ltrim('-');
+    if (arg.startswith("print-before") || arg.startswith("print-after") ||
+        arg.startswith("start-before") || arg.startswith("start-after") ||
+        arg.startswith("stop-before") || arg.startswith("stop-after") ||
+        arg.startswith("run-pass") || arg.startswith("help")) {
+      return true;
+    }
+  }
+  return false;
+}
+
 void expandResponseFiles(llvm::BumpPtrAllocator &A,
                          llvm::SmallVectorImpl<const char *> &args) {
   llvm::StringSaver Saver(A);
@@ -342,9 +401,13 @@ void parseCommandLine(int argc, char **argv, Strings &sourceFiles,
   opts::hideLLVMOptions();
   opts::createClashingOptions();
 
+  if (needsRegisteredPasses(allArguments))
+    initializePasses(/*optimizing=*/true);
+
   cl::ParseCommandLineOptions(allArguments.size(),
                               const_cast<char **>(allArguments.data()),
                               "LDC - the LLVM D compiler\n");
+  statsfile::initialize();
 
   helpOnly = opts::printTargetFeaturesHelp();
   if (helpOnly) {
@@ -581,34 +644,15 @@ void parseCommandLine(int argc, char **argv, Strings &sourceFiles,
     error(Loc(), "-soname can be used only when building a shared library");
   }
 
-  global.params.hdrStripPlainFunctions = !opts::hdrKeepAllBodies;
-  global.params.disableRedZone = opts::disableRedZone();
-}
-
-void initializePasses() {
-  using namespace llvm;
-  // Initialize passes
-  PassRegistry &Registry = *PassRegistry::getPassRegistry();
-  initializeCore(Registry);
-  initializeTransformUtils(Registry);
-  initializeScalarOpts(Registry);
-  initializeObjCARCOpts(Registry);
-  initializeVectorization(Registry);
-  initializeInstCombine(Registry);
-  initializeIPO(Registry);
-  initializeInstrumentation(Registry);
-  initializeAnalysis(Registry);
-  initializeCodeGen(Registry);
-  initializeGlobalISel(Registry);
-  initializeTarget(Registry);
-
-// Initialize passes not included above
 #if LDC_LLVM_VER >= 400
-  initializeRewriteSymbolsLegacyPassPass(Registry);
-#else
-  initializeRewriteSymbolsPass(Registry);
+  if (opts::wholeProgramVtables && !opts::isUsingLTO()) {
+    error(Loc(), "-fwhole-program-vtables requires -flto");
+  }
 #endif
-  initializeSjLjEHPreparePass(Registry);
+
+  global.params.hdrStripPlainFunctions = !opts::hdrKeepAllBodies;
+  global.params.disableRedZone = opts::disableRedZone();
+  global.params.realIsDouble = opts::realPrecision == opts::RealPrecision_Double;
 }
 
 /// Register the MIPS ABI.
@@ -794,6 +838,10 @@ void registerPredefinedTargetVersions() {
     VersionCondition::addPredefinedGlobalIdent("D_PIC");
   }
 
+  if (global.params.realIsDouble) {
+    VersionCondition::addPredefinedGlobalIdent("LDC_RealIsDouble");
+  }
+
   if (arch == llvm::Triple::x86 || arch == llvm::Triple::x86_64) {
     /* LDC doesn't support DMD's core.simd interface.
     if (traitsTargetHasFeature("sse2"))
@@ -966,7 +1014,32 @@ void registerPredefinedVersions() {
 #undef STR
 }
 
+#if LDC_LDMD_MULTICALL
+// In driver/ldmd.cpp
+int ldmdMain(int argc, char **argv);
+
+/// Returns true if this multi-call binary has been invoked as ldmd2, i.e.,
+/// via a link with a file name containing `ldmd`.
+static bool isInvokedAsLdmd(const char *argv0) {
+  return llvm::sys::path::stem(argv0).contains("ldmd");
+}
+#endif
+
 int cppmain(int argc, char **argv) {
+#if LDC_LDMD_MULTICALL
+  // ldmdMain() translates the command line and calls cppmain() again.
+  static bool translatingLdmd = false;
+  if (!translatingLdmd && isInvokedAsLdmd(argv[0])) {
+    translatingLdmd = true;
+    return ldmdMain(argc, argv);
+  }
+#endif
+
+  // Hand the invocation over to a running compile server, if any.
+  int forwardedStatus;
+  if (server::forwardToServer(argc, argv, forwardedStatus))
+    return forwardedStatus;
+
   llvm::sys::PrintStackTraceOnErrorSignal(argv[0]);
 
   exe_path::initialize(argv[0]);
@@ -976,15 +1049,28 @@ int cppmain(int argc, char **argv) {
   global.ldc_version = ldc::ldc_version;
   global.llvm_version = ldc::llvm_version;
 
-  // Initialize LLVM before parsing the command line so that --version shows
-  // registered targets.
-  llvm::InitializeAllTargetInfos();
-  llvm::InitializeAllTargets();
-  llvm::InitializeAllTargetMCs();
-  llvm::InitializeAllAsmPrinters();
-  llvm::InitializeAllAsmParsers();
+  // Register the targets before parsing the command line so that --version
+  // shows them. Only the selected target is initialized, once looked up.
+  registerTargets();
+
+  // In compile server mode, everything following is done per request in a
+  // forked child with the client's command line.
+  if (const char *socketPath = server::getServerSocketPath(argc, argv)) {
+    // Initialize everything once for all requests.
+    initializeAllTargets();
+    initializePasses(/*optimizing=*/true);
+    if (!server::serve(socketPath, argc, argv))
+      return EXIT_FAILURE;
+  }
 
-  initializePasses();
+  // In batch mode, the merged jobs are compiled in forked children.
+  if (const char *batchFile = batch::getBatchFile(argc, argv)) {
+    initializeAllTargets();
+    initializePasses(/*optimizing=*/true);
+    int batchStatus;
+    if (!batch::run(batchFile, argc, argv, batchStatus))
+      return batchStatus;
+  }
 
   bool helpOnly;
   Strings files;
@@ -994,6 +1080,8 @@ int cppmain(int argc, char **argv) {
     return 0;
   }
 
+  initializePasses(isOptimizationEnabled() || opts::isUsingLTO());
+
   if (files.dim == 0) {
     if (global.params.jsonFieldFlags) {
       generateJson(nullptr);
@@ -1040,6 +1128,7 @@ int cppmain(int argc, char **argv) {
       disableLinkerStripDead);
 
   opts::setDefaultMathOptions(gTargetMachine->Options);
+  setupFastDebugCodegen(*gTargetMachine);
 
   static llvm::DataLayout DL = gTargetMachine->createDataLayout();
   gDataLayout = &DL;
@@ -1081,11 +1170,47 @@ int cppmain(int argc, char **argv) {
 
   loadAllPlugins();
 
+  // A remote worker only compiles the bitcode shipped by the client.
+  if (remote::isCodegenJob())
+    return remote::runCodegenJob(files);
+  remote::initialize();
+
   Strings libmodules;
-  return mars_mainBody(files, libmodules);
+  int status;
+  {
+    timetrace::Scope timeScope("Execute compiler");
+    status = mars_mainBody(files, libmodules);
+  }
+
+  timetrace::writeTraceFile();
+  return status;
+}
+
+/// Returns whether the object files of the given modules may be looked up in
+/// the cache before generating any IR for them (-cache-early-lookup).
+static bool canLookupCacheEarly() {
+  // With -singleobj, all modules end up in a single object file. With
+  // -dedup-typeinfo, an object file's contents depend on the previously
+  // emitted ones. Only plain object file output is cached, without .dwo files
+  // for -gsplit-dwarf.
+  return cache::isEarlyLookupEnabled() && !global.params.oneobj &&
+         !(opts::splitDwarf && global.params.symdebug) &&
+         !opts::dedupTypeInfo && global.params.output_o != OUTPUTFLAGno &&
+         global.params.output_ll == OUTPUTFLAGno &&
+         global.params.output_bc == OUTPUTFLAGno &&
+         global.params.output_s == OUTPUTFLAGno;
 }
 
 void codegenModules(Modules &modules) {
+  // CTFE calls during the codegen are always interpreted.
+  ctfeJitFinish();
+  // All imported modules have been loaded by now.
+  releasePrefetchedImports();
+
+  // Object files to be added to the cache once written, with their source
+  // hashes.
+  std::vector<std::pair<std::string, std::string>> earlyCacheMisses;
+
   // Generate one or more object/IR/bitcode files/dcompute kernels.
   if (global.params.obj && !modules.empty()) {
     ldc::CodeGenerator cg(getGlobalContext(), global.params.oneobj);
@@ -1099,6 +1224,20 @@ void codegenModules(Modules &modules) {
     // Therefore, codegen is done in reverse order with members[0] last, to make
     // sure these functions (added to members[0] by members[x>0]) are
     // codegenned.
+    bool lookupCacheEarly = canLookupCacheEarly();
+    // The sources are hashed once for all modules.
+    llvm::SmallString<32> sourcesHash;
+    if (lookupCacheEarly) {
+      makeCacheDirAbsolute();
+      cache::setupRemoteBackend();
+      lookupCacheEarly = cache::calculateSourcesHash(sourcesHash);
+    }
+    if (global.params.link)
+      startLinkPreparation();
+    // The first module must not be restored from the cache if cross-module
+    // inlining has extended it.
+    const d_size_t numFirstModuleMembers =
+        modules[0]->members ? modules[0]->members->dim : 0;
     for (d_size_t i = modules.dim; i-- > 0;) {
       Module *const m = modules[i];
 
@@ -1111,6 +1250,23 @@ void codegenModules(Modules &modules) {
       const auto atCompute = hasComputeAttr(m);
       if (atCompute == DComputeCompileFor::hostOnly ||
           atCompute == DComputeCompileFor::hostAndDevice) {
+        llvm::SmallString<32> sourceHash;
+        const bool extended =
+            i == 0 && m->members && m->members->dim != numFirstModuleMembers;
+        if (lookupCacheEarly && !extended &&
+            atCompute == DComputeCompileFor::hostOnly) {
+          cache::calculateModuleSourceHash(m, sourcesHash, sourceHash);
+          const char *objfile = m->objfile->name.toChars();
+          // A miss is counted by the lookup after IR generation.
+          if (!cache::cacheLookup(sourceHash, /*countMiss=*/false).empty()) {
+            IF_LOG Logger::println("Skipping IR generation for %s",
+                                   m->toChars());
+            if (!cache::recoverObjectFile(sourceHash, objfile))
+              fatal();
+            continue;
+          }
+          earlyCacheMisses.emplace_back(objfile, sourceHash.str());
+        }
         cg.emit(m);
       }
       if (atCompute != DComputeCompileFor::hostOnly) {
@@ -1141,7 +1297,18 @@ void codegenModules(Modules &modules) {
       global.params.link = false;
   }
 
+  // All object files have been written at this point (`cg` is destroyed).
+  for (const auto &miss : earlyCacheMisses) {
+    if (llvm::sys::fs::exists(miss.first) &&
+        !cache::cacheObjectFile(miss.first, miss.second)) {
+      fatal();
+    }
+  }
+
   cache::pruneCache();
+  cache::printStatistics();
+  sizereport::writeReport();
+  statsfile::writeStatsFile();
 
   freeRuntime();
   llvm::llvm_shutdown();
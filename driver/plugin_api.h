@@ -0,0 +1,122 @@
+//===-- driver/plugin_api.h - API for LDC pass plugins ----------*- C++ -*-===//
+//
+//                         LDC – the LLVM D compiler
+//
+// This file is distributed under the BSD-style LDC license. See the LICENSE
+// file for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Header for optimization pass plugins loaded with `-plugin=...`.
+//
+// Besides legacy plugins registering their passes in static constructors,
+// LDC supports LLVM's new pass manager plugin interface: a plugin exporting
+// `llvmGetPassPluginInfo()` gets its PassBuilder callbacks registered for the
+// `-passmanager=new` pipeline.
+// Plugins may additionally export `ldcGetPluginInfo()` to hook into
+// D-specific extension points of LDC's pipeline.
+//
+// When plugins are loaded, LDC annotates the IR with frontend information,
+// which is accessible via the helpers below:
+//  - declarations of druntime hooks (`_d_newclass`, `_d_arraybounds` etc.)
+//    get the `ldc-druntime-hook` function attribute,
+//  - functions with UDAs get an `ldc.udas` metadata node listing the fully
+//    qualified names of the UDA types.
+//
+// This header only depends on LLVM, so that plugins can be built without the
+// LDC source tree.
+//
+//===----------------------------------------------------------------------===//
+
+#pragma once
+
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Config/llvm-config.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Metadata.h"
+#include <cstdint>
+#include <vector>
+
+#if LLVM_VERSION_MAJOR >= 8
+#include "llvm/IR/PassManager.h"
+#include "llvm/Passes/PassBuilder.h"
+#include <functional>
+#endif
+
+namespace ldc {
+namespace plugin {
+
+/// Version of the LDC-specific plugin API, checked when loading a plugin.
+constexpr uint32_t ApiVersion = 1;
+
+/// Function attribute of druntime hook declarations.
+constexpr const char *DRuntimeHookAttr = "ldc-druntime-hook";
+
+/// Function metadata kind listing the UDAs of a D function.
+constexpr const char *UDAMetadataKind = "ldc.udas";
+
+/// Returns whether `callee` is a druntime hook called by LDC-generated code.
+inline bool isDRuntimeHook(const llvm::Function &callee) {
+  return callee.hasFnAttribute(DRuntimeHookAttr);
+}
+
+/// Returns the fully qualified names of the struct and type UDAs of a D
+/// function, e.g. `mylib.attrs.logging`.
+inline std::vector<llvm::StringRef> getUDAs(const llvm::Function &func) {
+  std::vector<llvm::StringRef> udas;
+  if (auto node = func.getMetadata(UDAMetadataKind)) {
+    for (const auto &op : node->operands()) {
+      if (auto name = llvm::dyn_cast_or_null<llvm::MDString>(op.get()))
+        udas.push_back(name->getString());
+    }
+  }
+  return udas;
+}
+
+/// Returns whether a D function has a UDA of the fully qualified type `name`.
+inline bool hasUDA(const llvm::Function &func, llvm::StringRef name) {
+  for (auto uda : getUDAs(func)) {
+    if (uda == name)
+      return true;
+  }
+  return false;
+}
+
+#if LLVM_VERSION_MAJOR >= 8
+
+using OptimizationLevel = llvm::PassBuilder::OptimizationLevel;
+
+/// The D-specific extension points of LDC's new pass manager pipeline.
+class PluginCallbacks {
+public:
+  using FunctionPassCallback =
+      std::function<void(llvm::FunctionPassManager &, OptimizationLevel)>;
+
+  virtual ~PluginCallbacks() = default;
+
+  /// Adds function passes right after LDC's druntime call optimizations
+  /// (druntime call simplification, GC allocations to stack promotion and
+  /// bounds checks elimination), so that they see their results. Only the
+  /// passes of the latter run at -O2 and higher, but the callback is invoked
+  /// for all optimization levels.
+  virtual void
+  registerDRuntimeOptimizerLateEPCallback(FunctionPassCallback callback) = 0;
+};
+
+/// Returned by the `ldcGetPluginInfo()` function of a plugin.
+struct PluginInfo {
+  /// Must be `ldc::plugin::ApiVersion`.
+  uint32_t APIVersion;
+  const char *PluginName;
+  void (*RegisterCallbacks)(PluginCallbacks &);
+};
+
+#endif // LLVM_VERSION_MAJOR >= 8
+
+} // namespace plugin
+} // namespace ldc
+
+#if LLVM_VERSION_MAJOR >= 8
+/// To be defined by plugins using the D-specific extension points.
+extern "C" ::ldc::plugin::PluginInfo LLVM_ATTRIBUTE_WEAK ldcGetPluginInfo();
+#endif
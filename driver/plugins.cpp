@@ -20,6 +20,13 @@
 #include "llvm/Support/CommandLine.h"
 #include "llvm/Support/DynamicLibrary.h"
 
+#if LDC_LLVM_VER >= 800
+#include "driver/plugin_api.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Passes/PassPlugin.h"
+#include <vector>
+#endif
+
 namespace {
 namespace cl = llvm::cl;
 
@@ -27,23 +34,102 @@ cl::list<std::string>
     pluginFiles("plugin", cl::CommaSeparated, cl::desc("Plugins to load."),
                 cl::value_desc("<dynamic_library.so, lib2.so>"));
 
+#if LDC_LLVM_VER >= 800
+
+std::vector<llvm::PassPluginLibraryInfo> passPlugins;
+
+class LDCPluginCallbacks : public ldc::plugin::PluginCallbacks {
+public:
+  std::vector<FunctionPassCallback> dRuntimeOptimizerLateCallbacks;
+
+  void registerDRuntimeOptimizerLateEPCallback(
+      FunctionPassCallback callback) override {
+    dRuntimeOptimizerLateCallbacks.push_back(std::move(callback));
+  }
+};
+
+LDCPluginCallbacks ldcPluginCallbacks;
+
+/// Looks up the new pass manager entry points of a loaded plugin.
+void initNewPMPlugin(const std::string &filename,
+                     llvm::sys::DynamicLibrary &library) {
+  if (auto getInfo = library.getAddressOfSymbol("llvmGetPassPluginInfo")) {
+    const auto info =
+        reinterpret_cast<decltype(llvmGetPassPluginInfo) *>(getInfo)();
+    if (info.APIVersion != LLVM_PLUGIN_API_VERSION) {
+      error(Loc(), "Plugin '%s' uses LLVM plugin API version %u, expected %u",
+            filename.c_str(), info.APIVersion, LLVM_PLUGIN_API_VERSION);
+      return;
+    }
+    passPlugins.push_back(info);
+  }
+
+  if (auto getInfo = library.getAddressOfSymbol("ldcGetPluginInfo")) {
+    const auto info =
+        reinterpret_cast<decltype(ldcGetPluginInfo) *>(getInfo)();
+    if (info.APIVersion != ldc::plugin::ApiVersion) {
+      error(Loc(), "Plugin '%s' uses LDC plugin API version %u, expected %u",
+            filename.c_str(), info.APIVersion, ldc::plugin::ApiVersion);
+      return;
+    }
+    if (info.RegisterCallbacks)
+      info.RegisterCallbacks(ldcPluginCallbacks);
+  }
+}
+
+#endif // LDC_LLVM_VER >= 800
+
 } // anonymous namespace
 
-/// Loads all plugins. The static constructor of each plugin should take care of
-/// the plugins registering themself with the rest of LDC/LLVM.
+/// Loads all plugins. Legacy pass manager plugins are expected to register
+/// themselves with the rest of LDC/LLVM in their static constructors; new
+/// pass manager plugins are registered via their `llvmGetPassPluginInfo()`
+/// and `ldcGetPluginInfo()` functions.
 void loadAllPlugins() {
   for (auto &filename : pluginFiles) {
     std::string errorString;
-    if (llvm::sys::DynamicLibrary::LoadLibraryPermanently(filename.c_str(),
-                                                          &errorString)) {
+    auto library = llvm::sys::DynamicLibrary::getPermanentLibrary(
+        filename.c_str(), &errorString);
+    if (!library.isValid()) {
       error(Loc(), "Error loading plugin '%s': %s", filename.c_str(),
             errorString.c_str());
+      continue;
     }
+#if LDC_LLVM_VER >= 800
+    initNewPMPlugin(filename, library);
+#endif
   }
 }
 
+bool arePluginsLoaded() { return !pluginFiles.empty(); }
+
+#if LDC_LLVM_VER >= 800
+void registerPluginCallbacks(llvm::PassBuilder &pb) {
+  for (auto &plugin : passPlugins)
+    plugin.RegisterPassBuilderCallbacks(pb);
+
+  if (!ldcPluginCallbacks.dRuntimeOptimizerLateCallbacks.empty()) {
+    // Registered after LDC's own callback for this extension point, so that
+    // the plugins' passes run after the D-specific ones.
+    pb.registerScalarOptimizerLateEPCallback(
+        [](llvm::FunctionPassManager &fpm,
+           llvm::PassBuilder::OptimizationLevel level) {
+          for (auto &callback :
+               ldcPluginCallbacks.dRuntimeOptimizerLateCallbacks)
+            callback(fpm, level);
+        });
+  }
+}
+#endif
+
 #else // #if LDC_ENABLE_PLUGINS
 
 void loadAllPlugins() {}
 
+bool arePluginsLoaded() { return false; }
+
+#if LDC_LLVM_VER >= 800
+void registerPluginCallbacks(llvm::PassBuilder &) {}
+#endif
+
 #endif // LDC_ENABLE_PLUGINS
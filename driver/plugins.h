@@ -9,4 +9,20 @@
 
 #pragma once
 
+#if LDC_LLVM_VER >= 800
+namespace llvm {
+class PassBuilder;
+}
+#endif
+
 void loadAllPlugins();
+
+/// Returns whether plugins are loaded, in which case the IR is annotated with
+/// frontend information for them (see driver/plugin_api.h).
+bool arePluginsLoaded();
+
+#if LDC_LLVM_VER >= 800
+/// Registers the callbacks of the new pass manager plugins. Must be called
+/// after LDC's own passes have been registered.
+void registerPluginCallbacks(llvm::PassBuilder &pb);
+#endif
@@ -0,0 +1,235 @@
+//===-- driver/remote_codegen.cpp -----------------------------------------===//
+//
+//                         LDC – the LLVM D compiler
+//
+// This file is distributed under the BSD-style LDC license. See the LICENSE
+// file for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// With -remote-codegen=<launcher>, each module's unoptimized bitcode is
+// written to a temporary file after IR generation, and the launcher is run as
+//
+//   <launcher> [<host>] <ldc2> <IR-to-object relevant switches>
+//       -remote-codegen-job <module.bc> -c -of=<module.o>
+//
+// The hosts are taken round-robin from -remote-codegen-hosts. The launcher
+// (e.g. a script around ssh/scp or a remote execution client) is responsible
+// for transferring the bitcode file to the worker, running the command there
+// and transferring the object file back. If it fails, the module is compiled
+// locally. With -codegen-threads=N, up to N jobs are in flight.
+//
+// The IR-to-object relevant switches are the ones hashed for the object
+// cache, so options need to be specified with an equals sign to be forwarded;
+// options whose value is a separate argument are dropped with a warning. If
+// the launcher can't be found, all modules are compiled locally.
+//
+//===----------------------------------------------------------------------===//
+
+#include "driver/remote_codegen.h"
+
+#include "dmd/errors.h"
+#include "dmd/globals.h"
+#include "driver/cache.h"
+#include "driver/cl_options.h"
+#include "driver/exe_path.h"
+#include "driver/toobj.h"
+#include "gen/irstate.h"
+#include "gen/logger.h"
+#if LDC_LLVM_VER >= 400
+#include "llvm/Bitcode/BitcodeWriter.h"
+#else
+#include "llvm/Bitcode/ReaderWriter.h"
+#endif
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IRReader/IRReader.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Program.h"
+#include "llvm/Support/SourceMgr.h"
+#include "llvm/Support/raw_ostream.h"
+#include <atomic>
+#include <string>
+#include <vector>
+
+namespace cl = llvm::cl;
+
+namespace {
+
+cl::opt<std::string> launcher(
+    "remote-codegen", cl::ZeroOrMore, cl::value_desc("launcher"),
+    cl::desc("Optimize and compile the modules by remote ldc2 workers, via "
+             "the given launcher program (experimental)"));
+
+cl::list<std::string>
+    hosts("remote-codegen-hosts", cl::CommaSeparated,
+          cl::value_desc("host1,host2,..."),
+          cl::desc("Workers passed round-robin to the -remote-codegen "
+                   "launcher as first argument"));
+
+cl::opt<unsigned> timeout(
+    "remote-codegen-timeout", cl::ZeroOrMore, cl::value_desc("seconds"),
+    cl::desc("Compile a module locally if its remote job takes longer "
+             "(default: 0 = no timeout)"),
+    cl::init(0));
+
+cl::opt<bool> isJob("remote-codegen-job", cl::ZeroOrMore, cl::ReallyHidden);
+
+std::atomic<unsigned> nextHost{0};
+
+// Set up by remote::initialize() on the main thread; the program stays empty
+// if the launcher can't be found.
+std::string program;
+std::vector<std::string> switches;
+
+// Collects the switches of this invocation affecting the object code.
+std::vector<std::string> getJobSwitches() {
+  std::vector<std::string> switches;
+  for (size_t i = 1; i < opts::allArguments.size(); ++i) {
+    const char *arg = opts::allArguments[i];
+    if (arg && arg[0] == '-' && arg[1] == 'O')
+      switches.push_back(arg);
+  }
+  const auto &options = cl::getRegisteredOptions();
+  cache::forEachIR2ObjRelevantCmdlineArg([&](const char *arg) {
+    // skip source files etc.
+    if (arg[0] != '-')
+      return;
+    // The value of `-option value` is skipped above, so drop the option too.
+    const llvm::StringRef name = llvm::StringRef(arg).ltrim('-');
+    if (name.find('=') == llvm::StringRef::npos) {
+      const auto it = options.find(name);
+      if (it != options.end() &&
+          it->second->getValueExpectedFlag() == cl::ValueRequired) {
+        warning(Loc(),
+                "not forwarding %s to -remote-codegen jobs, specify its "
+                "value as %s=<value>",
+                arg, arg);
+        return;
+      }
+    }
+    switches.push_back(arg);
+  });
+  return switches;
+}
+
+bool runLauncher(const std::vector<std::string> &args) {
+#if LDC_LLVM_VER >= 700
+  std::vector<llvm::StringRef> argv;
+  argv.push_back(program);
+  argv.insert(argv.end(), args.begin(), args.end());
+  auto envVars = llvm::None;
+#else
+  std::vector<const char *> argv;
+  argv.push_back(program.c_str());
+  for (const auto &arg : args)
+    argv.push_back(arg.c_str());
+  argv.push_back(nullptr);
+  auto envVars = nullptr;
+#endif
+
+  std::string errstr;
+  const int status = llvm::sys::ExecuteAndWait(program,
+#if LDC_LLVM_VER >= 700
+                                               argv,
+#else
+                                               argv.data(),
+#endif
+                                               envVars,
+#if LDC_LLVM_VER >= 600
+                                               {},
+#else
+                                               nullptr,
+#endif
+                                               timeout, 0, &errstr);
+  IF_LOG Logger::println("%s exited with status %d %s", launcher.c_str(),
+                         status, errstr.c_str());
+  return status == 0;
+}
+
+} // anonymous namespace
+
+namespace remote {
+
+void initialize() {
+  if (launcher.empty() || isJob)
+    return;
+  auto path = llvm::sys::findProgramByName(launcher);
+  if (!path) {
+    warning(Loc(), "failed to locate %s, compiling all modules locally",
+            launcher.c_str());
+    return;
+  }
+  program = *path;
+  switches = getJobSwitches();
+}
+
+bool isEnabled() { return !program.empty(); }
+
+bool codegenModule(llvm::Module &m, const char *filename) {
+  llvm::SmallString<128> bcPath;
+  if (llvm::sys::fs::createTemporaryFile("ldc-remote", "bc", bcPath))
+    return false;
+  {
+    std::error_code errinfo;
+    llvm::raw_fd_ostream bos(bcPath, errinfo, llvm::sys::fs::F_None);
+    if (errinfo) {
+      llvm::sys::fs::remove(bcPath);
+      return false;
+    }
+#if LDC_LLVM_VER >= 700
+    llvm::WriteBitcodeToFile(m, bos);
+#else
+    llvm::WriteBitcodeToFile(&m, bos);
+#endif
+  }
+
+  std::vector<std::string> args;
+  if (!hosts.empty())
+    args.push_back(hosts[nextHost++ % hosts.size()]);
+  args.push_back(exe_path::getExePath());
+  args.insert(args.end(), switches.begin(), switches.end());
+  args.push_back("-remote-codegen-job");
+  args.push_back(bcPath.str());
+  args.push_back("-c");
+  args.push_back(std::string("-of=") + filename);
+
+  IF_LOG Logger::println("Remote codegen of module %s (%s)",
+                         m.getModuleIdentifier().c_str(),
+                         args.front().c_str());
+
+  const bool success = runLauncher(args) && llvm::sys::fs::exists(filename);
+  llvm::sys::fs::remove(bcPath);
+  if (!success) {
+    if (global.params.verbose) {
+      message("remote    codegen of %s failed, compiling locally",
+              m.getModuleIdentifier().c_str());
+    }
+    llvm::sys::fs::remove(filename);
+  }
+  return success;
+}
+
+bool isCodegenJob() { return isJob; }
+
+int runCodegenJob(Strings &files) {
+  if (files.dim != 1 || !global.params.objname) {
+    error(Loc(), "-remote-codegen-job expects a single bitcode file and -of");
+    return EXIT_FAILURE;
+  }
+
+  llvm::LLVMContext context;
+  llvm::SMDiagnostic err;
+  std::unique_ptr<llvm::Module> m = llvm::parseIRFile(files[0], err, context);
+  if (!m) {
+    error(Loc(), "cannot read bitcode file '%s': %s", files[0],
+          err.getMessage().str().c_str());
+    return EXIT_FAILURE;
+  }
+
+  writeModule(*gTargetMachine, m.get(), global.params.objname);
+  return global.errors ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+} // namespace remote
@@ -0,0 +1,48 @@
+//===-- driver/remote_codegen.h - Remote backend execution ------*- C++ -*-===//
+//
+//                         LDC – the LLVM D compiler
+//
+// This file is distributed under the BSD-style LDC license. See the LICENSE
+// file for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Optimization and code generation of modules by remote ldc2 workers
+// (-remote-codegen=<launcher>), with local fallback.
+//
+//===----------------------------------------------------------------------===//
+
+#pragma once
+
+#include "dmd/root/filename.h" // Strings
+
+namespace llvm {
+class Module;
+}
+
+namespace remote {
+
+/// Locates the -remote-codegen launcher and collects the switches forwarded to
+/// the jobs. Warns if the launcher can't be found, in which case remote
+/// codegen is disabled. To be called on the main thread.
+void initialize();
+
+/// Returns whether modules are handed over to remote workers
+/// (-remote-codegen).
+bool isEnabled();
+
+/// Optimizes and compiles the (not yet optimized) module to the object file
+/// `filename` by a remote worker. Returns false (after a warning) if the job
+/// failed, in which case the module needs to be compiled locally. Safe to call
+/// from the codegen threads.
+bool codegenModule(llvm::Module &m, const char *filename);
+
+/// Returns whether this invocation is a job on a worker
+/// (-remote-codegen-job).
+bool isCodegenJob();
+
+/// Runs the job of a worker: optimizes and compiles the single bitcode file in
+/// `files` to the -of object file. Returns the exit status.
+int runCodegenJob(Strings &files);
+
+} // namespace remote
@@ -0,0 +1,316 @@
+//===-- server.cpp --------------------------------------------------------===//
+//
+//                         LDC – the LLVM D compiler
+//
+// This file is distributed under the BSD-style LDC license. See the LICENSE
+// file for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// The protocol consists of a single request and reply per connection. The
+// client sends a header (argument count, environment size, payload size)
+// along with its stdin, stdout and stderr as SCM_RIGHTS ancillary data,
+// followed by the payload: the working directory, the arguments and the
+// environment as consecutive NUL-terminated strings. The server replies with
+// the exit status of the compiler once it has finished.
+//
+// Every request is handled in a forked process, which forks again for the
+// actual compiler, so that each compilation starts from the pristine,
+// LLVM-initialized state of the server and may exit() at will.
+//
+//===----------------------------------------------------------------------===//
+
+#include "driver/server.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#if LDC_POSIX
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char **environ;
+#endif
+
+namespace server {
+
+const char *getServerSocketPath(int argc, char **argv) {
+  static const char prefix[] = "--compile-server=";
+  if (argc < 2 || strncmp(argv[1], prefix, sizeof(prefix) - 1) != 0)
+    return nullptr;
+  return argv[1] + sizeof(prefix) - 1;
+}
+
+#if LDC_POSIX
+
+namespace {
+
+struct RequestHeader {
+  uint32_t argc;
+  uint32_t envc;
+  uint32_t payloadSize;
+};
+
+constexpr int numForwardedFds = 3;
+
+bool writeAll(int fd, const void *data, size_t size) {
+  auto p = static_cast<const char *>(data);
+  while (size) {
+    const ssize_t n = write(fd, p, size);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    p += n;
+    size -= n;
+  }
+  return true;
+}
+
+bool readAll(int fd, void *data, size_t size) {
+  auto p = static_cast<char *>(data);
+  while (size) {
+    const ssize_t n = read(fd, p, size);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    p += n;
+    size -= n;
+  }
+  return true;
+}
+
+bool makeAddress(const char *socketPath, sockaddr_un &addr) {
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (strlen(socketPath) >= sizeof(addr.sun_path))
+    return false;
+  strcpy(addr.sun_path, socketPath);
+  return true;
+}
+
+/// Receives the header and the client's standard streams.
+bool receiveHeader(int conn, RequestHeader &header, int (&fds)[numForwardedFds]) {
+  char control[CMSG_SPACE(sizeof(fds))];
+  iovec iov = {&header, sizeof(header)};
+  msghdr msg = {};
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+
+  if (recvmsg(conn, &msg, MSG_WAITALL) != sizeof(header))
+    return false;
+  cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  if (!cmsg || cmsg->cmsg_level != SOL_SOCKET ||
+      cmsg->cmsg_type != SCM_RIGHTS ||
+      cmsg->cmsg_len != CMSG_LEN(sizeof(fds)))
+    return false;
+  memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+  return true;
+}
+
+/// Handles a single connection. Returns true in the compiler process.
+bool handleRequest(int conn, int &argc, char **&argv) {
+  RequestHeader header;
+  int fds[numForwardedFds];
+  if (!receiveHeader(conn, header, fds))
+    _exit(EXIT_FAILURE);
+
+  // The request stays alive for the whole compilation.
+  char *payload = static_cast<char *>(malloc(header.payloadSize + 1));
+  if (!payload || !readAll(conn, payload, header.payloadSize))
+    _exit(EXIT_FAILURE);
+  payload[header.payloadSize] = '\0';
+
+  std::vector<char *> strings;
+  for (char *p = payload, *end = payload + header.payloadSize; p < end;
+       p += strlen(p) + 1) {
+    strings.push_back(p);
+  }
+  if (strings.size() != 1 + header.argc + header.envc || header.argc == 0)
+    _exit(EXIT_FAILURE);
+
+  const pid_t pid = fork();
+  if (pid < 0)
+    _exit(EXIT_FAILURE);
+
+  if (pid == 0) {
+    close(conn);
+    if (chdir(strings[0]) != 0)
+      _exit(EXIT_FAILURE);
+    for (int i = 0; i < numForwardedFds; ++i) {
+      dup2(fds[i], i);
+      close(fds[i]);
+    }
+
+    auto env = new char *[header.envc + 1];
+    std::copy(strings.begin() + 1 + header.argc, strings.end(), env);
+    env[header.envc] = nullptr;
+    environ = env;
+
+    argc = static_cast<int>(header.argc);
+    argv = new char *[argc + 1];
+    std::copy(strings.begin() + 1, strings.begin() + 1 + argc, argv);
+    argv[argc] = nullptr;
+    return true;
+  }
+
+  for (int fd : fds)
+    close(fd);
+
+  int waitStatus;
+  while (waitpid(pid, &waitStatus, 0) < 0) {
+    if (errno != EINTR)
+      _exit(EXIT_FAILURE);
+  }
+  const int32_t status = WIFEXITED(waitStatus)
+                             ? WEXITSTATUS(waitStatus)
+                             : 128 + WTERMSIG(waitStatus);
+  writeAll(conn, &status, sizeof(status));
+  _exit(EXIT_SUCCESS);
+}
+
+} // anonymous namespace
+
+bool forwardToServer(int argc, char **argv, int &status) {
+  const char *socketPath = getenv("LDC_COMPILE_SERVER");
+  if (!socketPath || !*socketPath || getServerSocketPath(argc, argv))
+    return false;
+
+  sockaddr_un addr;
+  if (!makeAddress(socketPath, addr))
+    return false;
+  const int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (sock < 0)
+    return false;
+  if (connect(sock, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0) {
+    // No server running, compile locally.
+    close(sock);
+    return false;
+  }
+
+  std::string payload;
+  {
+    std::vector<char> cwd(4096);
+    while (!getcwd(cwd.data(), cwd.size())) {
+      if (errno != ERANGE) {
+        close(sock);
+        return false;
+      }
+      cwd.resize(cwd.size() * 2);
+    }
+    payload.append(cwd.data()).push_back('\0');
+  }
+  for (int i = 0; i < argc; ++i)
+    payload.append(argv[i]).push_back('\0');
+  uint32_t envc = 0;
+  for (char **e = environ; *e; ++e, ++envc)
+    payload.append(*e).push_back('\0');
+
+  RequestHeader header = {static_cast<uint32_t>(argc), envc,
+                          static_cast<uint32_t>(payload.size())};
+  const int fds[numForwardedFds] = {STDIN_FILENO, STDOUT_FILENO,
+                                    STDERR_FILENO};
+  char control[CMSG_SPACE(sizeof(fds))] = {};
+  iovec iov = {&header, sizeof(header)};
+  msghdr msg = {};
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+  cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+  memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+  int32_t result;
+  if (sendmsg(sock, &msg, 0) != sizeof(header) ||
+      !writeAll(sock, payload.data(), payload.size()) ||
+      !readAll(sock, &result, sizeof(result))) {
+    // The server went away; the streams may have been written to already, so
+    // don't retry locally.
+    fprintf(stderr, "Error: lost connection to compile server '%s'\n",
+            socketPath);
+    close(sock);
+    status = EXIT_FAILURE;
+    return true;
+  }
+
+  close(sock);
+  status = result;
+  return true;
+}
+
+bool serve(const char *socketPath, int &argc, char **&argv) {
+  sockaddr_un addr;
+  if (!makeAddress(socketPath, addr)) {
+    fprintf(stderr, "Error: compile server socket path too long: %s\n",
+            socketPath);
+    return false;
+  }
+
+  const int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (sock < 0) {
+    perror("Error: cannot create compile server socket");
+    return false;
+  }
+  unlink(socketPath); // a stale socket of a previous server
+  if (bind(sock, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0 ||
+      listen(sock, SOMAXCONN) != 0) {
+    perror("Error: cannot listen on compile server socket");
+    close(sock);
+    return false;
+  }
+
+  // Let the kernel reap the request handlers.
+  signal(SIGCHLD, SIG_IGN);
+
+  for (;;) {
+    const int conn = accept(sock, nullptr, nullptr);
+    if (conn < 0) {
+      if (errno == EINTR || errno == ECONNABORTED)
+        continue;
+      perror("Error: compile server accept");
+      close(sock);
+      return false;
+    }
+
+    const pid_t pid = fork();
+    if (pid == 0) {
+      close(sock);
+      // The compiler process is waited for explicitly.
+      signal(SIGCHLD, SIG_DFL);
+      if (handleRequest(conn, argc, argv))
+        return true;
+    }
+    if (pid < 0)
+      perror("Error: compile server fork");
+    close(conn);
+  }
+}
+
+#else // !LDC_POSIX
+
+bool forwardToServer(int, char **, int &) { return false; }
+
+bool serve(const char *, int &, char **&) {
+  fprintf(stderr, "Error: the compile server is only supported on POSIX "
+                  "systems\n");
+  return false;
+}
+
+#endif
+
+} // namespace server
@@ -0,0 +1,36 @@
+//===-- driver/server.h - Compile server ------------------------*- C++ -*-===//
+//
+//                         LDC – the LLVM D compiler
+//
+// This file is distributed under the BSD-style LDC license. See the LICENSE
+// file for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// A resident ldc2 process (`ldc2 --compile-server=<socket>`) that has
+// initialized LLVM once and forks a compiler for every invocation forwarded by
+// an ldc2 client (environment variable LDC_COMPILE_SERVER=<socket>) over a
+// local socket. POSIX only.
+//
+//===----------------------------------------------------------------------===//
+
+#pragma once
+
+namespace server {
+
+/// Forwards this invocation (command line, working directory, environment and
+/// standard streams) to the compile server named by LDC_COMPILE_SERVER, if
+/// any, and waits for it to finish. Returns false if there is no server to
+/// forward to, so that the invocation is to be compiled locally.
+bool forwardToServer(int argc, char **argv, int &status);
+
+/// Returns the server socket path if argv[1] is `--compile-server=<socket>`.
+const char *getServerSocketPath(int argc, char **argv);
+
+/// Serves compile requests on `socketPath` until terminated. Only returns in
+/// the forked child for a request, with `argc`/`argv`, the working directory,
+/// the environment and the standard streams set up like the client's; returns
+/// false in the server if the socket cannot be set up.
+bool serve(const char *socketPath, int &argc, char **&argv);
+
+} // namespace server
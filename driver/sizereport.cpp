@@ -0,0 +1,382 @@
+//===-- driver/sizereport.cpp ---------------------------------------------===//
+//
+//                         LDC – the LLVM D compiler
+//
+// This file is distributed under the BSD-style LDC license. See the LICENSE
+// file for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "driver/sizereport.h"
+
+#include "dmd/dsymbol.h"
+#include "dmd/errors.h"
+#include "dmd/module.h"
+#include "dmd/template.h"
+#include "driver/statsfile.h"
+#include "gen/dibuilder.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Object/ELFObjectFile.h"
+#include "llvm/Object/ObjectFile.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+#include <algorithm>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace {
+
+llvm::cl::opt<std::string> sizeReportFile(
+    "size-report", llvm::cl::ZeroOrMore, llvm::cl::value_desc("file"),
+    llvm::cl::desc("Write the machine code and data bytes of the emitted "
+                   "symbols, grouped by D module, template declaration and "
+                   "TypeInfo/ModuleInfo, to a JSON file"));
+
+struct Origin {
+  std::string module;
+  std::string templateDecl;     // fully qualified, e.g. `std.algorithm.sort`
+  std::string templateInstance; // e.g. `sort!(int[])`
+};
+
+struct Size {
+  uint64_t code = 0;
+  uint64_t data = 0;
+  unsigned copies = 0; // number of object files defining the symbol
+
+  void add(const Size &other) {
+    code += other.code;
+    data += other.data;
+    copies += other.copies;
+  }
+};
+
+// Only accessed by the main thread.
+llvm::StringMap<Origin> origins;
+
+std::mutex sizesMutex;
+llvm::StringMap<Size> symbolSizes;
+// The bytes of the code and data sections not covered by any symbol (e.g.,
+// private string literals and jump tables).
+Size unattributed;
+
+llvm::StringRef stripIRPrefix(llvm::StringRef irName) {
+  // Names starting with \1 aren't decorated by LLVM.
+  return irName.startswith("\1") ? irName.drop_front() : irName;
+}
+
+Origin getOrigin(Dsymbol *sym) {
+  Origin origin;
+  if (Module *m = sym->getModule())
+    origin.module = m->toPrettyChars();
+  for (Dsymbol *s = sym; s; s = s->parent) {
+    if (TemplateInstance *ti = s->isTemplateInstance()) {
+      origin.templateDecl =
+          ti->tempdecl ? ti->tempdecl->toPrettyChars() : ti->toPrettyChars();
+      origin.templateInstance = ldc::getTemplateInstanceName(ti);
+      break;
+    }
+  }
+  return origin;
+}
+
+const char *getCategory(llvm::StringRef name) {
+  if (name.endswith("12__ModuleInfoZ"))
+    return "ModuleInfo";
+  if (name.find("TypeInfo_") != llvm::StringRef::npos ||
+      name.endswith("7__ClassZ") || name.endswith("11__InterfaceZ"))
+    return "TypeInfo";
+  return nullptr;
+}
+
+struct Section {
+  bool isCode;
+  uint64_t address;
+  uint64_t size;
+  uint64_t attributed;
+  // The symbols without an explicit size, by address.
+  std::vector<std::pair<uint64_t, std::string>> symbols;
+};
+
+void addSize(llvm::StringMap<Size> &sizes, llvm::StringRef name, bool isCode,
+             uint64_t size) {
+  auto &s = sizes[name];
+  (isCode ? s.code : s.data) += size;
+  s.copies = 1;
+}
+
+void writeSize(llvm::raw_ostream &os, const Size &size) {
+  os << "\"code\": " << size.code << ", \"data\": " << size.data;
+}
+
+// group name => (size, number of symbols or template instances)
+using Groups = std::map<std::string, std::pair<Size, unsigned>>;
+
+void writeGroups(llvm::raw_ostream &os, const char *key, const Groups &groups,
+                 const char *countKey) {
+  std::vector<const Groups::value_type *> sorted;
+  for (const auto &group : groups)
+    sorted.push_back(&group);
+  std::stable_sort(sorted.begin(), sorted.end(),
+                   [](const Groups::value_type *a, const Groups::value_type *b) {
+                     return a->second.first.code + a->second.first.data >
+                            b->second.first.code + b->second.first.data;
+                   });
+
+  os << ",\n\"" << key << "\": [";
+  bool first = true;
+  for (const auto *group : sorted) {
+    os << (first ? "\n  {\"name\": " : ",\n  {\"name\": ");
+    first = false;
+    statsfile::writeJSONString(os, group->first);
+    os << ", ";
+    writeSize(os, group->second.first);
+    os << ", \"" << countKey << "\": " << group->second.second << "}";
+  }
+  os << "\n]";
+}
+
+} // anonymous namespace
+
+namespace sizereport {
+
+bool isEnabled() { return !sizeReportFile.empty(); }
+
+void recordSymbol(llvm::StringRef irName, Dsymbol *sym) {
+  if (!isEnabled() || !sym)
+    return;
+  const auto name = stripIRPrefix(irName);
+  if (!origins.count(name))
+    origins[name] = getOrigin(sym);
+}
+
+void recordModule(const llvm::Module &lm, Module *m) {
+  if (!isEnabled())
+    return;
+  const std::string moduleName = m->toPrettyChars();
+  for (const auto &gv : lm.global_values()) {
+    if (gv.isDeclaration() || !gv.hasName())
+      continue;
+    const auto name = stripIRPrefix(gv.getName());
+    if (!origins.count(name))
+      origins[name].module = moduleName;
+  }
+}
+
+void addObject(llvm::MemoryBufferRef object) {
+  if (!isEnabled())
+    return;
+
+  auto objOrErr = llvm::object::ObjectFile::createObjectFile(object);
+  if (!objOrErr) {
+    llvm::handleAllErrors(
+        objOrErr.takeError(), [&](const llvm::ErrorInfoBase &eib) {
+          warning(Loc(), "cannot read object file '%s' for the size report: %s",
+                  object.getBufferIdentifier().str().c_str(),
+                  eib.message().c_str());
+        });
+    return;
+  }
+  const auto &obj = **objOrErr;
+  const bool isELF = llvm::isa<llvm::object::ELFObjectFileBase>(&obj);
+
+  std::map<uintptr_t, Section> sections;
+  for (const auto &sec : obj.sections()) {
+    const bool isCode = sec.isText();
+    if (!isCode && !sec.isData() && !sec.isBSS())
+      continue;
+    sections[sec.getRawDataRefImpl().p] = {isCode, sec.getAddress(),
+                                           sec.getSize(), 0, {}};
+  }
+
+  llvm::StringMap<Size> sizes;
+  for (const auto &sym : obj.symbols()) {
+    using llvm::object::SymbolRef;
+    const auto flags = sym.getFlags();
+    if (flags & (SymbolRef::SF_Undefined | SymbolRef::SF_FormatSpecific))
+      continue;
+    auto nameOrErr = sym.getName();
+    if (!nameOrErr) {
+      llvm::consumeError(nameOrErr.takeError());
+      continue;
+    }
+    llvm::StringRef name = *nameOrErr;
+    if (obj.isMachO() && name.startswith("_"))
+      name = name.drop_front();
+    if (name.empty())
+      continue;
+
+    if (flags & SymbolRef::SF_Common) {
+      addSize(sizes, name, false, sym.getCommonSize());
+      continue;
+    }
+
+    auto secOrErr = sym.getSection();
+    auto addrOrErr = sym.getAddress();
+    if (!secOrErr || !addrOrErr) {
+      if (!secOrErr)
+        llvm::consumeError(secOrErr.takeError());
+      if (!addrOrErr)
+        llvm::consumeError(addrOrErr.takeError());
+      continue;
+    }
+    if (*secOrErr == obj.section_end())
+      continue;
+    auto it = sections.find((*secOrErr)->getRawDataRefImpl().p);
+    if (it == sections.end())
+      continue;
+    auto &section = it->second;
+
+    if (isELF) {
+      const uint64_t size = llvm::object::ELFSymbolRef(sym).getSize();
+      addSize(sizes, name, section.isCode, size);
+      section.attributed += size;
+    } else {
+      // The other formats don't record symbol sizes, so each symbol is
+      // assumed to extend to the next one in its section.
+      section.symbols.emplace_back(*addrOrErr, name.str());
+    }
+  }
+
+  Size uncovered;
+  for (auto &entry : sections) {
+    auto &section = entry.second;
+    auto &symbols = section.symbols;
+    std::sort(symbols.begin(), symbols.end());
+    const uint64_t end = section.address + section.size;
+    for (size_t i = 0; i < symbols.size(); ++i) {
+      const uint64_t next = i + 1 < symbols.size() ? symbols[i + 1].first : end;
+      const uint64_t size = next > symbols[i].first ? next - symbols[i].first : 0;
+      addSize(sizes, symbols[i].second, section.isCode, size);
+      section.attributed += size;
+    }
+    if (section.size > section.attributed) {
+      (section.isCode ? uncovered.code : uncovered.data) +=
+          section.size - section.attributed;
+    }
+  }
+
+  std::lock_guard<std::mutex> lock(sizesMutex);
+  for (const auto &entry : sizes)
+    symbolSizes[entry.first()].add(entry.second);
+  unattributed.add(uncovered);
+}
+
+void addObjectFile(const char *filename) {
+  if (!isEnabled() || !llvm::sys::fs::exists(filename))
+    return;
+  auto buffer = llvm::MemoryBuffer::getFile(filename);
+  if (!buffer) {
+    warning(Loc(), "cannot read object file '%s' for the size report: %s",
+            filename, buffer.getError().message().c_str());
+    return;
+  }
+  addObject(buffer.get()->getMemBufferRef());
+}
+
+void writeReport() {
+  if (!isEnabled())
+    return;
+
+  std::error_code errcode;
+  llvm::raw_fd_ostream os(sizeReportFile, errcode, llvm::sys::fs::F_None);
+  if (errcode) {
+    error(Loc(), "cannot write size report '%s': %s", sizeReportFile.c_str(),
+          errcode.message().c_str());
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(sizesMutex);
+
+  Groups modules, templates, categories;
+  std::map<std::string, std::vector<std::string>> instancesPerTemplate;
+  Size total = unattributed;
+
+  struct Symbol {
+    llvm::StringRef name;
+    const Size *size;
+    const Origin *origin;
+    const char *category;
+  };
+  std::vector<Symbol> symbols;
+  symbols.reserve(symbolSizes.size());
+
+  const Origin unknown{"<unknown>", "", ""};
+  for (const auto &entry : symbolSizes) {
+    const auto name = entry.first();
+    const auto &size = entry.second;
+    total.add(size);
+    const auto it = origins.find(name);
+    const Origin &origin = it == origins.end() ? unknown : it->second;
+    const char *category = getCategory(name);
+    symbols.push_back({name, &size, &origin, category});
+
+    auto &module = modules[origin.module];
+    module.first.add(size);
+    ++module.second;
+    if (!origin.templateDecl.empty()) {
+      auto &tmpl = templates[origin.templateDecl];
+      tmpl.first.add(size);
+      auto &instances = instancesPerTemplate[origin.templateDecl];
+      if (std::find(instances.begin(), instances.end(),
+                    origin.templateInstance) == instances.end()) {
+        instances.push_back(origin.templateInstance);
+        ++tmpl.second;
+      }
+    }
+    if (category) {
+      auto &cat = categories[category];
+      cat.first.add(size);
+      ++cat.second;
+    }
+  }
+
+  std::sort(symbols.begin(), symbols.end(),
+            [](const Symbol &a, const Symbol &b) {
+              const auto sa = a.size->code + a.size->data;
+              const auto sb = b.size->code + b.size->data;
+              return sa != sb ? sa > sb : a.name < b.name;
+            });
+
+  // Weakly defined symbols (e.g., template instances) are counted once per
+  // object file (`copies`), as that's what the compiler and linker have to
+  // process.
+  os << "{\n\"total\": {";
+  writeSize(os, total);
+  os << "},\n\"unattributed\": {";
+  writeSize(os, unattributed);
+  os << "}";
+  writeGroups(os, "modules", modules, "symbols");
+  writeGroups(os, "templates", templates, "instances");
+  writeGroups(os, "categories", categories, "symbols");
+
+  os << ",\n\"symbols\": [";
+  bool first = true;
+  for (const auto &sym : symbols) {
+    os << (first ? "\n  {\"name\": " : ",\n  {\"name\": ");
+    first = false;
+    statsfile::writeJSONString(os, sym.name);
+    os << ", \"module\": ";
+    statsfile::writeJSONString(os, sym.origin->module);
+    if (!sym.origin->templateDecl.empty()) {
+      os << ", \"template\": ";
+      statsfile::writeJSONString(os, sym.origin->templateDecl);
+      os << ", \"instance\": ";
+      statsfile::writeJSONString(os, sym.origin->templateInstance);
+    }
+    if (sym.category) {
+      os << ", \"category\": \"" << sym.category << '"';
+    }
+    os << ", ";
+    writeSize(os, *sym.size);
+    os << ", \"copies\": " << sym.size->copies << "}";
+  }
+  os << "\n]\n}\n";
+}
+
+} // namespace sizereport
@@ -0,0 +1,47 @@
+//===-- driver/sizereport.h - Object code size report -----------*- C++ -*-===//
+//
+//                         LDC – the LLVM D compiler
+//
+// This file is distributed under the BSD-style LDC license. See the LICENSE
+// file for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Attributes the machine code and data bytes of the emitted object files to
+// the D modules, template declarations and TypeInfo/ModuleInfo categories
+// they originate from, and writes them to a JSON file (-size-report).
+//
+//===----------------------------------------------------------------------===//
+
+#pragma once
+
+#include "llvm/ADT/StringRef.h"
+
+class Dsymbol;
+class Module;
+
+namespace llvm {
+class MemoryBufferRef;
+class Module;
+}
+
+namespace sizereport {
+
+bool isEnabled();
+
+/// Records the D symbol an IR definition originates from.
+void recordSymbol(llvm::StringRef irName, Dsymbol *sym);
+
+/// Attributes the definitions of an IR module which haven't been recorded
+/// yet to the D module they are emitted for.
+void recordModule(const llvm::Module &lm, Module *m);
+
+/// Adds the symbol sizes of an object file. Safe to call from the codegen
+/// threads.
+void addObject(llvm::MemoryBufferRef object);
+void addObjectFile(const char *filename);
+
+/// Writes the report of all object files added so far.
+void writeReport();
+
+} // namespace sizereport
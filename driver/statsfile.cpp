@@ -0,0 +1,124 @@
+//===-- driver/statsfile.cpp ----------------------------------------------===//
+//
+//                         LDC – the LLVM D compiler
+//
+// This file is distributed under the BSD-style LDC license. See the LICENSE
+// file for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "driver/statsfile.h"
+
+#include "dmd/errors.h"
+#include "driver/cache.h"
+#include "driver/timetrace.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/raw_ostream.h"
+#include <string>
+
+#if _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+namespace {
+
+llvm::cl::opt<std::string> statsFile(
+    "stats-file", llvm::cl::ZeroOrMore, llvm::cl::value_desc("file"),
+    llvm::cl::desc("Write the cache statistics, compile time per phase, peak "
+                   "memory usage and LLVM statistics (if LLVM was built with "
+                   "them) of this invocation to a JSON file"));
+
+// Returns the peak resident set size of the process in bytes, or 0 if
+// unknown.
+unsigned long long getPeakRSS() {
+#if _WIN32
+  PROCESS_MEMORY_COUNTERS counters;
+  if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+    return counters.PeakWorkingSetSize;
+  return 0;
+#else
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0)
+    return 0;
+#if __APPLE__
+  return usage.ru_maxrss; // in bytes
+#else
+  return usage.ru_maxrss * 1024ULL; // in kilobytes
+#endif
+#endif
+}
+
+} // anonymous namespace
+
+namespace statsfile {
+
+bool isEnabled() { return !statsFile.empty(); }
+
+void initialize() {
+  if (!isEnabled())
+    return;
+#if LDC_LLVM_VER >= 400
+  llvm::EnableStatistics(/*PrintOnExit=*/false);
+#else
+  llvm::EnableStatistics();
+#endif
+}
+
+void writeJSONString(llvm::raw_ostream &os, llvm::StringRef str) {
+  os << '"';
+  for (char c : str) {
+    if (c == '"' || c == '\\') {
+      os << '\\' << c;
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      os << llvm::format("\\u%04x", c);
+    } else {
+      os << c;
+    }
+  }
+  os << '"';
+}
+
+void writeStatsFile() {
+  if (!isEnabled())
+    return;
+
+  std::error_code errcode;
+  llvm::raw_fd_ostream os(statsFile, errcode, llvm::sys::fs::F_None);
+  if (errcode) {
+    error(Loc(), "cannot write stats file '%s': %s", statsFile.c_str(),
+          errcode.message().c_str());
+    return;
+  }
+
+  os << "{\n\"cache\": ";
+  cache::writeStatisticsJSON(os);
+
+  // Inclusive times, i.e., nested events of the same name are counted
+  // multiple times.
+  os << ",\n\"phases\": {";
+  bool first = true;
+  for (const auto &phase : timetrace::getPhaseTotals()) {
+    os << (first ? "\n  " : ",\n  ");
+    first = false;
+    writeJSONString(os, phase.name);
+    os << ": {\"us\": " << phase.microseconds << ", \"count\": " << phase.count
+       << "}";
+  }
+  os << "\n},\n\"peakRSS\": " << getPeakRSS();
+
+  os << ",\n\"llvm\": ";
+#if LDC_LLVM_VER >= 400
+  llvm::PrintStatisticsJSON(os);
+#else
+  os << "{}\n";
+#endif
+  os << "}\n";
+}
+
+} // namespace statsfile
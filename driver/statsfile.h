@@ -0,0 +1,38 @@
+//===-- driver/statsfile.h - Per-invocation statistics file -----*- C++ -*-===//
+//
+//                         LDC – the LLVM D compiler
+//
+// This file is distributed under the BSD-style LDC license. See the LICENSE
+// file for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Writes the counters of a compiler invocation (cache lookups, phase times,
+// peak memory usage and LLVM statistics) to a JSON file (-stats-file), e.g.,
+// for tracking build regressions.
+//
+//===----------------------------------------------------------------------===//
+
+#pragma once
+
+#include "llvm/ADT/StringRef.h"
+
+namespace llvm {
+class raw_ostream;
+}
+
+namespace statsfile {
+
+bool isEnabled();
+
+/// Enables the collection of LLVM statistics if a stats file is to be
+/// written. To be called after parsing the commandline.
+void initialize();
+
+/// Writes the stats file, before LLVM is shut down.
+void writeStatsFile();
+
+/// Writes `str` as quoted and escaped JSON string.
+void writeJSONString(llvm::raw_ostream &os, llvm::StringRef str);
+
+} // namespace statsfile
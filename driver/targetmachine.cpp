@@ -18,6 +18,7 @@
 #include "dmd/mars.h"
 #include "driver/cl_options.h"
 #include "gen/logger.h"
+#include "llvm/ADT/SmallVector.h"
 #include "llvm/ADT/StringExtras.h"
 #include "llvm/ADT/StringSwitch.h"
 #include "llvm/ADT/Triple.h"
@@ -31,6 +32,9 @@
 #include "llvm/Support/TargetSelect.h"
 #include "llvm/Target/TargetMachine.h"
 #include "llvm/Target/TargetOptions.h"
+#include <algorithm>
+#include <cstring>
+#include <mutex>
 
 #if LDC_LLVM_VER >= 700
 #include "gen/optimizer.h"
@@ -270,6 +274,108 @@ static FloatABI::Type getARMFloatABI(const llvm::Triple &triple,
   }
 }
 
+namespace {
+/// The initialization functions of a target (library), see
+/// llvm/Support/TargetSelect.h.
+using InitFn = void (*)();
+
+struct TargetInitializers {
+  const char *name;
+  InitFn initTargetInfo;
+  InitFn initTarget;
+  InitFn initTargetMC;
+  InitFn initAsmPrinter;
+  InitFn initAsmParser;
+  /// The targets registered by initTargetInfo, e.g., x86 and x86-64.
+  llvm::SmallVector<const llvm::Target *, 4> targets;
+  bool initialized;
+};
+
+#define LLVM_TARGET(TargetName)                                                \
+  {#TargetName,                                                                \
+   &LLVMInitialize##TargetName##TargetInfo,                                    \
+   &LLVMInitialize##TargetName##Target,                                        \
+   &LLVMInitialize##TargetName##TargetMC,                                      \
+   nullptr,                                                                    \
+   nullptr,                                                                    \
+   {},                                                                         \
+   false},
+TargetInitializers targetInitializers[] = {
+#include "llvm/Config/Targets.def"
+};
+
+struct NamedInitializer {
+  const char *name;
+  InitFn init;
+};
+
+#define LLVM_ASM_PRINTER(TargetName)                                           \
+  {#TargetName, &LLVMInitialize##TargetName##AsmPrinter},
+const NamedInitializer asmPrinterInitializers[] = {
+#include "llvm/Config/AsmPrinters.def"
+    {nullptr, nullptr}};
+
+#define LLVM_ASM_PARSER(TargetName)                                            \
+  {#TargetName, &LLVMInitialize##TargetName##AsmParser},
+const NamedInitializer asmParserInitializers[] = {
+#include "llvm/Config/AsmParsers.def"
+    {nullptr, nullptr}};
+
+InitFn findInitializer(const NamedInitializer *initializers,
+                       const char *name) {
+  for (auto i = initializers; i->name; ++i) {
+    if (std::strcmp(i->name, name) == 0)
+      return i->init;
+  }
+  return nullptr;
+}
+
+std::mutex targetInitializationMutex;
+
+void initialize(TargetInitializers &t) {
+  if (t.initialized)
+    return;
+  t.initTarget();
+  t.initTargetMC();
+  if (t.initAsmPrinter)
+    t.initAsmPrinter();
+  if (t.initAsmParser)
+    t.initAsmParser();
+  t.initialized = true;
+}
+
+void initializeTarget(const llvm::Target *target) {
+  std::lock_guard<std::mutex> lock(targetInitializationMutex);
+  for (auto &t : targetInitializers) {
+    if (std::find(t.targets.begin(), t.targets.end(), target) !=
+        t.targets.end()) {
+      initialize(t);
+      return;
+    }
+  }
+}
+} // anonymous namespace
+
+void registerTargets() {
+  for (auto &t : targetInitializers) {
+    // Targets are prepended to the registry's list.
+    const auto previousHead = llvm::TargetRegistry::targets().begin();
+    t.initTargetInfo();
+    for (auto it = llvm::TargetRegistry::targets().begin(); it != previousHead;
+         ++it) {
+      t.targets.push_back(&*it);
+    }
+    t.initAsmPrinter = findInitializer(asmPrinterInitializers, t.name);
+    t.initAsmParser = findInitializer(asmParserInitializers, t.name);
+  }
+}
+
+void initializeAllTargets() {
+  std::lock_guard<std::mutex> lock(targetInitializationMutex);
+  for (auto &t : targetInitializers)
+    initialize(t);
+}
+
 /// Looks up a target based on an arch name and a target triple.
 ///
 /// If the arch name is non-empty, then the lookup is done by arch. Otherwise,
@@ -316,6 +422,8 @@ const llvm::Target *lookupTarget(const std::string &arch, llvm::Triple &triple,
     }
   }
 
+  if (target)
+    initializeTarget(target);
   return target;
 }
 
@@ -481,6 +589,20 @@ createTargetMachine(const std::string targetTriple, const std::string arch,
   }
 
 #if LDC_LLVM_VER >= 700
+  // Tell the linker which symbols have their address taken. The others, which
+  // are only ever called or loaded from, may be merged with byte-identical
+  // ones by lld's --icf=safe. Only ELF and COFF know about the table.
+  if (opts::emitAddrsig && (triple.isOSBinFormatELF() ||
+                            triple.isOSBinFormatCOFF())) {
+    targetOptions.EmitAddrsig = true;
+  }
+#endif
+
+#if LDC_LLVM_VER < 700
+  if (opts::emitAddrsig) {
+    warning(Loc(), "-faddrsig requires LDC to be built against LLVM 7+");
+  }
+#else
   // On Android, we depend on a custom TLS emulation scheme implemented in our
   // LLVM fork. LLVM 7+ enables regular emutls by default; prevent that.
   if (triple.getEnvironment() == llvm::Triple::Android) {
@@ -73,6 +73,14 @@ createTargetMachine(std::string targetTriple, std::string arch, std::string cpu,
  */
 MipsABI::Type getMipsABI();
 
-// Looks up a target based on an arch name and a target triple.
+/// Registers the targets compiled into LLVM, e.g., for -version and the
+/// lookup. Their (more expensive) initialization is deferred to lookupTarget().
+void registerTargets();
+
+/// Initializes all registered targets, not just the ones looked up.
+void initializeAllTargets();
+
+// Looks up a target based on an arch name and a target triple, and initializes
+// it.
 const llvm::Target *lookupTarget(const std::string &arch, llvm::Triple &triple,
                                  std::string &errorMsg);
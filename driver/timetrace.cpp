@@ -0,0 +1,198 @@
+//===-- driver/timetrace.cpp ----------------------------------------------===//
+//
+//                         LDC – the LLVM D compiler
+//
+// This file is distributed under the BSD-style LDC license. See the LICENSE
+// file for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "driver/timetrace.h"
+
+#include "dmd/errors.h"
+#include "dmd/globals.h"
+#include "driver/statsfile.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/raw_ostream.h"
+#include <cassert>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace {
+
+llvm::cl::opt<bool> timeTrace(
+    "ftime-trace", llvm::cl::ZeroOrMore,
+    llvm::cl::desc("Write a trace of the compile time spent in the compiler's "
+                   "phases, in Chrome's trace event JSON format"));
+
+llvm::cl::opt<std::string> timeTraceFile(
+    "ftime-trace-file", llvm::cl::ZeroOrMore, llvm::cl::value_desc("file"),
+    llvm::cl::desc("Set the -ftime-trace output file (default: output file "
+                   "name + '.time-trace')"));
+
+llvm::cl::opt<unsigned> timeTraceGranularity(
+    "ftime-trace-granularity", llvm::cl::ZeroOrMore,
+    llvm::cl::value_desc("us"),
+    llvm::cl::desc("Minimum duration of traced events in microseconds "
+                   "(default: 500)"),
+    llvm::cl::init(500));
+
+using Clock = std::chrono::steady_clock;
+
+struct Event {
+  std::string name;
+  std::string detail;
+  Clock::time_point start;
+  Clock::duration duration;
+  unsigned threadId;
+};
+
+const Clock::time_point startTime = Clock::now();
+
+// Events may be recorded concurrently (-codegen-threads); the stack of open
+// events is per thread, completed ones are collected here.
+std::mutex completedEventsMutex;
+std::vector<Event> completedEvents;
+unsigned numThreads = 0;
+
+// The accumulated durations by event name, for -stats-file.
+struct Total {
+  Clock::duration duration{};
+  unsigned count = 0;
+};
+std::map<std::string, Total> totals;
+
+struct ThreadState {
+  unsigned id;
+  std::vector<Event> stack;
+
+  ThreadState() {
+    std::lock_guard<std::mutex> lock(completedEventsMutex);
+    id = numThreads++;
+  }
+};
+
+ThreadState &getThreadState() {
+  static thread_local ThreadState state;
+  return state;
+}
+
+long long toMicroseconds(Clock::duration d) {
+  return std::chrono::duration_cast<std::chrono::microseconds>(d).count();
+}
+
+void writeEscaped(llvm::raw_ostream &os, llvm::StringRef str) {
+  for (char c : str) {
+    if (c == '"' || c == '\\') {
+      os << '\\' << c;
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      os << llvm::format("\\u%04x", c);
+    } else {
+      os << c;
+    }
+  }
+}
+
+std::string getTraceFileName() {
+  if (!timeTraceFile.empty())
+    return timeTraceFile;
+
+  const char *output = nullptr;
+  if (global.params.exefile) {
+    output = global.params.exefile;
+  } else if (global.params.objfiles.dim != 0) {
+    output = global.params.objfiles[0];
+  } else if (global.params.objname) {
+    output = global.params.objname;
+  }
+  return std::string(output ? output : "ldc2") + ".time-trace";
+}
+
+} // anonymous namespace
+
+namespace timetrace {
+
+bool isEnabled() { return timeTrace || statsfile::isEnabled(); }
+
+void begin(llvm::StringRef name, llvm::StringRef detail) {
+  auto &state = getThreadState();
+  state.stack.push_back(
+      {name.str(), detail.str(), Clock::now(), {}, state.id});
+}
+
+void end() {
+  auto &state = getThreadState();
+  assert(!state.stack.empty() && "unbalanced timetrace::end()");
+
+  Event event = std::move(state.stack.back());
+  state.stack.pop_back();
+  event.duration = Clock::now() - event.start;
+
+  std::lock_guard<std::mutex> lock(completedEventsMutex);
+  if (statsfile::isEnabled()) {
+    Total &total = totals[event.name];
+    total.duration += event.duration;
+    ++total.count;
+  }
+  if (timeTrace && toMicroseconds(event.duration) >= timeTraceGranularity)
+    completedEvents.push_back(std::move(event));
+}
+
+void writeTraceFile() {
+  if (!timeTrace)
+    return;
+
+  const std::string filename = getTraceFileName();
+  std::error_code errcode;
+  llvm::raw_fd_ostream os(filename, errcode, llvm::sys::fs::F_None);
+  if (errcode) {
+    error(Loc(), "cannot write time trace file '%s': %s", filename.c_str(),
+          errcode.message().c_str());
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(completedEventsMutex);
+  os << "{\"traceEvents\":[\n";
+  for (const auto &event : completedEvents) {
+    os << "{\"pid\":1,\"tid\":" << event.threadId
+       << ",\"ph\":\"X\",\"ts\":" << toMicroseconds(event.start - startTime)
+       << ",\"dur\":" << toMicroseconds(event.duration) << ",\"name\":\"";
+    writeEscaped(os, event.name);
+    os << '"';
+    if (!event.detail.empty()) {
+      os << ",\"args\":{\"detail\":\"";
+      writeEscaped(os, event.detail);
+      os << "\"}";
+    }
+    os << "},\n";
+  }
+  os << "{\"pid\":1,\"tid\":0,\"ph\":\"M\",\"name\":\"process_name\","
+        "\"args\":{\"name\":\"ldc2\"}}\n";
+  os << "]}\n";
+}
+
+std::vector<PhaseTotal> getPhaseTotals() {
+  std::lock_guard<std::mutex> lock(completedEventsMutex);
+  std::vector<PhaseTotal> result;
+  result.reserve(totals.size());
+  for (const auto &total : totals) {
+    result.push_back({total.first, toMicroseconds(total.second.duration),
+                      total.second.count});
+  }
+  return result;
+}
+
+} // namespace timetrace
+
+bool timeTraceEnabled() { return timetrace::isEnabled(); }
+
+void timeTraceBegin(const char *name, const char *detail) {
+  timetrace::begin(name, detail ? detail : "");
+}
+
+void timeTraceEnd() { timetrace::end(); }
@@ -0,0 +1,68 @@
+//===-- driver/timetrace.h - Compile-time tracing ---------------*- C++ -*-===//
+//
+//                         LDC – the LLVM D compiler
+//
+// This file is distributed under the BSD-style LDC license. See the LICENSE
+// file for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Records the durations of compiler phases (-ftime-trace) and writes them to a
+// JSON file in Chrome's trace event format, viewable in chrome://tracing or
+// speedscope. The totals per phase are also part of the -stats-file.
+//
+//===----------------------------------------------------------------------===//
+
+#pragma once
+
+#include "llvm/ADT/StringRef.h"
+#include <string>
+#include <vector>
+
+namespace timetrace {
+
+bool isEnabled();
+
+/// Starts a new (nested) event on the current thread.
+void begin(llvm::StringRef name, llvm::StringRef detail = "");
+
+/// Ends the innermost event of the current thread.
+void end();
+
+/// Writes all recorded events to the trace file.
+void writeTraceFile();
+
+struct PhaseTotal {
+  std::string name;
+  long long microseconds;
+  unsigned count;
+};
+
+/// Returns the accumulated durations of the events ended so far, by name
+/// (-stats-file).
+std::vector<PhaseTotal> getPhaseTotals();
+
+/// Records an event for the lifetime of the object.
+class Scope {
+  bool active;
+
+public:
+  explicit Scope(llvm::StringRef name, llvm::StringRef detail = "")
+      : active(isEnabled()) {
+    if (active)
+      begin(name, detail);
+  }
+  ~Scope() {
+    if (active)
+      end();
+  }
+  Scope(const Scope &) = delete;
+  Scope &operator=(const Scope &) = delete;
+};
+
+} // namespace timetrace
+
+// For the frontend, see driver/timetrace.d.
+bool timeTraceEnabled();
+void timeTraceBegin(const char *name, const char *detail);
+void timeTraceEnd();
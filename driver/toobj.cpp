@@ -9,18 +9,26 @@
 
 #include "driver/toobj.h"
 
+#include "dmd/errors.h"
+#include "driver/archiver.h"
 #include "driver/cl_options.h"
 #include "driver/cache.h"
+#include "driver/remote_codegen.h"
+#include "driver/sizereport.h"
 #include "driver/targetmachine.h"
+#include "driver/timetrace.h"
 #include "driver/tool.h"
 #include "gen/irstate.h"
 #include "gen/logger.h"
+#include "gen/moduleinfo.h"
 #include "gen/optimizer.h"
+#include "gen/typinf.h"
 #include "llvm/IR/AssemblyAnnotationWriter.h"
 #include "llvm/IR/Verifier.h"
 #include "llvm/Analysis/ModuleSummaryAnalysis.h"
 #if LDC_LLVM_VER >= 400
 #include "llvm/Analysis/ProfileSummaryInfo.h"
+#include "llvm/Bitcode/BitcodeReader.h"
 #include "llvm/Bitcode/BitcodeWriter.h"
 #else
 #include "llvm/Bitcode/ReaderWriter.h"
@@ -29,10 +37,16 @@
 #include "llvm/Support/CommandLine.h"
 #include "llvm/Support/FileSystem.h"
 #include "llvm/Support/FormattedStream.h"
+#include "llvm/Support/MD5.h"
+#include "llvm/Support/MemoryBuffer.h"
 #include "llvm/Support/Program.h"
 #include "llvm/Support/Path.h"
+#include "llvm/Support/TargetRegistry.h"
+#include "llvm/Support/ThreadPool.h"
+#include "llvm/Support/Threading.h"
 #include "llvm/Target/TargetMachine.h"
 #include "llvm/Analysis/TargetTransformInfo.h"
+#include "llvm/CodeGen/ParallelCG.h"
 #if LDC_LLVM_VER >= 600
 #include "llvm/CodeGen/TargetSubtargetInfo.h"
 #else
@@ -40,8 +54,11 @@
 #endif
 #include "llvm/Transforms/Utils/Cloning.h"
 #include "llvm/IR/Module.h"
+#include <cstdarg>
 #include <cstddef>
+#include <cstdio>
 #include <fstream>
+#include <thread>
 
 #ifdef LDC_LLVM_SUPPORTED_TARGET_SPIRV
 namespace llvm {
@@ -56,12 +73,19 @@ static llvm::cl::opt<bool>
 
 namespace {
 
+// The errors of the module written by the current ParallelModuleWriter
+// thread, see writeModuleError().
+thread_local std::vector<std::string> *threadErrors = nullptr;
+
 // based on llc code, University of Illinois Open Source License
 void codegenModule(llvm::TargetMachine &Target, llvm::Module &m,
-                   llvm::raw_fd_ostream &out,
-                   llvm::TargetMachine::CodeGenFileType fileType) {
+                   llvm::raw_pwrite_stream &out,
+                   llvm::TargetMachine::CodeGenFileType fileType,
+                   llvm::raw_pwrite_stream *dwoOut = nullptr) {
   using namespace llvm;
 
+  timetrace::Scope timeScope("Emit machine code", m.getModuleIdentifier());
+
 // Create a PassManager to hold and optimize the collection of passes we are
 // about to build.
   legacy::PassManager Passes;
@@ -73,7 +97,7 @@ void codegenModule(llvm::TargetMachine &Target, llvm::Module &m,
     llvm::createSPIRVWriterPass(out)->runOnModule(m);
     IF_LOG Logger::println("Success.");
 #else
-    error(Loc(), "Trying to target SPIRV, but LDC is not built to do so!");
+    writeModuleError("Trying to target SPIRV, but LDC is not built to do so!");
 #endif
 
     return;
@@ -92,7 +116,7 @@ void codegenModule(llvm::TargetMachine &Target, llvm::Module &m,
           Passes,
           out, // Output file
 #if LDC_LLVM_VER >= 700
-          nullptr, // DWO output file
+          dwoOut, // DWO output file
 #endif
           // Always generate assembly for ptx as it is an assembly format
           // The PTX backend fails if we pass anything else.
@@ -105,22 +129,49 @@ void codegenModule(llvm::TargetMachine &Target, llvm::Module &m,
   Passes.run(m);
 }
 
-void cloneAndCodegenModule(llvm::TargetMachine &Target, llvm::Module &m,
-                           llvm::raw_fd_ostream &out,
-                           llvm::TargetMachine::CodeGenFileType fileType) {
-  auto newModule = llvm::CloneModule(
+// Serializes the module to in-memory bitcode, which is much more compact than
+// the module itself.
+void writeBitcodeToBuffer(llvm::Module &m, llvm::SmallVectorImpl<char> &buffer) {
+  llvm::raw_svector_ostream os(buffer);
 #if LDC_LLVM_VER >= 700
-                     m
+  llvm::WriteBitcodeToFile(m, os);
+#else
+  llvm::WriteBitcodeToFile(&m, os);
+#endif
+}
+
+// Returns null (after reporting an error) on failure.
+std::unique_ptr<llvm::Module>
+readBitcodeFromBuffer(llvm::StringRef buffer, llvm::StringRef identifier,
+                      llvm::LLVMContext &context) {
+  auto parsed = llvm::parseBitcodeFile(llvm::MemoryBufferRef(buffer, identifier),
+                                       context);
+  if (!parsed) {
+#if LDC_LLVM_VER >= 400
+    const std::string message = llvm::toString(parsed.takeError());
 #else
-                     &m
+    const std::string message = parsed.getError().message();
 #endif
-                     );
-  codegenModule(Target, *newModule, out, fileType);
+    writeModuleError("cannot reload module %s: %s", identifier.str().c_str(),
+                     message.c_str());
+    return nullptr;
+  }
+  return std::move(*parsed);
+}
+
+// Deletes the bodies of all functions once the module's machine code has been
+// emitted, only the (empty) module is kept until it is freed.
+void discardFunctionBodies(llvm::Module &m) {
+  for (auto &F : m) {
+    if (!F.isDeclaration())
+      F.deleteBody();
+  }
 }
 
 }
 
-static void assemble(const std::string &asmpath, const std::string &objpath) {
+static std::vector<std::string> getAssemblerArgs(const std::string &asmpath,
+                                                  const std::string &objpath) {
   std::vector<std::string> args;
   args.push_back("-O3");
   args.push_back("-c");
@@ -130,13 +181,64 @@ static void assemble(const std::string &asmpath, const std::string &objpath) {
   args.push_back(objpath);
 
   appendTargetArgsForGcc(args);
+  return args;
+}
 
+// Returns false (after reporting an error) on failure.
+static bool assemble(const std::string &asmpath, const std::string &objpath) {
   // Run the compiler to assembly the program.
+  int R = executeToolAndWait(getGcc(), getAssemblerArgs(asmpath, objpath),
+                             global.params.verbose);
+  if (R) {
+    writeModuleError("Error while invoking external assembler.");
+    return false;
+  }
+  return true;
+}
+
+#ifndef _WIN32
+// Streams the assembly into the stdin of the external assembler while it is
+// being generated, without a temporary file. Returns false (after reporting an
+// error) on failure.
+static bool assembleFromPipe(
+    const std::string &objpath,
+    llvm::function_ref<void(llvm::raw_pwrite_stream &)> writeAsm) {
+  int R = executeToolWithPipedInput(getGcc(), getAssemblerArgs("-", objpath),
+                                    writeAsm, global.params.verbose);
+  if (R) {
+    writeModuleError("Error while invoking external assembler.");
+    return false;
+  }
+  return true;
+}
+#endif
+
+// Combines several object files to a single relocatable one. Returns false
+// (after reporting an error) on failure.
+static bool linkRelocatable(const std::vector<std::string> &objpaths,
+                            const std::string &objpath) {
+  std::vector<std::string> args;
+  args.push_back("-r");
+  args.push_back("-nostdlib");
+  for (const auto &path : objpaths)
+    args.push_back(path);
+  args.push_back("-o");
+  args.push_back(objpath);
+
+  appendTargetArgsForGcc(args);
+
   int R = executeToolAndWait(getGcc(), args, global.params.verbose);
   if (R) {
-    error(Loc(), "Error while invoking external assembler.");
-    fatal();
+    writeModuleError("Error while combining the object file partitions.");
+    return false;
   }
+  return true;
+}
+
+// Removes temporary files.
+static void removeFiles(const std::vector<std::string> &paths) {
+  for (const auto &path : paths)
+    llvm::sys::fs::remove(path);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -266,21 +368,314 @@ public:
   }
 };
 
-void writeObjectFile(llvm::Module *m, const char *filename) {
+// Whether the DWARF debug info of the given module is written to a
+// separate .dwo file (-gsplit-dwarf).
+bool useSplitDwarf(llvm::Module &m) {
+  return opts::splitDwarf && global.params.symdebug &&
+         !global.params.targetTriple->isWindowsMSVCEnvironment() &&
+         getComputeTargetType(&m) == ComputeBackend::None;
+}
+
+// Emits the object file into memory for the static library, and only writes
+// it to disk if it is kept afterwards.
+bool writeArchiveMemberObjectFile(llvm::TargetMachine &target, llvm::Module *m,
+                                  const char *filename) {
+  IF_LOG Logger::println("Writing object file to memory for: %s", filename);
+  llvm::SmallVector<char, 0> buffer;
+  {
+    llvm::raw_svector_ostream out(buffer);
+    codegenModule(target, *m, out, llvm::TargetMachine::CGFT_ObjectFile);
+  }
+
+  sizereport::addObject(llvm::MemoryBufferRef(
+      llvm::StringRef(buffer.data(), buffer.size()), filename));
+
+  if (!canSkipWritingArchiveMembers()) {
+    std::error_code errinfo;
+    llvm::raw_fd_ostream out(filename, errinfo, llvm::sys::fs::F_None);
+    if (errinfo) {
+      writeModuleError("cannot write object file '%s': %s", filename,
+                       errinfo.message().c_str());
+      return false;
+    }
+    out.write(buffer.data(), buffer.size());
+  }
+
+  retainArchiveMember(filename, std::move(buffer));
+  return true;
+}
+
+// Whether the object file is emitted into memory for the static library,
+// instead of being written to disk.
+bool isArchiveMemberInMemory(llvm::Module *m) {
+  return isArchivingObjectsInMemory() && !useSplitDwarf(*m) &&
+         getComputeTargetType(m) == ComputeBackend::None;
+}
+
+// The write*ObjectFile() functions return false (after reporting an error) on
+// failure.
+bool writeObjectFile(llvm::TargetMachine &target, llvm::Module *m,
+                     const char *filename) {
+  if (isArchiveMemberInMemory(m)) {
+    return writeArchiveMemberObjectFile(target, m, filename);
+  }
+
   IF_LOG Logger::println("Writing object file to: %s", filename);
   std::error_code errinfo;
   {
     llvm::raw_fd_ostream out(filename, errinfo, llvm::sys::fs::F_None);
     if (!errinfo)
     {
-      codegenModule(*gTargetMachine, *m, out,
-                    llvm::TargetMachine::CGFT_ObjectFile);
+      std::unique_ptr<llvm::raw_fd_ostream> dwoOut;
+#if LDC_LLVM_VER >= 700
+      if (useSplitDwarf(*m)) {
+        const auto dwoPath = getSplitDwarfFilename(filename);
+        dwoOut = llvm::make_unique<llvm::raw_fd_ostream>(
+            dwoPath, errinfo, llvm::sys::fs::F_None);
+        if (errinfo) {
+          writeModuleError("cannot write split debug info file '%s': %s",
+                           dwoPath.c_str(), errinfo.message().c_str());
+          return false;
+        }
+        target.Options.MCOptions.SplitDwarfFile = dwoPath;
+      }
+#else
+      if (useSplitDwarf(*m)) {
+        writeModuleError(
+            "-gsplit-dwarf requires LDC to be built against LLVM 7+");
+        return false;
+      }
+#endif
+      codegenModule(target, *m, out, llvm::TargetMachine::CGFT_ObjectFile,
+                    dwoOut.get());
+#if LDC_LLVM_VER >= 700
+      target.Options.MCOptions.SplitDwarfFile.clear();
+#endif
     } else {
-      error(Loc(), "cannot write object file '%s': %s", filename,
-            errinfo.message().c_str());
-      fatal();
+      writeModuleError("cannot write object file '%s': %s", filename,
+                       errinfo.message().c_str());
+      return false;
+    }
+  }
+  return true;
+}
+
+/// Creates a copy of the given TargetMachine, for use by a worker thread
+/// (TargetMachines cache subtargets and are not safe to share).
+std::unique_ptr<llvm::TargetMachine>
+cloneTargetMachine(const llvm::TargetMachine &tm) {
+  return std::unique_ptr<llvm::TargetMachine>(
+      tm.getTarget().createTargetMachine(
+          tm.getTargetTriple().str(), tm.getTargetCPU(),
+          tm.getTargetFeatureString(), tm.Options, tm.getRelocationModel(),
+          tm.getCodeModel(), tm.getOptLevel()));
+}
+
+// Returns whether the module defines at least -codegen-split-threshold
+// functions.
+bool exceedsSplitThreshold(llvm::Module *m) {
+  if (opts::codegenSplitThreshold == 0)
+    return false;
+  unsigned numDefinitions = 0;
+  for (auto &f : *m) {
+    if (!f.isDeclaration() &&
+        ++numDefinitions >= opts::codegenSplitThreshold)
+      return true;
+  }
+  return false;
+}
+
+// Returns the number of partitions to split the optimized module into for
+// parallel machine codegen (-singleobj or -codegen-split-threshold, with
+// -codegen-threads=N). Partitioning requires combining the partial objects
+// with a relocatable link via the external toolchain, which isn't available
+// for MSVC targets.
+unsigned getNumCodegenPartitions(llvm::Module *m) {
+  // The parts would be generated without .dwo files for -gsplit-dwarf.
+  if (global.params.targetTriple->isWindowsMSVCEnvironment() ||
+      getComputeTargetType(m) != ComputeBackend::None || useSplitDwarf(*m))
+    return 1;
+  const unsigned numThreads = ldc::ParallelModuleWriter::getNumThreads();
+  if (numThreads <= 1 || (!global.params.oneobj && !exceedsSplitThreshold(m)))
+    return 1;
+  return numThreads;
+}
+
+// Emits the object file by splitting the module into `numPartitions` parts,
+// which are code-generated in parallel and then linked together.
+bool writeSplitObjectFile(llvm::TargetMachine &target, llvm::Module *m,
+                          const char *filename, unsigned numPartitions) {
+  IF_LOG Logger::println("Writing object file to: %s (%u partitions)", filename,
+                         numPartitions);
+
+  std::vector<std::string> partFiles;
+  std::vector<std::unique_ptr<llvm::raw_fd_ostream>> partStreams;
+  std::vector<llvm::raw_pwrite_stream *> partStreamPtrs;
+  for (unsigned i = 0; i < numPartitions; ++i) {
+    llvm::SmallString<128> path;
+    int fd;
+    if (llvm::sys::fs::createTemporaryFile("ldc-part", global.obj_ext, fd,
+                                           path)) {
+      partStreams.clear();
+      removeFiles(partFiles);
+      writeModuleError("could not create a temporary object file for '%s'",
+                       filename);
+      return false;
+    }
+    partFiles.push_back(path.str().str());
+    partStreams.push_back(
+        llvm::make_unique<llvm::raw_fd_ostream>(fd, /*shouldClose=*/true));
+    partStreamPtrs.push_back(partStreams.back().get());
+  }
+
+  // splitCodeGen() consumes the module, so hand it a copy. The function
+  // bodies of the original aren't needed anymore (a pristine copy for the
+  // assembly output has been taken before), so free them right away instead
+  // of keeping them alive next to the copy and all parts.
+  auto clonedModule = llvm::CloneModule(
+#if LDC_LLVM_VER >= 700
+      *m
+#else
+      m
+#endif
+      );
+  discardFunctionBodies(*m);
+  // Locals are kept local. Externalizing them would make them hidden globals
+  // with their original names in the combined object, clashing with the ones
+  // of other modules.
+  llvm::splitCodeGen(
+      std::move(clonedModule), partStreamPtrs, {},
+      [&target]() { return cloneTargetMachine(target); },
+      llvm::TargetMachine::CGFT_ObjectFile, /*PreserveLocals=*/true);
+
+  partStreams.clear(); // flush & close
+
+  const bool linked = linkRelocatable(partFiles, filename);
+  removeFiles(partFiles);
+  return linked;
+}
+
+// Returns the index of the cache fragment a global value is assigned to.
+// The assignment only depends on the (comdat) name to keep it stable when
+// other functions of the module are changed.
+unsigned getFragmentIndex(const llvm::GlobalValue &gv, unsigned numFragments) {
+  if (const auto *ga = llvm::dyn_cast<llvm::GlobalAlias>(&gv)) {
+    if (const auto *aliasee = llvm::dyn_cast<llvm::GlobalValue>(
+            ga->getAliasee()->stripPointerCasts()))
+      return getFragmentIndex(*aliasee, numFragments);
+  }
+  // Appending globals (llvm.used, llvm.global_ctors...) go to fragment 0.
+  if (gv.hasAppendingLinkage())
+    return 0;
+  const llvm::StringRef key =
+      gv.hasComdat() ? gv.getComdat()->getName() : gv.getName();
+  llvm::MD5 hasher;
+  hasher.update(key);
+  llvm::MD5::MD5Result result;
+  hasher.final(result);
+  return static_cast<unsigned>(result.low() % numFragments);
+}
+
+// Turns all local definitions into hidden external ones, so that they can be
+// referenced across fragments. The new names are made unique per module, so
+// that they don't clash with other modules' objects.
+void externalizeLocals(llvm::Module &m) {
+  llvm::MD5 hasher;
+  hasher.update(m.getModuleIdentifier());
+  llvm::MD5::MD5Result result;
+  hasher.final(result);
+  llvm::SmallString<32> moduleId;
+  llvm::MD5::stringifyResult(result, moduleId);
+  moduleId.resize(8);
+
+  auto externalize = [&moduleId](llvm::GlobalValue &gv) {
+    if (!gv.hasLocalLinkage() || gv.isDeclaration())
+      return;
+    if (gv.hasName())
+      gv.setName(gv.getName() + ".frag." + moduleId);
+    else
+      gv.setName(llvm::Twine("__unnamed.frag.") + moduleId);
+    gv.setLinkage(llvm::GlobalValue::ExternalLinkage);
+    gv.setVisibility(llvm::GlobalValue::HiddenVisibility);
+  };
+  for (auto &gv : m.global_values())
+    externalize(gv);
+}
+
+// Emits the object file by splitting the optimized module into fragments,
+// each of which is looked up in (and added to) the IR-to-object cache
+// separately. The fragment objects are then combined to the final object
+// file. This way, changing a single function only requires machine codegen
+// for its fragment.
+bool writeFragmentedObjectFile(llvm::TargetMachine &target, llvm::Module *m,
+                               const char *filename, unsigned numFragments) {
+  IF_LOG Logger::println("Writing object file to: %s (%u cache fragments)",
+                         filename, numFragments);
+  LOG_SCOPE
+
+  externalizeLocals(*m);
+
+  std::vector<std::string> fragmentFiles;
+  for (unsigned i = 0; i < numFragments; ++i) {
+    bool hasDefinitions = i == 0 && !m->getModuleInlineAsm().empty();
+    for (const auto &gv : m->global_values()) {
+      if (!gv.isDeclaration() && getFragmentIndex(gv, numFragments) == i) {
+        hasDefinitions = true;
+        break;
+      }
+    }
+    if (!hasDefinitions)
+      continue;
+
+    llvm::ValueToValueMapTy vmap;
+    auto fragment = llvm::CloneModule(
+#if LDC_LLVM_VER >= 700
+        *m,
+#else
+        m,
+#endif
+        vmap, [i, numFragments](const llvm::GlobalValue *gv) {
+          return getFragmentIndex(*gv, numFragments) == i;
+        });
+    if (i != 0)
+      fragment->setModuleInlineAsm("");
+
+    llvm::SmallString<32> fragmentHash;
+    cache::calculateModuleHash(fragment.get(), target, fragmentHash);
+
+    llvm::SmallString<128> path;
+    if (llvm::sys::fs::createTemporaryFile("ldc-frag", global.obj_ext, path)) {
+      removeFiles(fragmentFiles);
+      writeModuleError("could not create a temporary object file for '%s'",
+                       filename);
+      return false;
     }
+    fragmentFiles.push_back(path.str().str());
+
+    const bool written =
+        !cache::cacheLookup(fragmentHash).empty()
+            ? cache::recoverObjectFile(fragmentHash, path)
+            : writeObjectFile(target, fragment.get(), path.c_str()) &&
+                  cache::cacheObjectFile(path, fragmentHash);
+    if (!written) {
+      removeFiles(fragmentFiles);
+      return false;
+    }
+  }
+
+  bool written = true;
+  if (fragmentFiles.size() == 1) {
+    llvm::sys::fs::remove(filename);
+    if (llvm::sys::fs::copy_file(fragmentFiles[0], filename)) {
+      writeModuleError("cannot write object file '%s'", filename);
+      written = false;
+    }
+  } else {
+    written = linkRelocatable(fragmentFiles, filename);
   }
+
+  removeFiles(fragmentFiles);
+  return written;
 }
 
 bool shouldAssembleExternally() {
@@ -307,46 +702,74 @@ bool shouldDoLTO(llvm::Module *m) {
 }
 } // end of anonymous namespace
 
-void writeModule(llvm::Module *m, const char *filename) {
+// Returns false (after reporting an error) on failure.
+static bool writeModuleImpl(llvm::TargetMachine &target, llvm::Module *m,
+                            const char *filename) {
   const bool doLTO = shouldDoLTO(m);
   const bool outputObj = shouldOutputObjectFile();
   const bool assembleExternally = shouldAssembleExternally();
+  // DCompute kernels (PTX/SPIR-V) are cached like object files, but are
+  // neither fragmented nor part of the size report.
+  const bool isComputeModule = getComputeTargetType(m) != ComputeBackend::None;
 
   // Use cached object code if possible.
-  // TODO: combine LDC's cache and LTO (the advantage is skipping the IR
-  // optimization).
-  const bool useIR2ObjCache = !opts::cacheDir.empty() && outputObj && !doLTO;
+  // For LTO, the cached 'object' file is the optimized (and for ThinLTO,
+  // summary-annotated) bitcode, so that IR optimization and bitcode writing
+  // are skipped for unchanged modules. The LTO mode is part of the hash.
+  // The cache only holds object files, so -gsplit-dwarf disables it (the
+  // .dwo file would be missing after a cache hit).
+  const bool useIR2ObjCache =
+      !opts::cacheDir.empty() && outputObj && !useSplitDwarf(*m);
   llvm::SmallString<32> moduleHash;
   if (useIR2ObjCache) {
-    llvm::SmallString<128> cacheDir(opts::cacheDir.c_str());
-    llvm::sys::fs::make_absolute(cacheDir);
-    opts::cacheDir = cacheDir.c_str();
+    makeCacheDirAbsolute();
 
     IF_LOG Logger::println("Use IR-to-Object cache in %s",
                            opts::cacheDir.c_str());
     LOG_SCOPE
 
-    cache::calculateModuleHash(m, moduleHash);
+    cache::calculateModuleHash(m, target, moduleHash);
     std::string cacheFile = cache::cacheLookup(moduleHash);
     if (!cacheFile.empty()) {
-      cache::recoverObjectFile(moduleHash, filename);
-      return;
+      if (!cache::recoverObjectFile(moduleHash, filename))
+        return false;
+      if (!isComputeModule)
+        sizereport::addObjectFile(filename);
+      return true;
     }
   }
 
-  // run optimizer
-  ldc_optimize_module(m);
-
   // make sure the output directory exists
   const auto directory = llvm::sys::path::parent_path(filename);
   if (!directory.empty()) {
     if (auto ec = llvm::sys::fs::create_directories(directory)) {
-      error(Loc(), "failed to create output directory: %s\n%s",
-            directory.data(), ec.message().c_str());
-      fatal();
+      writeModuleError("failed to create output directory: %s\n%s",
+                       directory.data(), ec.message().c_str());
+      return false;
     }
   }
 
+  // Hand optimization and code generation of a plain object file over to a
+  // remote worker (-remote-codegen), falling back to local compilation.
+  if (remote::isEnabled() && outputObj && !doLTO && !isComputeModule &&
+      !global.params.output_bc && !global.params.output_ll &&
+      !global.params.output_s && !assembleExternally && !useSplitDwarf(*m) &&
+      !isArchiveMemberInMemory(m) && remote::codegenModule(*m, filename)) {
+    if (useIR2ObjCache && !cache::cacheObjectFile(filename, moduleHash))
+      return false;
+    sizereport::addObjectFile(filename);
+    return true;
+  }
+
+  // run optimizer
+  ldc_optimize_module(m, target);
+
+  // drop the TypeInfos which aren't needed anymore
+  finalizeTypeInfos(*m);
+
+  // statically initialize what simple module constructors would assign
+  evaluateModuleCtors(*m);
+
   const auto outputFlags = {global.params.output_o, global.params.output_bc,
                             global.params.output_ll, global.params.output_s};
   const auto numOutputFiles =
@@ -372,9 +795,9 @@ void writeModule(llvm::Module *m, const char *filename) {
     std::error_code errinfo;
     llvm::raw_fd_ostream bos(bcpath.c_str(), errinfo, llvm::sys::fs::F_None);
     if (bos.has_error()) {
-      error(Loc(), "cannot write LLVM bitcode file '%s': %s", bcpath.c_str(),
-            errinfo.message().c_str());
-      fatal();
+      writeModuleError("cannot write LLVM bitcode file '%s': %s",
+                       bcpath.c_str(), errinfo.message().c_str());
+      return false;
     }
 
 #if LDC_LLVM_VER >= 700
@@ -405,6 +828,12 @@ void writeModule(llvm::Module *m, const char *filename) {
     } else {
       llvm::WriteBitcodeToFile(M, bos);
     }
+
+    if (emitBitcodeAsObjectFile && useIR2ObjCache) {
+      bos.close();
+      if (!cache::cacheObjectFile(filename, moduleHash))
+        return false;
+    }
   }
 
   // write LLVM IR
@@ -414,17 +843,78 @@ void writeModule(llvm::Module *m, const char *filename) {
     std::error_code errinfo;
     llvm::raw_fd_ostream aos(llpath.c_str(), errinfo, llvm::sys::fs::F_None);
     if (aos.has_error()) {
-      error(Loc(), "cannot write LLVM IR file '%s': %s", llpath.c_str(),
-            errinfo.message().c_str());
-      fatal();
+      writeModuleError("cannot write LLVM IR file '%s': %s", llpath.c_str(),
+                       errinfo.message().c_str());
+      return false;
     }
     AssemblyAnnotator annotator(m->getDataLayout());
     m->print(aos, &annotator);
   }
 
   const bool writeObj = outputObj && !emitBitcodeAsObjectFile;
+  const bool writeAsm = global.params.output_s || assembleExternally;
+
+  // Code generation modifies the module, so emitting both assembly and an
+  // object file requires a pristine copy of it for the second run. Instead of
+  // cloning the whole module, keep a bitcode snapshot, emit the object file
+  // first and free the function bodies before reloading the snapshot for the
+  // assembly.
+  llvm::SmallVector<char, 0> asmSnapshot;
+  if (writeObj && writeAsm)
+    writeBitcodeToBuffer(*m, asmSnapshot);
+
+  if (writeObj) {
+    // Fragments are only supported if the object file is the sole output,
+    // as the module is modified in the process.
+    const unsigned numFragments =
+        useIR2ObjCache && numOutputFiles == 1 && !isComputeModule &&
+                !global.params.targetTriple->isWindowsMSVCEnvironment()
+            ? cache::getNumModuleFragments()
+            : 0;
+    const unsigned numPartitions = getNumCodegenPartitions(m);
+    bool written;
+    if (numFragments > 1) {
+      written = writeFragmentedObjectFile(target, m, filename, numFragments);
+    } else if (numPartitions > 1) {
+      written = writeSplitObjectFile(target, m, filename, numPartitions);
+    } else {
+      written = writeObjectFile(target, m, filename);
+    }
+    if (!written ||
+        (useIR2ObjCache && !cache::cacheObjectFile(filename, moduleHash))) {
+      return false;
+    }
+    // In-memory archive members have been added by
+    // writeArchiveMemberObjectFile().
+    if (!isComputeModule &&
+        (numPartitions > 1 || !isArchiveMemberInMemory(m))) {
+      sizereport::addObjectFile(filename);
+    }
+  }
+
   // write native assembly
-  if (global.params.output_s || assembleExternally) {
+  if (writeAsm) {
+    std::unique_ptr<llvm::Module> asmModule;
+    if (writeObj) {
+      discardFunctionBodies(*m);
+      asmModule = readBitcodeFromBuffer(
+          llvm::StringRef(asmSnapshot.data(), asmSnapshot.size()),
+          m->getModuleIdentifier(), m->getContext());
+      if (!asmModule)
+        return false;
+      asmSnapshot = llvm::SmallVector<char, 0>();
+    }
+
+#ifndef _WIN32
+    if (assembleExternally && !global.params.output_s) {
+      Logger::println("Piping asm to the external assembler\n");
+      llvm::Module &mod = asmModule ? *asmModule : *m;
+      return assembleFromPipe(filename, [&](llvm::raw_pwrite_stream &out) {
+        codegenModule(target, mod, out, llvm::TargetMachine::CGFT_AssemblyFile);
+      });
+    }
+#endif
+
     std::string spath;
     if (!global.params.output_s) {
       llvm::SmallString<16> buffer;
@@ -440,34 +930,146 @@ void writeModule(llvm::Module *m, const char *filename) {
       llvm::raw_fd_ostream out(spath.c_str(), errinfo, llvm::sys::fs::F_None);
       if (!errinfo)
       {
-        if (writeObj) {
-          // Clone module if we have both output-o and output-s flags
-          // to avoid running 'addPassesToEmitFile' passes twice on same module
-          cloneAndCodegenModule(*gTargetMachine, *m, out,
-                                llvm::TargetMachine::CGFT_AssemblyFile);
-        } else {
-          codegenModule(*gTargetMachine, *m, out,
-                        llvm::TargetMachine::CGFT_AssemblyFile);
-        }
+        codegenModule(target, asmModule ? *asmModule : *m, out,
+                      llvm::TargetMachine::CGFT_AssemblyFile);
       } else {
-        error(Loc(), "cannot write asm: %s", errinfo.message().c_str());
-        fatal();
+        writeModuleError("cannot write asm: %s", errinfo.message().c_str());
+        return false;
       }
     }
 
-    if (assembleExternally) {
-      assemble(spath, filename);
-    }
+    const bool assembled = !assembleExternally || assemble(spath, filename);
 
     if (!global.params.output_s) {
       llvm::sys::fs::remove(spath);
     }
+    if (!assembled)
+      return false;
   }
+  return true;
+}
 
-  if (writeObj) {
-    writeObjectFile(m, filename);
-    if (useIR2ObjCache) {
-      cache::cacheObjectFile(filename, moduleHash);
+void writeModule(llvm::TargetMachine &target, llvm::Module *m,
+                 const char *filename) {
+  if (!writeModuleImpl(target, m, filename))
+    fatal();
+}
+
+void writeModuleError(const char *format, ...) {
+  va_list ap;
+  va_start(ap, format);
+  if (threadErrors) {
+    char buffer[1024];
+    vsnprintf(buffer, sizeof(buffer), format, ap);
+    threadErrors->push_back(buffer);
+  } else {
+    verror(Loc(), format, ap);
+  }
+  va_end(ap);
+}
+
+std::string getSplitDwarfFilename(llvm::StringRef objPath) {
+  llvm::SmallString<128> path(objPath);
+  llvm::sys::path::replace_extension(path, "dwo");
+  return path.str().str();
+}
+
+void makeCacheDirAbsolute() {
+  if (opts::cacheDir.empty() || llvm::sys::path::is_absolute(opts::cacheDir))
+    return;
+  llvm::SmallString<128> cacheDir(opts::cacheDir.c_str());
+  llvm::sys::fs::make_absolute(cacheDir);
+  opts::cacheDir = cacheDir.c_str();
+}
+
+void writeModule(llvm::Module *m, const char *filename) {
+  writeModule(*gTargetMachine, m, filename);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+namespace ldc {
+
+ParallelModuleWriter::ParallelModuleWriter(unsigned numThreads)
+    : pool(llvm::make_unique<llvm::ThreadPool>(numThreads)) {
+  // The worker threads may access the cache directory concurrently.
+  makeCacheDirAbsolute();
+  cache::setupRemoteBackend();
+}
+
+ParallelModuleWriter::~ParallelModuleWriter() { wait(); }
+
+void ParallelModuleWriter::enqueue(llvm::Module &m, const char *filename) {
+  enqueue(*gTargetMachine, m, filename);
+}
+
+void ParallelModuleWriter::enqueue(const llvm::TargetMachine &tm,
+                                   llvm::Module &m, const char *filename) {
+  // Move the module to a fresh LLVMContext by serializing it to bitcode, so
+  // that IR generation of the next module can continue in the global context.
+  auto bitcode = std::make_shared<llvm::SmallVector<char, 0>>();
+  {
+    llvm::raw_svector_ostream os(*bitcode);
+#if LDC_LLVM_VER >= 700
+    llvm::WriteBitcodeToFile(m, os);
+#else
+    llvm::WriteBitcodeToFile(&m, os);
+#endif
+  }
+
+  // Clone the TargetMachine on the main thread; gTargetMachine may be swapped
+  // out (e.g., by DCompute) while the task is pending.
+  std::shared_ptr<llvm::TargetMachine> target = cloneTargetMachine(tm);
+  const bool discardValueNames = m.getContext().shouldDiscardValueNames();
+  std::string file = filename;
+  errors.emplace_back();
+  std::vector<std::string> *jobErrors = &errors.back();
+
+  pool->async([bitcode, target, discardValueNames, file, jobErrors]() {
+    threadErrors = jobErrors;
+    llvm::LLVMContext context;
+    context.setDiscardValueNames(discardValueNames);
+
+    auto buffer = llvm::MemoryBuffer::getMemBuffer(
+        llvm::StringRef(bitcode->data(), bitcode->size()), file, false);
+    auto module = llvm::parseBitcodeFile(buffer->getMemBufferRef(), context);
+    if (!module) {
+#if LDC_LLVM_VER >= 400
+      const std::string msg = llvm::toString(module.takeError());
+#else
+      const std::string msg = module.getError().message();
+#endif
+      writeModuleError("failed to transfer module '%s' to a codegen thread: %s",
+                       file.c_str(), msg.c_str());
+    } else {
+      bitcode->clear();
+      writeModuleImpl(*target, module->get(), file.c_str());
+    }
+    threadErrors = nullptr;
+  });
+}
+
+void ParallelModuleWriter::wait() {
+  pool->wait();
+
+  bool failed = false;
+  for (const auto &jobErrors : errors) {
+    for (const auto &msg : jobErrors) {
+      error(Loc(), "%s", msg.c_str());
+      failed = true;
     }
   }
+  errors.clear();
+  if (failed)
+    fatal();
 }
+
+unsigned ParallelModuleWriter::getNumThreads() {
+  if (!llvm::llvm_is_multithreaded())
+    return 1;
+  if (opts::codegenThreads == 0)
+    return std::max(1u, std::thread::hardware_concurrency());
+  return opts::codegenThreads;
+}
+
+} // namespace ldc
@@ -13,8 +13,70 @@
 
 #pragma once
 
+#include "llvm/ADT/StringRef.h"
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+
 namespace llvm {
 class Module;
+class TargetMachine;
+class ThreadPool;
 }
 
 void writeModule(llvm::Module *m, const char *filename);
+
+/// Same as above, but emits the module for `target` instead of gTargetMachine.
+void writeModule(llvm::TargetMachine &target, llvm::Module *m,
+                 const char *filename);
+
+/// Returns the path of the .dwo file accompanying the given object file
+/// (-gsplit-dwarf).
+std::string getSplitDwarfFilename(llvm::StringRef objPath);
+
+/// Makes opts::cacheDir an absolute path (once, before any concurrent use).
+void makeCacheDirAbsolute();
+
+/// Reports an error while writing a module. dmd's error() isn't thread-safe,
+/// so on ParallelModuleWriter threads, the errors are collected and reported
+/// by the main thread instead. The caller returns the failure to writeModule()
+/// instead of calling fatal().
+void writeModuleError(const char *format, ...);
+
+namespace ldc {
+
+/// Optimizes and emits finished modules concurrently (-codegen-threads).
+///
+/// Each enqueued module is transferred to its own LLVMContext (via bitcode)
+/// and processed by writeModule() on a worker thread with a private copy of
+/// the TargetMachine, while IR generation continues on the main thread.
+class ParallelModuleWriter {
+public:
+  explicit ParallelModuleWriter(unsigned numThreads);
+  ~ParallelModuleWriter();
+
+  /// Schedules the module for emission to `filename`. The module isn't
+  /// referenced anymore after this call and can be freed by the caller.
+  void enqueue(llvm::Module &m, const char *filename);
+
+  /// Same as above, but emits the module for `target` instead of
+  /// gTargetMachine (e.g., for DCompute targets).
+  void enqueue(const llvm::TargetMachine &target, llvm::Module &m,
+               const char *filename);
+
+  /// Blocks until all enqueued modules have been written, then reports the
+  /// errors of the worker threads (and exits if there are any).
+  void wait();
+
+  /// Returns the number of threads requested via -codegen-threads.
+  static unsigned getNumThreads();
+
+private:
+  std::unique_ptr<llvm::ThreadPool> pool;
+  /// The errors of each enqueued module, in order. Each worker thread only
+  /// writes to the (stable) slot of its own module.
+  std::deque<std::vector<std::string>> errors;
+};
+
+} // namespace ldc
@@ -20,7 +20,27 @@
 #include "llvm/Support/Program.h"
 
 #ifdef _WIN32
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Support/MD5.h"
+#include "llvm/Support/raw_ostream.h"
+#if LDC_LLVM_VER >= 400
+#include "llvm/Support/Chrono.h"
+#endif
+#include <algorithm>
+#include <tuple>
 #include <Windows.h>
+#else
+#include "llvm/Support/raw_ostream.h"
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <fcntl.h>
+#include <pthread.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char **environ;
 #endif
 
 //////////////////////////////////////////////////////////////////////////////
@@ -209,6 +229,98 @@ int executeToolAndWait(const std::string &tool_,
 
 ////////////////////////////////////////////////////////////////////////////////
 
+#ifndef _WIN32
+
+int executeToolWithPipedInput(
+    const std::string &tool_, std::vector<std::string> const &args,
+    llvm::function_ref<void(llvm::raw_pwrite_stream &)> writeInput,
+    bool verbose) {
+  const auto tool = findProgramByName(tool_);
+  if (tool.empty()) {
+    error(Loc(), "failed to locate %s", tool_.c_str());
+    return -1;
+  }
+
+  auto realargs = getFullArgs(tool.c_str(), args, verbose);
+  realargs.push_back(nullptr); // terminate with null
+
+  // Several tools may be spawned concurrently by codegen threads. Both pipe
+  // ends are close-on-exec, so that no child inherits the write end of its
+  // own or of another tool's pipe, which would never see EOF then. The dup2
+  // to the child's stdin clears the flag for the read end.
+  int fds[2];
+#ifdef __linux__
+  const bool pipeCreated = pipe2(fds, O_CLOEXEC) == 0;
+#else
+  // Without pipe2(), a concurrent spawn may still catch the pipe before the
+  // flags are set.
+  const bool pipeCreated = pipe(fds) == 0 &&
+                           fcntl(fds[0], F_SETFD, FD_CLOEXEC) != -1 &&
+                           fcntl(fds[1], F_SETFD, FD_CLOEXEC) != -1;
+#endif
+  if (!pipeCreated) {
+    error(Loc(), "cannot create pipe to %s", tool.c_str());
+    return -1;
+  }
+
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_adddup2(&actions, fds[0], STDIN_FILENO);
+
+  pid_t pid;
+  const int spawnError =
+      posix_spawn(&pid, tool.c_str(), &actions, nullptr,
+                  const_cast<char *const *>(realargs.data()), environ);
+  posix_spawn_file_actions_destroy(&actions);
+  close(fds[0]);
+  if (spawnError) {
+    close(fds[1]);
+    error(Loc(), "cannot execute %s: %s", tool.c_str(), strerror(spawnError));
+    return -1;
+  }
+
+  // If the tool exits prematurely, report its status instead of being killed
+  // by SIGPIPE. The signal is only blocked for this thread, as other threads
+  // may write to their pipes concurrently. A SIGPIPE raised by the writes
+  // below is consumed before restoring the signal mask.
+  sigset_t sigpipeMask, previousMask, pending;
+  sigemptyset(&sigpipeMask);
+  sigaddset(&sigpipeMask, SIGPIPE);
+  pthread_sigmask(SIG_BLOCK, &sigpipeMask, &previousMask);
+  sigpending(&pending);
+  const bool wasPending = sigismember(&pending, SIGPIPE);
+  {
+    llvm::raw_fd_ostream out(fds[1], /*shouldClose=*/true);
+    writeInput(out);
+    out.close();
+    out.clear_error();
+  }
+  sigpending(&pending);
+  if (!wasPending && sigismember(&pending, SIGPIPE)) {
+    int signal;
+    sigwait(&sigpipeMask, &signal);
+  }
+  pthread_sigmask(SIG_SETMASK, &previousMask, nullptr);
+
+  int status;
+  while (waitpid(pid, &status, 0) < 0) {
+    if (errno != EINTR) {
+      error(Loc(), "cannot wait for %s", tool.c_str());
+      return -1;
+    }
+  }
+  if (WIFEXITED(status) && WEXITSTATUS(status) == 0)
+    return 0;
+
+  const int exitCode = WIFEXITED(status) ? WEXITSTATUS(status) : -2;
+  error(Loc(), "%s failed with status: %d", tool.c_str(), exitCode);
+  return exitCode;
+}
+
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+
 #ifdef _WIN32
 
 namespace windows {
@@ -300,10 +412,227 @@ int executeAndWait(const char *commandLine) {
   return exitCode;
 }
 
-bool setupMsvcEnvironmentImpl() {
-  if (getenv("VSINSTALLDIR"))
-    return true;
+namespace {
 
+llvm::cl::opt<bool> disableMsvcEnvCache(
+    "disable-msvc-env-cache", llvm::cl::ZeroOrMore, llvm::cl::Hidden,
+    llvm::cl::desc("Always run vcvarsall to set up the MSVC environment, "
+                   "instead of using the one cached by a previous run"));
+
+using Environment = std::vector<std::pair<std::string, std::string>>;
+
+const char msvcEnvCacheMagic[] = "LDC MSVC environment cache v2";
+
+// Parses the output of `set`.
+Environment parseEnvironment(llvm::StringRef contents) {
+  Environment env;
+  const auto size = contents.size();
+
+  size_t i = 0;
+  // for each line
+  while (i < size) {
+    llvm::StringRef key, value;
+
+    for (size_t j = i; j < size; ++j) {
+      const char c = contents[j];
+      if (c == '=' && key.empty()) {
+        key = contents.slice(i, j);
+        i = j + 1;
+      } else if (c == '\n' || c == '\r' || c == '\0') {
+        if (!key.empty()) {
+          value = contents.slice(i, j);
+        }
+        // break and continue with next line
+        i = j + 1;
+        break;
+      }
+    }
+
+    if (!key.empty() && !value.empty())
+      env.emplace_back(key.str(), value.str());
+  }
+
+  return env;
+}
+
+// Variables holding `;`-separated lists, which vcvarsall extends.
+bool isListVariable(llvm::StringRef key) {
+  return key.equals_lower("PATH") || key.equals_lower("INCLUDE") ||
+         key.equals_lower("LIB") || key.equals_lower("LIBPATH");
+}
+
+// Returns the entries of the list `added` missing in the list `current`.
+std::string getMissingListEntries(llvm::StringRef current,
+                                  llvm::StringRef added) {
+  llvm::SmallVector<llvm::StringRef, 32> currentEntries, addedEntries;
+  current.split(currentEntries, ';', -1, /*KeepEmpty=*/false);
+  added.split(addedEntries, ';', -1, /*KeepEmpty=*/false);
+
+  std::string missing;
+  for (llvm::StringRef entry : addedEntries) {
+    const bool found =
+        std::any_of(currentEntries.begin(), currentEntries.end(),
+                    [entry](llvm::StringRef e) { return e.equals_lower(entry); });
+    if (!found) {
+      if (!missing.empty())
+        missing += ';';
+      missing += entry;
+    }
+  }
+  return missing;
+}
+
+// Reduces the environment dumped after running vcvarsall to the variables it
+// added or changed, so that neither the cache nor the current process pick up
+// unrelated (and possibly sensitive) variables. For list variables, only the
+// added entries are kept.
+Environment getVcvarsallChanges(const Environment &env) {
+  Environment changes;
+  for (const auto &pair : env) {
+    const char *current = getenv(pair.first.c_str());
+    if (!current) {
+      changes.push_back(pair);
+    } else if (isListVariable(pair.first)) {
+      std::string added = getMissingListEntries(current, pair.second);
+      if (!added.empty())
+        changes.emplace_back(pair.first, std::move(added));
+    } else if (pair.second != current) {
+      changes.push_back(pair);
+    }
+  }
+  return changes;
+}
+
+// Returns the paths whose modification times invalidate a cached environment:
+// the LDC batch files and the VS/SDK installation directories set up by
+// vcvarsall. VS updates install the tools to new versioned directories and
+// touch the installation directory.
+std::vector<std::string> getMsvcEnvStampPaths(const Environment &env) {
+  std::vector<std::string> paths = {exe_path::prependBinDir("dumpEnv.bat"),
+                                    exe_path::prependBinDir("msvcEnv.bat")};
+  for (const auto &pair : env) {
+    if (pair.first == "VSINSTALLDIR" || pair.first == "VCINSTALLDIR" ||
+        pair.first == "VCToolsInstallDir" || pair.first == "WindowsSdkDir" ||
+        pair.first == "UniversalCRTSdkDir") {
+      paths.push_back(pair.second);
+    }
+  }
+  return paths;
+}
+
+bool getModificationTime(const std::string &path, long long &time) {
+  llvm::sys::fs::file_status status;
+  if (llvm::sys::fs::status(path, status))
+    return false;
+#if LDC_LLVM_VER >= 400
+  time = llvm::sys::toTimeT(status.getLastModificationTime());
+#else
+  time = status.getLastModificationTime().toEpochTime();
+#endif
+  return true;
+}
+
+// Returns the cache file for the environment for `arch`, also keyed by the
+// VS installation preselected via LDC_VSDIR and the LDC installation.
+std::string getMsvcEnvCacheFile(const std::string &arch) {
+  llvm::SmallString<128> dir;
+  if (const char *localAppData = getenv("LOCALAPPDATA")) {
+    dir = localAppData;
+  } else {
+    llvm::sys::path::system_temp_directory(/*ErasedOnReboot=*/false, dir);
+  }
+  llvm::sys::path::append(dir, "ldc");
+
+  llvm::MD5 hash;
+  hash.update(exe_path::getBinDir());
+  hash.update(llvm::StringRef("\0", 1));
+  if (const char *vsDir = getenv("LDC_VSDIR"))
+    hash.update(vsDir);
+  llvm::MD5::MD5Result result;
+  hash.final(result);
+  llvm::SmallString<32> hex;
+  llvm::MD5::stringifyResult(result, hex);
+
+  llvm::sys::path::append(dir, "msvcenv-" + arch + "-" +
+                                   hex.substr(0, 16).str() + ".txt");
+  return dir.str();
+}
+
+// Reads a cached environment, checking that the stamps still match.
+bool readMsvcEnvCache(const std::string &cacheFile, Environment &env) {
+  auto fileBuffer = llvm::MemoryBuffer::getFile(cacheFile);
+  if (fileBuffer.getError())
+    return false;
+
+  llvm::StringRef contents = (*fileBuffer)->getBuffer();
+  llvm::StringRef line;
+  std::tie(line, contents) = contents.split('\n');
+  if (line.rtrim() != msvcEnvCacheMagic)
+    return false;
+
+  // `<mtime>|<path>` stamp lines, terminated by an empty line
+  std::vector<std::pair<long long, std::string>> stamps;
+  while (true) {
+    std::tie(line, contents) = contents.split('\n');
+    line = line.rtrim();
+    if (line.empty())
+      break;
+    const auto parts = line.split('|');
+    long long time;
+    if (parts.first.getAsInteger(10, time))
+      return false;
+    stamps.emplace_back(time, parts.second.str());
+  }
+
+  env = parseEnvironment(contents);
+
+  // The recorded stamps must be the ones for this environment and unchanged.
+  const auto paths = getMsvcEnvStampPaths(env);
+  if (paths.size() != stamps.size())
+    return false;
+  for (size_t i = 0; i < paths.size(); ++i) {
+    long long time;
+    if (stamps[i].second != paths[i] || !getModificationTime(paths[i], time) ||
+        time != stamps[i].first) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void writeMsvcEnvCache(const std::string &cacheFile, const Environment &env) {
+  if (llvm::sys::fs::create_directories(
+          llvm::sys::path::parent_path(cacheFile))) {
+    return;
+  }
+
+  // Write to a unique file and rename it, for concurrent invocations.
+  int fd;
+  llvm::SmallString<128> tmpFile;
+  if (llvm::sys::fs::createUniqueFile(cacheFile + ".%%%%%%%%", fd, tmpFile))
+    return;
+  {
+    llvm::raw_fd_ostream os(fd, /*shouldClose=*/true);
+    os << msvcEnvCacheMagic << '\n';
+    for (const auto &path : getMsvcEnvStampPaths(env)) {
+      long long time;
+      if (!getModificationTime(path, time)) {
+        os.close();
+        llvm::sys::fs::remove(tmpFile);
+        return;
+      }
+      os << time << '|' << path << '\n';
+    }
+    os << '\n';
+    for (const auto &pair : env)
+      os << pair.first << '=' << pair.second << '\n';
+  }
+  if (llvm::sys::fs::rename(tmpFile, cacheFile))
+    llvm::sys::fs::remove(tmpFile);
+}
+
+// Runs vcvarsall (via dumpEnv.bat) and returns the variables it changed.
+bool probeMsvcEnvironment(const std::string &arch, Environment &env) {
   llvm::SmallString<128> tmpFilePath;
   if (llvm::sys::fs::createTemporaryFile("ldc_dumpEnv", "", tmpFilePath))
     return false;
@@ -326,8 +655,6 @@ bool setupMsvcEnvironmentImpl() {
   }
   std::string cmdExecutable = comspecEnv;
   std::string batchFile = exe_path::prependBinDir("dumpEnv.bat");
-  std::string arch =
-      global.params.targetTriple->isArch64Bit() ? "amd64" : "x86";
 
   llvm::SmallString<512> commandLine;
   commandLine += quoteArg(cmdExecutable);
@@ -351,34 +678,35 @@ bool setupMsvcEnvironmentImpl() {
   if (fileBuffer.getError())
     return false;
 
-  const auto contents = (*fileBuffer)->getBuffer();
-  const auto size = contents.size();
+  env = getVcvarsallChanges(parseEnvironment((*fileBuffer)->getBuffer()));
+  return true;
+}
 
-  // Parse the file.
-  std::vector<std::pair<llvm::StringRef, llvm::StringRef>> env;
+} // anonymous namespace
 
-  size_t i = 0;
-  // for each line
-  while (i < size) {
-    llvm::StringRef key, value;
+bool setupMsvcEnvironmentImpl() {
+  if (getenv("VSINSTALLDIR"))
+    return true;
 
-    for (size_t j = i; j < size; ++j) {
-      const char c = contents[j];
-      if (c == '=' && key.empty()) {
-        key = contents.slice(i, j);
-        i = j + 1;
-      } else if (c == '\n' || c == '\r' || c == '\0') {
-        if (!key.empty()) {
-          value = contents.slice(i, j);
-        }
-        // break and continue with next line
-        i = j + 1;
-        break;
-      }
-    }
+  const std::string arch =
+      global.params.targetTriple->isArch64Bit() ? "amd64" : "x86";
 
-    if (!key.empty() && !value.empty())
-      env.emplace_back(key, value);
+  // The probe takes seconds, so the environment is cached on disk.
+  const std::string cacheFile =
+      disableMsvcEnvCache ? std::string() : getMsvcEnvCacheFile(arch);
+
+  Environment env;
+  if (cacheFile.empty() || !readMsvcEnvCache(cacheFile, env)) {
+    if (!probeMsvcEnvironment(arch, env))
+      return false;
+    const bool haveVsInstallDir = std::any_of(
+        env.begin(), env.end(), [](const Environment::value_type &pair) {
+          return pair.first == "VSINSTALLDIR";
+        });
+    if (!cacheFile.empty() && haveVsInstallDir)
+      writeMsvcEnvCache(cacheFile, env);
+  } else if (global.params.verbose) {
+    message("Using cached MSVC environment: %s", cacheFile.c_str());
   }
 
   if (global.params.verbose)
@@ -387,8 +715,17 @@ bool setupMsvcEnvironmentImpl() {
   bool haveVsInstallDir = false;
 
   for (const auto &pair : env) {
-    const std::string key = pair.first.str();
-    const std::string value = pair.second.str();
+    const std::string &key = pair.first;
+    std::string value = pair.second;
+
+    // Prepend the added entries of list variables to their current values.
+    const char *current = getenv(key.c_str());
+    if (current && isListVariable(key)) {
+      const std::string missing = getMissingListEntries(current, value);
+      if (missing.empty())
+        continue;
+      value = missing + ';' + current;
+    }
 
     if (global.params.verbose)
       message("  %s=%s", key.c_str(), value.c_str());
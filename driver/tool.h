@@ -17,8 +17,13 @@
 #include <vector>
 #include <string>
 
+#include "llvm/ADT/STLExtras.h"
 #include "llvm/Support/CommandLine.h"
 
+namespace llvm {
+class raw_pwrite_stream;
+}
+
 namespace opts {
 extern llvm::cl::opt<std::string> linker;
 }
@@ -41,6 +46,15 @@ int executeToolAndWait(const std::string &tool,
                        std::vector<std::string> const &args,
                        bool verbose = false);
 
+#ifndef _WIN32
+// Runs the tool with its stdin connected to a pipe, which `writeInput` writes
+// to while the tool is running. Returns the tool's exit status.
+int executeToolWithPipedInput(
+    const std::string &tool, std::vector<std::string> const &args,
+    llvm::function_ref<void(llvm::raw_pwrite_stream &)> writeInput,
+    bool verbose = false);
+#endif
+
 #ifdef _WIN32
 
 namespace windows {
@@ -15,6 +15,7 @@
 #include "dmd/mtype.h"
 #include "gen/arrays.h"
 #include "gen/dvalue.h"
+#include "gen/gcallocsites.h"
 #include "gen/irstate.h"
 #include "gen/llvm.h"
 #include "gen/llvmhelpers.h"
@@ -23,6 +24,14 @@
 #include "gen/tollvm.h"
 #include "ir/irfunction.h"
 #include "ir/irmodule.h"
+#include "llvm/Support/CommandLine.h"
+#include <functional>
+
+static llvm::cl::opt<bool> inlineAALookups(
+    "aa-inline-lookup", llvm::cl::ZeroOrMore,
+    llvm::cl::desc("Probe the first bucket of associative arrays with "
+                   "integral or pointer keys inline, bypassing druntime's "
+                   "TypeInfo-based lookup (relies on the druntime AA layout)"));
 
 // returns the keytype typeinfo
 static LLConstant *to_keyti(DValue *aa, LLType *targetType) {
@@ -35,6 +44,140 @@ static LLConstant *to_keyti(DValue *aa, LLType *targetType) {
 
 ////////////////////////////////////////////////////////////////////////////////
 
+// Returns whether lookups with keys of the given type may use the inline fast
+// path. For integral types fitting into a size_t, druntime's
+// TypeInfo.getHash() is the value itself; for data pointers, it is
+// `addr ^ (addr >> 4)` (TypeInfo_Pointer). equals() compares the bits.
+static bool canInlineAALookup(Type *keyType) {
+  if (!inlineAALookups) {
+    return false;
+  }
+  Type *t = keyType->toBasetype();
+  if (t->ty == Tpointer) {
+    return t->nextOf()->toBasetype()->ty != Tfunction;
+  }
+  return t->ty != Tvector && t->isintegral() &&
+         t->size() <= Type::tsize_t->size();
+}
+
+// Emits a lookup of the key pointed to by pkey in the druntime AA aaval
+// (the Impl pointer), probing the first bucket inline. A hit yields the value
+// pointer directly; an empty bucket means the key isn't present, which
+// `insert` lookups (_aaGetY) still need to handle in the runtime.
+// callRuntime emits the regular runtime lookup, used for everything else
+// (null and empty AAs, collisions).
+//
+// This mirrors rt.aaA in druntime:
+//   struct Impl { Bucket[] buckets; uint used; uint deleted;
+//                 TypeInfo_Struct entryTI; uint firstUsed;
+//                 immutable uint keysz, valsz, valoff; ... }
+//   struct Bucket { size_t hash; void* entry; }
+//   hash = mix(keyti.getHash(pkey)) | HASH_FILLED_MARK
+// The getHash() implementations inlined here must match druntime's exactly,
+// otherwise the probe looks at the wrong bucket.
+static LLValue *DtoInlineAALookup(Type *keyType, LLValue *aaval, LLValue *pkey,
+                                  bool insert,
+                                  const std::function<LLValue *()> &callRuntime) {
+  IF_LOG Logger::println("Inlining first AA bucket probe");
+  LOG_SCOPE;
+
+  LLType *sizeTy = DtoSize_t();
+  LLType *voidPtrTy = getVoidPtrType();
+  LLType *i32Ty = LLType::getInt32Ty(gIR->context());
+  LLStructType *bucketTy = LLStructType::get(gIR->context(),
+                                             {sizeTy, voidPtrTy});
+  LLStructType *implTy = LLStructType::get(
+      gIR->context(), {sizeTy, getPtrToType(bucketTy), i32Ty, i32Ty,
+                       voidPtrTy, i32Ty, i32Ty, i32Ty, i32Ty});
+  const unsigned sizeBits = getTypeBitSize(sizeTy);
+
+  llvm::BasicBlock *probebb = gIR->insertBB("aa.probe");
+  llvm::BasicBlock *keybb = gIR->insertBBAfter(probebb, "aa.probekey");
+  llvm::BasicBlock *hitbb = gIR->insertBBAfter(keybb, "aa.hit");
+  llvm::BasicBlock *emptybb = gIR->insertBBAfter(hitbb, "aa.probeempty");
+  llvm::BasicBlock *slowbb = gIR->insertBBAfter(emptybb, "aa.slow");
+  llvm::BasicBlock *endbb = gIR->insertBBAfter(slowbb, "aa.lookupend");
+
+  LLValue *nullptr_ = LLConstant::getNullValue(voidPtrTy);
+
+  // null AA => runtime (which returns null or allocates the AA)
+  aaval = DtoBitCast(aaval, voidPtrTy);
+  gIR->ir->CreateCondBr(gIR->ir->CreateICmpEQ(aaval, nullptr_), slowbb,
+                        probebb);
+
+  // compute the hash and load the bucket
+  gIR->scope() = IRScope(probebb);
+  LLValue *impl = DtoBitCast(aaval, getPtrToType(implTy));
+  LLValue *dim = DtoLoad(DtoGEPi(impl, 0, 0), "aa.dim");
+  LLValue *buckets = DtoLoad(DtoGEPi(impl, 0, 1), "aa.buckets");
+
+  Type *kt = keyType->toBasetype();
+  LLType *keyIntTy = LLIntegerType::get(
+      gIR->context(), static_cast<unsigned>(kt->size() * 8));
+  LLValue *key = DtoLoad(DtoBitCast(pkey, getPtrToType(keyIntTy)), "aa.key");
+  LLValue *hash = (kt->ty != Tpointer && !kt->isunsigned())
+                      ? gIR->ir->CreateSExtOrBitCast(key, sizeTy)
+                      : gIR->ir->CreateZExtOrBitCast(key, sizeTy);
+  if (kt->ty == Tpointer) {
+    // TypeInfo_Pointer.getHash()
+    hash = gIR->ir->CreateXor(hash, gIR->ir->CreateLShr(hash, 4));
+  }
+  // final mix function of MurmurHash2
+  hash = gIR->ir->CreateXor(hash, gIR->ir->CreateLShr(hash, 13));
+  hash = gIR->ir->CreateMul(hash, LLConstantInt::get(sizeTy, 0x5bd1e995));
+  hash = gIR->ir->CreateXor(hash, gIR->ir->CreateLShr(hash, 15));
+  hash = gIR->ir->CreateOr(
+      hash, LLConstantInt::get(sizeTy, APInt::getOneBitSet(sizeBits,
+                                                           sizeBits - 1)),
+      "aa.hash");
+
+  // Allocated AAs always have a power-of-2 number of buckets (>= 8).
+  LLValue *mask = gIR->ir->CreateSub(dim, DtoConstSize_t(1));
+  LLValue *bucket = DtoGEP1(buckets, gIR->ir->CreateAnd(hash, mask), true);
+  LLValue *bucketHash = DtoLoad(DtoGEPi(bucket, 0, 0), "aa.buckethash");
+  gIR->ir->CreateCondBr(gIR->ir->CreateICmpEQ(bucketHash, hash), keybb,
+                        emptybb);
+
+  // hashes match => compare the keys
+  gIR->scope() = IRScope(keybb);
+  LLValue *entry = DtoLoad(DtoGEPi(bucket, 0, 1), "aa.entry");
+  LLValue *entryKey = DtoLoad(DtoBitCast(entry, getPtrToType(keyIntTy)));
+  gIR->ir->CreateCondBr(gIR->ir->CreateICmpEQ(entryKey, key), hitbb, slowbb);
+
+  // hit => value pointer
+  gIR->scope() = IRScope(hitbb);
+  LLValue *valoff = gIR->ir->CreateZExt(
+      DtoLoad(DtoGEPi(impl, 0, 8), "aa.valoff"), sizeTy);
+  LLValue *hit = DtoGEP1(entry, valoff, false, "aa.value");
+  llvm::BranchInst::Create(endbb, gIR->scopebb());
+
+  // an empty bucket ends the probe sequence => the key is not present
+  gIR->scope() = IRScope(emptybb);
+  if (insert) {
+    llvm::BranchInst::Create(slowbb, gIR->scopebb());
+  } else {
+    gIR->ir->CreateCondBr(gIR->ir->CreateICmpEQ(bucketHash, DtoConstSize_t(0)),
+                          endbb, slowbb);
+  }
+
+  // everything else => runtime
+  gIR->scope() = IRScope(slowbb);
+  LLValue *slow = DtoBitCast(callRuntime(), voidPtrTy);
+  llvm::BasicBlock *slowEndBB = gIR->scopebb();
+  llvm::BranchInst::Create(endbb, slowEndBB);
+
+  gIR->scope() = IRScope(endbb);
+  llvm::PHINode *result = gIR->ir->CreatePHI(voidPtrTy, 3, "aa.lookup");
+  result->addIncoming(hit, hitbb);
+  if (!insert) {
+    result->addIncoming(nullptr_, emptybb);
+  }
+  result->addIncoming(slow, slowEndBB);
+  return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
 DLValue *DtoAAIndex(Loc &loc, Type *type, DValue *aa, DValue *key,
                     bool lvalue) {
   // D2:
@@ -58,19 +201,31 @@ DLValue *DtoAAIndex(Loc &loc, Type *type, DValue *aa, DValue *key,
   pkey = DtoBitCast(pkey, funcTy->getParamType(lvalue ? 3 : 2));
 
   // call runtime
+  auto callRuntime = [&]() -> LLValue * {
+    if (lvalue) {
+      LLValue *rawAATI =
+          DtoTypeInfoOf(aa->type->unSharedOf()->mutableOf(), /*base=*/false);
+      LLValue *castedAATI = DtoBitCast(rawAATI, funcTy->getParamType(1));
+      LLValue *valsize = DtoConstSize_t(getTypeAllocSize(DtoType(type)));
+      // inserts (and allocates) the element if it doesn't exist
+      emitGCAllocSiteHook(loc, func);
+      return gIR
+          ->CreateCallOrInvoke(func, aaval, castedAATI, valsize, pkey,
+                               "aa.index")
+          .getInstruction();
+    }
+    LLValue *keyti = to_keyti(aa, funcTy->getParamType(1));
+    return gIR->CreateCallOrInvoke(func, aaval, keyti, pkey, "aa.index")
+        .getInstruction();
+  };
+
+  Type *keyType = static_cast<TypeAArray *>(aa->type->toBasetype())->index;
   LLValue *ret;
-  if (lvalue) {
-    LLValue *rawAATI =
-        DtoTypeInfoOf(aa->type->unSharedOf()->mutableOf(), /*base=*/false);
-    LLValue *castedAATI = DtoBitCast(rawAATI, funcTy->getParamType(1));
-    LLValue *valsize = DtoConstSize_t(getTypeAllocSize(DtoType(type)));
-    ret = gIR->CreateCallOrInvoke(func, aaval, castedAATI, valsize, pkey,
-                                  "aa.index")
-              .getInstruction();
+  if (canInlineAALookup(keyType)) {
+    LLValue *impl = lvalue ? DtoLoad(aaval) : aaval;
+    ret = DtoInlineAALookup(keyType, impl, pkey, lvalue, callRuntime);
   } else {
-    LLValue *keyti = to_keyti(aa, funcTy->getParamType(1));
-    ret = gIR->CreateCallOrInvoke(func, aaval, keyti, pkey, "aa.index")
-              .getInstruction();
+    ret = callRuntime();
   }
 
   // cast return value
@@ -134,8 +289,16 @@ DValue *DtoAAIn(Loc &loc, Type *type, DValue *aa, DValue *key) {
   pkey = DtoBitCast(pkey, getVoidPtrType());
 
   // call runtime
-  LLValue *ret = gIR->CreateCallOrInvoke(func, aaval, keyti, pkey, "aa.in")
-                     .getInstruction();
+  auto callRuntime = [&]() -> LLValue * {
+    return gIR->CreateCallOrInvoke(func, aaval, keyti, pkey, "aa.in")
+        .getInstruction();
+  };
+
+  Type *keyType = static_cast<TypeAArray *>(aa->type->toBasetype())->index;
+  LLValue *ret = canInlineAALookup(keyType)
+                     ? DtoInlineAALookup(keyType, aaval, pkey, false,
+                                         callRuntime)
+                     : callRuntime();
 
   // cast return value
   LLType *targettype = DtoType(type);
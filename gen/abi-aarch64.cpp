@@ -48,10 +48,28 @@ private:
                                       "ldc.internal.vararg.std.__va_list") == 0;
   }
 
+  // Homogeneous Short-Vector Aggregates of up to 4 64/128-bit vectors
+  // (5.3.2) are passed and returned in SIMD registers, like HFAs.
+  bool isShortVectorHVA(Type *t, llvm::Type **rewriteType = nullptr) {
+    if (t->ty != Tstruct)
+      return false;
+    llvm::Type *vectorArrayType = nullptr;
+    if (!isHVA(static_cast<TypeStruct *>(t), &vectorArrayType))
+      return false;
+    const auto vectorSize = getTypeAllocSize(
+        vectorArrayType->getArrayElementType());
+    if (vectorSize != 8 && vectorSize != 16)
+      return false;
+    if (rewriteType)
+      *rewriteType = vectorArrayType;
+    return true;
+  }
+
   bool passIndirectlyByValue(Type *t) {
     t = t->toBasetype();
-    return t->ty == Tsarray || (t->ty == Tstruct && t->size() > 16 &&
-                                !isHFA(static_cast<TypeStruct *>(t)));
+    return t->ty == Tsarray ||
+           (t->ty == Tstruct && t->size() > 16 &&
+            !isHFA(static_cast<TypeStruct *>(t)) && !isShortVectorHVA(t));
   }
 
 public:
@@ -101,6 +119,8 @@ public:
     else if (t->ty == Tstruct &&
              isHFA(static_cast<TypeStruct *>(t), &arg.ltype)) {
       hfaToArray.applyTo(arg, arg.ltype);
+    } else if (isShortVectorHVA(t, &arg.ltype)) {
+      hfaToArray.applyTo(arg, arg.ltype);
     } else {
       if (isReturnVal) {
         integerRewrite.applyTo(arg);
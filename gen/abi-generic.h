@@ -223,7 +223,7 @@ struct IndirectByvalRewrite : ABIRewrite {
 
 /**
  * Rewrite Homogeneous Homogeneous Floating-point Aggregate (HFA) as array of
- * float type.
+ * float type, or a Homogeneous Vector Aggregate (HVA) as array of vector type.
  */
 struct HFAToArray : ABIRewrite {
   const int maxFloats = 4;
@@ -244,9 +244,10 @@ struct HFAToArray : ABIRewrite {
   LLType *type(Type *t) override {
     assert(t->ty == Tstruct);
     LLType *floatArrayType = nullptr;
-    if (TargetABI::isHFA((TypeStruct *)t, &floatArrayType, maxFloats))
+    if (TargetABI::isHFA((TypeStruct *)t, &floatArrayType, maxFloats) ||
+        TargetABI::isHVA((TypeStruct *)t, &floatArrayType, maxFloats))
       return floatArrayType;
-    llvm_unreachable("Type t should be an HFA");
+    llvm_unreachable("Type t should be an HFA or HVA");
   }
 };
 
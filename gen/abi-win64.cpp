@@ -35,10 +35,31 @@ private:
   const bool isMSVC;
   IndirectByvalRewrite byvalRewrite;
   IntegerRewrite integerRewrite;
+  HFAToArray hfvaToArray;
 
   bool isX87(Type *t) const {
     return !isMSVC // 64-bit reals for MSVC targets
-           && (t->ty == Tfloat80 || t->ty == Timaginary80);
+           && !global.params.realIsDouble &&
+           (t->ty == Tfloat80 || t->ty == Timaginary80);
+  }
+
+  // For extern(D), homogeneous aggregates of up to 4 floats/doubles or vectors
+  // (HFAs/HVAs) are passed and returned in XMM registers, as enabled by the
+  // vector calling convention.
+  bool isVectorCallHFVA(TypeFunction *tf, Type *t) const {
+    if (tf->linkage != LINKd || t->ty != Tstruct ||
+        tf->parameterList.varargs == VarArg::variadic) {
+      return false;
+    }
+    const auto ts = static_cast<TypeStruct *>(t);
+    if (isHVA(ts))
+      return true;
+    LLType *floatArrayType = nullptr;
+    if (!isHFA(ts, &floatArrayType))
+      return false;
+    // no x87 reals
+    const auto floatType = floatArrayType->getArrayElementType();
+    return floatType->isFloatTy() || floatType->isDoubleTy();
   }
 
   bool passPointerToHiddenCopy(Type *t, bool isReturnValue, LINK linkage) const {
@@ -109,6 +130,9 @@ public:
 
     Type *rt = tf->next->toBasetype();
 
+    if (isVectorCallHFVA(tf, rt) && isPOD(rt))
+      return false;
+
     // for non-static member functions, MSVC++ enforces sret for all structs
     if (isMSVC && tf->linkage == LINKcpp && needsThis && rt->ty == Tstruct &&
         !isMagicCppStruct(rt)) {
@@ -169,7 +193,9 @@ public:
     Type *t = arg.type->toBasetype();
     LLType *originalLType = arg.ltype;
 
-    if (passPointerToHiddenCopy(t, isReturnValue, fty.type->linkage)) {
+    if (isVectorCallHFVA(fty.type, t) && (!isReturnValue || isPOD(t))) {
+      hfvaToArray.applyTo(arg);
+    } else if (passPointerToHiddenCopy(t, isReturnValue, fty.type->linkage)) {
       // the caller allocates a hidden copy and passes a pointer to that copy
       byvalRewrite.applyTo(arg);
     } else if (isAggregate(t) && canRewriteAsInt(t) && !isMagicCppStruct(t)) {
@@ -23,6 +23,11 @@
 // attribute to ensure no part of them ends up in registers when only a subset
 // of the desired registers are available.
 //
+// With -x86-64-d-aggregates-in-regs, extern(D) deviates from that: POD structs
+// and static arrays of up to 32 bytes are passed and returned as up to 4
+// eightbytes in registers, and aggregates are never forced into memory when
+// the remaining registers don't suffice.
+//
 //===----------------------------------------------------------------------===//
 
 #include "gen/abi-x86-64.h"
@@ -43,11 +48,19 @@
 #include "gen/logger.h"
 #include "gen/tollvm.h"
 #include "ir/irfunction.h"
+#include "llvm/Support/CommandLine.h"
 #include <cassert>
 #include <map>
 #include <string>
 #include <utility>
 
+static llvm::cl::opt<bool> dAggregatesInRegs(
+    "x86-64-d-aggregates-in-regs", llvm::cl::ZeroOrMore,
+    llvm::cl::desc("Pass and return POD aggregates of up to 32 bytes in "
+                   "registers for extern(D) functions on x86-64. Changes the "
+                   "ABI, so all D code (incl. druntime and Phobos) needs to be "
+                   "compiled with it, e.g., for whole-program LTO"));
+
 namespace {
 // Structs, static arrays and cfloats may be rewritten to exploit registers.
 // This function returns the rewritten type, or null if no transformation is
@@ -96,6 +109,105 @@ LLType *getAbiType(Type *ty) {
   return abiTy;
 }
 
+// Eightbyte classification for -x86-64-d-aggregates-in-regs.
+struct Eightbyte {
+  bool isInteger = false;
+  unsigned floatBytes = 0;
+  bool isDouble = false;
+};
+
+bool classifyEightbytes(Type *t, d_uns64 offset,
+                        llvm::SmallVectorImpl<Eightbyte> &eightbytes) {
+  t = t->toBasetype();
+  const d_uns64 size = t->size();
+  const auto markFloat = [&](d_uns64 floatOffset, unsigned floatSize) {
+    Eightbyte &eb = eightbytes[floatOffset / 8];
+    if ((floatOffset % 8) + floatSize > 8) {
+      eb.isInteger = true; // misaligned
+    } else {
+      eb.floatBytes += floatSize;
+      eb.isDouble = floatSize == 8;
+    }
+  };
+
+  switch (t->ty) {
+  case Tstruct: {
+    StructDeclaration *sd = static_cast<TypeStruct *>(t)->sym;
+    if (!sd->isPOD())
+      return false;
+    for (auto field : sd->fields) {
+      if (!classifyEightbytes(field->type, offset + field->offset, eightbytes))
+        return false;
+    }
+    return true;
+  }
+  case Tsarray: {
+    Type *elemType = t->nextOf();
+    const d_uns64 elemSize = elemType->size();
+    const auto dim = static_cast<TypeSArray *>(t)->dim->toUInteger();
+    for (uinteger_t i = 0; i < dim; ++i) {
+      if (!classifyEightbytes(elemType, offset + i * elemSize, eightbytes))
+        return false;
+    }
+    return true;
+  }
+  case Tfloat80:
+  case Timaginary80:
+    if (!global.params.realIsDouble)
+      return false;
+    // fallthrough
+  case Tfloat32:
+  case Timaginary32:
+  case Tfloat64:
+  case Timaginary64:
+    markFloat(offset, size);
+    return true;
+  case Tcomplex80:
+    if (!global.params.realIsDouble)
+      return false;
+    // fallthrough
+  case Tcomplex32:
+  case Tcomplex64:
+    markFloat(offset, size / 2);
+    markFloat(offset + size / 2, size / 2);
+    return true;
+  case Tvector:
+    return false;
+  default:
+    for (d_uns64 i = offset / 8; i <= (offset + size - 1) / 8; ++i)
+      eightbytes[i].isInteger = true;
+    return size > 0;
+  }
+}
+
+// Returns the type of up to 4 eightbytes a POD struct or static array of
+// 17-32 bytes is passed as for extern(D) with -x86-64-d-aggregates-in-regs, or
+// null if not applicable.
+LLType *getDAggregateAbiType(Type *ty) {
+  if (!(ty->ty == Tstruct || ty->ty == Tsarray))
+    return nullptr;
+  const d_uns64 size = ty->size();
+  if (size <= 16 || size > 32)
+    return nullptr;
+
+  llvm::SmallVector<Eightbyte, 4> eightbytes((size + 7) / 8);
+  if (!classifyEightbytes(ty, 0, eightbytes))
+    return nullptr;
+
+  auto &context = gIR->context();
+  llvm::SmallVector<LLType *, 4> parts;
+  for (const auto &eb : eightbytes) {
+    if (eb.isInteger || eb.floatBytes == 0) {
+      parts.push_back(LLType::getInt64Ty(context));
+    } else if (eb.isDouble) {
+      parts.push_back(LLType::getDoubleTy(context));
+    } else {
+      parts.push_back(llvm::VectorType::get(LLType::getFloatTy(context), 2));
+    }
+  }
+  return LLStructType::get(context, parts);
+}
+
 bool passByVal(Type *ty) {
   TypeTuple *argTypes = Target::toArgTypes(ty);
   if (!argTypes) {
@@ -216,8 +328,29 @@ struct ImplicitByvalRewrite : ABIRewrite {
   }
 };
 
+/**
+ * Same as X86_64_C_struct_rewrite, but for the eightbytes of larger extern(D)
+ * aggregates with -x86-64-d-aggregates-in-regs.
+ */
+struct X86_64_D_aggregate_rewrite : ABIRewrite {
+  LLValue *put(DValue *v, bool, bool) override {
+    LLValue *address = getAddressOf(v);
+    return loadFromMemory(address, type(v->type),
+                          ".X86_64_D_aggregate_rewrite_putResult");
+  }
+
+  LLValue *getLVal(Type *dty, LLValue *v) override {
+    return DtoAllocaDump(v, dty, ".X86_64_D_aggregate_rewrite_dump");
+  }
+
+  LLType *type(Type *t) override {
+    return getDAggregateAbiType(t->toBasetype());
+  }
+};
+
 struct X86_64TargetABI : TargetABI {
   X86_64_C_struct_rewrite struct_rewrite;
+  X86_64_D_aggregate_rewrite dAggregateRewrite;
   ImplicitByvalRewrite byvalRewrite;
   IndirectByvalRewrite indirectByvalRewrite;
 
@@ -241,6 +374,10 @@ struct X86_64TargetABI : TargetABI {
   const char *objcMsgSendFunc(Type *ret, IrFuncTy &fty) override;
 
 private:
+  static bool passDAggregatesInRegs(TypeFunction *tf) {
+    return dAggregatesInRegs && tf->linkage == LINKd;
+  }
+
   LLType *getValistType();
   RegCount &getRegCount(IrFuncTy &fty) {
     return reinterpret_cast<RegCount &>(fty.tag);
@@ -256,6 +393,9 @@ bool X86_64TargetABI::returnInArg(TypeFunction *tf, bool) {
   }
 
   Type *rt = tf->next->toBasetype();
+  if (passDAggregatesInRegs(tf) && getDAggregateAbiType(rt)) {
+    return false;
+  }
   return ::passByVal(rt);
 }
 
@@ -264,6 +404,9 @@ bool X86_64TargetABI::passByVal(TypeFunction *tf, Type *t) {
   if (tf->linkage == LINKcpp && !isPOD(t))
     return false;
 
+  if (passDAggregatesInRegs(tf) && getDAggregateAbiType(t->toBasetype()))
+    return false;
+
   return ::passByVal(t->toBasetype());
 }
 
@@ -286,6 +429,23 @@ void X86_64TargetABI::rewriteArgument(IrFuncTy &fty, IrFuncTyArg &arg,
     return;
   }
 
+  const bool dRegs = passDAggregatesInRegs(fty.type);
+  if (dRegs) {
+    if (LLType *dAbiTy = getDAggregateAbiType(t)) {
+      IF_LOG Logger::cout() << "Passing extern(D) aggregate in registers: "
+                            << t->toChars() << " (" << *dAbiTy << ")\n";
+      dAggregateRewrite.applyTo(arg, dAbiTy);
+      // LLVM passes the eightbytes not fitting into registers on the stack.
+      for (LLType *part : isaStruct(dAbiTy)->elements()) {
+        char &regs =
+            part->isIntegerTy() ? regCount.int_regs : regCount.sse_regs;
+        if (regs > 0)
+          --regs;
+      }
+      return;
+    }
+  }
+
   LLType *abiTy = getAbiType(t);
   if (abiTy && !LLTypeMemoryLayout::typesAreEquivalent(abiTy, originalLType)) {
     IF_LOG {
@@ -297,7 +457,8 @@ void X86_64TargetABI::rewriteArgument(IrFuncTy &fty, IrFuncTyArg &arg,
     struct_rewrite.applyTo(arg, abiTy);
   }
 
-  if (regCount.trySubtract(arg) == RegCount::ArgumentWouldFitInPartially) {
+  if (regCount.trySubtract(arg) == RegCount::ArgumentWouldFitInPartially &&
+      !dRegs) {
     // pass the LL struct with byval attribute to prevent LLVM from passing it
     // partially in registers, partially in memory
     assert(originalLType->isStructTy());
@@ -441,7 +602,7 @@ const char *X86_64TargetABI::objcMsgSendFunc(Type *ret,
   if (fty.arg_sret) {
     return "objc_msgSend_stret";
   }
-  if (ret) {
+  if (ret && !global.params.realIsDouble) {
     // complex long double return
     if (ret->ty == Tcomplex80) {
       return "objc_msgSend_fp2ret";
@@ -191,6 +191,75 @@ bool TargetABI::isHFA(TypeStruct *t, llvm::Type **rewriteType,
   return false;
 }
 
+namespace {
+bool isNestedHVA(const TypeStruct *t, Type *&vectorType, int &num,
+                 uinteger_t adim) {
+  // Used internally by isHVA() to check struct recursively for HVA-ness,
+  // analogous to isNestedHFA().  'vectorType' is the type of the first
+  // vector found.
+  VarDeclarations fields = t->sym->fields;
+
+  if (fields.dim == 0)
+    return false;
+
+  int n;
+  int maxn = num;
+
+  for (size_t i = 0; i < fields.dim; ++i) {
+    Type *field = fields[i]->type;
+
+    if (fields[i]->offset == 0)
+      n = num;
+
+    uinteger_t dim = adim;
+
+    if (field->ty == Tsarray) {
+      TypeSArray *array = (TypeSArray *)field;
+      if (array->dim->toUInteger() == 0)
+        return false;
+      field = array->nextOf();
+      dim *= array->dim->toUInteger();
+    }
+
+    if (field->ty == Tstruct) {
+      if (!isNestedHVA((TypeStruct *)field, vectorType, n, dim))
+        return false;
+    } else if (field->ty == Tvector) {
+      if (!vectorType)
+        vectorType = field;
+      else if (field->size() != vectorType->size())
+        return false; // different vector size, reject
+      n += dim;
+    } else {
+      return false; // reject all other types
+    }
+
+    if (n > maxn)
+      maxn = n;
+  }
+
+  num = maxn;
+  return true;
+}
+}
+
+bool TargetABI::isHVA(TypeStruct *t, llvm::Type **rewriteType,
+                      const int maxVectors) {
+  Type *vectorType = nullptr;
+  int num = 0;
+
+  if (!isNestedHVA(t, vectorType, num, 1) || num > maxVectors)
+    return false;
+
+  // reject padded structs (e.g., with explicit alignment)
+  if (t->size() != num * vectorType->size())
+    return false;
+
+  if (rewriteType)
+    *rewriteType = LLArrayType::get(DtoType(vectorType), num);
+  return true;
+}
+
 bool TargetABI::isAggregate(Type *t) {
   TY ty = t->toBasetype()->ty;
   // FIXME: dynamic arrays can currently not be rewritten as they are used
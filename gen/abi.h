@@ -182,6 +182,12 @@ struct TargetABI {
   /// produce the rewriteType: an array of that floating point type
   static bool isHFA(TypeStruct *t, llvm::Type **rewriteType = nullptr, const int maxFloats = 4);
 
+  /// Check if struct 't' is a Homogeneous Vector Aggregate (HVA) consisting
+  /// of up to 4 vectors of the same size.  If so, optionally produce the
+  /// rewriteType: an array of that vector type
+  static bool isHVA(TypeStruct *t, llvm::Type **rewriteType = nullptr,
+                    const int maxVectors = 4);
+
 protected:
 
   /// Returns true if the D type is an aggregate:
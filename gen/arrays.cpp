@@ -16,16 +16,25 @@
 #include "dmd/init.h"
 #include "dmd/module.h"
 #include "dmd/mtype.h"
+#include "dmd/template.h"
+#include "gen/abi.h"
+#include "gen/dcompute/target.h"
 #include "gen/dvalue.h"
 #include "gen/funcgenstate.h"
+#include "gen/gcallocsites.h"
 #include "gen/irstate.h"
 #include "gen/llvm.h"
 #include "gen/llvmhelpers.h"
 #include "gen/logger.h"
+#include "gen/optimizer.h"
+#include "gen/optremarks.h"
 #include "gen/runtime.h"
 #include "gen/tollvm.h"
 #include "ir/irfunction.h"
 #include "ir/irmodule.h"
+#include "ir/irtype.h"
+#include "llvm/IR/Intrinsics.h"
+#include "llvm/Support/CommandLine.h"
 
 static void DtoSetArray(DValue *array, LLValue *dim, LLValue *ptr);
 
@@ -196,6 +205,34 @@ static void copySlice(Loc &loc, LLValue *dstarr, LLValue *dstlen, LLValue *srcar
                       LLValue *srclen, size_t elementSize, bool knownInBounds) {
   const bool checksEnabled =
       global.params.useAssert == CHECKENABLEon || gIR->emitArrayBoundsChecks();
+#if LDC_LLVM_SUPPORTED_TARGET_SPIRV || LDC_LLVM_SUPPORTED_TARGET_NVPTX
+  if (checksEnabled && !knownInBounds && gIR->dcomputetarget) {
+    // druntime isn't available in device code, check the lengths and for
+    // overlap inline.
+    LLValue *size = computeSize(dstlen, elementSize);
+    LLValue *dstBegin = gIR->ir->CreatePtrToInt(dstarr, DtoSize_t());
+    LLValue *srcBegin = gIR->ir->CreatePtrToInt(srcarr, DtoSize_t());
+    LLValue *dstEnd = gIR->ir->CreateAdd(dstBegin, size);
+    LLValue *srcEnd = gIR->ir->CreateAdd(srcBegin, size);
+    LLValue *cond = gIR->ir->CreateAnd(
+        gIR->ir->CreateICmpEQ(dstlen, srclen),
+        gIR->ir->CreateOr(gIR->ir->CreateICmpULE(dstEnd, srcBegin),
+                          gIR->ir->CreateICmpULE(srcEnd, dstBegin)),
+        "slicecopy.cmp");
+
+    llvm::BasicBlock *okbb = gIR->insertBB("slicecopy.ok");
+    llvm::BasicBlock *failbb = gIR->insertBBAfter(okbb, "slicecopy.fail");
+    gIR->ir->CreateCondBr(cond, okbb, failbb);
+
+    gIR->scope() = IRScope(failbb);
+    DtoBoundsCheckFailCall(gIR, loc);
+
+    gIR->scope() = IRScope(okbb);
+    DtoMemCpy(dstarr, srcarr, size);
+    return;
+  }
+#endif
+
   if (checksEnabled && !knownInBounds) {
     LLValue *fn = getRuntimeFunction(loc, gIR->module, "_d_array_slice_copy");
     gIR->CreateCallOrInvoke(
@@ -212,8 +249,7 @@ static void copySlice(Loc &loc, LLValue *dstarr, LLValue *dstlen, LLValue *srcar
 
 ////////////////////////////////////////////////////////////////////////////////
 
-// Determine whether t is an array of structs that need a postblit.
-static bool arrayNeedsPostblit(Type *t) {
+bool arrayNeedsPostblit(Type *t) {
   t = DtoArrayElementType(t);
   if (t->ty == Tstruct) {
     return static_cast<TypeStruct *>(t)->sym->postblit != nullptr;
@@ -573,7 +609,56 @@ bool isConstLiteral(Expression *e, bool immutableType) {
 
 ////////////////////////////////////////////////////////////////////////////////
 
+namespace {
+template <typename T>
+llvm::Constant *buildIntegralArrayConstant(IRState *p, ArrayLiteralExp *ale) {
+  std::vector<T> vals;
+  vals.reserve(ale->elements->dim);
+  for (unsigned i = 0; i < ale->elements->dim; ++i) {
+    Expression *e = indexArrayLiteral(ale, i);
+    if (e->op != TOKint64)
+      return nullptr;
+    vals.push_back(static_cast<T>(e->toInteger()));
+  }
+  return llvm::ConstantDataArray::get(p->context(), vals);
+}
+
+/// Fast path for (possibly huge, e.g., CTFE-generated) literals of integral
+/// elements: builds the array constant directly from the raw values, without
+/// going through toConstElem() for each element. Returns null if not
+/// applicable.
+llvm::Constant *integralArrayLiteralToConst(IRState *p, ArrayLiteralExp *ale) {
+  if (ale->elements->dim == 0)
+    return nullptr;
+
+  Type *elemType = ale->type->toBasetype()->nextOf()->toBasetype();
+  switch (elemType->ty) {
+  case Tbool:
+  case Tint8:
+  case Tuns8:
+  case Tchar:
+    return buildIntegralArrayConstant<uint8_t>(p, ale);
+  case Tint16:
+  case Tuns16:
+  case Twchar:
+    return buildIntegralArrayConstant<uint16_t>(p, ale);
+  case Tint32:
+  case Tuns32:
+  case Tdchar:
+    return buildIntegralArrayConstant<uint32_t>(p, ale);
+  case Tint64:
+  case Tuns64:
+    return buildIntegralArrayConstant<uint64_t>(p, ale);
+  default:
+    return nullptr;
+  }
+}
+} // anonymous namespace
+
 llvm::Constant *arrayLiteralToConst(IRState *p, ArrayLiteralExp *ale) {
+  if (auto c = integralArrayLiteralToConst(p, ale))
+    return c;
+
   // Build the initializer. We have to take care as due to unions in the
   // element types (with different fields being initialized), we can end up
   // with different types for the initializer values. In this case, we
@@ -699,6 +784,7 @@ DSliceValue *DtoNewDynArray(Loc &loc, Type *arrayType, DValue *dim,
   LLValue *arrayLen = DtoRVal(dim);
 
   // call allocator
+  emitGCAllocSiteHook(loc, fn);
   LLValue *newArray =
       gIR->CreateCallOrInvoke(fn, arrayTypeInfo, arrayLen, ".gc_mem")
           .getInstruction();
@@ -707,11 +793,69 @@ DSliceValue *DtoNewDynArray(Loc &loc, Type *arrayType, DValue *dim,
 }
 
 ////////////////////////////////////////////////////////////////////////////////
+
+/// Allocates a 2-dimensional array as 2 GC blocks, one for the rows (slices)
+/// and one for all elements, instead of one block per row as
+/// _d_newarraym[i]TX does. The rows then point into the contiguous block.
+static DSliceValue *DtoNewContiguous2DArray(Loc &loc, Type *arrayType,
+                                           DValue *rowsVal, DValue *colsVal) {
+  Type *rowType = arrayType->toBasetype()->nextOf();
+  LLValue *rows = DtoRVal(rowsVal);
+  LLValue *cols = DtoRVal(colsVal);
+
+  // rows * cols, saturated so that the runtime throws an OutOfMemoryError on
+  // overflow
+  llvm::Function *umul = llvm::Intrinsic::getDeclaration(
+      &gIR->module, llvm::Intrinsic::umul_with_overflow, DtoSize_t());
+  LLValue *product = gIR->ir->CreateCall(umul, {rows, cols});
+  LLValue *numElements = gIR->ir->CreateSelect(
+      DtoExtractValue(product, 1),
+      llvm::ConstantInt::getAllOnesValue(DtoSize_t()),
+      DtoExtractValue(product, 0), ".numElements");
+  DImValue numElementsVal(Type::tsize_t, numElements);
+
+  DSliceValue *result = DtoNewDynArray(loc, arrayType, rowsVal, true);
+  DSliceValue *elements = DtoNewDynArray(loc, rowType, &numElementsVal, true);
+  LLValue *rowsPtr = result->getPtr();
+  LLValue *elementsPtr = elements->getPtr();
+
+  // create blocks
+  llvm::BasicBlock *condbb = gIR->insertBB("newarray.cond");
+  llvm::BasicBlock *bodybb = gIR->insertBBAfter(condbb, "newarray.body");
+  llvm::BasicBlock *endbb = gIR->insertBBAfter(bodybb, "newarray.end");
+
+  LLValue *itr = DtoAllocaDump(DtoConstSize_t(0), 0, "newarray.itr");
+  llvm::BranchInst::Create(condbb, gIR->scopebb());
+
+  gIR->scope() = IRScope(condbb);
+  LLValue *condVal =
+      gIR->ir->CreateICmpNE(DtoLoad(itr), rows, "newarray.condition");
+  llvm::BranchInst::Create(bodybb, endbb, condVal, gIR->scopebb());
+
+  // rows[i] = elements[i * cols .. (i + 1) * cols]
+  gIR->scope() = IRScope(bodybb);
+  LLValue *itrVal = DtoLoad(itr);
+  LLValue *rowPtr = DtoGEP1(
+      elementsPtr, gIR->ir->CreateMul(itrVal, cols, "", true, true), true);
+  DtoStore(DtoAggrPair(DtoType(rowType), cols, rowPtr),
+           DtoGEP1(rowsPtr, itrVal, true, "newarray.row"));
+  DtoStore(gIR->ir->CreateAdd(itrVal, DtoConstSize_t(1), "newarray.new_itr"),
+           itr);
+  llvm::BranchInst::Create(condbb, gIR->scopebb());
+
+  gIR->scope() = IRScope(endbb);
+  return result;
+}
+
 DSliceValue *DtoNewMulDimDynArray(Loc &loc, Type *arrayType, DValue **dims,
                                   size_t ndims) {
   IF_LOG Logger::println("DtoNewMulDimDynArray : %s", arrayType->toChars());
   LOG_SCOPE;
 
+  if (ndims == 2) {
+    return DtoNewContiguous2DArray(loc, arrayType, dims[0], dims[1]);
+  }
+
   // get value type
   Type *vtype = arrayType->toBasetype();
   for (size_t i = 0; i < ndims; ++i) {
@@ -766,6 +910,7 @@ DSliceValue *DtoNewMulDimDynArray(Loc &loc, Type *arrayType, DValue **dims,
            DtoGEPi(darray, 0, 1, ".ptr"));
 
   // call allocator
+  emitGCAllocSiteHook(loc, fn);
   LLValue *newptr =
       gIR->CreateCallOrInvoke(fn, arrayTypeInfo, DtoLoad(darray), ".gc_mem")
           .getInstruction();
@@ -795,6 +940,7 @@ DSliceValue *DtoResizeDynArray(Loc &loc, Type *arrayType, DValue *array,
       getRuntimeFunction(loc, gIR->module, zeroInit ? "_d_arraysetlengthT"
                                                     : "_d_arraysetlengthiT");
 
+  emitGCAllocSiteHook(loc, fn);
   LLValue *newArray =
       gIR->CreateCallOrInvoke(
              fn, DtoTypeInfoOf(arrayType), newdim,
@@ -819,16 +965,22 @@ void DtoCatAssignElement(Loc &loc, DValue *array, Expression *exp) {
   DValue *expVal = toElem(exp);
 
   // The druntime function extends the slice in-place (length += 1, ptr
-  // potentially moved to a new block).
+  // potentially moved to a new block) and returns it.
   LLFunction *fn = getRuntimeFunction(loc, gIR->module, "_d_arrayappendcTX");
-  gIR->CreateCallOrInvoke(
-      fn, DtoTypeInfoOf(arrayType),
-      DtoBitCast(DtoLVal(array), fn->getFunctionType()->getParamType(1)),
-      DtoConstSize_t(1), ".appendedArray");
-
-  // Assign to the new last element.
-  LLValue *newLength = DtoArrayLen(array);
-  LLValue *ptr = DtoArrayPtr(array);
+  emitGCAllocSiteHook(loc, fn);
+  LLValue *appendedArray =
+      gIR->CreateCallOrInvoke(
+             fn, DtoTypeInfoOf(arrayType),
+             DtoBitCast(DtoLVal(array), fn->getFunctionType()->getParamType(1)),
+             DtoConstSize_t(1), ".appendedArray")
+          .getInstruction();
+
+  // Assign to the new last element. Use the returned slice instead of
+  // reloading it from memory, so that its pointer and length are known to the
+  // optimizer (e.g., for consecutive appends in a loop).
+  LLValue *newLength = DtoExtractValue(appendedArray, 0, ".newLength");
+  LLValue *ptr = DtoBitCast(DtoExtractValue(appendedArray, 1),
+                            DtoPtrToType(arrayType->nextOf()));
   LLValue *lastIndex =
       gIR->ir->CreateSub(newLength, DtoConstSize_t(1), ".lastIndex");
   LLValue *lastElemPtr = DtoGEP1(ptr, lastIndex, true, ".lastElem");
@@ -846,6 +998,7 @@ DSliceValue *DtoCatAssignArray(Loc &loc, DValue *arr, Expression *exp) {
 
   LLFunction *fn = getRuntimeFunction(loc, gIR->module, "_d_arrayappendT");
   // Call _d_arrayappendT(TypeInfo ti, byte[] *px, byte[] y)
+  emitGCAllocSiteHook(loc, fn);
   LLValue *newArray =
       gIR->CreateCallOrInvoke(
              fn, DtoTypeInfoOf(arrayType),
@@ -923,6 +1076,7 @@ DSliceValue *DtoCatArrays(Loc &loc, Type *arrayType, Expression *exp1,
     args.push_back(val);
   }
 
+  emitGCAllocSiteHook(loc, fn);
   auto newArray =
       gIR->CreateCallOrInvoke(fn, args, ".appendedArray").getInstruction();
   return getSlice(arrayType, newArray);
@@ -938,6 +1092,7 @@ DSliceValue *DtoAppendDChar(Loc &loc, DValue *arr, Expression *exp,
   LLFunction *fn = getRuntimeFunction(loc, gIR->module, func);
 
   // Call function (ref string x, dchar c)
+  emitGCAllocSiteHook(loc, fn);
   LLValue *newArray =
       gIR->CreateCallOrInvoke(
              fn,
@@ -1009,11 +1164,23 @@ bool validCompareWithMemcmpType(Type *t) {
     return validCompareWithMemcmpType(elemType);
   }
 
-  case Tstruct:
-    // TODO: Implement when structs can be compared with memcmp. Remember that
-    // structs can have a user-defined opEquals, alignment padding bytes (in
-    // arrays), and padding bytes.
-    return false;
+  case Tstruct: {
+    // Structs without an xopEquals are compared bitwise by TypeInfo_Struct
+    // too. Only accept them if all fields are memcmp-comparable themselves and
+    // there are no padding bytes (and no overlapping union fields).
+    StructDeclaration *sd = static_cast<TypeStruct *>(t)->sym;
+    if (sd->sizeok != SIZEOKdone || sd->xeq || sd->fields.dim == 0)
+      return false;
+    d_uns64 offset = 0;
+    for (VarDeclaration *field : sd->fields) {
+      if (field->offset != offset ||
+          !validCompareWithMemcmpType(field->type->toBasetype())) {
+        return false;
+      }
+      offset += field->type->size();
+    }
+    return offset == sd->structsize;
+  }
 
   case Tvoid:
   case Tint8:
@@ -1078,7 +1245,10 @@ llvm::CallInst *callMemcmp(Loc &loc, IRState &irs, LLValue *l_ptr,
   // Call memcmp.
   LLValue *args[] = {DtoBitCast(l_ptr, getVoidPtrType()),
                      DtoBitCast(r_ptr, getVoidPtrType()), sizeInBytes};
-  return irs.ir->CreateCall(fn, args);
+  auto call = irs.ir->CreateCall(fn, args);
+  // PGO: profile the compared sizes, typically dominated by a few short ones.
+  irs.funcGen().pgo.emitMemOpSizePGO(call, sizeInBytes);
+  return call;
 }
 
 /// Compare `l` and `r` using memcmp. No checks are done for validity.
@@ -1154,6 +1324,398 @@ LLValue *DtoArrayEquals(Loc &loc, TOK op, DValue *l, DValue *r) {
   return res;
 }
 
+////////////////////////////////////////////////////////////////////////////////
+
+static llvm::cl::opt<bool> lowerArrayOps(
+    "lower-array-ops", llvm::cl::ZeroOrMore, llvm::cl::Hidden,
+    llvm::cl::init(true),
+    llvm::cl::desc("Emit array operations on basic numeric types as "
+                   "vectorizable loops instead of calling druntime"));
+
+namespace {
+// Returns the `core.internal.arrayop.arrayOp` template instance fd belongs to,
+// or null.
+TemplateInstance *getArrayOpInstance(FuncDeclaration *fd) {
+  TemplateInstance *ti =
+      fd->parent ? fd->parent->isTemplateInstance() : nullptr;
+  if (!ti || !ti->tempdecl || !ti->tiargs ||
+      strcmp(ti->tempdecl->ident->toChars(), "arrayOp") != 0) {
+    return nullptr;
+  }
+  Module *m = ti->tempdecl->getModule();
+  if (!m || strcmp(m->toPrettyChars(), "core.internal.arrayop") != 0)
+    return nullptr;
+  return ti;
+}
+
+bool isArrayOpBinaryOp(char op) { return op && strchr("+-*/%&|^", op); }
+
+LLValue *emitArrayOpBinary(char op, LLValue *lhs, LLValue *rhs, bool isFloat,
+                           bool isUnsigned) {
+  auto &b = *gIR->ir;
+  switch (op) {
+  case '+':
+    return isFloat ? b.CreateFAdd(lhs, rhs) : b.CreateAdd(lhs, rhs);
+  case '-':
+    return isFloat ? b.CreateFSub(lhs, rhs) : b.CreateSub(lhs, rhs);
+  case '*':
+    return isFloat ? b.CreateFMul(lhs, rhs) : b.CreateMul(lhs, rhs);
+  case '/':
+    if (isFloat)
+      return b.CreateFDiv(lhs, rhs);
+    return isUnsigned ? b.CreateUDiv(lhs, rhs) : b.CreateSDiv(lhs, rhs);
+  case '%':
+    if (isFloat)
+      return b.CreateFRem(lhs, rhs);
+    return isUnsigned ? b.CreateURem(lhs, rhs) : b.CreateSRem(lhs, rhs);
+  case '&':
+    return b.CreateAnd(lhs, rhs);
+  case '|':
+    return b.CreateOr(lhs, rhs);
+  case '^':
+    return b.CreateXor(lhs, rhs);
+  default:
+    llvm_unreachable("Unexpected array operation.");
+  }
+}
+
+// Applies an array operation to complex operands, using the plain formula
+// for multiplications, which (SLP-)vectorizes well.
+LLValue *emitComplexArrayOpBinary(char op, LLValue *lhs, LLValue *rhs) {
+  auto &b = *gIR->ir;
+  LLValue *lre = b.CreateExtractValue(lhs, 0);
+  LLValue *lim = b.CreateExtractValue(lhs, 1);
+  LLValue *rre = b.CreateExtractValue(rhs, 0);
+  LLValue *rim = b.CreateExtractValue(rhs, 1);
+  LLValue *re, *im;
+  if (op == '*') {
+    re = b.CreateFSub(b.CreateFMul(lre, rre), b.CreateFMul(lim, rim));
+    im = b.CreateFAdd(b.CreateFMul(lre, rim), b.CreateFMul(lim, rre));
+  } else {
+    re = emitArrayOpBinary(op, lre, rre, true, false);
+    im = emitArrayOpBinary(op, lim, rim, true, false);
+  }
+  return DtoAggrPair(lhs->getType(), re, im);
+}
+
+// Returns a loop ID forcing vectorization (incl. runtime alias checks and a
+// scalar remainder loop), independent of the cost model.
+llvm::MDNode *createVectorizeLoopID() {
+  auto &ctx = gIR->context();
+  llvm::Metadata *enable[] = {
+      llvm::MDString::get(ctx, "llvm.loop.vectorize.enable"),
+      llvm::ConstantAsMetadata::get(llvm::ConstantInt::getTrue(ctx))};
+  auto self = llvm::MDNode::getTemporary(ctx, llvm::None);
+  llvm::Metadata *ops[] = {self.get(), llvm::MDNode::get(ctx, enable)};
+  llvm::MDNode *loopID = llvm::MDNode::getDistinct(ctx, ops);
+  loopID->replaceOperandWith(0, loopID);
+  return loopID;
+}
+}
+
+DValue *DtoArrayOp(Loc &loc, Type *type, FuncDeclaration *fd,
+                   Expressions *args) {
+  if (!lowerArrayOps || !args || args->dim == 0)
+    return nullptr;
+  TemplateInstance *ti = getArrayOpInstance(fd);
+  if (!ti)
+    return nullptr;
+
+  // The template arguments encode the operation in reverse polish notation,
+  // starting with the result slice (an operand too) and ending with the
+  // assignment, e.g., `float[], float[], float[], "*", float, "+", "="`.
+  Objects &tiargs = *ti->tiargs;
+  Type *resType = tiargs.dim >= 3 ? isType(tiargs[0]) : nullptr;
+  if (!resType || resType->toBasetype()->ty != Tarray)
+    return nullptr;
+  Type *elemType = resType->toBasetype()->nextOf()->toBasetype();
+  if (!((elemType->isintegral() && elemType->ty != Tbool) ||
+        elemType->isreal() || elemType->iscomplex())) {
+    return nullptr;
+  }
+  const bool isFloat = elemType->isfloating();
+  const bool isUnsigned = elemType->isunsigned();
+  // Complex numbers are only added, subtracted and multiplied.
+  const bool isComplex = elemType->iscomplex();
+  const char *invalidOps = isComplex ? "/%&|^" : isFloat ? "&|^" : "";
+
+  llvm::SmallVector<const char *, 8> ops; // null for operands
+  size_t stackSize = 1, numOperands = 1;
+  for (size_t i = 1; i < tiargs.dim; ++i) {
+    if (Type *t = isType(tiargs[i])) {
+      t = t->toBasetype();
+      if (t->ty == Tarray || t->ty == Tsarray)
+        t = t->nextOf()->toBasetype();
+      if (t->ty != elemType->ty)
+        return nullptr;
+      ops.push_back(nullptr);
+      ++stackSize;
+      ++numOperands;
+      continue;
+    }
+
+    Expression *e = isExpression(tiargs[i]);
+    if (!e || e->op != TOKstring)
+      return nullptr;
+    const char *op = static_cast<StringExp *>(e)->toStringz();
+    if (i == tiargs.dim - 1) { // `=` or `op=`
+      const bool isAssign =
+          (op[0] == '=' && !op[1]) ||
+          (isArrayOpBinaryOp(op[0]) && op[1] == '=' && !op[2]);
+      if (!isAssign || stackSize != 2 || strchr(invalidOps, op[0]))
+        return nullptr;
+    } else if (op[0] == 'u' && (op[1] == '-' || op[1] == '~') && !op[2]) {
+      if (stackSize < 2 || (isFloat && op[1] == '~'))
+        return nullptr;
+    } else if (isArrayOpBinaryOp(op[0]) && !op[1]) {
+      if (stackSize < 3 || strchr(invalidOps, op[0]))
+        return nullptr;
+      --stackSize;
+    } else {
+      return nullptr; // e.g., `^^`
+    }
+    ops.push_back(op);
+  }
+  if (numOperands != args->dim)
+    return nullptr;
+
+  IF_LOG Logger::println("DtoArrayOp: %s", fd->toPrettyChars());
+  LOG_SCOPE;
+
+  // Evaluate the arguments; scalars are hoisted out of the loop this way.
+  llvm::SmallVector<LLValue *, 8> argValues;
+  llvm::SmallVector<bool, 8> isArrayArg;
+  LLValue *length = nullptr;
+  for (size_t i = 0; i < args->dim; ++i) {
+    Expression *arg = (*args)[i];
+    DValue *v = toElem(arg);
+    const TY ty = arg->type->toBasetype()->ty;
+    const bool isArray = ty == Tarray || ty == Tsarray;
+    if (isArray) {
+      if (ty == Tsarray && !v->isLVal())
+        v = new DLValue(arg->type, makeLValue(loc, v));
+      if (i == 0)
+        length = DtoArrayLen(v);
+      argValues.push_back(DtoArrayPtr(v));
+    } else {
+      argValues.push_back(DtoRVal(v));
+    }
+    isArrayArg.push_back(isArray);
+  }
+  assert(length && "result of array operation is not a slice");
+
+  // Small integers are promoted to int, like in the druntime implementation.
+  LLType *elemLLType = DtoType(elemType);
+  LLType *calcType = !isFloat && getTypeBitSize(elemLLType) < 32
+                         ? LLType::getInt32Ty(gIR->context())
+                         : elemLLType;
+  auto promote = [&](LLValue *v) -> LLValue * {
+    if (v->getType() == calcType || isComplex)
+      return v;
+    return isUnsigned ? gIR->ir->CreateZExt(v, calcType)
+                      : gIR->ir->CreateSExt(v, calcType);
+  };
+
+  auto binary = [&](char op, LLValue *lhs, LLValue *rhs) {
+    return isComplex ? emitComplexArrayOpBinary(op, lhs, rhs)
+                     : emitArrayOpBinary(op, lhs, rhs, isFloat, isUnsigned);
+  };
+
+  // create blocks
+  llvm::BasicBlock *condbb = gIR->insertBB("arrayop.cond");
+  llvm::BasicBlock *bodybb = gIR->insertBBAfter(condbb, "arrayop.body");
+  llvm::BasicBlock *endbb = gIR->insertBBAfter(bodybb, "arrayop.end");
+
+  LLValue *itr = DtoAllocaDump(DtoConstSize_t(0), 0, "arrayop.itr");
+  assert(!gIR->scopereturned());
+  llvm::BranchInst::Create(condbb, gIR->scopebb());
+
+  gIR->scope() = IRScope(condbb);
+  LLValue *cond = gIR->ir->CreateICmpULT(DtoLoad(itr), length, "arrayop.cond");
+  llvm::BranchInst::Create(bodybb, endbb, cond, gIR->scopebb());
+
+  gIR->scope() = IRScope(bodybb);
+  LLValue *itrVal = DtoLoad(itr);
+  auto loadOperand = [&](size_t i) {
+    return promote(isArrayArg[i]
+                       ? DtoLoad(DtoGEP1(argValues[i], itrVal, true))
+                       : argValues[i]);
+  };
+
+  llvm::SmallVector<LLValue *, 8> stack;
+  size_t nextArg = 1;
+  for (size_t i = 0; i + 1 < ops.size(); ++i) {
+    const char *op = ops[i];
+    if (!op) {
+      stack.push_back(loadOperand(nextArg++));
+    } else if (op[0] == 'u') {
+      LLValue *v = stack.pop_back_val();
+      if (isComplex) {
+        v = DtoAggrPair(
+            v->getType(),
+            gIR->ir->CreateFNeg(gIR->ir->CreateExtractValue(v, 0)),
+            gIR->ir->CreateFNeg(gIR->ir->CreateExtractValue(v, 1)));
+      } else {
+        v = op[1] == '~' ? gIR->ir->CreateNot(v)
+                         : isFloat ? gIR->ir->CreateFNeg(v)
+                                   : gIR->ir->CreateNeg(v);
+      }
+      stack.push_back(v);
+    } else {
+      LLValue *rhs = stack.pop_back_val();
+      LLValue *lhs = stack.pop_back_val();
+      stack.push_back(binary(op[0], lhs, rhs));
+    }
+  }
+  assert(stack.size() == 1);
+
+  LLValue *resElem = DtoGEP1(argValues[0], itrVal, true, "arrayop.res");
+  LLValue *value = stack.back();
+  const char *assignOp = ops.back();
+  if (assignOp[0] != '=')
+    value = binary(assignOp[0], promote(DtoLoad(resElem)), value);
+  if (value->getType() != elemLLType)
+    value = gIR->ir->CreateTrunc(value, elemLLType);
+  DtoStore(value, resElem);
+
+  DtoStore(gIR->ir->CreateAdd(itrVal, DtoConstSize_t(1), "arrayop.next_itr"),
+           itr);
+  llvm::BranchInst *latch = llvm::BranchInst::Create(condbb, gIR->scopebb());
+  latch->setMetadata(llvm::LLVMContext::MD_loop, createVectorizeLoopID());
+
+  gIR->scope() = IRScope(endbb);
+
+  return new DSliceValue(type, length, argValues[0]);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static llvm::cl::opt<bool> lowerStringForeach(
+    "lower-string-foreach", llvm::cl::ZeroOrMore, llvm::cl::Hidden,
+    llvm::cl::init(true),
+    llvm::cl::desc("Decode ASCII/BMP code units of foreach loops over strings "
+                   "inline when optimizing"));
+
+DValue *DtoInlineStringApply(Loc &loc, Type *type, FuncDeclaration *fd,
+                             Expressions *args) {
+  if (!lowerStringForeach || !isOptimizationEnabled() || !args ||
+      args->dim != 2 || fd->fbody || fd->linkage != LINKc) {
+    return nullptr;
+  }
+
+  const llvm::StringRef name = fd->ident->toChars();
+  unsigned codeUnitSize;
+  if (name == "_aApplycd1" || name == "_aApplyRcd1") {
+    codeUnitSize = 1;
+  } else if (name == "_aApplywd1" || name == "_aApplyRwd1") {
+    codeUnitSize = 2;
+  } else {
+    return nullptr;
+  }
+  const bool reverse = name[7] == 'R';
+
+  // The loop body is called with the D ABI of its `int delegate(void*)` type,
+  // just like druntime does (e.g., the context is passed in a register on
+  // 32-bit x86). Bail out for ABIs rewriting the argument or return value.
+  Type *dgDType = stripModifiers((*args)[1]->type->toBasetype());
+  if (dgDType->ty != Tdelegate) {
+    return nullptr;
+  }
+  DtoType(dgDType);
+  IrFuncTy &dgIrFty = dgDType->ctype->getIrFuncTy();
+  auto dgTf = static_cast<TypeFunction *>(dgDType->nextOf()->toBasetype());
+  if (dgIrFty.arg_sret || !dgIrFty.arg_nest || dgIrFty.args.size() != 1 ||
+      dgIrFty.args[0]->rewrite || (dgIrFty.ret && dgIrFty.ret->rewrite)) {
+    return nullptr;
+  }
+
+  IF_LOG Logger::println("DtoInlineStringApply: %s", name.str().c_str());
+  LOG_SCOPE;
+
+  LLFunction *fn = getRuntimeFunction(loc, gIR->module, name.data());
+  LLType *strType = fn->getFunctionType()->getParamType(0);
+  LLType *dgType = fn->getFunctionType()->getParamType(1);
+
+  DValue *str = toElem((*args)[0]);
+  LLValue *length = DtoArrayLen(str);
+  LLValue *ptr = DtoArrayPtr(str);
+  LLValue *dg = DtoAggrPaint(DtoRVal(toElem((*args)[1])), dgType);
+  LLValue *dgContext = gIR->ir->CreateExtractValue(dg, 0, ".context");
+  LLValue *dgFuncPtr = gIR->ir->CreateExtractValue(dg, 1, ".funcptr");
+
+  LLType *resultType = DtoType(type);
+  LLValue *result = DtoAllocaDump(DtoConstInt(0), 0, "strapply.result");
+  LLValue *itr =
+      DtoAllocaDump(reverse ? length : DtoConstSize_t(0), 0, "strapply.itr");
+  LLType *dcharType = LLType::getInt32Ty(gIR->context());
+  LLValue *dchar = DtoRawAlloca(dcharType, 0, "strapply.dchar");
+
+  // The loop passes code units which are code points on their own (ASCII
+  // resp. non-surrogate UTF-16) to the delegate directly; the rest of the
+  // string is handed over to druntime at the first multi-unit sequence.
+  llvm::BasicBlock *condbb = gIR->insertBB("strapply.cond");
+  llvm::BasicBlock *loadbb = gIR->insertBBAfter(condbb, "strapply.load");
+  llvm::BasicBlock *bodybb = gIR->insertBBAfter(loadbb, "strapply.body");
+  llvm::BasicBlock *slowbb = gIR->insertBBAfter(bodybb, "strapply.decode");
+  llvm::BasicBlock *endbb = gIR->insertBBAfter(slowbb, "strapply.end");
+
+  assert(!gIR->scopereturned());
+  llvm::BranchInst::Create(condbb, gIR->scopebb());
+
+  gIR->scope() = IRScope(condbb);
+  LLValue *itrVal = DtoLoad(itr);
+  LLValue *cond = reverse
+                      ? gIR->ir->CreateICmpNE(itrVal, DtoConstSize_t(0))
+                      : gIR->ir->CreateICmpULT(itrVal, length);
+  llvm::BranchInst::Create(loadbb, endbb, cond, gIR->scopebb());
+
+  gIR->scope() = IRScope(loadbb);
+  LLValue *unitIndex =
+      reverse ? gIR->ir->CreateSub(itrVal, DtoConstSize_t(1)) : itrVal;
+  LLValue *unit = DtoLoad(DtoGEP1(ptr, unitIndex, true));
+  LLValue *isCodePoint =
+      codeUnitSize == 1
+          ? gIR->ir->CreateICmpULT(unit, LLConstantInt::get(unit->getType(),
+                                                            0x80))
+          : gIR->ir->CreateICmpUGE(
+                gIR->ir->CreateSub(unit,
+                                   LLConstantInt::get(unit->getType(), 0xD800)),
+                LLConstantInt::get(unit->getType(), 0x800));
+  llvm::BranchInst::Create(bodybb, slowbb, isCodePoint, gIR->scopebb());
+
+  gIR->scope() = IRScope(bodybb);
+  DtoStore(gIR->ir->CreateZExt(unit, dcharType), dchar);
+  llvm::FunctionType *dgFuncType = dgIrFty.funcType;
+  llvm::CallSite dgCall = gIR->CreateCallOrInvoke(
+      DtoBitCast(dgFuncPtr, getPtrToType(dgFuncType)),
+      DtoBitCast(dgContext, dgFuncType->getParamType(0)),
+      DtoBitCast(dchar, dgFuncType->getParamType(1)));
+  dgCall.setCallingConv(gABI->callingConv(dgTf->linkage, dgTf));
+  AttrSet dgCallAttrs(dgCall.getAttributes());
+  dgCallAttrs.merge(dgIrFty.getParamAttrs(gABI->passThisBeforeSret(dgTf)));
+  dgCall.setAttributes(dgCallAttrs);
+  LLValue *dgResult = dgCall.getInstruction();
+  DtoStore(dgResult, result);
+  DtoStore(reverse ? unitIndex : gIR->ir->CreateAdd(itrVal, DtoConstSize_t(1)),
+           itr);
+  LLValue *proceed = gIR->ir->CreateICmpEQ(dgResult, DtoConstInt(0));
+  llvm::BranchInst::Create(condbb, endbb, proceed, gIR->scopebb());
+
+  gIR->scope() = IRScope(slowbb);
+  LLType *strPtrType = strType->getContainedType(1);
+  LLValue *rest =
+      reverse ? DtoAggrPair(strType, itrVal, DtoBitCast(ptr, strPtrType))
+              : DtoAggrPair(strType, gIR->ir->CreateSub(length, itrVal),
+                            DtoBitCast(DtoGEP1(ptr, itrVal, true), strPtrType));
+  LLValue *rtResult = gIR->CreateCallOrInvoke(fn, rest, dg).getInstruction();
+  DtoStore(gIR->ir->CreateTrunc(rtResult, resultType), result);
+  llvm::BranchInst::Create(endbb, gIR->scopebb());
+
+  gIR->scope() = IRScope(endbb);
+
+  return new DImValue(type, DtoLoad(result));
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 LLValue *DtoArrayCastLength(Loc &loc, LLValue *len, LLType *elemty,
                             LLType *newelemty) {
@@ -1356,6 +1918,13 @@ void DtoIndexBoundsCheck(Loc &loc, DValue *arr, DValue *index) {
   llvm::ICmpInst::Predicate cmpop = llvm::ICmpInst::ICMP_ULT;
   llvm::Value *cond = gIR->ir->CreateICmp(cmpop, DtoRVal(index),
                                           DtoArrayLen(arr), "bounds.cmp");
+  if (areCodegenRemarksEnabled()) {
+    if (auto cmp = llvm::dyn_cast<llvm::Instruction>(cond)) {
+      addCodegenRemark("BoundsCheck", cmp,
+                       llvm::Twine("bounds check for indexing `") +
+                           arr->type->toChars() + "`");
+    }
+  }
 
   llvm::BasicBlock *okbb = gIR->insertBB("bounds.ok");
   llvm::BasicBlock *failbb = gIR->insertBBAfter(okbb, "bounds.fail");
@@ -1370,6 +1939,13 @@ void DtoIndexBoundsCheck(Loc &loc, DValue *arr, DValue *index) {
 }
 
 void DtoBoundsCheckFailCall(IRState *irs, Loc &loc) {
+#if LDC_LLVM_SUPPORTED_TARGET_SPIRV || LDC_LLVM_SUPPORTED_TARGET_NVPTX
+  if (irs->dcomputetarget) {
+    irs->dcomputetarget->emitBoundsCheckFailure(loc);
+    return;
+  }
+#endif
+
   Module *const module = irs->func()->decl->getModule();
 
   if (global.params.checkAction == CHECKACTION_C) {
@@ -1377,8 +1953,8 @@ void DtoBoundsCheckFailCall(IRState *irs, Loc &loc) {
   } else {
     llvm::Function *errorfn =
         getRuntimeFunction(loc, irs->module, "_d_arraybounds");
-    irs->CreateCallOrInvoke(errorfn, DtoModuleFileName(module, loc),
-                            DtoConstUint(loc.linnum));
+    DtoFailureCall(errorfn,
+                   {DtoModuleFileName(module, loc), DtoConstUint(loc.linnum)});
 
     // the function does not return
     irs->ir->CreateUnreachable();
@@ -13,6 +13,7 @@
 
 #pragma once
 
+#include "dmd/arraytypes.h"
 #include "dmd/tokens.h"
 #include "gen/llvm.h"
 
@@ -21,6 +22,7 @@ class ArrayLiteralExp;
 class DSliceValue;
 class DValue;
 class Expression;
+class FuncDeclaration;
 struct IRState;
 struct Loc;
 class Type;
@@ -54,6 +56,9 @@ llvm::Constant *arrayLiteralToConst(IRState *p, ArrayLiteralExp *ale);
 /// dstMem is expected to be a pointer to the array allocation.
 void initializeArrayLiteral(IRState *p, ArrayLiteralExp *ale, LLValue *dstMem);
 
+/// Determines whether t is an array of structs that need a postblit.
+bool arrayNeedsPostblit(Type *t);
+
 void DtoArrayAssign(Loc &loc, DValue *lhs, DValue *rhs, int op,
                     bool canSkipPostblit);
 void DtoSetArrayToNull(LLValue *v);
@@ -74,6 +79,23 @@ DSliceValue *DtoAppendDCharToUnicodeString(Loc &loc, DValue *arr,
 
 LLValue *DtoArrayEquals(Loc &loc, TOK op, DValue *l, DValue *r);
 
+/// Emits a call of the druntime array operation template instance fd (a
+/// lowered `a[] = b[] * c[] + d` etc.) directly as a loop annotated for the
+/// loop vectorizer, if all operands are of the same basic numeric type (or
+/// complex type, for additions, subtractions and multiplications).
+/// Returns null if the regular call needs to be emitted instead.
+DValue *DtoArrayOp(Loc &loc, Type *type, FuncDeclaration *fd,
+                   Expressions *args);
+
+/// Emits a call of the druntime hook fd of a `foreach (dchar c; str)` loop
+/// over a char[]/wchar[] (`_aApplycd1` etc.) as a loop passing the single-unit
+/// code points to the loop body delegate directly, which the inliner can then
+/// fold into the loop. Strings are only handed over to druntime from their
+/// first multi-unit sequence on. Returns null if the regular call needs to be
+/// emitted instead.
+DValue *DtoInlineStringApply(Loc &loc, Type *type, FuncDeclaration *fd,
+                             Expressions *args);
+
 LLValue *DtoDynArrayIs(TOK op, DValue *l, DValue *r);
 
 LLValue *DtoArrayCastLength(Loc &loc, LLValue *len, LLType *elemty,
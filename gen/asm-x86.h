@@ -2051,6 +2051,9 @@ struct AsmProcessor {
   Identifier *opIdent;
   Operand *operand;
 
+  // set if the instruction being formatted refers to the stack/frame pointer
+  bool usesStackFrameReg;
+
   AsmProcessor(Scope *sc, InlineAsmStatement *stmt) {
     this->sc = sc;
     this->stmt = stmt;
@@ -2493,7 +2496,54 @@ struct AsmProcessor {
     return Opr_Invalid;
   }
 
-  void writeReg(Reg reg) { insnTemplate << "%" << regInfo[reg].gccName; }
+  void writeReg(Reg reg) {
+    if (isStackFrameReg(reg)) {
+      usesStackFrameReg = true;
+    }
+    insnTemplate << "%" << regInfo[reg].gccName;
+  }
+
+  static bool isStackFrameReg(Reg reg) {
+    switch (reg) {
+    case Reg_EBP:
+    case Reg_ESP:
+    case Reg_BP:
+    case Reg_SP:
+#ifdef ASM_X86_64
+    case Reg_RBP:
+    case Reg_RSP:
+    case Reg_BPL:
+    case Reg_SPL:
+#endif
+      return true;
+    default:
+      return false;
+    }
+  }
+
+  // Returns true if the instruction makes assumptions about the enclosing
+  // function's stack frame (stack/frame pointer operands, stack adjustments,
+  // calls and returns), i.e., if it can't be inlined into another function.
+  bool dependsOnStackFrame() {
+    if (usesStackFrameReg || (opInfo->implicitClobbers & Clb_SP)) {
+      return true;
+    }
+    switch (op) {
+    case Op_Branch:
+      return strcmp(opIdent->toChars(), "call") == 0;
+    case Op_enter:
+    case Op_iret:
+    case Op_iretd:
+#ifdef ASM_X86_64
+    case Op_iretq:
+#endif
+    case Op_ret:
+    case Op_retf:
+      return true;
+    default:
+      return strcmp(opIdent->toChars(), "leave") == 0;
+    }
+  }
 
   bool opTakesLabel() {
     switch (op) {
@@ -2582,6 +2632,7 @@ struct AsmProcessor {
     AsmArgMode mode;
 
     insnTemplate.str("");
+    usesStackFrameReg = false;
     // %% todo: special case for something..
     if (opInfo->linkType == Out_Mnemonic) {
       mnemonic = alternateMnemonics[opInfo->link];
@@ -3096,6 +3147,7 @@ struct AsmProcessor {
     }
 
     asmcode->insnTemplate = insnTemplate.str();
+    asmcode->dependsOnStackFrame = dependsOnStackFrame();
     Logger::cout() << "insnTemplate = " << asmcode->insnTemplate << '\n';
     return true;
   }
@@ -3194,7 +3246,8 @@ struct AsmProcessor {
           TY ty = v->type->toBasetype()->ty;
           operand->dataSizeHint =
               (ty == Tfloat80 || ty == Timaginary80) &&
-                      !global.params.targetTriple->isWindowsMSVCEnvironment()
+                      !global.params.targetTriple->isWindowsMSVCEnvironment() &&
+                      !global.params.realIsDouble
                   ? Extended_Ptr
                   : static_cast<PtrType>(v->type->size(Loc()));
         }
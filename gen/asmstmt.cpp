@@ -55,10 +55,12 @@ struct AsmCode {
   std::vector<bool> regs;
   unsigned dollarLabel;
   int clobbersMemory;
+  bool dependsOnStackFrame;
   explicit AsmCode(int n_regs) {
     regs.resize(n_regs, false);
     dollarLabel = 0;
     clobbersMemory = 0;
+    dependsOnStackFrame = false;
   }
 };
 
@@ -405,6 +407,10 @@ void AsmStatement_toIR(InlineAsmStatement *stmt, IRState *irs) {
                      input_values.end());
   asmStmt->isBranchToLabel = stmt->isBranchToLabel;
   asmblock->s.push_back(asmStmt);
+
+  if (code->dependsOnStackFrame || stmt->isBranchToLabel) {
+    asmblock->inlinable = false;
+  }
 }
 
 //////////////////////////////////////////////////////////////////////////////
@@ -455,16 +461,38 @@ static void remap_inargs(std::string &insnt, size_t nargs, size_t idx) {
   }
 }
 
+static void disableInlining(CompoundAsmStatement *stmt, IRState *p,
+                            bool dependsOnStackFrame) {
+  IrFunction *irFunc = p->func();
+  FuncDeclaration *fd = irFunc->decl;
+
+  if (dependsOnStackFrame) {
+    // disable frame-pointer-elimination
+    irFunc->func->addAttribute(
+        LLAttributeSet::FunctionIndex,
+        llvm::Attribute::get(p->context(), "no-frame-pointer-elim", "true"));
+    irFunc->func->addAttribute(
+        LLAttributeSet::FunctionIndex,
+        llvm::Attribute::get(p->context(), "no-frame-pointer-elim-non-leaf"));
+  }
+
+  if (fd->allowInlining) { // pragma(LDC_allow_inline)
+    return;
+  }
+  if (fd->inlining == PINLINEalways) {
+    stmt->error("`pragma(inline, true)` function `%s` cannot be inlined: asm "
+                "block depends on the stack frame or contains labels",
+                fd->toPrettyChars());
+    return;
+  }
+  irFunc->setNeverInline();
+}
+
 void CompoundAsmStatement_toIR(CompoundAsmStatement *stmt, IRState *p) {
   IF_LOG Logger::println("CompoundAsmStatement::toIR(): %s",
                          stmt->loc.toChars());
   LOG_SCOPE;
 
-  // disable inlining by default
-  if (!p->func()->decl->allowInlining) {
-    p->func()->setNeverInline();
-  }
-
   // create asm block structure
   assert(!p->asmBlock);
   auto asmblock = new IRAsmBlock(stmt);
@@ -478,6 +506,14 @@ void CompoundAsmStatement_toIR(CompoundAsmStatement *stmt, IRState *p) {
     }
   }
 
+  // The asm block is translated to LLVM inline asm with explicit constraints
+  // and clobbers, so it can be inlined along with the function, unless it
+  // makes assumptions about the stack frame or defines labels (which would
+  // be duplicated).
+  if (!asmblock->inlinable || !asmblock->internalLabels.empty()) {
+    disableInlining(stmt, p, !asmblock->inlinable);
+  }
+
   // build forwarder for in-asm branches to external labels
   // this additional asm code sets the __llvm_jump_target variable
   // to a unique value that will identify the jump target in
@@ -14,17 +14,22 @@
 #include "dmd/expression.h"
 #include "dmd/identifier.h"
 #include "dmd/init.h"
+#include "dmd/module.h"
 #include "dmd/mtype.h"
 #include "dmd/target.h"
+#include "driver/cl_options.h"
 #include "gen/arrays.h"
 #include "gen/dvalue.h"
 #include "gen/functions.h"
+#include "gen/gcallocsites.h"
 #include "gen/irstate.h"
 #include "gen/llvm.h"
 #include "gen/llvmhelpers.h"
 #include "gen/logger.h"
+#include "gen/mangling.h"
 #include "gen/nested.h"
 #include "gen/optimizer.h"
+#include "gen/optremarks.h"
 #include "gen/rttibuilder.h"
 #include "gen/runtime.h"
 #include "gen/structs.h"
@@ -82,6 +87,7 @@ DValue *DtoNewClass(Loc &loc, TypeClass *tc, NewExp *newexp) {
 
   // allocate
   LLValue *mem;
+  bool doInit = true;
   if (newexp->onstack) {
     unsigned alignment = tc->sym->alignsize;
     if (alignment == STRUCTALIGN_DEFAULT)
@@ -96,19 +102,34 @@ DValue *DtoNewClass(Loc &loc, TypeClass *tc, NewExp *newexp) {
     DValue *res = DtoCallFunction(newexp->loc, nullptr, &dfn, newexp->newargs);
     mem = DtoBitCast(DtoRVal(res), DtoType(tc), ".newclass_custom");
   }
+  // -dip1008: `throw new` in @nogc code, reference-counted by druntime
+  else if (global.params.ehnogc && newexp->thrownew) {
+    llvm::Function *fn =
+        getRuntimeFunction(loc, gIR->module, "_d_newThrowable");
+    LLConstant *ci = DtoBitCast(getIrAggr(tc->sym)->getClassInfoSymbol(),
+                                DtoType(getClassInfoType()));
+    emitGCAllocSiteHook(loc, fn);
+    mem = gIR->CreateCallOrInvoke(fn, ci, ".newthrowable_alloc")
+              .getInstruction();
+    mem = DtoBitCast(mem, DtoType(tc), ".newthrowable");
+    // already initialized by druntime, incl. the reference count
+    doInit = false;
+  }
   // default allocator
   else {
     llvm::Function *fn =
         getRuntimeFunction(loc, gIR->module, "_d_allocclass");
     LLConstant *ci = DtoBitCast(getIrAggr(tc->sym)->getClassInfoSymbol(),
                                 DtoType(getClassInfoType()));
+    emitGCAllocSiteHook(loc, fn);
     mem =
         gIR->CreateCallOrInvoke(fn, ci, ".newclass_gc_alloc").getInstruction();
     mem = DtoBitCast(mem, DtoType(tc), ".newclass_gc");
   }
 
   // init
-  DtoInitClass(tc, mem);
+  if (doInit)
+    DtoInitClass(tc, mem);
 
   // init inner-class outer reference
   if (newexp->thisexp) {
@@ -149,6 +170,50 @@ DValue *DtoNewClass(Loc &loc, TypeClass *tc, NewExp *newexp) {
 
 ////////////////////////////////////////////////////////////////////////////////
 
+namespace {
+// Collects the (top-level) initializer fields starting at `firstDataIdx` which
+// aren't all-zero. Returns false if their total size exceeds a quarter of the
+// data size, copying the init symbol is preferable then.
+bool collectNonZeroFields(llvm::ConstantStruct *init, unsigned firstDataIdx,
+                          uint64_t dataBytes,
+                          llvm::SmallVectorImpl<unsigned> &nonZeroFields) {
+  uint64_t nonZeroBytes = 0;
+  for (unsigned i = firstDataIdx, e = init->getNumOperands(); i < e; ++i) {
+    LLConstant *field = init->getOperand(i);
+    if (field->isNullValue())
+      continue;
+    nonZeroBytes += getTypeStoreSize(field->getType());
+    if (nonZeroBytes * 4 > dataBytes)
+      return false;
+    nonZeroFields.push_back(i);
+  }
+  return true;
+}
+
+bool initClassSparsely(ClassDeclaration *cd, LLValue *dst, LLValue *dstarr,
+                       unsigned firstDataIdx, uint64_t dataBytes) {
+  auto init =
+      llvm::dyn_cast<llvm::ConstantStruct>(getIrAggr(cd)->getDefaultInit());
+  if (!init)
+    return false;
+
+  llvm::SmallVector<unsigned, 8> nonZeroFields;
+  if (!collectNonZeroFields(init, firstDataIdx, dataBytes, nonZeroFields))
+    return false;
+
+  DtoMemSetZero(dstarr, DtoConstSize_t(dataBytes));
+
+  if (!nonZeroFields.empty()) {
+    // The initializer type might differ from the class type (unions etc.).
+    LLValue *typedDst = DtoBitCast(dst, getPtrToType(init->getType()));
+    for (unsigned i : nonZeroFields)
+      DtoStore(init->getOperand(i), DtoGEPi(typedDst, 0, i));
+  }
+
+  return true;
+}
+}
+
 void DtoInitClass(TypeClass *tc, LLValue *dst) {
   DtoResolveClass(tc->sym);
 
@@ -176,6 +241,11 @@ void DtoInitClass(TypeClass *tc, LLValue *dst) {
 
   LLValue *dstarr = DtoGEPi(dst, 0, firstDataIdx);
 
+  // If the initializer is mostly zero, zero the instance and store the few
+  // non-zero fields directly instead of copying the whole init image.
+  if (initClassSparsely(tc->sym, dst, dstarr, firstDataIdx, dataBytes))
+    return;
+
   // init symbols might not have valid types
   LLValue *initsym = getIrAggr(tc->sym)->getInitSymbol();
   initsym = DtoBitCast(initsym, DtoType(tc));
@@ -208,20 +278,19 @@ void DtoFinalizeScopeClass(Loc &loc, LLValue *inst, ClassDeclaration *cd) {
   // classes, so this code assumes D classes.
   assert(!cd->isCPPclass());
 
-  bool hasDtor = false;
-  for (; cd; cd = cd->baseClass) {
-    if (cd->dtor) {
-      hasDtor = true;
-      break;
+  // The dynamic type of a scope class instance is known statically, so
+  // destruct it like druntime's rt_finalize2() would, but without runtime
+  // call: invoke the destructors along the base class chain directly...
+  for (ClassDeclaration *c = cd; c; c = c->baseClass) {
+    if (FuncDeclaration *dtor = c->tidtor) {
+      DtoResolveFunction(dtor);
+      Expressions args;
+      DFuncValue dfn(dtor, DtoCallee(dtor), DtoBitCast(inst, DtoType(c->type)));
+      DtoCallFunction(loc, Type::basic[Tvoid], &dfn, &args);
     }
   }
 
-  if (hasDtor) {
-    DtoFinalizeClass(loc, inst);
-    return;
-  }
-
-  // no dtors => only finalize (via druntime call) if monitor is set,
+  // ... and only delete the monitor (via druntime call) if set,
   // see https://github.com/ldc-developers/ldc/issues/2515
   llvm::BasicBlock *ifbb = gIR->insertBB("if");
   llvm::BasicBlock *endbb = gIR->insertBBAfter(ifbb, "endif");
@@ -233,7 +302,11 @@ void DtoFinalizeScopeClass(Loc &loc, LLValue *inst, ClassDeclaration *cd) {
   llvm::BranchInst::Create(ifbb, endbb, hasMonitor, gIR->scopebb());
 
   gIR->scope() = IRScope(ifbb);
-  DtoFinalizeClass(loc, inst);
+  llvm::Function *fn =
+      getRuntimeFunction(loc, gIR->module, "_d_monitordelete");
+  gIR->CreateCallOrInvoke(
+      fn, DtoBitCast(inst, fn->getFunctionType()->getParamType(0)),
+      LLConstantInt::getTrue(gIR->context()), "");
   gIR->ir->CreateBr(endbb);
 
   gIR->scope() = IRScope(endbb);
@@ -338,6 +411,15 @@ DValue *DtoCastClass(Loc &loc, DValue *val, Type *_to) {
     return new DImValue(_to, v);
   }
 
+  // from final class: the object's dynamic type is known statically, so if
+  // `to` isn't a base (handled above), the result is always null
+  if (fc->sym->classKind == ClassKind::d && tc->sym->classKind == ClassKind::d &&
+      !fc->sym->isInterfaceDeclaration() &&
+      (fc->sym->storage_class & STCfinal)) {
+    Logger::println("static cast from final class to unrelated type");
+    return new DImValue(_to, LLConstant::getNullValue(toType));
+  }
+
   // from interface
   if (fc->sym->isInterfaceDeclaration()) {
     Logger::println("interface cast");
@@ -359,7 +441,114 @@ static void resolveObjectAndClassInfoClasses() {
   DtoResolveClass(Type::typeinfoclass);
 }
 
+// Returns whether a dynamic cast of an object or interface of type `from` to
+// `to` can be emitted inline instead of calling into druntime.
+static bool canInlineDynamicCast(ClassDeclaration *from, ClassDeclaration *to) {
+  return to->classKind == ClassKind::d && !to->isInterfaceDeclaration() &&
+         !to->isCOMclass() && !from->isCOMinterface();
+}
+
+// Emits the equivalent of _d_dynamic_cast (or _d_interface_cast if
+// `fromInterface` is set) to a D class `to`: the ClassInfo of the object's
+// dynamic type is compared against the one of `to`, and, unless `to` is final,
+// so are the ClassInfos along its base class chain.
+static LLValue *DtoInlineDynamicCast(LLValue *val, bool fromInterface,
+                                     ClassDeclaration *to, LLType *toType) {
+  IF_LOG Logger::println("Inlining dynamic cast to %s", to->toChars());
+  LOG_SCOPE;
+
+  const bool isFinal = (to->storage_class & STCfinal) != 0;
+
+  LLType *classInfoTy = DtoType(getClassInfoType());
+  LLValue *cinfo =
+      DtoBitCast(getIrAggr(to)->getClassInfoSymbol(), classInfoTy);
+
+  llvm::BasicBlock *entryBB = gIR->scopebb();
+  llvm::BasicBlock *checkBB = gIR->insertBB("dyncast.check");
+  llvm::BasicBlock *loopBB =
+      isFinal ? nullptr : gIR->insertBBAfter(checkBB, "dyncast.loop");
+  llvm::BasicBlock *nextBB =
+      isFinal ? nullptr : gIR->insertBBAfter(loopBB, "dyncast.next");
+  llvm::BasicBlock *endBB =
+      gIR->insertBBAfter(isFinal ? checkBB : nextBB, "dyncast.end");
+
+  // null casts to null
+  LLValue *isNull = gIR->ir->CreateICmpEQ(
+      val, LLConstant::getNullValue(val->getType()), ".nullcheck");
+  llvm::BranchInst::Create(endBB, checkBB, isNull, entryBB);
+
+  gIR->scope() = IRScope(checkBB);
+  LLValue *obj = val;
+  if (fromInterface) {
+    // The first interface vtbl entry points to the Interface struct, whose
+    // offset member is the offset of the interface vptr within the object.
+    LLType *interfaceTy =
+        DtoType(Type::typeinfoclass->fields[3]->type->nextOf());
+    LLValue *pi = DtoInvariantLoad(DtoLoad(DtoBitCast(
+        val, interfaceTy->getPointerTo()->getPointerTo()->getPointerTo())));
+    LLValue *offset = DtoInvariantLoad(DtoGEPi(pi, 0, 2), ".interface.offset");
+    obj = DtoBitCast(obj, getVoidPtrType());
+    obj = gIR->ir->CreateGEP(obj, gIR->ir->CreateNeg(offset));
+  }
+  obj = DtoBitCast(obj, toType);
+
+  // The ClassInfo of the dynamic type is the first vtbl entry.
+  LLValue *vtbl = DtoLoad(DtoGEPi(obj, 0, 0));
+  LLValue *objCinfo = DtoInvariantLoad(
+      DtoBitCast(DtoGEPi(vtbl, 0, 0), classInfoTy->getPointerTo()), ".cinfo");
+
+  LLValue *nullObj = LLConstant::getNullValue(toType);
+  llvm::PHINode *result;
+  if (isFinal) {
+    LLValue *isTo = gIR->ir->CreateICmpEQ(objCinfo, cinfo);
+    LLValue *res = gIR->ir->CreateSelect(isTo, obj, nullObj);
+    llvm::BranchInst::Create(endBB, checkBB);
+
+    gIR->scope() = IRScope(endBB);
+    result = gIR->ir->CreatePHI(toType, 2, ".dyncast");
+    result->addIncoming(nullObj, entryBB);
+    result->addIncoming(res, checkBB);
+  } else {
+    llvm::BranchInst::Create(loopBB, checkBB);
+
+    gIR->scope() = IRScope(loopBB);
+    llvm::PHINode *current = gIR->ir->CreatePHI(classInfoTy, 2, ".cinfo");
+    current->addIncoming(objCinfo, checkBB);
+    LLValue *isTo = gIR->ir->CreateICmpEQ(current, cinfo);
+    llvm::BranchInst::Create(endBB, nextBB, isTo, loopBB);
+
+    // TypeInfo_Class.base
+    gIR->scope() = IRScope(nextBB);
+    LLValue *base = DtoIndexAggregate(current, Type::typeinfoclass,
+                                      Type::typeinfoclass->fields[4]);
+    base = DtoBitCast(DtoLoad(base), classInfoTy, ".cinfo.base");
+    current->addIncoming(base, nextBB);
+    LLValue *isRoot = gIR->ir->CreateICmpEQ(
+        base, LLConstant::getNullValue(classInfoTy));
+    llvm::BranchInst::Create(endBB, loopBB, isRoot, nextBB);
+
+    gIR->scope() = IRScope(endBB);
+    result = gIR->ir->CreatePHI(toType, 3, ".dyncast");
+    result->addIncoming(nullObj, entryBB);
+    result->addIncoming(obj, loopBB);
+    result->addIncoming(nullObj, nextBB);
+  }
+
+  return result;
+}
+
 DValue *DtoDynamicCastObject(Loc &loc, DValue *val, Type *_to) {
+  TypeClass *to = static_cast<TypeClass *>(_to->toBasetype());
+  ClassDeclaration *from =
+      static_cast<TypeClass *>(val->type->toBasetype())->sym;
+  if (canInlineDynamicCast(from, to->sym)) {
+    resolveObjectAndClassInfoClasses();
+    DtoResolveClass(to->sym);
+    LLValue *ret = DtoInlineDynamicCast(DtoRVal(val), false, to->sym,
+                                        DtoType(_to));
+    return new DImValue(_to, ret);
+  }
+
   // call:
   // Object _d_dynamic_cast(Object o, ClassInfo c)
 
@@ -375,7 +564,6 @@ DValue *DtoDynamicCastObject(Loc &loc, DValue *val, Type *_to) {
   assert(funcTy->getParamType(0) == obj->getType());
 
   // ClassInfo c
-  TypeClass *to = static_cast<TypeClass *>(_to->toBasetype());
   DtoResolveClass(to->sym);
 
   LLValue *cinfo = getIrAggr(to->sym)->getClassInfoSymbol();
@@ -397,6 +585,17 @@ DValue *DtoDynamicCastObject(Loc &loc, DValue *val, Type *_to) {
 ////////////////////////////////////////////////////////////////////////////////
 
 DValue *DtoDynamicCastInterface(Loc &loc, DValue *val, Type *_to) {
+  TypeClass *to = static_cast<TypeClass *>(_to->toBasetype());
+  ClassDeclaration *from =
+      static_cast<TypeClass *>(val->type->toBasetype())->sym;
+  if (canInlineDynamicCast(from, to->sym)) {
+    resolveObjectAndClassInfoClasses();
+    DtoResolveClass(to->sym);
+    LLValue *ret = DtoInlineDynamicCast(DtoRVal(val), true, to->sym,
+                                        DtoType(_to));
+    return new DImValue(_to, ret);
+  }
+
   // call:
   // Object _d_interface_cast(void* p, ClassInfo c)
 
@@ -411,7 +610,6 @@ DValue *DtoDynamicCastInterface(Loc &loc, DValue *val, Type *_to) {
   ptr = DtoBitCast(ptr, funcTy->getParamType(0));
 
   // ClassInfo c
-  TypeClass *to = static_cast<TypeClass *>(_to->toBasetype());
   DtoResolveClass(to->sym);
   LLValue *cinfo = getIrAggr(to->sym)->getClassInfoSymbol();
   // unfortunately this is needed as the implementation of object differs
@@ -430,6 +628,53 @@ DValue *DtoDynamicCastInterface(Loc &loc, DValue *val, Type *_to) {
 
 ////////////////////////////////////////////////////////////////////////////////
 
+#if LDC_LLVM_VER >= 400
+// Returns the type identifier of cd's vtables in !type metadata and
+// llvm.type.test calls, or null if cd takes no part in whole-program
+// devirtualization.
+static llvm::MDString *getVtblTypeId(ClassDeclaration *cd) {
+  if (!opts::wholeProgramVtables || cd->isInterfaceDeclaration() ||
+      cd->isCPPclass() || cd->isCOMclass()) {
+    return nullptr;
+  }
+  return llvm::MDString::get(gIR->context(),
+                             getIRMangledVTableSymbolName(cd));
+}
+#endif
+
+void DtoAddVtblTypeMetadata(ClassDeclaration *cd, llvm::GlobalVariable *vtbl) {
+#if LDC_LLVM_VER >= 400
+  // A class vtable extends the ones of all base classes, and the vptr of
+  // objects points to its start.
+  for (ClassDeclaration *c = cd; c; c = c->baseClass) {
+    if (auto typeId = getVtblTypeId(c)) {
+      vtbl->addTypeMetadata(0, typeId);
+    }
+  }
+#endif
+}
+
+// Tells LLVM's whole-program devirtualization that vtbl belongs to a class
+// derived from cd.
+static void emitVtblTypeTest(ClassDeclaration *cd, LLValue *vtbl) {
+#if LDC_LLVM_VER >= 400
+  // Only for classes defined in the compiled modules; others may be extended
+  // by code not taking part in the LTO link.
+  Module *m = cd->getModule();
+  llvm::MDString *typeId = getVtblTypeId(cd);
+  if (!typeId || !m || !m->isRoot()) {
+    return;
+  }
+
+  LLValue *test = gIR->ir->CreateCall(
+      GET_INTRINSIC_DECL(type_test),
+      {DtoBitCast(vtbl, getVoidPtrType()),
+       llvm::MetadataAsValue::get(gIR->context(), typeId)},
+      "vtbl.typetest");
+  gIR->ir->CreateCall(GET_INTRINSIC_DECL(assume), test);
+#endif
+}
+
 LLValue *DtoVirtualFunctionPointer(DValue *inst, FuncDeclaration *fdecl,
                                    const char *name) {
   // sanity checks
@@ -449,12 +694,22 @@ LLValue *DtoVirtualFunctionPointer(DValue *inst, FuncDeclaration *fdecl,
   funcval = DtoGEPi(funcval, 0, 0);
   // load vtbl ptr
   funcval = DtoLoad(funcval);
+  emitVtblTypeTest(static_cast<TypeClass *>(inst->type->toBasetype())->sym,
+                   funcval);
   // index vtbl
   std::string vtblname = name;
   vtblname.append("@vtbl");
   funcval = DtoGEPi(funcval, 0, fdecl->vtblIndex, vtblname.c_str());
   // load opaque pointer
-  funcval = DtoAlignedLoad(funcval);
+  funcval = DtoInvariantLoad(funcval);
+
+  if (areCodegenRemarksEnabled()) {
+    addCodegenRemark(
+        "VirtualCall", llvm::cast<llvm::Instruction>(funcval),
+        llvm::Twine("virtual call to `") + fdecl->toPrettyChars() +
+            "`: neither the method nor `" + inst->type->toChars() +
+            "` is final");
+  }
 
   IF_LOG Logger::cout() << "funcval: " << *funcval << '\n';
 
@@ -708,15 +963,7 @@ LLConstant *DtoDefineClassInfo(ClassDeclaration *cd) {
   b.push_funcptr(defConstructor, defConstructorVar->type);
 
   // m_RTInfo
-  // The cases where getRTInfo is null are not quite here, but the code is
-  // modelled after what DMD does.
-  if (cd->getRTInfo) {
-    b.push(toConstElem(cd->getRTInfo, gIR));
-  } else if (flags & ClassFlags::noPointers) {
-    b.push_size_as_vp(0); // no pointers
-  } else {
-    b.push_size_as_vp(1); // has pointers
-  }
+  b.push_rtinfo(cd, !(flags & ClassFlags::noPointers));
 
   /*size_t n = inits.size();
   for (size_t i=0; i<n; ++i)
@@ -21,6 +21,9 @@ class CtorDeclaration;
 class FuncDeclaration;
 class NewExp;
 class TypeClass;
+namespace llvm {
+class GlobalVariable;
+}
 
 /// Resolves the llvm type for a class declaration
 void DtoResolveClass(ClassDeclaration *cd);
@@ -41,3 +44,7 @@ DValue *DtoDynamicCastInterface(Loc &loc, DValue *val, Type *to);
 
 llvm::Value *DtoVirtualFunctionPointer(DValue *inst, FuncDeclaration *fdecl,
                                        const char *name);
+
+/// Attaches the !type metadata for whole-program devirtualization
+/// (-fwhole-program-vtables) to the vtable of cd.
+void DtoAddVtblTypeMetadata(ClassDeclaration *cd, llvm::GlobalVariable *vtbl);
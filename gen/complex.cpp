@@ -361,8 +361,17 @@ DImValue *DtoComplexDiv(Loc &loc, Type *type, DRValue *lhs, DRValue *rhs) {
     tmp2 = gIR->ir->CreateFMul(rhs_im, rhs_im, "rhs_imsq");
     denom = gIR->ir->CreateFAdd(tmp1, tmp2, "denom");
 
-    res_re = gIR->ir->CreateFDiv(res_re, denom, "res_re");
-    res_im = gIR->ir->CreateFDiv(res_im, denom, "res_im");
+    // With reciprocals allowed (@fastmath, -ffast-math), a single division
+    // and two multiplications are cheaper and vectorize better.
+    if (gIR->ir->getFastMathFlags().allowReciprocal()) {
+      denom = gIR->ir->CreateFDiv(llvm::ConstantFP::get(denom->getType(), 1.0),
+                                  denom, "denom_inv");
+      res_re = gIR->ir->CreateFMul(res_re, denom, "res_re");
+      res_im = gIR->ir->CreateFMul(res_im, denom, "res_im");
+    } else {
+      res_re = gIR->ir->CreateFDiv(res_re, denom, "res_re");
+      res_im = gIR->ir->CreateFDiv(res_im, denom, "res_im");
+    }
   }
 
   LLValue *res = DtoAggrPair(DtoType(type), res_re, res_im);
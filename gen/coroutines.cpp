@@ -0,0 +1,176 @@
+//===-- coroutines.cpp ----------------------------------------------------===//
+//
+//                         LDC – the LLVM D compiler
+//
+// This file is distributed under the BSD-style LDC license. See the LICENSE
+// file for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "gen/coroutines.h"
+
+#include "dmd/declaration.h"
+#include "dmd/errors.h"
+#include "dmd/mtype.h"
+#include "gen/dvalue.h"
+#include "gen/funcgenstate.h"
+#include "gen/irstate.h"
+#include "gen/llvm.h"
+#include "gen/llvmhelpers.h"
+#include "gen/logger.h"
+#include "gen/runtime.h"
+#include "gen/tollvm.h"
+
+#if LDC_LLVM_VER >= 400
+
+namespace coroutines {
+
+void emitBegin(FuncGenState &funcGen, FuncDeclaration *fd) {
+  IF_LOG Logger::println("Emitting generator setup for %s", fd->toChars());
+  LOG_SCOPE;
+
+  auto tf = static_cast<TypeFunction *>(fd->type->toBasetype());
+  // The suspension points don't unwind; an exception escaping a resumed
+  // generator would bypass the coroutine end.
+  if (!tf->isnothrow) {
+    fd->error("generator function must be `nothrow`");
+    fatal();
+  }
+  if (tf->parameterList.varargs == VarArg::variadic) {
+    fd->error("generator function cannot be variadic");
+    fatal();
+  }
+
+  IRState &irs = *gIR;
+  GeneratorState &gen = funcGen.generator;
+  llvm::Function *func = irs.topfunc();
+  LLValue *voidNull = getNullPtr(getVoidPtrType());
+
+  // The promise is allocated and patched in by the first yield.
+  gen.id = irs.ir->CreateCall(GET_INTRINSIC_DECL(coro_id),
+                              {DtoConstUint(0), voidNull, voidNull, voidNull},
+                              "coro.id");
+  LLValue *needAlloc =
+      irs.ir->CreateCall(GET_INTRINSIC_DECL(coro_alloc), gen.id, "coro.alloc");
+
+  llvm::BasicBlock *entryBB = irs.scopebb();
+  llvm::BasicBlock *allocBB = irs.insertBB("coro.alloc");
+  llvm::BasicBlock *beginBB = irs.insertBBAfter(allocBB, "coro.begin");
+  irs.ir->CreateCondBr(needAlloc, allocBB, beginBB);
+
+  irs.scope() = IRScope(allocBB);
+  LLValue *size = irs.ir->CreateCall(
+      llvm::Intrinsic::getDeclaration(&irs.module, llvm::Intrinsic::coro_size,
+                                      DtoSize_t()),
+      {}, "coro.size");
+  llvm::Function *allocFn =
+      getRuntimeFunction(fd->loc, irs.module, "_d_allocmemory");
+  LLValue *mem = irs.ir->CreateCall(allocFn, size, "coro.mem");
+  irs.ir->CreateBr(beginBB);
+
+  irs.scope() = IRScope(beginBB);
+  llvm::PHINode *frame = irs.ir->CreatePHI(getVoidPtrType(), 2, "coro.frame");
+  frame->addIncoming(voidNull, entryBB);
+  frame->addIncoming(mem, allocBB);
+  gen.handle = irs.ir->CreateCall(GET_INTRINSIC_DECL(coro_begin),
+                                  {gen.id, frame}, "coro.handle");
+
+  // Populated by emitEnd().
+  gen.cleanupBB =
+      llvm::BasicBlock::Create(irs.context(), "coro.cleanup", func);
+  gen.suspendBB =
+      llvm::BasicBlock::Create(irs.context(), "coro.suspend", func);
+}
+
+void emitYield(FuncGenState &funcGen, Loc &loc, Type *type, DValue *value) {
+  IRState &irs = *gIR;
+  GeneratorState &gen = funcGen.generator;
+  if (!gen.id) {
+    error(loc, "`pragma(LDC_yield)` can only be used in generator functions");
+    fatal();
+  }
+
+  if (!gen.promise) {
+    gen.yieldType = type;
+    gen.promise = DtoAlloca(type, ".coro.promise");
+    // The coroutine id refers to the promise, which has to dominate it.
+    auto promisePtr = new llvm::BitCastInst(gen.promise, getVoidPtrType(),
+                                            "", gen.id);
+    gen.id->setArgOperand(0, DtoConstUint(gen.promise->getAlignment()));
+    gen.id->setArgOperand(1, promisePtr);
+  } else if (!type->equals(gen.yieldType)) {
+    error(loc, "generator yields `%s`, but previously yielded `%s`",
+          type->toChars(), gen.yieldType->toChars());
+    fatal();
+  }
+
+  DLValue promise(type, gen.promise);
+  DtoAssign(loc, &promise, value, TOKblit);
+
+  LLValue *suspend = irs.ir->CreateCall(
+      GET_INTRINSIC_DECL(coro_suspend),
+      {llvm::ConstantTokenNone::get(irs.context()), DtoConstBool(false)},
+      "coro.suspend");
+
+  llvm::BasicBlock *resumeBB = irs.insertBB("coro.resume");
+  llvm::BasicBlock *destroyBB = irs.insertBBBefore(resumeBB, "coro.destroy");
+  llvm::SwitchInst *dispatch =
+      irs.ir->CreateSwitch(suspend, gen.suspendBB, 2);
+  dispatch->addCase(DtoConstUbyte(0), resumeBB);
+  dispatch->addCase(DtoConstUbyte(1), destroyBB);
+
+  // A destroyed generator runs the cleanups of the scopes it is suspended in.
+  irs.scope() = IRScope(destroyBB);
+  funcGen.scopes.runCleanups(0, gen.cleanupBB);
+
+  irs.scope() = IRScope(resumeBB);
+}
+
+void emitEnd(FuncGenState &funcGen, bool fallsThrough) {
+  IRState &irs = *gIR;
+  GeneratorState &gen = funcGen.generator;
+
+  if (fallsThrough) {
+    LLValue *suspend = irs.ir->CreateCall(
+        GET_INTRINSIC_DECL(coro_suspend),
+        {llvm::ConstantTokenNone::get(irs.context()), DtoConstBool(true)},
+        "coro.final");
+    // Resuming a finished generator is undefined.
+    llvm::BasicBlock *trapBB = irs.insertBB("coro.resume.final");
+    llvm::SwitchInst *dispatch =
+        irs.ir->CreateSwitch(suspend, gen.suspendBB, 2);
+    dispatch->addCase(DtoConstUbyte(0), trapBB);
+    dispatch->addCase(DtoConstUbyte(1), gen.cleanupBB);
+    irs.scope() = IRScope(trapBB);
+    irs.ir->CreateUnreachable();
+  }
+
+  // The GC-allocated frame isn't freed explicitly.
+  irs.scope() = IRScope(gen.cleanupBB);
+  irs.ir->CreateBr(gen.suspendBB);
+
+  irs.scope() = IRScope(gen.suspendBB);
+  irs.ir->CreateCall(GET_INTRINSIC_DECL(coro_end),
+                     {gen.handle, DtoConstBool(false)});
+  irs.ir->CreateRet(gen.handle);
+}
+
+} // namespace coroutines
+
+#else // LDC_LLVM_VER < 400
+
+namespace coroutines {
+
+void emitBegin(FuncGenState &, FuncDeclaration *fd) {
+  fd->error("generator functions require LDC to be built against LLVM 4.0 "
+            "or later");
+  fatal();
+}
+
+void emitYield(FuncGenState &, Loc &, Type *, DValue *) {}
+
+void emitEnd(FuncGenState &, bool) {}
+
+} // namespace coroutines
+
+#endif
@@ -0,0 +1,44 @@
+//===-- gen/coroutines.h - Generator functions ------------------*- C++ -*-===//
+//
+//                         LDC – the LLVM D compiler
+//
+// This file is distributed under the BSD-style LDC license. See the LICENSE
+// file for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// A function calling a `pragma(LDC_yield)` template is a stackless generator,
+// lowered to an LLVM coroutine (`llvm.coro.*` intrinsics). It returns the
+// coroutine handle (`void*`) after running up to the first yield; each yield
+// stores the value in the coroutine promise and suspends. The consumer uses
+// the `llvm.coro.{resume,done,promise,destroy}` intrinsics on the handle.
+//
+// The coroutine frame is allocated via `_d_allocmemory()`, so that the GC
+// scans it; LLVM's CoroElide pass places it on the consumer's stack if the
+// generator is inlined and destroyed by it.
+//
+//===----------------------------------------------------------------------===//
+
+#pragma once
+
+class DValue;
+class FuncDeclaration;
+class FuncGenState;
+struct Loc;
+class Type;
+
+namespace coroutines {
+
+/// Emits the coroutine setup of a generator function; must be called before
+/// any of its parameters and locals are initialized.
+void emitBegin(FuncGenState &funcGen, FuncDeclaration *fd);
+
+/// Suspends the generator, making `value` of type `type` available to the
+/// consumer.
+void emitYield(FuncGenState &funcGen, Loc &loc, Type *type, DValue *value);
+
+/// Emits the final suspension (if the body falls through) and the return of
+/// the handle, finishing the function.
+void emitEnd(FuncGenState &funcGen, bool fallsThrough);
+
+} // namespace coroutines
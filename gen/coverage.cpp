@@ -13,6 +13,22 @@
 #include "dmd/module.h"
 #include "gen/irstate.h"
 #include "gen/logger.h"
+#include "llvm/Support/CommandLine.h"
+
+namespace {
+enum class CoverageIncrement { atomic, nonAtomic, boolean };
+
+llvm::cl::opt<CoverageIncrement> coverageIncrement(
+    "cov-increment", llvm::cl::ZeroOrMore,
+    llvm::cl::desc("Set the type of coverage line count increment instruction"),
+    llvm::cl::init(CoverageIncrement::atomic),
+    clEnumValues(clEnumValN(CoverageIncrement::atomic, "atomic",
+                            "Atomic increment (default)"),
+                 clEnumValN(CoverageIncrement::nonAtomic, "non-atomic",
+                            "Non-atomic increment (not thread safe)"),
+                 clEnumValN(CoverageIncrement::boolean, "boolean",
+                            "Don't read, just set counter to 1")));
+}
 
 void emitCoverageLinecountInc(Loc &loc) {
   Module *m = gIR->dmodule;
@@ -37,9 +53,37 @@ void emitCoverageLinecountInc(Loc &loc) {
       LLArrayType::get(LLType::getInt32Ty(gIR->context()), m->numlines),
       m->d_cover_data, idxs, true);
 
-  // Do an atomic increment, so this works when multiple threads are executed.
-  gIR->ir->CreateAtomicRMW(llvm::AtomicRMWInst::Add, ptr, DtoConstUint(1),
-                           llvm::AtomicOrdering::Monotonic);
+  switch (coverageIncrement) {
+  case CoverageIncrement::atomic:
+    // Do an atomic increment, so this works when multiple threads are
+    // executed.
+    gIR->ir->CreateAtomicRMW(llvm::AtomicRMWInst::Add, ptr, DtoConstUint(1),
+                             llvm::AtomicOrdering::Monotonic);
+    break;
+  case CoverageIncrement::nonAtomic: {
+    // Do a non-atomic increment, user is responsible for correct results with
+    // multithreaded execution
+    llvm::LoadInst *load = gIR->ir->CreateAlignedLoad(ptr, 4);
+    llvm::Value *incr = gIR->ir->CreateAdd(load, DtoConstUint(1));
+    gIR->ir->CreateAlignedStore(incr, ptr, 4);
+    break;
+  }
+  case CoverageIncrement::boolean: {
+    // Setting the counter to 1 is idempotent, so a single store per basic block
+    // and line suffices. The GEP constant is uniqued, so its users are the
+    // previous stores for this line.
+    llvm::BasicBlock *bb = gIR->scopebb();
+    for (auto user : ptr->users()) {
+      auto store = llvm::dyn_cast<llvm::StoreInst>(user);
+      if (store && store->getParent() == bb) {
+        IF_LOG Logger::println("already set in this basic block");
+        return;
+      }
+    }
+    gIR->ir->CreateAlignedStore(DtoConstUint(1), ptr, 4);
+    break;
+  }
+  }
 
   unsigned num_sizet_bits = gDataLayout->getTypeSizeInBits(DtoSize_t());
   unsigned idx = line / num_sizet_bits;
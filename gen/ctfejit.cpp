@@ -0,0 +1,530 @@
+//===-- ctfejit.cpp -------------------------------------------------------===//
+//
+//                         LDC – the LLVM D compiler
+//
+// This file is distributed under the BSD-style LDC license. See the LICENSE
+// file for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// With -ctfe-jit, compile-time functions interpreted more often than a
+// threshold are compiled to native code and executed directly.
+//
+// Only a conservative subset is supported, such that the native execution is
+// guaranteed to yield the same result as the interpreter (and never to crash
+// the compiler): pure, non-recursive functions whose parameters, return type
+// and locals are integral, only using arithmetic, comparisons, control flow and
+// calls of other such functions. Divisions and shifts are restricted to
+// constant operands the interpreter would accept. Everything else (asserts,
+// exceptions, pointers, arrays, floating-point values, globals, `__ctfe`, ...)
+// is left to the interpreter.
+//
+// The functions are emitted into a side module with the regular codegen, an
+// `extern(C) void entry(ulong* args, ulong* result)` wrapper is added, and the
+// module is compiled for the host with MCJIT. The IR state of all symbols is
+// reset afterwards, so that the codegen of the actual modules starts from
+// scratch.
+//
+//===----------------------------------------------------------------------===//
+
+#include "gen/ctfejit.h"
+
+#include "dmd/declaration.h"
+#include "dmd/errors.h"
+#include "dmd/expression.h"
+#include "dmd/globals.h"
+#include "dmd/module.h"
+#include "dmd/mtype.h"
+#include "dmd/statement.h"
+#include "driver/cl_options_instrumentation.h"
+#include "gen/functions.h"
+#include "gen/irstate.h"
+#include "gen/llvmhelpers.h"
+#include "gen/logger.h"
+#include "gen/recursivevisitor.h"
+#include "gen/scope_exit.h"
+#include "ir/irdsymbol.h"
+#include "ir/irfunction.h"
+#include "llvm/ADT/SetVector.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/Triple.h"
+#include "llvm/ExecutionEngine/ExecutionEngine.h"
+#include "llvm/ExecutionEngine/MCJIT.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Host.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+
+llvm::cl::opt<bool>
+    ctfeJit("ctfe-jit", llvm::cl::ZeroOrMore,
+            llvm::cl::desc("Execute frequently called pure compile-time "
+                           "functions over integral types natively "
+                           "(JIT-compiled) instead of interpreting them"));
+
+llvm::cl::opt<unsigned> ctfeJitThreshold(
+    "ctfe-jit-threshold", llvm::cl::ZeroOrMore, llvm::cl::init(16),
+    llvm::cl::value_desc("calls"),
+    llvm::cl::desc("Number of interpreted calls of a compile-time function "
+                   "before it is JIT-compiled (with -ctfe-jit)"));
+
+const char *const entryName = "__ctfe_jit_entry";
+
+using EntryFn = void (*)(const uint64_t *args, uint64_t *result);
+
+enum class Eligibility { Unknown, Checking, Yes, No };
+
+struct FunctionInfo {
+  Eligibility eligibility = Eligibility::Unknown;
+  // The functions called directly.
+  llvm::SmallVector<FuncDeclaration *, 2> callees;
+  unsigned calls = 0;
+  bool failed = false;
+  EntryFn entry = nullptr;
+};
+
+// Node-based, so references stay valid while inserting (recursively).
+std::unordered_map<FuncDeclaration *, FunctionInfo> functionInfos;
+std::vector<std::unique_ptr<llvm::ExecutionEngine>> engines;
+bool finished = false;
+
+bool isSupportedType(Type *t) {
+  if (!t)
+    return false;
+  switch (t->toBasetype()->ty) {
+  case Tbool:
+  case Tint8:
+  case Tuns8:
+  case Tint16:
+  case Tuns16:
+  case Tint32:
+  case Tuns32:
+  case Tint64:
+  case Tuns64:
+  case Tchar:
+  case Twchar:
+  case Tdchar:
+    return true;
+  default:
+    return false;
+  }
+}
+
+// Returns true if the JIT can be used for the current compilation, i.e., if
+// the code can be executed on the host and the codegen emits no references to
+// instrumentation runtimes.
+bool isEnabled() {
+  static const bool enabled = [] {
+    if (!ctfeJit)
+      return false;
+    const llvm::Triple host(llvm::sys::getProcessTriple());
+    const llvm::Triple &target = *global.params.targetTriple;
+    if (host.getArch() != target.getArch() || host.getOS() != target.getOS()) {
+      IF_LOG Logger::println("CTFE JIT disabled: not compiling for the host");
+      return false;
+    }
+    if (global.params.cov || opts::instrumentFunctions ||
+        opts::fXRayInstrument || opts::isInstrumentingForPGO() ||
+        opts::isUsingPGOProfile()) {
+      IF_LOG Logger::println("CTFE JIT disabled: instrumented codegen");
+      return false;
+    }
+    return true;
+  }();
+  return enabled;
+}
+
+/// Checks the body of a function for constructs not supported by the JIT and
+/// collects the called functions.
+class BodyChecker : public StoppableVisitor {
+  FuncDeclaration *const fd;
+  llvm::SmallVectorImpl<FuncDeclaration *> &callees;
+
+  void checkType(Expression *e) {
+    if (!isSupportedType(e->type))
+      stop = true;
+  }
+
+  // The interpreter fails for divisions by zero, and dividing the smallest
+  // signed value by -1 traps on some hosts.
+  void checkDivisor(BinExp *e) {
+    checkType(e);
+    if (e->e2->op != TOKint64) {
+      stop = true;
+      return;
+    }
+    const dinteger_t v = e->e2->toInteger();
+    if (v == 0 ||
+        (!e->e2->type->isunsigned() && static_cast<sinteger_t>(v) == -1)) {
+      stop = true;
+    }
+  }
+
+  // The interpreter fails for shifts by the bit width or more.
+  void checkShift(BinExp *e) {
+    checkType(e);
+    if (e->e2->op != TOKint64 ||
+        e->e2->toInteger() >= e->e1->type->size() * 8) {
+      stop = true;
+    }
+  }
+
+public:
+  BodyChecker(FuncDeclaration *fd,
+              llvm::SmallVectorImpl<FuncDeclaration *> &callees)
+      : fd(fd), callees(callees) {}
+
+  using StoppableVisitor::visit;
+
+  // Everything not explicitly allowed below is rejected.
+  void visit(Dsymbol *) override { stop = true; }
+  void visit(Statement *) override { stop = true; }
+  void visit(Expression *) override { stop = true; }
+  void visit(Initializer *) override { stop = true; }
+
+  // The walked function itself, and the variables of checked DeclarationExps.
+  void visit(FuncDeclaration *) override {}
+  void visit(VarDeclaration *) override {}
+  void visit(ExpInitializer *) override {}
+
+  void visit(CompoundStatement *) override {}
+  void visit(ExpStatement *) override {}
+  void visit(ScopeStatement *) override {}
+  void visit(IfStatement *stmt) override {
+    if (stmt->match)
+      stop = true;
+  }
+  void visit(WhileStatement *) override {}
+  void visit(DoStatement *) override {}
+  void visit(ForStatement *) override {}
+  void visit(UnrolledLoopStatement *) override {}
+  void visit(SwitchStatement *stmt) override {
+    if (stmt->tf || stmt->hasVars)
+      stop = true;
+  }
+  void visit(CaseStatement *) override {}
+  void visit(DefaultStatement *) override {}
+  void visit(GotoDefaultStatement *) override {}
+  void visit(GotoCaseStatement *) override {}
+  void visit(GotoStatement *) override {}
+  void visit(LabelStatement *) override {}
+  void visit(BreakStatement *) override {}
+  void visit(ContinueStatement *) override {}
+  void visit(ReturnStatement *) override {}
+
+  void visit(IntegerExp *e) override { checkType(e); }
+
+  void visit(VarExp *e) override {
+    // The callee of a (checked) call.
+    if (e->var->isFuncDeclaration() && e->type->toBasetype()->ty == Tfunction)
+      return;
+    // Only the function's own parameters and locals.
+    VarDeclaration *vd = e->var->isVarDeclaration();
+    if (!vd || vd->isDataseg() || vd->toParent2() != fd ||
+        (vd->storage_class & (STCref | STCout | STClazy))) {
+      stop = true;
+      return;
+    }
+    checkType(e);
+  }
+
+  void visit(DeclarationExp *e) override {
+    VarDeclaration *vd = e->declaration->isVarDeclaration();
+    if (!vd || vd->aliassym || vd->isDataseg() ||
+        (vd->storage_class & STCref) || !isSupportedType(vd->type)) {
+      stop = true;
+    }
+  }
+
+  void visit(CallExp *e) override {
+    if (!e->f || e->e1->op != TOKvar) {
+      stop = true;
+      return;
+    }
+    checkType(e);
+    callees.push_back(e->f);
+  }
+
+  void visit(CommaExp *e) override {
+    if (e->type->toBasetype()->ty != Tvoid)
+      checkType(e);
+  }
+
+  void visit(CastExp *e) override { checkType(e); }
+  void visit(NegExp *e) override { checkType(e); }
+  void visit(ComExp *e) override { checkType(e); }
+  void visit(NotExp *e) override { checkType(e); }
+  void visit(PreExp *e) override { checkType(e); }
+  void visit(PostExp *e) override { checkType(e); }
+  void visit(AddExp *e) override { checkType(e); }
+  void visit(MinExp *e) override { checkType(e); }
+  void visit(MulExp *e) override { checkType(e); }
+  void visit(AndExp *e) override { checkType(e); }
+  void visit(OrExp *e) override { checkType(e); }
+  void visit(XorExp *e) override { checkType(e); }
+  void visit(EqualExp *e) override { checkType(e); }
+  void visit(IdentityExp *e) override { checkType(e); }
+  void visit(CmpExp *e) override { checkType(e); }
+  void visit(LogicalExp *e) override { checkType(e); }
+  void visit(CondExp *e) override { checkType(e); }
+  void visit(AssignExp *e) override { checkType(e); }
+  void visit(AddAssignExp *e) override { checkType(e); }
+  void visit(MinAssignExp *e) override { checkType(e); }
+  void visit(MulAssignExp *e) override { checkType(e); }
+  void visit(AndAssignExp *e) override { checkType(e); }
+  void visit(OrAssignExp *e) override { checkType(e); }
+  void visit(XorAssignExp *e) override { checkType(e); }
+
+  void visit(DivExp *e) override { checkDivisor(e); }
+  void visit(ModExp *e) override { checkDivisor(e); }
+  void visit(DivAssignExp *e) override { checkDivisor(e); }
+  void visit(ModAssignExp *e) override { checkDivisor(e); }
+
+  void visit(ShlExp *e) override { checkShift(e); }
+  void visit(ShrExp *e) override { checkShift(e); }
+  void visit(UshrExp *e) override { checkShift(e); }
+  void visit(ShlAssignExp *e) override { checkShift(e); }
+  void visit(ShrAssignExp *e) override { checkShift(e); }
+  void visit(UshrAssignExp *e) override { checkShift(e); }
+};
+
+bool hasSupportedSignature(FuncDeclaration *fd) {
+  if (!fd->fbody || fd->semanticRun < PASSsemantic3done ||
+      fd->semantic3Errors || fd->isNested() || fd->needThis() || fd->naked ||
+      fd->llvmInternal || fd->userAttribDecl || fd->v_arguments ||
+      fd->frequires || fd->fensures || fd->frequire || fd->fensure ||
+      fd->isPure() == PUREimpure) {
+    return false;
+  }
+
+  auto tf = static_cast<TypeFunction *>(fd->type->toBasetype());
+  if (tf->isref || tf->parameterList.varargs != VarArg::none ||
+      !isSupportedType(tf->next)) {
+    return false;
+  }
+
+  if (fd->parameters) {
+    for (auto p : *fd->parameters) {
+      if ((p->storage_class & (STCref | STCout | STClazy)) ||
+          !isSupportedType(p->type)) {
+        return false;
+      }
+    }
+  }
+
+  return true;
+}
+
+// Checks whether the function and all (transitively) called functions can be
+// JIT-compiled. Recursion is not supported, to preserve the interpreter's
+// limit for the recursion depth.
+bool isEligible(FuncDeclaration *fd) {
+  FunctionInfo &info = functionInfos[fd];
+  switch (info.eligibility) {
+  case Eligibility::Yes:
+    return true;
+  case Eligibility::Checking:
+  case Eligibility::No:
+    return false;
+  case Eligibility::Unknown:
+    break;
+  }
+
+  info.eligibility = Eligibility::Checking;
+
+  bool eligible = hasSupportedSignature(fd);
+  if (eligible) {
+    BodyChecker checker(fd, info.callees);
+    RecursiveWalker walker(&checker, /*continueAfterStop=*/false);
+    fd->accept(&walker);
+    eligible = !checker.stop;
+  }
+  for (size_t i = 0; eligible && i < info.callees.size(); ++i)
+    eligible = isEligible(info.callees[i]);
+
+  IF_LOG Logger::println("CTFE JIT: %s is %ssupported", fd->toPrettyChars(),
+                         eligible ? "" : "not ");
+  info.eligibility = eligible ? Eligibility::Yes : Eligibility::No;
+  return eligible;
+}
+
+void collectFunctions(FuncDeclaration *fd,
+                      llvm::SetVector<FuncDeclaration *> &functions) {
+  if (!functions.insert(fd))
+    return;
+  for (auto callee : functionInfos[fd].callees)
+    collectFunctions(callee, functions);
+}
+
+std::unique_ptr<llvm::Module> cloneModule(const llvm::Module &m) {
+#if LDC_LLVM_VER >= 700
+  return llvm::CloneModule(m);
+#else
+  return llvm::CloneModule(&m);
+#endif
+}
+
+// Emits `void entry(ulong* args, ulong* result)`, calling `callee` with the
+// (truncated) arguments and storing the zero-extended result.
+void emitEntry(llvm::Module &m, llvm::Function *callee, bool reverseParams) {
+  llvm::LLVMContext &ctx = m.getContext();
+  llvm::Type *i64 = llvm::Type::getInt64Ty(ctx);
+  llvm::Type *params[] = {i64->getPointerTo(), i64->getPointerTo()};
+  auto entry = llvm::Function::Create(
+      llvm::FunctionType::get(llvm::Type::getVoidTy(ctx), params, false),
+      llvm::GlobalValue::ExternalLinkage, entryName, &m);
+  auto argsPtr = &*entry->arg_begin();
+  auto resultPtr = &*std::next(entry->arg_begin());
+
+  llvm::IRBuilder<> builder(llvm::BasicBlock::Create(ctx, "", entry));
+  const unsigned numArgs = callee->arg_size();
+  llvm::SmallVector<llvm::Value *, 8> args;
+  for (unsigned i = 0; i < numArgs; ++i) {
+    const unsigned index = reverseParams ? numArgs - 1 - i : i;
+    llvm::Value *arg =
+        builder.CreateLoad(builder.CreateConstGEP1_64(argsPtr, index));
+    args.push_back(builder.CreateTrunc(
+        arg, callee->getFunctionType()->getParamType(i)));
+  }
+  llvm::CallInst *call = builder.CreateCall(callee, args);
+  call->setCallingConv(callee->getCallingConv());
+  call->setAttributes(callee->getAttributes());
+  builder.CreateStore(builder.CreateZExt(call, i64), resultPtr);
+  builder.CreateRetVoid();
+}
+
+// Returns true if the module can be executed with the arguments and result
+// passed as integers, without resolving any external symbols.
+bool isSelfContained(llvm::Module &m, llvm::Function *callee,
+                     const IrFuncTy &irFty) {
+  if (!m.global_empty() || !callee->getReturnType()->isIntegerTy() ||
+      irFty.arg_sret || irFty.ret->rewrite) {
+    return false;
+  }
+  for (auto &param : callee->args()) {
+    if (!param.getType()->isIntegerTy())
+      return false;
+  }
+  for (auto arg : irFty.args) {
+    if (arg->rewrite || arg->byref)
+      return false;
+  }
+  for (auto &f : m) {
+    if (f.isDeclaration() && !f.isIntrinsic() && !f.use_empty())
+      return false;
+  }
+  return true;
+}
+
+EntryFn compile(FuncDeclaration *fd) {
+  llvm::SetVector<FuncDeclaration *> functions;
+  collectFunctions(fd, functions);
+
+  const auto oldSymdebug = global.params.symdebug;
+  const auto oldOutputSourceLocations = global.params.outputSourceLocations;
+  global.params.symdebug = 0;
+  global.params.outputSourceLocations = false;
+
+  IRState irs("__ctfe_jit", getGlobalContext());
+  irs.module.setTargetTriple(llvm::sys::getProcessTriple());
+  irs.dmodule = fd->getModule();
+  gIR = &irs;
+  SCOPE_EXIT {
+    gIR = nullptr;
+    // No IR data is kept, so the actual codegen starts from scratch.
+    IrDsymbol::resetAll(/*freeData=*/true);
+    global.params.symdebug = oldSymdebug;
+    global.params.outputSourceLocations = oldOutputSourceLocations;
+  };
+
+  const unsigned oldGagged = global.startGagging();
+  for (auto f : functions)
+    DtoDefineFunction(f, /*linkageAvailableExternally=*/true);
+  if (global.endGagging(oldGagged))
+    return nullptr;
+
+  IrFunction *irFunc = getIrFunc(fd);
+  llvm::Function *callee = irFunc->getLLVMFunc();
+  if (!isSelfContained(irs.module, callee, irFunc->irFty))
+    return nullptr;
+
+  for (auto &f : irs.module) {
+    if (!f.isDeclaration()) {
+      f.setLinkage(llvm::GlobalValue::InternalLinkage);
+      f.setComdat(nullptr);
+    }
+  }
+  emitEntry(irs.module, callee, irFunc->irFty.reverseParams);
+
+  std::string error;
+  std::unique_ptr<llvm::ExecutionEngine> engine(
+      llvm::EngineBuilder(cloneModule(irs.module))
+          .setEngineKind(llvm::EngineKind::JIT)
+          .setErrorStr(&error)
+          .setOptLevel(llvm::CodeGenOpt::Default)
+          .create());
+  if (!engine) {
+    IF_LOG Logger::println("CTFE JIT: cannot create the execution engine: %s",
+                           error.c_str());
+    return nullptr;
+  }
+  engine->finalizeObject();
+  const uint64_t address = engine->getFunctionAddress(entryName);
+  if (!address)
+    return nullptr;
+
+  engines.push_back(std::move(engine));
+  return reinterpret_cast<EntryFn>(address);
+}
+
+} // anonymous namespace
+
+Expression *ctfeJitCall(FuncDeclaration *fd, Expressions *arguments) {
+  // No CTFE during the codegen of a module, as the IR state is reset.
+  if (finished || gIR || !isEnabled())
+    return nullptr;
+
+  FunctionInfo &info = functionInfos[fd];
+  if (info.failed)
+    return nullptr;
+
+  if (!info.entry) {
+    if (++info.calls <= ctfeJitThreshold)
+      return nullptr;
+
+    IF_LOG Logger::println("CTFE JIT: compiling %s", fd->toPrettyChars());
+    LOG_SCOPE;
+    if (isEligible(fd))
+      info.entry = compile(fd);
+    if (!info.entry) {
+      info.failed = true;
+      return nullptr;
+    }
+    if (global.params.verbose)
+      message("ctfejit   %s", fd->toPrettyChars());
+  }
+
+  llvm::SmallVector<uint64_t, 8> args;
+  for (auto arg : *arguments) {
+    if (arg->op != TOKint64)
+      return nullptr;
+    args.push_back(arg->toInteger());
+  }
+
+  uint64_t result = 0;
+  info.entry(args.data(), &result);
+
+  auto tf = static_cast<TypeFunction *>(fd->type->toBasetype());
+  return IntegerExp::create(fd->loc, result, tf->next);
+}
+
+void ctfeJitFinish() {
+  finished = true;
+  engines.clear();
+  functionInfos.clear();
+}
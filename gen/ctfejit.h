@@ -0,0 +1,31 @@
+//===-- gen/ctfejit.h - Native execution of CTFE calls ----------*- C++ -*-===//
+//
+//                         LDC – the LLVM D compiler
+//
+// This file is distributed under the BSD-style LDC license. See the LICENSE
+// file for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Opt-in (-ctfe-jit) execution of frequently interpreted compile-time function
+// calls as native code: the function is compiled to a side LLVM module with
+// the regular codegen, JIT-compiled for the host and called directly instead of
+// being interpreted.
+//
+//===----------------------------------------------------------------------===//
+
+#pragma once
+
+#include "dmd/arraytypes.h"
+
+class Expression;
+class FuncDeclaration;
+
+/// Tries to evaluate a call of `fd` with the already interpreted `arguments`
+/// natively. Returns null if the function is not supported (or not called
+/// often enough yet), in which case the call is to be interpreted.
+Expression *ctfeJitCall(FuncDeclaration *fd, Expressions *arguments);
+
+/// Releases all JIT-compiled code. Must be called before the codegen of the
+/// modules starts; CTFE calls afterwards are always interpreted.
+void ctfeJitFinish();
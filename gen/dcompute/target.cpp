@@ -19,6 +19,9 @@
 #include "gen/dcompute/target.h"
 #include "gen/llvmhelpers.h"
 #include "gen/runtime.h"
+#include "gen/tollvm.h"
+#include "llvm/IR/Intrinsics.h"
+#include <algorithm>
 #include <string>
 
 void DComputeTarget::doCodeGen(Module *m) {
@@ -43,17 +46,60 @@ void DComputeTarget::emit(Module *m) {
   doCodeGen(m);
 }
 
-void DComputeTarget::writeModule() {
-  addMetadata();
+std::string DComputeTarget::getName() const {
+  std::string name;
+  llvm::raw_string_ostream os(name);
+  os << short_name << tversion << '_' << (global.params.is64bit ? 64 : 32);
+  return os.str();
+}
 
-  std::string filename;
-  llvm::raw_string_ostream os(filename);
-  os << opts::dcomputeFilePrefix << '_' << short_name << tversion << '_'
-     << (global.params.is64bit ? 64 : 32) << '.' << binSuffix;
+void DComputeTarget::emitBoundsCheckFailure(Loc &loc) {
+  if (opts::dcomputeBoundsFailure == opts::DComputeBoundsFailure_Trap) {
+    _ir->ir->CreateCall(
+        llvm::Intrinsic::getDeclaration(&_ir->module, llvm::Intrinsic::trap));
+    _ir->ir->CreateUnreachable();
+    return;
+  }
 
-  const char *path = FileName::combine(global.params.objdir, os.str().c_str());
+  // Record the line of the first failure in a global the host can read back
+  // after the launch, then leave the function; its results are meaningless.
+  const char *name = "__dcompute_bounds_error";
+  llvm::GlobalVariable *flag = _ir->module.getNamedGlobal(name);
+  if (!flag) {
+    auto i32 = LLType::getInt32Ty(ctx);
+    flag = new llvm::GlobalVariable(
+        _ir->module, i32, false, llvm::GlobalValue::ExternalLinkage,
+        llvm::ConstantInt::get(i32, 0), name, nullptr,
+        llvm::GlobalValue::NotThreadLocal, mapping[1]); // AddrSpace.Global
+  }
+  _ir->ir->CreateAtomicCmpXchg(flag, DtoConstUint(0),
+                               DtoConstUint(std::max(loc.linnum, 1u)),
+                               llvm::AtomicOrdering::Monotonic,
+                               llvm::AtomicOrdering::Monotonic);
 
-  ::writeModule(&_ir->module, path);
+  LLType *retType = _ir->topfunc()->getReturnType();
+  if (retType->isVoidTy()) {
+    _ir->ir->CreateRetVoid();
+  } else {
+    _ir->ir->CreateRet(llvm::UndefValue::get(retType));
+  }
+}
+
+void DComputeTarget::writeModule(ldc::ParallelModuleWriter *writer) {
+  addMetadata();
+
+  const std::string filename =
+      opts::dcomputeFilePrefix + '_' + getName() + '.' + binSuffix;
+  const char *path = FileName::combine(global.params.objdir, filename.c_str());
+  outputPath = path;
+
+  // OpenCL has no TargetMachine, SPIR-V is emitted by a writer pass.
+  auto &target = targetMachine ? *targetMachine : *gTargetMachine;
+  if (writer) {
+    writer->enqueue(target, _ir->module, path);
+  } else {
+    ::writeModule(target, &_ir->module, path);
+  }
 
   delete _ir;
   _ir = nullptr;
@@ -13,6 +13,9 @@
 #include "llvm/IR/LLVMContext.h"
 #include "llvm/IR/Function.h"
 #include <array>
+#include <string>
+#include <utility>
+#include <vector>
 
 namespace llvm {
 class Module;
@@ -22,6 +25,10 @@ class TargetMachine;
 
 class Module;
 class FuncDeclaration;
+struct Loc;
+namespace ldc {
+class ParallelModuleWriter;
+}
 
 class DComputeTarget {
 public:
@@ -39,6 +46,13 @@ public:
 
   IRState *_ir;
 
+  // Mangled names of the emitted kernels.
+  std::vector<std::string> kernelNames;
+  // Path of the kernel file, set by writeModule.
+  const char *outputPath = nullptr;
+  // Additional binaries produced by finalizeOutput(), as (name, path) pairs.
+  std::vector<std::pair<std::string, const char *>> extraOutputs;
+
   DComputeTarget(llvm::LLVMContext &c, int v, ID id, const char *_short_name,
                  const char *suffix, TargetABI *a, std::array<int, 5> map)
       : ctx(c), tversion(v), target(id), short_name(_short_name),
@@ -46,7 +60,17 @@ public:
 
   void emit(Module *m);
   void doCodeGen(Module *m);
-  void writeModule();
+  // Emits the module on a worker thread of `writer` if non-null.
+  void writeModule(ldc::ParallelModuleWriter *writer = nullptr);
+  // e.g. cuda350_64
+  std::string getName() const;
+
+  // Lowers a failed bounds check in device code, where druntime's
+  // _d_arraybounds is unavailable. See -mdcompute-bounds-failure.
+  void emitBoundsCheckFailure(Loc &loc);
+
+  // Runs after the kernel file has been written, e.g. to compile it further.
+  virtual void finalizeOutput() {}
 
   virtual void addMetadata() = 0;
   virtual void addKernelMetadata(FuncDeclaration *df, llvm::Function *llf) = 0;
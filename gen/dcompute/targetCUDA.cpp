@@ -9,6 +9,7 @@
 
 #if LDC_LLVM_SUPPORTED_TARGET_NVPTX
 
+#include "dmd/id.h"
 #include "gen/dcompute/target.h"
 #include "gen/dcompute/druntime.h"
 #include "gen/metadata.h"
@@ -16,12 +17,27 @@
 #include "gen/logger.h"
 #include "gen/optimizer.h"
 #include "gen/to_string.h"
+#include "gen/uda.h"
+#include "dmd/errors.h"
+#include "dmd/globals.h"
+#include "dmd/root/filename.h"
+#include "llvm/Support/CommandLine.h"
 #include "llvm/Target/TargetMachine.h"
 #include "llvm/Transforms/Scalar.h"
 #include "driver/targetmachine.h"
+#include "driver/tool.h"
 #include <cstring>
 
 namespace {
+llvm::cl::opt<bool> dcomputeCubin(
+    "mdcompute-cubin", llvm::cl::ZeroOrMore,
+    llvm::cl::desc("Additionally compile the PTX of CUDA targets to cubin "
+                   "files with ptxas"));
+
+llvm::cl::opt<std::string>
+    ptxas("ptxas", llvm::cl::desc("ptxas to use for -mdcompute-cubin"),
+          llvm::cl::Hidden, llvm::cl::ZeroOrMore);
+
 class TargetCUDA : public DComputeTarget {
 public:
   TargetCUDA(llvm::LLVMContext &c, int sm)
@@ -52,18 +68,55 @@ public:
     // sm version?
   }
 
+  void finalizeOutput() override {
+    if (!dcomputeCubin)
+      return;
+
+    assert(outputPath);
+    const char *cubin = FileName::forceExt(outputPath, "cubin");
+    std::vector<std::string> args = {
+        "-arch=sm_" + ldc::to_string(tversion / 10),
+        global.params.is64bit ? "-m64" : "-m32",
+        "-o",
+        cubin,
+        outputPath};
+    const int R = executeToolAndWait(getProgram("ptxas", &ptxas, "PTXAS"),
+                                     args, global.params.verbose);
+    if (R) {
+      error(Loc(), "Error while invoking ptxas for `%s`.", outputPath);
+      fatal();
+    }
+    extraOutputs.emplace_back(getName() + "_cubin", cubin);
+  }
+
   void addKernelMetadata(FuncDeclaration *df, llvm::Function *llf) override {
-    // TODO: Handle Function attibutes
     llvm::NamedMDNode *na =
         _ir->module.getOrInsertNamedMetadata("nvvm.annotations");
     llvm::Metadata *fn = llvm::ConstantAsMetadata::get(llf);
-    llvm::Metadata *kstr = llvm::MDString::get(ctx, "kernel");
-    llvm::Metadata *one = llvm::ConstantAsMetadata::get(
-        llvm::ConstantInt::get(llvm::IntegerType::get(ctx, 32), 1));
+    auto addAnnotation = [&](const char *name, unsigned value) {
+      llvm::Metadata *arr[] = {
+          fn, llvm::MDString::get(ctx, name),
+          llvm::ConstantAsMetadata::get(
+              llvm::ConstantInt::get(llvm::IntegerType::get(ctx, 32), value))};
+      na->addOperand(llvm::MDTuple::get(ctx, arr));
+    };
+
+    addAnnotation("kernel", 1);
 
-    llvm::Metadata *arr[] = {fn, kstr, one};
-    llvm::MDNode *tup = llvm::MDTuple::get(ctx, arr);
-    na->addOperand(tup);
+    // Same annotations as emitted by clang for __launch_bounds__ and
+    // reqd_work_group_size.
+    unsigned maxThreads, minBlocks;
+    if (getKernelLaunchBounds(df, maxThreads, minBlocks)) {
+      addAnnotation("maxntidx", maxThreads);
+      if (minBlocks != 0)
+        addAnnotation("minctasm", minBlocks);
+    }
+    unsigned dims[3];
+    if (getKernelWorkGroupSize(df, Id::udaReqdWorkGroupSize, dims)) {
+      addAnnotation("reqntidx", dims[0]);
+      addAnnotation("reqntidy", dims[1]);
+      addAnnotation("reqntidz", dims[2]);
+    }
   }
 };
 } // anonymous namespace.
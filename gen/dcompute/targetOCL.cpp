@@ -16,6 +16,7 @@
 #include "gen/dcompute/target.h"
 #include "gen/dcompute/druntime.h"
 #include "gen/logger.h"
+#include "gen/uda.h"
 #include "llvm/Transforms/Scalar.h"
 #include <cstring>
 #include <string>
@@ -98,7 +99,6 @@ public:
     // what the LLVM backend expects.
 
     unsigned i = 0;
-    // TODO: Handle Function attibutes
     llvm::SmallVector<llvm::Metadata *, 8> kernelMDArgs;
     kernelMDArgs.push_back(llvm::ConstantAsMetadata::get(llf));
     // MDNode for the kernel argument address space qualifiers.
@@ -126,9 +126,25 @@ public:
 
     for (auto &md : paramArgs)
       kernelMDArgs.push_back(llvm::MDNode::get(ctx, md));
-    ///-------------------------------
-    /// TODO: Handle Function attibutes
-    ///-------------------------------
+
+    // Function attributes, in the SPIR 1.2 form (as the kernel arguments).
+    auto addWorkGroupSize = [&](const Identifier *id, const char *name) {
+      unsigned dims[3];
+      if (!getKernelWorkGroupSize(fd, id, dims))
+        return;
+      llvm::Metadata *elts[] = {
+          llvm::MDString::get(ctx, name),
+          llvm::ConstantAsMetadata::get(
+              llvm::ConstantInt::get(llvm::Type::getInt32Ty(ctx), dims[0])),
+          llvm::ConstantAsMetadata::get(
+              llvm::ConstantInt::get(llvm::Type::getInt32Ty(ctx), dims[1])),
+          llvm::ConstantAsMetadata::get(
+              llvm::ConstantInt::get(llvm::Type::getInt32Ty(ctx), dims[2]))};
+      kernelMDArgs.push_back(llvm::MDNode::get(ctx, elts));
+    };
+    addWorkGroupSize(Id::udaReqdWorkGroupSize, "reqd_work_group_size");
+    addWorkGroupSize(Id::udaWorkGroupSizeHint, "work_group_size_hint");
+
     llvm::MDNode *kernelMDNode = llvm::MDNode::get(ctx, kernelMDArgs);
     llvm::NamedMDNode *OpenCLKernelMetadata =
         _ir->module.getOrInsertNamedMetadata("opencl.kernels");
@@ -18,6 +18,7 @@
 #include "dmd/root/rmem.h"
 #include "dmd/template.h"
 #include "driver/cl_options.h"
+#include "driver/sizereport.h"
 #include "gen/classes.h"
 #include "gen/functions.h"
 #include "gen/irstate.h"
@@ -149,6 +150,7 @@ public:
       auto initGlobal = llvm::cast<LLGlobalVariable>(initZ);
       initZ = irs->setGlobalVarInitializer(initGlobal, ir->getDefaultInit());
       setLinkage(decl, initGlobal);
+      sizereport::recordSymbol(initGlobal->getName(), decl);
 
       // emit typeinfo
       if (global.params.useTypeInfo && Type::dtypeinfo) {
@@ -201,9 +203,12 @@ public:
       auto initGlobal = llvm::cast<LLGlobalVariable>(initZ);
       initZ = irs->setGlobalVarInitializer(initGlobal, ir->getDefaultInit());
       setLinkage(decl, initGlobal);
+      sizereport::recordSymbol(initGlobal->getName(), decl);
 
       llvm::GlobalVariable *vtbl = ir->getVtblSymbol();
       defineGlobal(vtbl, ir->getVtblInit(), decl);
+      DtoAddVtblTypeMetadata(decl, vtbl);
+      irs->DBuilder.EmitClassType(decl);
 
       ir->defineInterfaceVtbls();
 
@@ -316,6 +321,8 @@ public:
 
         // Also set up the debug info.
         irs->DBuilder.EmitGlobalVariable(gvar, decl);
+
+        sizereport::recordSymbol(irGlobal->value->getName(), decl);
       }
 
       // If this global is used from a naked function, we need to create an
@@ -19,7 +19,9 @@
 #include "dmd/nspace.h"
 #include "dmd/template.h"
 #include "driver/cl_options.h"
+#include "driver/cl_options_instrumentation.h"
 #include "driver/ldc-version.h"
+#include "driver/toobj.h"
 #include "gen/functions.h"
 #include "gen/irstate.h"
 #include "gen/llvmhelpers.h"
@@ -59,12 +61,23 @@ llvm::StringRef uniqueIdent(Type *t) {
   return llvm::StringRef();
 }
 
-const char *getTemplateInstanceName(TemplateInstance *ti) {
-  const auto realParent = ti->parent;
-  ti->parent = nullptr;
-  const auto name = ti->toPrettyChars(true);
-  ti->parent = realParent;
-  return name;
+// Whether the full debug description of an aggregate is left to the object
+// file of its module (-flimit-debug-info). Like clang, this is limited to
+// classes, whose vtable is always defined by their module, which then
+// describes them (see DIBuilder::EmitClassType()). Structs and template
+// instances have no such home and are always described in full.
+bool isDescribedElsewhere(AggregateDeclaration *ad) {
+  if (!opts::limitDebugInfo)
+    return false;
+  ClassDeclaration *cd = ad->isClassDeclaration();
+  if (!cd || cd->isInterfaceDeclaration() || cd->isCPPclass())
+    return false;
+  for (Dsymbol *s = ad; s; s = s->parent) {
+    if (s->isTemplateInstance())
+      return false;
+  }
+  Module *m = ad->getModule();
+  return m && !m->isRoot();
 }
 
 llvm::StringRef processDIName(llvm::StringRef name) {
@@ -75,6 +88,14 @@ llvm::StringRef processDIName(llvm::StringRef name) {
 
 } // namespace
 
+const char *getTemplateInstanceName(TemplateInstance *ti) {
+  const auto realParent = ti->parent;
+  ti->parent = nullptr;
+  const auto name = ti->toPrettyChars(true);
+  ti->parent = realParent;
+  return name;
+}
+
 bool DIBuilder::mustEmitFullDebugInfo() {
   // only for -g and -gc
   // TODO: but not dcompute (yet)
@@ -98,7 +119,7 @@ bool DIBuilder::mustEmitLocationsDebugInfo() {
 ////////////////////////////////////////////////////////////////////////////////
 
 DIBuilder::DIBuilder(IRState *const IR)
-    : IR(IR), DBuilder(IR->module), CUNode(nullptr),
+    : IR(IR), DBuilder(new llvm::DIBuilder(IR->module)), CUNode(nullptr),
       isTargetMSVC(global.params.targetTriple->isWindowsMSVCEnvironment()),
       isTargetMSVCx64(isTargetMSVC &&
                       global.params.targetTriple->isArch64Bit()) {}
@@ -183,7 +204,7 @@ void DIBuilder::Declare(const Loc &loc, llvm::Value *storage,
                         DILocalVariable divar, DIExpression diexpr) {
   unsigned charnum = (loc.linnum ? loc.charnum : 0);
   auto debugLoc = llvm::DebugLoc::get(loc.linnum, charnum, GetCurrentScope());
-  DBuilder.insertDeclare(storage, divar, diexpr, debugLoc, IR->scopebb());
+  DBuilder->insertDeclare(storage, divar, diexpr, debugLoc, IR->scopebb());
 }
 
 // Sets the (current) value for a debuginfo variable.
@@ -191,7 +212,7 @@ void DIBuilder::SetValue(const Loc &loc, llvm::Value *value,
                          DILocalVariable divar, DIExpression diexpr) {
   unsigned charnum = (loc.linnum ? loc.charnum : 0);
   auto debugLoc = llvm::DebugLoc::get(loc.linnum, charnum, GetCurrentScope());
-  DBuilder.insertDbgValueIntrinsic(value,
+  DBuilder->insertDbgValueIntrinsic(value,
 #if LDC_LLVM_VER < 600
                                    0,
 #endif
@@ -205,7 +226,7 @@ DIFile DIBuilder::CreateFile(Loc &loc) {
   llvm::SmallString<128> path(filename);
   llvm::sys::fs::make_absolute(path);
 
-  return DBuilder.createFile(llvm::sys::path::filename(path),
+  return DBuilder->createFile(llvm::sys::path::filename(path),
                              llvm::sys::path::parent_path(path));
 }
 
@@ -301,7 +322,7 @@ DIType DIBuilder::CreateBasicType(Type *type) {
         "Unsupported basic type for debug info in DIBuilder::CreateBasicType");
   }
 
-  return DBuilder.createBasicType(type->toChars(),         // name
+  return DBuilder->createBasicType(type->toChars(),         // name
                                   getTypeAllocSize(T) * 8, // size (bits)
 #if LDC_LLVM_VER < 400
                                   getABITypeAlign(T) * 8, // align (bits)
@@ -324,7 +345,7 @@ DIType DIBuilder::CreateEnumType(Type *type) {
     EnumMember *em = m->isEnumMember();
     llvm::StringRef Name(em->toChars());
     uint64_t Val = em->value()->toInteger();
-    auto Subscript = DBuilder.createEnumerator(Name, Val);
+    auto Subscript = DBuilder->createEnumerator(Name, Val);
     subscripts.push_back(Subscript);
   }
 
@@ -333,11 +354,11 @@ DIType DIBuilder::CreateEnumType(Type *type) {
   const auto lineNumber = te->sym->loc.linnum;
   const auto file = CreateFile(te->sym);
 
-  return DBuilder.createEnumerationType(
+  return DBuilder->createEnumerationType(
       scope, name, file, lineNumber,
       getTypeAllocSize(T) * 8,               // size (bits)
       getABITypeAlign(T) * 8,                // align (bits)
-      DBuilder.getOrCreateArray(subscripts), // subscripts
+      DBuilder->getOrCreateArray(subscripts), // subscripts
       CreateTypeDescription(te->sym->memtype));
 }
 
@@ -360,7 +381,7 @@ DIType DIBuilder::CreatePointerType(Type *type) {
 
   const auto name = processDIName(type->toPrettyChars(true));
 
-  return DBuilder.createPointerType(CreateTypeDescription(nt),
+  return DBuilder->createPointerType(CreateTypeDescription(nt),
                                     getTypeAllocSize(T) * 8, // size (bits)
                                     getABITypeAlign(T) * 8,  // align (bits)
 #if LDC_LLVM_VER >= 500
@@ -381,13 +402,13 @@ DIType DIBuilder::CreateVectorType(Type *type) {
   if (te->toBasetype()->ty == Tvoid)
     te = Type::tuns8;
   int64_t Dim = tv->size(Loc()) / te->size(Loc());
-  LLMetadata *subscripts[] = {DBuilder.getOrCreateSubrange(0, Dim)};
+  LLMetadata *subscripts[] = {DBuilder->getOrCreateSubrange(0, Dim)};
 
-  return DBuilder.createVectorType(
+  return DBuilder->createVectorType(
       getTypeAllocSize(T) * 8,              // size (bits)
       getABITypeAlign(T) * 8,               // align (bits)
       CreateTypeDescription(te),            // element type
-      DBuilder.getOrCreateArray(subscripts) // subscripts
+      DBuilder->getOrCreateArray(subscripts) // subscripts
   );
 }
 
@@ -417,7 +438,7 @@ DIType DIBuilder::CreateComplexType(Type *type) {
       CreateMemberType(0, elemtype, file, "re", 0, Prot::public_),
       CreateMemberType(0, elemtype, file, "im", imoffset, Prot::public_)};
 
-  return DBuilder.createStructType(GetCU(),
+  return DBuilder->createStructType(GetCU(),
                                    t->toChars(),            // Name
                                    file,                    // File
                                    0,                       // LineNo
@@ -425,7 +446,7 @@ DIType DIBuilder::CreateComplexType(Type *type) {
                                    getABITypeAlign(T) * 8,  // alignment
                                    DIFlagZero,              // What here?
                                    getNullDIType(),         // derived from
-                                   DBuilder.getOrCreateArray(elems),
+                                   DBuilder->getOrCreateArray(elems),
                                    0,               // RunTimeLang
                                    getNullDIType(), // VTableHolder
                                    uniqueIdent(t)); // UniqueIdentifier
@@ -442,7 +463,7 @@ DIType DIBuilder::CreateTypedef(unsigned linnum, Type *type, DIFile file,
   // find base type
   DIType basetype = CreateTypeDescription(t);
 
-  return DBuilder.createTypedef(basetype, c_name, file, linnum, GetCU());
+  return DBuilder->createTypedef(basetype, c_name, file, linnum, GetCU());
 }
 
 DIType DIBuilder::CreateMemberType(unsigned linnum, Type *type, DIFile file,
@@ -478,7 +499,7 @@ DIType DIBuilder::CreateMemberType(unsigned linnum, Type *type, DIFile file,
   if (isStatic)
     Flags |= DIFlags::FlagStaticMember;
 
-  return DBuilder.createMemberType(scope,
+  return DBuilder->createMemberType(scope,
                                    c_name,                  // name
                                    file,                    // file
                                    linnum,                  // line number
@@ -565,11 +586,22 @@ DIType DIBuilder::CreateCompositeType(Type *type) {
   // if we don't know the aggregate's size, we don't know enough about it
   // to provide debug info. probably a forward-declared struct?
   if (ad->sizeok == SIZEOKnone) {
-    return DBuilder.createUnspecifiedType(name);
+    return DBuilder->createUnspecifiedType(name);
   }
 
   assert(GetCU() && "Compilation unit missing or corrupted");
 
+  const unsigned tag = (t->ty == Tstruct) ? llvm::dwarf::DW_TAG_structure_type
+                                          : llvm::dwarf::DW_TAG_class_type;
+
+  if (isDescribedElsewhere(ad)) {
+    const auto runtimeLang = 0;
+    irAggr->diCompositeType = DBuilder->createForwardDecl(
+        tag, name, scope, CreateFile(ad), ad->loc.linnum, runtimeLang, 0, 0,
+        uniqueIdent(t));
+    return irAggr->diCompositeType;
+  }
+
   // elements
   llvm::SmallVector<LLMetadata *, 16> elems;
 
@@ -585,10 +617,8 @@ DIType DIBuilder::CreateCompositeType(Type *type) {
   const auto uniqueIdentifier = uniqueIdent(t);
 
   // set diCompositeType to handle recursive types properly
-  unsigned tag = (t->ty == Tstruct) ? llvm::dwarf::DW_TAG_structure_type
-                                    : llvm::dwarf::DW_TAG_class_type;
   irAggr->diCompositeType =
-      DBuilder.createReplaceableCompositeType(tag, name, scope, file, lineNum);
+      DBuilder->createReplaceableCompositeType(tag, name, scope, file, lineNum);
 
   if (!ad->isInterfaceDeclaration()) // plain interfaces don't have one
   {
@@ -597,11 +627,11 @@ DIType DIBuilder::CreateCompositeType(Type *type) {
       derivedFrom = CreateCompositeType(classDecl->baseClass->getType());
       // needs a forward declaration to add inheritence information to elems
       const auto elemsArray = nullptr;
-      DIType fwd = DBuilder.createClassType(
+      DIType fwd = DBuilder->createClassType(
           scope, name, file, lineNum, sizeInBits, alignmentInBits,
           classOffsetInBits, DIFlags::FlagFwdDecl, derivedFrom, elemsArray,
           vtableHolder, templateParams, uniqueIdentifier);
-      auto dt = DBuilder.createInheritance(fwd,
+      auto dt = DBuilder->createInheritance(fwd,
                                            derivedFrom, // base class type
                                            0,           // offset of base class
 #if LDC_LLVM_VER >= 700
@@ -614,23 +644,23 @@ DIType DIBuilder::CreateCompositeType(Type *type) {
   }
   AddStaticMembers(ad, file, elems);
 
-  const auto elemsArray = DBuilder.getOrCreateArray(elems);
+  const auto elemsArray = DBuilder->getOrCreateArray(elems);
 
   DIType ret;
   if (t->ty == Tclass) {
-    ret = DBuilder.createClassType(
+    ret = DBuilder->createClassType(
         scope, name, file, lineNum, sizeInBits, alignmentInBits,
         classOffsetInBits, DIFlagZero, derivedFrom, elemsArray, vtableHolder,
         templateParams, uniqueIdentifier);
   } else {
     const auto runtimeLang = 0;
-    ret = DBuilder.createStructType(
+    ret = DBuilder->createStructType(
         scope, name, file, lineNum, sizeInBits, alignmentInBits, DIFlagZero,
         derivedFrom, elemsArray, runtimeLang, vtableHolder, uniqueIdentifier);
   }
 
   irAggr->diCompositeType =
-      DBuilder.replaceTemporary(llvm::TempDINode(irAggr->diCompositeType), ret);
+      DBuilder->replaceTemporary(llvm::TempDINode(irAggr->diCompositeType), ret);
   irAggr->diCompositeType = ret;
 
   return ret;
@@ -650,13 +680,13 @@ DIType DIBuilder::CreateArrayType(Type *type) {
       CreateMemberType(0, t->nextOf()->pointerTo(), file, "ptr",
                        global.params.is64bit ? 8 : 4, Prot::public_)};
 
-  return DBuilder.createStructType(scope, name, file,
+  return DBuilder->createStructType(scope, name, file,
                                    0,                       // LineNo
                                    getTypeAllocSize(T) * 8, // size in bits
                                    getABITypeAlign(T) * 8,  // alignment in bits
                                    DIFlagZero,              // What here?
                                    getNullDIType(),         // derived from
-                                   DBuilder.getOrCreateArray(elems),
+                                   DBuilder->getOrCreateArray(elems),
                                    0,               // RunTimeLang
                                    getNullDIType(), // VTableHolder
                                    uniqueIdent(t)); // UniqueIdentifier
@@ -672,7 +702,7 @@ DIType DIBuilder::CreateSArrayType(Type *type) {
   while (t->ty == Tsarray) {
     TypeSArray *tsa = static_cast<TypeSArray *>(t);
     int64_t Count = tsa->dim->toInteger();
-    auto subscript = DBuilder.getOrCreateSubrange(0, Count);
+    auto subscript = DBuilder->getOrCreateSubrange(0, Count);
     subscripts.push_back(subscript);
     t = t->nextOf();
   }
@@ -684,11 +714,11 @@ DIType DIBuilder::CreateSArrayType(Type *type) {
   else if (t->ty == Tfunction)
     t = t->pointerTo();
 
-  return DBuilder.createArrayType(
+  return DBuilder->createArrayType(
       getTypeAllocSize(T) * 8,              // size (bits)
       getABITypeAlign(T) * 8,               // align (bits)
       CreateTypeDescription(t),             // element type
-      DBuilder.getOrCreateArray(subscripts) // subscripts
+      DBuilder->getOrCreateArray(subscripts) // subscripts
   );
 }
 
@@ -711,13 +741,13 @@ DIType DIBuilder::CreateAArrayType(Type *type) {
       CreateTypedef(0, value, file, "__val_t"),
       CreateMemberType(0, Type::tvoidptr, file, "ptr", 0, Prot::public_)};
 
-  return DBuilder.createStructType(scope, name, file,
+  return DBuilder->createStructType(scope, name, file,
                                    0,                       // LineNo
                                    getTypeAllocSize(T) * 8, // size in bits
                                    getABITypeAlign(T) * 8,  // alignment in bits
                                    DIFlagZero,              // What here?
                                    getNullDIType(),         // derived from
-                                   DBuilder.getOrCreateArray(elems),
+                                   DBuilder->getOrCreateArray(elems),
                                    0,               // RunTimeLang
                                    getNullDIType(), // VTableHolder
                                    uniqueIdent(t)); // UniqueIdentifier
@@ -736,7 +766,7 @@ DISubroutineType DIBuilder::CreateFunctionType(Type *type) {
 
   // Create "dummy" subroutine type for the return type
   LLMetadata *params = {CreateTypeDescription(retType)};
-  auto paramsArray = DBuilder.getOrCreateTypeArray(params);
+  auto paramsArray = DBuilder->getOrCreateTypeArray(params);
 
   // The calling convention has to be recorded to distinguish
   // extern(D) functions from extern(C++) ones.
@@ -744,12 +774,12 @@ DISubroutineType DIBuilder::CreateFunctionType(Type *type) {
   assert(t->ctype);
   unsigned CC = t->ctype->getIrFuncTy().reverseParams ? DW_CC_D_dmd : 0;
 
-  return DBuilder.createSubroutineType(paramsArray, DIFlagZero, CC);
+  return DBuilder->createSubroutineType(paramsArray, DIFlagZero, CC);
 }
 
 DISubroutineType DIBuilder::CreateEmptyFunctionType() {
-  auto paramsArray = DBuilder.getOrCreateTypeArray(llvm::None);
-  return DBuilder.createSubroutineType(paramsArray);
+  auto paramsArray = DBuilder->getOrCreateTypeArray(llvm::None);
+  return DBuilder->createSubroutineType(paramsArray);
 }
 
 DIType DIBuilder::CreateDelegateType(Type *type) {
@@ -767,13 +797,13 @@ DIType DIBuilder::CreateDelegateType(Type *type) {
       CreateMemberType(0, t->next, file, "funcptr",
                        global.params.is64bit ? 8 : 4, Prot::public_)};
 
-  return DBuilder.createStructType(scope, name, file,
+  return DBuilder->createStructType(scope, name, file,
                                    0, // line number where defined
                                    getTypeAllocSize(T) * 8, // size in bits
                                    getABITypeAlign(T) * 8,  // alignment in bits
                                    DIFlagZero,              // flags
                                    getNullDIType(),         // derived from
-                                   DBuilder.getOrCreateArray(elems),
+                                   DBuilder->getOrCreateArray(elems),
                                    0,               // RunTimeLang
                                    getNullDIType(), // VTableHolder
                                    uniqueIdent(t)); // UniqueIdentifier
@@ -792,7 +822,7 @@ DIType DIBuilder::CreateTypeDescription(Type *type) {
   // Check for opaque enum first, Bugzilla 13792
   if (isOpaqueEnumType(type)) {
     const auto ed = static_cast<TypeEnum *>(type)->sym;
-    return DBuilder.createUnspecifiedType(ed->toChars());
+    return DBuilder->createUnspecifiedType(ed->toChars());
   }
 
   Type *t = type->toBasetype();
@@ -800,7 +830,7 @@ DIType DIBuilder::CreateTypeDescription(Type *type) {
   if (t->ty == Tvoid)
     return nullptr;
   if (t->ty == Tnull) // display null as void*
-    return DBuilder.createPointerType(CreateTypeDescription(Type::tvoid), 8, 8,
+    return DBuilder->createPointerType(CreateTypeDescription(Type::tvoid), 8, 8,
 #if LDC_LLVM_VER >= 500
                                       /* DWARFAddressSpace */ llvm::None,
 #endif
@@ -827,7 +857,7 @@ DIType DIBuilder::CreateTypeDescription(Type *type) {
     LLType *T = DtoType(t);
     const auto aggregateDIType = CreateCompositeType(type);
     const auto name = (aggregateDIType->getName() + "*").str();
-    return DBuilder.createPointerType(aggregateDIType, getTypeAllocSize(T) * 8,
+    return DBuilder->createPointerType(aggregateDIType, getTypeAllocSize(T) * 8,
                                       getABITypeAlign(T) * 8,
 #if LDC_LLVM_VER >= 500
                                       llvm::None,
@@ -873,7 +903,13 @@ void DIBuilder::EmitCompileUnit(Module *m) {
   Logger::println("D to dwarf compile_unit");
   LOG_SCOPE;
 
-  assert(!CUNode && "Already created compile unit for this DIBuilder instance");
+  // An llvm::DIBuilder only handles a single CU, so each module of a
+  // -singleobj compilation gets its own, after finalizing the previous one.
+  const bool isFirstCU = !CUNode;
+  if (!isFirstCU) {
+    DBuilder->finalize();
+    DBuilder.reset(new llvm::DIBuilder(IR->module));
+  }
 
   // prepare srcpath
   llvm::SmallString<128> srcpath(m->srcfile->name.toChars());
@@ -883,20 +919,31 @@ void DIBuilder::EmitCompileUnit(Module *m) {
   auto producerName =
       std::string("LDC ") + ldc_version + " (LLVM " + llvm_version + ")";
 
-  if (isTargetMSVC)
-    IR->module.addModuleFlag(llvm::Module::Warning, "CodeView", 1);
-  else if (global.params.dwarfVersion > 0)
-    IR->module.addModuleFlag(llvm::Module::Warning, "Dwarf Version",
-                             global.params.dwarfVersion);
-  // Metadata without a correct version will be stripped by UpgradeDebugInfo.
-  IR->module.addModuleFlag(llvm::Module::Warning, "Debug Info Version",
-                           llvm::DEBUG_METADATA_VERSION);
+  if (isFirstCU) {
+    if (isTargetMSVC)
+      IR->module.addModuleFlag(llvm::Module::Warning, "CodeView", 1);
+    else if (global.params.dwarfVersion > 0)
+      IR->module.addModuleFlag(llvm::Module::Warning, "Dwarf Version",
+                               global.params.dwarfVersion);
+    // Metadata without a correct version will be stripped by
+    // UpgradeDebugInfo.
+    IR->module.addModuleFlag(llvm::Module::Warning, "Debug Info Version",
+                             llvm::DEBUG_METADATA_VERSION);
+  }
 
-  CUNode = DBuilder.createCompileUnit(
+  // The skeleton CU refers to the .dwo file written next to the object file.
+  // With -singleobj, the object file name is only known at emission time.
+  std::string splitName;
+  if (opts::splitDwarf && !isTargetMSVC && !global.params.oneobj &&
+      m->objfile) {
+    splitName = getSplitDwarfFilename(m->objfile->name.toChars());
+  }
+
+  CUNode = DBuilder->createCompileUnit(
       global.params.symdebug == 2 ? llvm::dwarf::DW_LANG_C_plus_plus
                                   : llvm::dwarf::DW_LANG_D,
 #if LDC_LLVM_VER >= 400
-      DBuilder.createFile(llvm::sys::path::filename(srcpath),
+      DBuilder->createFile(llvm::sys::path::filename(srcpath),
                           llvm::sys::path::parent_path(srcpath)),
 #else
       llvm::sys::path::filename(srcpath), llvm::sys::path::parent_path(srcpath),
@@ -905,9 +952,14 @@ void DIBuilder::EmitCompileUnit(Module *m) {
       isOptimizationEnabled(), // isOptimized
       llvm::StringRef(),       // Flags TODO
       1,                       // Runtime Version TODO
-      llvm::StringRef(),       // SplitName
+      splitName,               // SplitName
       getDebugEmissionKind(),  // DebugEmissionKind
       0                        // DWOId
+#if LDC_LLVM_VER >= 500
+      ,
+      true,                                  // SplitDebugInlining
+      opts::isUsingSampleBasedPGOProfile()   // DebugInfoForProfiling
+#endif
   );
 }
 
@@ -922,7 +974,7 @@ DIModule DIBuilder::EmitModule(Module *m) {
 
   const auto name = processDIName(m->toPrettyChars(true));
 
-  irm->diModule = DBuilder.createModule(
+  irm->diModule = DBuilder->createModule(
       CUNode,
       name,              // qualified module name
       llvm::StringRef(), // (clang modules specific) ConfigurationMacros
@@ -936,7 +988,7 @@ DIModule DIBuilder::EmitModule(Module *m) {
 DINamespace DIBuilder::EmitNamespace(Dsymbol *sym, llvm::StringRef name) {
   name = processDIName(name);
   const bool exportSymbols = true;
-  return DBuilder.createNameSpace(GetSymbolScope(sym), name
+  return DBuilder->createNameSpace(GetSymbolScope(sym), name
 #if LDC_LLVM_VER < 500
                                   ,
                                   CreateFile(sym), sym->loc.linnum
@@ -955,7 +1007,7 @@ void DIBuilder::EmitImport(Import *im) {
 
   auto diModule = EmitModule(im->mod);
 
-  DBuilder.createImportedModule(GetCurrentScope(),
+  DBuilder->createImportedModule(GetCurrentScope(),
                                 diModule, // imported module
 #if LDC_LLVM_VER >= 500
                                 CreateFile(im), // file
@@ -1013,7 +1065,7 @@ DISubprogram DIBuilder::EmitSubProgram(FuncDeclaration *fd) {
     // A special case is `auto foo() { struct S{}; S s; return s; }`
     // The return type is a nested struct, so for this particular
     // chicken-and-egg case we need to create a temporary subprogram.
-    irFunc->diSubprogram = DBuilder.createTempFunctionFwdDecl(
+    irFunc->diSubprogram = DBuilder->createTempFunctionFwdDecl(
         scope, name, linkageName, file, lineNo, /*ty=*/nullptr,
 #if LDC_LLVM_VER < 800
         isLocalToUnit, isDefinition,
@@ -1036,7 +1088,7 @@ DISubprogram DIBuilder::EmitSubProgram(FuncDeclaration *fd) {
                            flags);
 
   if (mustEmitFullDebugInfo())
-    DBuilder.replaceTemporary(llvm::TempDINode(irFunc->diSubprogram), SP);
+    DBuilder->replaceTemporary(llvm::TempDINode(irFunc->diSubprogram), SP);
 
   irFunc->diSubprogram = SP;
   return SP;
@@ -1052,7 +1104,7 @@ DISubprogram DIBuilder::CreateFunction(DIScope scope, llvm::StringRef name,
   const auto dispFlags =
       llvm::DISubprogram::toSPFlags(isLocalToUnit, isDefinition, isOptimized);
 #endif
-  return DBuilder.createFunction(scope, name, linkageName, file, lineNo, ty,
+  return DBuilder->createFunction(scope, name, linkageName, file, lineNo, ty,
 #if LDC_LLVM_VER < 800
                                  isLocalToUnit, isDefinition,
 #endif
@@ -1110,8 +1162,8 @@ DISubprogram DIBuilder::EmitModuleCTor(llvm::Function *Fn,
 
   // Create "dummy" subroutine type for the return type
   LLMetadata *params = {CreateTypeDescription(Type::tvoid)};
-  auto paramsArray = DBuilder.getOrCreateTypeArray(params);
-  auto DIFnType = DBuilder.createSubroutineType(paramsArray);
+  auto paramsArray = DBuilder->getOrCreateTypeArray(params);
+  auto DIFnType = DBuilder->createSubroutineType(paramsArray);
 
   const auto scope = GetCurrentScope();
   const auto linkageName = Fn->getName();
@@ -1162,7 +1214,7 @@ void DIBuilder::EmitBlockStart(Loc &loc) {
   LOG_SCOPE;
 
   DILexicalBlock block =
-      DBuilder.createLexicalBlock(GetCurrentScope(),           // scope
+      DBuilder->createLexicalBlock(GetCurrentScope(),           // scope
                                   CreateFile(loc),             // file
                                   loc.linnum,                  // line
                                   loc.linnum ? loc.charnum : 0 // column
@@ -1212,20 +1264,23 @@ void DIBuilder::EmitStopPoint(Loc &loc) {
 Loc DIBuilder::GetCurrentLoc() const { return currentLoc; }
 
 void DIBuilder::EmitValue(llvm::Value *val, VarDeclaration *vd) {
+  if (!mustEmitFullDebugInfo())
+    return;
+
   auto sub = IR->func()->variableMap.find(vd);
   if (sub == IR->func()->variableMap.end())
     return;
 
   DILocalVariable debugVariable = sub->second;
-  if (!mustEmitFullDebugInfo() || !debugVariable)
+  if (!debugVariable)
     return;
 
-  llvm::Instruction *instr = DBuilder.insertDbgValueIntrinsic(
+  llvm::Instruction *instr = DBuilder->insertDbgValueIntrinsic(
       val,
 #if LDC_LLVM_VER < 600
       0,
 #endif
-      debugVariable, DBuilder.createExpression(),
+      debugVariable, DBuilder->createExpression(),
       IR->ir->getCurrentDebugLocation(), IR->scopebb());
   instr->setDebugLoc(IR->ir->getCurrentDebugLocation());
 }
@@ -1285,7 +1340,7 @@ void DIBuilder::EmitLocalVariable(llvm::Value *ll, VarDeclaration *vd,
     useDbgValueIntrinsic = !isSpecialRefVar(vd) && isRefRVal;
     // Note: createReferenceType expects the size to be the size of a pointer,
     // not the size of the type the reference refers to.
-    TD = DBuilder.createReferenceType(
+    TD = DBuilder->createReferenceType(
         Tag, TD,
         gDataLayout->getPointerSizeInBits(), // size (bits)
         DtoAlignment(type) * 8);             // align (bits)
@@ -1317,25 +1372,36 @@ void DIBuilder::EmitLocalVariable(llvm::Value *ll, VarDeclaration *vd,
         argNo++;
     }
 
-    debugVariable = DBuilder.createParameterVariable(
+    debugVariable = DBuilder->createParameterVariable(
         scope, name, argNo + 1, file, lineNum, TD, preserve, flags);
   } else {
-    debugVariable = DBuilder.createAutoVariable(scope, name, file, lineNum, TD,
+    debugVariable = DBuilder->createAutoVariable(scope, name, file, lineNum, TD,
                                                 preserve, flags);
   }
   variableMap[vd] = debugVariable;
 
   if (useDbgValueIntrinsic) {
     SetValue(vd->loc, ll, debugVariable,
-             addr.empty() ? DBuilder.createExpression()
-                          : DBuilder.createExpression(addr));
+             addr.empty() ? DBuilder->createExpression()
+                          : DBuilder->createExpression(addr));
   } else {
     Declare(vd->loc, ll, debugVariable,
-            addr.empty() ? DBuilder.createExpression()
-                         : DBuilder.createExpression(addr));
+            addr.empty() ? DBuilder->createExpression()
+                         : DBuilder->createExpression(addr));
   }
 }
 
+void DIBuilder::EmitClassType(ClassDeclaration *cd) {
+  if (!opts::limitDebugInfo || !mustEmitFullDebugInfo() ||
+      cd->isInterfaceDeclaration() || cd->isCPPclass())
+    return;
+
+  Logger::println("D to dwarf class type");
+  LOG_SCOPE;
+
+  DBuilder->retainType(CreateCompositeType(cd->type));
+}
+
 void DIBuilder::EmitGlobalVariable(llvm::GlobalVariable *llVar,
                                    VarDeclaration *vd) {
   if (!mustEmitFullDebugInfo())
@@ -1360,9 +1426,9 @@ void DIBuilder::EmitGlobalVariable(llvm::GlobalVariable *llVar,
   mangleToBuffer(vd, &mangleBuf);
 
 #if LDC_LLVM_VER >= 400
-  auto DIVar = DBuilder.createGlobalVariableExpression(
+  auto DIVar = DBuilder->createGlobalVariableExpression(
 #else
-  DBuilder.createGlobalVariable(
+  DBuilder->createGlobalVariable(
 #endif
       scope,                                 // context
       vd->toChars(),                         // name
@@ -1388,7 +1454,7 @@ void DIBuilder::Finalize() {
   if (!mustEmitLocationsDebugInfo())
     return;
 
-  DBuilder.finalize();
+  DBuilder->finalize();
 }
 
 } // namespace ldc
@@ -17,6 +17,7 @@
 #include "llvm/IR/DebugInfo.h"
 #include "llvm/IR/DIBuilder.h"
 #include "llvm/IR/Type.h"
+#include <memory>
 
 struct IRState;
 
@@ -25,6 +26,7 @@ class Dsymbol;
 class FuncDeclaration;
 class Import;
 class Module;
+class TemplateInstance;
 class Type;
 class VarDeclaration;
 
@@ -42,6 +44,10 @@ extern const llvm::DataLayout *gDataLayout;
 
 namespace ldc {
 
+/// Returns the name of a template instance with its (fully qualified)
+/// arguments, but without its parent scope, e.g. `sort!(int[])`.
+const char *getTemplateInstanceName(TemplateInstance *ti);
+
 // Define some basic types
 using DIType = llvm::DIType *;
 using DICompositeType = llvm::DICompositeType *;
@@ -66,7 +72,7 @@ using DIFlags = llvm::DINode;
 
 class DIBuilder {
   IRState *const IR;
-  llvm::DIBuilder DBuilder;
+  std::unique_ptr<llvm::DIBuilder> DBuilder;
 
   DICompileUnit CUNode;
 
@@ -156,6 +162,10 @@ public:
                     bool isRefRVal = false,
                     llvm::ArrayRef<int64_t> addr = llvm::ArrayRef<int64_t>());
 
+  /// \brief Emits the full description of a class defined by the current
+  /// module, for other modules to refer to with -flimit-debug-info.
+  void EmitClassType(ClassDeclaration *cd);
+
   /// \brief Emits all things necessary for making debug info for a global
   /// variable vd.
   /// \param ll       LLVM global variable
@@ -15,6 +15,7 @@
 #include "gen/llvmhelpers.h"
 #include "gen/logger.h"
 #include "gen/optimizer.h"
+#include "gen/tbaa.h"
 #include "gen/tollvm.h"
 #include "llvm/IR/MDBuilder.h"
 
@@ -120,7 +121,8 @@ bool DFuncValue::definedInFuncEntryBB() {
 
 ////////////////////////////////////////////////////////////////////////////////
 
-DLValue::DLValue(Type *t, LLValue *v) : DValue(t, v) {
+DLValue::DLValue(Type *t, LLValue *v, llvm::MDNode *tbaaTag)
+    : DValue(t, v), tbaaTag(tbaaTag) {
   // v may be an addrspace qualified pointer so strip it before doing a pointer
   // equality check.
   assert(t->toBasetype()->ty == Ttuple ||
@@ -134,6 +136,7 @@ DRValue *DLValue::getRVal() {
   }
 
   LLValue *rval = DtoLoad(val);
+  TBAABuilder::attach(llvm::cast<llvm::LoadInst>(rval), getTBAATag());
 
   const auto ty = type->toBasetype()->ty;
   if (ty == Tbool) {
@@ -156,6 +159,10 @@ DRValue *DLValue::getRVal() {
   return new DImValue(type, rval);
 }
 
+llvm::MDNode *DLValue::getTBAATag() {
+  return tbaaTag ? tbaaTag : gIR->tbaa.getAccessTag(type);
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 
 DSpecialRefValue::DSpecialRefValue(Type *t, LLValue *v) : DLValue(v, t) {
@@ -27,6 +27,7 @@ namespace llvm {
 class Value;
 class Type;
 class Constant;
+class MDNode;
 }
 
 class DValue;
@@ -150,17 +151,24 @@ public:
 /// keep structs and static arrays in memory.
 class DLValue : public DValue {
 public:
-  DLValue(Type *t, llvm::Value *v);
+  DLValue(Type *t, llvm::Value *v, llvm::MDNode *tbaaTag = nullptr);
 
   DRValue *getRVal() override;
   virtual DLValue *getLVal() { return this; }
 
   DLValue *isLVal() override { return this; }
 
+  /// Returns the TBAA access tag for loads and stores of the value (by
+  /// default derived from its type), or null.
+  llvm::MDNode *getTBAATag();
+
 protected:
   DLValue(llvm::Value *v, Type *t) : DValue(t, v) {}
 
   friend llvm::Value *DtoLVal(DValue *v);
+
+private:
+  llvm::MDNode *const tbaaTag = nullptr;
 };
 
 /// Represents special internal ref variables.
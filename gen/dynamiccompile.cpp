@@ -14,11 +14,18 @@
 #include <unordered_map>
 #include <unordered_set>
 
+#include "dmd/aggregate.h"
+#include "dmd/declaration.h"
+#include "dmd/expression.h"
+#include "dmd/mtype.h"
 #include "driver/cl_options.h"
 
 #include "gen/irstate.h"
 #include "gen/llvm.h"
+#include "gen/llvmhelpers.h"
+#include "gen/tollvm.h"
 #include "ir/irfunction.h"
+#include "ir/irvar.h"
 #include "llvm/Bitcode/BitcodeWriter.h"
 #include "llvm/IR/TypeBuilder.h"
 #include "llvm/Transforms/Utils/Cloning.h"
@@ -30,6 +37,9 @@ enum { ApiVersion = LDC_DYNAMIC_COMPILE_API_VERSION };
 
 const char *DynamicCompileModulesHeadName = "dynamiccompile_modules_head";
 
+// Must match the jit runtime (runtime/jit-rt/cpp-so/optimizer.cpp).
+const char *DynamicCompileSlicesMetadataName = "ldc.dynamic_compile.slices";
+
 llvm::GlobalValue *getPredefinedSymbol(llvm::Module &module,
                                        llvm::StringRef name, llvm::Type *type) {
   assert(nullptr != type);
@@ -83,6 +93,7 @@ template <typename F> void enumFuncSymbols(llvm::Function *fun, F &&handler) {
 enum class GlobalValVisibility {
   Internal,
   External,
+  AvailableExternally,
   Declaration,
 };
 
@@ -109,6 +120,19 @@ void getPredefinedSymbols(IRState *irs, GlobalValsMap &symList) {
   }
 }
 
+// Functions which are statically compiled anyway, and whose IR is only
+// embedded so that the dynamically compiled code can inline them. Calls which
+// aren't inlined are resolved to the statically compiled version.
+bool isInlineOnlyFunction(IRState *irs, const llvm::Function &fun) {
+  if (fun.hasAvailableExternallyLinkage()) {
+    // @dynamicCompileInline function from another module
+    return true;
+  }
+  return !fun.hasLocalLinkage() &&
+         contains(irs->dynamicCompileInlineFunctions,
+                  const_cast<llvm::Function *>(&fun));
+}
+
 GlobalValsMap createGlobalValsFilter(IRState *irs) {
   assert(nullptr != irs);
   GlobalValsMap ret;
@@ -139,7 +163,9 @@ GlobalValsMap createGlobalValsFilter(IRState *irs) {
           if (it.second && !gv->isDeclaration()) {
             if (auto newFun = llvm::dyn_cast<llvm::Function>(gv)) {
               if (!newFun->isIntrinsic()) {
-                it.first->second = GlobalValVisibility::Internal;
+                it.first->second = isInlineOnlyFunction(irs, *newFun)
+                                       ? GlobalValVisibility::AvailableExternally
+                                       : GlobalValVisibility::Internal;
                 functionsToAdd.push_back(newFun);
               }
             }
@@ -186,6 +212,19 @@ void stripModule(llvm::Module &module) {
   stripDeclarations(module.globals());
 }
 
+void makeInlineOnlyFunctionsAvailable(llvm::Module &newModule,
+                                      const GlobalValsMap &filter) {
+  for (auto &&it : filter) {
+    if (it.second != GlobalValVisibility::AvailableExternally) {
+      continue;
+    }
+    auto func = newModule.getFunction(it.first->getName());
+    assert(nullptr != func);
+    func->setLinkage(llvm::GlobalValue::AvailableExternallyLinkage);
+    func->setComdat(nullptr);
+  }
+}
+
 void fixRtModule(llvm::Module &newModule,
                  const decltype(IRState::dynamicCompiledFunctions) &funcs) {
   std::unordered_map<std::string, std::string> thunkVar2func;
@@ -317,23 +356,37 @@ void replaceDynamicThreadLocals(llvm::Module &oldModule,
     auto dstFunc = llvm::Function::Create(srcFunc->getFunctionType(),
                                           llvm::GlobalValue::ExternalLinkage,
                                           srcFunc->getName(), &newModule);
+    // The address of a thread local is constant for the calling thread, so
+    // the optimizer may CSE the calls and hoist them out of loops.
+    dstFunc->addFnAttr(llvm::Attribute::ReadNone);
+    dstFunc->addFnAttr(llvm::Attribute::NoUnwind);
     threadLocalAccessors.insert({var, dstFunc});
     valsMap.insert({srcFunc, GlobalValVisibility::Declaration});
     return dstFunc;
   };
 
   for (auto &&fun : newModule.functions()) {
+    if (fun.isDeclaration()) {
+      continue;
+    }
+
+    // Get the address of each accessed thread local once per function call, in
+    // the entry block (also valid for PHI operands).
+    std::unordered_map<llvm::GlobalVariable *, llvm::Value *> addresses;
+    llvm::IRBuilder<> builder(&*fun.getEntryBlock().getFirstInsertionPt());
     iterateFuncInstructions(fun, [&](llvm::Instruction &instr) -> bool {
       bool changed = false;
       for (unsigned int i = 0; i < instr.getNumOperands(); ++i) {
         auto op = instr.getOperand(i);
         if (auto globalVar = llvm::dyn_cast<llvm::GlobalVariable>(op)) {
           if (globalVar->isThreadLocal()) {
-            auto accessor = getAccessor(globalVar);
-            assert(nullptr != accessor);
-            auto callResult = llvm::CallInst::Create(accessor);
-            callResult->insertBefore(&instr);
-            instr.setOperand(i, callResult);
+            auto &address = addresses[globalVar];
+            if (nullptr == address) {
+              auto accessor = getAccessor(globalVar);
+              assert(nullptr != accessor);
+              address = builder.CreateCall(accessor);
+            }
+            instr.setOperand(i, address);
             changed = true;
           }
         }
@@ -772,6 +825,88 @@ void createThunkFunc(llvm::Module &module, const llvm::Function *src,
   }
 }
 
+using SlicePath = llvm::SmallVector<unsigned, 4>;
+
+// Collects the GEP index paths to the slices contained in a value of type
+// `type`, appended to `path`.
+void collectSlicePaths(Type *type, SlicePath &path,
+                       std::vector<SlicePath> &paths) {
+  Type *t = type->toBasetype();
+  switch (t->ty) {
+  case Tarray:
+    paths.push_back(path);
+    break;
+  case Tsarray: {
+    SlicePath elemPath;
+    std::vector<SlicePath> elemPaths;
+    collectSlicePaths(t->nextOf(), elemPath, elemPaths);
+    if (elemPaths.empty()) {
+      break;
+    }
+    const auto dim = static_cast<TypeSArray *>(t)->dim->toUInteger();
+    for (uinteger_t i = 0; i < dim; ++i) {
+      for (auto &&p : elemPaths) {
+        SlicePath fullPath = path;
+        fullPath.push_back(static_cast<unsigned>(i));
+        fullPath.append(p.begin(), p.end());
+        paths.push_back(std::move(fullPath));
+      }
+    }
+    break;
+  }
+  case Tstruct: {
+    auto sd = static_cast<TypeStruct *>(t)->sym;
+    // The active member of a union isn't known.
+    if (sd->isUnionDeclaration()) {
+      break;
+    }
+    DtoType(sd->type);
+    for (auto field : sd->fields) {
+      if (field->overlapped) {
+        continue;
+      }
+      path.push_back(getFieldGEPIndex(sd, field));
+      collectSlicePaths(field->type, path, paths);
+      path.pop_back();
+    }
+    break;
+  }
+  default:
+    break;
+  }
+}
+
+// Lists the slices in the dynamicCompileConst variables, so that the jit
+// runtime can fold their contents (and not only their length and pointer)
+// into the jitted code.
+void addSlicesMetadata(IRState *irs, llvm::Module &module) {
+  assert(nullptr != irs);
+  auto &context = module.getContext();
+  llvm::NamedMDNode *slices = nullptr;
+  SlicePath path;
+  std::vector<SlicePath> paths;
+  for (auto &&var : irs->dynamicCompiledVars) {
+    paths.clear();
+    collectSlicePaths(var->V->type, path, paths);
+    if (paths.empty()) {
+      continue;
+    }
+    if (nullptr == slices) {
+      slices = module.getOrInsertNamedMetadata(DynamicCompileSlicesMetadataName);
+    }
+    const auto name = var->value->getName();
+    for (auto &&p : paths) {
+      llvm::SmallVector<llvm::Metadata *, 8> ops;
+      ops.push_back(llvm::MDString::get(context, name));
+      for (auto index : p) {
+        ops.push_back(llvm::ConstantAsMetadata::get(
+            llvm::ConstantInt::get(llvm::Type::getInt32Ty(context), index)));
+      }
+      slices->addOperand(llvm::MDTuple::get(context, ops));
+    }
+  }
+}
+
 } // anon namespace
 
 void generateBitcodeForDynamicCompile(IRState *irs) {
@@ -795,10 +930,12 @@ void generateBitcodeForDynamicCompile(IRState *irs) {
                it->second != GlobalValVisibility::Declaration;
       });
   removeFunctionsTargets(irs, *newModule);
+  makeInlineOnlyFunctionsAvailable(*newModule, filter);
   if (opts::dynamicCompileTlsWorkaround) {
     replaceDynamicThreadLocals(irs->module, *newModule, filter);
   }
   fixRtModule(*newModule, irs->dynamicCompiledFunctions);
+  addSlicesMetadata(irs, *newModule);
 
   setupModuleBitcodeData(*newModule, irs, filter);
 }
@@ -835,11 +972,13 @@ void defineDynamicCompiledFunction(IRState *irs, IrFunction *func) {
     auto srcFunc = func->getLLVMFunc();
     auto it = irs->dynamicCompiledFunctions.find(srcFunc);
     assert(irs->dynamicCompiledFunctions.end() != it);
+    // Until the jitted code is ready, the thunk calls the statically compiled
+    // version of the function, so the program can run before
+    // compileDynamicCode() finished.
     auto thunkVarType = srcFunc->getFunctionType()->getPointerTo();
     auto thunkVar = new llvm::GlobalVariable(
         irs->module, thunkVarType, false, llvm::GlobalValue::PrivateLinkage,
-        llvm::ConstantPointerNull::get(thunkVarType),
-        ".rtcompile_thunkvar_" + srcFunc->getName());
+        srcFunc, ".rtcompile_thunkvar_" + srcFunc->getName());
     auto dstFunc = it->second.thunkFunc;
     createThunkFunc(irs->module, srcFunc, dstFunc, thunkVar);
     it->second.thunkVar = thunkVar;
@@ -864,6 +1003,17 @@ void addDynamicCompiledVar(IRState *irs, IrGlobal *var) {
   irs->dynamicCompiledVars.insert(var);
 }
 
+void addDynamicCompileInlineFunction(IRState *irs, IrFunction *func) {
+  assert(nullptr != irs);
+  assert(nullptr != func);
+  assert(nullptr != func->getLLVMFunc());
+  if (!opts::enableDynamicCompile) {
+    return;
+  }
+
+  irs->dynamicCompileInlineFunctions.insert(func->getLLVMFunc());
+}
+
 #else // defined(LDC_DYNAMIC_COMPILE)
 
 void generateBitcodeForDynamicCompile(IRState *) {
@@ -882,4 +1032,8 @@ void addDynamicCompiledVar(IRState *, IrGlobal *) {
   // nothing
 }
 
+void addDynamicCompileInlineFunction(IRState *, IrFunction *) {
+  // nothing
+}
+
 #endif
@@ -21,3 +21,4 @@ void generateBitcodeForDynamicCompile(IRState *irs);
 void declareDynamicCompiledFunction(IRState *irs, IrFunction *func);
 void defineDynamicCompiledFunction(IRState *irs, IrFunction *func);
 void addDynamicCompiledVar(IRState *irs, IrGlobal *var);
+void addDynamicCompileInlineFunction(IRState *irs, IrFunction *func);
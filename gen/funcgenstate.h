@@ -21,13 +21,17 @@
 #include "llvm/IR/CallSite.h"
 #include <vector>
 
+class CallExp;
+class DtorExpStatement;
 class Identifier;
 struct IRState;
 class Statement;
+class Type;
 
 namespace llvm {
 class AllocaInst;
 class BasicBlock;
+class CallInst;
 class Constant;
 class MDNode;
 class Value;
@@ -160,6 +164,22 @@ private:
   llvm::DenseMap<Statement *, llvm::BasicBlock *> targetBBs;
 };
 
+/// The coroutine of a generator function (see gen/coroutines.h).
+struct GeneratorState {
+  /// The `llvm.coro.id` call, patched with the promise by the first yield.
+  llvm::CallInst *id = nullptr;
+  llvm::Value *handle = nullptr;
+
+  /// The type of the yielded values and their stack slot.
+  Type *yieldType = nullptr;
+  llvm::AllocaInst *promise = nullptr;
+
+  /// Entered when the generator is destroyed, after running the cleanups.
+  llvm::BasicBlock *cleanupBB = nullptr;
+  /// Returns the handle to the caller of the ramp or resume function.
+  llvm::BasicBlock *suspendBB = nullptr;
+};
+
 /// The "global" transitory state necessary for emitting the body of a certain
 /// function.
 ///
@@ -198,6 +218,20 @@ public:
   /// value.
   llvm::AllocaInst *retValSlot = nullptr;
 
+  /// Last-use moves (see gen/moveelision.h): the postblit calls to skip and
+  /// the destructor statements to guard, with the 'moved-from' flags of the
+  /// variables.
+  llvm::DenseMap<CallExp *, llvm::AllocaInst *> elidedPostblits;
+  llvm::DenseMap<DtorExpStatement *, llvm::AllocaInst *> guardedDtors;
+
+  /// Set up for generator functions only.
+  GeneratorState generator;
+
+  /// The allocas of the local variables declared in the scopes being emitted
+  /// (innermost last), whose lifetime ends with their scope. Only tracked when
+  /// optimizing, see ScopeStatement in gen/statements.cpp.
+  std::vector<std::vector<llvm::AllocaInst *>> scopedLocals;
+
   /// Emits a call or invoke to the given callee, depending on whether there
   /// are catches/cleanups active or not.
   llvm::CallSite callOrInvoke(llvm::Value *callee,
@@ -17,56 +17,161 @@
 #include "dmd/module.h"
 #include "dmd/statement.h"
 #include "dmd/template.h"
+#include "driver/cl_options.h"
+#include "driver/cl_options_instrumentation.h"
 #include "gen/logger.h"
+#include "gen/mangling.h"
 #include "gen/optimizer.h"
 #include "gen/recursivevisitor.h"
 #include "gen/uda.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ProfileData/InstrProfReader.h"
+#include "llvm/Support/CommandLine.h"
+#include <algorithm>
+#include <functional>
+#include <vector>
 
 namespace {
 
-/// An ASTVisitor that checks whether the number of statements is larger than a
-/// certain number.
-struct MoreThanXStatements : public StoppableVisitor {
-  /// Are there more or fewer statements than `threshold`?.
+llvm::cl::opt<unsigned> inlineCostThreshold(
+    "cross-module-inline-threshold", llvm::cl::ZeroOrMore, llvm::cl::init(100),
+    llvm::cl::value_desc("cost"),
+    llvm::cl::desc("Maximum estimated cost of functions from other modules to "
+                   "be made available for cross-module inlining"));
+
+llvm::cl::opt<unsigned> inlineHotCostThreshold(
+    "cross-module-inline-hot-threshold", llvm::cl::ZeroOrMore,
+    llvm::cl::init(400), llvm::cl::value_desc("cost"),
+    llvm::cl::desc("Maximum estimated cost of functions from other modules "
+                   "that are hot according to -fprofile-instr-use"));
+
+/// An ASTVisitor that estimates the code size of a function body, stopping as
+/// soon as the estimate exceeds a threshold.
+/// Each statement and expression node costs 1, with surcharges for constructs
+/// that expand to much more code (calls, allocations, loops, exception
+/// handling).
+struct InlineCostEstimator : public StoppableVisitor {
+  /// Stop when the cost exceeds `threshold`.
   unsigned threshold;
-  /// The statement count.
-  unsigned count;
+  /// The estimated cost.
+  unsigned cost;
 
-  explicit MoreThanXStatements(unsigned X) : threshold(X), count(0) {}
+  explicit InlineCostEstimator(unsigned X) : threshold(X), cost(0) {}
 
-  using StoppableVisitor::visit;
-
-  void visit(Statement *stmt) override {
-    count++;
-    if (count > threshold)
+  void add(unsigned c) {
+    cost += c;
+    if (cost > threshold)
       stop = true;
   }
-  void visit(Expression *exp) override {}
-  void visit(Declaration *decl) override {}
-  void visit(Initializer *init) override {}
+
+  using StoppableVisitor::visit;
+
+  void visit(Statement *) override { add(1); }
+  void visit(WhileStatement *) override { add(10); }
+  void visit(DoStatement *) override { add(10); }
+  void visit(ForStatement *) override { add(10); }
+  void visit(ForeachStatement *) override { add(10); }
+  void visit(ForeachRangeStatement *) override { add(10); }
+  void visit(SwitchStatement *) override { add(5); }
+  void visit(TryCatchStatement *) override { add(10); }
+  void visit(TryFinallyStatement *) override { add(5); }
+  void visit(ThrowStatement *) override { add(5); }
+  void visit(InlineAsmStatement *) override { add(10); }
+
+  void visit(Expression *) override { add(1); }
+  void visit(CallExp *) override { add(5); }
+  void visit(NewExp *) override { add(10); }
+  void visit(CatExp *) override { add(10); }
+  void visit(AssertExp *) override { add(3); }
+
+  void visit(Declaration *) override {}
+  void visit(Initializer *) override {}
   void visit(Dsymbol *) override {}
 };
 
+/// Function entry counts of the -fprofile-instr-use profile, keyed by PGO
+/// function name, and the count from which on a function is considered hot.
+struct ProfileEntryCounts {
+  llvm::StringMap<uint64_t> counts;
+  uint64_t hotThreshold = 0;
+
+  ProfileEntryCounts() {
+    // Only the frontend-based PGO counters start with the function entry.
+    if (!opts::isUsingASTBasedPGOProfile() || !global.params.datafileInstrProf)
+      return;
+
+    auto readerOrErr =
+        llvm::IndexedInstrProfReader::create(global.params.datafileInstrProf);
+    if (auto E = readerOrErr.takeError()) {
+      llvm::consumeError(std::move(E));
+      return; // reported by the module codegen
+    }
+
+    std::vector<uint64_t> sorted;
+    uint64_t total = 0;
+    for (const auto &record : *readerOrErr.get()) {
+      if (record.Counts.empty())
+        continue;
+      uint64_t &count = counts[record.Name];
+      count = std::max(count, record.Counts[0]);
+      sorted.push_back(record.Counts[0]);
+      total += record.Counts[0];
+    }
+
+    // Hot are the functions accounting for 99% of all function entries.
+    std::sort(sorted.begin(), sorted.end(), std::greater<uint64_t>());
+    uint64_t sum = 0;
+    for (uint64_t count : sorted) {
+      sum += count;
+      hotThreshold = count;
+      if (sum >= total - total / 100)
+        break;
+    }
+  }
+};
+
+enum class Hotness { Unknown, Cold, Hot };
+
+Hotness getProfileHotness(FuncDeclaration &fdecl) {
+  static ProfileEntryCounts profile;
+  if (profile.counts.empty())
+    return Hotness::Unknown;
+
+  const auto it = profile.counts.find(getIRMangledName(&fdecl, LINKd));
+  if (it == profile.counts.end())
+    return Hotness::Unknown;
+  if (it->second == 0)
+    return Hotness::Cold;
+  return it->second >= profile.hotThreshold ? Hotness::Hot : Hotness::Unknown;
+}
+
 // Use a heuristic to determine if it could make sense to inline this fdecl.
 // Note: isInlineCandidate is called _before_ semantic3 analysis of fdecl.
 bool isInlineCandidate(FuncDeclaration &fdecl) {
   // Giving maximum inlining potential to LLVM should be possible, but we
   // restrict it to save some compile time.
-  // return true;
-
-  // TODO: make the heuristic more sophisticated?
   // In the end, LLVM will make the decision whether to _actually_ inline.
-  // The statement count threshold is completely arbitrary. Also, all
-  // statements are weighed the same.
 
-  unsigned statementThreshold = 10;
-  MoreThanXStatements statementCounter(statementThreshold);
-  RecursiveWalker walker(&statementCounter, false);
+  unsigned threshold = inlineCostThreshold;
+  switch (getProfileHotness(fdecl)) {
+  case Hotness::Cold:
+    IF_LOG Logger::println("Never executed according to the profile.");
+    return false;
+  case Hotness::Hot:
+    IF_LOG Logger::println("Hot according to the profile.");
+    threshold = inlineHotCostThreshold;
+    break;
+  case Hotness::Unknown:
+    break;
+  }
+
+  InlineCostEstimator estimator(threshold);
+  RecursiveWalker walker(&estimator, false);
   fdecl.fbody->accept(&walker);
 
-  IF_LOG Logger::println("Contains %u statements or more (threshold = %u).",
-                         statementCounter.count, statementThreshold);
-  return statementCounter.count <= statementThreshold;
+  IF_LOG Logger::println("Estimated cost is %u or more (threshold = %u).",
+                         estimator.cost, threshold);
+  return estimator.cost <= threshold;
 }
 
 } // end anonymous namespace
@@ -89,11 +194,7 @@ bool defineAsExternallyAvailable(FuncDeclaration &fdecl) {
   IF_LOG Logger::println("Enter defineAsExternallyAvailable");
   LOG_SCOPE
 
-  // FIXME: For now, disable all cross-module inlining (also of pragma(inline, true)
-  // functions). This check should be removed when cross-module inlining has
-  // become more stable.
-  // There are related `FIXME`s in a few lit-based `codegen/inlining_*.d` tests.
-  if (!willCrossModuleInline()) {
+  if (isCrossModuleInliningDisabled()) {
     IF_LOG Logger::println("Cross-module inlining fully disabled.");
     return false;
   }
@@ -105,10 +206,18 @@ bool defineAsExternallyAvailable(FuncDeclaration &fdecl) {
     return false;
   }
 
+  // @dynamicCompileInline functions are needed by the dynamically compiled
+  // code of this module, whether or not it is optimized statically.
+  const bool forDynamicCompile =
+      opts::enableDynamicCompile && hasDynamicCompileInlineUDA(&fdecl);
+
   // pragma(inline, true) functions will be inlined even at -O0
   if (fdecl.inlining == PINLINEalways) {
     IF_LOG Logger::println(
         "pragma(inline, true) specified, overrides cmdline flags");
+  } else if (forDynamicCompile) {
+    IF_LOG Logger::println(
+        "@dynamicCompileInline specified, overrides cmdline flags");
   } else if (!willCrossModuleInline()) {
     IF_LOG Logger::println("Commandline flags indicate no inlining");
     return false;
@@ -147,11 +256,19 @@ bool defineAsExternallyAvailable(FuncDeclaration &fdecl) {
     return false;
   }
 
+  // Nested functions are analyzed and defined together with their enclosing
+  // function, which would have to be made available as a whole. Their
+  // context layout also depends on the enclosing function's codegen.
+  Dsymbol *parent = fdecl.toParent2();
+  if (parent && parent->isFuncDeclaration()) {
+    IF_LOG Logger::println("Nested functions cannot be inlined across modules.");
+    return false;
+  }
+
   if (fdecl.semanticRun >= PASSsemantic3) {
     // If semantic analysis has come this far, the function will be defined
     // elsewhere and should not get the available_externally attribute from
     // here.
-    // TODO: This check prevents inlining of nested functions.
     IF_LOG Logger::println("Semantic analysis already completed");
     return false;
   }
@@ -169,7 +286,8 @@ bool defineAsExternallyAvailable(FuncDeclaration &fdecl) {
     return false;
   }
 
-  if (fdecl.inlining != PINLINEalways && !isInlineCandidate(fdecl))
+  if (fdecl.inlining != PINLINEalways && !forDynamicCompile &&
+      !isInlineCandidate(fdecl))
     return false;
 
   IF_LOG Logger::println("Potential inlining candidate");
@@ -23,9 +23,11 @@
 #include "driver/cl_options.h"
 #include "driver/cl_options_instrumentation.h"
 #include "driver/cl_options_sanitizers.h"
+#include "driver/sizereport.h"
 #include "gen/abi.h"
 #include "gen/arrays.h"
 #include "gen/classes.h"
+#include "gen/coroutines.h"
 #include "gen/dcompute/target.h"
 #include "gen/dvalue.h"
 #include "gen/dynamiccompile.h"
@@ -58,6 +60,15 @@ static bool isMainFunction(FuncDeclaration *fd) {
   return fd->isMain() || (global.params.betterC && fd->isCMain());
 }
 
+// With -dip1000, a `scope` (but not `return scope`) pointer or class reference
+// cannot escape the call.
+static bool isNoCaptureScope(Type *t, bool isScope, bool isReturn) {
+  if (!global.params.vsafe || !isScope || isReturn)
+    return false;
+  const auto ty = t->toBasetype()->ty;
+  return ty == Tpointer || ty == Tclass;
+}
+
 llvm::FunctionType *DtoFunctionType(Type *type, IrFuncTy &irFty, Type *thistype,
                                     Type *nesttype, FuncDeclaration *fd) {
   IF_LOG Logger::println("DtoFunctionType(%s)", type->toChars());
@@ -117,6 +128,9 @@ llvm::FunctionType *DtoFunctionType(Type *type, IrFuncTy &irFty, Type *thistype,
     if (fd && fd->isCtorDeclaration()) {
       attrs.add(LLAttribute::Returned);
     }
+    if (isNoCaptureScope(thistype, f->isscope, f->isreturn)) {
+      attrs.add(LLAttribute::NoCapture);
+    }
     newIrFty.arg_this =
         new IrFuncTyArg(thistype, thistype->toBasetype()->ty == Tstruct, attrs);
     ++nextLLArgIdx;
@@ -189,8 +203,13 @@ llvm::FunctionType *DtoFunctionType(Type *type, IrFuncTy &irFty, Type *thistype,
       } else {
         // Add sext/zext as needed.
         attrs.add(DtoShouldExtend(loweredDType));
+        if (isNoCaptureScope(loweredDType, arg->storageClass & STCscope,
+                             arg->storageClass & STCreturn)) {
+          attrs.add(LLAttribute::NoCapture);
+        }
       }
     }
+    applyParamUDAs(arg, attrs);
 
     newIrFty.args.push_back(new IrFuncTyArg(loweredDType, passPointer, attrs));
     newIrFty.args.back()->parametersIdx = i;
@@ -588,6 +607,7 @@ void DtoDeclareFunction(FuncDeclaration *fdecl) {
   }
 
   func->setCallingConv(gABI->callingConv(link, f, fdecl));
+  DtoSetDSOLocality(fdecl, func);
 
   if (global.params.isWindows && fdecl->isExport()) {
     func->setDLLStorageClass(fdecl->isImportedSymbol()
@@ -616,6 +636,9 @@ void DtoDeclareFunction(FuncDeclaration *fdecl) {
   if(irFunc->isDynamicCompiled()) {
     declareDynamicCompiledFunction(gIR, irFunc);
   }
+  if (irFunc->dynamicCompileInline) {
+    addDynamicCompileInlineFunction(gIR, irFunc);
+  }
 
   if (irFunc->targetCpuOverridden ||
       irFunc->targetFeaturesOverridden) {
@@ -1011,6 +1034,8 @@ void DtoDefineFunction(FuncDeclaration *fd, bool linkageAvailableExternally) {
     return;
   }
 
+  sizereport::recordSymbol(func->getName(), fd);
+
   if (opts::defaultToHiddenVisibility && !fd->isExport()) {
     func->setVisibility(LLGlobalValue::HiddenVisibility);
   }
@@ -1113,22 +1138,15 @@ void DtoDefineFunction(FuncDeclaration *fd, bool linkageAvailableExternally) {
   // debug info - after all allocas, but before any llvm.dbg.declare etc
   gIR->DBuilder.EmitFuncStart(fd);
 
+  // The coroutine frame has to exist before the parameters are stored.
+  if (fd->isGenerator)
+    coroutines::emitBegin(funcGen, fd);
+
   emitInstrumentationFnEnter(fd);
 
   if (global.params.trace && !fd->isCMain() && !fd->naked)
     emitDMDStyleFunctionTrace(*gIR, fd, funcGen);
 
-  // disable frame-pointer-elimination for functions with inline asm
-  if (fd->hasReturnExp & 8) // has inline asm
-  {
-    func->addAttribute(
-        LLAttributeSet::FunctionIndex,
-        llvm::Attribute::get(gIR->context(), "no-frame-pointer-elim", "true"));
-    func->addAttribute(
-        LLAttributeSet::FunctionIndex,
-        llvm::Attribute::get(gIR->context(), "no-frame-pointer-elim-non-leaf"));
-  }
-
   // give the 'this' parameter (an lvalue) storage and debug info
   if (irFty.arg_this) {
     LLValue *thisvar = irFunc->thisArg;
@@ -1215,7 +1233,12 @@ void DtoDefineFunction(FuncDeclaration *fd, bool linkageAvailableExternally) {
   }
 
   const bool wasDummy = eraseDummyAfterReturnBB(gIR->scopebb());
-  if (!wasDummy && !gIR->scopereturned()) {
+  if (fd->isGenerator) {
+    // The final suspension takes the place of the implicit return.
+    if (!wasDummy && !gIR->scopereturned())
+      gIR->DBuilder.EmitStopPoint(fd->endloc);
+    coroutines::emitEnd(funcGen, !wasDummy && !gIR->scopereturned());
+  } else if (!wasDummy && !gIR->scopereturned()) {
     // llvm requires all basic blocks to end with a TerminatorInst but DMD does
     // not put a return statement in automatically, so we do it here.
 
@@ -1246,8 +1269,13 @@ void DtoDefineFunction(FuncDeclaration *fd, bool linkageAvailableExternally) {
     allocaPoint = nullptr;
   }
 
+  if (!irFunc->targetClones.empty() && !linkageAvailableExternally) {
+    gIR->targetClonedFunctions.push_back(irFunc);
+  }
+
   if (gIR->dcomputetarget && hasKernelAttr(fd)) {
     auto fn = gIR->module.getFunction(fd->mangleString);
+    gIR->dcomputetarget->kernelNames.push_back(fn->getName().str());
     gIR->dcomputetarget->addKernelMetadata(fd, fn);
   }
 }
@@ -0,0 +1,69 @@
+//===-- gcallocsites.cpp --------------------------------------------------===//
+//
+//                         LDC – the LLVM D compiler
+//
+// This file is distributed under the BSD-style LDC license. See the LICENSE
+// file for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "gen/gcallocsites.h"
+
+#include "dmd/globals.h"
+#include "driver/cl_options_instrumentation.h"
+#include "gen/irstate.h"
+#include "gen/logger.h"
+#include "gen/tollvm.h"
+#include "llvm/ADT/Triple.h"
+
+namespace {
+const char *const hookName = "ldc_gc_alloc_site_hook";
+
+/// Returns the extern_weak declaration of the hook function in the current
+/// module.
+llvm::Function *getHookFunction() {
+  if (auto fn = gIR->module.getFunction(hookName))
+    return fn;
+
+  auto voidPtrTy = getVoidPtrType();
+  auto fnTy = llvm::FunctionType::get(llvm::Type::getVoidTy(gIR->context()),
+                                      {voidPtrTy}, false);
+  auto fn = llvm::Function::Create(fnTy, llvm::GlobalValue::ExternalWeakLinkage,
+                                   hookName, &gIR->module);
+  fn->setDoesNotThrow();
+  return fn;
+}
+}
+
+void emitGCAllocSiteHook(const Loc &loc, llvm::Function *allocFunction) {
+  if (!opts::instrumentGCAllocations)
+    return;
+
+  IF_LOG Logger::println("Emitting GC allocation site hook for %s",
+                         allocFunction->getName().str().c_str());
+
+  const std::string allocFunctionName = allocFunction->getName();
+  LLConstant *fields[] = {DtoConstCString(loc.filename),
+                          DtoConstUint(loc.linnum), DtoConstUint(loc.charnum),
+                          DtoConstCString(allocFunctionName.c_str())};
+  auto init = llvm::ConstantStruct::getAnon(gIR->context(), fields);
+  auto site = new llvm::GlobalVariable(gIR->module, init->getType(), true,
+                                       llvm::GlobalValue::PrivateLinkage, init,
+                                       ".gc_alloc_site");
+  if (global.params.targetTriple->isOSBinFormatELF())
+    site->setSection("ldc_gc_alloc_sites");
+
+  // Only call the hook if it is defined.
+  llvm::Function *hook = getHookFunction();
+  llvm::BasicBlock *callbb = gIR->insertBB("gc_alloc_site_hook");
+  llvm::BasicBlock *endbb = gIR->insertBBAfter(callbb, "gc_alloc_site_hook.end");
+  LLValue *isDefined = gIR->ir->CreateICmpNE(
+      hook, LLConstant::getNullValue(hook->getType()), "gc_alloc_site_hook.set");
+  gIR->ir->CreateCondBr(isDefined, callbb, endbb);
+
+  gIR->scope() = IRScope(callbb);
+  gIR->ir->CreateCall(hook, DtoBitCast(site, getVoidPtrType()));
+  gIR->ir->CreateBr(endbb);
+
+  gIR->scope() = IRScope(endbb);
+}
@@ -0,0 +1,34 @@
+//===-- gen/gcallocsites.h - GC allocation site hooks -----------*- C++ -*-===//
+//
+//                         LDC – the LLVM D compiler
+//
+// This file is distributed under the BSD-style LDC license. See the LICENSE
+// file for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Instrumentation of GC allocations with their source location, enabled by the
+// "-finstrument-gc-allocations" commandline switch. Before each call of a
+// druntime GC allocation function, a pointer to a constant
+//
+//   struct GCAllocSite {
+//     const(char)* file; uint line; uint column; const(char)* allocFunction;
+//   }
+//
+// is passed to `extern(C) void ldc_gc_alloc_site_hook(const(GCAllocSite)*)`.
+// The hook is an extern_weak declaration, and only called if it is defined
+// (by user code or a profiling library) at link/load time. This includes
+// -dip1008 `throw new` and AA insertions. On ELF
+// targets, all sites are additionally placed in the `ldc_gc_alloc_sites`
+// section, accessible via the `__start_`/`__stop_` linker symbols.
+//
+//===----------------------------------------------------------------------===//
+
+#pragma once
+
+struct Loc;
+namespace llvm {
+class Function;
+}
+
+void emitGCAllocSiteHook(const Loc &loc, llvm::Function *allocFunction);
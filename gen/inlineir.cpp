@@ -13,8 +13,10 @@
 #include "gen/to_string.h"
 #include "llvm/AsmParser/Parser.h"
 #include "llvm/Linker/Linker.h"
+#include "llvm/Support/ManagedStatic.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Support/SourceMgr.h"
+#include "llvm/Transforms/Utils/Cloning.h"
 
 namespace {
 
@@ -45,6 +47,57 @@ std::string exprToString(StringExp *strexp) {
   assert(strexp->sz == 1);
   return std::string(strexp->toPtr(), strexp->numberOfCodeUnits());
 }
+
+/// The name of the inline IR function in the parsed modules, renamed when
+/// linked into a module.
+const char *const inlineIRFuncName = "inline.ir";
+
+/// The modules parsed from inline IR in the global context, keyed by their
+/// textual IR. They are cloned into the modules using them, so that each
+/// instantiation is only parsed once per compiler invocation.
+llvm::ManagedStatic<llvm::StringMap<std::unique_ptr<llvm::Module>>>
+    parsedInlineIRModules;
+
+std::unique_ptr<llvm::Module> cloneModule(const llvm::Module &m) {
+#if LDC_LLVM_VER >= 700
+  return llvm::CloneModule(m);
+#else
+  return llvm::CloneModule(&m);
+#endif
+}
+
+/// Returns a new module defining the inline IR function, parsed from `ir`.
+std::unique_ptr<llvm::Module> parseInlineIR(Loc &loc, const std::string &ir) {
+  const bool useCache = &gIR->context() == &getGlobalContext();
+  if (useCache) {
+    auto it = parsedInlineIRModules->find(ir);
+    if (it != parsedInlineIRModules->end()) {
+      return cloneModule(*it->second);
+    }
+  }
+
+  llvm::SMDiagnostic err;
+  std::unique_ptr<llvm::Module> m =
+      llvm::parseAssemblyString(ir, err, gIR->context());
+
+  std::string errstr = err.getMessage();
+  if (!errstr.empty()) {
+    error(loc,
+          "can't parse inline LLVM IR:\n`%s`\n%s\n%s\nThe input string "
+          "was:\n`%s`",
+          err.getLineContents().str().c_str(),
+          (std::string(err.getColumnNo(), ' ') + '^').c_str(), errstr.c_str(),
+          ir.c_str());
+    fatal();
+  }
+
+  if (!useCache) {
+    return m;
+  }
+  auto clone = cloneModule(*m);
+  (*parsedInlineIRModules)[ir] = std::move(m);
+  return clone;
+}
 } // anonymous namespace
 
 void DtoCheckInlineIRPragma(Identifier *ident, Dsymbol *s) {
@@ -108,15 +161,16 @@ DValue *DtoInlineIRExpr(Loc &loc, FuncDeclaration *fdecl,
   // temporarily disable value name discarding.
   TempDisableDiscardValueNames tempDisable(gIR->context());
 
-  // Generate a random new function name. Because the inlineIR function is
-  // always inlined, this name does not escape the current compiled module; not
-  // even at -O0.
-  static size_t namecounter = 0;
-  std::string mangled_name = "inline.ir." + ldc::to_string(namecounter++);
   TemplateInstance *tinst = fdecl->parent->isTemplateInstance();
   assert(tinst);
 
-  // 1. Define the inline function (define a new function for each call)
+  assert(!gIR->funcGenStates.empty() && "Inline ir outside function");
+  auto enclosingFunc = gIR->topfunc();
+  assert(enclosingFunc);
+
+  // 1. Define the inline function (once per module and set of enclosing
+  //    function attributes)
+  llvm::Function *fun = nullptr;
   {
     // The magic inlineIR template is one of
     // pragma(LDC_inline_ir)
@@ -162,7 +216,7 @@ DValue *DtoInlineIRExpr(Loc &loc, FuncDeclaration *fdecl,
     if (!prefix.empty()) {
       stream << prefix << "\n";
     }
-    stream << "define " << *DtoType(ret) << " @" << mangled_name << "(";
+    stream << "define " << *DtoType(ret) << " @" << inlineIRFuncName << "(";
 
     for (size_t i = 0;;) {
       Type *ty = isType(arg_types[i]);
@@ -193,45 +247,45 @@ DValue *DtoInlineIRExpr(Loc &loc, FuncDeclaration *fdecl,
       stream << "\n" << suffix;
     }
 
-    llvm::SMDiagnostic err;
+    const std::string &ir = stream.str();
+    const std::string key =
+        ir + "\n; " +
+        enclosingFunc->getAttributes().getAsString(
+            LLAttributeSet::FunctionIndex);
 
-    std::unique_ptr<llvm::Module> m =
-        llvm::parseAssemblyString(stream.str().c_str(), err, gIR->context());
+    llvm::Function *&cachedFun = gIR->inlineIRFunctions[key];
+    if (!cachedFun) {
+      std::unique_ptr<llvm::Module> m = parseInlineIR(tinst->loc, ir);
 
-    std::string errstr = err.getMessage();
-    if (!errstr.empty()) {
-      error(tinst->loc,
-            "can't parse inline LLVM IR:\n`%s`\n%s\n%s\nThe input string "
-            "was:\n`%s`",
-            err.getLineContents().str().c_str(),
-            (std::string(err.getColumnNo(), ' ') + '^').c_str(), errstr.c_str(),
-            stream.str().c_str());
-    }
+      // Give the function a new unique name. Because the inlineIR function is
+      // always inlined, this name does not escape the current compiled module;
+      // not even at -O0.
+      static size_t namecounter = 0;
+      const std::string mangled_name =
+          std::string(inlineIRFuncName) + "." + ldc::to_string(namecounter++);
+      m->getFunction(inlineIRFuncName)->setName(mangled_name);
 
-    m->setDataLayout(gIR->module.getDataLayout());
+      m->setDataLayout(gIR->module.getDataLayout());
 
-    llvm::Linker(gIR->module).linkInModule(std::move(m));
-  }
+      llvm::Linker(gIR->module).linkInModule(std::move(m));
 
-  // 2. Call the function that was just defined and return the returnvalue
-  {
-    llvm::Function *fun = gIR->module.getFunction(mangled_name);
-
-    // Apply some parent function attributes to the inlineIR function too. This
-    // is needed e.g. when the parent function has "unsafe-fp-math"="true"
-    // applied.
-    {
-      assert(!gIR->funcGenStates.empty() && "Inline ir outside function");
-      auto enclosingFunc = gIR->topfunc();
-      assert(enclosingFunc);
-      copyFnAttributes(fun, enclosingFunc);
-    }
+      cachedFun = gIR->module.getFunction(mangled_name);
 
-    fun->setLinkage(llvm::GlobalValue::PrivateLinkage);
-    fun->removeFnAttr(llvm::Attribute::NoInline);
-    fun->addFnAttr(llvm::Attribute::AlwaysInline);
-    fun->setCallingConv(llvm::CallingConv::C);
+      // Apply some parent function attributes to the inlineIR function too.
+      // This is needed e.g. when the parent function has
+      // "unsafe-fp-math"="true" applied.
+      copyFnAttributes(cachedFun, enclosingFunc);
 
+      cachedFun->setLinkage(llvm::GlobalValue::PrivateLinkage);
+      cachedFun->removeFnAttr(llvm::Attribute::NoInline);
+      cachedFun->addFnAttr(llvm::Attribute::AlwaysInline);
+      cachedFun->setCallingConv(llvm::CallingConv::C);
+    }
+    fun = cachedFun;
+  }
+
+  // 2. Call the function and return the returnvalue
+  {
     // Build the runtime arguments
     llvm::SmallVector<llvm::Value *, 8> args;
     args.reserve(arguments->dim);
@@ -15,6 +15,7 @@
 #include "dmd/statement.h"
 #include "gen/funcgenstate.h"
 #include "gen/llvm.h"
+#include "gen/pgo_ASTbased.h"
 #include "gen/tollvm.h"
 #include "ir/irfunction.h"
 #include <cstdarg>
@@ -37,7 +38,7 @@ IRScope &IRScope::operator=(const IRScope &rhs) {
 
 ////////////////////////////////////////////////////////////////////////////////
 IRState::IRState(const char *name, llvm::LLVMContext &context)
-    : module(name, context), objc(module), DBuilder(this) {
+    : module(name, context), objc(module), tbaa(context), DBuilder(this) {
   ir.state = this;
 }
 
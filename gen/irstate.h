@@ -18,6 +18,8 @@
 #include "dmd/root/root.h"
 #include "gen/dibuilder.h"
 #include "gen/objcgen.h"
+#include "gen/pgo_ASTbased.h"
+#include "gen/tbaa.h"
 #include "ir/iraggr.h"
 #include "ir/irvar.h"
 #include "llvm/ADT/StringMap.h"
@@ -35,6 +37,7 @@ class TargetMachine;
 class IndexedInstrProfReader;
 }
 
+class CoverageMappingModuleGen;
 class FuncGenState;
 struct IRState;
 struct TargetABI;
@@ -94,6 +97,10 @@ struct IRAsmBlock {
   // stores the labels within the asm block
   std::vector<Identifier *> internalLabels;
 
+  // false if a statement depends on the function's stack frame or branches
+  // to a label, so that the asm block can't be inlined
+  bool inlinable;
+
   CompoundAsmStatement *asmBlock;
   LLType *retty;
   unsigned retn;
@@ -101,8 +108,8 @@ struct IRAsmBlock {
   LLValue *(*retfixup)(IRBuilderHelper b, LLValue *orig); // Modifies retval
 
   explicit IRAsmBlock(CompoundAsmStatement *b)
-      : outputcount(0), asmBlock(b), retty(nullptr), retn(0), retemu(false),
-        retfixup(nullptr) {}
+      : outputcount(0), inlinable(true), asmBlock(b), retty(nullptr), retn(0),
+        retemu(false), retfixup(nullptr) {}
 };
 
 // represents the LLVM module (object file)
@@ -121,12 +128,20 @@ public:
   llvm::Module module;
   llvm::LLVMContext &context() const { return module.getContext(); }
 
+  // Returns whether the names of local values (instructions, arguments, basic
+  // blocks) are kept, i.e., whether building expensive names is worthwhile.
+  bool keepsValueNames() const {
+    return !context().shouldDiscardValueNames();
+  }
+
   Module *dmodule = nullptr;
 
   LLStructType *moduleRefType = nullptr;
 
   ObjCState objc;
 
+  TBAABuilder tbaa;
+
   // Stack of currently codegen'd functions (more than one for lambdas or other
   // nested functions, inlining-only codegen'ing, etc.), and some convenience
   // accessors for the top-most one.
@@ -191,6 +206,10 @@ public:
   std::unique_ptr<llvm::IndexedInstrProfReader> PGOReader;
   llvm::IndexedInstrProfReader *getPGOReader() const { return PGOReader.get(); }
 
+  // Coverage mapping records of the instrumented functions
+  // (-fcoverage-mapping)
+  std::unique_ptr<CoverageMappingModuleGen> CoverageMapping;
+
   // for inline asm
   IRAsmBlock *asmBlock = nullptr;
   std::ostringstream nakedAsm;
@@ -210,6 +229,10 @@ public:
   llvm::StringMap<llvm::GlobalVariable *> stringLiteral2ByteCache;
   llvm::StringMap<llvm::GlobalVariable *> stringLiteral4ByteCache;
 
+  // Cold stubs calling druntime failure functions, keyed by the function and
+  // the constant arguments baked into the stub (null for forwarded ones).
+  std::map<std::vector<llvm::Constant *>, llvm::Function *> failureStubs;
+
   // Sets the initializer for a global LL variable.
   // If the types don't match, this entails creating a new helper global
   // matching the initializer type and replacing all existing uses of globalVar
@@ -228,6 +251,9 @@ public:
   // List of functions with cpu or features attributes overriden by user
   std::vector<IrFunction *> targetCpuOrFeaturesOverridden;
 
+  // List of defined functions with @targetClones, see gen/targetclones.h
+  std::vector<IrFunction *> targetClonedFunctions;
+
   struct RtCompiledFuncDesc {
     llvm::GlobalVariable *thunkVar;
     llvm::Function *thunkFunc;
@@ -235,6 +261,9 @@ public:
 
   std::map<llvm::Function *, RtCompiledFuncDesc> dynamicCompiledFunctions;
   std::set<IrGlobal *> dynamicCompiledVars;
+  // @dynamicCompileInline functions, embedded as available_externally into
+  // the dynamic compilation module if dynamically compiled code calls them
+  std::set<llvm::Function *> dynamicCompileInlineFunctions;
 
 /// Vector of options passed to the linker as metadata in object file.
 #if LDC_LLVM_VER >= 500
@@ -243,6 +272,14 @@ public:
   llvm::SmallVector<llvm::Metadata *, 5> LinkerMetadataArgs;
 #endif
 
+  // thread-local PGO counters of the functions in this module
+  // (-fprofile-update=per-thread)
+  std::vector<ThreadLocalPGOCounters> threadLocalPGOCounters;
+
+  // inline IR functions defined in this module, keyed by their textual IR
+  // and the function attributes of the caller
+  llvm::StringMap<llvm::Function *> inlineIRFunctions;
+
   // MS C++ compatible type descriptors
   llvm::DenseMap<size_t, llvm::StructType *> TypeDescriptorTypeMap;
   llvm::DenseMap<llvm::Constant *, llvm::GlobalVariable *> TypeDescriptorMap;
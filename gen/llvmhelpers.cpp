@@ -17,6 +17,9 @@
 #include "dmd/mars.h"
 #include "dmd/module.h"
 #include "dmd/template.h"
+#include "driver/cl_options.h"
+#include "driver/linker.h"
+#include "driver/sizereport.h"
 #include "gen/abi.h"
 #include "gen/arrays.h"
 #include "gen/cl_helpers.h"
@@ -26,13 +29,16 @@
 #include "gen/dynamiccompile.h"
 #include "gen/funcgenstate.h"
 #include "gen/functions.h"
+#include "gen/gcallocsites.h"
 #include "gen/irstate.h"
 #include "gen/llvm.h"
 #include "gen/logger.h"
 #include "gen/nested.h"
 #include "gen/mangling.h"
+#include "gen/optimizer.h"
 #include "gen/pragma.h"
 #include "gen/runtime.h"
+#include "gen/tbaa.h"
 #include "gen/tollvm.h"
 #include "gen/typinf.h"
 #include "gen/uda.h"
@@ -91,6 +97,7 @@ LLValue *DtoNew(Loc &loc, Type *newtype) {
   LLConstant *ti = DtoTypeInfoOf(newtype);
   assert(isaPointer(ti));
   // call runtime allocator
+  emitGCAllocSiteHook(loc, fn);
   LLValue *mem = gIR->CreateCallOrInvoke(fn, ti, ".gc_mem").getInstruction();
   // cast
   return DtoBitCast(mem, DtoPtrToType(newtype), ".gc_mem");
@@ -101,6 +108,7 @@ LLValue *DtoNewStruct(Loc &loc, TypeStruct *newtype) {
       loc, gIR->module,
       newtype->isZeroInit(newtype->sym->loc) ? "_d_newitemT" : "_d_newitemiT");
   LLConstant *ti = DtoTypeInfoOf(newtype);
+  emitGCAllocSiteHook(loc, fn);
   LLValue *mem = gIR->CreateCallOrInvoke(fn, ti, ".gc_struct").getInstruction();
   return DtoBitCast(mem, DtoPtrToType(newtype), ".gc_struct");
 }
@@ -213,6 +221,7 @@ LLValue *DtoGcMalloc(Loc &loc, LLType *lltype, const char *name) {
   // parameters
   LLValue *size = DtoConstSize_t(getTypeAllocSize(lltype));
   // call runtime allocator
+  emitGCAllocSiteHook(loc, fn);
   LLValue *mem = gIR->CreateCallOrInvoke(fn, size, name).getInstruction();
   // cast
   return DtoBitCast(mem, getPtrToType(lltype), name);
@@ -293,12 +302,85 @@ void DtoAssert(Module *M, Loc &loc, DValue *msg) {
   args.push_back(DtoConstUint(loc.linnum));
 
   // call
-  gIR->CreateCallOrInvoke(fn, args);
+  DtoFailureCall(fn, args);
 
   // after assert is always unreachable
   gIR->ir->CreateUnreachable();
 }
 
+static llvm::Function *getFailureStub(llvm::Function *fn,
+                                      llvm::ArrayRef<LLValue *> args) {
+  std::vector<llvm::Constant *> key = {fn};
+  std::vector<LLType *> paramTypes;
+  for (size_t i = 0; i + 1 < args.size(); ++i) {
+    auto c = llvm::dyn_cast<llvm::Constant>(args[i]);
+    key.push_back(c);
+    if (!c) {
+      paramTypes.push_back(args[i]->getType());
+    }
+  }
+  paramTypes.push_back(args.back()->getType());
+
+  llvm::Function *&stub = gIR->failureStubs[key];
+  if (stub) {
+    return stub;
+  }
+
+  auto stubTy = LLFunctionType::get(LLType::getVoidTy(gIR->context()),
+                                    paramTypes, false);
+  stub = LLFunction::Create(stubTy, LLGlobalValue::PrivateLinkage,
+                            fn->getName() + ".stub", &gIR->module);
+  stub->addFnAttr(LLAttribute::Cold);
+  stub->addFnAttr(LLAttribute::NoReturn);
+  stub->addFnAttr(LLAttribute::NoInline);
+  stub->addFnAttr(LLAttribute::OptimizeForSize);
+  if (fn->doesNotThrow()) {
+    stub->setDoesNotThrow();
+  } else if (gABI->needsUnwindTables()) {
+    stub->addFnAttr(LLAttribute::UWTable);
+  }
+
+  llvm::BasicBlock *bb = llvm::BasicBlock::Create(gIR->context(), "", stub);
+  llvm::IRBuilder<> builder(bb);
+  llvm::SmallVector<LLValue *, 4> fnArgs;
+  auto param = stub->arg_begin();
+  for (size_t i = 1; i < key.size(); ++i) {
+    if (key[i]) {
+      fnArgs.push_back(key[i]);
+    } else {
+      fnArgs.push_back(&*param++);
+    }
+  }
+  fnArgs.push_back(&*param);
+  llvm::CallInst *call = builder.CreateCall(fn, fnArgs);
+  call->setCallingConv(fn->getCallingConv());
+  call->setDoesNotReturn();
+  builder.CreateUnreachable();
+
+  return stub;
+}
+
+LLCallSite DtoFailureCall(llvm::Function *fn,
+                          llvm::ArrayRef<LLValue *> args) {
+  assert(!args.empty());
+  if (!isOptimizationEnabled()) {
+    return gIR->CreateCallOrInvoke(fn, args);
+  }
+
+  llvm::Function *stub = getFailureStub(fn, args);
+  llvm::SmallVector<LLValue *, 4> stubArgs;
+  for (size_t i = 0; i + 1 < args.size(); ++i) {
+    if (!llvm::isa<llvm::Constant>(args[i])) {
+      stubArgs.push_back(args[i]);
+    }
+  }
+  stubArgs.push_back(args.back());
+
+  LLCallSite call = gIR->CreateCallOrInvoke(stub, stubArgs);
+  call.setDoesNotReturn();
+  return call;
+}
+
 void DtoCAssert(Module *M, Loc &loc, LLValue *msg) {
   const auto file =
       DtoConstCString(loc.filename ? loc.filename : M->srcfile->name.toChars());
@@ -369,6 +451,13 @@ void DtoGoto(Loc &loc, LabelDsymbol *target) {
 
 // is this a good approach at all ?
 
+namespace {
+llvm::MDNode *getTBAATag(DValue *lhs) {
+  DLValue *lval = lhs->isLVal();
+  return lval ? lval->getTBAATag() : nullptr;
+}
+}
+
 void DtoAssign(Loc &loc, DValue *lhs, DValue *rhs, int op,
                bool canSkipPostblit) {
   IF_LOG Logger::println("DtoAssign()");
@@ -410,7 +499,7 @@ void DtoAssign(Loc &loc, DValue *lhs, DValue *rhs, int op,
       Logger::cout() << "r : " << *r << '\n';
     }
     r = DtoBitCast(r, l->getType()->getContainedType(0));
-    DtoStore(r, l);
+    TBAABuilder::attach(DtoStore(r, l), getTBAATag(lhs));
   } else if (t->iscomplex()) {
     LLValue *dst = DtoLVal(lhs);
     LLValue *src = DtoRVal(DtoCast(loc, rhs, lhs->type));
@@ -440,7 +529,7 @@ void DtoAssign(Loc &loc, DValue *lhs, DValue *rhs, int op,
       assert(r->getType() == lit);
 #endif
     }
-    gIR->ir->CreateStore(r, l);
+    TBAABuilder::attach(gIR->ir->CreateStore(r, l), getTBAATag(lhs));
   }
 }
 
@@ -822,6 +911,65 @@ TemplateInstance *DtoIsTemplateInstance(Dsymbol *s) {
   return nullptr;
 }
 
+namespace {
+// druntime and Phobos
+bool isDefaultLibModule(Module *m) {
+  if (!m->parent)
+    return m->ident == Id::object;
+  Dsymbol *top = m;
+  while (top->parent)
+    top = top->parent;
+  const char *name = top->ident->toChars();
+  return strcmp(name, "core") == 0 || strcmp(name, "std") == 0 ||
+         strcmp(name, "etc") == 0 || strcmp(name, "ldc") == 0;
+}
+
+bool isDefinedInExecutable(Dsymbol *sym) {
+  if (!global.params.link || global.params.dll ||
+      !global.params.targetTriple->isOSBinFormatELF() ||
+      gTargetMachine->getRelocationModel() != llvm::Reloc::PIC_) {
+    return false;
+  }
+
+  Module *m = sym->getModule();
+  if (!m)
+    return false;
+
+  if (auto fd = sym->isFuncDeclaration()) {
+    if (!fd->fbody || fd->llvmInternal == LLVMextern_weak)
+      return false; // e.g., C functions declared in core.stdc.*
+    if (m->isRoot() && !DtoIsTemplateInstance(fd))
+      return true;
+    // Calls to functions wrongly assumed to be local still go through the PLT
+    // of the linker (R_X86_64_PLT32), so the static default libs are fine.
+    return isDefaultLibModule(m) && !linkAgainstSharedDefaultLibs();
+  }
+
+  // Variables are only local if defined in the objects being linked, as
+  // direct accesses to variables of shared libraries need copy relocations.
+  if (auto vd = sym->isVarDeclaration()) {
+    return m->isRoot() && !(vd->storage_class & STCextern) &&
+           vd->llvmInternal != LLVMextern_weak && !DtoIsTemplateInstance(vd);
+  }
+
+  return false;
+}
+} // anonymous namespace
+
+void DtoSetDSOLocality(Dsymbol *sym, llvm::GlobalValue *gv) {
+  if (isDefinedInExecutable(sym)) {
+#if LDC_LLVM_VER >= 700
+    gv->setDSOLocal(true);
+#endif
+    return;
+  }
+
+  if (opts::noPLT && gTargetMachine->getRelocationModel() == llvm::Reloc::PIC_) {
+    if (auto func = llvm::dyn_cast<llvm::Function>(gv))
+      func->addFnAttr(llvm::Attribute::NonLazyBind);
+  }
+}
+
 /******************************************************************************
  * PROCESSING QUEUE HELPERS
  ******************************************************************************/
@@ -888,10 +1036,15 @@ void DtoResolveVariable(VarDeclaration *vd) {
     // If a const/immutable value has a proper initializer (not "= void"),
     // it cannot be assigned again in a static constructor. Thus, we can
     // emit it as read-only data.
+    // The same goes for a default-initialized one of a root module, if none of
+    // its static constructors initializes it.
     // We also do so for forward-declared (extern) globals, just like clang.
-    const bool isLLConst = (vd->isConst() || vd->isImmutable()) &&
-                           ((vd->_init && !vd->_init->isVoidInitializer()) ||
-                            (vd->storage_class & STCextern));
+    const bool isLLConst =
+        (vd->isConst() || vd->isImmutable()) &&
+        ((vd->_init ? !vd->_init->isVoidInitializer()
+                    : !vd->ctorinit && vd->getModule() &&
+                          vd->getModule()->isRoot()) ||
+         (vd->storage_class & STCextern));
 
     assert(!vd->ir->isInitialized());
     if (gIR->dmodule) {
@@ -913,6 +1066,7 @@ void DtoResolveVariable(VarDeclaration *vd) {
                       isLLConst, vd->isThreadlocal());
     if (vd->llvmInternal == LLVMextern_weak)
       gvar->setLinkage(llvm::GlobalValue::ExternalWeakLinkage);
+    DtoSetDSOLocality(vd, gvar);
 
     auto varIr = getIrGlobal(vd);
     varIr->value = gvar;
@@ -996,6 +1150,16 @@ void DtoVarDeclaration(VarDeclaration *vd) {
     irLocal->value = allocainst;
 
     gIR->DBuilder.EmitLocalVariable(allocainst, vd);
+
+    // The stack slot of a local declared in a scope can be reused after it.
+    // Variables referenced by nested functions are excluded, as these may
+    // outlive the scope.
+    auto &scopedLocals = gIR->funcGen().scopedLocals;
+    auto alloca = llvm::dyn_cast<llvm::AllocaInst>(allocainst);
+    if (alloca && !scopedLocals.empty() && !vd->nestedrefs.dim) {
+      gIR->ir->CreateLifetimeStart(alloca);
+      scopedLocals.back().push_back(alloca);
+    }
   }
 
   IF_LOG Logger::cout() << "llvm value for decl: " << *getIrLocal(vd)->value
@@ -1721,11 +1885,42 @@ stringLiteralCacheForType(Type *charType) {
   }
 }
 
+llvm::StringRef stringLiteralCacheKey(StringExp *se) {
+  return {static_cast<const char *>(se->string),
+          se->numberOfCodeUnits() * se->sz};
+}
+
+namespace {
+template <typename CodeUnit>
+llvm::Constant *buildCodeUnitsConstant(StringExp *se, bool zeroTerm) {
+  const auto data = static_cast<const CodeUnit *>(se->string);
+  std::vector<CodeUnit> units(data, data + se->numberOfCodeUnits());
+  if (zeroTerm) {
+    units.push_back(0);
+  }
+  return llvm::ConstantDataArray::get(gIR->context(), units);
+}
+}
+
 llvm::Constant *buildStringLiteralConstant(StringExp *se, bool zeroTerm) {
   Type *dtype = se->type->toBasetype();
   Type *cty = dtype->nextOf()->toBasetype();
 
   LLType *ct = DtoMemType(cty);
+
+  // Build the constant directly from the raw code units if possible, without
+  // an intermediate llvm::Constant per code unit.
+  if (ct->isIntegerTy(se->sz * 8)) {
+    switch (se->sz) {
+    case 1:
+      return buildCodeUnitsConstant<uint8_t>(se, zeroTerm);
+    case 2:
+      return buildCodeUnitsConstant<uint16_t>(se, zeroTerm);
+    case 4:
+      return buildCodeUnitsConstant<uint32_t>(se, zeroTerm);
+    }
+  }
+
   auto len = se->numberOfCodeUnits();
   if (zeroTerm) {
     len += 1;
@@ -1751,6 +1946,14 @@ std::string llvmTypeToString(llvm::Type *type) {
   return result;
 }
 
+llvm::GlobalVariable::ThreadLocalMode getThreadLocalModel() {
+  // On PPC there is only local-exec available - in this case just ignore the
+  // command line.
+  return global.params.targetTriple->getArch() == llvm::Triple::ppc
+             ? llvm::GlobalVariable::LocalExecTLSModel
+             : clThreadModel.getValue();
+}
+
 llvm::GlobalVariable *declareGlobal(const Loc &loc, llvm::Module &module,
                                     llvm::Type *type,
                                     llvm::StringRef mangledName,
@@ -1774,15 +1977,8 @@ llvm::GlobalVariable *declareGlobal(const Loc &loc, llvm::Module &module,
     return existing;
   }
 
-  // Use a command line option for the thread model.
-  // On PPC there is only local-exec available - in this case just ignore the
-  // command line.
-  const auto tlsModel =
-      isThreadLocal
-          ? (global.params.targetTriple->getArch() == llvm::Triple::ppc
-                 ? llvm::GlobalVariable::LocalExecTLSModel
-                 : clThreadModel.getValue())
-          : llvm::GlobalVariable::NotThreadLocal;
+  const auto tlsModel = isThreadLocal ? getThreadLocalModel()
+                                      : llvm::GlobalVariable::NotThreadLocal;
 
   return new llvm::GlobalVariable(module, type, isConstant,
                                   llvm::GlobalValue::ExternalLinkage, nullptr,
@@ -1794,8 +1990,10 @@ void defineGlobal(llvm::GlobalVariable *global, llvm::Constant *init,
   assert(global->isDeclaration() && "Global variable already defined");
   assert(init);
   global->setInitializer(init);
-  if (symbolForLinkage)
+  if (symbolForLinkage) {
     setLinkage(symbolForLinkage, global);
+    sizereport::recordSymbol(global->getName(), symbolForLinkage);
+  }
 }
 
 llvm::GlobalVariable *defineGlobal(const Loc &loc, llvm::Module &module,
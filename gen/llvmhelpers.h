@@ -66,6 +66,14 @@ LLValue *DtoAllocaDump(LLValue *val, LLType *asType, int alignment = 0,
 void DtoAssert(Module *M, Loc &loc, DValue *msg);
 void DtoCAssert(Module *M, Loc &loc, LLValue *msg);
 
+/// Calls the druntime function `fn` reporting a failed check (_d_assert,
+/// _d_arraybounds etc.), whose last parameter is the line number. When
+/// optimizing, the call is made through a per-module cold stub with all other
+/// constant arguments (file name, ModuleInfo) baked in, so that their setup
+/// doesn't bloat the calling function.
+LLCallSite DtoFailureCall(llvm::Function *fn,
+                          llvm::ArrayRef<LLValue *> args);
+
 // returns module file name
 LLConstant *DtoModuleFileName(Module *M, const Loc &loc);
 
@@ -106,6 +114,12 @@ DValue *DtoPaintType(Loc &loc, DValue *val, Type *to);
 // is template instance check, returns module where instantiated
 TemplateInstance *DtoIsTemplateInstance(Dsymbol *s);
 
+/// Marks the LLVM function/variable of a D symbol as dso_local if it is known
+/// to end up in the executable being linked (PIC only).
+/// With -fno-plt, other function declarations are marked nonlazybind, i.e.,
+/// called through the GOT.
+void DtoSetDSOLocality(Dsymbol *sym, llvm::GlobalValue *gv);
+
 /// Makes sure the declarations corresponding to the given D symbol have been
 /// emitted to the currently processed LLVM module.
 ///
@@ -243,8 +257,15 @@ LLConstant *toConstantArray(LLType *ct, LLArrayType *at, T *str, size_t len,
 llvm::StringMap<llvm::GlobalVariable *> *
 stringLiteralCacheForType(Type *charType);
 
+/// Returns the key of a string literal in its cache, i.e., its raw code units
+/// (cheap even for huge binary blobs, e.g., from string imports).
+llvm::StringRef stringLiteralCacheKey(StringExp *se);
+
 llvm::Constant *buildStringLiteralConstant(StringExp *se, bool zeroTerm);
 
+/// Returns the TLS model for thread-local globals (`-fthread-model`).
+llvm::GlobalVariable::ThreadLocalMode getThreadLocalModel();
+
 /// Tries to declare an LLVM global. If a variable with the same mangled name
 /// already exists, checks if the types match and returns it instead.
 ///
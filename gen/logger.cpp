@@ -15,13 +15,17 @@
 #include "llvm/IR/Value.h"
 #include "llvm/Support/Casting.h"
 #include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Format.h"
 #include "llvm/Support/raw_os_ostream.h"
+#include <atomic>
 #include <cassert>
 #include <cstdarg>
 #include <cstdio>
 #include <cstdlib>
 #include <fstream>
 #include <iostream>
+#include <mutex>
+#include <sstream>
 #include <string>
 
 void Stream::writeType(std::ostream &OS, const llvm::Type &Ty) {
@@ -46,28 +50,132 @@ void Stream::writeValue(std::ostream &OS, const llvm::Value &V) {
 bool _Logger_enabled;
 
 namespace Logger {
-static std::string indent_str;
+
+std::atomic<bool> forceEnabled{false};
+
+bool isEnabled() { return enabled(); }
 
 static llvm::cl::opt<bool, true>
     enabledopt("vv", llvm::cl::desc("Print front-end/glue code debug log"),
                llvm::cl::location(_Logger_enabled), llvm::cl::ZeroOrMore);
 
-void indent() {
-  if (_Logger_enabled) {
-    indent_str += "* ";
+static llvm::cl::opt<bool> jsonOutput(
+    "vv-json", llvm::cl::ZeroOrMore,
+    llvm::cl::desc("Print the -vv debug log as JSON lines with thread IDs, "
+                   "e.g., for merging the logs of parallel codegen threads"));
+
+namespace {
+std::mutex outputMutex;
+std::atomic<unsigned> numThreads{0};
+
+/// The log state of a thread. Lines are buffered until complete and then
+/// written out as a whole, so that lines of multiple threads don't mix.
+struct ThreadLog {
+  const unsigned id = numThreads++;
+  unsigned depth = 0;
+  unsigned lineDepth = 0;
+  std::string line;
+  bool atLineStart = true;
+  std::ostringstream stream;
+
+  void append(const char *str, size_t len) {
+    for (size_t i = 0; i < len; ++i) {
+      if (atLineStart) {
+        atLineStart = false;
+        lineDepth = depth;
+        if (!jsonOutput) {
+          for (unsigned d = 0; d < depth; ++d)
+            line += "* ";
+        }
+      }
+      if (str[i] == '\n') {
+        writeLine();
+      } else {
+        line += str[i];
+      }
+    }
+  }
+
+  void writeLine() {
+    if (jsonOutput) {
+      std::string json;
+      llvm::raw_string_ostream os(json);
+      os << "{\"tid\":" << id << ",\"depth\":" << lineDepth << ",\"msg\":\"";
+      for (char c : line) {
+        if (c == '"' || c == '\\') {
+          os << '\\' << c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+          os << llvm::format("\\u%04x", c);
+        } else {
+          os << c;
+        }
+      }
+      os << "\"}\n";
+      os.flush();
+      line.swap(json);
+    } else {
+      line += '\n';
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(outputMutex);
+      fwrite(line.data(), 1, line.size(), stdout);
+    }
+    line.clear();
+    atLineStart = true;
+  }
+
+  void vprint(const char *fmt, va_list va) {
+    char buffer[512];
+    va_list va2;
+    va_copy(va2, va);
+    const int len = vsnprintf(buffer, sizeof(buffer), fmt, va);
+    if (len < 0) {
+      va_end(va2);
+      return;
+    }
+    if (static_cast<size_t>(len) < sizeof(buffer)) {
+      append(buffer, len);
+    } else {
+      std::string large(len + 1, '\0');
+      vsnprintf(&large[0], large.size(), fmt, va2);
+      append(large.data(), len);
+    }
+    va_end(va2);
+  }
+
+  void flushStream() {
+    const std::string str = stream.str();
+    if (!str.empty()) {
+      stream.str(std::string());
+      append(str.data(), str.size());
+    }
   }
+};
+
+ThreadLog &getThreadLog() {
+  static thread_local ThreadLog log;
+  return log;
+}
+} // anonymous namespace
+
+void indent() {
+#ifndef LDC_DISABLE_LOGGER
+  ++getThreadLog().depth;
+#endif
 }
 
 void undent() {
-  if (_Logger_enabled) {
-    assert(!indent_str.empty());
-    indent_str.resize(indent_str.size() - 2);
-  }
+#ifndef LDC_DISABLE_LOGGER
+  auto &log = getThreadLog();
+  assert(log.depth > 0);
+  --log.depth;
+#endif
 }
 
 Stream cout() {
-  if (_Logger_enabled) {
-    return Stream(std::cout << indent_str);
+  if (enabled()) {
+    return Stream(getThreadLog().stream);
   }
   return Stream(nullptr);
 }
@@ -91,29 +199,31 @@ static inline void search_and_replace(std::string &str, const std::string &what,
 #define WORKAROUND_C99_SPECIFIERS_BUG(f)
 #endif
 
-void printIndentation() { printf("%s", indent_str.c_str()); }
-
 void println(const char *fmt, ...) {
-  if (_Logger_enabled) {
-    printf("%s", indent_str.c_str());
+  if (enabled()) {
+    auto &log = getThreadLog();
     va_list va;
     va_start(va, fmt);
     WORKAROUND_C99_SPECIFIERS_BUG(fmt);
-    vprintf(fmt, va);
+    log.vprint(fmt, va);
     va_end(va);
-    printf("\n");
+    log.append("\n", 1);
   }
 }
 void print(const char *fmt, ...) {
-  if (_Logger_enabled) {
-    printf("%s", indent_str.c_str());
+  if (enabled()) {
     va_list va;
     va_start(va, fmt);
     WORKAROUND_C99_SPECIFIERS_BUG(fmt);
-    vprintf(fmt, va);
+    getThreadLog().vprint(fmt, va);
     va_end(va);
   }
 }
+void write(const char *str, size_t len) {
+  if (enabled()) {
+    getThreadLog().append(str, len);
+  }
+}
 void attention(Loc &loc, const char *fmt, ...) {
   va_list va;
   va_start(va, fmt);
@@ -121,3 +231,10 @@ void attention(Loc &loc, const char *fmt, ...) {
   va_end(va);
 }
 }
+
+Stream::~Stream() {
+  // All non-null Streams write to the current thread's log stream.
+  if (OS) {
+    Logger::getThreadLog().flushStream();
+  }
+}
@@ -10,10 +10,16 @@
 // Defines a common interface for logging debug information during code
 // generation.
 //
+// The log is thread-safe: indentation is tracked per thread, and output is
+// buffered per thread and written line by line. Building with
+// LDC_DISABLE_LOGGER compiles out all IF_LOG-guarded logging.
+//
 //===----------------------------------------------------------------------===//
 
 #pragma once
 
+#include <atomic>
+#include <cstddef>
 #include <iosfwd>
 #include <iostream>
 
@@ -33,6 +39,8 @@ class Value;
 
 struct Loc;
 
+/// Streams into the current thread's log buffer (see Logger::cout()). Complete
+/// lines are written out when the Stream is destroyed.
 class Stream {
   std::ostream *OS;
 
@@ -40,6 +48,7 @@ public:
   Stream() : OS(nullptr) {}
   explicit Stream(std::ostream *S) : OS(S) {}
   explicit Stream(std::ostream &S) : OS(&S) {}
+  ~Stream();
 
   /*
   Stream operator << (std::ios_base &(*Func)(std::ios_base&)) {
@@ -91,28 +100,55 @@ private:
   short sfinae_bait(...);
 };
 
+// Set by -vv, only written while parsing the commandline.
 extern bool _Logger_enabled;
 
 namespace Logger {
 
+/// Set by Logger::enable() (for pragma(LDC_verbose)) while other threads may be
+/// logging concurrently.
+extern std::atomic<bool> forceEnabled;
+
 void indent();
 void undent();
 Stream cout();
-void printIndentation();
 void println(const char *fmt, ...) IS_PRINTF(1);
 void print(const char *fmt, ...) IS_PRINTF(1);
-inline void enable() { _Logger_enabled = true; }
-inline void disable() { _Logger_enabled = false; }
-inline bool enabled() { return _Logger_enabled; }
+/// Appends `len` chars to the log (used by the D logging in gen/logger.d).
+void write(const char *str, size_t len);
+inline void enable() { forceEnabled.store(true, std::memory_order_relaxed); }
+inline void disable() { forceEnabled.store(false, std::memory_order_relaxed); }
+#ifdef LDC_DISABLE_LOGGER
+inline bool enabled() { return false; }
+#else
+inline bool enabled() {
+  return _Logger_enabled || forceEnabled.load(std::memory_order_relaxed);
+}
+#endif
+/// Non-inline enabled(), for the D logging in gen/logger.d.
+bool isEnabled();
 
 void attention(Loc loc, const char *fmt, ...) IS_PRINTF(2);
 
+// Only indents if the logger is enabled, so that disabled scopes don't access
+// the thread-local log state.
 struct LoggerScope {
-  LoggerScope() { Logger::indent(); }
-  ~LoggerScope() { Logger::undent(); }
+  const bool active = enabled();
+  LoggerScope() {
+    if (active)
+      Logger::indent();
+  }
+  ~LoggerScope() {
+    if (active)
+      Logger::undent();
+  }
 };
 }
 
+#ifdef LDC_DISABLE_LOGGER
+#define LOG_SCOPE
+#else
 #define LOG_SCOPE Logger::LoggerScope _logscope;
+#endif
 
 #define IF_LOG if (Logger::enabled())
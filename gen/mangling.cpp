@@ -15,28 +15,68 @@
 
 #include "dmd/declaration.h"
 #include "dmd/dsymbol.h"
+#include "dmd/errors.h"
+#include "dmd/id.h"
 #include "dmd/identifier.h"
 #include "dmd/mangle.h"
 #include "dmd/module.h"
+#include "dmd/template.h"
+#include "driver/cl_options.h"
 #include "gen/abi.h"
 #include "gen/irstate.h"
 #include "gen/to_string.h"
+#include "llvm/ADT/StringSet.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
 #include "llvm/Support/MD5.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Support/xxhash.h"
+#include <memory>
 
 namespace {
 
-// TODO: Disable hashing of symbols that are defined in libdruntime and
-// libphobos. This would enable hashing thresholds below the largest symbol in
-// libdruntime/phobos.
+/// Returns the module the code of the symbol is emitted into, i.e., the
+/// instantiating module for template instances.
+Module *getDefiningModule(Dsymbol *symb) {
+  for (Dsymbol *s = symb; s; s = s->parent) {
+    if (auto ti = s->isTemplateInstance()) {
+      if (ti->minst)
+        return ti->minst;
+    }
+  }
+  return symb->getModule();
+}
 
-bool shouldHashAggrName(llvm::StringRef name) {
+/// Symbols defined in libdruntime and libphobos are never hashed, so that
+/// code compiled with any hash threshold can be linked against the default
+/// builds of these libraries.
+bool isDefinedInDefaultLibrary(Dsymbol *symb) {
+  Module *m = getDefiningModule(symb);
+  if (!m || !m->md)
+    return false;
+  auto packages = m->md->packages;
+  if (!packages || packages->dim == 0)
+    return m->md->id == Id::object;
+  llvm::StringRef root = (*packages)[0]->toChars();
+  return root == "core" || root == "std" || root == "etc" || root == "ldc";
+}
+
+bool shouldHashAggrName(llvm::StringRef name, AggregateDeclaration *ad) {
   /// Add extra chars to the length of aggregate names to account for
   /// the additional D mangling suffix and prefix
   return (global.params.hashThreshold != 0) &&
-         ((name.size() + 11) > global.params.hashThreshold);
+         ((name.size() + 11) > global.params.hashThreshold) &&
+         !isDefinedInDefaultLibrary(ad);
 }
 
-llvm::SmallString<32> hashName(llvm::StringRef name) {
+std::string hashName(llvm::StringRef name) {
+  if (opts::hashAlgorithm == opts::SymbolHash_XXHash) {
+    std::string hashStr;
+    llvm::raw_string_ostream os(hashStr);
+    os << llvm::format_hex_no_prefix(llvm::xxHash64(name), 16);
+    return os.str();
+  }
+
   llvm::MD5 hasher;
   hasher.update(name);
   llvm::MD5::MD5Result result;
@@ -44,7 +84,28 @@ llvm::SmallString<32> hashName(llvm::StringRef name) {
   llvm::SmallString<32> hashStr;
   llvm::MD5::stringifyResult(result, hashStr);
 
-  return hashStr;
+  return hashStr.str();
+}
+
+/// Records the original name of a hashed symbol in the -hash-map file.
+void writeHashMapEntry(llvm::StringRef hashed, llvm::StringRef original) {
+  if (opts::hashMapFile.empty())
+    return;
+
+  static std::unique_ptr<llvm::raw_fd_ostream> os;
+  static llvm::StringSet<> written;
+  if (!os) {
+    std::error_code ec;
+    os = llvm::make_unique<llvm::raw_fd_ostream>(opts::hashMapFile, ec,
+                                                 llvm::sys::fs::F_None);
+    if (ec) {
+      error(Loc(), "cannot write hash map file '%s': %s",
+            opts::hashMapFile.c_str(), ec.message().c_str());
+      fatal();
+    }
+  }
+  if (written.insert(hashed).second)
+    *os << hashed << '\t' << original << '\n';
 }
 
 /// Hashes the symbol name and prefixes the hash with some recognizable parts of
@@ -77,9 +138,11 @@ std::string hashSymbolName(llvm::StringRef name, Dsymbol *symb) {
   ret += 'L';
   ret += lineNo;
 
-  // MD5 hash
+  // hash
   auto hashedName = hashName(name);
-  ret += "33_"; // add underscore to delimit the 33 character count
+  // add underscore to delimit the character count
+  ret += ldc::to_string(hashedName.size() + 1);
+  ret += '_';
   ret += hashedName;
 
   // top aggregate
@@ -104,10 +167,12 @@ std::string getIRMangledName(FuncDeclaration *fdecl, LINK link) {
   // Hash the name if necessary
   if (((link == LINKd) || (link == LINKdefault)) &&
       (global.params.hashThreshold != 0) &&
-      (mangledName.length() > global.params.hashThreshold)) {
+      (mangledName.length() > global.params.hashThreshold) &&
+      !isDefinedInDefaultLibrary(fdecl)) {
 
-    auto hashedName = hashSymbolName(mangledName, fdecl);
-    mangledName = "_D" + hashedName + "Z";
+    auto hashedName = "_D" + hashSymbolName(mangledName, fdecl) + "Z";
+    writeHashMapEntry(hashedName, mangledName);
+    mangledName = std::move(hashedName);
   }
 
   // TODO: Cache the result?
@@ -143,7 +208,8 @@ std::string getIRMangledAggregateName(AggregateDeclaration *ad,
   mangleToBuffer(ad, &mangleBuf);
   llvm::StringRef mangledAggrName = mangleBuf.peekString();
 
-  if (shouldHashAggrName(mangledAggrName)) {
+  const bool hash = shouldHashAggrName(mangledAggrName, ad);
+  if (hash) {
     ret += hashSymbolName(mangledAggrName, ad);
   } else {
     ret += mangledAggrName;
@@ -152,6 +218,12 @@ std::string getIRMangledAggregateName(AggregateDeclaration *ad,
   if (suffix)
     ret += suffix;
 
+  if (hash) {
+    writeHashMapEntry(
+        ret, (llvm::Twine("_D") + mangledAggrName + (suffix ? suffix : ""))
+                 .str());
+  }
+
   return getIRMangledVarName(std::move(ret), LINKd);
 }
 }
@@ -29,6 +29,9 @@ enum TypeDataFields {
 
   TD_Type, /// A value of the LLVM type corresponding to this D type
 
+  TD_ElemPostblit, /// True if this is an array type whose elements need
+                   /// postblits when copied.
+
   // Must be kept last:
   TD_NumFields /// The number of fields in TypeInfo metadata
 };
@@ -11,6 +11,7 @@
 
 #include "dmd/module.h"
 #include "dmd/mangle.h"
+#include "driver/cl_options.h"
 #include "gen/abi.h"
 #include "gen/classes.h"
 #include "gen/irstate.h"
@@ -22,6 +23,14 @@
 #include "ir/irfunction.h"
 #include "ir/irmodule.h"
 #include "ir/irtype.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/Triple.h"
+#include "llvm/Analysis/TargetLibraryInfo.h"
+#include "llvm/Support/CommandLine.h"
+#if LDC_LLVM_VER >= 400
+#include "llvm/Transforms/Utils/Evaluator.h"
+#endif
+#include <algorithm>
 
 // These must match the values in druntime/src/object_.d
 #define MIstandalone 0x4
@@ -36,20 +45,32 @@
 #define MIlocalClasses 0x800
 #define MInew 0x80000000 // it's the "new" layout
 
+static llvm::cl::opt<bool> reduceModuleInfoImports(
+    "reduce-moduleinfo-imports", llvm::cl::ZeroOrMore,
+    llvm::cl::desc("Only list the imported modules in the ModuleInfo which "
+                   "aren't imported indirectly anyway, leaving fewer "
+                   "dependencies for druntime to sort at startup"));
+
+static llvm::cl::opt<bool> evaluateModuleCtorsOpt(
+    "evaluate-module-ctors", llvm::cl::ZeroOrMore,
+    llvm::cl::desc("Evaluate simple module constructors at compile time and "
+                   "statically initialize the globals they assign"));
+
 namespace {
 /// Creates a function in the current llvm::Module that dispatches to the given
-/// functions one after each other and then increments the gate variables, if
-/// any.
+/// functions one after each other (finally calling the internal `lastFunc`, if
+/// any) and then increments the gate variables, if any.
 llvm::Function *buildForwarderFunction(
     const std::string &name, const std::list<FuncDeclaration *> &funcs,
-    const std::list<VarDeclaration *> &gates = std::list<VarDeclaration *>()) {
+    const std::list<VarDeclaration *> &gates = std::list<VarDeclaration *>(),
+    llvm::Function *lastFunc = nullptr) {
   // If there is no gates, we might get away without creating a function at all.
   if (gates.empty()) {
     if (funcs.empty()) {
-      return nullptr;
+      return lastFunc;
     }
 
-    if (funcs.size() == 1) {
+    if (funcs.size() == 1 && !lastFunc) {
       return DtoCallee(funcs.front());
     }
   }
@@ -80,6 +101,9 @@ llvm::Function *buildForwarderFunction(
     const auto call = builder.CreateCall(f, {});
     call->setCallingConv(gABI->callingConv(func->linkage));
   }
+  if (lastFunc) {
+    builder.CreateCall(lastFunc, {})->setCallingConv(lastFunc->getCallingConv());
+  }
 
   // ... incrementing the gate variables.
   for (auto gate : gates) {
@@ -113,7 +137,11 @@ llvm::Function *buildModuleCtor(Module *m) {
 
 llvm::Function *buildModuleDtor(Module *m) {
   std::string name = getMangledName(m, "6__dtorZ");
-  return buildForwarderFunction(name, getIrModule(m)->dtors);
+  // Merges the thread-local PGO counters (-fprofile-update=per-thread) when a
+  // thread terminates, after the user's thread-local destructors.
+  const auto pgoFlush = buildThreadLocalPGOCountersFlush(
+      *gIR, getMangledName(m, "11__pgo_flushZ"));
+  return buildForwarderFunction(name, getIrModule(m)->dtors, {}, pgoFlush);
 }
 
 llvm::Function *buildModuleUnittest(Module *m) {
@@ -132,16 +160,74 @@ llvm::Function *buildModuleSharedDtor(Module *m) {
   return buildForwarderFunction(name, getIrModule(m)->sharedDtors);
 }
 
+/// Removes the imports reachable via another import from the given list.
+/// druntime only derives the constructor order from the transitive closure of
+/// the importedModules[] graph, so this doesn't change any constraint (or
+/// cycle), but saves druntime from walking the redundant edges at startup.
+///
+/// The frontend may not see all imports of non-root modules (e.g., function-
+/// local ones), but a path found in the visible graph exists in the real one
+/// too. Paths through \p m itself don't count. The DFS shares its visited set
+/// across all starting imports; a path missed because of this only means
+/// keeping a redundant import.
+void reduceImports(Module *m, std::vector<Module *> &imports) {
+  llvm::SmallPtrSet<Module *, 16> candidates(imports.begin(), imports.end());
+  llvm::SmallPtrSet<Module *, 16> dropped;
+  llvm::SmallPtrSet<Module *, 64> visited;
+  visited.insert(m);
+
+  std::vector<Module *> worklist;
+  for (auto start : imports) {
+    // Only imports still in the list may justify dropping others.
+    if (dropped.count(start) || !visited.insert(start).second) {
+      continue;
+    }
+
+    worklist.push_back(start);
+    while (!worklist.empty()) {
+      Module *current = worklist.back();
+      worklist.pop_back();
+      for (auto mod : current->aimports) {
+        if (!mod->needModuleInfo()) {
+          continue;
+        }
+        if (mod != start && candidates.count(mod)) {
+          dropped.insert(mod);
+        }
+        if (visited.insert(mod).second) {
+          worklist.push_back(mod);
+        }
+      }
+    }
+  }
+
+  imports.erase(std::remove_if(imports.begin(), imports.end(),
+                               [&](Module *mod) { return dropped.count(mod); }),
+                imports.end());
+}
+
 /// Builds the (constant) data content for the importedModules[] array.
 llvm::Constant *buildImportedModules(Module *m, size_t &count) {
   const auto moduleInfoPtrTy = DtoPtrToType(getModuleInfoType());
 
-  std::vector<LLConstant *> importInits;
+  std::vector<Module *> imports;
   for (auto mod : m->aimports) {
     if (!mod->needModuleInfo() || mod == m) {
       continue;
     }
+    if (reduceModuleInfoImports &&
+        std::find(imports.begin(), imports.end(), mod) != imports.end()) {
+      continue;
+    }
+    imports.push_back(mod);
+  }
 
+  if (reduceModuleInfoImports && imports.size() > 1) {
+    reduceImports(m, imports);
+  }
+
+  std::vector<LLConstant *> importInits;
+  for (auto mod : imports) {
     importInits.push_back(
         DtoBitCast(getIrModule(mod)->moduleInfoSymbol(), moduleInfoPtrTy));
   }
@@ -155,7 +241,13 @@ llvm::Constant *buildImportedModules(Module *m, size_t &count) {
 }
 
 /// Builds the (constant) data content for the localClasses[] array.
+/// Returns null for -fno-object-factory, which keeps the ClassInfos (and thus
+/// vtables and methods) of unused classes unreferenced.
 llvm::Constant *buildLocalClasses(Module *m, size_t &count) {
+  count = 0;
+  if (opts::noObjectFactory)
+    return nullptr;
+
   const auto classinfoTy = DtoType(getClassInfoType());
 
   ClassDeclarations aclasses;
@@ -194,6 +286,49 @@ llvm::Constant *buildLocalClasses(Module *m, size_t &count) {
 }
 }
 
+llvm::GlobalVariable *genUnittestTable(Module *m) {
+  const auto &unitTests = getIrModule(m)->unitTests;
+  if (unitTests.empty()) {
+    return nullptr;
+  }
+
+  auto &context = gIR->context();
+  const auto sizeTy = DtoSize_t();
+  const auto fnPtrTy =
+      LLFunctionType::get(LLType::getVoidTy(context), {}, false)
+          ->getPointerTo();
+  const auto charPtrTy = getVoidPtrType();
+  const auto entryTy = LLStructType::get(
+      context, {fnPtrTy, charPtrTy, charPtrTy, sizeTy}, false);
+
+  std::vector<LLConstant *> entries;
+  for (auto fd : unitTests) {
+    const char *file = fd->loc.filename ? fd->loc.filename : "";
+    LLConstant *fields[] = {DtoBitCast(DtoCallee(fd), fnPtrTy),
+                            DtoConstCString(fd->toPrettyChars()),
+                            DtoConstCString(file),
+                            DtoConstSize_t(fd->loc.linnum)};
+    entries.push_back(LLConstantStruct::get(entryTy, fields));
+  }
+
+  const auto moduleInfoPtrTy = DtoPtrToType(getModuleInfoType());
+  const auto entriesTy = llvm::ArrayType::get(entryTy, entries.size());
+  LLConstant *fields[] = {
+      DtoConstSize_t(1), // version
+      DtoBitCast(getIrModule(m)->moduleInfoSymbol(), moduleInfoPtrTy),
+      DtoConstSize_t(entries.size()),
+      LLConstantArray::get(entriesTy, entries)};
+  const auto init = LLConstantStruct::getAnon(context, fields);
+
+  const auto irMangle =
+      getIRMangledVarName(getMangledName(m, "15__unittestTableZ"), LINKd);
+  auto table = new LLGlobalVariable(gIR->module, init->getType(), true,
+                                    LLGlobalValue::ExternalLinkage, init,
+                                    irMangle);
+  setLinkage({LLGlobalValue::ExternalLinkage, supportsCOMDAT()}, table);
+  return table;
+}
+
 llvm::GlobalVariable *genModuleInfo(Module *m) {
   // check declaration in object.d
   const auto moduleInfoType = getModuleInfoType();
@@ -312,3 +447,241 @@ llvm::GlobalVariable *genModuleInfo(Module *m) {
   setLinkage({LLGlobalValue::ExternalLinkage, supportsCOMDAT()}, moduleInfoSym);
   return moduleInfoSym;
 }
+
+////////////////////////////////////////////////////////////////////////////////
+
+#if LDC_LLVM_VER >= 400
+namespace {
+using namespace llvm;
+
+GlobalVariable *getUnderlyingGlobal(Constant *c) {
+  c = c->stripPointerCasts();
+  while (auto ce = dyn_cast<ConstantExpr>(c)) {
+    if (ce->getOpcode() != Instruction::GetElementPtr)
+      return nullptr;
+    c = ce->getOperand(0)->stripPointerCasts();
+  }
+  return dyn_cast<GlobalVariable>(c);
+}
+
+void collectGlobals(Constant *c, SmallPtrSetImpl<GlobalVariable *> &globals,
+                    SmallPtrSetImpl<Function *> &callees) {
+  if (auto gv = dyn_cast<GlobalVariable>(c)) {
+    globals.insert(gv);
+  } else if (auto f = dyn_cast<Function>(c)) {
+    callees.insert(f);
+  } else if (isa<ConstantExpr>(c)) {
+    for (auto &op : c->operands())
+      collectGlobals(cast<Constant>(op), globals, callees);
+  }
+}
+
+/// Checks that the given constructor, and everything it calls, only accesses
+/// globals whose value at the time the constructor runs is known: constants
+/// and the (non-ODR) definitions of this module. For the TLS constructor, the
+/// variables must be thread-local too, as the shared constructors of other
+/// modules run before and may have modified this module's __gshared data.
+/// Conversely, a shared constructor must only touch the main thread's TLS
+/// data, not the initial TLS image.
+bool accessesOnlyKnownGlobals(Function *ctor, bool threadLocal) {
+  SmallPtrSet<GlobalVariable *, 16> globals;
+  SmallPtrSet<Function *, 8> callees;
+  SmallVector<Function *, 8> worklist;
+  callees.insert(ctor);
+  worklist.push_back(ctor);
+
+  while (!worklist.empty()) {
+    Function *f = worklist.pop_back_val();
+    if (f->isDeclaration())
+      continue; // rejected by the Evaluator if not an intrinsic
+
+    SmallPtrSet<Function *, 8> newCallees;
+    for (auto &bb : *f) {
+      for (auto &inst : bb) {
+        for (auto &op : inst.operands()) {
+          if (auto c = dyn_cast<Constant>(op))
+            collectGlobals(c, globals, newCallees);
+        }
+      }
+    }
+    for (auto callee : newCallees) {
+      if (callees.insert(callee).second)
+        worklist.push_back(callee);
+    }
+  }
+
+  for (auto gv : globals) {
+    if (gv->isConstant())
+      continue;
+    if (gv->isDeclaration() ||
+        !(gv->hasExternalLinkage() || gv->hasLocalLinkage()) ||
+        gv->isThreadLocal() != threadLocal) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Adapted from LLVM's GlobalOpt (EvaluateStoreInto/CommitValueTo).
+Constant *evaluateStoreInto(Constant *init, Constant *val, ConstantExpr *addr,
+                            unsigned opNo) {
+  if (opNo == addr->getNumOperands()) {
+    assert(val->getType() == init->getType() && "Type mismatch!");
+    return val;
+  }
+
+  SmallVector<Constant *, 32> elements;
+  const auto idx = cast<ConstantInt>(addr->getOperand(opNo))->getZExtValue();
+  if (auto st = dyn_cast<StructType>(init->getType())) {
+    for (unsigned i = 0, e = st->getNumElements(); i != e; ++i)
+      elements.push_back(init->getAggregateElement(i));
+    elements[idx] = evaluateStoreInto(elements[idx], val, addr, opNo + 1);
+    return ConstantStruct::get(st, elements);
+  }
+
+  auto seqTy = cast<SequentialType>(init->getType());
+  for (uint64_t i = 0, e = seqTy->getNumElements(); i != e; ++i)
+    elements.push_back(init->getAggregateElement(i));
+  assert(idx < elements.size());
+  elements[idx] = evaluateStoreInto(elements[idx], val, addr, opNo + 1);
+  if (auto at = dyn_cast<ArrayType>(seqTy))
+    return ConstantArray::get(at, elements);
+  return ConstantVector::get(elements);
+}
+
+void commitValueTo(Constant *val, Constant *addr) {
+  if (auto gv = dyn_cast<GlobalVariable>(addr)) {
+    gv->setInitializer(val);
+    return;
+  }
+  auto ce = cast<ConstantExpr>(addr);
+  auto gv = cast<GlobalVariable>(ce->getOperand(0));
+  gv->setInitializer(evaluateStoreInto(gv->getInitializer(), val, ce, 2));
+}
+
+/// Evaluates the given module constructor and commits its stores to the
+/// initializers. Returns false (without changes) if that isn't possible.
+bool evaluateCtor(Function *ctor, bool threadLocal,
+                  const TargetLibraryInfo &tli) {
+  if (!accessesOnlyKnownGlobals(ctor, threadLocal))
+    return false;
+
+  Evaluator eval(ctor->getParent()->getDataLayout(), &tli);
+  Constant *retVal = nullptr;
+  SmallVector<Constant *, 0> args;
+  if (!eval.EvaluateFunction(ctor, retVal, args))
+    return false;
+
+  // Also check the stores through pointers loaded at evaluation time.
+  for (const auto &it : eval.getMutatedMemory()) {
+    auto gv = getUnderlyingGlobal(it.first);
+    if (!gv || (gv->getParent() && gv->isThreadLocal() != threadLocal))
+      return false;
+  }
+
+  for (const auto &it : eval.getMutatedMemory()) {
+    auto gv = getUnderlyingGlobal(it.first);
+    if (gv->getParent()) // skip the Evaluator's temporaries for allocas
+      commitValueTo(it.second, it.first);
+  }
+  return true;
+}
+}
+
+void evaluateModuleCtors(llvm::Module &m) {
+  if (!evaluateModuleCtorsOpt)
+    return;
+
+  // With -singleobj, the constructors of the different D modules may access
+  // each other's globals (in an order only known at runtime), so only handle
+  // a single ModuleInfo.
+  GlobalVariable *moduleInfo = nullptr;
+  for (auto &gv : m.globals()) {
+    if (!gv.isDeclaration() && gv.getName().endswith("12__ModuleInfoZ")) {
+      if (moduleInfo)
+        return;
+      moduleInfo = &gv;
+    }
+  }
+  if (!moduleInfo)
+    return;
+
+  auto init = dyn_cast<ConstantStruct>(moduleInfo->getInitializer());
+  if (!init || init->getNumOperands() < 3)
+    return;
+  const auto flags = cast<ConstantInt>(init->getOperand(0))->getZExtValue();
+
+  IF_LOG Logger::println("Evaluating module constructors (%s)",
+                         moduleInfo->getName().str().c_str());
+  LOG_SCOPE
+
+  TargetLibraryInfoImpl tlii(Triple(m.getTargetTriple()));
+  TargetLibraryInfo tli(tlii);
+
+  // The field layout is given by the flags: tlsctor, tlsdtor, ctor, dtor, ...
+  const unsigned tlsCtorIndex = 2;
+  const unsigned sharedCtorIndex = 2 + ((flags & MItlsctor) ? 1 : 0) +
+                                   ((flags & MItlsdtor) ? 1 : 0);
+  const auto getCtor = [&](unsigned index) {
+    return cast<Function>(init->getOperand(index)->stripPointerCasts());
+  };
+
+  unsigned newFlags = flags;
+  // The shared constructors run before the TLS ones (and may modify the
+  // main thread's TLS data), so only try the latter if the former are gone.
+  if (flags & MIctor) {
+    Function *ctor = getCtor(sharedCtorIndex);
+    if (evaluateCtor(ctor, /*threadLocal=*/false, tli)) {
+      Logger::println("Evaluated %s", ctor->getName().str().c_str());
+      newFlags &= ~MIctor;
+    }
+  }
+  if ((flags & MItlsctor) && !(newFlags & MIctor)) {
+    Function *ctor = getCtor(tlsCtorIndex);
+    if (evaluateCtor(ctor, /*threadLocal=*/true, tli)) {
+      Logger::println("Evaluated %s", ctor->getName().str().c_str());
+      newFlags &= ~MItlsctor;
+    }
+  }
+
+  if (newFlags == flags)
+    return;
+
+  // Rebuild the ModuleInfo without the evaluated constructors. Note that
+  // druntime won't consider these modules for constructor cycles anymore.
+  SmallVector<Constant *, 16> fields;
+  SmallVector<Function *, 2> evaluatedCtors;
+  for (unsigned i = 0, e = init->getNumOperands(); i != e; ++i) {
+    if ((i == sharedCtorIndex && (flags & MIctor) && !(newFlags & MIctor)) ||
+        (i == tlsCtorIndex && (flags & MItlsctor) &&
+         !(newFlags & MItlsctor))) {
+      evaluatedCtors.push_back(getCtor(i));
+      continue;
+    }
+    fields.push_back(i == 0 ? ConstantInt::get(init->getOperand(0)->getType(),
+                                               newFlags)
+                            : init->getOperand(i));
+  }
+
+  auto newInit = ConstantStruct::getAnon(m.getContext(), fields);
+  auto newModuleInfo = new GlobalVariable(
+      m, newInit->getType(), moduleInfo->isConstant(),
+      moduleInfo->getLinkage(), newInit, "", moduleInfo,
+      moduleInfo->getThreadLocalMode());
+  newModuleInfo->copyAttributesFrom(moduleInfo);
+  newModuleInfo->setComdat(moduleInfo->getComdat());
+  newModuleInfo->takeName(moduleInfo);
+  moduleInfo->replaceAllUsesWith(
+      ConstantExpr::getBitCast(newModuleInfo, moduleInfo->getType()));
+  moduleInfo->eraseFromParent();
+
+  // Erase the forwarder functions which aren't referenced anymore.
+  for (auto ctor : evaluatedCtors) {
+    ctor->removeDeadConstantUsers();
+    if (ctor->hasLocalLinkage() && ctor->use_empty())
+      ctor->eraseFromParent();
+  }
+}
+#else
+void evaluateModuleCtors(llvm::Module &) {}
+#endif
@@ -9,6 +9,7 @@
 
 namespace llvm {
 class GlobalVariable;
+class Module;
 }
 class Module;
 
@@ -18,3 +19,28 @@ class Module;
 /// Note that this just creates data itself, and is not concerned with emitting
 /// a reference pointing to it to register the module with the runtime.
 llvm::GlobalVariable *genModuleInfo(Module *m);
+
+/// Creates a global variable listing the individual unittests of the given
+/// module, so that a test runner can distribute them across threads (the
+/// ModuleInfo only references a single function running all of them). Returns
+/// null if the module has no unittests. The layout is:
+///
+///   struct UnitTestTable {
+///     size_t version; // 1
+///     immutable(ModuleInfo)* moduleInfo;
+///     size_t count;
+///     UnitTest[count] tests;
+///   }
+///   struct UnitTest {
+///     void function() fp;
+///     const(char)* name; // fully qualified
+///     const(char)* file;
+///     size_t line;
+///   }
+llvm::GlobalVariable *genUnittestTable(Module *m);
+
+/// Evaluates the module constructors referenced by the ModuleInfo of the given
+/// (optimized) LLVM module at compile time if possible (-evaluate-module-ctors).
+/// The globals they assign are statically initialized instead, and the
+/// constructors are removed from the ModuleInfo.
+void evaluateModuleCtors(llvm::Module &m);
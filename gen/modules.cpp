@@ -34,6 +34,7 @@
 #include "gen/mangling.h"
 #include "gen/moduleinfo.h"
 #include "gen/optimizer.h"
+#include "gen/pgo_ASTbased.h"
 #include "gen/runtime.h"
 #include "gen/structs.h"
 #include "gen/tollvm.h"
@@ -391,6 +392,26 @@ void emitModuleRefToSection(RegistryStyle style, std::string moduleMangle,
   dsoDtor->setSection("__DATA,__mod_term_func,mod_term_funcs");
 }
 
+/// Emits a reference to the unittest table of the module into a dedicated
+/// section, so that a test runner can find the tables of all linked modules
+/// (between the `__start___ldc_unittests`/`__stop___ldc_unittests` linker
+/// symbols on ELF targets).
+void emitUnittestTableRefToSection(RegistryStyle style,
+                                   const std::string &moduleMangle,
+                                   llvm::GlobalVariable *table) {
+  const auto sectionName =
+      style == RegistryStyle::sectionMSVC
+          ? ".ldcunit"
+          : style == RegistryStyle::sectionDarwin ? "__DATA,.ldcunittests"
+                                                  : "__ldc_unittests";
+
+  const auto ref = defineDSOGlobal(
+      getIRMangledVarName("_D" + moduleMangle + "18__unittestTableRefZ", LINKd),
+      DtoBitCast(table, getVoidPtrType()));
+  ref->setSection(sectionName);
+  gIR->usedArray.push_back(ref);
+}
+
 // Add module-private variables and functions for coverage analysis.
 void addCoverageAnalysis(Module *m) {
   IF_LOG {
@@ -566,6 +587,37 @@ void registerModuleInfo(Module *m) {
     AppendFunctionToLLVMGlobalCtorsDtors(miCtor, 65535, true);
   } else {
     emitModuleRefToSection(style, mangle, moduleInfoSym);
+    if (const auto unittestTable = genUnittestTable(m)) {
+      emitUnittestTableRefToSection(style, mangle, unittestTable);
+    }
+  }
+}
+
+/// With -real-precision=double, druntime's object module defines a marker
+/// symbol referenced by all other modules. So linking against a runtime built
+/// without the switch fails (with an undefined reference to the marker)
+/// instead of silently mixing up the ABI of `real`.
+void emitRealIsDoubleMarker(Module *m) {
+  const char *name = "_d_runtime_built_with_real_precision_double";
+  auto i8 = LLType::getInt8Ty(gIR->context());
+  llvm::GlobalVariable *marker = gIR->module.getGlobalVariable(name);
+  if (!marker) {
+    marker = new llvm::GlobalVariable(gIR->module, i8, true,
+                                      llvm::GlobalValue::ExternalLinkage,
+                                      nullptr, name);
+  }
+
+  if (!m->parent && m->ident == Id::object) {
+    marker->setInitializer(llvm::ConstantInt::get(i8, 1));
+    return;
+  }
+
+  const char *refName = "ldc.real_precision_double_ref";
+  if (!gIR->module.getGlobalVariable(refName, true)) {
+    auto ref = new llvm::GlobalVariable(gIR->module, marker->getType(), true,
+                                        llvm::GlobalValue::InternalLinkage,
+                                        marker, refName);
+    gIR->usedArray.push_back(ref);
   }
 }
 }
@@ -579,8 +631,6 @@ void codegenModule(IRState *irs, Module *m) {
 
   irs->DBuilder.EmitModule(m);
 
-  initRuntime();
-
   // Skip pseudo-modules for coverage analysis
   std::string name = m->toChars();
   const bool isPseudoModule = (name == "__entrypoint") || (name == "__main");
@@ -611,12 +661,20 @@ void codegenModule(IRState *irs, Module *m) {
   if (global.params.useModuleInfo && !m->noModuleInfo && Module::moduleinfo) {
     // generate ModuleInfo
     registerModuleInfo(m);
+
+    if (global.params.realIsDouble) {
+      emitRealIsDoubleMarker(m);
+    }
   }
 
   if (m->d_cover_valid) {
     addCoverageAnalysisInitializer(m);
   }
 
+  if (irs->CoverageMapping) {
+    irs->CoverageMapping->emit(*irs);
+  }
+
   gIR = nullptr;
   irs->dmodule = nullptr;
 }
@@ -0,0 +1,139 @@
+//===-- moveelision.cpp ---------------------------------------------------===//
+//
+//                         LDC – the LLVM D compiler
+//
+// This file is distributed under the BSD-style LDC license. See the LICENSE
+// file for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "gen/moveelision.h"
+
+#include "dmd/aggregate.h"
+#include "dmd/declaration.h"
+#include "dmd/expression.h"
+#include "dmd/mtype.h"
+#include "dmd/statement.h"
+#include "gen/funcgenstate.h"
+#include "gen/irstate.h"
+#include "gen/llvmhelpers.h"
+#include "gen/logger.h"
+#include "gen/recursivevisitor.h"
+#include "gen/tollvm.h"
+#include "llvm/Support/CommandLine.h"
+
+namespace {
+llvm::cl::opt<bool> moveLastUse(
+    "fmove-last-use", llvm::cl::ZeroOrMore,
+    llvm::cl::desc("Move local structs instead of copying them (skipping the "
+                   "postblit and destructor calls) when the copy is their "
+                   "last use"));
+
+bool isMovableLocal(VarDeclaration *vd) {
+  if (vd->isDataseg() || (vd->storage_class & (STCref | STCout | STClazy)))
+    return false;
+  // Closures may access the variable after the move.
+  if (vd->nestedrefs.dim != 0)
+    return false;
+  return vd->type->toBasetype()->ty == Tstruct;
+}
+
+/// Returns the last statement executed when falling through `s`.
+Statement *lastStatement(Statement *s) {
+  while (s) {
+    if (auto cs = s->isCompoundStatement()) {
+      Statement *last = nullptr;
+      for (auto sub : *cs->statements) {
+        if (sub)
+          last = sub;
+      }
+      s = last;
+    } else if (auto ss = s->isScopeStatement()) {
+      s = ss->statement;
+    } else {
+      break;
+    }
+  }
+  return s;
+}
+
+/// Looks for the postblit call of a blit `(tmp = var).__postblit()` in an
+/// expression and counts all other references to `var`.
+class UseFinder : public StoppableVisitor {
+  VarDeclaration *const var;
+
+public:
+  unsigned numUses = 0;
+  CallExp *postblitCall = nullptr;
+
+  explicit UseFinder(VarDeclaration *var) : var(var) {}
+
+  using StoppableVisitor::visit;
+
+  void visit(SymbolExp *e) override {
+    if (e->var == var)
+      ++numUses;
+  }
+
+  void visit(CallExp *e) override {
+    auto dve = e->e1->op == TOKdotvar ? static_cast<DotVarExp *>(e->e1)
+                                      : nullptr;
+    if (!dve || dve->e1->op != TOKblit)
+      return;
+    auto sd = static_cast<TypeStruct *>(var->type->toBasetype())->sym;
+    auto be = static_cast<BlitExp *>(dve->e1);
+    if (dve->var == sd->postblit && be->e2->op == TOKvar &&
+        static_cast<VarExp *>(be->e2)->var == var && be->e1->op == TOKvar) {
+      postblitCall = e;
+    }
+  }
+
+  void visit(Statement *) override {}
+  void visit(Expression *) override {}
+  void visit(Declaration *) override {}
+  void visit(Initializer *) override {}
+  void visit(Dsymbol *) override {}
+};
+}
+
+namespace moveelision {
+
+void prepare(IRState &irs, Statement *body, DtorExpStatement *dtor) {
+  VarDeclaration *vd = dtor->var;
+  if (!moveLastUse || !vd || !vd->edtor || dtor->exp != vd->edtor ||
+      !isMovableLocal(vd)) {
+    return;
+  }
+
+  Statement *last = lastStatement(body);
+  if (!last)
+    return;
+  Expression *exp = nullptr;
+  if (auto es = last->isExpStatement()) {
+    if (!es->isDtorExpStatement())
+      exp = es->exp;
+  } else if (auto rs = last->isReturnStatement()) {
+    exp = rs->exp;
+  }
+  if (!exp)
+    return;
+
+  UseFinder finder(vd);
+  RecursiveWalker walker(&finder);
+  exp->accept(&walker);
+  // The blitted operand must be the only reference.
+  if (!finder.postblitCall || finder.numUses != 1)
+    return;
+
+  IF_LOG Logger::println("Moving %s at its last use: %s", vd->toChars(),
+                         finder.postblitCall->toChars());
+
+  auto &funcGen = irs.funcGen();
+  auto movedFrom = DtoRawAlloca(llvm::Type::getInt1Ty(irs.context()), 0,
+                                llvm::Twine(vd->toChars()) + ".movedfrom");
+  DtoStore(DtoConstBool(false), movedFrom);
+  funcGen.elidedPostblits[finder.postblitCall] = movedFrom;
+  funcGen.guardedDtors[dtor] = movedFrom;
+}
+
+} // namespace moveelision
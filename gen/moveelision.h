@@ -0,0 +1,34 @@
+//===-- gen/moveelision.h - Last-use move elision ---------------*- C++ -*-===//
+//
+//                         LDC – the LLVM D compiler
+//
+// This file is distributed under the BSD-style LDC license. See the LICENSE
+// file for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// With -fmove-last-use, a local struct variable which is copied (postblit) by
+// the last statement before its destruction, e.g. when passed by value to a
+// function, is moved instead: the copy is a plain blit, and the variable's
+// destructor call is skipped.
+//
+// As the destructor still needs to run for exceptions and early exits
+// before the move, it is guarded by a 'moved-from' flag, which the optimizer
+// folds on the normal path.
+//
+//===----------------------------------------------------------------------===//
+
+#pragma once
+
+class DtorExpStatement;
+struct IRState;
+class Statement;
+
+namespace moveelision {
+
+/// Checks whether the last statement of `body`, followed by `dtor`, moves
+/// the destructed variable, and registers the move with the current function
+/// if so. Must be called before emitting either statement.
+void prepare(IRState &irs, Statement *body, DtorExpStatement *dtor);
+
+} // namespace moveelision
@@ -16,6 +16,7 @@
 #include "gen/irstate.h"
 #include "gen/llvmhelpers.h"
 #include "gen/logger.h"
+#include "gen/optremarks.h"
 #include "gen/tollvm.h"
 #include "ir/irfunction.h"
 #include "ir/irtypeaggr.h"
@@ -27,6 +28,25 @@ static unsigned getVthisIdx(AggregateDeclaration *ad) {
 
 static void DtoCreateNestedContextType(FuncDeclaration *fd);
 
+/// Returns why the closure of `fd` needs to be allocated on the GC heap, for
+/// optimization remarks. Like FuncDeclaration::checkClosure(), this reports
+/// the first nested function referencing a closure variable which escapes
+/// (as a delegate or member function).
+static std::string getClosureReason(FuncDeclaration *fd) {
+  for (auto v : fd->closureVars) {
+    for (auto f : v->nestedrefs) {
+      for (Dsymbol *s = f; s && s != fd; s = s->parent) {
+        auto fx = s->isFuncDeclaration();
+        if (fx && (fx->isThis() || fx->tookAddressOf)) {
+          return std::string("`") + f->toPrettyChars() +
+                 "` closes over `" + v->toChars() + "` and escapes";
+        }
+      }
+    }
+  }
+  return "a nested function escapes";
+}
+
 DValue *DtoNestedVariable(Loc &loc, Type *astype, VarDeclaration *vd,
                           bool byref) {
   IF_LOG Logger::println("DtoNestedVariable for %s @ %s", vd->toChars(),
@@ -143,7 +163,9 @@ DValue *DtoNestedVariable(Loc &loc, Type *astype, VarDeclaration *vd,
     IF_LOG Logger::println("Lower depth");
     offsetToNthField(vardepth);
     IF_LOG Logger::cout() << "Frame index: " << *val << '\n';
-    dereference((std::string(".frame.") + vdparent->toChars()).c_str());
+    dereference(gIR->keepsValueNames()
+                    ? (std::string(".frame.") + vdparent->toChars()).c_str()
+                    : "");
     IF_LOG Logger::cout() << "Frame: " << *val << '\n';
   }
 
@@ -301,7 +323,9 @@ LLValue *DtoNestedContext(Loc &loc, Dsymbol *sym) {
                        LLPointerType::getUnqual(getIrFunc(ctxfd)->frameType));
       val = DtoGEPi(val, 0, neededDepth);
       val = DtoAlignedLoad(
-          val, (std::string(".frame.") + frameToPass->toChars()).c_str());
+          val, gIR->keepsValueNames()
+                   ? (std::string(".frame.") + frameToPass->toChars()).c_str()
+                   : "");
     }
   }
 
@@ -445,6 +469,13 @@ void DtoCreateNestedContext(FuncGenState &funcGen) {
     if (needsClosure) {
       // FIXME: alignment ?
       frame = DtoGcMalloc(fd->loc, frameType, ".frame");
+      if (areCodegenRemarksEnabled()) {
+        addCodegenRemark(
+            "HeapClosure",
+            llvm::cast<llvm::Instruction>(frame->stripPointerCasts()),
+            llvm::Twine("closure of `") + fd->toPrettyChars() +
+                "` heap-allocated because " + getClosureReason(fd));
+      }
     } else {
       unsigned alignment =
           std::max(getABITypeAlign(frameType), irFunc.frameTypeAlignment);
@@ -16,7 +16,9 @@
 #include "driver/cl_options.h"
 #include "driver/cl_options_instrumentation.h"
 #include "driver/cl_options_sanitizers.h"
+#include "driver/plugins.h"
 #include "driver/targetmachine.h"
+#include "driver/timetrace.h"
 #include "llvm/ADT/Triple.h"
 #include "llvm/Analysis/TargetLibraryInfo.h"
 #include "llvm/Analysis/TargetTransformInfo.h"
@@ -38,9 +40,26 @@
 
 #if LDC_LLVM_VER >= 400
 #include "llvm/Analysis/InlineCost.h"
+#include "llvm/Transforms/Coroutines.h"
+#endif
+
+#if LDC_LLVM_VER >= 800
+#include "llvm/IR/DebugInfo.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Transforms/IPO/AlwaysInliner.h"
+#include "llvm/Transforms/IPO/GlobalDCE.h"
+#include "llvm/Transforms/IPO/HotColdSplitting.h"
+#include "llvm/Transforms/Instrumentation/InstrProfiling.h"
+#include "llvm/Transforms/Instrumentation/PGOInstrumentation.h"
+#include "llvm/Transforms/Utils/LCSSA.h"
+#include "llvm/Transforms/Utils/LoopSimplify.h"
+#include "llvm/Transforms/Utils/NameAnonGlobals.h"
+#endif
+
+#if LDC_LLVM_VER >= 900
+#include "llvm/ProfileData/InstrProfReader.h"
 #endif
 
-extern llvm::TargetMachine *gTargetMachine;
 using namespace llvm;
 
 static cl::opt<signed char> optimizeLevel(
@@ -81,6 +100,16 @@ static cl::opt<bool> disableGCToStack(
     "disable-gc2stack", cl::ZeroOrMore,
     cl::desc("Disable promotion of GC allocations to stack memory"));
 
+static cl::opt<bool> disableBoundsCheckElimination(
+    "disable-bounds-check-elim", cl::ZeroOrMore,
+    cl::desc("Disable removal of redundant array bounds checks and their "
+             "hoisting out of loops"));
+
+static cl::opt<bool> disableNoUnwindInference(
+    "disable-nounwind-inference", cl::ZeroOrMore,
+    cl::desc("Disable inferring nounwind for functions (incl. template "
+             "instances) and removing the then dead landing pads"));
+
 static cl::opt<cl::boolOrDefault, false, opts::FlagParser<cl::boolOrDefault>>
     enableInlining(
         "inlining", cl::ZeroOrMore,
@@ -88,8 +117,17 @@ static cl::opt<cl::boolOrDefault, false, opts::FlagParser<cl::boolOrDefault>>
 
 static cl::opt<cl::boolOrDefault, false, opts::FlagParser<cl::boolOrDefault>>
     enableCrossModuleInlining(
-        "cross-module-inlining", cl::ZeroOrMore, cl::Hidden,
-        cl::desc("(*) Enable cross-module function inlining (default disabled)"));
+        "cross-module-inlining", cl::ZeroOrMore,
+        cl::desc("(*) Enable cross-module function inlining (default when "
+                 "inlining is enabled)"));
+
+#if LDC_LLVM_VER >= 800
+static cl::opt<cl::boolOrDefault, false, opts::FlagParser<cl::boolOrDefault>>
+    enableColdSplitting(
+        "cold-splitting", cl::ZeroOrMore,
+        cl::desc("(*) Enable outlining of cold code regions into separate "
+                 "functions (default with a PGO profile in -O1 and higher)"));
+#endif
 
 static cl::opt<bool> unitAtATime("unit-at-a-time", cl::desc("Enable basic IPO"),
                                  cl::ZeroOrMore, cl::init(true));
@@ -109,6 +147,24 @@ static cl::opt<bool>
     disableSLPVectorization("disable-slp-vectorization", cl::ZeroOrMore,
                             cl::desc("Disable the slp vectorization pass"));
 
+static cl::opt<bool> fastDebugCodegen(
+    "fast-debug-codegen", cl::ZeroOrMore,
+    cl::desc("At -O0, minimize compile times: force FastISel (GlobalISel on "
+             "AArch64) and skip the IR passes not needed for correctness"));
+
+namespace {
+enum class PassManagerKind { Legacy, New };
+}
+
+static cl::opt<PassManagerKind> passManager(
+    "passmanager", cl::ZeroOrMore,
+    cl::desc("Select the pass manager used for the optimization pipeline"),
+    cl::init(PassManagerKind::Legacy),
+    clEnumValues(clEnumValN(PassManagerKind::Legacy, "legacy",
+                            "Legacy pass manager (default)"),
+                 clEnumValN(PassManagerKind::New, "new",
+                            "New pass manager (requires LLVM 8+)")));
+
 unsigned optLevel() {
   // Use -O2 as a base for the size-optimization levels.
   return optimizeLevel >= 0 ? optimizeLevel : 2;
@@ -122,8 +178,25 @@ bool willInline() {
          (enableInlining == cl::BOU_UNSET && optLevel() > 1);
 }
 
+#if LDC_LLVM_VER >= 800
+// Determines whether or not to run the hot/cold splitting pass. The cold
+// regions are identified via the profile summary and branch weights. As for
+// clang, the pass isn't run in the LTO pre-link pipeline.
+static bool willSplitColdCode() {
+  if (optLevel() == 0 || opts::isUsingLTO())
+    return false;
+  return enableColdSplitting == cl::BOU_TRUE ||
+         (enableColdSplitting == cl::BOU_UNSET && opts::isUsingPGOProfile());
+}
+#endif
+
 bool willCrossModuleInline() {
-  return enableCrossModuleInlining == llvm::cl::BOU_TRUE;
+  return enableCrossModuleInlining == llvm::cl::BOU_TRUE ||
+         (enableCrossModuleInlining == llvm::cl::BOU_UNSET && willInline());
+}
+
+bool isCrossModuleInliningDisabled() {
+  return enableCrossModuleInlining == llvm::cl::BOU_FALSE;
 }
 
 #if LDC_LLVM_VER >= 900
@@ -171,6 +244,21 @@ static void addStripExternalsPass(const PassManagerBuilder &builder,
   }
 }
 
+// Which available_externally function bodies can be stripped before the
+// inliner, as it will never inline them. The remaining ones are stripped by
+// LLVM right after the inliner (-O2 and higher) and by the above pass.
+static ExternalsToStrip getExternalsToStripEarly() {
+  return willInline() ? ExternalsToStrip::NotInlinable
+                      : ExternalsToStrip::NotAlwaysInline;
+}
+
+static void addEarlyStripExternalsPass(const PassManagerBuilder &builder,
+                                       PassManagerBase &pm) {
+  if (builder.OptLevel >= 1) {
+    addPass(pm, createStripExternalsPass(getExternalsToStripEarly()));
+  }
+}
+
 static void addSimplifyDRuntimeCallsPass(const PassManagerBuilder &builder,
                                          PassManagerBase &pm) {
   if (builder.OptLevel >= 2 && builder.SizeLevel == 0) {
@@ -185,6 +273,20 @@ static void addGarbageCollect2StackPass(const PassManagerBuilder &builder,
   }
 }
 
+static void addBoundsCheckEliminationPass(const PassManagerBuilder &builder,
+                                          PassManagerBase &pm) {
+  if (builder.OptLevel >= 2 && builder.SizeLevel == 0) {
+    addPass(pm, createBoundsCheckEliminationPass());
+  }
+}
+
+static void addInferNoUnwindPass(const PassManagerBuilder &builder,
+                                 PassManagerBase &pm) {
+  if (builder.OptLevel >= 1) {
+    addPass(pm, createInferNoUnwindPass());
+  }
+}
+
 static void addAddressSanitizerPasses(const PassManagerBuilder &Builder,
                                       PassManagerBase &PM) {
   PM.add(createAddressSanitizerFunctionPass());
@@ -229,6 +331,24 @@ static void addSanitizerCoveragePass(const PassManagerBuilder &Builder,
 #endif
 }
 
+#if LDC_LLVM_VER >= 900
+// Returns true if the IR-based PGO profile contains context-sensitive data
+// (from a -fcs-profile-generate run), which then needs to be applied after
+// inlining too.
+static bool hasCSIRLevelProfile() {
+  static const bool result = [] {
+    auto reader =
+        IndexedInstrProfReader::create(global.params.datafileInstrProf);
+    if (!reader) {
+      consumeError(reader.takeError());
+      return false;
+    }
+    return (*reader)->hasCSIRLevelProfile();
+  }();
+  return result;
+}
+#endif
+
 // Adds PGO instrumentation generation and use passes.
 static void addPGOPasses(PassManagerBuilder &builder,
                          legacy::PassManagerBase &mpm, unsigned optLevel) {
@@ -237,6 +357,11 @@ static void addPGOPasses(PassManagerBuilder &builder,
     options.NoRedZone = global.params.disableRedZone;
     if (global.params.datafileInstrProf)
       options.InstrProfileOutput = global.params.datafileInstrProf;
+#if LDC_LLVM_VER >= 500
+    // With per-thread counters, only the merging into the shared counters
+    // is lowered by the pass.
+    options.Atomic = opts::profileUpdate != opts::ProfileUpdateMode::Single;
+#endif
     mpm.add(createInstrProfilingLegacyPass(options));
   } else if (opts::isUsingASTBasedPGOProfile()) {
 // We are generating code with PGO profile information available.
@@ -254,6 +379,24 @@ static void addPGOPasses(PassManagerBuilder &builder,
     builder.PGOInstrGen = global.params.datafileInstrProf;
   } else if (opts::isUsingIRBasedPGOProfile()) {
     builder.PGOInstrUse = global.params.datafileInstrProf;
+#if LDC_LLVM_VER >= 900
+    if (opts::instrumentingForCSPGO) {
+      builder.EnablePGOCSInstrGen = true;
+      builder.PGOInstrGen = opts::csPGOInstrGenFile;
+    } else {
+      builder.EnablePGOCSInstrUse = hasCSIRLevelProfile();
+    }
+#endif
+  } else if (opts::isUsingSampleBasedPGOProfile()) {
+#if LDC_LLVM_VER >= 400
+    builder.PGOSampleUse = global.params.datafileInstrProf;
+#endif
+    // Distinguish the different basic blocks of a line for the samples.
+    builder.addExtension(
+        PassManagerBuilder::EP_EarlyAsPossible,
+        [](const PassManagerBuilder &, legacy::PassManagerBase &pm) {
+          pm.add(createAddDiscriminatorsPass());
+        });
   }
 }
 
@@ -348,22 +491,313 @@ static void addOptimizationPasses(legacy::PassManagerBase &mpm,
       builder.addExtension(PassManagerBuilder::EP_LoopOptimizerEnd,
                            addGarbageCollect2StackPass);
     }
+
+    if (!disableBoundsCheckElimination) {
+      builder.addExtension(PassManagerBuilder::EP_LoopOptimizerEnd,
+                           addBoundsCheckEliminationPass);
+    }
+
+    // Early, before the inliner and the main function simplifications.
+    if (!disableNoUnwindInference) {
+      builder.addExtension(PassManagerBuilder::EP_ModuleOptimizerEarly,
+                           addInferNoUnwindPass);
+    }
   }
 
+  builder.addExtension(PassManagerBuilder::EP_ModuleOptimizerEarly,
+                       addEarlyStripExternalsPass);
   // EP_OptimizerLast does not exist in LLVM 3.0, add it manually below.
   builder.addExtension(PassManagerBuilder::EP_OptimizerLast,
                        addStripExternalsPass);
 
+#if LDC_LLVM_VER >= 800
+  if (willSplitColdCode()) {
+    builder.addExtension(
+        PassManagerBuilder::EP_OptimizerLast,
+        [](const PassManagerBuilder &, legacy::PassManagerBase &pm) {
+          pm.add(createHotColdSplittingPass());
+        });
+  }
+#endif
+
   addPGOPasses(builder, mpm, optLevel);
 
+#if LDC_LLVM_VER >= 400
+  // Lowers the coroutines of generator functions (at all optimization levels).
+  addCoroutinePassesToExtensionPoints(builder);
+#endif
+
   builder.populateFunctionPassManager(fpm);
   builder.populateModulePassManager(mpm);
 }
 
+#if LDC_LLVM_VER >= 800
+static PassBuilder::OptimizationLevel getPassBuilderOptLevel() {
+  switch (optimizeLevel) {
+  case -2:
+    return PassBuilder::Oz;
+  case -1:
+    return PassBuilder::Os;
+  case 0:
+    return PassBuilder::O0;
+  case 1:
+    return PassBuilder::O1;
+  case 2:
+    return PassBuilder::O2;
+  default:
+    return PassBuilder::O3;
+  }
+}
+
+// IR-based PGO is configured via the PassBuilder; AST-based PGO is handled
+// by explicitly added passes (see addPGOPassesNewPM()).
+static Optional<PGOOptions> getPGOOptions() {
+  const std::string file =
+      global.params.datafileInstrProf ? global.params.datafileInstrProf : "";
+#if LDC_LLVM_VER >= 900
+  if (opts::isInstrumentingForIRBasedPGO()) {
+    return PGOOptions(file, "", "", PGOOptions::IRInstr);
+  }
+  if (opts::isUsingIRBasedPGOProfile()) {
+    if (opts::instrumentingForCSPGO) {
+      return PGOOptions(file, opts::csPGOInstrGenFile, "", PGOOptions::IRUse,
+                        PGOOptions::CSIRInstr);
+    }
+    return PGOOptions(file, "", "", PGOOptions::IRUse,
+                      hasCSIRLevelProfile() ? PGOOptions::CSIRUse
+                                            : PGOOptions::NoCSAction);
+  }
+  if (opts::isUsingSampleBasedPGOProfile()) {
+    return PGOOptions(file, "", "", PGOOptions::SampleUse);
+  }
+#else
+  if (opts::isInstrumentingForIRBasedPGO()) {
+    return PGOOptions(file, "", "", "", /*RunProfileGen=*/true);
+  }
+  if (opts::isUsingIRBasedPGOProfile()) {
+    return PGOOptions("", file);
+  }
+  if (opts::isUsingSampleBasedPGOProfile()) {
+    return PGOOptions("", "", file);
+  }
+#endif
+  return None;
+}
+
+static void addPGOPassesNewPM(ModulePassManager &mpm) {
+  if (opts::isInstrumentingForASTBasedPGO()) {
+    InstrProfOptions options;
+    options.NoRedZone = global.params.disableRedZone;
+    if (global.params.datafileInstrProf)
+      options.InstrProfileOutput = global.params.datafileInstrProf;
+    options.Atomic = opts::profileUpdate != opts::ProfileUpdateMode::Single;
+    mpm.addPass(InstrProfiling(options));
+  } else if (opts::isUsingASTBasedPGOProfile()) {
+    // Do indirect call promotion from -O1
+    if (optLevel() > 0) {
+      mpm.addPass(PGOIndirectCallPromotion());
+    }
+    // Specialize memory intrinsics for the profiled sizes, unless
+    // optimizing for size (the legacy PassManagerBuilder does so by default).
+    if (optLevel() > 0 && sizeLevel() == 0) {
+      mpm.addPass(createModuleToFunctionPassAdaptor(PGOMemOPSizeOpt()));
+    }
+  }
+}
+
+// The passes registered at the pipeline start extension point.
+static void addPipelineStartPassesNewPM(ModulePassManager &mpm) {
+  if (optLevel() == 0) {
+    return;
+  }
+  if (!disableLangSpecificPasses && !disableNoUnwindInference) {
+    mpm.addPass(InferNoUnwindPass());
+    if (verifyEach) {
+      mpm.addPass(VerifierPass());
+    }
+  }
+  mpm.addPass(StripExternalsPass(getExternalsToStripEarly()));
+  if (verifyEach) {
+    mpm.addPass(VerifierPass());
+  }
+}
+
+/**
+ * Runs the default optimization pipeline using LLVM's new pass manager, with
+ * the D-specific passes registered at the same extension points as for the
+ * legacy PassManagerBuilder. The callbacks of new pass manager plugins are
+ * registered last. Without inlining, only the always-inliner is run.
+ *
+ * Sanitizer passes are not available for the new pass manager in all
+ * supported LLVM versions; they are run by a trailing legacy pass manager.
+ */
+static void runOptimizationPassesNewPM(llvm::Module &M, TargetMachine &target,
+                                       TargetLibraryInfoImpl &tlii) {
+  const auto level = getPassBuilderOptLevel();
+
+#if LDC_LLVM_VER >= 900
+  PipelineTuningOptions pto;
+  pto.LoopUnrolling = (disableLoopUnrolling.getNumOccurrences() > 0)
+                          ? !disableLoopUnrolling
+                          : optLevel() > 0;
+  pto.LoopVectorization =
+      !disableLoopVectorization && optLevel() > 1 && sizeLevel() < 2;
+  pto.SLPVectorization =
+      !disableSLPVectorization && optLevel() > 1 && sizeLevel() < 2;
+  PassBuilder pb(&target, pto, getPGOOptions());
+#else
+  PassBuilder pb(&target, getPGOOptions());
+#endif
+
+  LoopAnalysisManager lam;
+  FunctionAnalysisManager fam;
+  CGSCCAnalysisManager cgam;
+  ModuleAnalysisManager mam;
+
+  // Register our custom TLI and AA pipeline before the defaults so that they
+  // take precedence.
+  fam.registerPass([&] { return TargetLibraryAnalysis(tlii); });
+  fam.registerPass([&] { return pb.buildDefaultAAPipeline(); });
+
+  pb.registerModuleAnalyses(mam);
+  pb.registerCGSCCAnalyses(cgam);
+  pb.registerFunctionAnalyses(fam);
+  pb.registerLoopAnalyses(lam);
+  pb.crossRegisterProxies(lam, fam, cgam, mam);
+
+  pb.registerPipelineStartEPCallback(addPipelineStartPassesNewPM);
+
+  if (!disableLangSpecificPasses) {
+    pb.registerScalarOptimizerLateEPCallback(
+        [](FunctionPassManager &fpm, PassBuilder::OptimizationLevel level) {
+          // Only at -O2 and higher, but not when optimizing for size.
+          if (level != PassBuilder::O2 && level != PassBuilder::O3) {
+            return;
+          }
+          if (!disableSimplifyDruntimeCalls) {
+            fpm.addPass(SimplifyDRuntimeCallsPass());
+            if (verifyEach) {
+              fpm.addPass(VerifierPass());
+            }
+          }
+          if (!disableGCToStack) {
+            fpm.addPass(GarbageCollect2StackPass());
+            if (verifyEach) {
+              fpm.addPass(VerifierPass());
+            }
+          }
+          if (!disableBoundsCheckElimination) {
+            // The pass only handles loops in simplified and LCSSA form.
+            fpm.addPass(LoopSimplifyPass());
+            fpm.addPass(LCSSAPass());
+            fpm.addPass(BoundsCheckEliminationPass());
+            if (verifyEach) {
+              fpm.addPass(VerifierPass());
+            }
+          }
+        });
+  }
+
+  pb.registerOptimizerLastEPCallback(
+      [](ModulePassManager &mpm, PassBuilder::OptimizationLevel level) {
+        if (level != PassBuilder::O0) {
+          mpm.addPass(StripExternalsPass());
+          mpm.addPass(GlobalDCEPass());
+        }
+        if (willSplitColdCode()) {
+          mpm.addPass(HotColdSplittingPass());
+        }
+      });
+
+  registerPluginCallbacks(pb);
+
+  ModulePassManager mpm;
+  if (!noVerify) {
+    mpm.addPass(VerifierPass());
+  }
+  addPGOPassesNewPM(mpm);
+
+  if (!willInline()) {
+    // The default pipelines always run the inliner (PipelineTuningOptions
+    // has no switch for it), so assemble one running the always-inliner
+    // instead, followed by the function simplification and (unless the
+    // optimization is deferred to the ThinLTO backend) the module
+    // optimization pipelines. The pipeline start callbacks of plugins aren't
+    // invoked for it.
+    addPipelineStartPassesNewPM(mpm);
+    mpm.addPass(AlwaysInlinerPass());
+    mpm.addPass(createModuleToFunctionPassAdaptor(
+        pb.buildFunctionSimplificationPipeline(
+            level, PassBuilder::ThinLTOPhase::None)));
+    if (opts::isUsingThinLTO()) {
+      mpm.addPass(NameAnonGlobalPass());
+    } else {
+      mpm.addPass(pb.buildModuleOptimizationPipeline(level));
+    }
+  } else if (opts::isUsingThinLTO()) {
+    mpm.addPass(pb.buildThinLTOPreLinkDefaultPipeline(level));
+  } else if (opts::isUsingLTO()) {
+    mpm.addPass(pb.buildLTOPreLinkDefaultPipeline(level));
+  } else {
+    mpm.addPass(pb.buildPerModuleDefaultPipeline(level));
+  }
+
+  timetrace::Scope timeScope("Run module passes", M.getModuleIdentifier());
+  mpm.run(M, mam);
+}
+
+// Adds the passes that aren't part of the new pass manager pipeline.
+static void addLegacyOnlyPasses(legacy::PassManagerBase &pm) {
+  PassManagerBuilder builder;
+  builder.OptLevel = optLevel();
+  builder.SizeLevel = sizeLevel();
+
+  if (opts::isSanitizerEnabled(opts::AddressSanitizer)) {
+    addAddressSanitizerPasses(builder, pm);
+  }
+  if (opts::isSanitizerEnabled(opts::MemorySanitizer)) {
+    addMemorySanitizerPass(builder, pm);
+  }
+  if (opts::isSanitizerEnabled(opts::ThreadSanitizer)) {
+    addThreadSanitizerPass(builder, pm);
+  }
+  if (opts::isSanitizerEnabled(opts::CoverageSanitizer)) {
+    addSanitizerCoveragePass(builder, pm);
+  }
+}
+#endif
+
+static bool isFastDebugCodegen() { return fastDebugCodegen && optLevel() == 0; }
+
+void setupFastDebugCodegen(llvm::TargetMachine &target) {
+  if (!isFastDebugCodegen())
+    return;
+
+  // Set in the options (instead of setO0WantsFastISel()), so that they are
+  // inherited by the clones for parallel codegen.
+  target.Options.EnableFastISel = true;
+#if LDC_LLVM_VER >= 700
+  if (target.getTargetTriple().getArch() == Triple::aarch64) {
+    target.Options.EnableGlobalISel = true;
+    // Fall back to SelectionDAG for unsupported constructs.
+    target.Options.GlobalISelAbort = GlobalISelAbortMode::Disable;
+  }
+#endif
+}
+
+// Returns whether the -O0 module needs IR passes even with
+// -fast-debug-codegen, e.g., for lowering instrumentation or coroutines.
+static bool needsIRPassesAtO0(llvm::Module &M) {
+  return opts::isAnySanitizerEnabled() ||
+         opts::isInstrumentingForASTBasedPGO() ||
+         opts::isInstrumentingForIRBasedPGO() || stripDebug ||
+         arePluginsLoaded() || M.getFunction("llvm.coro.begin");
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // This function runs optimization passes based on command line arguments.
 // Returns true if any optimization passes were invoked.
-bool ldc_optimize_module(llvm::Module *M) {
+bool ldc_optimize_module(llvm::Module *M, llvm::TargetMachine &target) {
   // Create a PassManager to hold and optimize the collection of
   // per-module passes we are about to build.
   legacy::PassManager mpm;
@@ -378,6 +812,31 @@ bool ldc_optimize_module(llvm::Module *M) {
   if (getComputeTargetType(M) == ComputeBackend::SPIRV)
     return false;
 
+  // Skip setting up the (mostly empty) -O0 pipeline altogether. Only compilers
+  // with assertions verify the module then.
+  if (isFastDebugCodegen() && !needsIRPassesAtO0(*M)) {
+#ifndef NDEBUG
+    if (!noVerify) {
+      verifyModule(M);
+    }
+#endif
+    return false;
+  }
+
+  // The new pass manager is only used for actual optimization pipelines;
+  // -O0 keeps using the legacy pipeline.
+  bool useNewPM = false;
+  if (passManager == PassManagerKind::New) {
+#if LDC_LLVM_VER >= 800
+    // The new pass manager pipeline doesn't lower coroutines yet.
+    useNewPM = optLevel() > 0 && !M->getFunction("llvm.coro.begin");
+#else
+    error(Loc(), "-passmanager=new requires LDC to be built against LLVM 8 "
+                 "or later");
+    fatal();
+#endif
+  }
+
   // Add an appropriate TargetLibraryInfo pass for the module's triple.
   TargetLibraryInfoImpl *tlii =
       new TargetLibraryInfoImpl(Triple(M->getTargetTriple()));
@@ -386,6 +845,28 @@ bool ldc_optimize_module(llvm::Module *M) {
   if (disableSimplifyLibCalls)
     tlii->disableAllFunctions();
 
+#if LDC_LLVM_VER >= 800
+  if (useNewPM) {
+    timetrace::Scope timeScope("Optimize", M->getModuleIdentifier());
+
+    if (stripDebug) {
+      StripDebugInfo(*M);
+    }
+
+    runOptimizationPassesNewPM(*M, target, *tlii);
+
+    mpm.add(new TargetLibraryInfoWrapperPass(*tlii));
+    mpm.add(createTargetTransformInfoWrapperPass(target.getTargetIRAnalysis()));
+    addLegacyOnlyPasses(mpm);
+    mpm.run(*M);
+
+    if (!noVerify) {
+      verifyModule(M);
+    }
+    return true;
+  }
+#endif
+
   mpm.add(new TargetLibraryInfoWrapperPass(*tlii));
 
   // The DataLayout is already set at the module (in module.cpp,
@@ -394,15 +875,13 @@ bool ldc_optimize_module(llvm::Module *M) {
   // override the module data layout
 
   // Add internal analysis passes from the target machine.
-  mpm.add(createTargetTransformInfoWrapperPass(
-      gTargetMachine->getTargetIRAnalysis()));
+  mpm.add(createTargetTransformInfoWrapperPass(target.getTargetIRAnalysis()));
 
   // Also set up a manager for the per-function passes.
   legacy::FunctionPassManager fpm(M);
 
   // Add internal analysis passes from the target machine.
-  fpm.add(createTargetTransformInfoWrapperPass(
-      gTargetMachine->getTargetIRAnalysis()));
+  fpm.add(createTargetTransformInfoWrapperPass(target.getTargetIRAnalysis()));
 
   // If the -strip-debug command line option was specified, add it before
   // anything else.
@@ -412,15 +891,21 @@ bool ldc_optimize_module(llvm::Module *M) {
 
   addOptimizationPasses(mpm, fpm, optLevel(), sizeLevel());
 
+  timetrace::Scope timeScope("Optimize", M->getModuleIdentifier());
+
   // Run per-function passes.
   fpm.doInitialization();
   for (auto &F : *M) {
+    timetrace::Scope timeScope("Run function passes", F.getName());
     fpm.run(F);
   }
   fpm.doFinalization();
 
   // Run per-module passes.
-  mpm.run(*M);
+  {
+    timetrace::Scope timeScope("Run module passes", M->getModuleIdentifier());
+    mpm.run(*M);
+  }
 
   // Verify the resulting module.
   if (!noVerify) {
@@ -454,9 +939,13 @@ void outputOptimizationSettings(llvm::raw_ostream &hash_os) {
   hash_os << disableSimplifyDruntimeCalls;
   hash_os << disableSimplifyLibCalls;
   hash_os << disableGCToStack;
+  hash_os << disableBoundsCheckElimination;
+  hash_os << disableNoUnwindInference;
   hash_os << unitAtATime;
   hash_os << stripDebug;
   hash_os << disableLoopUnrolling;
   hash_os << disableLoopVectorization;
   hash_os << disableSLPVectorization;
+  hash_os << static_cast<int>(passManager.getValue());
+  hash_os << fastDebugCodegen;
 }
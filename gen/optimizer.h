@@ -25,15 +25,21 @@ class raw_ostream;
 
 namespace llvm {
 class Module;
+class TargetMachine;
 }
 
-bool ldc_optimize_module(llvm::Module *m);
+bool ldc_optimize_module(llvm::Module *m, llvm::TargetMachine &target);
 
 // Returns whether the normal, full inlining pass will be run.
 bool willInline();
 
+// Returns whether functions from other modules are made available for
+// inlining (pragma(inline, true) functions are, unless explicitly disabled).
 bool willCrossModuleInline();
 
+// Returns whether cross-module inlining was disabled on the command line.
+bool isCrossModuleInliningDisabled();
+
 #if LDC_LLVM_VER >= 900
 llvm::FramePointer::FP whichFramePointersToEmit();
 #else
@@ -46,6 +52,9 @@ bool isOptimizationEnabled();
 
 llvm::CodeGenOpt::Level codeGenOptLevel();
 
+// Adjusts the target options for -fast-debug-codegen (if enabled).
+void setupFastDebugCodegen(llvm::TargetMachine &target);
+
 void verifyModule(llvm::Module *m);
 
 void outputOptimizationSettings(llvm::raw_ostream &hash_os);
@@ -0,0 +1,97 @@
+//===-- optremarks.cpp ----------------------------------------------------===//
+//
+//                         LDC – the LLVM D compiler
+//
+// This file is distributed under the BSD-style LDC license. See the LICENSE
+// file for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "gen/optremarks.h"
+
+#include "driver/cl_options.h"
+#include "llvm/IR/DiagnosticInfo.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Instruction.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/ValueHandle.h"
+#include "llvm/Support/CommandLine.h"
+#include <string>
+#include <vector>
+
+namespace {
+#if LDC_LLVM_VER >= 500
+using InstructionHandle = llvm::WeakTrackingVH;
+#else
+using InstructionHandle = llvm::WeakVH;
+#endif
+
+struct CodegenRemark {
+  std::string name;
+  InstructionHandle inst;
+  std::string msg;
+  bool missed;
+};
+
+/// The codegen remarks of the module(s) being generated. The instructions are
+/// tracked, as cleanups may remove them before the module is written.
+std::vector<CodegenRemark> codegenRemarks;
+} // anonymous namespace
+
+void emitOptRemark(const char *passName, llvm::StringRef remarkName,
+                   const llvm::Instruction *inst, const llvm::Twine &msg,
+                   bool missed) {
+  llvm::LLVMContext &ctx = inst->getContext();
+#if LDC_LLVM_VER >= 500
+  if (missed) {
+    ctx.diagnose(llvm::OptimizationRemarkMissed(passName, remarkName, inst)
+                 << msg.str());
+  } else {
+    ctx.diagnose(llvm::OptimizationRemark(passName, remarkName, inst)
+                 << msg.str());
+  }
+#else
+  const llvm::Function &fn = *inst->getParent()->getParent();
+  if (missed) {
+    llvm::emitOptimizationRemarkMissed(ctx, passName, fn, inst->getDebugLoc(),
+                                       msg);
+  } else {
+    llvm::emitOptimizationRemark(ctx, passName, fn, inst->getDebugLoc(), msg);
+  }
+#endif
+}
+
+bool areCodegenRemarksEnabled() {
+  static const bool enabled = [] {
+#if LDC_LLVM_VER >= 400
+    if (opts::saveOptimizationRecord.getNumOccurrences() > 0)
+      return true;
+#endif
+    const auto &options = llvm::cl::getRegisteredOptions();
+    for (const char *name :
+         {"pass-remarks", "pass-remarks-missed", "pass-remarks-analysis"}) {
+      auto it = options.find(name);
+      if (it != options.end() && it->second->getNumOccurrences() > 0)
+        return true;
+    }
+    return false;
+  }();
+  return enabled;
+}
+
+void addCodegenRemark(llvm::StringRef remarkName, llvm::Instruction *inst,
+                      const llvm::Twine &msg, bool missed) {
+  codegenRemarks.push_back(
+      {remarkName.str(), InstructionHandle(inst), msg.str(), missed});
+}
+
+void emitCodegenRemarks() {
+  for (const auto &remark : codegenRemarks) {
+    if (auto inst = llvm::dyn_cast_or_null<llvm::Instruction>(
+            static_cast<llvm::Value *>(remark.inst))) {
+      emitOptRemark(codegenRemarksPassName, remark.name, inst, remark.msg,
+                    remark.missed);
+    }
+  }
+  codegenRemarks.clear();
+}
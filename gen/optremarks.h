@@ -0,0 +1,48 @@
+//===-- gen/optremarks.h - Optimization remarks -----------------*- C++ -*-===//
+//
+//                         LDC – the LLVM D compiler
+//
+// This file is distributed under the BSD-style LDC license. See the LICENSE
+// file for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Optimization remarks of LDC's D-specific passes and codegen decisions, for
+// -pass-remarks[-missed]=<regex> and -fsave-optimization-record. Like LLVM's
+// own remarks, they only have a source location with (line tables) debug
+// info.
+//
+//===----------------------------------------------------------------------===//
+
+#pragma once
+
+#include "llvm/ADT/StringRef.h"
+#include "llvm/ADT/Twine.h"
+
+namespace llvm {
+class Instruction;
+}
+
+/// The pass name of the remarks about codegen decisions (closures, GC
+/// allocations, bounds checks and virtual calls).
+constexpr const char *codegenRemarksPassName = "dcodegen";
+
+/// Emits a remark of the pass `passName` (which must be a string literal) at
+/// instruction `inst`. `missed` selects between a passed and a missed
+/// optimization remark.
+void emitOptRemark(const char *passName, llvm::StringRef remarkName,
+                   const llvm::Instruction *inst, const llvm::Twine &msg,
+                   bool missed = false);
+
+/// Returns whether remarks are requested, via -pass-remarks* or
+/// -fsave-optimization-record, so that the codegen only builds them if needed.
+bool areCodegenRemarksEnabled();
+
+/// Queues a remark about a codegen decision at instruction `inst`. They are
+/// emitted by emitCodegenRemarks() once the optimization record file has been
+/// set up for the module.
+void addCodegenRemark(llvm::StringRef remarkName, llvm::Instruction *inst,
+                      const llvm::Twine &msg, bool missed = true);
+
+/// Emits the queued codegen remarks.
+void emitCodegenRemarks();
@@ -0,0 +1,437 @@
+//===-- BoundsCheckElimination.cpp - Remove and hoist array bounds checks -===//
+//
+//                         LDC – the LLVM D compiler
+//
+// This file is distributed under the BSD-style LDC license. See the LICENSE
+// file for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file removes array bounds checks which are implied by a dominating
+// check, and hoists the checks of accesses indexed by an induction variable
+// out of innermost loops: the loop is versioned on a single check of the
+// index range in the preheader, so that the (common) in-bounds version runs
+// without any checks, while the original checked loop is kept for the case
+// that some access may be out of bounds.
+//
+// A bounds check is a conditional branch on an unsigned `index < length`
+// comparison, with the failure block calling _d_arraybounds.
+//
+//===----------------------------------------------------------------------===//
+
+#define DEBUG_TYPE "dbce"
+#if LDC_LLVM_VER < 700
+#define LLVM_DEBUG DEBUG
+#endif
+
+#include "gen/optremarks.h"
+#include "gen/passes/Passes.h"
+#include "llvm/Pass.h"
+#include "llvm/ADT/DepthFirstIterator.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/ScalarEvolution.h"
+#include "llvm/Analysis/ScalarEvolutionExpander.h"
+#include "llvm/Analysis/ScalarEvolutionExpressions.h"
+#include "llvm/IR/CallSite.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/DataLayout.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Compiler.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/Transforms/Utils/ValueMapper.h"
+#if LDC_LLVM_VER >= 700
+#include "llvm/Transforms/Utils.h"
+#else
+#include "llvm/Transforms/Scalar.h"
+#endif
+
+using namespace llvm;
+
+STATISTIC(NumRedundant, "Number of bounds checks removed as redundant");
+STATISTIC(NumHoisted, "Number of bounds checks hoisted out of loops");
+STATISTIC(NumVersioned, "Number of loops versioned on hoisted bounds checks");
+
+static cl::opt<unsigned> MaxLoopSize(
+    "dbce-max-loop-size", cl::ZeroOrMore, cl::Hidden, cl::init(512),
+    cl::desc("Maximum number of instructions in loops duplicated for "
+             "hoisting bounds checks"));
+
+namespace {
+/// A check of `Index < Length` (unsigned), branching to a block reporting a
+/// RangeError if it fails.
+struct BoundsCheck {
+  BranchInst *Br;
+  Value *Index;
+  Value *Length;
+  unsigned OkSuccessor;
+
+  /// Makes the check always succeed. The branch to the failure block is left
+  /// for SimplifyCFG to remove, so that the CFG (and its analyses) are kept.
+  void remove() const {
+    Br->setCondition(ConstantInt::get(Type::getInt1Ty(Br->getContext()),
+                                      OkSuccessor == 0));
+  }
+};
+
+class BoundsCheckEliminationImpl {
+  Function &F;
+  DominatorTree &DT;
+  LoopInfo &LI;
+  ScalarEvolution &SE;
+
+public:
+  BoundsCheckEliminationImpl(Function &F, DominatorTree &DT, LoopInfo &LI,
+                             ScalarEvolution &SE)
+      : F(F), DT(DT), LI(LI), SE(SE) {}
+
+  bool run();
+
+private:
+  bool removeRedundantChecks();
+  bool hoistChecks(Loop *L);
+  void versionLoop(Loop *L, Value *InBounds);
+};
+} // end anonymous namespace
+
+/// Returns whether BB reports an out-of-bounds array access.
+static bool isBoundsFailureBlock(BasicBlock *BB) {
+  for (Instruction &I : *BB) {
+    CallSite CS(&I);
+    if (!CS) {
+      continue;
+    }
+    Function *Callee = CS.getCalledFunction();
+    if (Callee && Callee->getName() == "_d_arraybounds") {
+      return true;
+    }
+  }
+  return false;
+}
+
+/// Matches the bounds check terminating a basic block, in any of the forms
+/// InstCombine may have canonicalized the comparison to.
+static bool matchBoundsCheck(Instruction *TI, BoundsCheck &Check) {
+  auto Br = dyn_cast<BranchInst>(TI);
+  if (!Br || !Br->isConditional()) {
+    return false;
+  }
+  auto Cmp = dyn_cast<ICmpInst>(Br->getCondition());
+  if (!Cmp) {
+    return false;
+  }
+
+  Value *LHS = Cmp->getOperand(0);
+  Value *RHS = Cmp->getOperand(1);
+  Check.Br = Br;
+  switch (Cmp->getPredicate()) {
+  case ICmpInst::ICMP_ULT: // i < len
+    Check.Index = LHS;
+    Check.Length = RHS;
+    Check.OkSuccessor = 0;
+    break;
+  case ICmpInst::ICMP_UGT: // len > i
+    Check.Index = RHS;
+    Check.Length = LHS;
+    Check.OkSuccessor = 0;
+    break;
+  case ICmpInst::ICMP_UGE: // i >= len
+    Check.Index = LHS;
+    Check.Length = RHS;
+    Check.OkSuccessor = 1;
+    break;
+  case ICmpInst::ICMP_ULE: // len <= i
+    Check.Index = RHS;
+    Check.Length = LHS;
+    Check.OkSuccessor = 1;
+    break;
+  default:
+    return false;
+  }
+
+  BasicBlock *OkBB = Br->getSuccessor(Check.OkSuccessor);
+  BasicBlock *FailBB = Br->getSuccessor(1 - Check.OkSuccessor);
+  return OkBB != FailBB && isBoundsFailureBlock(FailBB);
+}
+
+/// Returns whether `Index < Length` implies `Implied < Length`.
+static bool impliesIndex(Value *Index, Value *Implied) {
+  if (Index == Implied) {
+    return true;
+  }
+  auto C = dyn_cast<ConstantInt>(Index);
+  auto ImpliedC = dyn_cast<ConstantInt>(Implied);
+  return C && ImpliedC && ImpliedC->getValue().ule(C->getValue());
+}
+
+bool BoundsCheckEliminationImpl::run() {
+  bool Changed = removeRedundantChecks();
+
+  // Versioning adds loops, so collect the innermost ones first.
+  SmallVector<Loop *, 8> Loops;
+  for (Loop *TopLevel : LI) {
+    for (Loop *L : depth_first(TopLevel)) {
+      if (L->empty()) {
+        Loops.push_back(L);
+      }
+    }
+  }
+
+  for (Loop *L : Loops) {
+    Changed |= hoistChecks(L);
+  }
+
+  return Changed;
+}
+
+bool BoundsCheckEliminationImpl::removeRedundantChecks() {
+  SmallVector<BoundsCheck, 16> Checks;
+  for (BasicBlock &BB : F) {
+    BoundsCheck Check;
+    if (matchBoundsCheck(BB.getTerminator(), Check)) {
+      Checks.push_back(Check);
+    }
+  }
+
+  bool Changed = false;
+  for (const BoundsCheck &Check : Checks) {
+    for (const BoundsCheck &Dom : Checks) {
+      if (&Dom == &Check || Dom.Length != Check.Length ||
+          !impliesIndex(Dom.Index, Check.Index)) {
+        continue;
+      }
+      BasicBlockEdge OkEdge(Dom.Br->getParent(),
+                            Dom.Br->getSuccessor(Dom.OkSuccessor));
+      if (!DT.dominates(OkEdge, Check.Br->getParent())) {
+        continue;
+      }
+
+      LLVM_DEBUG(errs() << "Removing redundant bounds check in "
+                        << Check.Br->getParent()->getName() << "\n");
+      emitOptRemark(DEBUG_TYPE, "Redundant", Check.Br,
+                    "bounds check removed: implied by a dominating check");
+      Check.remove();
+      ++NumRedundant;
+      Changed = true;
+      break;
+    }
+  }
+  return Changed;
+}
+
+bool BoundsCheckEliminationImpl::hoistChecks(Loop *L) {
+  BasicBlock *Preheader = L->getLoopPreheader();
+  BasicBlock *Latch = L->getLoopLatch();
+  if (!Preheader || !Latch || !L->isLoopSimplifyForm() ||
+      !L->isLCSSAForm(DT)) {
+    return false;
+  }
+
+  // Bound the iterations: the loop exits after at most ExitCount backedges
+  // via an exiting block executed in every iteration.
+  const SCEV *ExitCount = nullptr;
+  SmallVector<BasicBlock *, 4> ExitingBlocks;
+  L->getExitingBlocks(ExitingBlocks);
+  for (BasicBlock *Exiting : ExitingBlocks) {
+    if (!DT.dominates(Exiting, Latch)) {
+      continue;
+    }
+    const SCEV *Count = SE.getExitCount(L, Exiting);
+    if (!isa<SCEVCouldNotCompute>(Count) && isSafeToExpand(Count, SE)) {
+      ExitCount = Count;
+      break;
+    }
+  }
+  if (!ExitCount) {
+    return false;
+  }
+
+  unsigned Size = 0;
+  SmallVector<BoundsCheck, 4> Hoisted;
+  SmallVector<const SCEVAddRecExpr *, 4> Indices;
+  for (BasicBlock *BB : L->blocks()) {
+    Size += BB->size();
+
+    BoundsCheck Check;
+    if (!matchBoundsCheck(BB->getTerminator(), Check) ||
+        !L->isLoopInvariant(Check.Length)) {
+      continue;
+    }
+    auto AR = dyn_cast<SCEVAddRecExpr>(SE.getSCEV(Check.Index));
+    if (!AR || AR->getLoop() != L || !AR->isAffine() ||
+        !isa<SCEVConstant>(AR->getStepRecurrence(SE)) ||
+        !isSafeToExpand(AR->getStart(), SE)) {
+      continue;
+    }
+    Hoisted.push_back(Check);
+    Indices.push_back(AR);
+  }
+  if (Hoisted.empty() || Size > MaxLoopSize) {
+    return false;
+  }
+
+  // All checks pass if the index range [Start, Start + Step * ExitCount]
+  // doesn't wrap and is below the length; compute it in integers wide enough
+  // not to overflow themselves.
+  const DataLayout &DL = F.getParent()->getDataLayout();
+  Instruction *InsertPt = Preheader->getTerminator();
+  SCEVExpander Expander(SE, DL, "bounds");
+  IRBuilder<> B(InsertPt);
+
+  Value *Count =
+      Expander.expandCodeFor(ExitCount, ExitCount->getType(), InsertPt);
+  const unsigned CountBits = Count->getType()->getIntegerBitWidth();
+
+  Value *InBounds = nullptr;
+  for (size_t i = 0; i < Hoisted.size(); ++i) {
+    const BoundsCheck &Check = Hoisted[i];
+    const SCEVAddRecExpr *AR = Indices[i];
+    Type *IndexTy = Check.Length->getType();
+    const unsigned IndexBits = IndexTy->getIntegerBitWidth();
+    const unsigned WideBits = IndexBits + CountBits;
+    Type *WideTy = B.getIntNTy(WideBits);
+
+    Value *Start = Expander.expandCodeFor(AR->getStart(), IndexTy, InsertPt);
+    Value *WideStart = B.CreateZExt(Start, WideTy);
+    Value *WideCount = B.CreateZExt(Count, WideTy);
+    Value *WideLength = B.CreateZExt(Check.Length, WideTy);
+
+    const APInt &Step =
+        cast<SCEVConstant>(AR->getStepRecurrence(SE))->getAPInt();
+    Value *C;
+    if (Step.isNonNegative()) {
+      // increasing: Start + Step * Count < Length
+      Value *Distance = B.CreateNUWMul(
+          WideCount, ConstantInt::get(WideTy, Step.zext(WideBits)));
+      Value *Last = B.CreateNUWAdd(WideStart, Distance);
+      C = B.CreateICmpULT(Last, WideLength, "bounds.last");
+    } else {
+      // decreasing: Start < Length && Step * Count <= Start
+      Value *Distance = B.CreateNUWMul(
+          WideCount, ConstantInt::get(WideTy, (-Step).zext(WideBits)));
+      C = B.CreateAnd(B.CreateICmpULT(Start, Check.Length, "bounds.first"),
+                      B.CreateICmpULE(Distance, WideStart, "bounds.last"));
+    }
+    InBounds = InBounds ? B.CreateAnd(InBounds, C) : C;
+  }
+  InBounds->setName("bounds.inrange");
+
+  LLVM_DEBUG(errs() << "Hoisting " << Hoisted.size()
+                    << " bounds checks out of loop "
+                    << L->getHeader()->getName() << "\n");
+  for (const BoundsCheck &Check : Hoisted) {
+    emitOptRemark(DEBUG_TYPE, "Hoisted", Check.Br,
+                  "bounds check hoisted out of the loop");
+  }
+
+  versionLoop(L, InBounds);
+
+  // The original loop is now the in-bounds version.
+  for (const BoundsCheck &Check : Hoisted) {
+    Check.remove();
+  }
+  NumHoisted += Hoisted.size();
+  ++NumVersioned;
+
+  SE.forgetLoop(L);
+  return true;
+}
+
+void BoundsCheckEliminationImpl::versionLoop(Loop *L, Value *InBounds) {
+  BasicBlock *CheckBB = L->getLoopPreheader();
+  BasicBlock *Preheader =
+      SplitBlock(CheckBB, CheckBB->getTerminator(), &DT, &LI);
+  Preheader->setName(L->getHeader()->getName() + ".ph");
+
+  ValueToValueMapTy VMap;
+  SmallVector<BasicBlock *, 8> ClonedBlocks;
+  Loop *Checked = cloneLoopWithPreheader(Preheader, CheckBB, L, VMap,
+                                         ".boundschecked", &LI, &DT,
+                                         ClonedBlocks);
+  remapInstructionsInBlocks(ClonedBlocks, VMap);
+
+  // Both loop versions branch to the original exit blocks (including the
+  // bounds failure blocks). As the loop is in LCSSA form, the values used
+  // outside are merged by the PHI nodes there.
+  SmallVector<BasicBlock *, 4> ExitBlocks;
+  L->getUniqueExitBlocks(ExitBlocks);
+  for (BasicBlock *Exit : ExitBlocks) {
+    for (auto I = Exit->begin(); auto PN = dyn_cast<PHINode>(I); ++I) {
+      for (unsigned i = 0, e = PN->getNumIncomingValues(); i != e; ++i) {
+        BasicBlock *Pred = PN->getIncomingBlock(i);
+        if (!L->contains(Pred)) {
+          continue;
+        }
+        Value *V = PN->getIncomingValue(i);
+        if (Value *Cloned = VMap.lookup(V)) {
+          V = Cloned;
+        }
+        PN->addIncoming(V, cast<BasicBlock>(VMap[Pred]));
+      }
+    }
+
+    BasicBlock *IDom = DT.getNode(Exit)->getIDom()->getBlock();
+    if (L->contains(IDom)) {
+      DT.changeImmediateDominator(Exit, CheckBB);
+    }
+  }
+
+  Instruction *OldTerm = CheckBB->getTerminator();
+  BranchInst::Create(Preheader, Checked->getLoopPreheader(), InBounds,
+                     OldTerm);
+  OldTerm->eraseFromParent();
+}
+
+namespace {
+class LLVM_LIBRARY_VISIBILITY BoundsCheckElimination : public FunctionPass {
+public:
+  static char ID; // Pass identification
+  BoundsCheckElimination() : FunctionPass(ID) {}
+
+  bool runOnFunction(Function &F) override {
+    DominatorTree &DT = getAnalysis<DominatorTreeWrapperPass>().getDomTree();
+    LoopInfo &LI = getAnalysis<LoopInfoWrapperPass>().getLoopInfo();
+    ScalarEvolution &SE = getAnalysis<ScalarEvolutionWrapperPass>().getSE();
+    return BoundsCheckEliminationImpl(F, DT, LI, SE).run();
+  }
+
+  void getAnalysisUsage(AnalysisUsage &AU) const override {
+    AU.addRequired<DominatorTreeWrapperPass>();
+    AU.addRequired<LoopInfoWrapperPass>();
+    AU.addRequired<ScalarEvolutionWrapperPass>();
+    AU.addRequiredID(LoopSimplifyID);
+    AU.addRequiredID(LCSSAID);
+  }
+};
+char BoundsCheckElimination::ID = 0;
+} // end anonymous namespace.
+
+static RegisterPass<BoundsCheckElimination>
+    X("dbce", "Remove redundant and hoist loop array bounds checks");
+
+// Public interface to the pass.
+FunctionPass *createBoundsCheckEliminationPass() {
+  return new BoundsCheckElimination();
+}
+
+#if LDC_LLVM_VER >= 800
+PreservedAnalyses
+BoundsCheckEliminationPass::run(Function &F, FunctionAnalysisManager &AM) {
+  auto &DT = AM.getResult<DominatorTreeAnalysis>(F);
+  auto &LI = AM.getResult<LoopAnalysis>(F);
+  auto &SE = AM.getResult<ScalarEvolutionAnalysis>(F);
+  if (!BoundsCheckEliminationImpl(F, DT, LI, SE).run()) {
+    return PreservedAnalyses::all();
+  }
+  return PreservedAnalyses::none();
+}
+#endif
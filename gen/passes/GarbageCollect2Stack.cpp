@@ -19,10 +19,12 @@
 
 #include "gen/attributes.h"
 #include "gen/metadata.h"
+#include "gen/optremarks.h"
 #include "gen/passes/Passes.h"
 #include "gen/runtime.h"
 #include "llvm/Pass.h"
 #include "llvm/Analysis/CallGraph.h"
+#include "llvm/Analysis/CaptureTracking.h"
 #include "llvm/Analysis/ValueTracking.h"
 #include "llvm/ADT/SmallSet.h"
 #include "llvm/ADT/SmallVector.h"
@@ -32,6 +34,7 @@
 #include "llvm/IR/Constants.h"
 #include "llvm/IR/DataLayout.h"
 #include "llvm/IR/Dominators.h"
+#include "llvm/IR/IntrinsicInst.h"
 #include "llvm/IR/Intrinsics.h"
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/Module.h"
@@ -53,6 +56,10 @@ STATISTIC(NumToDynSize,
           "Number of calls promoted to dynamically-sized allocas");
 STATISTIC(NumDeleted,
           "Number of GC calls deleted because the return value was unused");
+STATISTIC(NumClosureToStack,
+          "Number of closure frames (_d_allocmemory) promoted to allocas");
+STATISTIC(NumGuardedToStack,
+          "Number of array allocations promoted behind a runtime size check");
 
 static cl::opt<unsigned>
     SizeLimit("dgc2stack-size-limit", cl::ZeroOrMore, cl::Hidden,
@@ -60,6 +67,11 @@ static cl::opt<unsigned>
               cl::desc("Require allocs to be smaller than n bytes to be "
                        "promoted, 0 to ignore."));
 
+static cl::opt<bool> GuardedPromotion(
+    "dgc2stack-guarded", cl::ZeroOrMore, cl::Hidden, cl::init(true),
+    cl::desc("Promote array allocations whose size is only known at runtime "
+             "to a stack buffer of maximum size, guarded by a size check"));
+
 namespace {
 struct Analysis {
   const DataLayout &DL;
@@ -68,6 +80,10 @@ struct Analysis {
   CallGraphNode *CGNode;
 
   llvm::Type *getTypeFor(Value *typeinfo) const;
+  bool mayHaveElemPostblit(Value *typeinfo) const;
+
+private:
+  MDNode *getTypeInfoMetadata(Value *typeinfo) const;
 };
 }
 
@@ -92,6 +108,24 @@ static void EmitMemZero(IRBuilder<> &B, Value *Dst, Value *Len,
   EmitMemSet(B, Dst, ConstantInt::get(B.getInt8Ty(), 0), Len, A);
 }
 
+static void EmitMemCpy(IRBuilder<> &B, Value *Dst, Value *Src, Value *Len,
+                       const Analysis &A) {
+  Dst = B.CreateBitCast(Dst, PointerType::getUnqual(B.getInt8Ty()));
+  Src = B.CreateBitCast(Src, PointerType::getUnqual(B.getInt8Ty()));
+
+#if LDC_LLVM_VER >= 700
+  CallSite CS = B.CreateMemCpy(Dst, 1 /*Align*/, Src, 1 /*Align*/, Len,
+                               false /*isVolatile*/);
+#else
+  CallSite CS =
+      B.CreateMemCpy(Dst, Src, Len, 1 /*Align*/, false /*isVolatile*/);
+#endif
+  if (A.CGNode) {
+    A.CGNode->addCalledFunction(
+        CS, A.CG->getOrInsertFunction(CS.getCalledFunction()));
+  }
+}
+
 //===----------------------------------------------------------------------===//
 // Helpers for specific types of GC calls.
 //===----------------------------------------------------------------------===//
@@ -104,17 +138,50 @@ enum Type {
 };
 }
 
+/// A call producing an array of runtime size, to be promoted to a stack
+/// buffer of MaxCount elements when the actual count doesn't exceed it.
+struct GuardedArrayAlloc {
+  CallInst *Call;
+  llvm::Type *ElemTy;
+  uint64_t MaxCount;
+  /// The element count of a new array, or null for concatenations.
+  Value *Count;
+  /// Whether a new array is zero-initialized.
+  bool Initialized;
+  /// The concatenated arrays, copied into the buffer.
+  SmallVector<Value *, 4> Slices;
+};
+
 class FunctionInfo {
 protected:
   llvm::Type *Ty;
 
+  // Sets the reason for not promoting the last analyzed call and returns
+  // false.
+  bool reject(const char *reason) {
+    Reason = reason;
+    return false;
+  }
+
 public:
   ReturnType::Type ReturnType;
 
+  // Why the last analyzed call cannot be promoted, for optimization remarks.
+  const char *Reason = nullptr;
+
   // Analyze the current call, filling in some fields. Returns true if
   // this is an allocation we can stack-allocate.
   virtual bool analyze(CallSite CS, const Analysis &A) = 0;
 
+  // Returns whether the last analyzed call may only be promoted behind a
+  // runtime size check (see ArrayFI and promoteGuarded()).
+  virtual bool isGuarded() const { return false; }
+
+  // Returns the description of a guarded promotion of the last analyzed call.
+  virtual GuardedArrayAlloc getGuardedAlloc(CallSite CS) {
+    llvm_unreachable("Not a guarded promotion");
+  }
+
   // Returns the alloca to replace this call.
   // It will always be inserted before the call.
   virtual Value *promote(CallSite CS, IRBuilder<> &B, const Analysis &A) {
@@ -179,9 +246,12 @@ public:
     Value *TypeInfo = CS.getArgument(TypeInfoArgNr);
     Ty = A.getTypeFor(TypeInfo);
     if (!Ty) {
-      return false;
+      return reject("type unknown");
     }
-    return A.DL.getTypeAllocSize(Ty) < SizeLimit;
+    if (A.DL.getTypeAllocSize(Ty) >= SizeLimit) {
+      return reject("size exceeds the limit");
+    }
+    return true;
   }
 };
 
@@ -189,6 +259,7 @@ class ArrayFI : public TypeInfoFI {
   int ArrSizeArgNr;
   bool Initialized;
   Value *arrSize;
+  uint64_t GuardMaxCount;
 
 public:
   ArrayFI(ReturnType::Type returnType, unsigned tiArgNr, unsigned arrSizeArgNr,
@@ -202,6 +273,7 @@ public:
     }
 
     arrSize = CS.getArgument(ArrSizeArgNr);
+    GuardMaxCount = 0;
 
     // Extract the element type from the array type.
     const StructType *ArrTy = dyn_cast<StructType>(Ty);
@@ -218,13 +290,31 @@ public:
     if (SizeLimit > 0) {
       uint64_t ElemSize = A.DL.getTypeAllocSize(Ty);
       if (!isKnownLessThan(arrSize, SizeLimit / ElemSize, A)) {
-        return false;
+        // The block needs to be split for the size check, which isn't
+        // possible for invokes (and unwinding from the check isn't needed
+        // anyway).
+        if (!GuardedPromotion || !CS.isCall() || ElemSize == 0) {
+          return reject("size unknown");
+        }
+        GuardMaxCount = (SizeLimit - 1) / ElemSize;
+        if (GuardMaxCount == 0) {
+          return reject("element size exceeds the limit");
+        }
+        return true;
       }
     }
 
     return true;
   }
 
+  bool isGuarded() const override { return GuardMaxCount > 0; }
+
+  GuardedArrayAlloc getGuardedAlloc(CallSite CS) override {
+    assert(isGuarded());
+    return {cast<CallInst>(CS.getInstruction()), Ty, GuardMaxCount, arrSize,
+            Initialized, {}};
+  }
+
   Value *promote(CallSite CS, IRBuilder<> &B, const Analysis &A) override {
     IRBuilder<> Builder = B;
     // If the allocation is of constant size it's best to put it in the
@@ -270,17 +360,96 @@ public:
   }
 };
 
+/// FunctionInfo for _d_arraycatT and _d_arraycatnTX. The length of the
+/// result is hardly ever known at compile time, so these are always promoted
+/// behind a runtime size check.
+class ArrayCatFI : public TypeInfoFI {
+  bool Variadic; // _d_arraycatnTX(ti, byte[][] arrs) vs. _d_arraycatT(ti, x, y)
+  uint64_t NumArrays;
+  uint64_t MaxCount;
+
+public:
+  explicit ArrayCatFI(bool variadic)
+      : TypeInfoFI(ReturnType::Array, 0), Variadic(variadic) {}
+
+  bool analyze(CallSite CS, const Analysis &A) override {
+    // Without a size limit, there's no bound for the stack buffer.
+    if (!GuardedPromotion || SizeLimit == 0 || !CS.isCall()) {
+      return reject("result size unknown");
+    }
+    if (!TypeInfoFI::analyze(CS, A)) {
+      return false;
+    }
+
+    // The runtime also runs the postblits for the copied elements.
+    if (A.mayHaveElemPostblit(CS.getArgument(0))) {
+      return reject("elements may have postblits");
+    }
+
+    // Extract the element type from the array type.
+    const StructType *ArrTy = cast<StructType>(Ty);
+    Ty = cast<PointerType>(ArrTy->getElementType(1))->getElementType();
+
+    uint64_t ElemSize = A.DL.getTypeAllocSize(Ty);
+    if (ElemSize == 0) {
+      return reject("zero-sized elements");
+    }
+    MaxCount = (SizeLimit - 1) / ElemSize;
+    if (MaxCount == 0) {
+      return reject("element size exceeds the limit");
+    }
+
+    if (Variadic) {
+      // The glue code passes a stack array of a constant number of slices.
+      unsigned LengthIdx = 0;
+      auto N = dyn_cast_or_null<ConstantInt>(
+          FindInsertedValue(CS.getArgument(1), LengthIdx));
+      if (!N || N->isZero()) {
+        return reject("number of concatenated arrays unknown");
+      }
+      NumArrays = N->getZExtValue();
+    }
+
+    return true;
+  }
+
+  bool isGuarded() const override { return true; }
+
+  GuardedArrayAlloc getGuardedAlloc(CallSite CS) override {
+    GuardedArrayAlloc G = {cast<CallInst>(CS.getInstruction()),
+                           Ty,
+                           MaxCount,
+                           nullptr,
+                           false,
+                           {}};
+    if (Variadic) {
+      // Load the slices right before the call, i.e., in the same memory state
+      // the runtime would see them.
+      IRBuilder<> B(CS.getInstruction());
+      Value *Arrs = B.CreateExtractValue(CS.getArgument(1), 1);
+      for (uint64_t i = 0; i < NumArrays; ++i) {
+        G.Slices.push_back(
+            B.CreateLoad(B.CreateConstInBoundsGEP1_64(Arrs, i), ".catslice"));
+      }
+    } else {
+      G.Slices.push_back(CS.getArgument(1));
+      G.Slices.push_back(CS.getArgument(2));
+    }
+    return G;
+  }
+};
+
 // FunctionInfo for _d_allocclass
 class AllocClassFI : public FunctionInfo {
 public:
   bool analyze(CallSite CS, const Analysis &A) override {
     if (CS.arg_size() != 1) {
-      return false;
+      return reject("unexpected signature");
     }
     Value *arg = CS.getArgument(0)->stripPointerCasts();
     GlobalVariable *ClassInfo = dyn_cast<GlobalVariable>(arg);
     if (!ClassInfo) {
-      return false;
+      return reject("class unknown");
     }
 
     std::string metaname = CD_PREFIX;
@@ -288,12 +457,12 @@ public:
 
     NamedMDNode *meta = A.M.getNamedMetadata(metaname);
     if (!meta) {
-      return false;
+      return reject("class unknown");
     }
 
     MDNode *node = static_cast<MDNode *>(meta->getOperand(0));
     if (!node || node->getNumOperands() != CD_NumFields) {
-      return false;
+      return reject("class unknown");
     }
 
     // Inserting destructor calls is not implemented yet, so classes
@@ -306,17 +475,20 @@ public:
     auto hasCustomDelete =
         mdconst::dyn_extract<Constant>(node->getOperand(CD_CustomDelete));
     if (hasDestructor == nullptr || hasCustomDelete == nullptr) {
-      return false;
+      return reject("class unknown");
     }
 
     if (ConstantExpr::getOr(hasDestructor, hasCustomDelete) !=
         ConstantInt::getFalse(A.M.getContext())) {
-      return false;
+      return reject("class has a destructor or custom deallocator");
     }
 
     Ty = mdconst::dyn_extract<Constant>(node->getOperand(CD_BodyType))
              ->getType();
-    return A.DL.getTypeAllocSize(Ty) < SizeLimit;
+    if (A.DL.getTypeAllocSize(Ty) >= SizeLimit) {
+      return reject("size exceeds the limit");
+    }
+    return true;
   }
 
   // The default promote() should be fine.
@@ -333,7 +505,7 @@ class UntypedMemoryFI : public FunctionInfo {
 public:
   bool analyze(CallSite CS, const Analysis &A) override {
     if (CS.arg_size() < SizeArgNr + 1) {
-      return false;
+      return reject("unexpected signature");
     }
 
     SizeArg = CS.getArgument(SizeArgNr);
@@ -345,7 +517,7 @@ public:
     // is useful for experimenting.
     if (SizeLimit > 0) {
       if (!isKnownLessThan(SizeArg, SizeLimit, A)) {
-        return false;
+        return reject("size unknown or exceeding the limit");
       }
     }
 
@@ -370,11 +542,15 @@ public:
     } else {
       NumToDynSize++;
     }
+    // The glue code only uses _d_allocmemory for closure frames.
+    NumClosureToStack++;
 
     // Convert array size to 32 bits if necessary
     Value *count = Builder.CreateIntCast(SizeArg, Builder.getInt32Ty(), false);
-    AllocaInst *alloca =
-        Builder.CreateAlloca(Ty, count, ".nongc_mem"); // FIXME: align?
+    AllocaInst *alloca = Builder.CreateAlloca(Ty, count, ".nongc_mem");
+    // The type of the allocated memory is unknown; match the GC's alignment
+    // guarantee (e.g., for closure frames containing reals).
+    alloca->setAlignment(16);
 
     return Builder.CreateBitCast(alloca, CS.getType());
   }
@@ -389,29 +565,42 @@ public:
 //===----------------------------------------------------------------------===//
 
 namespace {
-/// This pass replaces GC calls with alloca's
+/// Replaces GC calls with alloca's. Shared by the legacy and the new pass
+/// manager versions of the pass.
 ///
-class LLVM_LIBRARY_VISIBILITY GarbageCollect2Stack : public FunctionPass {
+class LLVM_LIBRARY_VISIBILITY GarbageCollect2StackImpl {
   StringMap<FunctionInfo *> KnownFunctions;
-  Module *M;
 
   TypeInfoFI AllocMemoryT;
   ArrayFI NewArrayU;
   ArrayFI NewArrayT;
   AllocClassFI AllocClass;
   UntypedMemoryFI AllocMemory;
+  ArrayCatFI ArrayCatT;
+  ArrayCatFI ArrayCatnTX;
+
+public:
+  GarbageCollect2StackImpl();
+
+  bool run(Function &F, DominatorTree &DT, CallGraph *CG);
+};
+
+/// This pass replaces GC calls with alloca's
+///
+class LLVM_LIBRARY_VISIBILITY GarbageCollect2Stack : public FunctionPass {
+  GarbageCollect2StackImpl Impl;
 
 public:
   static char ID; // Pass identification
-  GarbageCollect2Stack();
+  GarbageCollect2Stack() : FunctionPass(ID) {}
 
-  bool doInitialization(Module &M) override {
-    this->M = &M;
-    return false;
+  bool runOnFunction(Function &F) override {
+    DominatorTree &DT = getAnalysis<DominatorTreeWrapperPass>().getDomTree();
+    CallGraphWrapperPass *CGPass =
+        getAnalysisIfAvailable<CallGraphWrapperPass>();
+    return Impl.run(F, DT, CGPass ? &CGPass->getCallGraph() : nullptr);
   }
 
-  bool runOnFunction(Function &F) override;
-
   void getAnalysisUsage(AnalysisUsage &AU) const override {
     AU.addRequired<DominatorTreeWrapperPass>();
     AU.addPreserved<CallGraphWrapperPass>();
@@ -428,15 +617,35 @@ FunctionPass *createGarbageCollect2Stack() {
   return new GarbageCollect2Stack();
 }
 
-GarbageCollect2Stack::GarbageCollect2Stack()
-    : FunctionPass(ID), AllocMemoryT(ReturnType::Pointer, 0),
+#if LDC_LLVM_VER >= 800
+// KnownFunctions points into the instance, so it is shared by copies of the
+// pass object instead of being copied along.
+class GarbageCollect2StackPass::Impl : public GarbageCollect2StackImpl {};
+
+GarbageCollect2StackPass::GarbageCollect2StackPass()
+    : impl(std::make_shared<Impl>()) {}
+
+PreservedAnalyses GarbageCollect2StackPass::run(Function &F,
+                                                FunctionAnalysisManager &AM) {
+  if (!impl->run(F, AM.getResult<DominatorTreeAnalysis>(F), nullptr)) {
+    return PreservedAnalyses::all();
+  }
+  return PreservedAnalyses::none();
+}
+#endif
+
+GarbageCollect2StackImpl::GarbageCollect2StackImpl()
+    : AllocMemoryT(ReturnType::Pointer, 0),
       NewArrayU(ReturnType::Array, 0, 1, false),
-      NewArrayT(ReturnType::Array, 0, 1, true), AllocMemory(0) {
+      NewArrayT(ReturnType::Array, 0, 1, true), AllocMemory(0),
+      ArrayCatT(false), ArrayCatnTX(true) {
   KnownFunctions["_d_allocmemoryT"] = &AllocMemoryT;
   KnownFunctions["_d_newarrayU"] = &NewArrayU;
   KnownFunctions["_d_newarrayT"] = &NewArrayT;
   KnownFunctions["_d_allocclass"] = &AllocClass;
   KnownFunctions["_d_allocmemory"] = &AllocMemory;
+  KnownFunctions["_d_arraycatT"] = &ArrayCatT;
+  KnownFunctions["_d_arraycatnTX"] = &ArrayCatnTX;
 }
 
 static void RemoveCall(CallSite CS, const Analysis &A) {
@@ -457,6 +666,89 @@ static void RemoveCall(CallSite CS, const Analysis &A) {
   CS->eraseFromParent();
 }
 
+/// Rewrites a guarded array allocation into
+///
+///   if (count <= MaxCount) { result = {count, entryBlockBuffer}; }
+///   else                   { result = <original GC call>; }
+///
+/// where entryBlockBuffer is a stack buffer of MaxCount elements, which is
+/// zero-initialized or filled with the concatenated arrays. Like the runtime,
+/// the stack path yields a null pointer for empty results.
+static void promoteGuarded(const GuardedArrayAlloc &G, const Analysis &A) {
+  CallInst *Call = G.Call;
+  Function &F = *Call->getParent()->getParent();
+  LLVMContext &Ctx = F.getContext();
+
+  BasicBlock &Entry = F.getEntryBlock();
+  auto Buffer = new AllocaInst(ArrayType::get(G.ElemTy, G.MaxCount),
+#if LDC_LLVM_VER >= 500
+                               A.DL.getAllocaAddrSpace(),
+#endif
+                               ".nongc_mem", &(*Entry.begin()));
+
+  // Isolate the GC call in its own block and branch around it.
+  BasicBlock *Head = Call->getParent();
+  BasicBlock *HeapBB = Head->splitBasicBlock(Call->getIterator(), "gc2heap");
+  BasicBlock *ContBB =
+      HeapBB->splitBasicBlock(std::next(Call->getIterator()), "gc2stack.cont");
+  BasicBlock *StackBB = BasicBlock::Create(Ctx, "gc2stack", &F, HeapBB);
+
+  Instruction *OldTerm = Head->getTerminator();
+  IRBuilder<> B(OldTerm);
+
+  Value *Count = G.Count;
+  SmallVector<Value *, 4> Lengths;
+  for (Value *Slice : G.Slices) {
+    Value *Len = B.CreateExtractValue(Slice, 0);
+    Lengths.push_back(Len);
+    Count = Count ? B.CreateAdd(Count, Len) : Len;
+  }
+  assert(Count && "Neither a count nor arrays to concatenate?");
+
+  Value *Fits = B.CreateICmpULE(
+      Count, ConstantInt::get(Count->getType(), G.MaxCount), "fits");
+  B.CreateCondBr(Fits, StackBB, HeapBB);
+  OldTerm->eraseFromParent();
+
+  B.SetInsertPoint(StackBB);
+  auto ArrTy = cast<StructType>(Call->getType());
+  Value *Mem = B.CreateBitCast(Buffer, ArrTy->getElementType(1));
+  if (G.Initialized) {
+    // For now, only zero-init is supported.
+    uint64_t size = A.DL.getTypeStoreSize(G.ElemTy);
+    Value *TypeSize = ConstantInt::get(Count->getType(), size);
+    EmitMemZero(B, Mem, B.CreateMul(TypeSize, Count), A);
+  }
+  Value *Offset = nullptr;
+  for (size_t i = 0; i < G.Slices.size(); ++i) {
+    Value *ElemSize = ConstantInt::get(Lengths[i]->getType(),
+                                       A.DL.getTypeAllocSize(G.ElemTy));
+    Value *Size = B.CreateMul(Lengths[i], ElemSize);
+    Value *Dst = Offset ? B.CreateInBoundsGEP(Mem, Offset) : Mem;
+    EmitMemCpy(B, Dst, B.CreateExtractValue(G.Slices[i], 1), Size, A);
+    Offset = Offset ? B.CreateAdd(Offset, Size) : Size;
+  }
+
+  Value *IsEmpty =
+      B.CreateICmpEQ(Count, ConstantInt::get(Count->getType(), 0));
+  Value *Ptr = B.CreateSelect(
+      IsEmpty,
+      ConstantPointerNull::get(cast<PointerType>(ArrTy->getElementType(1))),
+      Mem);
+  Value *Slice = llvm::UndefValue::get(ArrTy);
+  Slice = B.CreateInsertValue(Slice, Count, 0);
+  Slice = B.CreateInsertValue(Slice, Ptr, 1);
+  B.CreateBr(ContBB);
+
+  PHINode *Result =
+      PHINode::Create(ArrTy, 2, Call->getName(), &(*ContBB->begin()));
+  Call->replaceAllUsesWith(Result);
+  Result->addIncoming(Slice, StackBB);
+  Result->addIncoming(Call, HeapBB);
+
+  NumGuardedToStack++;
+}
+
 static bool
 isSafeToStackAllocateArray(BasicBlock::iterator Alloc, DominatorTree &DT,
                            SmallVector<CallInst *, 4> &RemoveTailCallInsts);
@@ -464,23 +756,25 @@ static bool
 isSafeToStackAllocate(BasicBlock::iterator Alloc, Value *V, DominatorTree &DT,
                       SmallVector<CallInst *, 4> &RemoveTailCallInsts);
 
-/// runOnFunction - Top level algorithm.
+/// run - Top level algorithm.
 ///
-bool GarbageCollect2Stack::runOnFunction(Function &F) {
+bool GarbageCollect2StackImpl::run(Function &F, DominatorTree &DT,
+                                   CallGraph *CG) {
   LLVM_DEBUG(errs() << "\nRunning -dgc2stack on function " << F.getName() << '\n');
 
   const DataLayout &DL = F.getParent()->getDataLayout();
-  DominatorTree &DT = getAnalysis<DominatorTreeWrapperPass>().getDomTree();
-  CallGraphWrapperPass *CGPass = getAnalysisIfAvailable<CallGraphWrapperPass>();
-  CallGraph *CG = CGPass ? &CGPass->getCallGraph() : nullptr;
   CallGraphNode *CGNode = CG ? (*CG)[&F] : nullptr;
 
-  Analysis A = {DL, *M, CG, CGNode};
+  Analysis A = {DL, *F.getParent(), CG, CGNode};
 
   BasicBlock &Entry = F.getEntryBlock();
 
   IRBuilder<> AllocaBuilder(&Entry, Entry.begin());
 
+  // Guarded promotions split blocks, so they are deferred until all calls
+  // have been analyzed (which requires an up-to-date dominator tree anyway).
+  SmallVector<GuardedArrayAlloc, 4> GuardedAllocs;
+
   bool Changed = false;
   for (auto &BB : F) {
     for (auto I = BB.begin(), E = BB.end(); I != E;) {
@@ -511,25 +805,38 @@ bool GarbageCollect2Stack::runOnFunction(Function &F) {
       if (Inst->use_empty()) {
         Changed = true;
         NumDeleted++;
+        emitOptRemark(DEBUG_TYPE, "Deleted", Inst,
+                      "unused GC allocation (" + Callee->getName() +
+                          ") removed");
         RemoveCall(CS, A);
         continue;
       }
 
       LLVM_DEBUG(errs() << "GarbageCollect2Stack inspecting: " << *Inst);
 
+      info->Reason = nullptr;
       if (!info->analyze(CS, A)) {
+        emitOptRemark(DEBUG_TYPE, "NotPromoted", Inst,
+                      "GC allocation (" + Callee->getName() +
+                          ") not promoted: " +
+                          (info->Reason ? info->Reason : "unsupported"),
+                      /*missed=*/true);
         continue;
       }
 
       SmallVector<CallInst *, 4> RemoveTailCallInsts;
-      if (info->ReturnType == ReturnType::Array) {
-        if (!isSafeToStackAllocateArray(originalI, DT, RemoveTailCallInsts)) {
-          continue;
-        }
-      } else {
-        if (!isSafeToStackAllocate(originalI, Inst, DT, RemoveTailCallInsts)) {
-          continue;
-        }
+      const bool isSafe =
+          info->ReturnType == ReturnType::Array
+              ? isSafeToStackAllocateArray(originalI, DT, RemoveTailCallInsts)
+              : isSafeToStackAllocate(originalI, Inst, DT,
+                                      RemoveTailCallInsts);
+      if (!isSafe) {
+        emitOptRemark(DEBUG_TYPE, "NotPromoted", Inst,
+                      "GC allocation (" + Callee->getName() +
+                          ") not promoted: memory may escape or be "
+                          "reallocated",
+                      /*missed=*/true);
+        continue;
       }
 
       // Let's alloca this!
@@ -541,6 +848,19 @@ bool GarbageCollect2Stack::runOnFunction(Function &F) {
         i->setTailCall(false);
       }
 
+      if (info->isGuarded()) {
+        emitOptRemark(DEBUG_TYPE, "PromotedGuarded", Inst,
+                      "GC allocation (" + Callee->getName() +
+                          ") promoted to the stack behind a runtime size "
+                          "check");
+        GuardedAllocs.push_back(info->getGuardedAlloc(CS));
+        continue;
+      }
+
+      emitOptRemark(DEBUG_TYPE, "Promoted", Inst,
+                    "GC allocation (" + Callee->getName() +
+                        ") promoted to the stack");
+
       IRBuilder<> Builder(&BB, originalI);
       Value *newVal = info->promote(CS, Builder, A);
 
@@ -557,10 +877,14 @@ bool GarbageCollect2Stack::runOnFunction(Function &F) {
     }
   }
 
+  for (const auto &G : GuardedAllocs) {
+    promoteGuarded(G, A);
+  }
+
   return Changed;
 }
 
-llvm::Type *Analysis::getTypeFor(Value *typeinfo) const {
+MDNode *Analysis::getTypeInfoMetadata(Value *typeinfo) const {
   GlobalVariable *ti_global =
       dyn_cast<GlobalVariable>(typeinfo->stripPointerCasts());
   if (!ti_global) {
@@ -590,11 +914,30 @@ llvm::Type *Analysis::getTypeFor(Value *typeinfo) const {
     return nullptr;
   }
 
+  return node;
+}
+
+llvm::Type *Analysis::getTypeFor(Value *typeinfo) const {
+  MDNode *node = getTypeInfoMetadata(typeinfo);
+  if (!node) {
+    return nullptr;
+  }
 
   return llvm::cast<llvm::ValueAsMetadata>(node->getOperand(TD_Type))
       ->getType();
 }
 
+bool Analysis::mayHaveElemPostblit(Value *typeinfo) const {
+  MDNode *node = getTypeInfoMetadata(typeinfo);
+  if (!node) {
+    return true;
+  }
+
+  auto md = llvm::dyn_cast<llvm::ConstantAsMetadata>(
+      node->getOperand(TD_ElemPostblit).get());
+  return md == nullptr || !md->getValue()->isNullValue();
+}
+
 /// Returns whether Def is used by any instruction that is reachable from Alloc
 /// (without executing Def again).
 static bool mayBeUsedAfterRealloc(Instruction *Def, BasicBlock::iterator Alloc,
@@ -731,6 +1074,116 @@ static bool mayBeUsedAfterRealloc(Instruction *Def, BasicBlock::iterator Alloc,
   return false;
 }
 
+/// Returns whether Store may be followed by a load from Loads which is
+/// reachable from Alloc without executing Store again, i.e., whether a load
+/// might read a pointer stored in a previous execution of Alloc.
+static bool mayBeLoadedAfterRealloc(Instruction *Store,
+                                    const SmallPtrSetImpl<Instruction *> &Loads,
+                                    BasicBlock::iterator Alloc) {
+  typedef std::pair<BasicBlock *, BasicBlock::iterator> StartPoint;
+  SmallVector<StartPoint, 16> Worklist;
+  SmallSet<BasicBlock *, 16> Visited;
+
+  BasicBlock::iterator Start = Alloc;
+  ++Start;
+  Worklist.push_back(StartPoint(Alloc->getParent(), Start));
+
+  while (!Worklist.empty()) {
+    StartPoint sp = Worklist.pop_back_val();
+    BasicBlock *B = sp.first;
+    bool stopped = false;
+    for (BasicBlock::iterator BBI = sp.second, E = B->end(); BBI != E; ++BBI) {
+      if (&*BBI == Store || &*BBI == &*Alloc) {
+        stopped = true;
+        break;
+      }
+      if (Loads.count(&*BBI)) {
+        LLVM_DEBUG(errs() << "### Problematic load: " << *BBI);
+        return true;
+      }
+    }
+    if (stopped) {
+      continue;
+    }
+
+    auto *Term = B->getTerminator();
+    for (unsigned i = 0, e = Term->getNumSuccessors(); i != e; ++i) {
+      BasicBlock *Succ = Term->getSuccessor(i);
+      if (Visited.insert(Succ).second) {
+        Worklist.push_back(StartPoint(Succ, Succ->begin()));
+      }
+    }
+  }
+
+  return false;
+}
+
+/// Returns the alloca Ptr points into if the alloca's address doesn't escape,
+/// i.e., if it is only loaded from and stored to. Collects all loads from it.
+static AllocaInst *getLocalSlot(Value *Ptr,
+                                SmallPtrSetImpl<Instruction *> &Loads) {
+  AllocaInst *Slot = dyn_cast<AllocaInst>(Ptr->stripInBoundsOffsets());
+  if (!Slot) {
+    return nullptr;
+  }
+
+  SmallVector<Instruction *, 16> Worklist;
+  Worklist.push_back(Slot);
+  while (!Worklist.empty()) {
+    Instruction *Addr = Worklist.pop_back_val();
+    for (auto U : Addr->users()) {
+      Instruction *I = cast<Instruction>(U);
+      switch (I->getOpcode()) {
+      case Instruction::Load:
+        Loads.insert(I);
+        break;
+      case Instruction::Store:
+        if (I->getOperand(0) == Addr) {
+          // The slot's address is stored somewhere.
+          return nullptr;
+        }
+        break;
+      case Instruction::BitCast:
+      case Instruction::GetElementPtr:
+        Worklist.push_back(I);
+        break;
+      case Instruction::Call:
+        if (auto II = dyn_cast<IntrinsicInst>(I)) {
+          if (II->getIntrinsicID() == Intrinsic::lifetime_start ||
+              II->getIntrinsicID() == Intrinsic::lifetime_end) {
+            break;
+          }
+        }
+        return nullptr;
+      default:
+        return nullptr;
+      }
+    }
+  }
+
+  return Slot;
+}
+
+/// Returns whether the pointer passed as argument ArgNo to the (direct) call
+/// CS may be captured by the callee, as far as its definition shows.
+static bool mayBeCapturedByCallee(CallSite CS, unsigned ArgNo) {
+  Function *Callee = CS.getCalledFunction();
+  // Only inspect definitions which can't be replaced at link time; ODR
+  // linkages are fine (e.g., templates and their nested functions).
+  if (!Callee || Callee->isDeclaration() || Callee->isInterposable() ||
+      ArgNo >= Callee->arg_size()) {
+    return true;
+  }
+
+  Argument *Arg = &*std::next(Callee->arg_begin(), ArgNo);
+  if (!Arg->getType()->isPointerTy()) {
+    // E.g., a delegate passed by value.
+    return true;
+  }
+  return PointerMayBeCaptured(Arg, /*ReturnCaptures=*/true,
+                              /*StoreCaptures=*/true);
+}
+
 /// Returns true if the GC call passed in is safe to turn into a stack
 /// allocation.
 ///
@@ -849,8 +1302,10 @@ bool isSafeToStackAllocate(BasicBlock::iterator Alloc, Value *V,
           const unsigned paramHasAttr_firstArg = 0;
 #endif
           if (!CS.paramHasAttr(A - B + paramHasAttr_firstArg,
-                               LLAttribute::NoCapture)) {
-            // The parameter is not marked 'nocapture' - captured.
+                               LLAttribute::NoCapture) &&
+              mayBeCapturedByCallee(CS, A - B)) {
+            // The parameter is not marked 'nocapture' and the callee's body
+            // doesn't prove otherwise - captured.
             return false;
           }
 
@@ -871,11 +1326,42 @@ bool isSafeToStackAllocate(BasicBlock::iterator Alloc, Value *V,
       break;
     case Instruction::Store:
       if (V == I->getOperand(0)) {
-        // Stored the pointer - it may be captured.
-        return false;
+        // Stored the pointer - it may be captured, unless it is stored to a
+        // local variable whose address doesn't escape (e.g., a delegate
+        // context pointer which hasn't been promoted to SSA). Then the loads
+        // from it are derived pointers, and there mustn't be a path to them
+        // from a later allocation without storing the new pointer first.
+        SmallPtrSet<Instruction *, 16> Loads;
+        if (!getLocalSlot(I->getOperand(1), Loads) ||
+            mayBeLoadedAfterRealloc(I, Loads, Alloc)) {
+          return false;
+        }
+        for (auto L : Loads) {
+          if (mayBeUsedAfterRealloc(L, Alloc, DT)) {
+            return false;
+          }
+          for (Instruction::use_iterator UI = L->use_begin(),
+                                         UE = L->use_end();
+               UI != UE; ++UI) {
+            Use *LU = &(*UI);
+            if (Visited.insert(LU).second) {
+              Worklist.push_back(LU);
+            }
+          }
+        }
       }
       // Storing to the pointee does not cause the pointer to be captured.
       break;
+    case Instruction::ExtractValue:
+      // E.g., the context pointer of a delegate. Other non-pointer members
+      // can't carry the pointer.
+      if (!I->getType()->isPointerTy() && !I->getType()->isAggregateType()) {
+        break;
+      }
+      // Fall through.
+    case Instruction::InsertValue:
+      // An aggregate containing the pointer (e.g., a delegate), tracked just
+      // like derived pointers.
     case Instruction::BitCast:
     case Instruction::GetElementPtr:
     case Instruction::PHI:
@@ -0,0 +1,226 @@
+//===-- InferNoUnwind.cpp - Infer nounwind and remove dead landing pads ---===//
+//
+//                         LDC – the LLVM D compiler
+//
+// This file is distributed under the BSD-style LDC license. See the LICENSE
+// file for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This pass infers the nounwind attribute for the functions defined in the
+// module, bottom-up over the call graph, converts the invokes of functions
+// which cannot unwind to plain calls and removes the landing pads becoming
+// dead that way.
+//
+// The frontend's nothrow only covers explicitly annotated functions and
+// templates whose callees are nothrow; LLVM's own inference (PruneEH,
+// FunctionAttrs) skips all linkonce_odr/weak_odr functions, i.e., all
+// template instances, as another module might contain a differently optimized
+// definition. D guarantees all instances to be semantically identical though,
+// and the pass runs before any of the main optimizations, so their
+// definitions are treated as exact here.
+//
+//===----------------------------------------------------------------------===//
+
+#define DEBUG_TYPE "infer-nounwind"
+#if LDC_LLVM_VER < 700
+#define LLVM_DEBUG DEBUG
+#endif
+
+#include "gen/passes/Passes.h"
+#include "llvm/ADT/SCCIterator.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/CallGraph.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Pass.h"
+#include "llvm/Support/Compiler.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/Utils/Local.h"
+
+using namespace llvm;
+
+STATISTIC(NumNoUnwind, "Number of functions inferred as nounwind");
+STATISTIC(NumInvokes, "Number of invokes converted to calls");
+
+namespace {
+using FunctionSet = SmallPtrSet<const Function *, 8>;
+
+const Function *getCallee(const Value *calledValue) {
+  return dyn_cast<Function>(calledValue->stripPointerCasts());
+}
+
+// Returns true if the specified function (or call site) is known not to
+// unwind, or is part of the specified SCC assumed not to unwind.
+bool isNoUnwindCall(const Value *calledValue,
+                    const FunctionSet &assumedNoUnwind) {
+  if (auto callee = getCallee(calledValue))
+    if (callee->doesNotThrow() || assumedNoUnwind.count(callee))
+      return true;
+  return false;
+}
+
+// Returns true if the specified instruction may unwind to the caller.
+bool mayUnwindToCaller(const Instruction &I,
+                       const FunctionSet &assumedNoUnwind) {
+  if (isa<ResumeInst>(I))
+    return true;
+  if (auto cri = dyn_cast<CleanupReturnInst>(&I))
+    return cri->unwindsToCaller();
+  if (auto csi = dyn_cast<CatchSwitchInst>(&I))
+    return csi->unwindsToCaller();
+  if (auto ci = dyn_cast<CallInst>(&I)) {
+    if (ci->doesNotThrow())
+      return false;
+    return !isNoUnwindCall(ci->getCalledValue(), assumedNoUnwind);
+  }
+  return false;
+}
+
+void convertToCall(InvokeInst *II) {
+  SmallVector<Value *, 8> args(II->arg_begin(), II->arg_end());
+  SmallVector<OperandBundleDef, 1> bundles;
+  II->getOperandBundlesAsDefs(bundles);
+
+  CallInst *call =
+      CallInst::Create(II->getCalledValue(), args, bundles, "", II);
+  call->takeName(II);
+  call->setCallingConv(II->getCallingConv());
+  call->setAttributes(II->getAttributes());
+  call->setDebugLoc(II->getDebugLoc());
+  II->replaceAllUsesWith(call);
+
+  // Branch to the normal destination and drop the unwind edge.
+  BasicBlock *bb = II->getParent();
+  BranchInst::Create(II->getNormalDest(), II);
+  II->getUnwindDest()->removePredecessor(bb);
+  II->eraseFromParent();
+}
+
+// Converts all invokes of functions which cannot unwind to calls, and removes
+// the landing pads (and personality) not needed anymore.
+bool removeDeadInvokes(Function &F, const FunctionSet &assumedNoUnwind) {
+  SmallVector<InvokeInst *, 16> invokes;
+  for (auto &BB : F) {
+    if (auto II = dyn_cast<InvokeInst>(BB.getTerminator()))
+      if (II->doesNotThrow() ||
+          isNoUnwindCall(II->getCalledValue(), assumedNoUnwind))
+        invokes.push_back(II);
+  }
+  if (invokes.empty())
+    return false;
+
+  for (auto II : invokes) {
+    LLVM_DEBUG(errs() << "Converting to call: " << *II << '\n');
+    convertToCall(II);
+    ++NumInvokes;
+  }
+  removeUnreachableBlocks(F);
+
+  if (F.hasPersonalityFn()) {
+    bool hasEHPads = false;
+    for (auto &BB : F) {
+      if (BB.isEHPad()) {
+        hasEHPads = true;
+        break;
+      }
+    }
+    if (!hasEHPads)
+      F.setPersonalityFn(nullptr);
+  }
+
+  return true;
+}
+
+// Returns true if the definition of the specified function is known to be
+// the one used at runtime (see file comment for the *_odr linkages).
+bool hasKnownDefinition(const Function *F) {
+  return F && !F->isDeclaration() && !F->isInterposable();
+}
+
+bool inferNoUnwind(Module &M) {
+  bool changed = false;
+
+  CallGraph CG(M);
+  // Bottom-up, i.e., callees first.
+  for (auto I = scc_begin(&CG); !I.isAtEnd(); ++I) {
+    const std::vector<CallGraphNode *> &scc = *I;
+
+    SmallVector<Function *, 4> sccDefinitions;
+    FunctionSet sccFunctions;
+    bool sccMayUnwind = false;
+    for (auto node : scc) {
+      Function *F = node->getFunction();
+      if (!hasKnownDefinition(F)) {
+        sccMayUnwind = true;
+        continue;
+      }
+      sccDefinitions.push_back(F);
+      sccFunctions.insert(F);
+      // A previously handled callee might have been inferred as nounwind.
+      changed |= removeDeadInvokes(*F, FunctionSet());
+    }
+
+    if (!sccMayUnwind) {
+      // Optimistically assume all functions of the SCC not to unwind (for
+      // their calls among each other) and check them.
+      for (auto F : sccDefinitions) {
+        if (F->doesNotThrow())
+          continue;
+        for (const auto &Inst : instructions(F)) {
+          if (mayUnwindToCaller(Inst, sccFunctions)) {
+            sccMayUnwind = true;
+            break;
+          }
+        }
+        if (sccMayUnwind)
+          break;
+      }
+    }
+
+    if (sccMayUnwind)
+      continue;
+
+    for (auto F : sccDefinitions) {
+      if (!F->doesNotThrow()) {
+        LLVM_DEBUG(errs() << "Inferred nounwind: " << F->getName() << '\n');
+        F->setDoesNotThrow();
+        ++NumNoUnwind;
+        changed = true;
+      }
+    }
+    // The (mutually) recursive invokes within the SCC.
+    for (auto F : sccDefinitions)
+      changed |= removeDeadInvokes(*F, sccFunctions);
+  }
+
+  return changed;
+}
+
+struct LLVM_LIBRARY_VISIBILITY InferNoUnwind : public ModulePass {
+  static char ID; // Pass identification, replacement for typeid
+  InferNoUnwind() : ModulePass(ID) {}
+
+  bool runOnModule(Module &M) override { return inferNoUnwind(M); }
+};
+}
+
+char InferNoUnwind::ID = 0;
+static RegisterPass<InferNoUnwind>
+    X("infer-nounwind",
+      "Infer nounwind (including *_odr functions) and remove dead landing "
+      "pads");
+
+ModulePass *createInferNoUnwindPass() { return new InferNoUnwind(); }
+
+#if LDC_LLVM_VER >= 800
+PreservedAnalyses InferNoUnwindPass::run(Module &M, ModuleAnalysisManager &) {
+  return inferNoUnwind(M) ? PreservedAnalyses::none()
+                          : PreservedAnalyses::all();
+}
+#endif
@@ -14,6 +14,10 @@
 #pragma once
 
 #include "gen/metadata.h"
+#if LDC_LLVM_VER >= 800
+#include "llvm/IR/PassManager.h"
+#include <memory>
+#endif
 
 namespace llvm {
 class FunctionPass;
@@ -25,4 +29,65 @@ llvm::FunctionPass *createSimplifyDRuntimeCalls();
 
 llvm::FunctionPass *createGarbageCollect2Stack();
 
-llvm::ModulePass *createStripExternalsPass();
+// Removes redundant array bounds checks and hoists them out of loops.
+llvm::FunctionPass *createBoundsCheckEliminationPass();
+
+// Which available_externally definitions StripExternals strips.
+enum class ExternalsToStrip {
+  All,
+  // Only function bodies the inliner can never use (noinline/optnone).
+  NotInlinable,
+  // Only function bodies without alwaysinline, for the always-inliner.
+  NotAlwaysInline
+};
+
+llvm::ModulePass *
+createStripExternalsPass(ExternalsToStrip toStrip = ExternalsToStrip::All);
+
+// Infers nounwind, also for *_odr functions, and converts the invokes of
+// such functions to calls.
+llvm::ModulePass *createInferNoUnwindPass();
+
+#if LDC_LLVM_VER >= 800
+// New pass manager versions of the passes above. The function passes set up
+// their tables once per pass object (i.e., per pipeline), not per function.
+
+struct SimplifyDRuntimeCallsPass
+    : public llvm::PassInfoMixin<SimplifyDRuntimeCallsPass> {
+  SimplifyDRuntimeCallsPass();
+  llvm::PreservedAnalyses run(llvm::Function &F,
+                              llvm::FunctionAnalysisManager &AM);
+
+private:
+  class Impl;
+  std::shared_ptr<Impl> impl;
+};
+
+struct GarbageCollect2StackPass
+    : public llvm::PassInfoMixin<GarbageCollect2StackPass> {
+  GarbageCollect2StackPass();
+  llvm::PreservedAnalyses run(llvm::Function &F,
+                              llvm::FunctionAnalysisManager &AM);
+
+private:
+  class Impl;
+  std::shared_ptr<Impl> impl;
+};
+
+struct BoundsCheckEliminationPass
+    : public llvm::PassInfoMixin<BoundsCheckEliminationPass> {
+  llvm::PreservedAnalyses run(llvm::Function &F,
+                              llvm::FunctionAnalysisManager &AM);
+};
+
+struct StripExternalsPass : public llvm::PassInfoMixin<StripExternalsPass> {
+  ExternalsToStrip toStrip;
+  explicit StripExternalsPass(ExternalsToStrip toStrip = ExternalsToStrip::All)
+      : toStrip(toStrip) {}
+  llvm::PreservedAnalyses run(llvm::Module &M, llvm::ModuleAnalysisManager &AM);
+};
+
+struct InferNoUnwindPass : public llvm::PassInfoMixin<InferNoUnwindPass> {
+  llvm::PreservedAnalyses run(llvm::Module &M, llvm::ModuleAnalysisManager &AM);
+};
+#endif
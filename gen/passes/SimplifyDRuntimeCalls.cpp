@@ -19,6 +19,7 @@
 #define LLVM_DEBUG DEBUG
 #endif
 
+#include "gen/optremarks.h"
 #include "gen/passes/Passes.h"
 #include "gen/tollvm.h"
 #include "gen/runtime.h"
@@ -300,6 +301,117 @@ struct LLVM_LIBRARY_VISIBILITY ArraySliceCopyOpt : public LibCallOptimization {
   }
 };
 
+/// Returns whether the length of the D slice V is known to be zero.
+static bool isKnownEmptySlice(Value *V) {
+  unsigned LengthIdx = 0;
+  auto Length = dyn_cast_or_null<Constant>(FindInsertedValue(V, LengthIdx));
+  return Length && Length->isNullValue();
+}
+
+/// ArrayCopyOpt - remove libcalls for copy-constructing or -assigning arrays
+/// (_d_arrayctor, _d_arrayassign_l/_r) if both arrays are empty.
+///
+/// The glue code only emits these calls for element types with postblits or
+/// destructors (POD arrays are copied inline), so this is all we can do
+/// without knowing the postblit/destructor.
+struct LLVM_LIBRARY_VISIBILITY ArrayCopyOpt : public LibCallOptimization {
+  Value *CallOptimizer(Function *Callee, CallInst *CI,
+                       IRBuilder<> &B) override {
+    // Verify we have a reasonable prototype for
+    // void[] _d_arrayctor(TypeInfo ti, void[] from, void[] to) and
+    // void[] _d_arrayassign_[lr](TypeInfo ti, void[] src, void[] dst, void*)
+    const FunctionType *FT = Callee->getFunctionType();
+    const llvm::Type *RetTy = FT->getReturnType();
+    if ((Callee->arg_size() != 3 && Callee->arg_size() != 4) ||
+        !isa<StructType>(RetTy) || FT->getParamType(1) != RetTy ||
+        FT->getParamType(2) != RetTy) {
+      return nullptr;
+    }
+
+    // Non-empty arrays need to be copied; arrays of different lengths make
+    // the runtime throw.
+    Value *Dst = CI->getOperand(2);
+    if (!isKnownEmptySlice(CI->getOperand(1)) || !isKnownEmptySlice(Dst)) {
+      return nullptr;
+    }
+    return Dst;
+  }
+};
+
+/// ArraySetAssignOpt - remove libcalls for setting all elements of an array
+/// (_d_arraysetassign, _d_arraysetctor) if there are none.
+struct LLVM_LIBRARY_VISIBILITY ArraySetAssignOpt : public LibCallOptimization {
+  Value *CallOptimizer(Function *Callee, CallInst *CI,
+                       IRBuilder<> &B) override {
+    // Verify we have a reasonable prototype for
+    // void* _d_arraysetassign(void* p, void* value, int count, TypeInfo ti)
+    const FunctionType *FT = Callee->getFunctionType();
+    if (Callee->arg_size() != 4 || !isa<PointerType>(FT->getReturnType()) ||
+        FT->getParamType(0) != FT->getReturnType() ||
+        !isa<IntegerType>(FT->getParamType(2))) {
+      return nullptr;
+    }
+
+    auto Count = dyn_cast<Constant>(CI->getOperand(2));
+    if (!Count || !Count->isNullValue()) {
+      return nullptr;
+    }
+    return CI->getOperand(0);
+  }
+};
+
+/// Returns whether the value is one of druntime's builtin TypeInfos for basic
+/// types, (const/immutable) arrays of them, e.g. `_D11TypeInfo_Aya6__initZ`.
+/// These compare and hash the bits without calling any user code.
+static bool isBuiltinTypeInfo(Value *V) {
+  auto GV = dyn_cast<GlobalVariable>(V->stripPointerCasts());
+  if (!GV) {
+    return false;
+  }
+  StringRef Name = GV->getName();
+  if (!Name.startswith("_D")) {
+    return false;
+  }
+  Name = Name.drop_front(2);
+  Name = Name.substr(Name.find_first_not_of("0123456789"));
+  if (!Name.startswith("TypeInfo_") || !Name.endswith("6__initZ")) {
+    return false;
+  }
+  Name = Name.drop_front(9).drop_back(8);
+  if (Name.empty()) {
+    return false;
+  }
+  // basic types, arrays and const/immutable
+  return Name.find_first_not_of("abcdefghijklmopqrstuvwAxy") == StringRef::npos;
+}
+
+/// UnusedResultOpt - remove calls to lookup/comparison runtime functions if
+/// their result is unused and they are called with a builtin TypeInfo.
+///
+/// These are declared 'readonly', but other TypeInfos may call user code
+/// (opEquals/toHash), which may throw or have side effects, so LLVM cannot
+/// delete them on its own.
+struct LLVM_LIBRARY_VISIBILITY UnusedResultOpt : public LibCallOptimization {
+  // The index of the TypeInfo argument, counted from the end if negative.
+  const int TypeInfoArg;
+
+  explicit UnusedResultOpt(int typeInfoArg) : TypeInfoArg(typeInfoArg) {}
+
+  Value *CallOptimizer(Function *Callee, CallInst *CI,
+                       IRBuilder<> &B) override {
+    if (!CI->use_empty() || !CI->onlyReadsMemory()) {
+      return nullptr;
+    }
+    const int NumArgs = static_cast<int>(CI->getNumArgOperands());
+    const int Index = TypeInfoArg < 0 ? NumArgs + TypeInfoArg : TypeInfoArg;
+    if (Index < 0 || Index >= NumArgs ||
+        !isBuiltinTypeInfo(CI->getArgOperand(Index))) {
+      return nullptr;
+    }
+    return CI;
+  }
+};
+
 // TODO: More optimizations! :)
 
 } // end anonymous namespace.
@@ -309,27 +421,45 @@ struct LLVM_LIBRARY_VISIBILITY ArraySliceCopyOpt : public LibCallOptimization {
 //===----------------------------------------------------------------------===//
 
 namespace {
-/// This pass optimizes library functions from the D runtime as used by LDC.
-///
-class LLVM_LIBRARY_VISIBILITY SimplifyDRuntimeCalls : public FunctionPass {
+/// Optimizes library functions from the D runtime as used by LDC. Shared by
+/// the legacy and new pass manager passes.
+class LLVM_LIBRARY_VISIBILITY DRuntimeCallSimplifier {
   StringMap<LibCallOptimization *> Optimizations;
 
   // Array operations
   ArraySetLengthOpt ArraySetLength;
   ArrayCastLenOpt ArrayCastLen;
   ArraySliceCopyOpt ArraySliceCopy;
+  ArrayCopyOpt ArrayCopy;
+  ArraySetAssignOpt ArraySetAssign;
 
   // GC allocations
   AllocationOpt Allocation;
 
+  // Lookups and comparisons
+  UnusedResultOpt AALookupUnusedResult{/*keyti*/ 1};
+  UnusedResultOpt ArrayEqUnusedResult{/*ti*/ -1};
+
+  void InitOptimizations();
+  bool runOnce(Function &F, const DataLayout *DL, AliasAnalysis &AA);
+
+public:
+  bool run(Function &F, AliasAnalysis &AA);
+};
+
+/// This pass optimizes library functions from the D runtime as used by LDC.
+///
+class LLVM_LIBRARY_VISIBILITY SimplifyDRuntimeCalls : public FunctionPass {
+  DRuntimeCallSimplifier Simplifier;
+
 public:
   static char ID; // Pass identification
   SimplifyDRuntimeCalls() : FunctionPass(ID) {}
 
-  void InitOptimizations();
-  bool runOnFunction(Function &F) override;
-
-  bool runOnce(Function &F, const DataLayout *DL, AAResultsWrapperPass &AA);
+  bool runOnFunction(Function &F) override {
+    return Simplifier.run(F,
+                          getAnalysis<AAResultsWrapperPass>().getAAResults());
+  }
 
   void getAnalysisUsage(AnalysisUsage &AU) const override {
     AU.addRequired<AAResultsWrapperPass>();
@@ -346,21 +476,43 @@ FunctionPass *createSimplifyDRuntimeCalls() {
   return new SimplifyDRuntimeCalls();
 }
 
+#if LDC_LLVM_VER >= 800
+class SimplifyDRuntimeCallsPass::Impl : public DRuntimeCallSimplifier {};
+
+SimplifyDRuntimeCallsPass::SimplifyDRuntimeCallsPass()
+    : impl(std::make_shared<Impl>()) {}
+
+PreservedAnalyses SimplifyDRuntimeCallsPass::run(Function &F,
+                                                 FunctionAnalysisManager &AM) {
+  if (!impl->run(F, AM.getResult<AAManager>(F))) {
+    return PreservedAnalyses::all();
+  }
+  PreservedAnalyses PA;
+  PA.preserveSet<CFGAnalyses>();
+  return PA;
+}
+#endif
+
 /// Optimizations - Populate the Optimizations map with all the optimizations
 /// we know.
-void SimplifyDRuntimeCalls::InitOptimizations() {
+void DRuntimeCallSimplifier::InitOptimizations() {
   // Some array-related optimizations
   Optimizations["_d_arraycast_len"] = &ArrayCastLen;
   Optimizations["_d_arraysetlengthT"] = &ArraySetLength;
   Optimizations["_d_arraysetlengthiT"] = &ArraySetLength;
   Optimizations["_d_array_slice_copy"] = &ArraySliceCopy;
+  Optimizations["_d_arrayctor"] = &ArrayCopy;
+  Optimizations["_d_arrayassign_l"] = &ArrayCopy;
+  Optimizations["_d_arrayassign_r"] = &ArrayCopy;
+  Optimizations["_d_arraysetassign"] = &ArraySetAssign;
+  Optimizations["_d_arraysetctor"] = &ArraySetAssign;
 
   /* Delete calls to runtime functions which aren't needed if their result is
    * unused. That comes down to functions that don't do anything but
    * GC-allocate and initialize some memory.
    * We don't need to do this for functions which are marked 'readnone' or
-   * 'readonly', since LLVM doesn't need our help figuring out when those can
-   * be deleted.
+   * 'readonly' and 'nounwind', since LLVM doesn't need our help figuring out
+   * when those can be deleted.
    * (We can't mark allocating calls as readonly/readnone because they don't
    * return the same pointer every time when called with the same arguments)
    */
@@ -373,17 +525,24 @@ void SimplifyDRuntimeCalls::InitOptimizations() {
   Optimizations["_d_newarraymvT"] = &Allocation;
   Optimizations["_d_newclass"] = &Allocation;
   Optimizations["_d_allocclass"] = &Allocation;
+
+  /* Delete lookups and comparisons whose result is unused. LLVM deletes
+   * unused calls of 'readonly' functions only if they are 'nounwind' too,
+   * which these aren't because of the TypeInfo callbacks. With builtin
+   * TypeInfos, no user code is called (see UnusedResultOpt).
+   */
+  Optimizations["_aaInX"] = &AALookupUnusedResult;
+  Optimizations["_adEq2"] = &ArrayEqUnusedResult;
 }
 
-/// runOnFunction - Top level algorithm.
+/// run - Top level algorithm.
 ///
-bool SimplifyDRuntimeCalls::runOnFunction(Function &F) {
+bool DRuntimeCallSimplifier::run(Function &F, AliasAnalysis &AA) {
   if (Optimizations.empty()) {
     InitOptimizations();
   }
 
   const DataLayout *DL = &F.getParent()->getDataLayout();
-  AAResultsWrapperPass &AA = getAnalysis<AAResultsWrapperPass>();
 
   // Iterate to catch opportunities opened up by other optimizations,
   // such as calls that are only used as arguments to unused calls:
@@ -400,8 +559,8 @@ bool SimplifyDRuntimeCalls::runOnFunction(Function &F) {
   return EverChanged;
 }
 
-bool SimplifyDRuntimeCalls::runOnce(Function &F, const DataLayout *DL,
-                                    AAResultsWrapperPass &AAP) {
+bool DRuntimeCallSimplifier::runOnce(Function &F, const DataLayout *DL,
+                                     AliasAnalysis &AA) {
   IRBuilder<> Builder(F.getContext());
 
   bool Changed = false;
@@ -434,7 +593,6 @@ bool SimplifyDRuntimeCalls::runOnce(Function &F, const DataLayout *DL,
       --ciIt;
       Builder.SetInsertPoint(&BB, I);
 
-      AliasAnalysis &AA = AAP.getAAResults();
       // Try to optimize this call.
       Value *Result = OMI->second->OptimizeCall(CI, Changed, DL, AA, Builder);
       if (Result == nullptr) {
@@ -450,8 +608,12 @@ bool SimplifyDRuntimeCalls::runOnce(Function &F, const DataLayout *DL,
       if (Result == CI) {
         assert(CI->use_empty());
         ++NumDeleted;
+        emitOptRemark(DEBUG_TYPE, "Deleted", CI,
+                      "call to " + Callee->getName() + " removed");
       } else {
         ++NumSimplified;
+        emitOptRemark(DEBUG_TYPE, "Simplified", CI,
+                      "call to " + Callee->getName() + " simplified");
 
         if (!CI->use_empty()) {
           CI->replaceAllUsesWith(Result);
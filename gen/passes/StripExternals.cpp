@@ -13,6 +13,9 @@
 // This is useful to allow Global DCE (-globaldce) to clean up references to
 // globals only used by available_externally functions and initializers.
 //
+// The pass can also run before the inliner, only stripping the bodies the
+// inliner can't use, so that they aren't optimized in vain.
+//
 //===----------------------------------------------------------------------===//
 
 #define DEBUG_TYPE "strip-externals"
@@ -36,7 +39,9 @@ STATISTIC(NumVariables, "Number of global initializers removed");
 namespace {
 struct LLVM_LIBRARY_VISIBILITY StripExternals : public ModulePass {
   static char ID; // Pass identification, replacement for typeid
-  StripExternals() : ModulePass(ID) {}
+  const ExternalsToStrip toStrip;
+  StripExternals(ExternalsToStrip toStrip = ExternalsToStrip::All)
+      : ModulePass(ID), toStrip(toStrip) {}
 
   // run - Do the StripExternals pass on the specified module.
   //
@@ -48,13 +53,43 @@ char StripExternals::ID = 0;
 static RegisterPass<StripExternals>
     X("strip-externals", "Strip available_externally bodies and initializers");
 
-ModulePass *createStripExternalsPass() { return new StripExternals(); }
+ModulePass *createStripExternalsPass(ExternalsToStrip toStrip) {
+  return new StripExternals(toStrip);
+}
+
+static bool stripExternals(Module &M, ExternalsToStrip toStrip);
 
 bool StripExternals::runOnModule(Module &M) {
+  return stripExternals(M, toStrip);
+}
+
+#if LDC_LLVM_VER >= 800
+PreservedAnalyses StripExternalsPass::run(Module &M, ModuleAnalysisManager &) {
+  return stripExternals(M, toStrip) ? PreservedAnalyses::none()
+                                    : PreservedAnalyses::all();
+}
+#endif
+
+// Returns whether the body of an available_externally function is of no use
+// to the inliner.
+static bool isNotInlinable(const Function &F, ExternalsToStrip toStrip) {
+  switch (toStrip) {
+  case ExternalsToStrip::All:
+    return true;
+  case ExternalsToStrip::NotInlinable:
+    return F.hasFnAttribute(Attribute::NoInline) ||
+           F.hasFnAttribute(Attribute::OptimizeNone);
+  case ExternalsToStrip::NotAlwaysInline:
+    return !F.hasFnAttribute(Attribute::AlwaysInline);
+  }
+  llvm_unreachable("Unknown ExternalsToStrip");
+}
+
+bool stripExternals(Module &M, ExternalsToStrip toStrip) {
   bool Changed = false;
 
   for (auto I = M.begin(); I != M.end();) {
-    if (I->hasAvailableExternallyLinkage()) {
+    if (I->hasAvailableExternallyLinkage() && isNotInlinable(*I, toStrip)) {
       assert(!I->isDeclaration() &&
              "Declarations can't be available_externally");
       Changed = true;
@@ -73,6 +108,11 @@ bool StripExternals::runOnModule(Module &M) {
     ++I;
   }
 
+  // The initializers may still be constant-folded into the inlined code.
+  if (toStrip != ExternalsToStrip::All) {
+    return Changed;
+  }
+
   for (auto I = M.global_begin(); I != M.global_end();) {
     if (I->hasAvailableExternallyLinkage()) {
       assert(!I->isDeclaration() &&
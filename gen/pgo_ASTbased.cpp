@@ -26,18 +26,30 @@
 #include "gen/logger.h"
 #include "gen/recursivevisitor.h"
 #include "gen/tollvm.h"
+#include "llvm/ADT/Triple.h"
 #include "llvm/IR/Intrinsics.h"
 #include "llvm/IR/MDBuilder.h"
 #include "llvm/ProfileData/InstrProfReader.h"
+#if LDC_LLVM_VER >= 500
+#include "llvm/ProfileData/Coverage/CoverageMapping.h"
+#include "llvm/ProfileData/Coverage/CoverageMappingWriter.h"
+#endif
 #include "llvm/Support/Endian.h"
 #include "llvm/Support/FileSystem.h"
 #include "llvm/Support/MD5.h"
+#include "llvm/Support/Path.h"
 
 namespace {
 llvm::cl::opt<bool, false, opts::FlagParser<bool>> enablePGOIndirectCalls(
     "pgo-indirect-calls", llvm::cl::ZeroOrMore, llvm::cl::Hidden,
     llvm::cl::desc("(*) Enable PGO of indirect calls (LLVM >= 3.9)"),
     llvm::cl::init(true));
+
+llvm::cl::opt<bool, false, opts::FlagParser<bool>> enablePGOMemOpSizes(
+    "pgo-memop-sizes", llvm::cl::ZeroOrMore, llvm::cl::Hidden,
+    llvm::cl::desc("(*) Enable PGO of the sizes of memcpy, memset and memcmp "
+                   "calls (LLVM >= 5)"),
+    llvm::cl::init(true));
 }
 
 /// \brief Stable hasher for PGO region counters.
@@ -748,6 +760,373 @@ struct ComputeRegionCounts : public RecursiveVisitor {
 ///////////////////////////////////////////////////////////////////////////////
 ///////////////////////////////////////////////////////////////////////////////
 
+#if LDC_LLVM_VER >= 500
+/// A Recursive AST Visitor that builds the coverage mapping regions of a
+/// function for -fcoverage-mapping. It propagates the region counters through
+/// the AST like ComputeRegionCounts does with the raw counts, but symbolically
+/// as LLVM coverage counter expressions, which are evaluated by llvm-cov.
+///
+/// Each body with a counter (function, if/else branches, loops, cases,
+/// catches, labels) gets a region up to its end. Where the count changes
+/// within a body (e.g., after a nested if containing a return), a new region
+/// is started at the next statement, extending to the end of the body.
+struct CoverageMappingBuilder : public RecursiveVisitor {
+  using Counter = llvm::coverage::Counter;
+
+  /// PGO state.
+  const CodeGenPGO &PGO;
+
+  /// The file the function is defined in; regions in other files (mixins)
+  /// are skipped.
+  const char *FileName;
+
+  llvm::coverage::CounterExpressionBuilder Builder;
+  std::vector<llvm::coverage::CounterMappingRegion> Regions;
+
+  /// A flag that is set when a new region with the current count should be
+  /// started at the next statement, such as at the exit of a loop.
+  bool RecordNextStmtCount = false;
+
+  /// The count at the current location in the traversal.
+  Counter CurrentCount;
+
+  /// The end of the innermost body being visited.
+  Loc RegionEnd;
+
+  /// The ends of the case/default statements of the switch statements.
+  llvm::DenseMap<const Statement *, Loc> CaseEnds;
+
+  struct BreakContinue {
+    Counter BreakCount;
+    Counter ContinueCount;
+  };
+  llvm::SmallVector<BreakContinue, 8> BreakContinueStack;
+
+  struct LoopLabel {
+    LabelStatement *label;
+    size_t stackindex;
+    LoopLabel(LabelStatement *_label, size_t index)
+        : label(_label), stackindex(index) {}
+  };
+  llvm::SmallVector<LoopLabel, 8> LoopLabels;
+
+  CoverageMappingBuilder(const CodeGenPGO &PGO, const char *FileName)
+      : PGO(PGO), FileName(FileName) {}
+
+  Counter getRegionCounter(const RootObject *S) const {
+    return Counter::getCounter(PGO.getRegionCounterIndex(S));
+  }
+
+  Counter add(Counter LHS, Counter RHS) { return Builder.add(LHS, RHS); }
+  Counter subtract(Counter LHS, Counter RHS) {
+    return Builder.subtract(LHS, RHS);
+  }
+
+  static bool isBefore(const Loc &a, const Loc &b) {
+    return a.linnum < b.linnum ||
+           (a.linnum == b.linnum && a.charnum < b.charnum);
+  }
+
+  void pushRegion(Counter C, const Loc &start, const Loc &end) {
+    if (!start.linnum || !end.linnum || !start.filename || !end.filename ||
+        strcmp(start.filename, FileName) != 0 ||
+        strcmp(end.filename, FileName) != 0 || !isBefore(start, end)) {
+      return;
+    }
+    // The end column points at the last character of the region (e.g., the
+    // closing curly bracket), but is exclusive for llvm-cov.
+    Regions.push_back(llvm::coverage::CounterMappingRegion::makeRegion(
+        C, /*FileID=*/0, start.linnum, std::max(start.charnum, 1u), end.linnum,
+        end.charnum + 1));
+  }
+
+  void RecordStmtCount(const Statement *S) {
+    if (RecordNextStmtCount) {
+      pushRegion(CurrentCount, S->loc, RegionEnd);
+      RecordNextStmtCount = false;
+    }
+  }
+
+  /// Visit a body entered with the given count, ending at the given location.
+  void visitBody(Statement *Body, Counter Count, const Loc &End) {
+    CurrentCount = Count;
+    if (!Body)
+      return;
+    pushRegion(Count, Body->loc, End);
+    const Loc OldEnd = RegionEnd;
+    RegionEnd = End;
+    RecordNextStmtCount = false;
+    recurse(Body);
+    RegionEnd = OldEnd;
+  }
+
+  static Loc getEndLoc(Statement *S, const Loc &Fallback) {
+    if (auto ss = S->isScopeStatement())
+      return ss->endloc;
+    return Fallback;
+  }
+
+  using RecursiveVisitor::visit;
+
+  void visitFunction(FuncDeclaration *fd) {
+    visitBody(fd->fbody, getRegionCounter(fd->fbody), fd->endloc);
+  }
+
+  void visit(CompoundStatement *S) override {
+    for (auto s : *S->statements) {
+      if (s) {
+        RecordStmtCount(s);
+        recurse(s);
+      }
+    }
+  }
+
+  void visit(UnrolledLoopStatement *S) override {
+    for (auto s : *S->statements) {
+      if (s) {
+        RecordStmtCount(s);
+        recurse(s);
+      }
+    }
+  }
+
+  void visit(ReturnStatement *S) override {
+    recurse(S->exp);
+    CurrentCount = Counter::getZero();
+    RecordNextStmtCount = true;
+  }
+
+  void visit(ThrowStatement *S) override {
+    recurse(S->exp);
+    CurrentCount = Counter::getZero();
+    RecordNextStmtCount = true;
+  }
+
+  void visit(GotoStatement *S) override {
+    CurrentCount = Counter::getZero();
+    RecordNextStmtCount = true;
+  }
+
+  void visit(GotoDefaultStatement *S) override {
+    CurrentCount = Counter::getZero();
+    RecordNextStmtCount = true;
+  }
+
+  void visit(GotoCaseStatement *S) override {
+    CurrentCount = Counter::getZero();
+    RecordNextStmtCount = true;
+  }
+
+  void visit(LabelStatement *S) override {
+    // Counter tracks the block following the label.
+    CurrentCount = getRegionCounter(S);
+    pushRegion(CurrentCount, S->loc, RegionEnd);
+    RecordNextStmtCount = false;
+    LoopLabels.push_back(LoopLabel(S, BreakContinueStack.size()));
+    recurse(S->statement);
+  }
+
+  BreakContinue &getBreakContinueTarget(Statement *target) {
+    if (target) {
+      auto it = std::find_if(
+          LoopLabels.begin(), LoopLabels.end(),
+          [target](const LoopLabel &LL) { return LL.label == target; });
+      assert(it != LoopLabels.end());
+      return BreakContinueStack[it->stackindex];
+    }
+    return BreakContinueStack.back();
+  }
+
+  void visit(BreakStatement *S) override {
+    assert(!BreakContinueStack.empty() && "break not in a loop or switch!");
+    auto &BC = getBreakContinueTarget(S->target);
+    BC.BreakCount = add(BC.BreakCount, CurrentCount);
+    CurrentCount = Counter::getZero();
+    RecordNextStmtCount = true;
+  }
+
+  void visit(ContinueStatement *S) override {
+    assert(!BreakContinueStack.empty() && "continue stmt not in a loop!");
+    auto &BC = getBreakContinueTarget(S->target);
+    BC.ContinueCount = add(BC.ContinueCount, CurrentCount);
+    CurrentCount = Counter::getZero();
+    RecordNextStmtCount = true;
+  }
+
+  /// Handles the loop body and sets the count after the loop, given the count
+  /// before.
+  void visitLoopBody(Statement *S, Statement *Body, const Loc &EndLoc,
+                     Counter ParentCount) {
+    BreakContinueStack.push_back(BreakContinue());
+    const Counter BodyCount = getRegionCounter(S);
+    visitBody(Body, BodyCount, EndLoc);
+    const Counter BackedgeCount = CurrentCount;
+    BreakContinue BC = BreakContinueStack.pop_back_val();
+
+    const Counter CondCount =
+        add(ParentCount, add(BackedgeCount, BC.ContinueCount));
+    CurrentCount = subtract(add(BC.BreakCount, CondCount), BodyCount);
+    RecordNextStmtCount = true;
+  }
+
+  void visit(WhileStatement *S) override {
+    recurse(S->condition);
+    visitLoopBody(S, S->_body, S->endloc, CurrentCount);
+  }
+
+  void visit(ForStatement *S) override {
+    recurse(S->_init);
+    visitLoopBody(S, S->_body, S->endloc, CurrentCount);
+  }
+
+  void visit(ForeachStatement *S) override {
+    recurse(S->aggr);
+    visitLoopBody(S, S->_body, S->endloc, CurrentCount);
+  }
+
+  void visit(ForeachRangeStatement *S) override {
+    recurse(S->lwr);
+    recurse(S->upr);
+    visitLoopBody(S, S->_body, S->endloc, CurrentCount);
+  }
+
+  void visit(DoStatement *S) override {
+    const Counter FallThroughCount = CurrentCount;
+    BreakContinueStack.push_back(BreakContinue());
+    // The counter includes the fallthrough from the parent scope.
+    const Counter BodyCount = getRegionCounter(S);
+    visitBody(S->_body, BodyCount, S->endloc);
+    const Counter BackedgeCount = CurrentCount;
+    BreakContinue BC = BreakContinueStack.pop_back_val();
+
+    const Counter CondCount = add(BackedgeCount, BC.ContinueCount);
+    const Counter LoopCount = subtract(BodyCount, FallThroughCount);
+    CurrentCount = subtract(add(BC.BreakCount, CondCount), LoopCount);
+    RecordNextStmtCount = true;
+  }
+
+  void visit(SwitchStatement *S) override {
+    recurse(S->condition);
+
+    // Each case extends up to the next one (D doesn't allow implicit
+    // fallthrough, so the case statements are always entered via their own
+    // counter).
+    std::vector<Statement *> cases;
+    if (S->cases)
+      cases.insert(cases.end(), S->cases->begin(), S->cases->end());
+    if (S->sdefault)
+      cases.push_back(S->sdefault);
+    std::sort(cases.begin(), cases.end(), [](Statement *a, Statement *b) {
+      return isBefore(a->loc, b->loc);
+    });
+    const Loc SwitchEnd = getEndLoc(S->_body, RegionEnd);
+    for (size_t i = 0; i < cases.size(); ++i) {
+      CaseEnds[cases[i]] =
+          i + 1 < cases.size() ? cases[i + 1]->loc : SwitchEnd;
+    }
+
+    CurrentCount = Counter::getZero();
+    BreakContinueStack.push_back(BreakContinue());
+    recurse(S->_body);
+    BreakContinue BC = BreakContinueStack.pop_back_val();
+    if (!BreakContinueStack.empty()) {
+      BreakContinueStack.back().ContinueCount =
+          add(BreakContinueStack.back().ContinueCount, BC.ContinueCount);
+    }
+    // Counter tracks the exit block of the switch.
+    CurrentCount = getRegionCounter(S);
+    RecordNextStmtCount = true;
+  }
+
+  void visitCase(Statement *S, Statement *Body, bool IsGotoTarget) {
+    // If this case is the target of a goto case, its extra counter behaves
+    // like a LabelStatement's.
+    const Counter CaseCount =
+        IsGotoTarget ? getRegionCounter(CodeGenPGO::getCounterPtr(S, 1))
+                     : add(CurrentCount, getRegionCounter(S));
+    auto it = CaseEnds.find(S);
+    const Loc End = it != CaseEnds.end() ? it->second : RegionEnd;
+    pushRegion(CaseCount, S->loc, End);
+    const Loc OldEnd = RegionEnd;
+    RegionEnd = End;
+    CurrentCount = CaseCount;
+    RecordNextStmtCount = false;
+    recurse(Body);
+    RegionEnd = OldEnd;
+  }
+
+  void visit(CaseStatement *S) override {
+    visitCase(S, S->statement, S->gototarget);
+  }
+
+  void visit(DefaultStatement *S) override {
+    visitCase(S, S->statement, S->gototarget);
+  }
+
+  void visit(IfStatement *S) override {
+    const Counter ParentCount = CurrentCount;
+    recurse(S->condition);
+
+    // Counter tracks the "then" part of an if statement. The count for
+    // the "else" part, if it exists, is calculated from this counter.
+    const Counter ThenCount = getRegionCounter(S);
+    visitBody(S->ifbody, ThenCount,
+              S->elsebody ? S->elsebody->loc : S->endloc);
+    Counter OutCount = CurrentCount;
+
+    const Counter ElseCount = subtract(ParentCount, ThenCount);
+    if (S->elsebody) {
+      visitBody(S->elsebody, ElseCount, S->endloc);
+      OutCount = add(OutCount, CurrentCount);
+    } else {
+      OutCount = add(OutCount, ElseCount);
+    }
+    CurrentCount = OutCount;
+    RecordNextStmtCount = true;
+  }
+
+  void visit(TryCatchStatement *S) override {
+    recurse(S->_body);
+    for (auto c : *S->catches) {
+      // Catch counter tracks the entry block of catch handler
+      if (c->handler) {
+        visitBody(c->handler, getRegionCounter(c),
+                  getEndLoc(c->handler, c->handler->loc));
+      }
+    }
+    // Try counter tracks the continuation block of the try statement.
+    CurrentCount = getRegionCounter(S);
+    RecordNextStmtCount = true;
+  }
+
+  void visit(TryFinallyStatement *S) override {
+    // Without counter (see MapRegionCounters), the count doesn't change.
+    if (!S->_body || !S->finalbody) {
+      recurse(S->_body);
+      recurse(S->finalbody);
+      return;
+    }
+
+    const Counter ParentCount = CurrentCount;
+    recurse(S->_body);
+
+    // Finally is always executed, so has same incoming count as the parent
+    // count of the try statement.
+    CurrentCount = ParentCount;
+    RecordNextStmtCount = true;
+    recurse(S->finalbody);
+
+    // The TryFinally counter tracks the continuation block of the try
+    // statement.
+    CurrentCount = getRegionCounter(S);
+    RecordNextStmtCount = true;
+  }
+};
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+
 // Pointer math to add an extra counter for one statement/expression.
 // Increasing (the size_t value of) the pointer by counter results in a new
 // "pointer" that will never clash with the other RootObject pointers (the size
@@ -793,6 +1172,12 @@ void CodeGenPGO::assignRegionCounters(const FuncDeclaration *D,
   setFuncName(fn);
 
   mapRegionCounters(D);
+  if (opts::isInstrumentingForASTBasedPGO() && emitInstrumentation) {
+    createThreadLocalCounters();
+  }
+  if (opts::coverageMapping && emitInstrumentation) {
+    emitCoverageMapping(D);
+  }
   if (PGOReader) {
     loadRegionCounts(PGOReader, D);
     computeRegionCounts(D);
@@ -818,6 +1203,132 @@ void CodeGenPGO::computeRegionCounts(const FuncDeclaration *FD) {
   Walker.visit(const_cast<FuncDeclaration *>(FD));
 }
 
+void CodeGenPGO::emitCoverageMapping(const FuncDeclaration *FD) {
+#if LDC_LLVM_VER >= 500
+  const char *fileName = FD->loc.filename;
+  if (!fileName || !FD->fbody)
+    return;
+
+  CoverageMappingBuilder builder(*this, fileName);
+  builder.visitFunction(const_cast<FuncDeclaration *>(FD));
+  if (builder.Regions.empty())
+    return;
+
+  if (!gIR->CoverageMapping)
+    gIR->CoverageMapping = llvm::make_unique<CoverageMappingModuleGen>();
+  auto &moduleGen = *gIR->CoverageMapping;
+
+  // All regions are in the function's file (FileID 0).
+  const unsigned fileMapping[] = {moduleGen.getFileIndex(fileName)};
+  std::string mapping;
+  {
+    llvm::raw_string_ostream os(mapping);
+    llvm::coverage::CoverageMappingWriter(fileMapping,
+                                          builder.Builder.getExpressions(),
+                                          builder.Regions)
+        .write(os);
+  }
+  moduleGen.addFunctionRecord(FuncName, FunctionHash, mapping);
+#endif
+}
+
+unsigned CoverageMappingModuleGen::getFileIndex(llvm::StringRef filename) {
+  auto it = fileIndices.find(filename);
+  if (it != fileIndices.end())
+    return it->second;
+
+  // llvm-cov expects absolute paths.
+  llvm::SmallString<128> path(filename);
+  llvm::sys::fs::make_absolute(path);
+  llvm::sys::path::remove_dots(path, /*remove_dot_dot=*/true);
+
+  const unsigned index = filenames.size();
+  filenames.push_back(path.str());
+  fileIndices[filename] = index;
+  return index;
+}
+
+void CoverageMappingModuleGen::addFunctionRecord(llvm::StringRef funcName,
+                                                 uint64_t funcHash,
+                                                 const std::string &mapping) {
+  functionRecords.push_back(
+      {llvm::IndexedInstrProf::ComputeHash(funcName),
+       static_cast<uint32_t>(mapping.size()), funcHash});
+  mappings += mapping;
+}
+
+void CoverageMappingModuleGen::emit(IRState &irs) {
+#if LDC_LLVM_VER >= 500
+  if (functionRecords.empty())
+    return;
+
+  // Adapted from Clang's CoverageMappingModuleGen::emit().
+  auto &ctx = irs.context();
+  auto i32Ty = llvm::Type::getInt32Ty(ctx);
+  auto i64Ty = llvm::Type::getInt64Ty(ctx);
+
+  // The function records: name hash, size of the mapping data, function hash.
+  auto recordTy = llvm::StructType::get(ctx, {i64Ty, i32Ty, i64Ty},
+                                        /*isPacked=*/true);
+  std::vector<llvm::Constant *> records;
+  records.reserve(functionRecords.size());
+  for (const auto &r : functionRecords) {
+    records.push_back(llvm::ConstantStruct::get(
+        recordTy, {llvm::ConstantInt::get(i64Ty, r.nameHash),
+                   llvm::ConstantInt::get(i32Ty, r.dataSize),
+                   llvm::ConstantInt::get(i64Ty, r.funcHash)}));
+  }
+  auto recordsTy = llvm::ArrayType::get(recordTy, records.size());
+  auto recordsVal = llvm::ConstantArray::get(recordsTy, records);
+
+  // The filenames, followed by the mapping data of the functions, padded to a
+  // multiple of 8 bytes.
+  std::string filenamesAndMappings;
+  llvm::raw_string_ostream os(filenamesAndMappings);
+  {
+    std::vector<llvm::StringRef> filenameRefs(filenames.begin(),
+                                              filenames.end());
+    llvm::coverage::CoverageFilenamesSectionWriter(filenameRefs).write(os);
+  }
+  const size_t filenamesSize = os.str().size();
+  os << mappings;
+  size_t coverageMappingSize = mappings.size();
+  if (const size_t rem = os.str().size() % 8) {
+    coverageMappingSize += 8 - rem;
+    for (size_t i = rem; i < 8; ++i)
+      os << '\0';
+  }
+  auto filenamesAndMappingsVal =
+      llvm::ConstantDataArray::getString(ctx, os.str(), false);
+
+  auto headerTy = llvm::StructType::get(ctx, {i32Ty, i32Ty, i32Ty, i32Ty});
+  auto headerVal = llvm::ConstantStruct::get(
+      headerTy, {llvm::ConstantInt::get(i32Ty, records.size()),
+                 llvm::ConstantInt::get(i32Ty, filenamesSize),
+                 llvm::ConstantInt::get(i32Ty, coverageMappingSize),
+                 llvm::ConstantInt::get(
+                     i32Ty, llvm::coverage::CovMapVersion::CurrentVersion)});
+
+  auto covDataVal = llvm::ConstantStruct::getAnon(
+      ctx, {headerVal, recordsVal, filenamesAndMappingsVal});
+  auto covData = new llvm::GlobalVariable(
+      irs.module, covDataVal->getType(), true,
+      llvm::GlobalValue::InternalLinkage, covDataVal,
+      llvm::getCoverageMappingVarName());
+  covData->setSection(llvm::getInstrProfSectionName(
+      llvm::IPSK_covmap,
+      llvm::Triple(irs.module.getTargetTriple()).getObjectFormat()));
+  covData->setAlignment(8);
+  // Make sure the data doesn't get deleted.
+  irs.usedArray.push_back(covData);
+#endif
+
+  fileIndices.clear();
+  filenames.clear();
+  functionRecords.clear();
+  mappings.clear();
+}
+
 /// Apply attributes to llvm::Function based on profiling data.
 void CodeGenPGO::applyFunctionAttributes(llvm::Function *Fn) {
   if (!haveRegionCounts())
@@ -825,6 +1336,11 @@ void CodeGenPGO::applyFunctionAttributes(llvm::Function *Fn) {
 
   uint64_t FunctionCount = getRegionCount(nullptr);
   Fn->setEntryCount(FunctionCount);
+
+  // Functions never executed in the training run are optimized for size and
+  // placed in .text.unlikely.
+  if (FunctionCount == 0)
+    Fn->addFnAttr(llvm::Attribute::Cold);
 }
 
 void CodeGenPGO::emitCounterIncrement(const RootObject *S) const {
@@ -835,7 +1351,33 @@ void CodeGenPGO::emitCounterIncrement(const RootObject *S) const {
   auto counter_it = (*RegionCounterMap).find(S);
   assert(counter_it != (*RegionCounterMap).end() &&
          "Statement not found in PGO counter map!");
-  unsigned counter = counter_it->second;
+  emitIncrement(counter_it->second);
+}
+
+void CodeGenPGO::createThreadLocalCounters() {
+  if (opts::profileUpdate != opts::ProfileUpdateMode::PerThread)
+    return;
+
+  auto *counterTy = llvm::ArrayType::get(
+      llvm::Type::getInt64Ty(gIR->context()), NumRegionCounters);
+  ThreadLocalCounters = new llvm::GlobalVariable(
+      gIR->module, counterTy, false, llvm::GlobalValue::InternalLinkage,
+      llvm::Constant::getNullValue(counterTy), "__ldc_profc_tls_" + FuncName,
+      nullptr, llvm::GlobalValue::GeneralDynamicTLSModel);
+  gIR->threadLocalPGOCounters.push_back(
+      {FuncNameVar, FunctionHash, NumRegionCounters, ThreadLocalCounters});
+}
+
+void CodeGenPGO::emitIncrement(unsigned counter) const {
+  if (ThreadLocalCounters) {
+    // Plain increment of the thread-local counter, merged by
+    // buildThreadLocalPGOCountersFlush().
+    llvm::Value *ptr = DtoGEPi(ThreadLocalCounters, 0, counter, "pgocount.tls");
+    llvm::Value *count = gIR->ir->CreateLoad(ptr, "pgocount");
+    gIR->ir->CreateStore(gIR->ir->CreateAdd(count, gIR->ir->getInt64(1)), ptr);
+    return;
+  }
+
   auto *I8PtrTy = llvm::Type::getInt8PtrTy(gIR->context());
   gIR->ir->CreateCall(GET_INTRINSIC_DECL(instrprof_increment),
                       {llvm::ConstantExpr::getBitCast(FuncNameVar, I8PtrTy),
@@ -844,6 +1386,62 @@ void CodeGenPGO::emitCounterIncrement(const RootObject *S) const {
                        gIR->ir->getInt32(counter)});
 }
 
+llvm::Function *buildThreadLocalPGOCountersFlush(IRState &irs,
+                                                 const std::string &name) {
+  if (irs.threadLocalPGOCounters.empty())
+    return nullptr;
+
+#if LDC_LLVM_VER >= 500
+  auto &ctx = irs.context();
+  auto *fnTy = llvm::FunctionType::get(llvm::Type::getVoidTy(ctx), {}, false);
+  auto *fn = llvm::Function::Create(fnTy, llvm::GlobalValue::InternalLinkage,
+                                    name, &irs.module);
+  fn->addFnAttr(llvm::Attribute::NoUnwind);
+  IRBuilder<> builder(llvm::BasicBlock::Create(ctx, "", fn));
+
+  // The increments are lowered to atomic ones, as threads may terminate
+  // concurrently.
+  auto *I8PtrTy = llvm::Type::getInt8PtrTy(ctx);
+  auto *incrementStep =
+      llvm::Intrinsic::getDeclaration(&irs.module,
+                                      llvm::Intrinsic::instrprof_increment_step);
+  for (const auto &c : irs.threadLocalPGOCounters) {
+    for (unsigned i = 0; i < c.NumCounters; ++i) {
+      llvm::Value *ptr =
+          builder.CreateConstInBoundsGEP2_32(c.Counters->getValueType(),
+                                             c.Counters, 0, i);
+      llvm::Value *count = builder.CreateLoad(ptr, "pgocount");
+      builder.CreateCall(
+          incrementStep,
+          {llvm::ConstantExpr::getBitCast(c.FuncNameVar, I8PtrTy),
+           builder.getInt64(c.FunctionHash), builder.getInt32(c.NumCounters),
+           builder.getInt32(i), count});
+      builder.CreateStore(builder.getInt64(0), ptr);
+    }
+  }
+
+  builder.CreateRetVoid();
+  return fn;
+#else
+  return nullptr;
+#endif
+}
+
+void CodeGenPGO::emitThunkInstrumentation(const FuncDeclaration *D,
+                                          llvm::Function *thunk) {
+  if (!opts::isInstrumentingForASTBasedPGO() || !D->emitInstrumentation)
+    return;
+
+  setFuncName(thunk);
+
+  // Thunks have no control flow, so a constant hash suffices.
+  NumRegionCounters = 1;
+  FunctionHash = 0;
+
+  createThreadLocalCounters();
+  emitIncrement(0);
+}
+
 void CodeGenPGO::loadRegionCounts(llvm::IndexedInstrProfReader *PGOReader,
                                   const FuncDeclaration *fd) {
   RegionCounts.clear();
@@ -1024,6 +1622,15 @@ void CodeGenPGO::emitIndirectCallPGO(llvm::Instruction *callSite,
     valueProfile(llvm::IPVK_IndirectCallTarget, callSite, funcPtr, true);
 }
 
+void CodeGenPGO::emitMemOpSizePGO(llvm::Instruction *memOp,
+                                  llvm::Value *size) {
+#if LDC_LLVM_VER >= 500
+  // Nothing to learn about constant sizes.
+  if (enablePGOMemOpSizes && !llvm::isa<llvm::Constant>(size))
+    valueProfile(llvm::IPVK_MemOPSize, memOp, size, false);
+#endif
+}
+
 void CodeGenPGO::valueProfile(uint32_t valueKind, llvm::Instruction *valueSite,
                               llvm::Value *value, bool ptrCastNeeded) {
   if (!value || !valueSite)
@@ -1039,6 +1646,8 @@ void CodeGenPGO::valueProfile(uint32_t valueKind, llvm::Instruction *valueSite,
 
     if (ptrCastNeeded)
       value = gIR->ir->CreatePtrToInt(value, gIR->ir->getInt64Ty());
+    else
+      value = gIR->ir->CreateZExtOrTrunc(value, gIR->ir->getInt64Ty());
 
     auto *i8PtrTy = llvm::Type::getInt8PtrTy(gIR->context());
     llvm::Value *Args[5] = {
@@ -18,6 +18,7 @@
 #pragma once
 
 #include "gen/llvm.h"
+#include "llvm/ADT/StringMap.h"
 #include "llvm/ProfileData/InstrProf.h"
 #include <string>
 #include <vector>
@@ -36,6 +37,21 @@ class ForeachStatement;
 class ForeachRangeStatement;
 
 
+/// The thread-local counters of a function instrumented with
+/// -fprofile-update=per-thread.
+struct ThreadLocalPGOCounters {
+  llvm::GlobalVariable *FuncNameVar;
+  uint64_t FunctionHash;
+  unsigned NumCounters;
+  llvm::GlobalVariable *Counters;
+};
+
+/// Builds a function adding the current thread's counters of all functions
+/// instrumented with -fprofile-update=per-thread in the current module to the
+/// shared counters, and resetting them. Returns null if there are none.
+llvm::Function *buildThreadLocalPGOCountersFlush(IRState &irs,
+                                                 const std::string &name);
+
 /// Keeps per-function PGO state.
 class CodeGenPGO {
 public:
@@ -86,6 +102,18 @@ public:
 
   void emitCounterIncrement(const RootObject *S) const;
 
+  /// Instruments the interface thunk `thunk` to the method `D` with a single
+  /// entry counter at the current insertion point. This makes the thunk known
+  /// to the profile runtime, so that profiled interface call targets can be
+  /// resolved to it and the hot call sites promoted to direct (inlinable)
+  /// calls of the thunk.
+  void emitThunkInstrumentation(const FuncDeclaration *D, llvm::Function *thunk);
+
+  /// Return the index of the counter mapped to the given statement.
+  unsigned getRegionCounterIndex(const RootObject *S) const {
+    return (*RegionCounterMap)[S];
+  }
+
   /// Return the region count for the counter at the given index.
   uint64_t getRegionCount(const RootObject *S) const {
     if (!RegionCounterMap)
@@ -121,13 +149,20 @@ public:
   /// Does nothing for LLVM < 3.9.
   void emitIndirectCallPGO(llvm::Instruction *callSite, llvm::Value *funcPtr);
 
+  /// Adds profiling instrumentation/annotation of the `size` operand of
+  /// memory operation `memOp` (memcpy, memset, memcmp), so that the mem op
+  /// can be specialized for the dominant sizes. Constant sizes are ignored.
+  /// Does nothing for LLVM < 5.
+  void emitMemOpSizePGO(llvm::Instruction *memOp, llvm::Value *size);
+
   /// Adds profiling instrumentation/annotation of a certain value.
   /// This method either inserts a call to the profile run-time during
   /// instrumentation or puts profile data into metadata for PGO use.
   /// The profiled value is of kind `valueKind`, will be added right before IR
   /// code site `valueSite`, and the to be profiled value is given by
-  /// `value`. `value` should be of LLVM i64 type, unless `ptrCastNeeded` is
-  /// true, in which case a ptrtoint cast to i64 is added.
+  /// `value`. `value` should be of an LLVM integer type (zero-extended to i64),
+  /// unless `ptrCastNeeded` is true, in which case a ptrtoint cast to i64 is
+  /// added.
   /// Does nothing for LLVM < 3.9.
   void valueProfile(uint32_t valueKind, llvm::Instruction *valueSite,
                     llvm::Value *value, bool ptrCastNeeded);
@@ -135,6 +170,8 @@ public:
 private:
   std::string FuncName;
   llvm::GlobalVariable *FuncNameVar;
+  /// The thread-local counters for -fprofile-update=per-thread.
+  llvm::GlobalVariable *ThreadLocalCounters = nullptr;
 
   unsigned NumRegionCounters;
   uint64_t FunctionHash;
@@ -165,9 +202,41 @@ private:
   void setFuncName(llvm::Function *Fn);
   void setFuncName(llvm::StringRef Name,
                    llvm::GlobalValue::LinkageTypes Linkage);
+  void createThreadLocalCounters();
+  void emitIncrement(unsigned counter) const;
   void mapRegionCounters(const FuncDeclaration *D);
   void computeRegionCounts(const FuncDeclaration *D);
+  void emitCoverageMapping(const FuncDeclaration *D);
   void applyFunctionAttributes(llvm::Function *Fn);
   void loadRegionCounts(llvm::IndexedInstrProfReader *PGOReader,
                         const FuncDeclaration *D);
 };
+
+/// Collects the coverage mapping records of the instrumented functions of a
+/// module (-fcoverage-mapping) and emits them into the coverage mapping
+/// section, for llvm-cov to report region coverage.
+class CoverageMappingModuleGen {
+public:
+  /// Return the index of the given file in the module's file list.
+  unsigned getFileIndex(llvm::StringRef filename);
+
+  /// Add the record of a function with its encoded mapping regions.
+  void addFunctionRecord(llvm::StringRef funcName, uint64_t funcHash,
+                         const std::string &mapping);
+
+  /// Emit the records added so far into the coverage mapping section and
+  /// reset.
+  void emit(IRState &irs);
+
+private:
+  struct FunctionRecord {
+    uint64_t nameHash;
+    uint32_t dataSize;
+    uint64_t funcHash;
+  };
+
+  llvm::StringMap<unsigned> fileIndices;
+  std::vector<std::string> filenames;
+  std::vector<FunctionRecord> functionRecords;
+  std::string mappings;
+};
@@ -123,6 +123,9 @@ LDCPragma DtoGetPragma(Scope *sc, PragmaDeclaration *decl,
         {"bitop.bt", LLVMbitop_bt},   {"bitop.btc", LLVMbitop_btc},
         {"bitop.btr", LLVMbitop_btr}, {"bitop.bts", LLVMbitop_bts},
         {"bitop.vld", LLVMbitop_vld}, {"bitop.vst", LLVMbitop_vst},
+        {"dcompute.shared", LLVMdcompute_shared},
+        {"dcompute.vload", LLVMdcompute_vload},
+        {"dcompute.vstore", LLVMdcompute_vstore},
     };
 
     static std::string prefix = "ldc.";
@@ -283,6 +286,15 @@ LDCPragma DtoGetPragma(Scope *sc, PragmaDeclaration *decl,
     return LLVMatomic_rmw;
   }
 
+  // pragma(LDC_yield) { templdecl(s) }
+  if (ident == Id::LDC_yield) {
+    if (args && args->dim > 0) {
+      decl->error("takes no parameters");
+      fatal();
+    }
+    return LLVMyield;
+  }
+
   // pragma(LDC_verbose);
   if (ident == Id::LDC_verbose) {
     if (args && args->dim > 0) {
@@ -360,6 +372,25 @@ void DtoCheckPragma(PragmaDeclaration *decl, Dsymbol *s,
     break;
   }
 
+  case LLVMdcompute_shared:
+  case LLVMdcompute_vload:
+  case LLVMdcompute_vstore: {
+    int count = applyFunctionPragma(s, [=](FuncDeclaration *fd) {
+      fd->llvmInternal = llvm_internal;
+    });
+    count += applyTemplatePragma(s, [=](TemplateDeclaration *td) {
+      td->llvmInternal = llvm_internal;
+    });
+    if (count != 1) {
+      error(s->loc,
+            "the `%s` pragma doesn't affect exactly 1 function/template "
+            "declaration",
+            ident->toChars());
+      fatal();
+    }
+    break;
+  }
+
   case LLVMglobal_crt_ctor:
   case LLVMglobal_crt_dtor: {
     const unsigned char flag = llvm_internal == LLVMglobal_crt_ctor ? 1 : 2;
@@ -406,7 +437,8 @@ void DtoCheckPragma(PragmaDeclaration *decl, Dsymbol *s,
   case LLVMva_arg:
   case LLVMatomic_load:
   case LLVMatomic_store:
-  case LLVMatomic_cmp_xchg: {
+  case LLVMatomic_cmp_xchg:
+  case LLVMyield: {
     const int count = applyTemplatePragma(s, [=](TemplateDeclaration *td) {
       if (td->parameters->dim != 1) {
         error(
@@ -556,6 +588,10 @@ bool DtoIsIntrinsic(FuncDeclaration *fd) {
   case LLVMbitop_bts:
   case LLVMbitop_vld:
   case LLVMbitop_vst:
+  case LLVMdcompute_shared:
+  case LLVMdcompute_vload:
+  case LLVMdcompute_vstore:
+  case LLVMyield:
     return true;
 
   default:
@@ -573,3 +609,81 @@ bool DtoIsVaIntrinsic(FuncDeclaration *fd) {
 bool DtoCheckProfileInstrPragma(Expression *arg, bool &value) {
   return parseBoolExp(arg, value);
 }
+
+// pragma(LDC_loop, <name>[ = <value>], ...), e.g.
+// pragma(LDC_loop, vectorize, width = 8, interleave = 4)
+bool DtoParseLoopPragmaArg(Expression *arg, LoopPragmaHint &hint) {
+  Identifier *name = nullptr;
+  Expression *value = nullptr;
+  if (arg->op == TOKidentifier) {
+    name = static_cast<IdentifierExp *>(arg)->ident;
+  } else if (arg->op == TOKassign) {
+    auto ae = static_cast<AssignExp *>(arg);
+    if (ae->e1->op == TOKidentifier) {
+      name = static_cast<IdentifierExp *>(ae->e1)->ident;
+      value = ae->e2;
+    }
+  }
+  if (!name) {
+    arg->error("`name` or `name = value` expected for `pragma(LDC_loop)`, "
+               "not `%s`",
+               arg->toChars());
+    return false;
+  }
+
+  static const struct {
+    const char *name;
+    const char *metadataName;
+    bool isBool;
+  } hints[] = {
+      {"vectorize", "llvm.loop.vectorize.enable", true},
+      {"width", "llvm.loop.vectorize.width", false},
+      {"interleave", "llvm.loop.interleave.count", false},
+      {"unroll", "llvm.loop.unroll.enable", true},
+      {"unroll_count", "llvm.loop.unroll.count", false},
+      {"distribute", "llvm.loop.distribute.enable", true},
+  };
+
+  for (const auto &h : hints) {
+    if (strcmp(name->toChars(), h.name) != 0) {
+      continue;
+    }
+
+    hint.metadataName = h.metadataName;
+    hint.hasValue = true;
+    hint.isBool = h.isBool;
+    if (h.isBool) {
+      bool enable = true;
+      if (value && !parseBoolExp(value, enable)) {
+        arg->error("`%s = true or false` expected for `pragma(LDC_loop)`",
+                   h.name);
+        return false;
+      }
+      hint.value = enable;
+      if (!enable && strcmp(h.name, "unroll") == 0) {
+        hint.metadataName = "llvm.loop.unroll.disable";
+        hint.hasValue = false;
+      }
+    } else {
+      dinteger_t count = 0;
+      if (!value || value->type->equals(Type::tbool) ||
+          !parseIntExp(value, count) || count == 0) {
+        arg->error("`%s = <positive integer>` expected for `pragma(LDC_loop)`",
+                   h.name);
+        return false;
+      }
+      hint.value = count;
+    }
+    return true;
+  }
+
+  arg->error("unknown `pragma(LDC_loop)` hint `%s`, expected one of: "
+             "vectorize, width, interleave, unroll, unroll_count, distribute",
+             name->toChars());
+  return false;
+}
+
+bool DtoCheckLoopPragmaArg(Expression *arg) {
+  LoopPragmaHint hint;
+  return DtoParseLoopPragmaArg(arg, hint);
+}
@@ -13,6 +13,7 @@
 
 #pragma once
 
+#include <cstdint>
 #include <string>
 
 class PragmaDeclaration;
@@ -48,12 +49,27 @@ enum LDCPragma {
   LLVMbitop_vld,
   LLVMbitop_vst,
   LLVMextern_weak,
-  LLVMprofile_instr
+  LLVMprofile_instr,
+  LLVMdcompute_shared,
+  LLVMdcompute_vload,
+  LLVMdcompute_vstore,
+  LLVMyield
 };
 
 LDCPragma DtoGetPragma(Scope *sc, PragmaDeclaration *decl, const char *&arg1str);
 void DtoCheckPragma(PragmaDeclaration *decl, Dsymbol *sym, LDCPragma llvm_internal,
                     const char * const arg1str);
 bool DtoCheckProfileInstrPragma(Expression *arg, bool &value);
+
+// A loop metadata hint of pragma(LDC_loop, <name>[ = <value>], ...).
+struct LoopPragmaHint {
+  const char *metadataName; // e.g., "llvm.loop.vectorize.width"
+  bool hasValue;            // false for e.g. "llvm.loop.unroll.disable"
+  bool isBool;              // i1 or i32 value
+  uint64_t value;
+};
+// Returns false (and reports an error) if `arg` isn't a valid hint.
+bool DtoParseLoopPragmaArg(Expression *arg, LoopPragmaHint &hint);
+bool DtoCheckLoopPragmaArg(Expression *arg);
 bool DtoIsIntrinsic(FuncDeclaration *fd);
 bool DtoIsVaIntrinsic(FuncDeclaration *fd);
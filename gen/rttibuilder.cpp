@@ -21,9 +21,18 @@
 #include "gen/tollvm.h"
 #include "ir/iraggr.h"
 #include "ir/irfunction.h"
+#include "llvm/Support/CommandLine.h"
 
 // in dmd/opover.d:
 AggregateDeclaration *isAggregate(Type *t);
+// in dmd/traits.d:
+d_uns64 getTypePointerBitmap(Loc loc, Type *t, Array<d_uns64> *data);
+
+static llvm::cl::opt<bool> gcPointerBitmaps(
+    "gc-pointer-bitmaps", llvm::cl::ZeroOrMore,
+    llvm::cl::desc("Emit pointer bitmaps for the precise GC into TypeInfos "
+                   "and ClassInfos lacking RTInfo from druntime"),
+    llvm::cl::init(true));
 
 RTTIBuilder::RTTIBuilder(Type *baseType) {
   const auto ad = isAggregate(baseType);
@@ -133,6 +142,47 @@ void RTTIBuilder::push_size_as_vp(uint64_t s) {
   push(llvm::ConstantExpr::getIntToPtr(DtoConstSize_t(s), getVoidPtrType()));
 }
 
+void RTTIBuilder::push_rtinfo(AggregateDeclaration *ad, bool hasPointers) {
+  if (ad->getRTInfo) {
+    LLConstant *rtinfo = toConstElem(ad->getRTInfo, gIR);
+    if (!gcPointerBitmaps || !hasPointers || !rtinfo->isNullValue()) {
+      push(rtinfo);
+      return;
+    }
+  }
+
+  // The cases where getRTInfo is null are not quite here, but the code is
+  // modelled after what DMD does.
+  if (!hasPointers) {
+    push_size_as_vp(0); // no pointers
+    return;
+  }
+
+  Array<d_uns64> bitmap;
+  const d_uns64 size = gcPointerBitmaps && !ad->isInterfaceDeclaration()
+                           ? getTypePointerBitmap(ad->loc, ad->type, &bitmap)
+                           : ~d_uns64(0);
+  if (size == ~d_uns64(0)) {
+    push_size_as_vp(1); // has pointers, scanned conservatively
+    return;
+  }
+
+  // [T.sizeof, pointer bits of words 0..63, pointer bits of words 64..127, ...]
+  std::vector<LLConstant *> words;
+  words.reserve(bitmap.dim + 1);
+  words.push_back(DtoConstSize_t(size));
+  for (size_t i = 0; i < bitmap.dim; ++i)
+    words.push_back(DtoConstSize_t(bitmap[i]));
+
+  auto init = LLConstantArray::get(
+      LLArrayType::get(DtoSize_t(), words.size()), words);
+  auto gvar = new LLGlobalVariable(gIR->module, init->getType(), true,
+                                   LLGlobalValue::InternalLinkage, init,
+                                   ".rtinfo");
+  gvar->setUnnamedAddr(llvm::GlobalValue::UnnamedAddr::Global);
+  push(DtoBitCast(gvar, getVoidPtrType()));
+}
+
 void RTTIBuilder::push_funcptr(FuncDeclaration *fd, Type *castto) {
   if (fd) {
     DtoResolveFunction(fd);
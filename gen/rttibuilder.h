@@ -17,6 +17,7 @@
 #include "llvm/ADT/SmallVector.h"
 #include "llvm/IR/Constant.h"
 
+class AggregateDeclaration;
 class ClassDeclaration;
 class Dsymbol;
 class FuncDeclaration;
@@ -47,6 +48,10 @@ public:
   void push_string(const char *str);
   void push_typeinfo(Type *t);
   void push_classinfo(ClassDeclaration *cd);
+  /// pushes the m_RTInfo GC info of an aggregate. If druntime's
+  /// `object.RTInfo` didn't generate one, the pointer bitmap of the type in
+  /// the format of `__traits(getPointerBitmap)` is emitted instead.
+  void push_rtinfo(AggregateDeclaration *ad, bool hasPointers);
 
   /// pushes the function pointer or a null void* if it cannot.
   void push_funcptr(FuncDeclaration *fd, Type *castto = nullptr);
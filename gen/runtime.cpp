@@ -18,6 +18,8 @@
 #include "dmd/root/root.h"
 #include "dmd/tokens.h"
 #include "driver/cl_options_instrumentation.h"
+#include "driver/plugin_api.h"
+#include "driver/plugins.h"
 #include "gen/abi.h"
 #include "gen/attributes.h"
 #include "gen/functions.h"
@@ -35,6 +37,7 @@
 #include "llvm/Support/CommandLine.h"
 #include "llvm/Support/MemoryBuffer.h"
 #include <algorithm>
+#include <set>
 
 #if LDC_LLVM_VER >= 400
 #include "llvm/Bitcode/BitcodeWriter.h"
@@ -52,10 +55,12 @@ static llvm::cl::opt<bool> nogc(
 ////////////////////////////////////////////////////////////////////////////////
 
 // Internal LLVM module containing already declared runtime functions and
-// globals.
+// globals. Built lazily on the first getRuntimeFunction() lookup, so that
+// modules not calling into druntime don't pay for it.
 static llvm::Module *M = nullptr;
 
 static void buildRuntimeModule();
+static void freeFunctionDeclarers();
 
 ////////////////////////////////////////////////////////////////////////////////
 
@@ -126,6 +131,7 @@ void freeRuntime() {
     Logger::println("*** Freeing D runtime declarations ***");
     delete M;
     M = nullptr;
+    freeFunctionDeclarers();
   }
 }
 
@@ -312,6 +318,16 @@ void createFwdDecl(LINK linkage, PotentiallyLazyType returnType,
 
 } // anonymous namespace
 
+static void freeFunctionDeclarers() {
+  // Declarers are shared by all their function names.
+  std::set<LazyFunctionDeclarer *> declarers;
+  for (auto &entry : lazyFunctionDeclarers)
+    declarers.insert(entry.second);
+  for (auto declarer : declarers)
+    delete declarer;
+  lazyFunctionDeclarers.clear();
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 
 llvm::Function *getRuntimeFunction(const Loc &loc, llvm::Module &target,
@@ -347,6 +363,9 @@ llvm::Function *getRuntimeFunction(const Loc &loc, llvm::Module &target,
       llvm::cast<llvm::Function>(target.getOrInsertFunction(name, fnty));
   resfn->setAttributes(fn->getAttributes());
   resfn->setCallingConv(fn->getCallingConv());
+  if (arePluginsLoaded()) {
+    resfn->addFnAttr(ldc::plugin::DRuntimeHookAttr);
+  }
   return resfn;
 }
 
@@ -519,6 +538,9 @@ static void buildRuntimeModule() {
       Attr_ReadOnly_NoUnwind_1_2_NoCapture(Attr_ReadOnly_NoUnwind_1_NoCapture,
                                            AttrSet::FirstArgIndex + 1,
                                            llvm::Attribute::NoCapture),
+      Attr_ReadOnly_NoUnwind_ArgMemOnly_1_2_NoCapture(
+          Attr_ReadOnly_NoUnwind_1_2_NoCapture, LLAttributeSet::FunctionIndex,
+          llvm::Attribute::ArgMemOnly),
       Attr_ReadNone(NoAttrs, LLAttributeSet::FunctionIndex,
                     llvm::Attribute::ReadNone),
       Attr_1_NoCapture(NoAttrs, AttrSet::FirstArgIndex,
@@ -620,6 +642,10 @@ static void buildRuntimeModule() {
   createFwdDecl(LINKc, objectTy, {"_d_newclass", "_d_allocclass"},
                 {classInfoTy}, {STCconst}, Attr_NoAlias);
 
+  // Throwable _d_newThrowable(const ClassInfo ci)
+  createFwdDecl(LINKc, throwableTy, {"_d_newThrowable"}, {classInfoTy},
+                {STCconst}, Attr_NoAlias);
+
   // void* _d_newitemT (TypeInfo ti)
   // void* _d_newitemiT(TypeInfo ti)
   createFwdDecl(LINKc, voidPtrTy, {"_d_newitemT", "_d_newitemiT"}, {typeInfoTy},
@@ -637,6 +663,9 @@ static void buildRuntimeModule() {
   // void _d_callfinalizer(void* p)
   createFwdDecl(LINKc, voidTy, {"_d_callfinalizer"}, {voidPtrTy});
 
+  // void _d_monitordelete(Object h, bool det)
+  createFwdDecl(LINKc, voidTy, {"_d_monitordelete"}, {objectTy, boolTy});
+
   // D2: void _d_delclass(Object* p)
   createFwdDecl(LINKc, voidTy, {"_d_delclass"}, {objectPtrTy});
 
@@ -902,7 +931,7 @@ static void buildRuntimeModule() {
 
   // int memcmp(const void *s1, const void *s2, size_t n);
   createFwdDecl(LINKc, intTy, {"memcmp"}, {voidPtrTy, voidPtrTy, sizeTy}, {},
-                Attr_ReadOnly_NoUnwind_1_2_NoCapture);
+                Attr_ReadOnly_NoUnwind_ArgMemOnly_1_2_NoCapture);
 }
 
 static void emitInstrumentationFn(const char *name) {
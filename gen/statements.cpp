@@ -18,6 +18,7 @@
 #include "dmd/module.h"
 #include "dmd/mtype.h"
 #include "dmd/root/port.h"
+#include "dmd/template.h"
 #include "gen/abi.h"
 #include "gen/arrays.h"
 #include "gen/classes.h"
@@ -29,16 +30,27 @@
 #include "gen/llvm.h"
 #include "gen/llvmhelpers.h"
 #include "gen/logger.h"
+#include "gen/moveelision.h"
+#include "gen/optimizer.h"
+#include "gen/pragma.h"
 #include "gen/runtime.h"
 #include "gen/tollvm.h"
 #include "ir/irfunction.h"
 #include "ir/irmodule.h"
 #include "llvm/IR/CFG.h"
 #include "llvm/IR/InlineAsm.h"
+#include "llvm/Support/CommandLine.h"
 #include <fstream>
+#include <map>
 #include <math.h>
 #include <stdio.h>
 
+static llvm::cl::opt<bool> inlineStringSwitch(
+    "inline-string-switch", llvm::cl::ZeroOrMore,
+    llvm::cl::desc("Dispatch switch statements on strings inline on the "
+                   "string length and first character instead of calling "
+                   "druntime's __switch"));
+
 //////////////////////////////////////////////////////////////////////////////
 // FIXME: Integrate these functions
 void AsmStatement_toIR(InlineAsmStatement *stmt, IRState *irs);
@@ -46,6 +58,218 @@ void CompoundAsmStatement_toIR(CompoundAsmStatement *stmt, IRState *p);
 
 //////////////////////////////////////////////////////////////////////////////
 
+/// Returns the `llvm.loop` metadata for the hints of a `pragma(LDC_loop)`
+/// statement, to be attached to the loop latch, or null.
+static llvm::MDNode *getLoopPragmaID(PragmaStatement *loopPragma) {
+  if (!loopPragma || !loopPragma->args || loopPragma->args->dim == 0) {
+    return nullptr;
+  }
+
+  auto &ctx = gIR->context();
+  auto self = llvm::MDNode::getTemporary(ctx, llvm::None);
+  llvm::SmallVector<llvm::Metadata *, 4> ops = {self.get()};
+  for (auto arg : *loopPragma->args) {
+    LoopPragmaHint hint;
+    const bool valid = DtoParseLoopPragmaArg(arg, hint);
+    assert(valid && "pragma(LDC_loop) hints are checked in semantic");
+    (void)valid;
+
+    llvm::SmallVector<llvm::Metadata *, 2> hintOps = {
+        llvm::MDString::get(ctx, hint.metadataName)};
+    if (hint.hasValue) {
+      LLType *type = hint.isBool ? llvm::Type::getInt1Ty(ctx)
+                                 : llvm::Type::getInt32Ty(ctx);
+      hintOps.push_back(llvm::ConstantAsMetadata::get(
+          llvm::ConstantInt::get(type, hint.value)));
+    }
+    ops.push_back(llvm::MDNode::get(ctx, hintOps));
+  }
+
+  llvm::MDNode *loopID = llvm::MDNode::getDistinct(ctx, ops);
+  loopID->replaceOperandWith(0, loopID);
+  return loopID;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+/// The frontend lowers switch statements on strings to
+/// `switch (object.__switch!(T, labels...)(cond))`, with the labels sorted
+/// and the case expressions replaced by the label indices. Collects the labels
+/// and returns true if the switch is of that form.
+static bool getStringSwitchLabels(SwitchStatement *stmt,
+                                  llvm::SmallVectorImpl<StringExp *> &labels) {
+  if (stmt->condition->op != TOKcall) {
+    return false;
+  }
+  auto ce = static_cast<CallExp *>(stmt->condition);
+  if (!ce->f || ce->f->ident != Id::__switch || !ce->arguments ||
+      ce->arguments->dim != 1 ||
+      (*ce->arguments)[0]->type->toBasetype()->ty != Tarray) {
+    return false;
+  }
+
+  TemplateInstance *ti =
+      ce->f->parent ? ce->f->parent->isTemplateInstance() : nullptr;
+  if (!ti || !ti->tiargs || ti->tiargs->dim < 2) {
+    return false;
+  }
+
+  // The first template argument is the character type.
+  for (size_t i = 1; i < ti->tiargs->dim; ++i) {
+    Expression *e = isExpression((*ti->tiargs)[i]);
+    if (!e || e->op != TOKstring || e->type->toBasetype()->ty != Tarray) {
+      return false;
+    }
+    labels.push_back(static_cast<StringExp *>(e));
+  }
+  return true;
+}
+
+/// Emits the equivalent of the `__switch` call of a lowered string switch,
+/// i.e., the index of the label matching the condition, or -1 if none does.
+/// The condition is dispatched on its length and then on its first character,
+/// and finally compared to the remaining candidate labels via memcmp.
+static LLValue *emitStringSwitchIndex(SwitchStatement *stmt,
+                                      llvm::ArrayRef<StringExp *> labels,
+                                      IRState *irs) {
+  IF_LOG Logger::println("Dispatching string switch inline");
+  LOG_SCOPE;
+
+  auto &PGO = irs->funcGen().pgo;
+  auto ce = static_cast<CallExp *>(stmt->condition);
+  LLType *const indexTy = DtoType(ce->type);
+
+  DValue *cond = toElemDtor((*ce->arguments)[0]);
+  LLValue *condLen = DtoArrayLen(cond);
+  LLValue *condPtr = DtoArrayPtr(cond);
+  const size_t charSize =
+      getTypeAllocSize(condPtr->getType()->getContainedType(0));
+
+  // Profile counts of the labels, for the dispatch branch weights.
+  llvm::SmallVector<uint64_t, 16> labelCounts(labels.size(), 0);
+  for (auto cs : *stmt->cases) {
+    const auto index = cs->exp->toInteger();
+    if (index < labels.size()) {
+      labelCounts[index] += PGO.getRegionCount(cs);
+    }
+  }
+  const uint64_t defaultCount =
+      stmt->sdefault ? PGO.getRegionCount(stmt->sdefault) : 0;
+
+  // label indices by length and first character
+  std::map<size_t, std::map<unsigned, llvm::SmallVector<size_t, 2>>> groups;
+  for (size_t i = 0; i < labels.size(); ++i) {
+    const size_t len = labels[i]->numberOfCodeUnits();
+    groups[len][len ? labels[i]->charAt(0) : 0].push_back(i);
+  }
+
+  llvm::BasicBlock *endbb = irs->insertBB("stringswitch.end");
+  llvm::BasicBlock *nomatchbb =
+      irs->insertBBBefore(endbb, "stringswitch.nomatch");
+  llvm::SmallVector<std::pair<LLValue *, llvm::BasicBlock *>, 16> incoming;
+
+  // Compares the condition against each candidate label in turn.
+  const auto emitCompares = [&](llvm::ArrayRef<size_t> indices) {
+    for (size_t i = 0; i < indices.size(); ++i) {
+      StringExp *label = labels[indices[i]];
+      LLConstant *labelPtr = toConstElem(label, irs)->getAggregateElement(1u);
+      const size_t len = label->numberOfCodeUnits();
+
+      LLValue *args[] = {DtoBitCast(condPtr, getVoidPtrType()),
+                         DtoBitCast(labelPtr, getVoidPtrType()),
+                         DtoConstSize_t(len * charSize)};
+      LLValue *cmp = irs->ir->CreateCall(
+          getRuntimeFunction(stmt->loc, irs->module, "memcmp"), args);
+      LLValue *isEqual = irs->ir->CreateICmpEQ(cmp, DtoConstInt(0));
+
+      llvm::BasicBlock *nextbb =
+          i + 1 == indices.size()
+              ? nomatchbb
+              : irs->insertBBBefore(nomatchbb, "stringswitch.cmp");
+      auto br = llvm::BranchInst::Create(endbb, nextbb, isEqual,
+                                         irs->scopebb());
+      PGO.addBranchWeights(
+          br, PGO.createProfileWeights(labelCounts[indices[i]], 0));
+      incoming.emplace_back(LLConstantInt::get(indexTy, indices[i]),
+                            irs->scopebb());
+      irs->scope() = IRScope(nextbb);
+    }
+  };
+
+  auto lenSwitch = llvm::SwitchInst::Create(condLen, nomatchbb, groups.size(),
+                                            irs->scopebb());
+  std::vector<uint64_t> lenWeights = {defaultCount};
+
+  for (auto &byLength : groups) {
+    const size_t len = byLength.first;
+    auto &byChar = byLength.second;
+
+    llvm::BasicBlock *lenbb =
+        irs->insertBBBefore(nomatchbb, "stringswitch.len");
+    lenSwitch->addCase(LLConstantInt::get(DtoSize_t(), len), lenbb);
+    irs->scope() = IRScope(lenbb);
+
+    uint64_t lenCount = 0;
+    for (auto &c : byChar) {
+      for (auto i : c.second) {
+        lenCount += labelCounts[i];
+      }
+    }
+    lenWeights.push_back(lenCount);
+
+    // There is only a single label of length 0.
+    if (len == 0) {
+      const size_t index = byChar.begin()->second[0];
+      llvm::BranchInst::Create(endbb, lenbb);
+      incoming.emplace_back(LLConstantInt::get(indexTy, index), lenbb);
+      continue;
+    }
+
+    if (byChar.size() == 1) {
+      emitCompares(byChar.begin()->second);
+      continue;
+    }
+
+    LLValue *firstChar = DtoLoad(condPtr, ".firstchar");
+    auto charSwitch = llvm::SwitchInst::Create(firstChar, nomatchbb,
+                                               byChar.size(), lenbb);
+    std::vector<uint64_t> charWeights = {0};
+    for (auto &c : byChar) {
+      llvm::BasicBlock *charbb =
+          irs->insertBBBefore(nomatchbb, "stringswitch.char");
+      charSwitch->addCase(
+          llvm::ConstantInt::get(
+              llvm::cast<llvm::IntegerType>(firstChar->getType()), c.first),
+          charbb);
+      uint64_t charCount = 0;
+      for (auto i : c.second) {
+        charCount += labelCounts[i];
+      }
+      charWeights.push_back(charCount);
+
+      irs->scope() = IRScope(charbb);
+      emitCompares(c.second);
+    }
+    PGO.addBranchWeights(charSwitch, PGO.createProfileWeights(charWeights));
+  }
+  PGO.addBranchWeights(lenSwitch, PGO.createProfileWeights(lenWeights));
+
+  // no label matched
+  irs->scope() = IRScope(nomatchbb);
+  llvm::BranchInst::Create(endbb, nomatchbb);
+  incoming.emplace_back(LLConstantInt::get(indexTy, -1, true), nomatchbb);
+
+  irs->scope() = IRScope(endbb);
+  llvm::PHINode *index =
+      irs->ir->CreatePHI(indexTy, incoming.size(), ".stringswitch.index");
+  for (auto &in : incoming) {
+    index->addIncoming(in.first, in.second);
+  }
+  return index;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
 class ToIRVisitor : public Visitor {
   IRState *irs;
 
@@ -67,8 +291,16 @@ public:
     auto &PGO = irs->funcGen().pgo;
     PGO.setCurrentStmt(stmt);
 
-    for (auto s : *stmt->statements) {
-      if (s) {
+    auto &statements = *stmt->statements;
+    for (size_t i = 0; i < statements.dim; ++i) {
+      if (Statement *s = statements[i]) {
+        if (i + 1 < statements.dim) {
+          if (auto dtor = statements[i + 1]
+                              ? statements[i + 1]->isDtorExpStatement()
+                              : nullptr) {
+            moveelision::prepare(*irs, s, dtor);
+          }
+        }
         s->accept(this);
       }
     }
@@ -96,6 +328,12 @@ public:
     FuncDeclaration *const fd = f->decl;
     llvm::FunctionType *funcType = f->getLLVMFuncType();
 
+    if (fd->isGenerator) {
+      stmt->error("cannot `return` from generator function `%s`",
+                  fd->toChars());
+      fatal();
+    }
+
     emitInstrumentationFnLeave(fd);
 
     // is there a return value expression?
@@ -266,6 +504,25 @@ public:
     }
   }
 
+  void visit(DtorExpStatement *stmt) override {
+    auto movedFrom = irs->funcGen().guardedDtors.lookup(stmt);
+    if (!movedFrom) {
+      visit(static_cast<ExpStatement *>(stmt));
+      return;
+    }
+
+    // skip the destructor if the variable has been moved from
+    llvm::BasicBlock *dtorbb = irs->insertBB("dtor");
+    llvm::BasicBlock *endbb = irs->insertBBAfter(dtorbb, "dtor.end");
+    llvm::BranchInst::Create(endbb, dtorbb, DtoLoad(movedFrom),
+                             irs->scopebb());
+    irs->scope() = IRScope(dtorbb);
+    visit(static_cast<ExpStatement *>(stmt));
+    if (!irs->scopereturned())
+      llvm::BranchInst::Create(endbb, irs->scopebb());
+    irs->scope() = IRScope(endbb);
+  }
+
   //////////////////////////////////////////////////////////////////////////
 
   bool dcomputeReflectMatches(CallExp *ce) {
@@ -369,7 +626,31 @@ public:
 
     if (stmt->statement) {
       irs->DBuilder.EmitBlockStart(stmt->statement->loc);
+
+      // Emit lifetime markers for the locals declared in the scope, so that
+      // LLVM's stack coloring can overlap their stack slots with the ones of
+      // other scopes. The lifetimes are only ended when falling through the
+      // end of the scope; other exits (break, return, unwinding etc.) keep the
+      // slots alive conservatively.
+      const bool trackLocals = isOptimizationEnabled() && !irs->dcomputetarget;
+      auto &scopedLocals = irs->funcGen().scopedLocals;
+      if (trackLocals) {
+        scopedLocals.emplace_back();
+      }
+
       stmt->statement->accept(this);
+
+      if (trackLocals) {
+        if (!irs->scopereturned()) {
+          for (auto it = scopedLocals.back().rbegin(),
+                    end = scopedLocals.back().rend();
+               it != end; ++it) {
+            irs->ir->CreateLifetimeEnd(*it);
+          }
+        }
+        scopedLocals.pop_back();
+      }
+
       irs->DBuilder.EmitBlockEnd();
     }
   }
@@ -491,6 +772,9 @@ public:
           PGO.createProfileWeightsWhileLoop(stmt->condition, loopcount);
       PGO.addBranchWeights(branchinst, brweights);
     }
+    if (auto loopID = getLoopPragmaID(stmt->loopPragma)) {
+      branchinst->setMetadata(llvm::LLVMContext::MD_loop, loopID);
+    }
 
     // rewrite the scope
     irs->scope() = IRScope(endbb);
@@ -582,7 +866,10 @@ public:
 
     // loop
     if (!irs->scopereturned()) {
-      llvm::BranchInst::Create(forbb, irs->scopebb());
+      auto latch = llvm::BranchInst::Create(forbb, irs->scopebb());
+      if (auto loopID = getLoopPragmaID(stmt->loopPragma)) {
+        latch->setMetadata(llvm::LLVMContext::MD_loop, loopID);
+      }
     }
 
     irs->funcGen().jumpTargets.popLoopTarget();
@@ -707,6 +994,9 @@ public:
       return;
     }
 
+    if (auto dtor = stmt->finalbody->isDtorExpStatement())
+      moveelision::prepare(*irs, stmt->_body, dtor);
+
     // We'll append the "try" part to the current basic block later. No need
     // for an extra one (we'd need to branch to it unconditionally anyway).
     llvm::BasicBlock *trybb = irs->scopebb();
@@ -898,7 +1188,13 @@ public:
     irs->scope() = IRScope(oldbb);
     if (useSwitchInst) {
       // The case index value.
-      LLValue *condVal = DtoRVal(toElemDtor(stmt->condition));
+      LLValue *condVal;
+      llvm::SmallVector<StringExp *, 16> stringLabels;
+      if (inlineStringSwitch && getStringSwitchLabels(stmt, stringLabels)) {
+        condVal = emitStringSwitchIndex(stmt, stringLabels, irs);
+      } else {
+        condVal = DtoRVal(toElemDtor(stmt->condition));
+      }
 
       // Create switch and add the cases.
       // For PGO instrumentation, we need to add counters /before/ the case
@@ -1421,9 +1717,6 @@ public:
       a->code = label.str();
       irs->asmBlock->s.push_back(a);
       irs->asmBlock->internalLabels.push_back(stmt->ident);
-
-      // disable inlining
-      irs->func()->setNeverInline();
     } else {
       llvm::BasicBlock *labelBB =
           irs->insertBB(llvm::Twine("label.") + stmt->ident->toChars());
@@ -1567,9 +1860,9 @@ public:
     LLValue *moduleInfoSymbol = getIrModule(module)->moduleInfoSymbol();
     LLType *moduleInfoPtrType = DtoPtrToType(getModuleInfoType());
 
-    LLCallSite call = irs->CreateCallOrInvoke(
-        fn, DtoBitCast(moduleInfoSymbol, moduleInfoPtrType),
-        DtoConstUint(stmt->loc.linnum));
+    LLCallSite call =
+        DtoFailureCall(fn, {DtoBitCast(moduleInfoSymbol, moduleInfoPtrType),
+                            DtoConstUint(stmt->loc.linnum)});
     call.setDoesNotReturn();
   }
 
@@ -17,6 +17,7 @@
 #include "driver/linker.h"
 #include "gen/abi.h"
 #include "gen/irstate.h"
+#include "gen/ldctraits.h"
 #include "gen/llvmhelpers.h"
 #include <assert.h>
 
@@ -234,8 +235,20 @@ TypeTuple *Target::toArgTypes(Type *t) {
   const auto &triple = *global.params.targetTriple;
   if (triple.getArch() == llvm::Triple::x86)
     return ::toArgTypes(t);
-  if (triple.getArch() == llvm::Triple::x86_64 && !triple.isOSWindows())
-    return toArgTypes_sysv_x64(t);
+  if (triple.getArch() == llvm::Triple::x86_64 && !triple.isOSWindows()) {
+    TypeTuple *result = toArgTypes_sysv_x64(t);
+    // Like GCC and clang, only pass 32-byte vectors in (YMM) registers if AVX
+    // is enabled for the whole module, and in memory otherwise. This way,
+    // functions with AVX enabled via @target agree with baseline code.
+    if (result && result->arguments->dim == 1) {
+      Type *argType = (*result->arguments)[0]->type;
+      if (argType->ty == Tvector && argType->size() > 16 &&
+          !traitsTargetHasFeature("avx")) {
+        return TypeTuple::create(new Parameters());
+      }
+    }
+    return result;
+  }
   return nullptr;
 }
 
@@ -0,0 +1,197 @@
+//===-- targetclones.cpp --------------------------------------------------===//
+//
+//                         LDC – the LLVM D compiler
+//
+// This file is distributed under the BSD-style LDC license. See the LICENSE
+// file for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "gen/targetclones.h"
+
+#include "dmd/declaration.h"
+#include "dmd/errors.h"
+#include "gen/irstate.h"
+#include "gen/logger.h"
+#include "gen/uda.h"
+#include "ir/irfunction.h"
+#include "llvm/ADT/StringSwitch.h"
+#include "llvm/IR/GlobalIFunc.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include <algorithm>
+
+namespace {
+/// Returns the bit of the feature in `__cpu_model.__cpu_features[0]` (enum
+/// ProcessorFeatures of libgcc and compiler-rt), or -1 if not detectable.
+int getCpuFeatureBit(llvm::StringRef feature) {
+  return llvm::StringSwitch<int>(feature)
+      .Case("cmov", 0)
+      .Case("mmx", 1)
+      .Case("popcnt", 2)
+      .Case("sse", 3)
+      .Case("sse2", 4)
+      .Case("sse3", 5)
+      .Case("ssse3", 6)
+      .Case("sse4.1", 7)
+      .Case("sse4.2", 8)
+      .Case("avx", 9)
+      .Case("avx2", 10)
+      .Case("sse4a", 11)
+      .Case("fma4", 12)
+      .Case("xop", 13)
+      .Case("fma", 14)
+      .Case("avx512f", 15)
+      .Case("bmi", 16)
+      .Case("bmi2", 17)
+      .Case("aes", 18)
+      .Case("pclmul", 19)
+      .Case("avx512vl", 20)
+      .Case("avx512bw", 21)
+      .Case("avx512dq", 22)
+      .Case("avx512cd", 23)
+      .Case("avx512er", 24)
+      .Case("avx512pf", 25)
+      .Case("avx512vbmi", 26)
+      .Case("avx512ifma", 27)
+      .Case("avx5124vnniw", 28)
+      .Case("avx5124fmaps", 29)
+      .Case("avx512vpopcntdq", 30)
+      .Default(-1);
+}
+
+/// Computes the mask of CPU features required by the target spec (a
+/// comma-separated list of features), returns false if not detectable.
+bool getCpuFeatureMask(const Loc &loc, llvm::StringRef spec, uint32_t &mask) {
+  mask = 0;
+  llvm::SmallVector<llvm::StringRef, 4> features;
+  spec.split(features, ',', -1, false);
+  for (auto f : features) {
+    f = f.trim();
+    const int bit = getCpuFeatureBit(f);
+    if (bit < 0) {
+      error(loc,
+            "`@targetClones` version `%s`: `%s` cannot be detected at runtime, "
+            "only CPU features like `avx2` are supported",
+            spec.str().c_str(), f.str().c_str());
+      return false;
+    }
+    mask |= 1u << bit;
+  }
+  return true;
+}
+
+std::string getVersionSuffix(llvm::StringRef spec) {
+  std::string suffix = spec;
+  std::replace_if(suffix.begin(), suffix.end(),
+                  [](char c) { return !isalnum(c) && c != '.'; }, '_');
+  return suffix;
+}
+
+llvm::Function *getCpuIndicatorInit(llvm::Module &module) {
+  const char *name = "__cpu_indicator_init";
+  if (auto fn = module.getFunction(name))
+    return fn;
+  auto voidTy = llvm::Type::getVoidTy(module.getContext());
+  auto fnTy = llvm::FunctionType::get(voidTy, false);
+  return llvm::Function::Create(fnTy, llvm::GlobalValue::ExternalLinkage, name,
+                                &module);
+}
+
+void emitTargetClones(IRState &irs, IrFunction *irFunc) {
+  llvm::Function *func = irFunc->getLLVMFunc();
+  const Loc &loc = irFunc->decl->loc;
+  const std::string name = func->getName();
+  auto &module = irs.module;
+  auto &context = irs.context();
+
+  IF_LOG Logger::println("Emitting target clones of %s", name.c_str());
+  LOG_SCOPE;
+
+  struct Version {
+    llvm::Function *func;
+    uint32_t featureMask;
+  };
+  llvm::Function *defaultVersion = nullptr;
+  std::vector<Version> versions;
+
+  for (const auto &spec : irFunc->targetClones) {
+    uint32_t mask = 0;
+    if (spec != "default" && !getCpuFeatureMask(loc, spec, mask))
+      return;
+
+    llvm::ValueToValueMapTy vmap;
+    llvm::Function *clone = llvm::CloneFunction(func, vmap);
+    clone->setName(name + "." + getVersionSuffix(spec));
+    clone->setLinkage(llvm::GlobalValue::InternalLinkage);
+    clone->setVisibility(llvm::GlobalValue::DefaultVisibility);
+    clone->setComdat(nullptr);
+
+    if (spec == "default") {
+      defaultVersion = clone;
+    } else {
+      applyTargetSpec(spec, clone, nullptr);
+      versions.push_back({clone, mask});
+    }
+  }
+  assert(defaultVersion);
+
+  // The resolver, checking the versions in reverse order.
+  auto resolver = llvm::Function::Create(
+      llvm::FunctionType::get(func->getType(), false),
+      llvm::GlobalValue::InternalLinkage, name + ".resolver", &module);
+  llvm::IRBuilder<> b(llvm::BasicBlock::Create(context, "", resolver));
+  b.CreateCall(getCpuIndicatorInit(module), {});
+
+  // struct __processor_model { uint vendor, type, subtype; uint[1] features; }
+  auto i32 = llvm::Type::getInt32Ty(context);
+  auto cpuModelType = llvm::StructType::get(
+      context, {i32, i32, i32, llvm::ArrayType::get(i32, 1)});
+  llvm::GlobalVariable *cpuModel = module.getGlobalVariable("__cpu_model");
+  if (!cpuModel) {
+    cpuModel = new llvm::GlobalVariable(module, cpuModelType, false,
+                                        llvm::GlobalValue::ExternalLinkage,
+                                        nullptr, "__cpu_model");
+  }
+  llvm::Value *features = b.CreateLoad(b.CreateInBoundsGEP(
+      cpuModelType, cpuModel, {b.getInt32(0), b.getInt32(3), b.getInt32(0)}));
+
+  for (auto it = versions.rbegin(); it != versions.rend(); ++it) {
+    auto mask = b.getInt32(it->featureMask);
+    auto supported = b.CreateICmpEQ(b.CreateAnd(features, mask), mask);
+    auto selectBB = llvm::BasicBlock::Create(context, "", resolver);
+    auto nextBB = llvm::BasicBlock::Create(context, "", resolver);
+    b.CreateCondBr(supported, selectBB, nextBB);
+    b.SetInsertPoint(selectBB);
+    b.CreateRet(it->func);
+    b.SetInsertPoint(nextBB);
+  }
+  b.CreateRet(defaultVersion);
+
+  // Replace the function by the ifunc. ifuncs aren't discardable, so
+  // linkonce_odr template instances become weak_odr.
+  auto linkage = func->getLinkage();
+  if (llvm::GlobalValue::isLinkOnceODRLinkage(linkage)) {
+    linkage = llvm::GlobalValue::WeakODRLinkage;
+  } else if (llvm::GlobalValue::isLinkOnceLinkage(linkage)) {
+    linkage = llvm::GlobalValue::WeakAnyLinkage;
+  }
+  auto ifunc = llvm::GlobalIFunc::create(func->getFunctionType(),
+                                         func->getType()->getAddressSpace(),
+                                         linkage, "", resolver, &module);
+  ifunc->setVisibility(func->getVisibility());
+  ifunc->takeName(func);
+
+  func->replaceAllUsesWith(ifunc);
+  std::replace(irs.usedArray.begin(), irs.usedArray.end(),
+               static_cast<llvm::Constant *>(func),
+               static_cast<llvm::Constant *>(ifunc));
+  func->eraseFromParent();
+  irFunc->setLLVMFunc(defaultVersion);
+}
+}
+
+void emitTargetClones(IRState &irs) {
+  for (IrFunction *irFunc : irs.targetClonedFunctions)
+    emitTargetClones(irs, irFunc);
+  irs.targetClonedFunctions.clear();
+}
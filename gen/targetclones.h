@@ -0,0 +1,27 @@
+//===-- gen/targetclones.h - Function multiversioning -----------*- C++ -*-===//
+//
+//                         LDC – the LLVM D compiler
+//
+// This file is distributed under the BSD-style LDC license. See the LICENSE
+// file for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Generates the versions of functions with @ldc.attributes.targetClones, e.g.,
+//
+//   @targetClones("default", "avx2", "avx512f") void kernel(float[] a);
+//
+// Each version is an internal clone compiled for its target spec. The function
+// symbol itself becomes an ifunc, whose resolver picks the last listed version
+// supported by the CPU (falling back to "default") via the x86 CPU feature
+// detection of libgcc/compiler-rt (`__cpu_indicator_init`, `__cpu_model`).
+//
+//===----------------------------------------------------------------------===//
+
+#pragma once
+
+struct IRState;
+
+/// Replaces all functions in irs.targetClonedFunctions by their dispatched
+/// versions. To be called once the module is complete.
+void emitTargetClones(IRState &irs);
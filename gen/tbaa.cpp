@@ -0,0 +1,177 @@
+//===-- tbaa.cpp ----------------------------------------------------------===//
+//
+//                         LDC – the LLVM D compiler
+//
+// This file is distributed under the BSD-style LDC license. See the LICENSE
+// file for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "gen/tbaa.h"
+
+#include "dmd/aggregate.h"
+#include "dmd/declaration.h"
+#include "dmd/mtype.h"
+#include "gen/optimizer.h"
+#include "llvm/IR/Instruction.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/Support/CommandLine.h"
+#include <utility>
+#include <vector>
+
+namespace {
+
+llvm::cl::opt<bool> strictAliasing(
+    "fstrict-aliasing", llvm::cl::ZeroOrMore,
+    llvm::cl::desc("Emit type-based alias analysis metadata when optimizing, "
+                   "assuming memory isn't accessed through pointers to "
+                   "unrelated scalar types (except for 1-byte types, unions "
+                   "and direct *cast(T*)p reinterpretations)"));
+
+bool isEnabled() { return strictAliasing && isOptimizationEnabled(); }
+
+const char *getScalarName(Type *t) {
+  switch (t->toBasetype()->ty) {
+  case Tint16:
+  case Tuns16:
+  case Twchar:
+    return "short";
+  case Tint32:
+  case Tuns32:
+  case Tdchar:
+    return "int";
+  case Tint64:
+  case Tuns64:
+    return "long";
+  case Tint128:
+  case Tuns128:
+    return "cent";
+  case Tfloat32:
+  case Timaginary32:
+    return "float";
+  case Tfloat64:
+  case Timaginary64:
+    return "double";
+  case Tfloat80:
+  case Timaginary80:
+    // -real-precision=double: same format as double
+    return global.params.realIsDouble ? "double" : "real";
+  case Tpointer:
+  case Tclass:
+  case Taarray:
+  case Tnull:
+    return "any pointer";
+  default:
+    // 1-byte types, slices, delegates, vectors, aggregates...
+    return nullptr;
+  }
+}
+
+bool hasOverlappingFields(StructDeclaration *sd) {
+  for (VarDeclaration *vd : sd->fields) {
+    if (vd->overlapped)
+      return true;
+  }
+  return false;
+}
+
+} // anonymous namespace
+
+llvm::MDNode *TBAABuilder::getCharNode() {
+  if (!charNode) {
+    charNode = builder.createTBAAScalarTypeNode("omnipotent char",
+                                                builder.createTBAARoot("D TBAA"));
+  }
+  return charNode;
+}
+
+llvm::MDNode *TBAABuilder::getScalarNode(Type *t) {
+  const char *name = getScalarName(t);
+  if (!name)
+    return nullptr;
+  llvm::MDNode *&node = scalarNodes[name];
+  if (!node)
+    node = builder.createTBAAScalarTypeNode(name, getCharNode());
+  return node;
+}
+
+// Returns null for unions and structs with overlapping fields.
+llvm::MDNode *TBAABuilder::getStructNode(StructDeclaration *sd) {
+  const auto it = structNodes.find(sd);
+  if (it != structNodes.end())
+    return it->second;
+
+  llvm::MDNode *node = nullptr;
+  if (!sd->isUnionDeclaration() && !hasOverlappingFields(sd)) {
+    std::vector<std::pair<llvm::MDNode *, uint64_t>> fields;
+    for (VarDeclaration *vd : sd->fields) {
+      if (vd->type->size() == 0)
+        continue;
+      fields.emplace_back(getFieldNode(vd->type), vd->offset);
+    }
+    const char *name = sd->type->deco ? sd->type->deco : sd->toPrettyChars();
+    node = builder.createTBAAStructTypeNode(name, fields);
+  }
+
+  structNodes[sd] = node;
+  return node;
+}
+
+llvm::MDNode *TBAABuilder::getFieldNode(Type *t) {
+  Type *tb = t->toBasetype();
+  if (tb->ty == Tstruct) {
+    if (auto node = getStructNode(static_cast<TypeStruct *>(tb)->sym))
+      return node;
+  } else if (auto node = getScalarNode(tb)) {
+    return node;
+  }
+  return getCharNode();
+}
+
+llvm::MDNode *TBAABuilder::getAccessTag(Type *t) {
+  if (!isEnabled())
+    return nullptr;
+  llvm::MDNode *node = getScalarNode(t);
+  if (!node)
+    return nullptr;
+  llvm::MDNode *&tag = scalarTags[node];
+  if (!tag)
+    tag = builder.createTBAAStructTagNode(node, node, 0);
+  return tag;
+}
+
+llvm::MDNode *TBAABuilder::getFieldAccessTag(AggregateDeclaration *ad,
+                                             VarDeclaration *field,
+                                             Type *accessType) {
+  if (!isEnabled())
+    return nullptr;
+  if (field->overlapped || ad->isUnionDeclaration())
+    return getMayAliasTag();
+
+  llvm::MDNode *access = getScalarNode(accessType);
+  if (!access)
+    return nullptr;
+  StructDeclaration *sd = ad->isStructDeclaration();
+  // Class fields at the same offset may belong to different classes of a
+  // hierarchy, so don't use struct-path tags for them.
+  llvm::MDNode *base =
+      sd && getScalarNode(field->type) == access ? getStructNode(sd) : nullptr;
+  if (!base)
+    return getAccessTag(accessType);
+  return builder.createTBAAStructTagNode(base, access, field->offset);
+}
+
+llvm::MDNode *TBAABuilder::getMayAliasTag() {
+  if (!isEnabled())
+    return nullptr;
+  llvm::MDNode *node = getCharNode();
+  llvm::MDNode *&tag = scalarTags[node];
+  if (!tag)
+    tag = builder.createTBAAStructTagNode(node, node, 0);
+  return tag;
+}
+
+void TBAABuilder::attach(llvm::Instruction *inst, llvm::MDNode *tag) {
+  if (tag)
+    inst->setMetadata(llvm::LLVMContext::MD_tbaa, tag);
+}
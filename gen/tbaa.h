@@ -0,0 +1,66 @@
+//===-- gen/tbaa.h - Type-based alias analysis metadata ---------*- C++ -*-===//
+//
+//                         LDC – the LLVM D compiler
+//
+// This file is distributed under the BSD-style LDC license. See the LICENSE
+// file for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Opt-in (-fstrict-aliasing) !tbaa metadata for loads and stores of D scalars.
+// The scalar types are grouped as loosely as D code tends to reinterpret them:
+// signed and unsigned integers (and characters) of the same size share a
+// node, all pointers and class references share one, and 1-byte types may
+// alias anything. Accesses to struct fields get struct-path tags, union
+// members and other overlapping fields may alias anything.
+//
+//===----------------------------------------------------------------------===//
+
+#pragma once
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/IR/MDBuilder.h"
+
+class AggregateDeclaration;
+class StructDeclaration;
+class Type;
+class VarDeclaration;
+namespace llvm {
+class Instruction;
+class LLVMContext;
+class MDNode;
+}
+
+// TBAA type trees and access tags, tied to an LLVM module.
+class TBAABuilder {
+public:
+  explicit TBAABuilder(llvm::LLVMContext &context) : builder(context) {}
+
+  /// Returns the access tag for a load/store of a value of (scalar) type `t`,
+  /// or null if TBAA is disabled or the access may alias anything.
+  llvm::MDNode *getAccessTag(Type *t);
+
+  /// Returns the struct-path access tag for a load/store of `field` of `ad`
+  /// as a value of type `accessType`, or null.
+  llvm::MDNode *getFieldAccessTag(AggregateDeclaration *ad,
+                                  VarDeclaration *field, Type *accessType);
+
+  /// Returns an access tag aliasing all others (e.g., for reinterpreted
+  /// pointers), or null if TBAA is disabled.
+  llvm::MDNode *getMayAliasTag();
+
+  /// Attaches `tag` (if non-null) to a load or store.
+  static void attach(llvm::Instruction *inst, llvm::MDNode *tag);
+
+private:
+  llvm::MDBuilder builder;
+  llvm::MDNode *charNode = nullptr; // the child of the root aliasing all
+  llvm::DenseMap<const char *, llvm::MDNode *> scalarNodes;
+  llvm::DenseMap<StructDeclaration *, llvm::MDNode *> structNodes;
+  llvm::DenseMap<llvm::MDNode *, llvm::MDNode *> scalarTags;
+
+  llvm::MDNode *getCharNode();
+  llvm::MDNode *getScalarNode(Type *t);
+  llvm::MDNode *getStructNode(StructDeclaration *sd);
+  llvm::MDNode *getFieldNode(Type *t);
+};
@@ -15,6 +15,8 @@
 #include "dmd/target.h"
 #include "gen/abi.h"
 #include "gen/classes.h"
+#include "gen/coroutines.h"
+#include "gen/dcompute/druntime.h"
 #include "gen/dvalue.h"
 #include "gen/funcgenstate.h"
 #include "gen/functions.h"
@@ -271,6 +273,41 @@ static LLValue *getTypeinfoArrayArgumentForDVarArg(Expressions *argexps,
 
 ////////////////////////////////////////////////////////////////////////////////
 
+namespace {
+// Returns the raw (address-space qualified) pointer of a pointer or
+// ldc.dcompute.Pointer argument.
+LLValue *getDComputeRawPointer(IRState *p, Expression *exp) {
+  LLValue *ptr = DtoRVal(exp);
+  if (ptr->getType()->isStructTy()) { // { T addrspace(n)* }
+    ptr = p->ir->CreateExtractValue(ptr, 0);
+  }
+  if (!ptr->getType()->isPointerTy()) {
+    exp->error("pointer expected instead of `%s`", exp->type->toChars());
+    fatal();
+  }
+  return ptr;
+}
+
+// Returns the compile-time alignment of a vload/vstore, defaulting to the
+// natural alignment of the vector type.
+unsigned getDComputeVectorAlignment(CallExp *e, size_t index, Type *vecType) {
+  if (vecType->toBasetype()->ty != Tvector) {
+    e->error("vector type expected instead of `%s`", vecType->toChars());
+    fatal();
+  }
+  if (e->arguments->dim <= index) {
+    return static_cast<unsigned>(vecType->size());
+  }
+  const dinteger_t alignment = (*e->arguments)[index]->toInteger();
+  if (alignment == 0 || (alignment & (alignment - 1)) != 0) {
+    e->error("alignment must be a power of 2, not %llu",
+             static_cast<unsigned long long>(alignment));
+    fatal();
+  }
+  return static_cast<unsigned>(alignment);
+}
+}
+
 bool DtoLowerMagicIntrinsic(IRState *p, FuncDeclaration *fndecl, CallExp *e,
                             DValue *&result) {
   // va_start instruction
@@ -365,6 +402,18 @@ bool DtoLowerMagicIntrinsic(IRState *p, FuncDeclaration *fndecl, CallExp *e,
     return true;
   }
 
+  // generator yield
+  if (fndecl->llvmInternal == LLVMyield) {
+    if (e->arguments->dim != 1) {
+      e->error("`yield` expects 1 argument");
+      fatal();
+    }
+    Expression *exp = (*e->arguments)[0];
+    coroutines::emitYield(p->funcGen(), e->loc, exp->type, toElem(exp));
+    result = nullptr;
+    return true;
+  }
+
   // atomic store instruction
   if (fndecl->llvmInternal == LLVMatomic_store) {
     if (e->arguments->dim != 3) {
@@ -644,6 +693,85 @@ bool DtoLowerMagicIntrinsic(IRState *p, FuncDeclaration *fndecl, CallExp *e,
     return true;
   }
 
+  // V vload(V, P)(P ptr, uint alignment = V.sizeof)
+  if (fndecl->llvmInternal == LLVMdcompute_vload) {
+    if (e->arguments->dim < 1 || e->arguments->dim > 2) {
+      e->error("`dcompute.vload` intrinsic expects 1 (or 2) arguments");
+      fatal();
+    }
+    const unsigned alignment = getDComputeVectorAlignment(e, 1, e->type);
+    LLValue *ptr = getDComputeRawPointer(p, (*e->arguments)[0]);
+    ptr = DtoBitCast(ptr, DtoType(e->type)->getPointerTo(
+                              ptr->getType()->getPointerAddressSpace()));
+    llvm::LoadInst *load = p->ir->CreateLoad(ptr);
+    load->setAlignment(alignment);
+    result = new DImValue(e->type, load);
+    return true;
+  }
+
+  // void vstore(P, V)(P ptr, V value, uint alignment = V.sizeof)
+  if (fndecl->llvmInternal == LLVMdcompute_vstore) {
+    if (e->arguments->dim < 2 || e->arguments->dim > 3) {
+      e->error("`dcompute.vstore` intrinsic expects 2 (or 3) arguments");
+      fatal();
+    }
+    Expression *exp2 = (*e->arguments)[1];
+    const unsigned alignment = getDComputeVectorAlignment(e, 2, exp2->type);
+    LLValue *ptr = getDComputeRawPointer(p, (*e->arguments)[0]);
+    LLValue *val = DtoRVal(exp2);
+    ptr = DtoBitCast(ptr, val->getType()->getPointerTo(
+                              ptr->getType()->getPointerAddressSpace()));
+    llvm::StoreInst *store = p->ir->CreateStore(val, ptr);
+    store->setAlignment(alignment);
+    return true;
+  }
+
+  // SharedPointer!T sharedArray(T)(size_t length)
+  // Each call site refers to its own statically allocated array in the
+  // target's shared (work-group local) address space.
+  if (fndecl->llvmInternal == LLVMdcompute_shared) {
+    if (e->arguments->dim != 1) {
+      e->error("`dcompute.shared` intrinsic expects 1 argument");
+      fatal();
+    }
+    if (!p->dcomputetarget) {
+      e->error("`dcompute.shared` can only be used in `@compute` code");
+      fatal();
+    }
+    Type *retType = e->type->toBasetype();
+    llvm::Optional<DcomputePointer> dptr;
+    if (retType->ty == Tstruct) {
+      dptr = toDcomputePointer(static_cast<TypeStruct *>(retType)->sym);
+    }
+    if (!dptr || dptr->addrspace != 2) { // AddrSpace.Shared
+      e->error("`dcompute.shared` must return a `SharedPointer`, not `%s`",
+               e->type->toChars());
+      fatal();
+    }
+    const dinteger_t length = (*e->arguments)[0]->toInteger();
+    if (length == 0) {
+      e->error("shared array length must be a positive constant");
+      fatal();
+    }
+
+    LLType *elemType = DtoMemType(dptr->type);
+    auto arrayType = llvm::ArrayType::get(elemType, length);
+    auto gvar = new llvm::GlobalVariable(
+        p->module, arrayType, false, llvm::GlobalValue::InternalLinkage,
+        llvm::UndefValue::get(arrayType),
+        p->topfunc()->getName() + ".shared", nullptr,
+        llvm::GlobalValue::NotThreadLocal,
+        p->dcomputetarget->mapping[dptr->addrspace]);
+    // Allow aligned vector loads/stores on the first elements.
+    gvar->setAlignment(std::max(DtoAlignment(dptr->type), 16u));
+
+    LLValue *ptr = DtoGEPi(gvar, 0, 0);
+    LLValue *val = llvm::UndefValue::get(DtoType(e->type));
+    val = p->ir->CreateInsertValue(val, ptr, 0);
+    result = new DImValue(e->type, val);
+    return true;
+  }
+
   return false;
 }
 
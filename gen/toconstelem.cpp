@@ -178,7 +178,7 @@ public:
     }
 
     auto stringLiteralCache = stringLiteralCacheForType(cty);
-    llvm::StringRef key(e->toChars());
+    const llvm::StringRef key = stringLiteralCacheKey(e);
     llvm::GlobalVariable *gvar =
         (stringLiteralCache->find(key) == stringLiteralCache->end())
             ? nullptr
@@ -30,6 +30,7 @@
 #include "gen/dvalue.h"
 #include "gen/functions.h"
 #include "gen/funcgenstate.h"
+#include "gen/gcallocsites.h"
 #include "gen/inlineir.h"
 #include "gen/irstate.h"
 #include "gen/llvm.h"
@@ -42,6 +43,7 @@
 #include "gen/runtime.h"
 #include "gen/scope_exit.h"
 #include "gen/structs.h"
+#include "gen/tbaa.h"
 #include "gen/tollvm.h"
 #include "gen/typinf.h"
 #include "gen/warnings.h"
@@ -202,6 +204,31 @@ static Expression *skipOverCasts(Expression *e) {
   return e;
 }
 
+// Immutable heap data can't be modified after its construction, so tell
+// LLVM about it when optimizing.
+static void emitInvariantStart(Type *newtype, LLValue *mem) {
+  if (!newtype->isImmutable() || !isOptimizationEnabled())
+    return;
+  const uint64_t size = getTypeAllocSize(DtoMemType(newtype));
+  if (size != 0) {
+    gIR->ir->CreateInvariantStart(
+        mem, llvm::ConstantInt::get(LLType::getInt64Ty(gIR->context()), size));
+  }
+}
+
+// Whether a pointer has been cast from a pointer to another type (or from a
+// non-pointer), as in `*cast(uint*)&f`.
+static bool isReinterpretedPointer(Expression *e) {
+  if (e->op != TOKcast)
+    return false;
+  Type *from = skipOverCasts(e)->type->toBasetype();
+  if (from->ty != Tpointer)
+    return true;
+  Type *l = stripModifiers(from->nextOf()->toBasetype(), true);
+  Type *r = stripModifiers(e->type->toBasetype()->nextOf()->toBasetype(), true);
+  return !l->equals(r);
+}
+
 DValue *toElem(Expression *e, bool doSkipOverCasts) {
   Expression *inner = skipOverCasts(e);
   if (!doSkipOverCasts || inner == e)
@@ -383,7 +410,7 @@ public:
     LLConstant *_init = buildStringLiteralConstant(e, true);
     const auto at = _init->getType();
 
-    llvm::StringRef key(e->toChars());
+    const llvm::StringRef key = stringLiteralCacheKey(e);
     llvm::GlobalVariable *gvar =
         (stringLiteralCache->find(key) == stringLiteralCache->end())
             ? nullptr
@@ -691,6 +718,13 @@ public:
         if (fd->llvmInternal == LLVMinline_ir) {
           return DtoInlineIRExpr(e->loc, fd, e->arguments, sretPointer);
         }
+        if (DValue *result = DtoArrayOp(e->loc, e->type, fd, e->arguments)) {
+          return result;
+        }
+        if (DValue *result =
+                DtoInlineStringApply(e->loc, e->type, fd, e->arguments)) {
+          return result;
+        }
       }
     }
 
@@ -774,7 +808,19 @@ public:
     return result;
   }
 
-  void visit(CallExp *e) override { result = call(p, e); }
+  void visit(CallExp *e) override {
+    if (auto movedFrom = p->funcGen().elidedPostblits.lookup(e)) {
+      IF_LOG Logger::print("CallExp::toElem: elided postblit %s\n",
+                           e->toChars());
+      LOG_SCOPE;
+      // last-use move (see gen/moveelision.h): only blit
+      toElem(static_cast<DotVarExp *>(e->e1)->e1);
+      DtoStore(DtoConstBool(true), movedFrom);
+      result = nullptr;
+      return;
+    }
+    result = call(p, e);
+  }
 
   //////////////////////////////////////////////////////////////////////////////
 
@@ -939,7 +985,10 @@ public:
     // get the rvalue and return it as an lvalue
     LLValue *V = DtoRVal(e->e1);
 
-    result = new DLValue(e->type, DtoBitCast(V, DtoPtrToType(e->type)));
+    result = new DLValue(e->type, DtoBitCast(V, DtoPtrToType(e->type)),
+                         isReinterpretedPointer(e->e1)
+                             ? gIR->tbaa.getMayAliasTag()
+                             : nullptr);
   }
 
   //////////////////////////////////////////////////////////////////////////////
@@ -960,28 +1009,33 @@ public:
     // Logger::cout() << *DtoType(e1type) << '\n';
 
     if (VarDeclaration *vd = e->var->isVarDeclaration()) {
+      AggregateDeclaration *ad;
       LLValue *arrptr;
       // indexing struct pointer
       if (e1type->ty == Tpointer) {
         assert(e1type->nextOf()->ty == Tstruct);
         TypeStruct *ts = static_cast<TypeStruct *>(e1type->nextOf());
+        ad = ts->sym;
         arrptr = DtoIndexAggregate(DtoRVal(l), ts->sym, vd);
       }
       // indexing normal struct
       else if (e1type->ty == Tstruct) {
         TypeStruct *ts = static_cast<TypeStruct *>(e1type);
+        ad = ts->sym;
         arrptr = DtoIndexAggregate(DtoLVal(l), ts->sym, vd);
       }
       // indexing class
       else if (e1type->ty == Tclass) {
         TypeClass *tc = static_cast<TypeClass *>(e1type);
+        ad = tc->sym;
         arrptr = DtoIndexAggregate(DtoRVal(l), tc->sym, vd);
       } else {
         llvm_unreachable("Unknown DotVarExp type for VarDeclaration.");
       }
 
       // Logger::cout() << "mem: " << *arrptr << '\n';
-      result = new DLValue(e->type, DtoBitCast(arrptr, DtoPtrToType(e->type)));
+      result = new DLValue(e->type, DtoBitCast(arrptr, DtoPtrToType(e->type)),
+                           gIR->tbaa.getFieldAccessTag(ad, vd, e->type));
     } else if (FuncDeclaration *fdecl = e->var->isFuncDeclaration()) {
       DtoResolveFunction(fdecl);
 
@@ -1542,6 +1596,9 @@ public:
         }
       }
 
+      if (!e->allocator && !ts->sym->dtor)
+        emitInvariantStart(e->newtype, mem);
+
       result = new DImValue(e->type, mem);
     }
     // new basic type
@@ -1568,6 +1625,8 @@ public:
       if (!toInPlaceConstruction(&tmpvar, exp))
         DtoAssign(e->loc, &tmpvar, toElem(exp), TOKblit);
 
+      emitInvariantStart(e->newtype, mem);
+
       // return as pointer-to
       result = new DImValue(e->type, mem);
     }
@@ -1712,6 +1771,23 @@ public:
       if (sym->isInterfaceDeclaration() || sym->isCPPclass())
         return;
 
+      // For a final class, the dynamic type is known statically, so call the
+      // invariants along the base class chain directly, like druntime's
+      // _d_invariant() would.
+      if (sym->storage_class & STCfinal) {
+        Logger::println("calling final class invariants");
+        LLValue *obj = DtoRVal(cond);
+        for (ClassDeclaration *c = sym; c; c = c->baseClass) {
+          if (FuncDeclaration *invDecl = c->inv) {
+            DtoResolveFunction(invDecl);
+            DFuncValue invFunc(invDecl, DtoCallee(invDecl),
+                               DtoBitCast(obj, DtoType(c->type)));
+            DtoCallFunction(e->loc, nullptr, &invFunc, nullptr);
+          }
+        }
+        return;
+      }
+
       Logger::println("calling class invariant");
 
       const auto fnMangle =
@@ -2463,9 +2539,36 @@ public:
       slice = DtoConstSlice(DtoConstSize_t(e->keys->dim), slice);
       LLValue *valuesArray = DtoAggrPaint(slice, funcTy->getParamType(2));
 
+      // A const or immutable AA can't be mutated after its construction, so
+      // the literal is only constructed once per thread and cached in a
+      // thread-local global.
+      llvm::GlobalVariable *cache = nullptr;
+      llvm::BasicBlock *endbb = nullptr;
+      LLType *aaType = funcTy->getReturnType();
+      if (basetype->isConst() || basetype->isImmutable()) {
+        cache = new llvm::GlobalVariable(
+            gIR->module, aaType, false, LLGlobalValue::InternalLinkage,
+            LLConstant::getNullValue(aaType), ".aaLiteralCache", nullptr,
+            getThreadLocalModel());
+        llvm::BasicBlock *constructbb = p->insertBB("aaliteral.construct");
+        endbb = p->insertBBAfter(constructbb, "aaliteral.end");
+        LLValue *isConstructed =
+            p->ir->CreateIsNotNull(DtoLoad(cache, "aaliteral.cached"));
+        p->ir->CreateCondBr(isConstructed, endbb, constructbb);
+        p->scope() = IRScope(constructbb);
+      }
+
+      emitGCAllocSiteHook(e->loc, func);
       LLValue *aa = gIR->CreateCallOrInvoke(func, aaTypeInfo, keysArray,
                                             valuesArray, "aa")
                         .getInstruction();
+
+      if (cache) {
+        DtoStore(aa, cache);
+        llvm::BranchInst::Create(endbb, p->scopebb());
+        p->scope() = IRScope(endbb);
+        aa = DtoLoad(cache, "aa");
+      }
       if (basetype->ty != Taarray) {
         LLValue *tmp = DtoAlloca(e->type, "aaliteral");
         DtoStore(aa, DtoGEPi(tmp, 0, 0));
@@ -2717,6 +2820,58 @@ bool toInPlaceConstruction(DLValue *lhs, Expression *rhs) {
       rhs = castSource;
   }
 
+  // `(e1, e2)`: evaluate e1 and construct e2 in-place
+  if (rhs->op == TOKcomma) {
+    auto ce = static_cast<CommaExp *>(rhs);
+    if (!basetypesAreEqualWithoutModifiers(lhs->type, ce->e2->type))
+      return false;
+    toElem(ce->e1);
+    if (!toInPlaceConstruction(lhs, ce->e2))
+      DtoAssign(ce->loc, lhs, toElem(ce->e2), TOKblit);
+    return true;
+  }
+
+  // `cond ? e1 : e2`: construct the respective branch in-place, instead of
+  // materializing it in a temporary and copying that.
+  // Lvalue conditionals are left alone, as the caller then takes care of the
+  // postblit for the copy.
+  if (rhs->op == TOKquestion && !rhs->isLvalue()) {
+    auto ce = static_cast<CondExp *>(rhs);
+    if (!basetypesAreEqualWithoutModifiers(lhs->type, ce->e1->type) ||
+        !basetypesAreEqualWithoutModifiers(lhs->type, ce->e2->type)) {
+      return false;
+    }
+
+    auto &PGO = gIR->funcGen().pgo;
+    PGO.setCurrentStmt(ce);
+
+    llvm::BasicBlock *condtrue = gIR->insertBB("condtrue");
+    llvm::BasicBlock *condfalse = gIR->insertBBAfter(condtrue, "condfalse");
+    llvm::BasicBlock *condend = gIR->insertBBAfter(condfalse, "condend");
+
+    DValue *c = toElem(ce->econd);
+    LLValue *cond_val = DtoRVal(DtoCast(ce->loc, c, Type::tbool));
+
+    auto truecount = PGO.getRegionCount(ce);
+    auto falsecount = PGO.getCurrentRegionCount() - truecount;
+    auto branchweights = PGO.createProfileWeights(truecount, falsecount);
+    gIR->ir->CreateCondBr(cond_val, condtrue, condfalse, branchweights);
+
+    gIR->scope() = IRScope(condtrue);
+    PGO.emitCounterIncrement(ce);
+    if (!toInPlaceConstruction(lhs, ce->e1))
+      DtoAssign(ce->loc, lhs, toElem(ce->e1), TOKblit);
+    llvm::BranchInst::Create(condend, gIR->scopebb());
+
+    gIR->scope() = IRScope(condfalse);
+    if (!toInPlaceConstruction(lhs, ce->e2))
+      DtoAssign(ce->loc, lhs, toElem(ce->e2), TOKblit);
+    llvm::BranchInst::Create(condend, gIR->scopebb());
+
+    gIR->scope() = IRScope(condend);
+    return true;
+  }
+
   if (rhs->op == TOKcall) {
     auto ce = static_cast<CallExp *>(rhs);
 
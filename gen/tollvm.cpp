@@ -21,6 +21,7 @@
 #include "gen/classes.h"
 #include "gen/complex.h"
 #include "gen/dvalue.h"
+#include "gen/funcgenstate.h"
 #include "gen/functions.h"
 #include "gen/irstate.h"
 #include "gen/linkage.h"
@@ -316,12 +317,21 @@ LLConstant *DtoGEPi(LLConstant *ptr, unsigned i0, unsigned i1) {
 
 ////////////////////////////////////////////////////////////////////////////////
 
+// PGO: Insert instrumentation or attach profile metadata for the size of a
+// memory operation.
+static void emitMemOpSizePGO(llvm::Instruction *memOp, LLValue *nbytes) {
+  if (!gIR->funcGenStates.empty())
+    gIR->funcGen().pgo.emitMemOpSizePGO(memOp, nbytes);
+}
+
 void DtoMemSet(LLValue *dst, LLValue *val, LLValue *nbytes, unsigned align) {
   LLType *VoidPtrTy = getVoidPtrType();
 
   dst = DtoBitCast(dst, VoidPtrTy);
 
-  gIR->ir->CreateMemSet(dst, val, nbytes, align, false /*isVolatile*/);
+  auto call =
+      gIR->ir->CreateMemSet(dst, val, nbytes, align, false /*isVolatile*/);
+  emitMemOpSizePGO(call, nbytes);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -344,10 +354,13 @@ void DtoMemCpy(LLValue *dst, LLValue *src, LLValue *nbytes, unsigned align) {
   src = DtoBitCast(src, VoidPtrTy);
 
 #if LDC_LLVM_VER >= 700
-  gIR->ir->CreateMemCpy(dst, align, src, align, nbytes, false /*isVolatile*/);
+  auto call = gIR->ir->CreateMemCpy(dst, align, src, align, nbytes,
+                                    false /*isVolatile*/);
 #else
-  gIR->ir->CreateMemCpy(dst, src, nbytes, align, false /*isVolatile*/);
+  auto call =
+      gIR->ir->CreateMemCpy(dst, src, nbytes, align, false /*isVolatile*/);
 #endif
+  emitMemOpSizePGO(call, nbytes);
 }
 
 void DtoMemCpy(LLValue *dst, LLValue *src, bool withPadding, unsigned align) {
@@ -375,7 +388,9 @@ LLValue *DtoMemCmp(LLValue *lhs, LLValue *rhs, LLValue *nbytes) {
   lhs = DtoBitCast(lhs, VoidPtrTy);
   rhs = DtoBitCast(rhs, VoidPtrTy);
 
-  return gIR->ir->CreateCall(fn, {lhs, rhs, nbytes});
+  auto call = gIR->ir->CreateCall(fn, {lhs, rhs, nbytes});
+  emitMemOpSizePGO(call, nbytes);
+  return call;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -458,16 +473,27 @@ LLValue *DtoAlignedLoad(LLValue *src, const char *name) {
   return ld;
 }
 
+// Like DtoAlignedLoad, but for memory never written to while it's
+// dereferenceable (e.g., vtables), so that LLVM can hoist the load across
+// calls.
+LLValue *DtoInvariantLoad(LLValue *src, const char *name) {
+  llvm::LoadInst *ld = gIR->ir->CreateLoad(src, name);
+  ld->setAlignment(getABITypeAlign(ld->getType()));
+  ld->setMetadata(llvm::LLVMContext::MD_invariant_load,
+                  llvm::MDNode::get(gIR->context(), llvm::None));
+  return ld;
+}
+
 LLValue *DtoVolatileLoad(LLValue *src, const char *name) {
   llvm::LoadInst *ld = gIR->ir->CreateLoad(src, name);
   ld->setVolatile(true);
   return ld;
 }
 
-void DtoStore(LLValue *src, LLValue *dst) {
+llvm::StoreInst *DtoStore(LLValue *src, LLValue *dst) {
   assert(src->getType() != llvm::Type::getInt1Ty(gIR->context()) &&
          "Should store bools as i8 instead of i1.");
-  gIR->ir->CreateStore(src, dst);
+  return gIR->ir->CreateStore(src, dst);
 }
 
 void DtoVolatileStore(LLValue *src, LLValue *dst) {
@@ -476,13 +502,13 @@ void DtoVolatileStore(LLValue *src, LLValue *dst) {
   gIR->ir->CreateStore(src, dst)->setVolatile(true);
 }
 
-void DtoStoreZextI8(LLValue *src, LLValue *dst) {
+llvm::StoreInst *DtoStoreZextI8(LLValue *src, LLValue *dst) {
   if (src->getType() == llvm::Type::getInt1Ty(gIR->context())) {
     llvm::Type *i8 = llvm::Type::getInt8Ty(gIR->context());
     assert(dst->getType()->getContainedType(0) == i8);
     src = gIR->ir->CreateZExt(src, i8);
   }
-  gIR->ir->CreateStore(src, dst);
+  return gIR->ir->CreateStore(src, dst);
 }
 
 // Like DtoStore, but the pointer is guaranteed to be aligned appropriately for
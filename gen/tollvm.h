@@ -104,9 +104,10 @@ LLConstant *DtoConstBool(bool);
 LLValue *DtoLoad(LLValue *src, const char *name = "");
 LLValue *DtoVolatileLoad(LLValue *src, const char *name = "");
 LLValue *DtoAlignedLoad(LLValue *src, const char *name = "");
-void DtoStore(LLValue *src, LLValue *dst);
+LLValue *DtoInvariantLoad(LLValue *src, const char *name = "");
+llvm::StoreInst *DtoStore(LLValue *src, LLValue *dst);
 void DtoVolatileStore(LLValue *src, LLValue *dst);
-void DtoStoreZextI8(LLValue *src, LLValue *dst);
+llvm::StoreInst *DtoStoreZextI8(LLValue *src, LLValue *dst);
 void DtoAlignedStore(LLValue *src, LLValue *dst);
 LLValue *DtoBitCast(LLValue *v, LLType *t, const llvm::Twine &name = "");
 LLConstant *DtoBitCast(LLConstant *v, LLType *t);
@@ -23,6 +23,13 @@
 #include "gen/tollvm.h"
 #include "ir/irfunction.h"
 #include "ir/irtypeclass.h"
+#include "llvm/Support/CommandLine.h"
+
+static llvm::cl::opt<unsigned> cleanupCopyThreshold(
+    "cleanup-copy-threshold", llvm::cl::ZeroOrMore, llvm::cl::Hidden,
+    llvm::cl::init(32),
+    llvm::cl::desc("MSVC EH: Share (instead of copy) cleanups with more "
+                   "instructions than this between normal exits"));
 
 ////////////////////////////////////////////////////////////////////////////////
 
@@ -72,7 +79,9 @@ void TryCatchScope::emitCatchBodies(IRState &irs, llvm::Value *ehPtrSlot) {
 
   for (auto c : *stmt->catches) {
     auto catchBB =
-        irs.insertBBBefore(endbb, llvm::Twine("catch.") + c->type->toChars());
+        irs.insertBBBefore(endbb, llvm::Twine("catch.") +
+                                      (irs.keepsValueNames() ? c->type->toChars()
+                                                             : ""));
     irs.scope() = IRScope(catchBB);
     irs.DBuilder.EmitBlockStart(c->loc);
     PGO.emitCounterIncrement(c);
@@ -299,7 +308,9 @@ void TryCatchScope::emitCatchBodiesMSVC(IRState &irs, llvm::Value *) {
 
   for (auto c : *stmt->catches) {
     auto catchBB =
-        irs.insertBBBefore(endbb, llvm::Twine("catch.") + c->type->toChars());
+        irs.insertBBBefore(endbb, llvm::Twine("catch.") +
+                                      (irs.keepsValueNames() ? c->type->toChars()
+                                                             : ""));
 
     irs.scope() = IRScope(catchBB);
     irs.DBuilder.EmitBlockStart(c->loc);
@@ -426,6 +437,17 @@ llvm::BasicBlock *CleanupScope::run(IRState &irs, llvm::BasicBlock *sourceBlock,
   return beginBlock();
 }
 
+namespace {
+void storeBranchSelector(llvm::Value *value, llvm::AllocaInst *branchSelector,
+                         llvm::BasicBlock *bb) {
+  // The source block might not be terminated yet.
+  if (auto term = bb->getTerminator())
+    new llvm::StoreInst(value, branchSelector, term);
+  else
+    new llvm::StoreInst(value, branchSelector, bb);
+}
+}
+
 llvm::BasicBlock *CleanupScope::runCopying(IRState &irs,
                                            llvm::BasicBlock *sourceBlock,
                                            llvm::BasicBlock *continueWith,
@@ -441,13 +463,22 @@ llvm::BasicBlock *CleanupScope::runCopying(IRState &irs,
     // check whether we have an exit target with the same continuation
     for (CleanupExitTarget &tgt : exitTargets)
       if (tgt.branchTarget == continueWith) {
+        if (branchSelector && tgt.cleanupBlocks.front() == beginBlock()) {
+          // a shared exit, select the target via the switch case (or the
+          // default)
+          auto sw = llvm::cast<llvm::SwitchInst>(endBlock()->getTerminator());
+          llvm::ConstantInt *selectorVal = sw->findCaseDest(continueWith);
+          storeBranchSelector(selectorVal ? selectorVal : DtoConstUint(0),
+                              branchSelector, sourceBlock);
+        }
         tgt.sourceBlocks.push_back(sourceBlock);
         return tgt.cleanupBlocks.front();
       }
   }
 
   // reuse the original IR if not unwinding and not already used
-  bool useOriginal = unwindTo == nullptr && funclet == nullptr;
+  const bool isNormalExit = unwindTo == nullptr && funclet == nullptr;
+  bool useOriginal = isNormalExit;
   for (CleanupExitTarget &tgt : exitTargets) {
     if (tgt.cleanupBlocks.front() == beginBlock()) {
       useOriginal = false;
@@ -455,6 +486,15 @@ llvm::BasicBlock *CleanupScope::runCopying(IRState &irs,
     }
   }
 
+  // share the original IR between normal exits if copying it is too costly
+  if (isNormalExit && !useOriginal) {
+    size_t numInstructions = 0;
+    for (auto bb : blocks)
+      numInstructions += bb->size();
+    if (branchSelector || numInstructions > cleanupCopyThreshold)
+      return runShared(irs, sourceBlock, continueWith);
+  }
+
   // append new target
   exitTargets.emplace_back(continueWith);
   auto &exitTarget = exitTargets.back();
@@ -471,12 +511,64 @@ llvm::BasicBlock *CleanupScope::runCopying(IRState &irs,
     exitTarget.cleanupBlocks = blocks;
   } else {
     // clone the code
-    cloneBlocks(blocks, exitTarget.cleanupBlocks, continueWith, unwindTo,
-                funclet);
+    cloneBlocks(templateBlocks.empty() ? blocks : templateBlocks,
+                exitTarget.cleanupBlocks, continueWith, unwindTo, funclet);
   }
   return exitTarget.cleanupBlocks.front();
 }
 
+llvm::BasicBlock *CleanupScope::runShared(IRState &irs,
+                                          llvm::BasicBlock *sourceBlock,
+                                          llvm::BasicBlock *continueWith) {
+  if (!branchSelector) {
+    // Keep a pristine copy as source for the funclet copies, as the original
+    // is going to end with a switch.
+    cloneBlocks(blocks, templateBlocks, nullptr, nullptr, nullptr);
+
+    branchSelector = new llvm::AllocaInst(llvm::Type::getInt32Ty(irs.context()),
+#if LDC_LLVM_VER >= 500
+                                          irs.module.getDataLayout().getAllocaAddrSpace(),
+#endif
+                                          llvm::Twine("branchsel.") +
+                                              beginBlock()->getName(),
+                                          irs.topallocapoint());
+
+    // The paths already using the original continue with the default target.
+    llvm::BasicBlock *originalTarget = nullptr;
+    for (CleanupExitTarget &tgt : exitTargets) {
+      if (tgt.cleanupBlocks.front() == beginBlock()) {
+        originalTarget = tgt.branchTarget;
+        for (auto bb : tgt.sourceBlocks)
+          storeBranchSelector(DtoConstUint(0), branchSelector, bb);
+        break;
+      }
+    }
+    assert(originalTarget);
+
+    endBlock()->getTerminator()->eraseFromParent();
+    llvm::Value *sel = new llvm::LoadInst(branchSelector, "", endBlock());
+    llvm::SwitchInst::Create(sel, originalTarget, 1, endBlock());
+  }
+
+  auto sw = llvm::cast<llvm::SwitchInst>(endBlock()->getTerminator());
+  llvm::ConstantInt *const selectorVal = DtoConstUint(sw->getNumCases() + 1);
+  sw->addCase(selectorVal, continueWith);
+  storeBranchSelector(selectorVal, branchSelector, sourceBlock);
+
+  exitTargets.emplace_back(continueWith);
+  exitTargets.back().sourceBlocks.push_back(sourceBlock);
+  exitTargets.back().cleanupBlocks = blocks;
+  return beginBlock();
+}
+
+void CleanupScope::eraseTemplateBlocks() {
+  for (auto bb : templateBlocks)
+    bb->dropAllReferences();
+  for (auto bb : templateBlocks)
+    bb->eraseFromParent();
+  templateBlocks.clear();
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 
 TryCatchFinallyScopes::TryCatchFinallyScopes(IRState &irs) : irs(irs) {
@@ -506,8 +598,10 @@ void TryCatchFinallyScopes::pushTryCatch(TryCatchStatement *stmt,
   // catches.
   tryCatchScopes.push_back(scope);
 
-  if (!useMSVCEH())
+  if (!useMSVCEH()) {
+    catchDispatchBlocks.push_back(nullptr);
     landingPadsPerCleanupScope[currentCleanupScope()].push_back(nullptr);
+  }
 }
 
 void TryCatchFinallyScopes::popTryCatch() {
@@ -516,6 +610,7 @@ void TryCatchFinallyScopes::popTryCatch() {
     assert(isCatchSwitchBlock(cleanupScopes.back().beginBlock()));
     popCleanups(currentCleanupScope() - 1);
   } else {
+    catchDispatchBlocks.pop_back();
     landingPadsPerCleanupScope[currentCleanupScope()].pop_back();
   }
 }
@@ -567,6 +662,7 @@ void TryCatchFinallyScopes::popCleanups(CleanupCursor targetScope) {
                           currentUnresolvedGotos().begin(),
                           currentUnresolvedGotos().end());
 
+    cleanupScopes.back().eraseTemplateBlocks();
     cleanupScopes.pop_back();
     unresolvedGotosPerCleanupScope.pop_back();
     landingPadsPerCleanupScope.pop_back();
@@ -714,65 +810,86 @@ llvm::BasicBlock *TryCatchFinallyScopes::emitLandingPad() {
     ehSelectorSlot = DtoRawAlloca(ehSelector->getType(), 0, "eh.selector");
   irs.ir->CreateStore(ehSelector, ehSelectorSlot);
 
-  // Add landingpad clauses, emit finallys and 'if' chain to catch the
-  // exception.
-  CleanupCursor lastCleanup = currentCleanupScope();
+  // Add the ClassInfo references of all active catches to the landingpad
+  // instruction so they are emitted to the EH tables.
   for (auto it = tryCatchScopes.rbegin(), end = tryCatchScopes.rend();
        it != end; ++it) {
-    const auto &tryCatchScope = *it;
-
-    // Insert any cleanups in between the previous (inner-more) try-catch scope
-    // and this one.
-    const auto newCleanup = tryCatchScope.getCleanupScope();
-    assert(lastCleanup >= newCleanup);
-    if (lastCleanup > newCleanup) {
-      landingPad->setCleanup(true);
-      llvm::BasicBlock *afterCleanupBB =
-          irs.insertBB(beginBB->getName() + llvm::Twine(".after.cleanup"));
-      runCleanups(lastCleanup, newCleanup, afterCleanupBB);
-      irs.scope() = IRScope(afterCleanupBB);
-      lastCleanup = newCleanup;
-    }
-
-    for (const auto &cb : tryCatchScope.getCatchBlocks()) {
-      // Add the ClassInfo reference to the landingpad instruction so it is
-      // emitted to the EH tables.
+    for (const auto &cb : it->getCatchBlocks())
       landingPad->addClause(cb.classInfoPtr);
-
-      llvm::BasicBlock *mismatchBB =
-          irs.insertBB(beginBB->getName() + llvm::Twine(".mismatch"));
-
-      // "Call" llvm.eh.typeid.for, which gives us the eh selector value to
-      // compare the landing pad selector value with.
-      llvm::Value *ehTypeId =
-          irs.ir->CreateCall(GET_INTRINSIC_DECL(eh_typeid_for),
-                             DtoBitCast(cb.classInfoPtr, getVoidPtrType()));
-
-      // Compare the selector value from the unwinder against the expected
-      // one and branch accordingly.
-      irs.ir->CreateCondBr(
-          irs.ir->CreateICmpEQ(irs.ir->CreateLoad(ehSelectorSlot), ehTypeId),
-          cb.bodyBB, mismatchBB, cb.branchWeights);
-      irs.scope() = IRScope(mismatchBB);
-    }
   }
 
-  // No catch matched. Execute all finallys and resume unwinding.
-  auto resumeUnwindBlock = getOrCreateResumeUnwindBlock();
-  if (lastCleanup > 0) {
+  // Some cleanup is run on the way to the catches or unwind resumption if
+  // we are inside any cleanup scope.
+  if (currentCleanupScope() > 0)
     landingPad->setCleanup(true);
-    runCleanups(lastCleanup, 0, resumeUnwindBlock);
-  } else if (!tryCatchScopes.empty()) {
+
+  // Run the cleanups up to the innermost try-catch scope and continue with
+  // its (shared) catch dispatch, or run all of them and resume unwinding.
+  if (tryCatchScopes.empty()) {
+    runCleanups(currentCleanupScope(), 0, getOrCreateResumeUnwindBlock());
+  } else {
+    const size_t innermost = tryCatchScopes.size() - 1;
+    runCleanups(currentCleanupScope(),
+                tryCatchScopes[innermost].getCleanupScope(),
+                getOrCreateCatchDispatch(innermost));
+  }
+
+  irs.scope() = savedIRScope;
+  return beginBB;
+}
+
+llvm::BasicBlock *
+TryCatchFinallyScopes::getOrCreateCatchDispatch(size_t tryCatchScope) {
+  llvm::BasicBlock *&dispatchBB = catchDispatchBlocks[tryCatchScope];
+  if (dispatchBB)
+    return dispatchBB;
+
+  IRScope savedIRScope = irs.scope();
+
+  dispatchBB = irs.insertBBBefore(nullptr, "catch.dispatch");
+  irs.scope() = IRScope(dispatchBB);
+
+  // Emit the 'if' chain to catch the exception.
+  const auto &scope = tryCatchScopes[tryCatchScope];
+  for (const auto &cb : scope.getCatchBlocks()) {
+    llvm::BasicBlock *mismatchBB =
+        irs.insertBB(dispatchBB->getName() + llvm::Twine(".mismatch"));
+
+    // "Call" llvm.eh.typeid.for, which gives us the eh selector value to
+    // compare the landing pad selector value with.
+    llvm::Value *ehTypeId =
+        irs.ir->CreateCall(GET_INTRINSIC_DECL(eh_typeid_for),
+                           DtoBitCast(cb.classInfoPtr, getVoidPtrType()));
+
+    // Compare the selector value from the unwinder against the expected
+    // one and branch accordingly.
+    irs.ir->CreateCondBr(
+        irs.ir->CreateICmpEQ(irs.ir->CreateLoad(ehSelectorSlot), ehTypeId),
+        cb.bodyBB, mismatchBB, cb.branchWeights);
+    irs.scope() = IRScope(mismatchBB);
+  }
+
+  // No catch matched. Execute the finallys in between this and the next outer
+  // try-catch scope and continue with its dispatch, or execute all remaining
+  // finallys and resume unwinding.
+  const CleanupCursor cleanupScope = scope.getCleanupScope();
+  if (tryCatchScope > 0) {
+    llvm::BasicBlock *outerDispatchBB =
+        getOrCreateCatchDispatch(tryCatchScope - 1);
+    runCleanups(cleanupScope,
+                tryCatchScopes[tryCatchScope - 1].getCleanupScope(),
+                outerDispatchBB);
+  } else if (cleanupScope > 0) {
+    runCleanups(cleanupScope, 0, getOrCreateResumeUnwindBlock());
+  } else {
     // Directly convert the last mismatch branch into a branch to the
     // unwind resume block.
-    irs.scopebb()->replaceAllUsesWith(resumeUnwindBlock);
+    irs.scopebb()->replaceAllUsesWith(getOrCreateResumeUnwindBlock());
     irs.scopebb()->eraseFromParent();
-  } else {
-    irs.ir->CreateBr(resumeUnwindBlock);
   }
 
   irs.scope() = savedIRScope;
-  return beginBB;
+  return dispatchBB;
 }
 
 llvm::AllocaInst *TryCatchFinallyScopes::getOrCreateEhPtrSlot() {
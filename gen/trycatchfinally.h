@@ -101,7 +101,10 @@ public:
   /// MSVC uses C++ exception handling that puts cleanup blocks into funclets.
   /// This means that we cannot use a branch selector and conditional branches
   /// at cleanup exit to continue with different targets.
-  /// Instead we make a full copy of the cleanup code for every target.
+  /// Instead we make a copy of the cleanup code for every funclet. Normal
+  /// (non-unwinding) exits share the original code via a branch selector if
+  /// the cleanup is larger than the `-cleanup-copy-threshold` instruction
+  /// count, and get their own copy otherwise.
   llvm::BasicBlock *runCopying(IRState &irs, llvm::BasicBlock *sourceBlock,
                                llvm::BasicBlock *continueWith,
                                llvm::BasicBlock *unwindTo = nullptr,
@@ -110,9 +113,23 @@ public:
   llvm::BasicBlock *beginBlock() const { return blocks.front(); }
   llvm::BasicBlock *endBlock() const { return blocks.back(); }
 
+  /// MSVC: Erases the unreachable pristine copy of the cleanup code kept
+  /// around for cloning, once the scope is left.
+  void eraseTemplateBlocks();
+
 private:
   std::vector<llvm::BasicBlock *> blocks;
 
+  /// MSVC: An unmodified copy of the cleanup code, created when normal exits
+  /// start sharing the original blocks (whose terminator is then a switch on
+  /// the branch selector). Funclet copies are cloned from it.
+  std::vector<llvm::BasicBlock *> templateBlocks;
+
+  /// MSVC: Turns the original blocks into a shared cleanup for normal exits,
+  /// continuing with the given target.
+  llvm::BasicBlock *runShared(IRState &irs, llvm::BasicBlock *sourceBlock,
+                              llvm::BasicBlock *continueWith);
+
   /// The branch selector variable, or null if not created yet.
   llvm::AllocaInst *branchSelector = nullptr;
 
@@ -249,6 +266,13 @@ private:
 
   std::vector<TryCatchScope> tryCatchScopes;
 
+  /// catchDispatchBlocks[i] is the lazily emitted block comparing the
+  /// exception against the catches of tryCatchScopes[i], continuing with the
+  /// cleanups and dispatch of the next outer try/catch scope on mismatch.
+  /// All landing pads inside the try block jump there after their own
+  /// cleanups, so the compare chains are emitted only once (not for MSVC).
+  std::vector<llvm::BasicBlock *> catchDispatchBlocks;
+
   /// cleanupScopes[i] contains the information to go from
   /// currentCleanupScope() == i + 1 to currentCleanupScope() == i.
   std::vector<CleanupScope> cleanupScopes;
@@ -279,6 +303,10 @@ private:
   /// Emits a landing pad to honor all the active cleanups and catches.
   llvm::BasicBlock *emitLandingPad();
 
+  /// Returns the catch dispatch block for the specified try/catch scope,
+  /// lazily emitting it (and those of the outer scopes) as needed.
+  llvm::BasicBlock *getOrCreateCatchDispatch(size_t tryCatchScope);
+
   /// Internal version that allows specifying the scope at which to start
   /// emitting the cleanups.
   void runCleanups(CleanupCursor sourceScope, CleanupCursor targetScope,
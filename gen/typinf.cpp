@@ -36,6 +36,7 @@
 #include "dmd/mtype.h"
 #include "dmd/scope.h"
 #include "dmd/template.h"
+#include "driver/cl_options.h"
 #include "gen/arrays.h"
 #include "gen/classes.h"
 #include "gen/irstate.h"
@@ -52,6 +53,7 @@
 #include "ir/irtype.h"
 #include <ir/irtypeclass.h>
 #include "ir/irvar.h"
+#include "llvm/ADT/StringSet.h"
 #include <cassert>
 #include <cstdio>
 
@@ -101,6 +103,11 @@ static void emitTypeMetadata(TypeInfoDeclaration *tid) {
       mdVals[TD_TypeInfo] = llvm::ValueAsMetadata::get(getIrGlobal(tid)->value);
       mdVals[TD_Type] = llvm::ConstantAsMetadata::get(
           llvm::UndefValue::get(DtoType(tid->tinfo)));
+      const bool elemPostblit =
+          (t->ty == Tarray || t->ty == Tsarray) && arrayNeedsPostblit(t);
+      mdVals[TD_ElemPostblit] = llvm::ConstantAsMetadata::get(
+          LLConstantInt::get(llvm::Type::getInt1Ty(gIR->context()),
+                             elemPostblit));
 
       // Construct the metadata and insert it into the module.
       llvm::NamedMDNode *node = gIR->module.getOrInsertNamedMetadata(metaname);
@@ -455,15 +462,7 @@ public:
     }
 
     // immutable(void)* m_RTInfo
-    // The cases where getRTInfo is null are not quite here, but the code is
-    // modelled after what DMD does.
-    if (sd->getRTInfo) {
-      b.push(toConstElem(sd->getRTInfo, gIR));
-    } else if (!tc->hasPointers()) {
-      b.push_size_as_vp(0); // no pointers
-    } else {
-      b.push_size_as_vp(1); // has pointers
-    }
+    b.push_rtinfo(sd, tc->hasPointers());
 
     // finish
     b.finalize(gvar);
@@ -608,6 +607,10 @@ public:
 
 /* ========================================================================= */
 
+// IR names of the TypeInfos already defined in an object file of this
+// invocation (-dedup-typeinfo).
+static llvm::StringSet<> definedTypeInfos;
+
 void TypeInfoDeclaration_codegen(TypeInfoDeclaration *decl, IRState *p) {
   IF_LOG Logger::println("TypeInfoDeclaration_codegen(%s)",
                          decl->toPrettyChars());
@@ -651,11 +654,21 @@ void TypeInfoDeclaration_codegen(TypeInfoDeclaration *decl, IRState *p) {
     return;
   }
 
+  // With -dedup-typeinfo, only the first object file of this invocation
+  // needing the TypeInfo defines it, as weak_odr so that it isn't discarded.
+  const bool dedup = opts::dedupTypeInfo && !global.params.oneobj;
+  if (dedup && !definedTypeInfos.insert(irMangle).second) {
+    IF_LOG Logger::println("Defined in another object file, only declaring");
+    return;
+  }
+
   // define the TypeInfo global
   LLVMDefineVisitor v(gvar);
   decl->accept(&v);
 
-  setLinkage({TYPEINFO_LINKAGE_TYPE, supportsCOMDAT()}, gvar);
+  setLinkage({dedup ? LLGlobalValue::WeakODRLinkage : TYPEINFO_LINKAGE_TYPE,
+              supportsCOMDAT()},
+             gvar);
 }
 
 /* ========================================================================= */
@@ -680,3 +693,58 @@ void TypeInfoClassDeclaration_codegen(TypeInfoDeclaration *decl, IRState *p) {
     emitTypeMetadata(decl);
   }
 }
+
+/* ========================================================================= */
+
+namespace {
+bool isTypeInfoSymbol(llvm::StringRef name) {
+  // The IR names may carry the \1 'don't mangle' prefix.
+  if (name.startswith("\1"))
+    name = name.drop_front();
+  return name.startswith("_D") && name.endswith("6__initZ") &&
+         name.find("TypeInfo_") != llvm::StringRef::npos;
+}
+}
+
+void finalizeTypeInfos(llvm::Module &m) {
+  // TypeInfos are defined as soon as codegen needs them, most notably for
+  // druntime calls like _d_newarrayT or the AA functions, which the optimizer
+  // may eliminate later on. Each object file needing a TypeInfo has its own
+  // linkonce_odr copy, so unreferenced ones can be erased safely. Erasing a
+  // TypeInfo may leave the TypeInfos it refers to unreferenced too (e.g.,
+  // TypeInfo_Const -> base), hence the loop.
+  bool changed;
+  do {
+    changed = false;
+    for (auto it = m.global_begin(); it != m.global_end();) {
+      llvm::GlobalVariable &gv = *it++;
+      if (gv.getLinkage() != LLGlobalValue::LinkOnceODRLinkage ||
+          !isTypeInfoSymbol(gv.getName())) {
+        continue;
+      }
+      gv.removeDeadConstantUsers();
+      if (gv.use_empty()) {
+        IF_LOG Logger::println("Erasing unreferenced TypeInfo %s",
+                               gv.getName().str().c_str());
+        gv.eraseFromParent();
+        changed = true;
+      }
+    }
+  } while (changed);
+
+  if (!opts::verboseTypeInfo)
+    return;
+
+  const auto &dl = m.getDataLayout();
+  uint64_t numBytes = 0;
+  unsigned numTypeInfos = 0;
+  for (auto &gv : m.globals()) {
+    if (!gv.isDeclaration() && isTypeInfoSymbol(gv.getName())) {
+      numBytes += dl.getTypeAllocSize(gv.getValueType());
+      ++numTypeInfos;
+    }
+  }
+  message("typeinfo  %s: %llu bytes in %u TypeInfos",
+          m.getModuleIdentifier().c_str(),
+          static_cast<unsigned long long>(numBytes), numTypeInfos);
+}
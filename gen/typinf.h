@@ -19,6 +19,9 @@ struct Scope;
 struct Loc;
 class Type;
 class TypeInfoDeclaration;
+namespace llvm {
+class Module;
+}
 
 void DtoResolveTypeInfo(TypeInfoDeclaration *tid);
 TypeInfoDeclaration *getOrCreateTypeInfoDeclaration(const Loc &loc, Type *t,
@@ -26,5 +29,10 @@ TypeInfoDeclaration *getOrCreateTypeInfoDeclaration(const Loc &loc, Type *t,
 void TypeInfoDeclaration_codegen(TypeInfoDeclaration *decl, IRState *p);
 void TypeInfoClassDeclaration_codegen(TypeInfoDeclaration *decl, IRState *p);
 
+/// Erases the linkonce_odr TypeInfo definitions of the module which aren't
+/// referenced anymore, e.g., because the runtime calls needing them have
+/// been optimized away. Prints their total size per module with -vtypeinfo.
+void finalizeTypeInfos(llvm::Module &m);
+
 // defined in dmd/typinf.d:
 bool isSpeculativeType(Type *t);
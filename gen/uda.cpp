@@ -7,6 +7,10 @@
 #include "dmd/id.h"
 #include "dmd/identifier.h"
 #include "dmd/module.h"
+#include "dmd/mtype.h"
+#include "driver/plugin_api.h"
+#include "driver/plugins.h"
+#include "gen/attributes.h"
 #include "gen/irstate.h"
 #include "gen/llvm.h"
 #include "gen/llvmhelpers.h"
@@ -14,6 +18,8 @@
 #include "ir/irvar.h"
 #include "llvm/ADT/StringExtras.h"
 #include "llvm/ADT/StringSwitch.h"
+#include "llvm/ADT/Triple.h"
+#include <algorithm>
 
 namespace llvm {
 // Auto-generate:
@@ -293,15 +299,56 @@ void applyAttrSection(StructLiteralExp *sle, llvm::GlobalObject *globj) {
 
 void applyAttrTarget(StructLiteralExp *sle, llvm::Function *func,
                      IrFunction *irFunc) {
+  checkStructElems(sle, {Type::tstring});
+  applyTargetSpec(getFirstElemString(sle), func, irFunc);
+}
+
+// @targetClones("default", "avx2", "avx512f")
+void applyAttrTargetClones(StructLiteralExp *sle, IrFunction *irFunc) {
+  checkStructElems(sle, {Type::tstring->arrayOf()});
+
+  const auto &triple = *global.params.targetTriple;
+  if ((triple.getArch() != llvm::Triple::x86 &&
+       triple.getArch() != llvm::Triple::x86_64) ||
+      !triple.isOSBinFormatELF()) {
+    sle->error("`ldc.attributes.targetClones` is only supported for x86 ELF "
+               "targets");
+    return;
+  }
+
+  auto arg = (*sle->elements)[0];
+  std::vector<std::string> specs;
+  if (arg->op == TOKarrayliteral) {
+    for (auto e : *static_cast<ArrayLiteralExp *>(arg)->elements) {
+      if (e && e->op == TOKstring)
+        specs.push_back(static_cast<StringExp *>(e)->toStringz());
+    }
+  }
+  if (std::find(specs.begin(), specs.end(), "default") == specs.end()) {
+    sle->error("`ldc.attributes.targetClones` requires a `\"default\"` "
+               "version");
+    return;
+  }
+
+  irFunc->targetClones = std::move(specs);
+}
+
+void applyAttrAssumeUsed(IRState &irs, StructLiteralExp *sle,
+                         llvm::Constant *symbol) {
+  checkStructElems(sle, {});
+  irs.usedArray.push_back(symbol);
+}
+
+} // anonymous namespace
+
+void applyTargetSpec(llvm::StringRef targetspec, llvm::Function *func,
+                     IrFunction *irFunc) {
   // TODO: this is a rudimentary implementation for @target. Many more
   // target-related attributes could be applied to functions (not just for
   // @target): clang applies many attributes that LDC does not.
   // The current implementation here does not do any checking of the specified
   // string and simply passes all to llvm.
 
-  checkStructElems(sle, {Type::tstring});
-  std::string targetspec = getFirstElemString(sle);
-
   if (targetspec.empty() || targetspec == "default")
     return;
 
@@ -347,7 +394,8 @@ void applyAttrTarget(StructLiteralExp *sle, llvm::Function *func,
 
   if (!CPU.empty()) {
     func->addFnAttr("target-cpu", CPU);
-    irFunc->targetCpuOverridden = true;
+    if (irFunc)
+      irFunc->targetCpuOverridden = true;
   }
 
   if (!features.empty()) {
@@ -357,17 +405,55 @@ void applyAttrTarget(StructLiteralExp *sle, llvm::Function *func,
     sort(features.begin(), features.end());
     func->addFnAttr("target-features",
                     llvm::join(features.begin(), features.end(), ","));
-    irFunc->targetFeaturesOverridden = true;
+    if (irFunc)
+      irFunc->targetFeaturesOverridden = true;
   }
 }
 
-void applyAttrAssumeUsed(IRState &irs, StructLiteralExp *sle,
-                         llvm::Constant *symbol) {
-  checkStructElems(sle, {});
-  irs.usedArray.push_back(symbol);
-}
+void applyParamUDAs(Parameter *param, AttrBuilder &attrs) {
+  if (!param->userAttribDecl)
+    return;
 
-} // anonymous namespace
+  Expressions *udas = param->userAttribDecl->getAttributes();
+  expandTuples(udas);
+  for (auto &attr : *udas) {
+    auto sle = getLdcAttributesStruct(attr);
+    if (!sle)
+      continue;
+
+    auto ident = sle->sd->ident;
+    if (ident != Id::udaLLVMAttr) {
+      sle->error("Special attribute `ldc.attributes.%s` is not valid for "
+                 "parameters",
+                 ident->toChars());
+      continue;
+    }
+
+    // @llvmAttr("noalias"), @llvmAttr("dereferenceable", "16"), ...
+    checkStructElems(sle, {Type::tstring, Type::tstring});
+    llvm::StringRef key = getStringElem(sle, 0);
+    llvm::StringRef value = getStringElem(sle, 1);
+    llvm::AttrBuilder &builder = attrs;
+    const auto kind = llvm::getAttrKindFromName(key);
+    uint64_t bytes = 0;
+    if (kind == llvm::Attribute::None) {
+      builder.addAttribute(key, value);
+    } else if (value.empty()) {
+      builder.addAttribute(kind);
+    } else if (value.getAsInteger(10, bytes)) {
+      sle->error("invalid value `%s` for parameter attribute `%s`",
+                 value.str().c_str(), key.str().c_str());
+    } else if (kind == llvm::Attribute::Alignment) {
+      attrs.addAlignment(bytes);
+    } else if (kind == llvm::Attribute::Dereferenceable) {
+      attrs.addDereferenceable(bytes);
+    } else if (kind == llvm::Attribute::DereferenceableOrNull) {
+      builder.addDereferenceableOrNullAttr(bytes);
+    } else {
+      sle->error("parameter attribute `%s` takes no value", key.str().c_str());
+    }
+  }
+}
 
 void applyVarDeclUDAs(VarDeclaration *decl, llvm::GlobalVariable *gvar) {
   if (!decl->userAttribDecl)
@@ -383,7 +469,8 @@ void applyVarDeclUDAs(VarDeclaration *decl, llvm::GlobalVariable *gvar) {
     auto ident = sle->sd->ident;
     if (ident == Id::udaSection) {
       applyAttrSection(sle, gvar);
-    } else if (ident == Id::udaOptStrategy || ident == Id::udaTarget) {
+    } else if (ident == Id::udaOptStrategy || ident == Id::udaTarget ||
+               ident == Id::udaTargetClones) {
       sle->error(
           "Special attribute `ldc.attributes.%s` is only valid for functions",
           ident->toChars());
@@ -392,7 +479,8 @@ void applyVarDeclUDAs(VarDeclaration *decl, llvm::GlobalVariable *gvar) {
     } else if (ident == Id::udaWeak) {
       // @weak is applied elsewhere
     } else if (ident == Id::udaDynamicCompile ||
-               ident == Id::udaDynamicCompileEmit) {
+               ident == Id::udaDynamicCompileEmit ||
+               ident == Id::udaDynamicCompileInline) {
       sle->error(
           "Special attribute `ldc.attributes.%s` is only valid for functions",
           ident->toChars());
@@ -406,6 +494,35 @@ void applyVarDeclUDAs(VarDeclaration *decl, llvm::GlobalVariable *gvar) {
   }
 }
 
+namespace {
+
+/// Lists the fully qualified names of the struct and type UDAs of a function
+/// in its `ldc.udas` metadata, for plugins (see driver/plugin_api.h).
+void addUDAMetadata(FuncDeclaration *decl, llvm::Function *func) {
+  Expressions *attrs = decl->userAttribDecl->getAttributes();
+  expandTuples(attrs);
+  llvm::SmallVector<llvm::Metadata *, 4> names;
+  for (auto attr : *attrs) {
+    const char *name = nullptr;
+    if (attr->op == TOKtype) {
+      name = attr->type->toPrettyChars(true);
+    } else {
+      unsigned prevErrors = global.startGagging();
+      auto e = attr->ctfeInterpret();
+      if (!global.endGagging(prevErrors) && e->op == TOKstructliteral)
+        name = static_cast<StructLiteralExp *>(e)->sd->toPrettyChars(true);
+    }
+    if (name)
+      names.push_back(llvm::MDString::get(func->getContext(), name));
+  }
+  if (!names.empty()) {
+    func->setMetadata(ldc::plugin::UDAMetadataKind,
+                      llvm::MDNode::get(func->getContext(), names));
+  }
+}
+
+} // anonymous namespace
+
 void applyFuncDeclUDAs(FuncDeclaration *decl, IrFunction *irFunc) {
   if (!decl->userAttribDecl)
     return;
@@ -413,6 +530,9 @@ void applyFuncDeclUDAs(FuncDeclaration *decl, IrFunction *irFunc) {
   llvm::Function *func = irFunc->getLLVMFunc();
   assert(func);
 
+  if (arePluginsLoaded())
+    addUDAMetadata(decl, func);
+
   Expressions *attrs = decl->userAttribDecl->getAttributes();
   expandTuples(attrs);
   for (auto &attr : *attrs) {
@@ -433,6 +553,8 @@ void applyFuncDeclUDAs(FuncDeclaration *decl, IrFunction *irFunc) {
       applyAttrSection(sle, func);
     } else if (ident == Id::udaTarget) {
       applyAttrTarget(sle, func, irFunc);
+    } else if (ident == Id::udaTargetClones) {
+      applyAttrTargetClones(sle, irFunc);
     } else if (ident == Id::udaAssumeUsed) {
       applyAttrAssumeUsed(*gIR, sle, func);
     } else if (ident == Id::udaWeak || ident == Id::udaKernel) {
@@ -441,6 +563,8 @@ void applyFuncDeclUDAs(FuncDeclaration *decl, IrFunction *irFunc) {
       irFunc->dynamicCompile = true;
     } else if (ident == Id::udaDynamicCompileEmit) {
       irFunc->dynamicCompileEmit = true;
+    } else if (ident == Id::udaDynamicCompileInline) {
+      irFunc->dynamicCompileInline = true;
     } else if (ident == Id::udaDynamicCompileConst) {
       sle->error(
           "Special attribute `ldc.attributes.%s` is only valid for variables",
@@ -467,6 +591,16 @@ bool hasWeakUDA(Dsymbol *sym) {
   return true;
 }
 
+bool hasDynamicCompileInlineUDA(FuncDeclaration *fd) {
+  auto sle =
+      getMagicAttribute(fd, Id::udaDynamicCompileInline, Id::attributes);
+  if (!sle)
+    return false;
+
+  checkStructElems(sle, {});
+  return true;
+}
+
 /// Returns 0 if 'sym' does not have the @ldc.dcompute.compute() UDA applied.
 /// Returns 1 + n if 'sym' does and is @compute(n).
 extern "C" DComputeCompileFor hasComputeAttr(Dsymbol *sym) {
@@ -496,3 +630,65 @@ bool hasKernelAttr(Dsymbol *sym) {
 
   return true;
 }
+
+namespace {
+/// Returns the kernel attribute `id` from ldc.dcompute applied to `fd`, with
+/// `numElems` positive int elements. Errors out if `fd` is not a kernel.
+StructLiteralExp *getKernelBoundsAttr(FuncDeclaration *fd, const Identifier *id,
+                                      size_t numElems) {
+  auto sle = getMagicAttribute(fd, id, Id::dcompute);
+  if (!sle)
+    return nullptr;
+
+  llvm::SmallVector<Type *, 3> elemTypes(numElems, Type::tint32);
+  checkStructElems(sle, elemTypes);
+
+  if (!hasKernelAttr(fd)) {
+    sle->error("`@ldc.dcompute.%s` can only be applied to `@kernel` functions",
+               id->toChars());
+    return nullptr;
+  }
+  for (size_t i = 0; i < numElems; ++i) {
+    if (getIntElem(sle, i) < 0) {
+      sle->error("`@ldc.dcompute.%s` arguments must not be negative",
+                 id->toChars());
+      return nullptr;
+    }
+  }
+  return sle;
+}
+} // anonymous namespace
+
+bool getKernelLaunchBounds(FuncDeclaration *fd, unsigned &maxThreads,
+                           unsigned &minBlocks) {
+  auto sle = getKernelBoundsAttr(fd, Id::udaLaunchBounds, 2);
+  if (!sle)
+    return false;
+
+  maxThreads = static_cast<unsigned>(getIntElem(sle, 0));
+  minBlocks = static_cast<unsigned>(getIntElem(sle, 1));
+  if (maxThreads == 0) {
+    sle->error("`@ldc.dcompute.launchBounds` requires a positive "
+               "`maxThreadsPerBlock`");
+    return false;
+  }
+  return true;
+}
+
+bool getKernelWorkGroupSize(FuncDeclaration *fd, const Identifier *id,
+                            unsigned (&dims)[3]) {
+  assert(id == Id::udaReqdWorkGroupSize || id == Id::udaWorkGroupSizeHint);
+  auto sle = getKernelBoundsAttr(fd, id, 3);
+  if (!sle)
+    return false;
+
+  for (size_t i = 0; i < 3; ++i) {
+    dims[i] = static_cast<unsigned>(getIntElem(sle, i));
+    if (dims[i] == 0) {
+      sle->error("`@ldc.dcompute.%s` dimensions must be positive",
+                 id->toChars());
+      return false;
+    }
+  }
+  return true;
+}
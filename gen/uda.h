@@ -14,19 +14,43 @@
 
 #pragma once
 
+#include "llvm/ADT/StringRef.h"
+
+class AttrBuilder;
 class Dsymbol;
 class FuncDeclaration;
+class Identifier;
+class Parameter;
 class VarDeclaration;
 struct IrFunction;
 namespace llvm {
+class Function;
 class GlobalVariable;
 }
 
 void applyFuncDeclUDAs(FuncDeclaration *decl, IrFunction *irFunc);
 void applyVarDeclUDAs(VarDeclaration *decl, llvm::GlobalVariable *gvar);
 
+/// Applies the `@llvmAttr` UDAs of a function parameter to its attributes.
+void applyParamUDAs(Parameter *param, AttrBuilder &attrs);
+
+/// Applies a @target spec like "arch=haswell,avx2,no-fma" to func. irFunc may
+/// be null (for clones).
+void applyTargetSpec(llvm::StringRef targetspec, llvm::Function *func,
+                     IrFunction *irFunc);
+
 bool hasWeakUDA(Dsymbol *sym);
+bool hasDynamicCompileInlineUDA(FuncDeclaration *fd);
 bool hasKernelAttr(Dsymbol *sym);
+/// Gets the arguments of @ldc.dcompute.launchBounds(maxThreadsPerBlock,
+/// minBlocksPerMultiprocessor = 0), returns false if it isn't applied.
+bool getKernelLaunchBounds(FuncDeclaration *fd, unsigned &maxThreads,
+                           unsigned &minBlocks);
+/// Gets the dimensions of @ldc.dcompute.reqdWorkGroupSize(x, y = 1, z = 1) or
+/// @ldc.dcompute.workGroupSizeHint(x, y = 1, z = 1) (selected by `id`),
+/// returns false if it isn't applied.
+bool getKernelWorkGroupSize(FuncDeclaration *fd, const Identifier *id,
+                            unsigned (&dims)[3]);
 /// Must match ldc.dcompute.Compilefor + 1 == DComputeCompileFor
 enum class DComputeCompileFor : int
 {
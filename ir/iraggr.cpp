@@ -24,7 +24,10 @@
 #include "ir/irdsymbol.h"
 #include "ir/irtypeclass.h"
 #include "ir/irtypestruct.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/IR/ValueHandle.h"
 #include <algorithm>
+#include <map>
 
 //////////////////////////////////////////////////////////////////////////////
 
@@ -62,17 +65,66 @@ LLConstant *&IrAggr::getInitSymbol() {
 
 //////////////////////////////////////////////////////////////////////////////
 
+namespace {
+#if LDC_LLVM_VER >= 500
+using ConstantHandle = llvm::WeakTrackingVH;
+#else
+using ConstantHandle = llvm::WeakVH;
+#endif
+
+/// The struct default initializers not referencing any globals. As all modules
+/// share a single LLVMContext, they can be reused for every module of the
+/// invocation, instead of being rebuilt after IrDsymbol::resetAll(). The
+/// target is part of the key, as the layout differs for DCompute devices.
+/// The handles are nulled if LLVM ever destroys a constant.
+std::map<std::pair<Type *, DComputeTarget *>, ConstantHandle>
+    moduleIndependentInits;
+
+bool referencesGlobals(llvm::Constant *c) {
+  llvm::SmallVector<llvm::Constant *, 16> worklist;
+  llvm::SmallPtrSet<llvm::Constant *, 16> visited;
+  worklist.push_back(c);
+  while (!worklist.empty()) {
+    llvm::Constant *cur = worklist.pop_back_val();
+    if (llvm::isa<llvm::GlobalValue>(cur) ||
+        llvm::isa<llvm::BlockAddress>(cur)) {
+      return true;
+    }
+    for (auto &op : cur->operands()) {
+      auto opc = llvm::cast<llvm::Constant>(op);
+      if (visited.insert(opc).second)
+        worklist.push_back(opc);
+    }
+  }
+  return false;
+}
+}
+
 llvm::Constant *IrAggr::getDefaultInit() {
   if (constInit) {
     return constInit;
   }
 
+  const bool isStruct = aggrdecl->isStructDeclaration() != nullptr;
+  const auto cacheKey = std::make_pair(type, gIR->dcomputetarget);
+  if (isStruct) {
+    auto it = moduleIndependentInits.find(cacheKey);
+    if (it != moduleIndependentInits.end() && it->second) {
+      constInit = llvm::cast<llvm::Constant>(it->second);
+      return constInit;
+    }
+  }
+
   IF_LOG Logger::println("Building default initializer for %s",
                          aggrdecl->toPrettyChars());
   LOG_SCOPE;
 
   VarInitMap noExplicitInitializers;
   constInit = createInitializerConstant(noExplicitInitializers);
+
+  if (isStruct && !referencesGlobals(constInit))
+    moduleIndependentInits[cacheKey] = constInit;
+
   return constInit;
 }
 
@@ -424,6 +424,9 @@ void IrAggr::defineInterfaceVtbl(BaseClass *b, bool new_instance,
 
       gIR->DBuilder.EmitFuncStart(thunkFd);
 
+      // PGO: allow promoting profiled interface calls to this thunk
+      gIR->funcGen().pgo.emitThunkInstrumentation(fd, thunk);
+
       // Copy the function parameters, so later we can pass them to the
       // real function and set their names from the original function (the
       // latter being just for IR readablilty).
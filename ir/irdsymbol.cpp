@@ -9,7 +9,10 @@
 
 #include "gen/llvm.h"
 #include "gen/logger.h"
+#include "ir/iraggr.h"
 #include "ir/irdsymbol.h"
+#include "ir/irfunction.h"
+#include "ir/irmodule.h"
 #include "ir/irvar.h"
 
 // Callbacks for constructing/destructing Dsymbol.ir member.
@@ -18,11 +21,15 @@ void deleteIrDsymbol(void* sym) { delete static_cast<IrDsymbol*>(sym); }
 
 std::vector<IrDsymbol *> IrDsymbol::list;
 
-void IrDsymbol::resetAll() {
-  Logger::println("resetting %llu Dsymbols",
-                  static_cast<unsigned long long>(list.size()));
+void IrDsymbol::resetAll(bool freeData) {
+  Logger::println("resetting %llu Dsymbols%s",
+                  static_cast<unsigned long long>(list.size()),
+                  freeData ? " and freeing their IR data" : "");
 
   for (auto s : list) {
+    if (freeData) {
+      s->freeData();
+    }
     s->reset();
   }
 }
@@ -55,6 +62,37 @@ void IrDsymbol::reset() {
   m_state = State::Initial;
 }
 
+void IrDsymbol::freeData() {
+  // The IrVar hierarchy has no virtual destructor, so delete the concrete
+  // types.
+  switch (m_type) {
+  case ModuleType:
+    delete irModule;
+    break;
+  case AggrType:
+    delete irAggr;
+    break;
+  case FuncType:
+    delete irFunc;
+    break;
+  case GlobalType:
+    delete irGlobal;
+    break;
+  case LocalType:
+    delete irLocal;
+    break;
+  case ParamterType:
+    delete irParam;
+    break;
+  case FieldType:
+    delete irField;
+    break;
+  case NotSet:
+    break;
+  }
+  irData = nullptr;
+}
+
 void IrDsymbol::setResolved() {
   if (m_state < Resolved) {
     m_state = Resolved;
@@ -48,7 +48,10 @@ struct IrDsymbol {
   enum State { Initial, Resolved, Declared, Initialized, Defined };
 
   static std::vector<IrDsymbol *> list;
-  static void resetAll();
+  /// Resets the IR state of all symbols, e.g. for a new llvm::Module. If
+  /// `freeData` is set, the IR data of the symbols is deleted instead of just
+  /// being forgotten; no pointers to it must be kept across the reset then.
+  static void resetAll(bool freeData = false);
 
   // overload all of these to make sure
   // the static list is up to date
@@ -57,6 +60,7 @@ struct IrDsymbol {
   ~IrDsymbol();
 
   void reset();
+  void freeData();
 
   Type type() const { return m_type; }
   State state() const { return m_state; }
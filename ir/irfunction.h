@@ -19,6 +19,8 @@
 #include "gen/llvm.h"
 #include "ir/irfuncty.h"
 #include <stack>
+#include <string>
+#include <vector>
 
 class FuncDeclaration;
 class TypeFunction;
@@ -88,12 +90,20 @@ struct IrFunction {
   /// target features was overriden by attributes
   bool targetFeaturesOverridden = false;
 
+  /// Target specs of the versions requested by @targetClones ("default" being
+  /// the regular version), dispatched to at load time.
+  std::vector<std::string> targetClones;
+
   /// This functions was marked for dynamic compilation
   bool dynamicCompile = false;
 
   /// This functions was marked emit-only for dynamic compilation
   bool dynamicCompileEmit = false;
 
+  /// This function's IR is made available to dynamically compiled callers
+  /// for inlining (@dynamicCompileInline)
+  bool dynamicCompileInline = false;
+
   /// Dynamic compilation thunk, all attempts to call or take address of the
   /// original function will be redirected to it
   llvm::Function *rtCompileFunc = nullptr;
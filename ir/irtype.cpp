@@ -56,6 +56,11 @@ llvm::Type *getReal80Type(llvm::LLVMContext &ctx) {
   bool const isAndroid =
       global.params.targetTriple->getEnvironment() == llvm::Triple::Android;
 
+  // -real-precision=double
+  if (global.params.realIsDouble) {
+    return llvm::Type::getDoubleTy(ctx);
+  }
+
   // only x86 has 80bit float - but no support with MS C Runtime!
   if (anyX86 && !global.params.targetTriple->isWindowsMSVCEnvironment() &&
       !isAndroid) {
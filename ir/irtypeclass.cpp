@@ -86,6 +86,10 @@ IrTypeClass *IrTypeClass::get(ClassDeclaration *cd) {
     // classes have monitor and fields
     if (!cd->isCPPclass() && !cd->isCPPinterface()) {
       // add monitor
+      // Note: This slot can't be omitted for any D class, not even for ones
+      // never used with `synchronized`: druntime's finalization
+      // (rt_finalize2) and monitor functions access it at this fixed offset
+      // for every Object.
       builder.addType(
           llvm::PointerType::get(llvm::Type::getInt8Ty(gIR->context()), 0),
           Target::ptrsize);
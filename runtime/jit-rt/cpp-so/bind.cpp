@@ -10,6 +10,7 @@
 #include "bind.h"
 
 #include "llvm/ADT/SmallVector.h"
+#include "llvm/IR/Attributes.h"
 #include "llvm/IR/BasicBlock.h"
 #include "llvm/IR/Function.h"
 #include "llvm/IR/IRBuilder.h"
@@ -36,6 +37,63 @@ llvm::FunctionType *getDstFuncType(llvm::FunctionType &srcType,
   return llvm::FunctionType::get(retType, newParams, /*isVarArg*/ false);
 }
 
+// Attributes which only describe what the function does with its values, so
+// they stay valid for the bind function. ABI attributes must match the calls
+// through the bind handle and are taken from exampleFunc.
+const llvm::Attribute::AttrKind FuncAttrsToCopy[] = {
+    llvm::Attribute::NoUnwind, llvm::Attribute::NoReturn,
+    llvm::Attribute::NoRecurse, llvm::Attribute::ReadNone,
+    llvm::Attribute::ReadOnly, llvm::Attribute::Cold,
+};
+
+const llvm::Attribute::AttrKind ValueAttrsToCopy[] = {
+    llvm::Attribute::NoAlias,
+    llvm::Attribute::NonNull,
+    llvm::Attribute::Dereferenceable,
+    llvm::Attribute::DereferenceableOrNull,
+    llvm::Attribute::Alignment,
+    llvm::Attribute::NoCapture,
+    llvm::Attribute::ReadOnly,
+    llvm::Attribute::ReadNone,
+};
+
+template <typename F>
+void copyValueAttrs(const llvm::AttributeSet &src,
+                    const llvm::AttributeSet &dst, F &&add) {
+  for (auto kind : ValueAttrsToCopy) {
+    if (src.hasAttribute(kind) && !dst.hasAttribute(kind)) {
+      add(src.getAttribute(kind));
+    }
+  }
+}
+
+void copyAttributes(llvm::Function &dstFunc, const llvm::Function &srcFunc,
+                    const llvm::ArrayRef<ParamSlice> &params) {
+  const auto srcAttrs = srcFunc.getAttributes();
+  const auto dstAttrs = dstFunc.getAttributes();
+  for (auto kind : FuncAttrsToCopy) {
+    if (srcFunc.hasFnAttribute(kind)) {
+      dstFunc.addFnAttr(kind);
+    }
+  }
+  copyValueAttrs(srcAttrs.getRetAttributes(), dstAttrs.getRetAttributes(),
+                 [&](llvm::Attribute attr) {
+                   dstFunc.addAttribute(llvm::AttributeList::ReturnIndex,
+                                        attr);
+                 });
+  unsigned dstInd = 0;
+  for (size_t i = 0; i < params.size(); ++i) {
+    if (params[i].data == nullptr) {
+      copyValueAttrs(
+          srcAttrs.getParamAttributes(static_cast<unsigned>(i)),
+          dstAttrs.getParamAttributes(dstInd),
+          [&](llvm::Attribute attr) { dstFunc.addParamAttr(dstInd, attr); });
+      ++dstInd;
+    }
+  }
+  assert(dstInd == dstFunc.getFunctionType()->getNumParams());
+}
+
 llvm::Function *createBindFunc(llvm::Module &module, llvm::Function &srcFunc,
                                llvm::Function &exampleFunc,
                                llvm::FunctionType &funcType,
@@ -44,22 +102,8 @@ llvm::Function *createBindFunc(llvm::Module &module, llvm::Function &srcFunc,
       &funcType, llvm::GlobalValue::ExternalLinkage, "\1.jit_bind", &module);
 
   newFunc->setCallingConv(srcFunc.getCallingConv());
-  //  auto srcAttributes = srcFunc.getAttributes();
-  //  newFunc->addAttributes(llvm::AttributeList::ReturnIndex,
-  //                         srcAttributes.getRetAttributes());
-  //  newFunc->addAttributes(llvm::AttributeList::FunctionIndex,
-  //                         srcAttributes.getFnAttributes());
-  //  unsigned dstInd = 0;
-  //  for (size_t i = 0; i < params.size(); ++i) {
-  //    if (params[i].data == nullptr) {
-  //      newFunc->addAttributes(llvm::AttributeList::FirstArgIndex + dstInd,
-  //                             srcAttributes.getParamAttributes(
-  //                               static_cast<unsigned>(i)));
-  //      ++dstInd;
-  //    }
-  //  }
-  //  assert(dstInd == funcType.getNumParams());
   newFunc->setAttributes(exampleFunc.getAttributes());
+  copyAttributes(*newFunc, srcFunc, params);
   return newFunc;
 }
 
@@ -114,10 +158,6 @@ void doBind(llvm::Module &module, llvm::Function &dstFunc,
   assert(currentArg == dstFunc.arg_end());
 
   auto ret = builder.CreateCall(&srcFunc, args);
-  if (!srcFunc.isDeclaration()) {
-    ret->addAttribute(llvm::AttributeList::FunctionIndex,
-                      llvm::Attribute::AlwaysInline);
-  }
   ret->setCallingConv(srcFunc.getCallingConv());
   ret->setAttributes(srcFunc.getAttributes());
   if (dstFunc.getReturnType()->isVoidTy()) {
@@ -125,6 +165,17 @@ void doBind(llvm::Module &module, llvm::Function &dstFunc,
   } else {
     builder.CreateRet(ret);
   }
+
+  // Inline the bound body right away, so the bound values are propagated
+  // into it regardless of the optimization level.
+  if (!srcFunc.isDeclaration() &&
+      !srcFunc.hasFnAttribute(llvm::Attribute::NoInline)) {
+    llvm::InlineFunctionInfo ifi;
+    if (!llvm::InlineFunction(ret, ifi)) {
+      ret->addAttribute(llvm::AttributeList::FunctionIndex,
+                        llvm::Attribute::AlwaysInline);
+    }
+  }
 }
 }
 
@@ -12,27 +12,38 @@
 //
 //===----------------------------------------------------------------------===//
 
+#include <atomic>
 #include <cassert>
+#include <chrono>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <sstream>
 #include <stdexcept>
+#include <thread>
 #include <type_traits>
 #include <unordered_map>
+#include <utility>
+#include <vector>
 
 #include "bind.h"
-#include "callback_ostream.h"
 #include "context.h"
+#include "dumper.h"
 #include "jit_context.h"
+#include "object_cache.h"
 #include "optimizer.h"
+#include "parallel_codegen.h"
 #include "utils.h"
 
+#include "llvm/ADT/SmallPtrSet.h"
 #include "llvm/Bitcode/BitcodeReader.h"
 #include "llvm/ExecutionEngine/JITSymbol.h"
 #include "llvm/IR/Constants.h"
 #include "llvm/IR/GlobalVariable.h"
+#include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/Mangler.h"
 #include "llvm/Linker/Linker.h"
+#include "llvm/Support/ManagedStatic.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Transforms/Utils/Cloning.h"
 
@@ -170,6 +181,28 @@ void *resolveSymbol(llvm::JITSymbol &symbol) {
   }
 }
 
+// Binds of the same function with identical parameter bytes produce identical
+// code, this key identifies them.
+std::string getBindKey(const void *originalFunc, const void *exampleFunc,
+                       llvm::ArrayRef<ParamSlice> params) {
+  std::string key;
+  auto append = [&](const void *data, std::size_t size) {
+    key.append(static_cast<const char *>(data), size);
+  };
+  append(&originalFunc, sizeof(originalFunc));
+  append(&exampleFunc, sizeof(exampleFunc));
+  for (auto &&param : params) {
+    const bool placeholder = nullptr == param.data;
+    append(&placeholder, sizeof(placeholder));
+    append(&param.type, sizeof(param.type));
+    append(&param.size, sizeof(param.size));
+    if (!placeholder) {
+      append(param.data, param.size);
+    }
+  }
+  return key;
+}
+
 void generateBind(const Context &context, JITContext &jitContext,
                   JitModuleInfo &moduleInfo, llvm::Module &module) {
   auto getIrFunc = [&](const void *ptr) -> llvm::Function * {
@@ -183,11 +216,21 @@ void generateBind(const Context &context, JITContext &jitContext,
 
   std::unordered_map<const void *, llvm::Function *> bindFuncs;
   bindFuncs.reserve(jitContext.getBindInstances().size() * 2);
+  std::unordered_map<std::string, llvm::Function *> sharedFuncs;
 
   auto genBind = [&](void *bindPtr, void *originalFunc, void *exampleFunc,
                      const llvm::ArrayRef<ParamSlice> &params) {
     assert(bindPtr != nullptr);
     assert(bindFuncs.end() == bindFuncs.find(bindPtr));
+    auto key = getBindKey(originalFunc, exampleFunc, params);
+    auto sharedIt = sharedFuncs.find(key);
+    if (sharedFuncs.end() != sharedIt) {
+      auto func = sharedIt->second;
+      interruptPoint(context, "Reuse bind function", func->getName().data());
+      moduleInfo.addBindHandle(func->getName(), bindPtr);
+      bindFuncs.insert({bindPtr, func});
+      return;
+    }
     auto funcToInline = getIrFunc(originalFunc);
     if (funcToInline != nullptr) {
       auto exampleIrFunc = getIrFunc(exampleFunc);
@@ -234,6 +277,7 @@ void generateBind(const Context &context, JITContext &jitContext,
                            errhandler, BindOverride(overrideHandler));
       moduleInfo.addBindHandle(func->getName(), bindPtr);
       bindFuncs.insert({bindPtr, func});
+      sharedFuncs.insert({std::move(key), func});
     } else {
       fatal(context, "Bind: function body not available");
     }
@@ -266,10 +310,39 @@ void applyBind(const Context &context, JITContext &jitContext,
 }
 
 JITContext &getJit() {
+  // Shuts LLVM down after the default context and all independent ones (which
+  // must have been destroyed by then) are gone.
+  static llvm::llvm_shutdown_obj shutdownObj;
   static JITContext jit;
   return jit;
 }
 
+// Serializes all accesses to the default jit, compilation may run on a
+// background thread.
+std::mutex &getJitMutex() {
+  static std::mutex mutex;
+  return mutex;
+}
+
+// An independent jit context, created by the user. Its accesses are only
+// serialized with each other, so that independent contexts can compile
+// concurrently.
+struct IndependentJit final {
+  JITContext jit;
+  std::mutex mutex;
+};
+
+JITContext &getJit(void *jitContext) {
+  return nullptr == jitContext ? getJit()
+                               : static_cast<IndependentJit *>(jitContext)->jit;
+}
+
+std::mutex &getJitMutex(void *jitContext) {
+  return nullptr == jitContext
+             ? getJitMutex()
+             : static_cast<IndependentJit *>(jitContext)->mutex;
+}
+
 void setRtCompileVars(const Context &context, llvm::Module &module,
                       llvm::ArrayRef<RtCompileVarList> vals) {
   for (auto &&val : vals) {
@@ -277,34 +350,211 @@ void setRtCompileVars(const Context &context, llvm::Module &module,
   }
 }
 
-void dumpModule(const Context &context, const llvm::Module &module,
-                DumpStage stage) {
-  if (nullptr != context.dumpHandler) {
-    auto callback = [&](const char *str, size_t len) {
-      context.dumpHandler(context.dumpHandlerData, stage, str, len);
-    };
-
-    CallbackOstream os(callback);
-    module.print(os, nullptr, false, true);
-  }
+llvm::StringRef toStringRef(const char *str) {
+  return nullptr != str ? llvm::StringRef(str) : llvm::StringRef();
 }
 
-void setFunctionsTarget(llvm::Module &module, const llvm::TargetMachine &TM) {
-  // Set function target cpu to host if it wasn't set explicitly
+void setFunctionsTarget(const Context &context, llvm::Module &module,
+                        const llvm::TargetMachine &TM) {
+  const auto cpu = toStringRef(context.targetCpu);
+  const auto extraFeatures = toStringRef(context.targetFeatures);
   for (auto &&func : module.functions()) {
+    if (!cpu.empty()) {
+      // Explicit cpu, don't mix its default features with the host ones
+      func.addFnAttr("target-cpu", cpu);
+      if (extraFeatures.empty()) {
+        func.removeFnAttr("target-features");
+      } else {
+        func.addFnAttr("target-features", extraFeatures);
+      }
+      continue;
+    }
+
+    // Set function target cpu to host if it wasn't set explicitly
     if (!func.hasFnAttribute("target-cpu")) {
       func.addFnAttr("target-cpu", TM.getTargetCPU());
     }
 
-    if (!func.hasFnAttribute("target-features")) {
-      auto featStr = TM.getTargetFeatureString();
+    std::string featStr;
+    if (func.hasFnAttribute("target-features")) {
+      featStr = func.getFnAttribute("target-features").getValueAsString();
+    } else {
+      featStr = TM.getTargetFeatureString();
+    }
+    // Later features override the earlier ones
+    if (!extraFeatures.empty()) {
       if (!featStr.empty()) {
-        func.addFnAttr("target-features", featStr);
+        featStr += ",";
       }
+      featStr += extraFeatures;
+    }
+    if (!featStr.empty()) {
+      func.addFnAttr("target-features", featStr);
+    }
+  }
+}
+
+using GlobalHashes = std::map<std::string, std::size_t>;
+
+bool isDefinition(const llvm::GlobalValue &gv) {
+  return !gv.isDeclaration() && !gv.hasAvailableExternallyLinkage();
+}
+
+template <typename F> void enumGlobals(llvm::Module &module, F &&fun) {
+  for (auto &&func : module.functions()) {
+    fun(func);
+  }
+  for (auto &&var : module.globals()) {
+    fun(var);
+  }
+  for (auto &&alias : module.aliases()) {
+    fun(alias);
+  }
+}
+
+GlobalHashes hashDefinitions(llvm::Module &module) {
+  GlobalHashes ret;
+  std::string str;
+  enumGlobals(module, [&](llvm::GlobalValue &gv) {
+    if (isDefinition(gv) && gv.hasName()) {
+      str.clear();
+      llvm::raw_string_ostream os(str);
+      gv.print(os);
+      os.flush();
+      ret.insert({gv.getName().str(), std::hash<std::string>()(str)});
+    }
+  });
+  return ret;
+}
+
+// Collects the globals whose definitions refer to `val`.
+void collectReferrers(llvm::Value &val,
+                      llvm::SmallVectorImpl<llvm::GlobalValue *> &referrers) {
+  for (auto user : val.users()) {
+    if (auto inst = llvm::dyn_cast<llvm::Instruction>(user)) {
+      referrers.push_back(inst->getParent()->getParent());
+    } else if (auto gv = llvm::dyn_cast<llvm::GlobalValue>(user)) {
+      referrers.push_back(gv);
+    } else if (llvm::isa<llvm::Constant>(user)) {
+      collectReferrers(*user, referrers);
     }
   }
 }
 
+enum class RecompileKind { Full, Incremental, UpToDate };
+
+// Compares the merged module against the code already held by the JIT and, if
+// possible, strips it down to the definitions which changed (directly or via
+// anything they refer to). Unchanged non-local definitions become
+// available_externally or declarations, so they are still visible to the
+// optimizer but linked against the already jitted code.
+RecompileKind prepareIncrementalModule(const Context &context,
+                                       JITContext &jitContext,
+                                       const OptimizerSettings &settings,
+                                       const GlobalHashes &hashes,
+                                       llvm::Module &module) {
+  const auto &state = jitContext.getCompiledState();
+  if (state.hashes.empty() || state.settings != settings ||
+      state.targetCpu != toStringRef(context.targetCpu) ||
+      state.targetFeatures != toStringRef(context.targetFeatures)) {
+    return RecompileKind::Full;
+  }
+
+  interruptPoint(context, "Find changed definitions");
+  llvm::SmallPtrSet<llvm::GlobalValue *, 16> changed;
+  llvm::SmallVector<llvm::GlobalValue *, 16> worklist;
+  bool hasDefinitions = false;
+  enumGlobals(module, [&](llvm::GlobalValue &gv) {
+    if (!isDefinition(gv)) {
+      return;
+    }
+    hasDefinitions = true;
+    const auto name = gv.getName().str();
+    auto it = state.hashes.find(name);
+    auto hashIt = hashes.find(name);
+    if (state.hashes.end() == it || hashes.end() == hashIt ||
+        it->second != hashIt->second) {
+      if (changed.insert(&gv).second) {
+        worklist.push_back(&gv);
+      }
+    }
+  });
+
+  llvm::SmallVector<llvm::GlobalValue *, 8> referrers;
+  while (!worklist.empty()) {
+    auto gv = worklist.pop_back_val();
+    referrers.clear();
+    collectReferrers(*gv, referrers);
+    for (auto referrer : referrers) {
+      if (changed.insert(referrer).second) {
+        worklist.push_back(referrer);
+      }
+    }
+  }
+
+  if (changed.empty()) {
+    return RecompileKind::UpToDate;
+  }
+
+  // Check that everything left unchanged can be shared with the old code.
+  // Local definitions are compiled again, which would silently duplicate any
+  // mutable state, so bail out on these.
+  bool canShare = true;
+  bool allChanged = true;
+  const auto &layout = jitContext.getDataLayout();
+  enumGlobals(module, [&](llvm::GlobalValue &gv) {
+    if (!isDefinition(gv)) {
+      return;
+    }
+    auto var = llvm::dyn_cast<llvm::GlobalVariable>(&gv);
+    if (llvm::isa<llvm::GlobalAlias>(gv) || gv.isThreadLocal() ||
+        (gv.hasLocalLinkage() && var != nullptr && !var->isConstant())) {
+      canShare = false;
+    }
+    if (changed.count(&gv) != 0) {
+      return;
+    }
+    allChanged = false;
+    if (!gv.hasLocalLinkage() &&
+        state.symbols.count(decorate(gv.getName().str(), layout)) == 0) {
+      canShare = false;
+    }
+  });
+  if (!canShare || allChanged || !hasDefinitions) {
+    return RecompileKind::Full;
+  }
+
+  for (auto &&func : module.functions()) {
+    if (isDefinition(func) && !func.hasLocalLinkage() &&
+        changed.count(&func) == 0) {
+      func.setLinkage(llvm::GlobalValue::AvailableExternallyLinkage);
+      func.setComdat(nullptr);
+    }
+  }
+  for (auto &&var : module.globals()) {
+    if (isDefinition(var) && !var.hasLocalLinkage() &&
+        changed.count(&var) == 0) {
+      var.setInitializer(nullptr);
+      var.setLinkage(llvm::GlobalValue::ExternalLinkage);
+      var.setComdat(nullptr);
+    }
+  }
+  return RecompileKind::Incremental;
+}
+
+// Returns the decorated names of all definitions which will be emitted for
+// the module.
+std::vector<std::string> getEmittedSymbols(llvm::Module &module,
+                                           const llvm::DataLayout &layout) {
+  std::vector<std::string> ret;
+  enumGlobals(module, [&](llvm::GlobalValue &gv) {
+    if (isDefinition(gv) && !gv.hasLocalLinkage() && gv.hasName()) {
+      ret.push_back(decorate(gv.getName().str(), layout));
+    }
+  });
+  return ret;
+}
+
 struct JitFinaliser final {
   JITContext &jit;
   bool finalized = false;
@@ -318,6 +568,519 @@ struct JitFinaliser final {
   void finalze() { finalized = true; }
 };
 
+// Adds the time until its destruction to a stage of the context's
+// statistics (if requested).
+class StageTimer final {
+  StageStats *stage;
+  std::chrono::steady_clock::time_point start;
+
+public:
+  StageTimer(const Context &context, StageStats CompileStats::*member)
+      : stage(nullptr != context.stats ? &(context.stats->*member) : nullptr),
+        start(std::chrono::steady_clock::now()) {}
+
+  ~StageTimer() {
+    if (nullptr != stage) {
+      stage->nanoseconds += static_cast<std::uint64_t>(
+          std::chrono::duration_cast<std::chrono::nanoseconds>(
+              std::chrono::steady_clock::now() - start)
+              .count());
+    }
+  }
+
+  void addBytes(std::size_t bytes) {
+    if (nullptr != stage) {
+      stage->bytes += bytes;
+    }
+  }
+};
+
+std::size_t getEmittedBytes(JITContext &jitContext) {
+  CodeMemory total;
+  CodeMemory current;
+  std::size_t generations = 0;
+  jitContext.getMemoryStats(total, current, generations);
+  return total.codeSize + total.dataSize;
+}
+
+void compileFinalModule(const Context &context, JITContext &jitContext,
+                        JitDumper &dumper, const OptimizerSettings &settings,
+                        std::unique_ptr<llvm::Module> finalModule,
+                        bool incremental) {
+  auto &objectCache = jitContext.getObjectCache();
+  objectCache.setDirectory(
+      nullptr != context.objectCacheDir ? context.objectCacheDir : "");
+  bool cached = false;
+  std::string key;
+  // Objects of a module compiled in parts by parallel codegen.
+  std::vector<std::unique_ptr<llvm::MemoryBuffer>> cachedParts;
+  if (objectCache.isEnabled()) {
+    interruptPoint(context, "Compute object cache key");
+    key = getObjectCacheKey(*finalModule, settings,
+                            jitContext.getTargetMachine());
+    finalModule->setModuleIdentifier(key);
+    cached = objectCache.load(key);
+    if (!cached) {
+      cachedParts = objectCache.readParts(key);
+      cached = !cachedParts.empty();
+    }
+    if (cached) {
+      interruptPoint(context, "Object cache hit", key.c_str());
+      if (nullptr != context.stats) {
+        context.stats->objectCacheHit = true;
+      }
+    }
+  }
+
+  if (!cached) {
+    StageTimer timer(context, &CompileStats::optimize);
+    interruptPoint(context, "Optimize final module");
+    optimizeModule(context, jitContext.getTargetMachine(), settings,
+                   *finalModule);
+
+    interruptPoint(context, "Verify final module");
+    verifyModule(context, *finalModule);
+
+    dumper.dumpModule(*finalModule, DumpStage::OptimizedModule);
+  }
+
+  auto symbols =
+      getEmittedSymbols(*finalModule, jitContext.getDataLayout());
+
+  // Code which may still be running on other threads must stay alive even if
+  // nothing is shared with the new module.
+  const bool keepPrevious = incremental || context.preserveOldCode;
+  if (!incremental && context.preserveOldCode) {
+    jitContext.newGeneration();
+  }
+  unsigned threadsCount = context.threadsCount;
+  if (0 == threadsCount) {
+    threadsCount = std::thread::hardware_concurrency();
+  }
+
+  StageTimer codegenTimer(context, &CompileStats::codegen);
+  const auto emittedBefore = getEmittedBytes(jitContext);
+  if (!cachedParts.empty()) {
+    interruptPoint(context, "Load cached module parts");
+    if (jitContext.addObjects(std::move(cachedParts), &dumper, keepPrevious)) {
+      fatal(context, "Can't load module parts");
+    }
+  } else if (!cached && threadsCount > 1) {
+    std::vector<std::string> partKeys;
+    auto objects = codegenParallel(context, std::move(finalModule),
+                                   threadsCount, settings,
+                                   jitContext.getTargetMachine(), objectCache,
+                                   key, partKeys);
+    if (objectCache.isEnabled()) {
+      objectCache.storeParts(key, partKeys);
+    }
+    if (jitContext.addObjects(std::move(objects), &dumper, keepPrevious)) {
+      fatal(context, "Can't load module parts");
+    }
+  } else {
+    interruptPoint(context, "Codegen final module");
+    setupCodegen(jitContext.getTargetMachine(), settings.fastCompile);
+    if (jitContext.addModule(std::move(finalModule), &dumper, keepPrevious)) {
+      fatal(context, "Can't codegen module");
+    }
+  }
+  const auto emittedAfter = getEmittedBytes(jitContext);
+  if (emittedAfter > emittedBefore) {
+    codegenTimer.addBytes(emittedAfter - emittedBefore);
+  }
+
+  // Definitions from the new module supersede the previously jitted ones.
+  auto &state = jitContext.getCompiledState();
+  if (!incremental) {
+    state.symbols.clear();
+  }
+  for (auto &&name : symbols) {
+    auto symbol = jitContext.findSymbolInLastModules(name);
+    if (auto addr = resolveSymbol(symbol)) {
+      state.symbols[name] = addr;
+    } else {
+      state.symbols.erase(name);
+    }
+  }
+}
+
+struct LazyFunc final {
+  std::string name;
+  void **thunkVar = nullptr;
+  bool compiled = false;
+};
+
+// Merged module and settings kept around for lazy compilation, functions are
+// compiled from it on their first call.
+struct LazyState final {
+  std::unique_ptr<llvm::Module> module;
+  Context context;
+  OptimizerSettings settings;
+  std::vector<LazyFunc> functions;
+};
+
+LazyState &getLazyState() {
+  static LazyState state;
+  return state;
+}
+
+// Lazy compilation compiles parts of the module separately, so local
+// definitions may end up duplicated. This is only valid for immutable ones.
+bool canCompileLazily(llvm::Module &module) {
+  bool ret = module.alias_empty();
+  for (auto &&var : module.globals()) {
+    if (isDefinition(var) &&
+        (var.isThreadLocal() || (var.hasLocalLinkage() && !var.isConstant()))) {
+      ret = false;
+    }
+  }
+  return ret;
+}
+
+void collectReferences(const llvm::Value &val,
+                       llvm::SmallVectorImpl<llvm::GlobalValue *> &refs) {
+  if (auto gv = llvm::dyn_cast<llvm::GlobalValue>(&val)) {
+    refs.push_back(const_cast<llvm::GlobalValue *>(gv));
+  } else if (auto constant = llvm::dyn_cast<llvm::Constant>(&val)) {
+    for (auto &&op : constant->operands()) {
+      collectReferences(*op.get(), refs);
+    }
+  }
+}
+
+// Collects the globals referenced by the definition of `gv`.
+void collectDefinitionReferences(
+    const llvm::GlobalValue &gv,
+    llvm::SmallVectorImpl<llvm::GlobalValue *> &refs) {
+  if (auto func = llvm::dyn_cast<llvm::Function>(&gv)) {
+    if (func->hasPersonalityFn()) {
+      collectReferences(*func->getPersonalityFn(), refs);
+    }
+    for (auto &&bb : *func) {
+      for (auto &&inst : bb) {
+        for (auto &&op : inst.operands()) {
+          collectReferences(*op.get(), refs);
+        }
+      }
+    }
+  } else if (auto var = llvm::dyn_cast<llvm::GlobalVariable>(&gv)) {
+    if (var->hasInitializer()) {
+      collectReferences(*var->getInitializer(), refs);
+    }
+  }
+}
+
+// Compiles the `roots` definitions together with everything they refer to
+// which wasn't compiled yet and updates the thunks of the functions which are
+// available now.
+void compileLazyDefinitions(JITContext &jitContext, LazyState &lazy,
+                            llvm::ArrayRef<std::string> roots) {
+  assert(nullptr != lazy.module);
+  auto &state = jitContext.getCompiledState();
+  const auto &layout = jitContext.getDataLayout();
+  auto isCompiled = [&](const llvm::GlobalValue &gv) {
+    return !gv.hasLocalLinkage() &&
+           state.symbols.count(decorate(gv.getName().str(), layout)) != 0;
+  };
+
+  llvm::SmallPtrSet<const llvm::GlobalValue *, 32> needed;
+  llvm::SmallVector<llvm::GlobalValue *, 32> worklist;
+  for (auto &&name : roots) {
+    if (auto gv = lazy.module->getNamedValue(name)) {
+      worklist.push_back(gv);
+    }
+  }
+  while (!worklist.empty()) {
+    auto gv = worklist.pop_back_val();
+    if (!isDefinition(*gv) || isCompiled(*gv) || !needed.insert(gv).second) {
+      continue;
+    }
+    collectDefinitionReferences(*gv, worklist);
+  }
+  if (needed.empty()) {
+    return;
+  }
+
+  llvm::ValueToValueMapTy unused;
+  auto module = llvm::CloneModule(
+#if LDC_LLVM_VER >= 700
+      *lazy.module,
+#else
+      lazy.module.get(),
+#endif
+      unused, [&](const llvm::GlobalValue *gv) -> bool {
+        return needed.count(gv) != 0;
+      });
+
+  const auto &context = lazy.context;
+  interruptPoint(context, "Optimize lazy module", roots.front().c_str());
+  optimizeModule(context, jitContext.getTargetMachine(), lazy.settings,
+                 *module);
+  verifyModule(context, *module);
+
+  auto symbols = getEmittedSymbols(*module, layout);
+  interruptPoint(context, "Codegen lazy module", roots.front().c_str());
+  setupCodegen(jitContext.getTargetMachine(), lazy.settings.fastCompile);
+  if (jitContext.addModule(std::move(module), nullptr, true)) {
+    fatal(context, "Can't codegen module");
+  }
+  for (auto &&name : symbols) {
+    auto symbol = jitContext.findSymbolInLastModules(name);
+    if (auto addr = resolveSymbol(symbol)) {
+      state.symbols[name] = addr;
+    }
+  }
+
+  for (auto &&fun : lazy.functions) {
+    if (fun.compiled) {
+      continue;
+    }
+    auto it = state.symbols.find(decorate(fun.name, layout));
+    if (state.symbols.end() != it) {
+      reinterpret_cast<std::atomic<void *> *>(fun.thunkVar)
+          ->store(it->second, std::memory_order_release);
+      fun.compiled = true;
+    }
+  }
+}
+
+// Called by the lazy stubs on the first call of a function.
+void lazyCompileCallback(uint32_t index) {
+  std::lock_guard<std::mutex> lock(getJitMutex());
+  auto &lazy = getLazyState();
+  assert(index < lazy.functions.size());
+  auto &fun = lazy.functions[index];
+  if (!fun.compiled) {
+    compileLazyDefinitions(getJit(), lazy, fun.name);
+    if (!fun.compiled) {
+      fatal(lazy.context,
+            std::string("Symbol not found in jitted code: \"") + fun.name +
+                "\"");
+    }
+  }
+}
+
+// Creates a stub for every function which compiles it on the first call and
+// then tail calls the compiled code through the thunk.
+std::unique_ptr<llvm::Module> createLazyStubs(JITContext &jitContext,
+                                              LazyState &lazy) {
+  auto &llvmContext = jitContext.getContext();
+  std::unique_ptr<llvm::Module> stubs(
+      new llvm::Module("lazy_stubs", llvmContext));
+  stubs->setDataLayout(jitContext.getDataLayout());
+  stubs->setTargetTriple(lazy.module->getTargetTriple());
+
+  const char *callbackName = "__ldc_jit_compile_lazy";
+  auto callback = llvm::Function::Create(
+      llvm::FunctionType::get(llvm::Type::getVoidTy(llvmContext),
+                              {llvm::Type::getInt32Ty(llvmContext)}, false),
+      llvm::GlobalValue::ExternalLinkage, callbackName, stubs.get());
+  callback->addFnAttr(llvm::Attribute::NoUnwind);
+  jitContext.addSymbol(decorate(callbackName, jitContext.getDataLayout()),
+                       reinterpret_cast<void *>(&lazyCompileCallback));
+
+  auto intPtrType =
+      jitContext.getDataLayout().getIntPtrType(llvmContext);
+  for (std::size_t i = 0; i < lazy.functions.size(); ++i) {
+    auto &fun = lazy.functions[i];
+    auto func = lazy.module->getFunction(fun.name);
+    assert(nullptr != func);
+    auto stub = llvm::Function::Create(func->getFunctionType(),
+                                       llvm::GlobalValue::ExternalLinkage,
+                                       fun.name + ".lazy_stub", stubs.get());
+    stub->setCallingConv(func->getCallingConv());
+    stub->setAttributes(func->getAttributes());
+
+    llvm::IRBuilder<> builder(
+        llvm::BasicBlock::Create(llvmContext, "", stub));
+    builder.CreateCall(callback, builder.getInt32(static_cast<uint32_t>(i)));
+    auto thunkVar = llvm::ConstantExpr::getIntToPtr(
+        llvm::ConstantInt::get(intPtrType,
+                               reinterpret_cast<uintptr_t>(fun.thunkVar)),
+        func->getType()->getPointerTo());
+    auto target = builder.CreateLoad(thunkVar);
+    llvm::SmallVector<llvm::Value *, 6> args;
+    for (auto &arg : stub->args()) {
+      args.push_back(&arg);
+    }
+    auto call = builder.CreateCall(target, args);
+    call->setCallingConv(func->getCallingConv());
+    call->setAttributes(func->getAttributes());
+    call->setTailCallKind(llvm::CallInst::TCK_MustTail);
+    if (stub->getReturnType()->isVoidTy()) {
+      builder.CreateRetVoid();
+    } else {
+      builder.CreateRet(call);
+    }
+  }
+  return stubs;
+}
+
+// Sets up lazy compilation: only bind functions are compiled right away,
+// thunks of all other functions point to stubs compiling them on demand.
+void setupLazyCompilation(const Context &context, JITContext &jitContext,
+                          const JitModuleInfo &moduleInfo,
+                          const OptimizerSettings &settings,
+                          std::unique_ptr<llvm::Module> module) {
+  auto &lazy = getLazyState();
+  lazy.module = std::move(module);
+  // The functions are compiled on their first call, after the compilation
+  // request has returned, so only keep what stays valid: the handlers' data
+  // is kept alive by dynamic_compile.d for lazy compilation.
+  lazy.context = Context();
+  lazy.context.optLevel = context.optLevel;
+  lazy.context.sizeLevel = context.sizeLevel;
+  lazy.context.interruptPointHandler = context.interruptPointHandler;
+  lazy.context.interruptPointHandlerData = context.interruptPointHandlerData;
+  lazy.context.fatalHandler = context.fatalHandler;
+  lazy.context.fatalHandlerData = context.fatalHandlerData;
+  lazy.settings = settings;
+  lazy.functions.clear();
+  for (auto &&fun : moduleInfo.functions()) {
+    if (fun.thunkVar != nullptr) {
+      LazyFunc lazyFunc;
+      lazyFunc.name = fun.name.str();
+      lazyFunc.thunkVar = fun.thunkVar;
+      lazy.functions.push_back(std::move(lazyFunc));
+    }
+  }
+
+  interruptPoint(context, "Codegen lazy stubs");
+  if (context.preserveOldCode) {
+    jitContext.newGeneration();
+  }
+  auto stubs = createLazyStubs(jitContext, lazy);
+  if (jitContext.addModule(std::move(stubs), nullptr,
+                           context.preserveOldCode)) {
+    fatal(context, "Can't codegen lazy stubs");
+  }
+  // Nothing of the previously jitted code can be reused.
+  jitContext.getCompiledState() = CompiledState();
+
+  const auto &layout = jitContext.getDataLayout();
+  std::vector<std::pair<void **, void *>> thunks;
+  for (auto &&fun : lazy.functions) {
+    auto name = decorate(fun.name + ".lazy_stub", layout);
+    auto symbol = jitContext.findSymbolInLastModules(name);
+    auto addr = resolveSymbol(symbol);
+    if (nullptr == addr) {
+      fatal(context, "Lazy stub not found: \"" + name + "\"");
+    }
+    thunks.push_back({fun.thunkVar, addr});
+  }
+  for (auto &&thunk : thunks) {
+    reinterpret_cast<std::atomic<void *> *>(thunk.first)
+        ->store(thunk.second, std::memory_order_release);
+  }
+
+  std::vector<std::string> binds;
+  for (auto &&handle : moduleInfo.getBindHandles()) {
+    binds.push_back(handle.name);
+  }
+  if (!binds.empty()) {
+    compileLazyDefinitions(jitContext, lazy, binds);
+  }
+}
+
+struct LoadedModule final {
+  const RtCompileModuleList *desc;
+  std::unique_ptr<llvm::Module> module;
+};
+
+// Returns the names of the functions which must be jitted: everything called
+// through thunks and everything used by bind.
+std::vector<std::string> getRequiredFunctions(JITContext &jitContext,
+                                              const JitModuleInfo &moduleInfo) {
+  std::vector<std::string> ret;
+  for (auto &&fun : moduleInfo.functions()) {
+    if (fun.thunkVar != nullptr) {
+      ret.push_back(fun.name.str());
+    }
+  }
+  for (auto &&bind : jitContext.getBindInstances()) {
+    for (auto ptr : {bind.second.originalFunc, bind.second.exampleFunc}) {
+      if (ptr != nullptr) {
+        if (auto funcDesc = moduleInfo.getFunc(ptr)) {
+          ret.push_back(funcDesc->name.str());
+        }
+      }
+    }
+  }
+  return ret;
+}
+
+// Modules are loaded lazily, materialize only the functions reachable from
+// `roots` (across all modules) and turn all other functions into
+// declarations, so their bodies are never parsed.
+void materializeRequired(const Context &context,
+                         llvm::ArrayRef<LoadedModule> modules,
+                         llvm::ArrayRef<std::string> roots) {
+  std::vector<std::string> names(roots.begin(), roots.end());
+  llvm::SmallPtrSet<llvm::GlobalValue *, 32> visited;
+  llvm::SmallVector<llvm::GlobalValue *, 32> worklist;
+  llvm::SmallVector<llvm::GlobalValue *, 8> refs;
+
+  // Aliases and global initializers are handled conservatively, everything
+  // they refer to is required.
+  for (auto &&loaded : modules) {
+    for (auto &&var : loaded.module->globals()) {
+      worklist.push_back(&var);
+    }
+    for (auto &&alias : loaded.module->aliases()) {
+      worklist.push_back(&alias);
+    }
+  }
+
+  while (!worklist.empty() || !names.empty()) {
+    if (worklist.empty()) {
+      auto name = std::move(names.back());
+      names.pop_back();
+      for (auto &&loaded : modules) {
+        if (auto gv = loaded.module->getNamedValue(name)) {
+          worklist.push_back(gv);
+        }
+      }
+      continue;
+    }
+
+    auto gv = worklist.pop_back_val();
+    if (!visited.insert(gv).second) {
+      continue;
+    }
+    if (auto err = gv->materialize()) {
+      llvm::consumeError(std::move(err));
+      fatal(context, "Unable to parse IR");
+    }
+    if (gv->isDeclaration()) {
+      // May be defined by another module
+      if (gv->hasName()) {
+        names.push_back(gv->getName().str());
+      }
+      continue;
+    }
+    refs.clear();
+    if (auto alias = llvm::dyn_cast<llvm::GlobalAlias>(gv)) {
+      collectReferences(*alias->getAliasee(), refs);
+    } else {
+      collectDefinitionReferences(*gv, refs);
+    }
+    worklist.append(refs.begin(), refs.end());
+  }
+
+  for (auto &&loaded : modules) {
+    for (auto &&func : loaded.module->functions()) {
+      if (func.isMaterializable() && visited.count(&func) == 0) {
+        func.deleteBody();
+        func.setComdat(nullptr);
+      }
+    }
+    if (auto err = loaded.module->materializeAll()) {
+      llvm::consumeError(std::move(err));
+      fatal(context, "Unable to parse IR");
+    }
+  }
+}
+
 void rtCompileProcessImplSoInternal(const RtCompileModuleList *modlist_head,
                                     const Context &context) {
   if (nullptr == modlist_head) {
@@ -325,7 +1088,23 @@ void rtCompileProcessImplSoInternal(const RtCompileModuleList *modlist_head,
     return;
   }
   interruptPoint(context, "Init");
-  JITContext &myJit = getJit();
+  if (nullptr != context.stats) {
+    *context.stats = CompileStats();
+  }
+  // Independent contexts only compile their bind functions, the thunks of the
+  // @dynamicCompile functions belong to the default context.
+  const bool independent = nullptr != context.jitContext;
+  if (independent && (context.lazyCompile || context.profileInstrument)) {
+    fatal(context, "Lazy compilation and profiling are only supported by the "
+                   "default jit context");
+  }
+  JITContext &myJit = getJit(context.jitContext);
+  // Delivered at the end of the compilation, so that the dump handler never
+  // stalls the jit.
+  JitDumper dumper(context, myJit.getTargetMachine());
+  // The instrumented code may be freed by this compilation.
+  auto &profile = myJit.getProfile();
+  profile.snapshot();
 
   JitModuleInfo moduleInfo(context, modlist_head);
   std::unique_ptr<llvm::Module> finalModule;
@@ -334,81 +1113,150 @@ void rtCompileProcessImplSoInternal(const RtCompileModuleList *modlist_head,
   OptimizerSettings settings;
   settings.optLevel = context.optLevel;
   settings.sizeLevel = context.sizeLevel;
+  settings.fastCompile = context.fastCompile;
+  settings.disableInlining = context.disableInlining;
+  settings.disableLoopUnrolling = context.disableLoopUnrolling;
+  settings.disableLoopVectorization = context.disableLoopVectorization;
+  settings.disableSLPVectorization = context.disableSLPVectorization;
+  settings.passPipeline = toStringRef(context.passPipeline);
+  std::vector<LoadedModule> modules;
+  std::unique_ptr<StageTimer> stageTimer(
+      new StageTimer(context, &CompileStats::parse));
   enumModules(modlist_head, context, [&](const RtCompileModuleList &current) {
     interruptPoint(context, "load IR");
-    auto buff = llvm::MemoryBuffer::getMemBuffer(
-        llvm::StringRef(current.irData,
-                        static_cast<std::size_t>(current.irDataSize)),
-        "", false);
-    interruptPoint(context, "parse IR");
-    auto mod = llvm::parseBitcodeFile(*buff, myJit.getContext());
+    stageTimer->addBytes(static_cast<std::size_t>(current.irDataSize));
+    auto mod = llvm::getLazyBitcodeModule(
+        llvm::MemoryBufferRef(
+            llvm::StringRef(current.irData,
+                            static_cast<std::size_t>(current.irDataSize)),
+            ""),
+        myJit.getContext());
     if (!mod) {
       fatal(context, "Unable to parse IR");
     } else {
-      llvm::Module &module = **mod;
-      const auto name = module.getName();
-      interruptPoint(context, "Verify module", name.data());
-      verifyModule(context, module);
+      modules.push_back({&current, std::move(*mod)});
+    }
+  });
+  if (nullptr != context.stats) {
+    context.stats->modules = modules.size();
+  }
 
-      dumpModule(context, module, DumpStage::OriginalModule);
-      setFunctionsTarget(module, myJit.getTargetMachine());
+  interruptPoint(context, "parse IR");
+  materializeRequired(context, modules,
+                      getRequiredFunctions(myJit, moduleInfo));
 
-      module.setDataLayout(myJit.getTargetMachine().createDataLayout());
+  for (auto &&loaded : modules) {
+    const RtCompileModuleList &current = *loaded.desc;
+    llvm::Module &module = *loaded.module;
+    const auto name = module.getName();
+    stageTimer.reset(new StageTimer(context, &CompileStats::parse));
+    interruptPoint(context, "Verify module", name.data());
+    verifyModule(context, module);
 
-      interruptPoint(context, "setRtCompileVars", name.data());
-      setRtCompileVars(context, module,
-                       toArray(current.varList,
-                               static_cast<std::size_t>(current.varListSize)));
+    dumper.dumpModule(module, DumpStage::OriginalModule);
+    setFunctionsTarget(context, module, myJit.getTargetMachine());
 
-      if (nullptr == finalModule) {
-        finalModule = std::move(*mod);
-      } else {
-        if (llvm::Linker::linkModules(*finalModule, std::move(*mod))) {
-          fatal(context, "Can't merge module");
-        }
-      }
+    module.setDataLayout(myJit.getTargetMachine().createDataLayout());
 
-      for (auto &&sym : toArray(current.symList, static_cast<std::size_t>(
-                                                     current.symListSize))) {
-        myJit.addSymbol(decorate(sym.name, layout), sym.sym);
+    stageTimer.reset(new StageTimer(context, &CompileStats::link));
+    interruptPoint(context, "setRtCompileVars", name.data());
+    setRtCompileVars(context, module,
+                     toArray(current.varList,
+                             static_cast<std::size_t>(current.varListSize)));
+
+    if (nullptr == finalModule) {
+      finalModule = std::move(loaded.module);
+    } else {
+      stageTimer->addBytes(static_cast<std::size_t>(current.irDataSize));
+      if (llvm::Linker::linkModules(*finalModule, std::move(loaded.module))) {
+        fatal(context, "Can't merge module");
       }
     }
-  });
+
+    for (auto &&sym : toArray(current.symList, static_cast<std::size_t>(
+                                                   current.symListSize))) {
+      myJit.addSymbol(decorate(sym.name, layout), sym.sym);
+    }
+  }
 
   assert(nullptr != finalModule);
 
+  stageTimer.reset(new StageTimer(context, &CompileStats::bind));
   interruptPoint(context, "Generate bind functions");
   generateBind(context, myJit, moduleInfo, *finalModule);
-  dumpModule(context, *finalModule, DumpStage::MergedModule);
-  interruptPoint(context, "Optimize final module");
-  optimizeModule(context, myJit.getTargetMachine(), settings, *finalModule);
-
-  interruptPoint(context, "Verify final module");
-  verifyModule(context, *finalModule);
-
-  dumpModule(context, *finalModule, DumpStage::OptimizedModule);
-
-  interruptPoint(context, "Codegen final module");
-  if (nullptr != context.dumpHandler) {
-    auto callback = [&](const char *str, size_t len) {
-      context.dumpHandler(context.dumpHandlerData, DumpStage::FinalAsm, str,
-                          len);
-    };
+  stageTimer.reset();
+  dumper.dumpModule(*finalModule, DumpStage::MergedModule);
 
-    CallbackOstream os(callback);
-    if (myJit.addModule(std::move(finalModule), &os)) {
-      fatal(context, "Can't codegen module");
+  if (context.lazyCompile && !context.profileInstrument &&
+      canCompileLazily(*finalModule)) {
+    JitFinaliser jitFinalizer(myJit);
+    {
+      StageTimer timer(context, &CompileStats::codegen);
+      const auto emittedBefore = getEmittedBytes(myJit);
+      setupLazyCompilation(context, myJit, moduleInfo, settings,
+                           std::move(finalModule));
+      const auto emittedAfter = getEmittedBytes(myJit);
+      if (emittedAfter > emittedBefore) {
+        timer.addBytes(emittedAfter - emittedBefore);
+      }
     }
+    StageTimer bindTimer(context, &CompileStats::bind);
+    interruptPoint(context, "Update bind handles");
+    applyBind(context, myJit, moduleInfo);
+    bindTimer.addBytes(myJit.getBindDataSize());
+    myJit.publishGeneration();
+    jitFinalizer.finalze();
+    dumper.deliver();
+    return;
+  }
+  if (!independent) {
+    getLazyState() = LazyState();
+  }
+
+  auto hashes = hashDefinitions(*finalModule);
+  // Instrumentation and profile data are applied to the whole module.
+  const bool fullProfile = context.profileInstrument || profile.isPending();
+  const auto recompile =
+      fullProfile ? RecompileKind::Full
+                  : prepareIncrementalModule(context, myJit, settings, hashes,
+                                             *finalModule);
+  if (RecompileKind::UpToDate == recompile) {
+    interruptPoint(context, "Jitted code is up to date");
   } else {
-    if (myJit.addModule(std::move(finalModule), nullptr)) {
-      fatal(context, "Can't codegen module");
+    if (RecompileKind::Incremental == recompile) {
+      interruptPoint(context, "Recompile changed definitions");
+    }
+    if (context.profileInstrument) {
+      interruptPoint(context, "Instrument final module");
+      profile.instrument(*finalModule, hashes);
+    } else if (profile.apply(*finalModule, hashes)) {
+      interruptPoint(context, "Apply profile data");
     }
+    compileFinalModule(context, myJit, dumper, settings,
+                       std::move(finalModule),
+                       RecompileKind::Incremental == recompile);
+    if (context.profileInstrument && !profile.getCountersName().empty()) {
+      auto name = decorate(profile.getCountersName(), layout);
+      auto symbol = myJit.findSymbolInLastModules(name);
+      auto addr = resolveSymbol(symbol);
+      if (nullptr == addr) {
+        fatal(context, "Profile counters not found: \"" + name + "\"");
+      }
+      profile.setCounters(addr);
+    }
+    auto &state = myJit.getCompiledState();
+    state.hashes = std::move(hashes);
+    state.settings = settings;
+    state.targetCpu = toStringRef(context.targetCpu);
+    state.targetFeatures = toStringRef(context.targetFeatures);
   }
 
   JitFinaliser jitFinalizer(myJit);
+  stageTimer.reset(new StageTimer(context, &CompileStats::resolve));
   interruptPoint(context, "Resolve functions");
+  std::vector<std::pair<void **, void *>> thunks;
   for (auto &&fun : moduleInfo.functions()) {
-    if (fun.thunkVar == nullptr) {
+    if (fun.thunkVar == nullptr || independent) {
       continue;
     }
     auto decorated = decorate(fun.name, layout);
@@ -419,7 +1267,7 @@ void rtCompileProcessImplSoInternal(const RtCompileModuleList *modlist_head,
                          fun.name.data() + "\" (\"" + decorated + "\")";
       fatal(context, desc);
     } else {
-      *fun.thunkVar = addr;
+      thunks.push_back({fun.thunkVar, addr});
     }
 
     if (nullptr != context.interruptPointHandler) {
@@ -429,9 +1277,26 @@ void rtCompileProcessImplSoInternal(const RtCompileModuleList *modlist_head,
       interruptPoint(context, "Resolved", str.c_str());
     }
   }
+  if (nullptr != context.stats) {
+    context.stats->functions = thunks.size();
+  }
+  // Only publish the new code once everything was resolved, so the thunks
+  // never end up pointing to a mix of old and missing code. Other threads may
+  // be calling through the thunks concurrently.
+  static_assert(sizeof(std::atomic<void *>) == sizeof(void *),
+                "Thunks can't be updated atomically");
+  for (auto &&thunk : thunks) {
+    reinterpret_cast<std::atomic<void *> *>(thunk.first)
+        ->store(thunk.second, std::memory_order_release);
+  }
+  stageTimer.reset(new StageTimer(context, &CompileStats::bind));
   interruptPoint(context, "Update bind handles");
   applyBind(context, myJit, moduleInfo);
+  stageTimer->addBytes(myJit.getBindDataSize());
+  stageTimer.reset();
+  myJit.publishGeneration();
   jitFinalizer.finalze();
+  dumper.deliver();
 }
 
 } // anon namespace
@@ -441,24 +1306,73 @@ EXTERNAL void JIT_API_ENTRYPOINT(const void *modlist_head,
                                  const Context *context, size_t contextSize) {
   assert(nullptr != context);
   assert(sizeof(*context) == contextSize);
+  std::lock_guard<std::mutex> lock(getJitMutex(context->jitContext));
   rtCompileProcessImplSoInternal(
       static_cast<const RtCompileModuleList *>(modlist_head), *context);
 }
 
-EXTERNAL void JIT_REG_BIND_PAYLOAD(void *handle, void *originalFunc,
-                                   void *exampleFunc, const ParamSlice *params,
+EXTERNAL void JIT_REG_BIND_PAYLOAD(void *jitContext, void *handle,
+                                   void *originalFunc, void *exampleFunc,
+                                   const ParamSlice *params,
                                    size_t paramsSize) {
   assert(handle != nullptr);
   assert(originalFunc != nullptr);
   assert(exampleFunc != nullptr);
-  JITContext &myJit = getJit();
+  std::lock_guard<std::mutex> lock(getJitMutex(jitContext));
+  JITContext &myJit = getJit(jitContext);
   myJit.registerBind(handle, originalFunc, exampleFunc,
                      toArray(params, paramsSize));
 }
 
-EXTERNAL void JIT_UNREG_BIND_PAYLOAD(void *handle) {
-  assert(handle != nullptr);
+EXTERNAL void JIT_GET_MEMORY_STATS(MemoryStats *stats, size_t statsSize) {
+  assert(nullptr != stats);
+  assert(sizeof(*stats) == statsSize);
+  std::lock_guard<std::mutex> lock(getJitMutex());
   JITContext &myJit = getJit();
+  CodeMemory total;
+  CodeMemory current;
+  myJit.getMemoryStats(total, current, stats->generations);
+  stats->codeSize = total.codeSize;
+  stats->dataSize = total.dataSize;
+  stats->currentCodeSize = current.codeSize;
+  stats->currentDataSize = current.dataSize;
+  stats->bindDataSize = myJit.getBindDataSize();
+}
+
+EXTERNAL unsigned JIT_ENTER_GENERATION() {
+  return getJit().enterGeneration();
+}
+
+EXTERNAL void JIT_LEAVE_GENERATION(unsigned generation) {
+  getJit().leaveGeneration(generation);
+}
+
+EXTERNAL uint64_t JIT_GET_PROFILE_CALLS() {
+  std::lock_guard<std::mutex> lock(getJitMutex());
+  return getJit().getProfile().getCallsCount();
+}
+
+EXTERNAL size_t JIT_RELEASE_GENERATIONS() {
+  std::lock_guard<std::mutex> lock(getJitMutex());
+  return getJit().releaseGenerations();
+}
+
+EXTERNAL void JIT_UNREG_BIND_PAYLOAD(void *jitContext, void *handle) {
+  assert(handle != nullptr);
+  std::lock_guard<std::mutex> lock(getJitMutex(jitContext));
+  JITContext &myJit = getJit(jitContext);
   myJit.unregisterBind(handle);
 }
+
+EXTERNAL void *JIT_CREATE_CONTEXT() {
+  // Makes sure LLVM is initialized (and shut down) by the default context.
+  std::lock_guard<std::mutex> lock(getJitMutex());
+  getJit();
+  return new IndependentJit();
+}
+
+EXTERNAL void JIT_DESTROY_CONTEXT(void *jitContext) {
+  assert(jitContext != nullptr);
+  delete static_cast<IndependentJit *>(jitContext);
+}
 }
@@ -43,6 +43,42 @@ enum { ApiVersion = LDC_DYNAMIC_COMPILE_API_VERSION };
 #define JIT_UNREG_BIND_PAYLOAD                                                 \
   MAKE_JIT_API_CALL(unregisterBindPayloadImplSo,                               \
                     LDC_DYNAMIC_COMPILE_API_VERSION)
+#define JIT_GET_MEMORY_STATS                                                   \
+  MAKE_JIT_API_CALL(getMemoryStatsImplSo, LDC_DYNAMIC_COMPILE_API_VERSION)
+#define JIT_ENTER_GENERATION                                                   \
+  MAKE_JIT_API_CALL(enterGenerationImplSo, LDC_DYNAMIC_COMPILE_API_VERSION)
+#define JIT_LEAVE_GENERATION                                                   \
+  MAKE_JIT_API_CALL(leaveGenerationImplSo, LDC_DYNAMIC_COMPILE_API_VERSION)
+#define JIT_RELEASE_GENERATIONS                                                \
+  MAKE_JIT_API_CALL(releaseGenerationsImplSo,                                  \
+                    LDC_DYNAMIC_COMPILE_API_VERSION)
+#define JIT_GET_PROFILE_CALLS                                                  \
+  MAKE_JIT_API_CALL(getProfileCallsImplSo, LDC_DYNAMIC_COMPILE_API_VERSION)
+#define JIT_CREATE_CONTEXT                                                     \
+  MAKE_JIT_API_CALL(createJitContextImplSo, LDC_DYNAMIC_COMPILE_API_VERSION)
+#define JIT_DESTROY_CONTEXT                                                    \
+  MAKE_JIT_API_CALL(destroyJitContextImplSo, LDC_DYNAMIC_COMPILE_API_VERSION)
+
+/// Duration of a jit compilation stage and the size of the data it processed
+/// or produced, must be in sync with dynamiccompile.d.
+struct StageStats final {
+  std::uint64_t nanoseconds = 0;
+  std::size_t bytes = 0;
+};
+
+/// Per-stage statistics of a compilation, must be in sync with
+/// dynamiccompile.d.
+struct CompileStats final {
+  StageStats parse;    // bytes: bitcode loaded
+  StageStats link;     // bytes: bitcode merged into the first module
+  StageStats bind;     // bytes: parameters of the bind payloads
+  StageStats optimize; // bytes: always 0
+  StageStats codegen;  // bytes: code and data emitted
+  StageStats resolve;  // bytes: always 0
+  std::size_t modules = 0;
+  std::size_t functions = 0; // resolved functions
+  bool objectCacheHit = false;
+};
 
 typedef void (*InterruptPointHandlerT)(void *, const char *action,
                                        const char *object);
@@ -59,4 +95,32 @@ struct Context final {
   void *fatalHandlerData = nullptr;
   DumpHandlerT dumpHandler = nullptr;
   void *dumpHandlerData = nullptr;
+  // Only dump the functions whose mangled name contains this, null for all.
+  const char *dumpFunctionFilter = nullptr;
+  const char *objectCacheDir = nullptr;
+  bool preserveOldCode = false;
+  unsigned threadsCount = 1;
+  bool lazyCompile = false;
+  bool profileInstrument = false;
+  const char *targetCpu = nullptr;
+  const char *targetFeatures = nullptr;
+  bool fastCompile = false;
+  bool disableInlining = false;
+  bool disableLoopUnrolling = false;
+  bool disableLoopVectorization = false;
+  bool disableSLPVectorization = false;
+  const char *passPipeline = nullptr;
+  CompileStats *stats = nullptr;
+  // Independent jit context to compile into, null for the default one.
+  void *jitContext = nullptr;
+};
+
+/// Memory held by the jit, must be in sync with dynamiccompile.d.
+struct MemoryStats final {
+  std::size_t codeSize = 0;
+  std::size_t dataSize = 0;
+  std::size_t currentCodeSize = 0;
+  std::size_t currentDataSize = 0;
+  std::size_t bindDataSize = 0;
+  std::size_t generations = 0;
 };
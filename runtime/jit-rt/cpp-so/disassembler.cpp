@@ -230,8 +230,8 @@ void processRelocations(SymTable &symTable, uint64_t offset,
 }
 
 void disassemble(const llvm::TargetMachine &tm,
-                 const llvm::object::ObjectFile &object,
-                 llvm::raw_ostream &os) {
+                 const llvm::object::ObjectFile &object, llvm::raw_ostream &os,
+                 llvm::StringRef functionFilter) {
   auto &target = tm.getTarget();
 
   auto mri = tm.getMCRegisterInfo();
@@ -319,6 +319,10 @@ void disassemble(const llvm::TargetMachine &tm,
 
   for (const auto &symbol : object.symbols()) {
     const auto name = llvm::cantFail(symbol.getName());
+    if (!functionFilter.empty() &&
+        llvm::StringRef::npos == name.find(functionFilter)) {
+      continue;
+    }
     const auto secIt = llvm::cantFail(symbol.getSection());
     if (object.section_end() != secIt) {
       const auto sec = *secIt;
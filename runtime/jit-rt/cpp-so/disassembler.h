@@ -13,6 +13,8 @@
 
 #pragma once
 
+#include "llvm/ADT/StringRef.h"
+
 namespace llvm {
 namespace object {
 class ObjectFile;
@@ -21,5 +23,8 @@ class TargetMachine;
 class raw_ostream;
 }
 
+/// Disassembles the functions of the object file. With a non-empty
+/// `functionFilter`, only the functions whose name contains it are printed.
 void disassemble(const llvm::TargetMachine &tm,
-                 const llvm::object::ObjectFile &object, llvm::raw_ostream &os);
+                 const llvm::object::ObjectFile &object, llvm::raw_ostream &os,
+                 llvm::StringRef functionFilter = llvm::StringRef());
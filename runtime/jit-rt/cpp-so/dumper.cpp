@@ -0,0 +1,136 @@
+//===-- dumper.cpp --------------------------------------------------------===//
+//
+//                         LDC – the LLVM D compiler
+//
+// This file is distributed under the Boost Software License. See the LICENSE
+// file for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "dumper.h"
+
+#include <memory>
+#include <utility>
+
+#include "disassembler.h"
+
+#include "llvm/IR/Module.h"
+#include "llvm/Object/ObjectFile.h"
+#include "llvm/Support/raw_ostream.h"
+
+namespace {
+thread_local JitDumper *currentDumper = nullptr;
+}
+
+JitDumper::JitDumper(const Context &c, const llvm::TargetMachine &tm)
+    : context(c), targetmachine(tm),
+      filter(nullptr != c.dumpFunctionFilter ? c.dumpFunctionFilter : ""),
+      previous(currentDumper) {
+  currentDumper = this;
+}
+
+JitDumper::~JitDumper() {
+  stopWorker();
+  currentDumper = previous;
+}
+
+JitDumper *JitDumper::getCurrent() { return currentDumper; }
+
+bool JitDumper::isDumped(llvm::StringRef name) const {
+  return filter.empty() || llvm::StringRef::npos != name.find(filter);
+}
+
+void JitDumper::dumpModule(const llvm::Module &module, DumpStage stage) {
+  if (!isEnabled()) {
+    return;
+  }
+
+  std::string text;
+  llvm::raw_string_ostream os(text);
+  if (filter.empty()) {
+    module.print(os, nullptr, false, true);
+  } else {
+    for (auto &&func : module.functions()) {
+      if (!func.isDeclaration() && isDumped(func.getName())) {
+        func.print(os);
+      }
+    }
+  }
+  os.flush();
+
+  std::lock_guard<std::mutex> lock(mutex);
+  dumps.push_back({stage, std::move(text)});
+}
+
+void JitDumper::dumpObject(llvm::MemoryBufferRef object) {
+  if (!isEnabled()) {
+    return;
+  }
+
+  // The object buffer may be released by the jit once it is loaded.
+  std::shared_ptr<llvm::MemoryBuffer> copy(llvm::MemoryBuffer::getMemBufferCopy(
+      object.getBuffer(), object.getBufferIdentifier()));
+  Dump *dump = nullptr;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    dumps.push_back({DumpStage::FinalAsm, std::string()});
+    dump = &dumps.back(); // stays valid, only appended to
+  }
+  post([this, copy, dump]() {
+    auto objFile =
+        llvm::object::ObjectFile::createObjectFile(copy->getMemBufferRef());
+    if (!objFile) {
+      llvm::consumeError(objFile.takeError());
+      return;
+    }
+    llvm::raw_string_ostream os(dump->text);
+    disassemble(targetmachine, **objFile, os, filter);
+  });
+}
+
+void JitDumper::deliver() {
+  stopWorker();
+  for (auto &&dump : dumps) {
+    if (!dump.text.empty()) {
+      context.dumpHandler(context.dumpHandlerData, dump.stage,
+                          dump.text.data(), dump.text.size());
+    }
+  }
+  dumps.clear();
+}
+
+void JitDumper::post(std::function<void()> job) {
+  std::lock_guard<std::mutex> lock(mutex);
+  jobs.push_back(std::move(job));
+  if (!worker.joinable()) {
+    worker = std::thread([this]() { runJobs(); });
+  }
+  condition.notify_one();
+}
+
+void JitDumper::runJobs() {
+  std::unique_lock<std::mutex> lock(mutex);
+  while (true) {
+    condition.wait(lock, [this]() { return stopping || !jobs.empty(); });
+    if (jobs.empty()) {
+      return;
+    }
+    auto job = std::move(jobs.front());
+    jobs.pop_front();
+    lock.unlock();
+    job();
+    lock.lock();
+  }
+}
+
+void JitDumper::stopWorker() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  condition.notify_one();
+  if (worker.joinable()) {
+    worker.join();
+  }
+  stopping = false;
+}
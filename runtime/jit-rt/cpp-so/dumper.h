@@ -0,0 +1,87 @@
+//===-- dumper.h - jit support ----------------------------------*- C++ -*-===//
+//
+//                         LDC – the LLVM D compiler
+//
+// This file is distributed under the Boost Software License. See the LICENSE
+// file for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Jit runtime - collects the module and assembly dumps of a compilation.
+//
+//===----------------------------------------------------------------------===//
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/MemoryBuffer.h"
+
+#include "context.h"
+
+namespace llvm {
+class Module;
+class TargetMachine;
+} // namespace llvm
+
+/// Collects the dumps of a compilation and passes them to the dump handler
+/// once the compilation is done. The jitted objects are copied and
+/// disassembled on a background thread, so that they don't stall the jit.
+/// With a function filter, only the matching functions are dumped instead of
+/// whole modules. If the compilation fails, the dumps collected so far are
+/// delivered before the error is reported (see fatal()).
+class JitDumper final {
+  struct Dump final {
+    DumpStage stage;
+    std::string text;
+  };
+
+  const Context &context;
+  const llvm::TargetMachine &targetmachine;
+  const std::string filter;
+
+  // Dumps in report order, filled in by the worker for the objects.
+  std::deque<Dump> dumps;
+  std::deque<std::function<void()>> jobs;
+  std::mutex mutex;
+  std::condition_variable condition;
+  std::thread worker;
+  bool stopping = false;
+  JitDumper *const previous;
+
+  void post(std::function<void()> job);
+  void runJobs();
+  void stopWorker();
+
+public:
+  JitDumper(const Context &context, const llvm::TargetMachine &tm);
+  ~JitDumper();
+
+  JitDumper(const JitDumper &) = delete;
+  JitDumper &operator=(const JitDumper &) = delete;
+
+  bool isEnabled() const { return nullptr != context.dumpHandler; }
+
+  /// Returns whether the function with the (mangled) name passes the filter.
+  bool isDumped(llvm::StringRef name) const;
+
+  /// Prints the module, must be called before it is modified further.
+  void dumpModule(const llvm::Module &module, DumpStage stage);
+
+  /// Disassembles a copy of the object in the background. Can be called
+  /// concurrently.
+  void dumpObject(llvm::MemoryBufferRef object);
+
+  /// Waits for the background work and passes all dumps to the dump handler
+  /// on the calling thread.
+  void deliver();
+
+  /// Returns the dumper of the compilation running on this thread, if any.
+  static JitDumper *getCurrent();
+};
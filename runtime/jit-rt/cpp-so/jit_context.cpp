@@ -14,6 +14,7 @@
 
 #include "jit_context.h"
 
+#include <algorithm>
 #include <cassert>
 
 #include "llvm/ADT/StringExtras.h"
@@ -39,6 +40,8 @@ llvm::SmallVector<std::string, 4> getHostAttrs() {
   return features;
 }
 
+} // anon namespace
+
 std::unique_ptr<llvm::TargetMachine> createTargetMachine() {
   llvm::InitializeNativeTarget();
   llvm::InitializeNativeTargetDisassembler();
@@ -62,6 +65,41 @@ std::unique_ptr<llvm::TargetMachine> createTargetMachine() {
   return ret;
 }
 
+void setupCodegen(llvm::TargetMachine &targetMachine, bool fastCompile) {
+  targetMachine.setOptLevel(fastCompile ? llvm::CodeGenOpt::None
+                                        : llvm::CodeGenOpt::Default);
+  targetMachine.setFastISel(fastCompile);
+}
+
+namespace {
+
+// Counts the memory allocated for the jitted code.
+class CountingMemoryManager final : public llvm::SectionMemoryManager {
+  std::shared_ptr<CodeMemory> memory;
+
+public:
+  explicit CountingMemoryManager(std::shared_ptr<CodeMemory> mem)
+      : memory(std::move(mem)) {
+    assert(nullptr != memory);
+  }
+
+  uint8_t *allocateCodeSection(uintptr_t size, unsigned alignment,
+                               unsigned sectionID,
+                               llvm::StringRef sectionName) override {
+    memory->codeSize += size;
+    return llvm::SectionMemoryManager::allocateCodeSection(
+        size, alignment, sectionID, sectionName);
+  }
+
+  uint8_t *allocateDataSection(uintptr_t size, unsigned alignment,
+                               unsigned sectionID, llvm::StringRef sectionName,
+                               bool isReadOnly) override {
+    memory->dataSize += size;
+    return llvm::SectionMemoryManager::allocateDataSection(
+        size, alignment, sectionID, sectionName, isReadOnly);
+  }
+};
+
 auto getSymbolInProcess(const std::string &name)
     -> decltype(llvm::RTDyldMemoryManager::getSymbolAddressInProcess(name)) {
   assert(!name.empty());
@@ -77,14 +115,13 @@ auto getSymbolInProcess(const std::string &name)
 
 } // anon namespace
 
-JITContext::ListenerCleaner::ListenerCleaner(JITContext &o,
-                                             llvm::raw_ostream *stream)
+JITContext::ListenerCleaner::ListenerCleaner(JITContext &o, JitDumper *dumper)
     : owner(o) {
-  owner.listenerlayer.getTransform().stream = stream;
+  owner.listenerlayer.getTransform().dumper = dumper;
 }
 
 JITContext::ListenerCleaner::~ListenerCleaner() {
-  owner.listenerlayer.getTransform().stream = nullptr;
+  owner.listenerlayer.getTransform().dumper = nullptr;
 }
 
 JITContext::JITContext()
@@ -95,27 +132,31 @@ JITContext::JITContext()
       execSession(stringPool), resolver(createResolver()),
       objectLayer(execSession,
                   [this](llvm::orc::VModuleKey) {
-                    return ObjectLayerT::Resources{
-                        std::make_shared<llvm::SectionMemoryManager>(),
-                        resolver};
+                    return ObjectLayerT::Resources{createMemoryManager(),
+                                                   resolver};
                   }),
 #else
-      objectLayer(
-          []() { return std::make_shared<llvm::SectionMemoryManager>(); }),
+      objectLayer([this]() { return createMemoryManager(); }),
 #endif
-      listenerlayer(objectLayer, ModuleListener(*targetmachine)),
-      compileLayer(listenerlayer, llvm::orc::SimpleCompiler(*targetmachine)) {
+      listenerlayer(objectLayer, ModuleListener()),
+      compileLayer(listenerlayer,
+                   llvm::orc::SimpleCompiler(*targetmachine, &objectCache)) {
   llvm::sys::DynamicLibrary::LoadLibraryPermanently(nullptr);
+  newGeneration();
+  publishGeneration();
 }
 
 JITContext::~JITContext() {}
 
 bool JITContext::addModule(std::unique_ptr<llvm::Module> module,
-                           llvm::raw_ostream *asmListener) {
+                           JitDumper *dumper, bool keepPrevious) {
   assert(nullptr != module);
-  reset();
+  if (!keepPrevious) {
+    reset();
+  }
 
-  ListenerCleaner cleaner(*this, asmListener);
+  ListenerCleaner cleaner(*this, dumper);
+  lastModulesBegin = moduleHandles.size();
   // Add the set to the JIT with the resolver we created above
 #if LDC_LLVM_VER >= 700
   auto handle = execSession.allocateVModule();
@@ -124,22 +165,78 @@ bool JITContext::addModule(std::unique_ptr<llvm::Module> module,
     execSession.releaseVModule(handle);
     return true;
   }
-  moduleHandle = handle;
+  addHandle(handle);
 #else
   auto result = compileLayer.addModule(std::move(module), createResolver());
   if (!result) {
     return true;
   }
-  moduleHandle = result.get();
+  addHandle(result.get());
 #endif
-  compiled = true;
   return false;
 }
 
 llvm::JITSymbol JITContext::findSymbol(const std::string &name) {
+  auto it = compiledState.symbols.find(name);
+  if (compiledState.symbols.end() != it) {
+    return llvm::JITSymbol(reinterpret_cast<llvm::JITTargetAddress>(it->second),
+                           llvm::JITSymbolFlags::Exported);
+  }
   return compileLayer.findSymbol(name, false);
 }
 
+bool JITContext::addObjects(
+    std::vector<std::unique_ptr<llvm::MemoryBuffer>> objects,
+    JitDumper *dumper, bool keepPrevious) {
+  if (!keepPrevious) {
+    reset();
+  }
+
+  ListenerCleaner cleaner(*this, dumper);
+  lastModulesBegin = moduleHandles.size();
+  for (auto &&object : objects) {
+    assert(nullptr != object);
+#if LDC_LLVM_VER >= 700
+    auto handle = execSession.allocateVModule();
+    if (auto err = listenerlayer.addObject(handle, std::move(object))) {
+      llvm::consumeError(std::move(err));
+      execSession.releaseVModule(handle);
+      return true;
+    }
+    addHandle(handle);
+#else
+    auto binary = llvm::object::ObjectFile::createObjectFile(
+        object->getMemBufferRef());
+    if (!binary) {
+      llvm::consumeError(binary.takeError());
+      return true;
+    }
+    auto owningBinary =
+        std::make_shared<llvm::object::OwningBinary<llvm::object::ObjectFile>>(
+            std::move(*binary), std::move(object));
+    auto result =
+        listenerlayer.addObject(std::move(owningBinary), createResolver());
+    if (!result) {
+      llvm::consumeError(result.takeError());
+      return true;
+    }
+    addHandle(result.get());
+#endif
+  }
+  return false;
+}
+
+llvm::JITSymbol JITContext::findSymbolInLastModules(const std::string &name) {
+  assert(lastModulesBegin <= moduleHandles.size());
+  for (auto i = lastModulesBegin; i < moduleHandles.size(); ++i) {
+    auto symbol = compileLayer.findSymbolIn(moduleHandles[i], name, false);
+    if (symbol) {
+      return symbol;
+    }
+  }
+  return nullptr;
+}
+
 void JITContext::clearSymMap() { symMap.clear(); }
 
 void JITContext::addSymbol(std::string &&name, void *value) {
@@ -147,11 +244,111 @@ void JITContext::addSymbol(std::string &&name, void *value) {
 }
 
 void JITContext::reset() {
-  if (compiled) {
-    removeModule(moduleHandle);
-    moduleHandle = {};
-    compiled = false;
+  for (auto &&handle : moduleHandles) {
+    removeModule(handle);
+  }
+  moduleHandles.clear();
+  lastModulesBegin = 0;
+  compiledState = CompiledState();
+  {
+    std::lock_guard<std::mutex> lock(generationsMutex);
+    generations.clear();
+  }
+  newGeneration();
+  publishGeneration();
+}
+
+void JITContext::newGeneration() {
+  std::lock_guard<std::mutex> lock(generationsMutex);
+  buildingGeneration = ++lastGeneration;
+  generations[buildingGeneration];
+}
+
+void JITContext::publishGeneration() {
+  std::lock_guard<std::mutex> lock(generationsMutex);
+  currentGeneration = buildingGeneration;
+}
+
+unsigned JITContext::enterGeneration() {
+  std::lock_guard<std::mutex> lock(generationsMutex);
+  auto it = generations.find(currentGeneration);
+  assert(generations.end() != it);
+  ++it->second.readers;
+  return currentGeneration;
+}
+
+void JITContext::leaveGeneration(unsigned generation) {
+  std::lock_guard<std::mutex> lock(generationsMutex);
+  auto it = generations.find(generation);
+  if (generations.end() != it) {
+    assert(it->second.readers > 0);
+    --it->second.readers;
+  }
+}
+
+std::size_t JITContext::releaseGenerations() {
+  std::vector<ModuleHandleT> handles;
+  std::size_t count = 0;
+  {
+    std::lock_guard<std::mutex> lock(generationsMutex);
+    for (auto it = generations.begin(); it != generations.end();) {
+      if (it->first != currentGeneration && it->first != buildingGeneration &&
+          0 == it->second.readers) {
+        handles.insert(handles.end(), it->second.handles.begin(),
+                       it->second.handles.end());
+        it = generations.erase(it);
+        ++count;
+      } else {
+        ++it;
+      }
+    }
   }
+  for (auto &&handle : handles) {
+    removeModule(handle);
+    moduleHandles.erase(
+        std::find(moduleHandles.begin(), moduleHandles.end(), handle));
+  }
+  lastModulesBegin = moduleHandles.size();
+  return count;
+}
+
+void JITContext::getMemoryStats(CodeMemory &total, CodeMemory &current,
+                                std::size_t &generationsCount) {
+  std::lock_guard<std::mutex> lock(generationsMutex);
+  total = CodeMemory();
+  current = CodeMemory();
+  for (auto &&it : generations) {
+    const auto &mem = *it.second.memory;
+    total.codeSize += mem.codeSize;
+    total.dataSize += mem.dataSize;
+    if (it.first == currentGeneration) {
+      current = mem;
+    }
+  }
+  generationsCount = generations.size();
+}
+
+std::size_t JITContext::getBindDataSize() const {
+  std::size_t ret = 0;
+  for (auto &&bind : bindInstances) {
+    for (auto &&param : bind.second.params) {
+      ret += param.size;
+    }
+  }
+  return ret;
+}
+
+void JITContext::addHandle(const ModuleHandleT &handle) {
+  moduleHandles.push_back(handle);
+  std::lock_guard<std::mutex> lock(generationsMutex);
+  generations[buildingGeneration].handles.push_back(handle);
+}
+
+std::shared_ptr<llvm::RuntimeDyld::MemoryManager>
+JITContext::createMemoryManager() {
+  std::lock_guard<std::mutex> lock(generationsMutex);
+  return std::make_shared<CountingMemoryManager>(
+      generations[buildingGeneration].memory);
 }
 
 void JITContext::registerBind(void *handle, void *originalFunc,
@@ -185,7 +382,7 @@ std::shared_ptr<llvm::orc::SymbolResolver> JITContext::createResolver() {
   return llvm::orc::createLegacyLookupResolver(
       execSession,
       [this](const std::string &name) -> llvm::JITSymbol {
-        if (auto Sym = compileLayer.findSymbol(name, false)) {
+        if (auto Sym = findSymbol(name)) {
           return Sym;
         } else if (auto Err = Sym.takeError()) {
           return std::move(Err);
@@ -213,7 +410,7 @@ std::shared_ptr<llvm::JITSymbolResolver> JITContext::createResolver() {
   // Lambda 2: Search for external symbols in the host process.
   return llvm::orc::createLambdaResolver(
       [this](const std::string &name) {
-        if (auto Sym = compileLayer.findSymbol(name, false)) {
+        if (auto Sym = findSymbol(name)) {
           return Sym;
         }
         return llvm::JITSymbol(nullptr);
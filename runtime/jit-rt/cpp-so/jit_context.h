@@ -16,55 +16,79 @@
 
 #include <map>
 #include <memory>
+#include <mutex>
+#include <string>
 #include <utility>
+#include <vector>
 
 #include "llvm/ADT/MapVector.h"
 #include "llvm/ExecutionEngine/JITSymbol.h"
+#include "llvm/ExecutionEngine/RuntimeDyld.h"
 #include "llvm/ExecutionEngine/Orc/CompileUtils.h"
 #include "llvm/ExecutionEngine/Orc/IRCompileLayer.h"
 #include "llvm/ExecutionEngine/Orc/LambdaResolver.h"
 #include "llvm/ExecutionEngine/Orc/ObjectTransformLayer.h"
 #include "llvm/ExecutionEngine/Orc/RTDyldObjectLinkingLayer.h"
 #include "llvm/IR/LLVMContext.h"
-#include "llvm/Support/ManagedStatic.h"
 
 #if LDC_LLVM_VER >= 700
 #include "llvm/ExecutionEngine/Orc/Legacy.h"
 #endif
 
 #include "context.h"
-#include "disassembler.h"
+#include "dumper.h"
+#include "object_cache.h"
+#include "optimizer.h"
+#include "profile.h"
 
 namespace llvm {
-class raw_ostream;
+class MemoryBuffer;
 class TargetMachine;
 } // namespace llvm
 
+/// Creates a target machine for the host.
+std::unique_ptr<llvm::TargetMachine> createTargetMachine();
+
+/// Switches the target machine between the default codegen pipeline and
+/// unoptimized codegen with FastISel.
+void setupCodegen(llvm::TargetMachine &targetMachine, bool fastCompile);
+
 using SymMap = std::map<std::string, void *>;
 
+/// Describes the code currently held by the JIT, so later compilations can
+/// recompile only the definitions which actually changed.
+struct CompiledState final {
+  /// Hashes of all definitions of the last merged module, by IR name.
+  std::map<std::string, std::size_t> hashes;
+  /// Current addresses of the jitted non-local definitions, by decorated name.
+  SymMap symbols;
+  OptimizerSettings settings;
+  std::string targetCpu;
+  std::string targetFeatures;
+};
+
+/// Executable and data memory allocated for jitted code.
+struct CodeMemory final {
+  std::size_t codeSize = 0;
+  std::size_t dataSize = 0;
+};
+
 class JITContext final {
 private:
   struct ModuleListener {
-    llvm::TargetMachine &targetmachine;
-    llvm::raw_ostream *stream = nullptr;
-
-    ModuleListener(llvm::TargetMachine &tm) : targetmachine(tm) {}
+    JitDumper *dumper = nullptr;
 
     template <typename T> auto operator()(T &&object) -> T {
-      if (nullptr != stream) {
+      if (nullptr != dumper) {
 #if LDC_LLVM_VER >= 700
-        auto objFile =
-            llvm::cantFail(llvm::object::ObjectFile::createObjectFile(
-                object->getMemBufferRef()));
-        disassemble(targetmachine, *objFile, *stream);
+        dumper->dumpObject(object->getMemBufferRef());
 #else
-        disassemble(targetmachine, *object->getBinary(), *stream);
+        dumper->dumpObject(object->getBinary()->getMemoryBufferRef());
 #endif
       }
       return std::move(object);
     }
   };
-  llvm::llvm_shutdown_obj shutdownObj;
   std::unique_ptr<llvm::TargetMachine> targetmachine;
   const llvm::DataLayout dataLayout;
 #if LDC_LLVM_VER >= 800
@@ -88,13 +112,31 @@ private:
 #else
   using ModuleHandleT = CompileLayerT::ModuleHandleT;
 #endif
+  JitObjectCache objectCache;
+  JitProfile profile;
   ObjectLayerT objectLayer;
   ListenerLayerT listenerlayer;
   CompileLayerT compileLayer;
   llvm::LLVMContext context;
-  bool compiled = false;
-  ModuleHandleT moduleHandle;
+  std::vector<ModuleHandleT> moduleHandles;
+  std::size_t lastModulesBegin = 0;
+
+  // All code jitted since the last full recompilation forms a generation.
+  // Old generations are kept until released, as other threads may still be
+  // executing them.
+  struct Generation final {
+    std::vector<ModuleHandleT> handles;
+    std::shared_ptr<CodeMemory> memory = std::make_shared<CodeMemory>();
+    std::size_t readers = 0;
+  };
+  std::map<unsigned, Generation> generations;
+  unsigned lastGeneration = 0;
+  unsigned currentGeneration = 0;
+  unsigned buildingGeneration = 0;
+  // Guards the generation readers, which don't take the jit lock.
+  std::mutex generationsMutex;
   SymMap symMap;
+  CompiledState compiledState;
 
   struct BindDesc final {
     void *originalFunc;
@@ -106,7 +148,7 @@ private:
 
   struct ListenerCleaner final {
     JITContext &owner;
-    ListenerCleaner(JITContext &o, llvm::raw_ostream *stream);
+    ListenerCleaner(JITContext &o, JitDumper *dumper);
     ~ListenerCleaner();
   };
 
@@ -117,11 +159,51 @@ public:
   llvm::TargetMachine &getTargetMachine() { return *targetmachine; }
   const llvm::DataLayout &getDataLayout() const { return dataLayout; }
 
-  bool addModule(std::unique_ptr<llvm::Module> module,
-                 llvm::raw_ostream *asmListener);
+  JitObjectCache &getObjectCache() { return objectCache; }
+
+  JitProfile &getProfile() { return profile; }
+
+  /// Adds the module to the JIT. Unless `keepPrevious` is set, all previously
+  /// added modules are removed first. The emitted objects are passed to the
+  /// dumper, if any.
+  bool addModule(std::unique_ptr<llvm::Module> module, JitDumper *dumper,
+                 bool keepPrevious = false);
+
+  /// Adds already compiled object files to the JIT (see addModule).
+  bool addObjects(std::vector<std::unique_ptr<llvm::MemoryBuffer>> objects,
+                  JitDumper *dumper, bool keepPrevious = false);
 
   llvm::JITSymbol findSymbol(const std::string &name);
 
+  /// Looks up the symbol only in what was added by the last addModule() or
+  /// addObjects() call.
+  llvm::JITSymbol findSymbolInLastModules(const std::string &name);
+
+  CompiledState &getCompiledState() { return compiledState; }
+
+  /// Starts a new generation, subsequently added code is put into it.
+  void newGeneration();
+
+  /// Makes the generation being built the current one, must be called after
+  /// its code was published.
+  void publishGeneration();
+
+  /// Registers a reader of the current generation, which won't be released
+  /// until leaveGeneration() is called with the returned id.
+  unsigned enterGeneration();
+
+  void leaveGeneration(unsigned generation);
+
+  /// Frees all old generations without readers, returns their count.
+  std::size_t releaseGenerations();
+
+  /// Returns the memory held by all generations and by the current one.
+  void getMemoryStats(CodeMemory &total, CodeMemory &current,
+                      std::size_t &generationsCount);
+
+  /// Returns the size of all registered bind payloads.
+  std::size_t getBindDataSize() const;
+
   llvm::LLVMContext &getContext() { return context; }
 
   void clearSymMap();
@@ -142,6 +224,10 @@ public:
   }
 
 private:
+  void addHandle(const ModuleHandleT &handle);
+
+  std::shared_ptr<llvm::RuntimeDyld::MemoryManager> createMemoryManager();
+
   void removeModule(const ModuleHandleT &handle);
 
 #if LDC_LLVM_VER >= 700
@@ -0,0 +1,184 @@
+//===-- object_cache.cpp --------------------------------------------------===//
+//
+//                         LDC – the LLVM D compiler
+//
+// This file is distributed under the Boost Software License. See the LICENSE
+// file for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "object_cache.h"
+
+#include <cassert>
+
+#include "optimizer.h"
+
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/Config/llvm-config.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MD5.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Target/TargetMachine.h"
+
+namespace {
+const char *const KeyPrefix = "ldc-jit-";
+}
+
+std::string JitObjectCache::getObjectPath(llvm::StringRef key) const {
+  llvm::SmallString<128> path(directory);
+  llvm::sys::path::append(path, key + ".o");
+  return path.str().str();
+}
+
+void JitObjectCache::setDirectory(llvm::StringRef dir) {
+  directory = dir.str();
+  loadedKey.clear();
+  loadedObject.reset();
+}
+
+bool JitObjectCache::load(llvm::StringRef key) {
+  loadedKey.clear();
+  loadedObject = read(key);
+  if (loadedObject == nullptr) {
+    return false;
+  }
+  loadedKey = key.str();
+  return true;
+}
+
+std::unique_ptr<llvm::MemoryBuffer>
+JitObjectCache::read(llvm::StringRef key) const {
+  assert(isEnabled());
+  auto buffer = llvm::MemoryBuffer::getFile(getObjectPath(key), -1, false);
+  if (!buffer) {
+    return nullptr;
+  }
+  return std::move(*buffer);
+}
+
+void JitObjectCache::store(llvm::StringRef key,
+                           llvm::MemoryBufferRef obj) const {
+  assert(isEnabled());
+  // Write to a temporary file first and rename it afterwards, so concurrent
+  // processes never observe partially written objects.
+  if (llvm::sys::fs::create_directories(directory)) {
+    return;
+  }
+  llvm::SmallString<128> model(directory);
+  llvm::sys::path::append(model, key + "-%%%%%%.tmp");
+  int fd = -1;
+  llvm::SmallString<128> tempPath;
+  if (llvm::sys::fs::createUniqueFile(model, fd, tempPath)) {
+    return;
+  }
+  {
+    llvm::raw_fd_ostream os(fd, /*shouldClose*/ true);
+    os << obj.getBuffer();
+    os.close();
+    if (os.has_error()) {
+      os.clear_error();
+      llvm::sys::fs::remove(tempPath);
+      return;
+    }
+  }
+  if (llvm::sys::fs::rename(tempPath, getObjectPath(key))) {
+    llvm::sys::fs::remove(tempPath);
+  }
+}
+
+void JitObjectCache::storeParts(
+    llvm::StringRef key, const std::vector<std::string> &partKeys) const {
+  assert(isEnabled());
+  std::string list;
+  for (auto &&partKey : partKeys) {
+    list += partKey;
+    list += '\n';
+  }
+  store((key + ".parts").str(), llvm::MemoryBufferRef(list, key));
+}
+
+std::vector<std::unique_ptr<llvm::MemoryBuffer>>
+JitObjectCache::readParts(llvm::StringRef key) const {
+  std::vector<std::unique_ptr<llvm::MemoryBuffer>> objects;
+  auto list = read((key + ".parts").str());
+  if (list == nullptr) {
+    return objects;
+  }
+  llvm::SmallVector<llvm::StringRef, 16> partKeys;
+  list->getBuffer().split(partKeys, '\n', -1, /*KeepEmpty*/ false);
+  for (auto &&partKey : partKeys) {
+    auto obj = read(partKey);
+    if (obj == nullptr) {
+      objects.clear();
+      break;
+    }
+    objects.push_back(std::move(obj));
+  }
+  return objects;
+}
+
+void JitObjectCache::notifyObjectCompiled(const llvm::Module *module,
+                                          llvm::MemoryBufferRef obj) {
+  assert(module != nullptr);
+  const auto &key = module->getModuleIdentifier();
+  if (isEnabled() && llvm::StringRef(key).startswith(KeyPrefix)) {
+    store(key, obj);
+  }
+}
+
+std::unique_ptr<llvm::MemoryBuffer>
+JitObjectCache::getObject(const llvm::Module *module) {
+  assert(module != nullptr);
+  if (loadedObject == nullptr ||
+      module->getModuleIdentifier() != loadedKey) {
+    return nullptr;
+  }
+  loadedKey.clear();
+  return std::move(loadedObject);
+}
+
+std::string getObjectCacheKey(const llvm::Module &module,
+                              const OptimizerSettings &settings,
+                              const llvm::TargetMachine &targetMachine) {
+  llvm::SmallString<0> bitcode;
+  {
+    llvm::raw_svector_ostream os(bitcode);
+#if LDC_LLVM_VER >= 700
+    llvm::WriteBitcodeToFile(module, os);
+#else
+    llvm::WriteBitcodeToFile(&module, os);
+#endif
+  }
+
+  llvm::MD5 hasher;
+  auto addString = [&](llvm::StringRef str) {
+    hasher.update(str);
+    // Separator, so adjacent strings can't alias each other.
+    const uint8_t separator = 0;
+    hasher.update(llvm::ArrayRef<uint8_t>(separator));
+  };
+  addString(LLVM_VERSION_STRING);
+  addString(std::to_string(LDC_DYNAMIC_COMPILE_API_VERSION));
+  addString(std::to_string(settings.optLevel));
+  addString(std::to_string(settings.sizeLevel));
+  addString(settings.fastCompile ? "fast" : "default");
+  addString(std::string(settings.disableInlining ? "i" : "") +
+            (settings.disableLoopUnrolling ? "u" : "") +
+            (settings.disableLoopVectorization ? "v" : "") +
+            (settings.disableSLPVectorization ? "s" : ""));
+  addString(settings.passPipeline);
+  addString(targetMachine.getTargetTriple().str());
+  addString(targetMachine.getTargetCPU());
+  addString(targetMachine.getTargetFeatureString());
+  hasher.update(bitcode.str());
+
+  llvm::MD5::MD5Result result;
+  hasher.final(result);
+  llvm::SmallString<32> str;
+  llvm::MD5::stringifyResult(result, str);
+  return KeyPrefix + str.str().str();
+}
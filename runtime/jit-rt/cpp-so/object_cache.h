@@ -0,0 +1,79 @@
+//===-- object_cache.h - jit support ----------------------------*- C++ -*-===//
+//
+//                         LDC – the LLVM D compiler
+//
+// This file is distributed under the Boost Software License. See the LICENSE
+// file for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Jit runtime - persistent on-disk cache for jitted object files.
+//
+//===----------------------------------------------------------------------===//
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "llvm/ExecutionEngine/ObjectCache.h"
+#include "llvm/Support/MemoryBuffer.h"
+
+namespace llvm {
+class Module;
+class TargetMachine;
+} // namespace llvm
+
+struct OptimizerSettings;
+
+/// Object cache keyed by the module identifier, which must be set to the
+/// result of getObjectCacheKey() for the module to be cached at all.
+class JitObjectCache final : public llvm::ObjectCache {
+  std::string directory;
+  std::string loadedKey;
+  std::unique_ptr<llvm::MemoryBuffer> loadedObject;
+
+  std::string getObjectPath(llvm::StringRef key) const;
+
+public:
+  /// Sets the cache directory, empty string disables the cache.
+  void setDirectory(llvm::StringRef dir);
+
+  bool isEnabled() const { return !directory.empty(); }
+
+  /// Tries to load the object for `key` from disk. On success, the object
+  /// will be handed out to the next getObject() call for the module with
+  /// this key, so optimization and codegen can be skipped.
+  bool load(llvm::StringRef key);
+
+  /// Reads the object for `key` from disk, returns null if there is none.
+  /// Can be called concurrently.
+  std::unique_ptr<llvm::MemoryBuffer> read(llvm::StringRef key) const;
+
+  /// Writes the object for `key` to disk. Can be called concurrently.
+  void store(llvm::StringRef key, llvm::MemoryBufferRef obj) const;
+
+  /// Records that the module with `key` was compiled to the objects stored
+  /// for `partKeys` (by parallel codegen).
+  void storeParts(llvm::StringRef key,
+                  const std::vector<std::string> &partKeys) const;
+
+  /// Reads the objects recorded by storeParts() for `key`, returns an empty
+  /// vector unless all of them are available.
+  std::vector<std::unique_ptr<llvm::MemoryBuffer>>
+  readParts(llvm::StringRef key) const;
+
+  void notifyObjectCompiled(const llvm::Module *module,
+                            llvm::MemoryBufferRef obj) override;
+
+  std::unique_ptr<llvm::MemoryBuffer>
+  getObject(const llvm::Module *module) override;
+};
+
+/// Returns a cache key which covers the module contents (after binding and
+/// setting of runtime compile vars), the optimizer settings and the host
+/// target.
+std::string getObjectCacheKey(const llvm::Module &module,
+                              const OptimizerSettings &settings,
+                              const llvm::TargetMachine &targetMachine);
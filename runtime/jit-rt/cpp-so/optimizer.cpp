@@ -13,15 +13,22 @@
 
 #include "llvm/IR/Constants.h"
 #include "llvm/IR/DataLayout.h"
+#include "llvm/IR/Dominators.h"
 #include "llvm/IR/LegacyPassManager.h"
+#include "llvm/IR/Metadata.h"
 #include "llvm/IR/Module.h"
 #include "llvm/IR/Verifier.h"
 
 #include "llvm/ADT/Triple.h"
 
+#include "llvm/Analysis/LoopInfo.h"
 #include "llvm/Analysis/TargetLibraryInfo.h"
 #include "llvm/Analysis/TargetTransformInfo.h"
 
+#include "llvm/InitializePasses.h"
+#include "llvm/PassInfo.h"
+#include "llvm/PassRegistry.h"
+
 #include "llvm/Transforms/IPO.h"
 #include "llvm/Transforms/IPO/AlwaysInliner.h"
 #include "llvm/Transforms/IPO/Inliner.h"
@@ -31,17 +38,44 @@
 #include "utils.h"
 #include "valueparser.h"
 
+#include <map>
+#include <mutex>
+
 namespace {
+// Must match ldc.dynamic_compile.dynamicCompileOpt.
+const char *FunctionOptAttrName = "ldc-jit-opt";
+
+// Optimization and size level.
+using OptLevels = std::pair<unsigned, unsigned>;
+
+// Returns the optimization levels of `func`, set by dynamicCompileOpt or the
+// ones of the compilation.
+OptLevels getOptLevels(const Context &context, const llvm::Function &func,
+                       const OptimizerSettings &settings) {
+  auto attr = func.getFnAttribute(FunctionOptAttrName);
+  if (!attr.isStringAttribute()) {
+    return {settings.optLevel, settings.sizeLevel};
+  }
+  // "<optLevel>,<sizeLevel>"
+  const auto value = attr.getValueAsString();
+  if (value.size() != 3 || value[0] < '0' || value[0] > '3' ||
+      value[1] != ',' || value[2] < '0' || value[2] > '2') {
+    fatal(context, "Invalid optimization levels \"" + value.str() +
+                       "\" for \"" + func.getName().str() + "\"");
+  }
+  return {static_cast<unsigned>(value[0] - '0'),
+          static_cast<unsigned>(value[2] - '0')};
+}
+
 // TODO: share this function with compiler
-void addOptimizationPasses(llvm::legacy::PassManagerBase &mpm,
-                           llvm::legacy::FunctionPassManager &fpm,
-                           unsigned optLevel, unsigned sizeLevel) {
-  llvm::PassManagerBuilder builder;
+void setupBuilder(llvm::PassManagerBuilder &builder,
+                  const OptimizerSettings &settings, OptLevels levels) {
+  const auto optLevel = levels.first;
+  const auto sizeLevel = levels.second;
   builder.OptLevel = optLevel;
   builder.SizeLevel = sizeLevel;
 
-  // TODO: expose this option from jit
-  if (/*willInline()*/ true) {
+  if (!settings.disableInlining) {
 #if LDC_LLVM_VER >= 400
     auto params = llvm::getInlineParams(optLevel, sizeLevel);
     builder.Inliner = llvm::createFunctionInliningPass(params);
@@ -57,40 +91,79 @@ void addOptimizationPasses(llvm::legacy::PassManagerBase &mpm,
   }
   builder.DisableUnitAtATime = false;
 
-  // TODO: Expose this option
-  builder.DisableUnrollLoops = optLevel == 0;
+  builder.DisableUnrollLoops = settings.disableLoopUnrolling || optLevel == 0;
 
-  // TODO: expose this option
-  if (/*disableLoopVectorization*/ false) {
+  if (settings.disableLoopVectorization) {
     builder.LoopVectorize = false;
     // If option wasn't forced via cmd line (-vectorize-loops, -loop-vectorize)
   } else if (!builder.LoopVectorize) {
     builder.LoopVectorize = optLevel > 1 && sizeLevel < 2;
   }
 
-  // TODO: expose this option
-  builder.SLPVectorize =
-      /*disableSLPVectorization*/ false ? false : optLevel > 1 && sizeLevel < 2;
+  builder.SLPVectorize = settings.disableSLPVectorization
+                             ? false
+                             : optLevel > 1 && sizeLevel < 2;
 
   // TODO: sanitizers support in jit?
   // TODO: lang specific passes support
   // TODO: addStripExternalsPass?
-  // TODO: PGO support in jit?
+}
 
-  builder.populateFunctionPassManager(fpm);
+void addOptimizationPasses(llvm::legacy::PassManagerBase &mpm,
+                           const OptimizerSettings &settings, OptLevels levels,
+                           bool hasProfile) {
+  llvm::PassManagerBuilder builder;
+  setupBuilder(builder, settings, levels);
   builder.populateModulePassManager(mpm);
+
+#if LDC_LLVM_VER >= 800
+  // Profile data from an instrumented jit tier, move the cold blocks out of
+  // the hot functions.
+  if (hasProfile && levels.first > 0) {
+    mpm.add(llvm::createHotColdSplittingPass());
+  }
+#else
+  (void)hasProfile;
+#endif
 }
 
-void setupPasses(llvm::TargetMachine &targetMachine,
-                 const OptimizerSettings &settings,
-                 llvm::legacy::PassManager &mpm,
-                 llvm::legacy::FunctionPassManager &fpm) {
+// Adds the passes of a comma separated list of pass names (as for
+// `opt -<name>`) to `mpm`.
+void addCustomPasses(const Context &context, llvm::StringRef pipeline,
+                     llvm::legacy::PassManagerBase &mpm) {
+  auto &registry = *llvm::PassRegistry::getPassRegistry();
+  static std::once_flag initialized;
+  std::call_once(initialized, [&registry]() {
+    llvm::initializeCore(registry);
+    llvm::initializeAnalysis(registry);
+    llvm::initializeTransformUtils(registry);
+    llvm::initializeScalarOpts(registry);
+    llvm::initializeVectorization(registry);
+    llvm::initializeInstCombine(registry);
+    llvm::initializeIPO(registry);
+    llvm::initializeTarget(registry);
+  });
+
+  llvm::SmallVector<llvm::StringRef, 16> names;
+  pipeline.split(names, ',', -1, false);
+  for (auto name : names) {
+    name = name.trim();
+    auto info = registry.getPassInfo(name);
+    if (nullptr == info || nullptr == info->getNormalCtor()) {
+      fatal(context, "Unknown pass \"" + name.str() + "\" in pass pipeline");
+    }
+    interruptPoint(context, "Add pass", name.str().c_str());
+    mpm.add(info->createPass());
+  }
+}
+
+void setupPasses(const Context &context, llvm::TargetMachine &targetMachine,
+                 const OptimizerSettings &settings, OptLevels levels,
+                 bool hasProfile, llvm::legacy::PassManager &mpm) {
   mpm.add(
       new llvm::TargetLibraryInfoWrapperPass(targetMachine.getTargetTriple()));
   mpm.add(llvm::createTargetTransformInfoWrapperPass(
       targetMachine.getTargetIRAnalysis()));
-  fpm.add(llvm::createTargetTransformInfoWrapperPass(
-      targetMachine.getTargetIRAnalysis()));
 
   if (/*stripDebug*/ true) {
     mpm.add(llvm::createStripSymbolsPass(true));
@@ -98,16 +171,84 @@ void setupPasses(llvm::TargetMachine &targetMachine,
   mpm.add(llvm::createStripDeadPrototypesPass());
   mpm.add(llvm::createStripDeadDebugInfoPass());
 
-  addOptimizationPasses(mpm, fpm, settings.optLevel, settings.sizeLevel);
+  if (!settings.passPipeline.empty()) {
+    addCustomPasses(context, settings.passPipeline, mpm);
+  } else {
+    addOptimizationPasses(mpm, settings, levels, hasProfile);
+  }
 }
 
-struct FuncFinalizer final {
-  llvm::legacy::FunctionPassManager &fpm;
-  explicit FuncFinalizer(llvm::legacy::FunctionPassManager &_fpm) : fpm(_fpm) {
-    fpm.doInitialization();
+// Sets up the function passes for the given optimization levels, run before
+// the module passes.
+std::unique_ptr<llvm::legacy::FunctionPassManager>
+createFunctionPasses(llvm::TargetMachine &targetMachine,
+                     const OptimizerSettings &settings, OptLevels levels,
+                     llvm::Module &module) {
+  std::unique_ptr<llvm::legacy::FunctionPassManager> fpm(
+      new llvm::legacy::FunctionPassManager(&module));
+  fpm->add(llvm::createTargetTransformInfoWrapperPass(
+      targetMachine.getTargetIRAnalysis()));
+  llvm::PassManagerBuilder builder;
+  setupBuilder(builder, settings, levels);
+  builder.populateFunctionPassManager(*fpm);
+  return fpm;
+}
+
+// Keeps the loop vectorizer and unroller of the module passes away from the
+// loops of `func`, via their loop metadata.
+void disableLoopTransforms(llvm::Function &func) {
+  llvm::DominatorTree domTree(func);
+  llvm::LoopInfo loopInfo(domTree);
+  auto &ctx = func.getContext();
+  llvm::SmallVector<llvm::Loop *, 8> worklist(loopInfo.begin(),
+                                              loopInfo.end());
+  while (!worklist.empty()) {
+    auto loop = worklist.pop_back_val();
+    worklist.append(loop->begin(), loop->end());
+
+    // The first operand of a loop ID is a self reference.
+    llvm::SmallVector<llvm::Metadata *, 4> ops;
+    ops.push_back(nullptr);
+    if (auto loopID = loop->getLoopID()) {
+      ops.append(loopID->op_begin() + 1, loopID->op_end());
+    }
+    ops.push_back(llvm::MDNode::get(
+        ctx, {llvm::MDString::get(ctx, "llvm.loop.vectorize.enable"),
+              llvm::ConstantAsMetadata::get(
+                  llvm::ConstantInt::getFalse(ctx))}));
+    ops.push_back(llvm::MDNode::get(
+        ctx, llvm::MDString::get(ctx, "llvm.loop.unroll.disable")));
+    auto loopID = llvm::MDNode::getDistinct(ctx, ops);
+    loopID->replaceOperandWith(0, loopID);
+    loop->setLoopID(loopID);
+  }
+}
+
+// Restricts the module passes, which run with the highest optimization
+// levels of all functions, to the lower levels of `func`.
+void restrictOptimizations(llvm::Function &func, OptLevels levels,
+                           OptLevels moduleLevels) {
+  if (levels.first == 0) {
+    if (moduleLevels.first > 0 &&
+        !func.hasFnAttribute(llvm::Attribute::AlwaysInline)) {
+      // optnone is incompatible with the size attributes.
+      func.removeFnAttr(llvm::Attribute::OptimizeForSize);
+      func.removeFnAttr(llvm::Attribute::MinSize);
+      func.addFnAttr(llvm::Attribute::OptimizeNone);
+      func.addFnAttr(llvm::Attribute::NoInline);
+    }
+    return;
   }
-  ~FuncFinalizer() { fpm.doFinalization(); }
-};
+  if (levels.second > moduleLevels.second) {
+    func.addFnAttr(llvm::Attribute::OptimizeForSize);
+    if (levels.second > 1) {
+      func.addFnAttr(llvm::Attribute::MinSize);
+    }
+  }
+  if (levels.first < 2 && moduleLevels.first > 1) {
+    disableLoopTransforms(func);
+  }
+}
 
 void stripComdat(llvm::Module &module) {
   for (auto &&func : module.functions()) {
@@ -126,23 +267,49 @@ void optimizeModule(const Context &context, llvm::TargetMachine &targetMachine,
   // There is llvm bug related tp comdat and IR based pgo
   // and anyway comdat is useless at this stage
   stripComdat(module);
-  llvm::legacy::PassManager mpm;
-  llvm::legacy::FunctionPassManager fpm(&module);
   const auto name = module.getName();
+
+  // Functions with their own optimization levels (dynamicCompileOpt) get
+  // their own function passes. The module passes run with the highest
+  // optimization level, and are restricted for the functions with lower ones.
+  std::vector<std::pair<llvm::Function *, OptLevels>> functions;
+  OptLevels moduleLevels{settings.optLevel, settings.sizeLevel};
+  for (auto &fun : module) {
+    if (fun.isDeclaration()) {
+      interruptPoint(context, "Func decl", fun.getName().data());
+      continue;
+    }
+    const auto levels = getOptLevels(context, fun, settings);
+    if (functions.empty() || levels.first > moduleLevels.first ||
+        (levels.first == moduleLevels.first &&
+         levels.second < moduleLevels.second)) {
+      moduleLevels = levels;
+    }
+    functions.emplace_back(&fun, levels);
+  }
+
   interruptPoint(context, "Setup passes for module", name.data());
-  setupPasses(targetMachine, settings, mpm, fpm);
-
-  // Run per-function passes.
-  {
-    FuncFinalizer finalizer(fpm);
-    for (auto &fun : module) {
-      if (fun.isDeclaration()) {
-        interruptPoint(context, "Func decl", fun.getName().data());
-      } else {
-        interruptPoint(context, "Run passes for function",
-                       fun.getName().data());
+  llvm::legacy::PassManager mpm;
+  setupPasses(context, targetMachine, settings, moduleLevels,
+              nullptr != module.getProfileSummary(), mpm);
+
+  // Run per-function passes, unless there is a custom pipeline.
+  if (settings.passPipeline.empty()) {
+    std::map<OptLevels, std::unique_ptr<llvm::legacy::FunctionPassManager>>
+        fpms;
+    for (auto &&fun : functions) {
+      auto &fpm = fpms[fun.second];
+      if (nullptr == fpm) {
+        fpm = createFunctionPasses(targetMachine, settings, fun.second, module);
+        fpm->doInitialization();
       }
-      fpm.run(fun);
+      interruptPoint(context, "Run passes for function",
+                     fun.first->getName().data());
+      fpm->run(*fun.first);
+      restrictOptimizations(*fun.first, fun.second, moduleLevels);
+    }
+    for (auto &&fpm : fpms) {
+      fpm.second->doFinalization();
     }
   }
 
@@ -151,6 +318,121 @@ void optimizeModule(const Context &context, llvm::TargetMachine &targetMachine,
   mpm.run(module);
 }
 
+namespace {
+// Must match the compiler (gen/dynamiccompile.cpp).
+const char *RtCompileSlicesMetadataName = "ldc.dynamic_compile.slices";
+
+// Returns `agg` with the element at `path` replaced by `val`.
+llvm::Constant *replaceElement(llvm::Constant *agg,
+                               llvm::ArrayRef<unsigned> path,
+                               llvm::Constant *val) {
+  if (path.empty()) {
+    return val;
+  }
+  auto type = agg->getType();
+  const auto numElements = type->isStructTy() ? type->getStructNumElements()
+                                              : type->getArrayNumElements();
+  llvm::SmallVector<llvm::Constant *, 16> elements(numElements);
+  for (unsigned i = 0; i < numElements; ++i) {
+    elements[i] = agg->getAggregateElement(i);
+  }
+  elements[path.front()] =
+      replaceElement(elements[path.front()], path.drop_front(), val);
+  if (auto stype = llvm::dyn_cast<llvm::StructType>(type)) {
+    return llvm::ConstantStruct::get(stype, elements);
+  }
+  return llvm::ConstantArray::get(llvm::cast<llvm::ArrayType>(type), elements);
+}
+
+// Replaces the pointers of the slices in the initializer of `var`, listed by
+// the compiler in the slices metadata, by snapshots of their contents, so
+// that the optimizer sees them as constants too.
+llvm::Constant *snapshotSlices(const Context &context, llvm::Module &module,
+                               llvm::GlobalVariable &var,
+                               llvm::Constant *initializer, const void *init) {
+  auto slices = module.getNamedMetadata(RtCompileSlicesMetadataName);
+  if (nullptr == slices) {
+    return initializer;
+  }
+  const auto &dataLayout = module.getDataLayout();
+  auto errHandler = [&](const std::string &str) { fatal(context, str); };
+  unsigned sliceIndex = 0;
+  llvm::SmallVector<unsigned, 4> path;
+  for (auto node : slices->operands()) {
+    auto varName = llvm::dyn_cast<llvm::MDString>(node->getOperand(0));
+    if (nullptr == varName || varName->getString() != var.getName()) {
+      continue;
+    }
+
+    // Find the slice and its offset from the start of the variable.
+    path.clear();
+    uint64_t offset = 0;
+    llvm::Type *type = var.getValueType();
+    for (unsigned i = 1; i < node->getNumOperands(); ++i) {
+      auto index = llvm::mdconst::extract<llvm::ConstantInt>(
+                       node->getOperand(i))
+                       ->getZExtValue();
+      if (auto stype = llvm::dyn_cast<llvm::StructType>(type)) {
+        offset += dataLayout.getStructLayout(stype)->getElementOffset(index);
+        type = stype->getElementType(index);
+      } else if (type->isArrayTy()) {
+        type = type->getArrayElementType();
+        offset += dataLayout.getTypeAllocSize(type) * index;
+      } else {
+        fatal(context, "Invalid slice path for \"" + var.getName().str() +
+                           "\"");
+      }
+      path.push_back(static_cast<unsigned>(index));
+    }
+    auto sliceType = llvm::dyn_cast<llvm::StructType>(type);
+    if (nullptr == sliceType || sliceType->getNumElements() != 2 ||
+        !sliceType->getElementType(0)->isIntegerTy() ||
+        !sliceType->getElementType(1)->isPointerTy()) {
+      fatal(context, "Invalid slice path for \"" + var.getName().str() + "\"");
+    }
+
+    const auto sliceLayout = dataLayout.getStructLayout(sliceType);
+    const auto slice = static_cast<const char *>(init) + offset;
+    const auto lengthWidth = sliceType->getElementType(0)->getIntegerBitWidth();
+    const auto length =
+        lengthWidth == 32
+            ? *reinterpret_cast<const uint32_t *>(
+                  slice + sliceLayout->getElementOffset(0))
+            : *reinterpret_cast<const uint64_t *>(
+                  slice + sliceLayout->getElementOffset(0));
+    const auto ptr = *reinterpret_cast<const void *const *>(
+        slice + sliceLayout->getElementOffset(1));
+    if (0 == length || nullptr == ptr) {
+      continue;
+    }
+
+    auto ptrType = llvm::cast<llvm::PointerType>(sliceType->getElementType(1));
+    auto contentType =
+        llvm::ArrayType::get(ptrType->getElementType(), length);
+    auto content = parseInitializer(dataLayout, *contentType, ptr, errHandler);
+    // The name is deterministic, so that the incremental recompilation
+    // notices changed contents via the hash of the snapshot definition.
+    auto snapshot = new llvm::GlobalVariable(
+        module, contentType, true, llvm::GlobalValue::PrivateLinkage, content,
+        ".rtcompile_slice_" + var.getName() + "_" + llvm::Twine(sliceIndex++));
+    auto contentPtr = llvm::ConstantExpr::getPointerCast(
+        llvm::ConstantExpr::getInBoundsGetElementPtr(
+            contentType, snapshot,
+            llvm::ArrayRef<llvm::Constant *>{
+                llvm::ConstantInt::get(dataLayout.getIntPtrType(
+                                           module.getContext()),
+                                       0),
+                llvm::ConstantInt::get(dataLayout.getIntPtrType(
+                                           module.getContext()),
+                                       0)}),
+        ptrType);
+    path.push_back(1);
+    initializer = replaceElement(initializer, path, contentPtr);
+  }
+  return initializer;
+}
+}
+
 void setRtCompileVar(const Context &context, llvm::Module &module,
                      const char *name, const void *init) {
   assert(nullptr != name);
@@ -161,6 +443,7 @@ void setRtCompileVar(const Context &context, llvm::Module &module,
     auto initializer =
         parseInitializer(module.getDataLayout(), *type, init,
                          [&](const std::string &str) { fatal(context, str); });
+    initializer = snapshotSlices(context, module, *var, initializer, init);
     var->setConstant(true);
     var->setInitializer(initializer);
     var->setLinkage(llvm::GlobalValue::PrivateLinkage);
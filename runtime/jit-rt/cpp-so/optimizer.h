@@ -14,6 +14,7 @@
 #pragma once
 
 #include <memory>
+#include <string>
 
 namespace llvm {
 namespace legacy {
@@ -29,6 +30,26 @@ struct Context;
 struct OptimizerSettings final {
   unsigned optLevel = 0;
   unsigned sizeLevel = 0;
+  bool fastCompile = false;
+  bool disableInlining = false;
+  bool disableLoopUnrolling = false;
+  bool disableLoopVectorization = false;
+  bool disableSLPVectorization = false;
+  // Comma separated pass names replacing the default pipeline, if not empty.
+  std::string passPipeline;
+
+  bool operator==(const OptimizerSettings &other) const {
+    return optLevel == other.optLevel && sizeLevel == other.sizeLevel &&
+           fastCompile == other.fastCompile &&
+           disableInlining == other.disableInlining &&
+           disableLoopUnrolling == other.disableLoopUnrolling &&
+           disableLoopVectorization == other.disableLoopVectorization &&
+           disableSLPVectorization == other.disableSLPVectorization &&
+           passPipeline == other.passPipeline;
+  }
+  bool operator!=(const OptimizerSettings &other) const {
+    return !(*this == other);
+  }
 };
 
 void optimizeModule(const Context &context, llvm::TargetMachine &targetMachine,
@@ -0,0 +1,166 @@
+//===-- parallel_codegen.cpp ----------------------------------------------===//
+//
+//                         LDC – the LLVM D compiler
+//
+// This file is distributed under the Boost Software License. See the LICENSE
+// file for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "parallel_codegen.h"
+
+#include <atomic>
+#include <cassert>
+#include <string>
+#include <thread>
+
+#include "jit_context.h"
+#include "object_cache.h"
+#include "utils.h"
+
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Bitcode/BitcodeReader.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/ExecutionEngine/Orc/CompileUtils.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Target/TargetMachine.h"
+#include "llvm/Transforms/Utils/SplitModule.h"
+
+namespace {
+
+// SplitModule externalizes local symbols, give them names which can't clash
+// with symbols of previously jitted code. With the object cache, the names
+// are derived from the module's cache key, so that the parts (and their
+// cache keys) are the same across runs.
+void renameLocals(llvm::Module &module, const std::string &moduleKey) {
+  static std::atomic<unsigned> generation{0};
+  const auto prefix =
+      moduleKey.empty()
+          ? ".jit" + std::to_string(generation++) + "."
+          : ".jit." + moduleKey.substr(moduleKey.size() - 16) + ".";
+  auto rename = [&](llvm::GlobalValue &gv) {
+    if (gv.hasLocalLinkage()) {
+      gv.setName(llvm::Twine(prefix) + (gv.hasName() ? gv.getName() : "anon"));
+    }
+  };
+  for (auto &&func : module.functions()) {
+    rename(func);
+  }
+  for (auto &&var : module.globals()) {
+    rename(var);
+  }
+  for (auto &&alias : module.aliases()) {
+    rename(alias);
+  }
+}
+
+bool hasDefinitions(const llvm::Module &module) {
+  for (auto &&func : module.functions()) {
+    if (!func.isDeclaration()) {
+      return true;
+    }
+  }
+  for (auto &&var : module.globals()) {
+    if (!var.isDeclaration()) {
+      return true;
+    }
+  }
+  return false;
+}
+
+std::unique_ptr<llvm::MemoryBuffer> compilePart(llvm::StringRef bitcode,
+                                                llvm::TargetMachine &tm) {
+  llvm::LLVMContext llvmContext;
+  auto module = llvm::parseBitcodeFile(
+      llvm::MemoryBufferRef(bitcode, "jit-part"), llvmContext);
+  if (!module) {
+    llvm::consumeError(module.takeError());
+    return nullptr;
+  }
+  llvm::orc::SimpleCompiler compiler(tm);
+#if LDC_LLVM_VER >= 700
+  return compiler(**module);
+#else
+  auto binary = compiler(**module).takeBinary();
+  return std::move(binary.second);
+#endif
+}
+
+} // anon namespace
+
+std::vector<std::unique_ptr<llvm::MemoryBuffer>>
+codegenParallel(const Context &context, std::unique_ptr<llvm::Module> module,
+                unsigned threadsCount, const OptimizerSettings &settings,
+                const llvm::TargetMachine &targetMachine,
+                const JitObjectCache &objectCache,
+                const std::string &moduleKey,
+                std::vector<std::string> &partKeys) {
+  assert(nullptr != module);
+  assert(threadsCount > 1);
+  assert(moduleKey.empty() == !objectCache.isEnabled());
+  interruptPoint(context, "Split final module");
+  renameLocals(*module, moduleKey);
+
+  // Parts are serialized right away so they can be compiled in their own
+  // LLVMContexts.
+  std::vector<llvm::SmallString<0>> bitcodes;
+  std::vector<std::string> keys;
+  std::vector<std::unique_ptr<llvm::MemoryBuffer>> objects;
+  partKeys.clear();
+  llvm::SplitModule(std::move(module), threadsCount,
+                    [&](std::unique_ptr<llvm::Module> part) {
+                      if (!hasDefinitions(*part)) {
+                        return;
+                      }
+                      if (objectCache.isEnabled()) {
+                        auto key =
+                            getObjectCacheKey(*part, settings, targetMachine);
+                        partKeys.push_back(key);
+                        if (auto obj = objectCache.read(key)) {
+                          objects.push_back(std::move(obj));
+                          return;
+                        }
+                        keys.push_back(std::move(key));
+                      }
+                      bitcodes.emplace_back();
+                      llvm::raw_svector_ostream os(bitcodes.back());
+#if LDC_LLVM_VER >= 700
+                      llvm::WriteBitcodeToFile(*part, os);
+#else
+                      llvm::WriteBitcodeToFile(part.get(), os);
+#endif
+                    });
+
+  // Target machines aren't thread-safe, create one per thread up front.
+  std::vector<std::unique_ptr<llvm::TargetMachine>> targetMachines;
+  for (std::size_t i = 0; i < bitcodes.size(); ++i) {
+    targetMachines.push_back(createTargetMachine());
+    setupCodegen(*targetMachines.back(), settings.fastCompile);
+  }
+
+  interruptPoint(context, "Codegen module parts");
+  std::vector<std::unique_ptr<llvm::MemoryBuffer>> compiled(bitcodes.size());
+  std::vector<std::thread> threads;
+  for (std::size_t i = 0; i < bitcodes.size(); ++i) {
+    threads.emplace_back([&, i]() {
+      compiled[i] = compilePart(bitcodes[i], *targetMachines[i]);
+    });
+  }
+  for (auto &&thread : threads) {
+    thread.join();
+  }
+
+  for (std::size_t i = 0; i < compiled.size(); ++i) {
+    if (nullptr == compiled[i]) {
+      fatal(context, "Can't codegen module part");
+    }
+    if (objectCache.isEnabled()) {
+      objectCache.store(keys[i], compiled[i]->getMemBufferRef());
+    }
+    objects.push_back(std::move(compiled[i]));
+  }
+  return objects;
+}
@@ -0,0 +1,41 @@
+//===-- parallel_codegen.h - jit support ------------------------*- C++ -*-===//
+//
+//                         LDC – the LLVM D compiler
+//
+// This file is distributed under the Boost Software License. See the LICENSE
+// file for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Jit runtime - splitting of the final module for parallel code generation.
+//
+//===----------------------------------------------------------------------===//
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace llvm {
+class MemoryBuffer;
+class Module;
+class TargetMachine;
+} // namespace llvm
+
+struct Context;
+struct OptimizerSettings;
+class JitObjectCache;
+
+/// Splits the (optimized) module into up to `threadsCount` parts and generates
+/// object files for them in parallel, each part in its own LLVMContext.
+/// Parts are individually looked up in and stored to the object cache, if it
+/// is enabled; `moduleKey` is the cache key of the whole module then, and the
+/// cache keys of the parts are returned in `partKeys`.
+std::vector<std::unique_ptr<llvm::MemoryBuffer>>
+codegenParallel(const Context &context, std::unique_ptr<llvm::Module> module,
+                unsigned threadsCount, const OptimizerSettings &settings,
+                const llvm::TargetMachine &targetMachine,
+                const JitObjectCache &objectCache,
+                const std::string &moduleKey,
+                std::vector<std::string> &partKeys);
@@ -0,0 +1,251 @@
+//===-- profile.cpp -------------------------------------------------------===//
+//
+//                         LDC – the LLVM D compiler
+//
+// This file is distributed under the Boost Software License. See the LICENSE
+// file for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "profile.h"
+
+#include <algorithm>
+#include <cassert>
+#include <functional>
+#include <limits>
+
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/GlobalVariable.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/MDBuilder.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/ProfileSummary.h"
+
+namespace {
+
+// Same cutoffs as llvm::ProfileSummaryBuilder::DefaultCutoffs, which lives
+// in ProfileData.
+const std::uint32_t SummaryCutoffs[] = {
+    10000,  100000, 200000, 300000, 400000, 500000, 600000, 700000,
+    800000, 900000, 950000, 990000, 999000, 999900, 999990, 999999};
+
+template <typename F> void enumBranches(llvm::Function &func, F &&fun) {
+  for (auto &&bb : func) {
+    auto br = llvm::dyn_cast<llvm::BranchInst>(bb.getTerminator());
+    if (br != nullptr && br->isConditional()) {
+      fun(*br);
+    }
+  }
+}
+
+void emitIncrement(llvm::IRBuilder<> &builder, llvm::GlobalVariable &var,
+                   llvm::Value *index) {
+  auto &context = builder.getContext();
+  auto zero = llvm::ConstantInt::get(llvm::Type::getInt64Ty(context), 0);
+  auto ptr = builder.CreateInBoundsGEP(&var, {zero, index});
+  auto val = builder.CreateLoad(ptr);
+  builder.CreateStore(
+      builder.CreateAdd(val, llvm::ConstantInt::get(val->getType(), 1)), ptr);
+}
+
+bool isInstrumentable(const llvm::Function &func) {
+  return !func.isDeclaration() && !func.hasAvailableExternallyLinkage() &&
+         func.hasName();
+}
+
+// Scale counters to fit branch weights into 32 bits, as clang does.
+std::uint64_t calcScale(std::uint64_t maxCount) {
+  const std::uint64_t max = std::numeric_limits<std::uint32_t>::max();
+  return maxCount < max ? 1 : maxCount / max + 1;
+}
+
+std::uint32_t scaleWeight(std::uint64_t weight, std::uint64_t scale) {
+  assert(scale != 0);
+  return static_cast<std::uint32_t>(weight / scale + 1);
+}
+
+llvm::Metadata *createSummary(llvm::LLVMContext &context,
+                              std::vector<std::uint64_t> counts,
+                              std::uint64_t maxFunctionCount,
+                              std::uint32_t numFunctions) {
+  std::sort(counts.begin(), counts.end(), std::greater<std::uint64_t>());
+  std::uint64_t total = 0;
+  for (auto count : counts) {
+    total += count;
+  }
+  const std::uint64_t maxCount = counts.empty() ? 0 : counts.front();
+
+  llvm::SummaryEntryVector detailed;
+  std::size_t index = 0;
+  std::uint64_t sum = 0;
+  for (auto cutoff : SummaryCutoffs) {
+    // Avoid 64-bit overflow of total * cutoff.
+    const auto desired = static_cast<std::uint64_t>(
+        static_cast<long double>(total) * cutoff / 1000000);
+    while (index < counts.size() && (sum < desired || 0 == sum)) {
+      sum += counts[index];
+      ++index;
+    }
+    const auto minCount = 0 == index ? 0 : counts[index - 1];
+    detailed.emplace_back(cutoff, minCount, index);
+  }
+  llvm::ProfileSummary summary(
+      llvm::ProfileSummary::PSK_Instr, detailed, total, maxCount, maxCount,
+      maxFunctionCount, static_cast<std::uint32_t>(counts.size()),
+      numFunctions);
+  return summary.getMD(context);
+}
+
+} // anon namespace
+
+void JitProfile::instrument(llvm::Module &module, const Hashes &hashes) {
+  reset();
+  std::size_t index = 0;
+  for (auto &&func : module.functions()) {
+    if (!isInstrumentable(func)) {
+      continue;
+    }
+    auto it = hashes.find(func.getName().str());
+    if (hashes.end() == it) {
+      continue;
+    }
+    FuncRecord record;
+    record.hash = it->second;
+    record.entryCounter = index++;
+    enumBranches(func, [&](llvm::BranchInst &) { ++record.branchesCount; });
+    index += record.branchesCount * 2;
+    functions.insert({func.getName().str(), record});
+  }
+  if (functions.empty()) {
+    return;
+  }
+
+  auto &context = module.getContext();
+  auto int64 = llvm::Type::getInt64Ty(context);
+  auto type = llvm::ArrayType::get(int64, index);
+  countersName =
+      "__ldc_jit_profile_counters." + std::to_string(++instrumentations);
+  auto var = new llvm::GlobalVariable(module, type, false,
+                                      llvm::GlobalValue::ExternalLinkage,
+                                      llvm::ConstantAggregateZero::get(type),
+                                      countersName);
+  counters.resize(index, 0);
+
+  llvm::IRBuilder<> builder(context);
+  for (auto &&func : module.functions()) {
+    auto it = functions.find(func.getName().str());
+    if (functions.end() == it || !isInstrumentable(func)) {
+      continue;
+    }
+    const auto &record = it->second;
+    builder.SetInsertPoint(&*func.getEntryBlock().getFirstInsertionPt());
+    emitIncrement(builder, *var,
+                  llvm::ConstantInt::get(int64, record.entryCounter));
+
+    auto counter = record.entryCounter + 1;
+    enumBranches(func, [&](llvm::BranchInst &br) {
+      builder.SetInsertPoint(&br);
+      auto idx =
+          builder.CreateSelect(br.getCondition(),
+                               llvm::ConstantInt::get(int64, counter),
+                               llvm::ConstantInt::get(int64, counter + 1));
+      emitIncrement(builder, *var, idx);
+      counter += 2;
+    });
+  }
+}
+
+void JitProfile::setCounters(const void *addr) {
+  liveCounters = static_cast<const std::uint64_t *>(addr);
+  pending = nullptr != liveCounters;
+}
+
+void JitProfile::snapshot() {
+  if (nullptr != liveCounters) {
+    std::copy(liveCounters, liveCounters + counters.size(), counters.begin());
+    liveCounters = nullptr;
+  }
+}
+
+bool JitProfile::apply(llvm::Module &module, const Hashes &hashes) {
+  assert(nullptr == liveCounters);
+  if (!pending) {
+    return false;
+  }
+  pending = false;
+
+  llvm::MDBuilder mdBuilder(module.getContext());
+  std::vector<std::uint64_t> counts;
+  std::uint64_t maxFunctionCount = 0;
+  std::uint32_t numFunctions = 0;
+  for (auto &&func : module.functions()) {
+    if (!isInstrumentable(func)) {
+      continue;
+    }
+    const auto name = func.getName().str();
+    auto it = functions.find(name);
+    auto hashIt = hashes.find(name);
+    if (functions.end() == it || hashes.end() == hashIt ||
+        it->second.hash != hashIt->second) {
+      continue;
+    }
+    const auto &record = it->second;
+    std::size_t branches = 0;
+    enumBranches(func, [&](llvm::BranchInst &) { ++branches; });
+    if (branches != record.branchesCount) {
+      continue;
+    }
+
+    const auto entryCount = counters[record.entryCounter];
+    func.setEntryCount(entryCount);
+    counts.push_back(entryCount);
+    maxFunctionCount = std::max(maxFunctionCount, entryCount);
+    ++numFunctions;
+
+    std::uint64_t maxCount = 0;
+    for (std::size_t i = 0; i < branches * 2; ++i) {
+      maxCount = std::max(maxCount, counters[record.entryCounter + 1 + i]);
+    }
+    const auto scale = calcScale(maxCount);
+    auto counter = record.entryCounter + 1;
+    enumBranches(func, [&](llvm::BranchInst &br) {
+      const auto trueCount = counters[counter];
+      const auto falseCount = counters[counter + 1];
+      br.setMetadata(llvm::LLVMContext::MD_prof,
+                     mdBuilder.createBranchWeights(
+                         scaleWeight(trueCount, scale),
+                         scaleWeight(falseCount, scale)));
+      counts.push_back(trueCount);
+      counts.push_back(falseCount);
+      counter += 2;
+    });
+  }
+  if (0 == numFunctions) {
+    return false;
+  }
+  if (nullptr == module.getProfileSummary()) {
+    module.setProfileSummary(createSummary(module.getContext(),
+                                           std::move(counts), maxFunctionCount,
+                                           numFunctions));
+  }
+  return true;
+}
+
+std::uint64_t JitProfile::getCallsCount() const {
+  std::uint64_t ret = 0;
+  for (auto &&it : functions) {
+    const auto index = it.second.entryCounter;
+    ret += nullptr != liveCounters ? liveCounters[index] : counters[index];
+  }
+  return ret;
+}
+
+void JitProfile::reset() {
+  functions.clear();
+  counters.clear();
+  countersName.clear();
+  liveCounters = nullptr;
+  pending = false;
+}
@@ -0,0 +1,74 @@
+//===-- profile.h - jit support ---------------------------------*- C++ -*-===//
+//
+//                         LDC – the LLVM D compiler
+//
+// This file is distributed under the Boost Software License. See the LICENSE
+// file for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Jit runtime - lightweight profiling of jitted code.
+//
+//===----------------------------------------------------------------------===//
+
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace llvm {
+class Module;
+} // namespace llvm
+
+/// Collects function entry and branch counters of an instrumented jit tier and
+/// applies them as profile metadata when the code is compiled again.
+///
+/// Counters are matched against the new module by function name, definition
+/// hash and branch ordinal, so they are only applied to functions whose IR did
+/// not change since the instrumented compilation.
+class JitProfile final {
+  struct FuncRecord final {
+    std::size_t hash = 0;
+    std::size_t entryCounter = 0;
+    std::size_t branchesCount = 0;
+  };
+
+  std::map<std::string, FuncRecord> functions;
+  std::vector<std::uint64_t> counters;
+  std::string countersName;
+  const std::uint64_t *liveCounters = nullptr;
+  unsigned instrumentations = 0;
+  bool pending = false;
+
+public:
+  using Hashes = std::map<std::string, std::size_t>;
+
+  /// Inserts counters into all function definitions of `module` and forgets
+  /// any previously collected data. Must be called before optimization.
+  void instrument(llvm::Module &module, const Hashes &hashes);
+
+  /// Name of the counters array of the last instrumented module, empty if
+  /// there is none.
+  const std::string &getCountersName() const { return countersName; }
+
+  /// Sets the address of the counters array of the jitted instrumented code.
+  void setCounters(const void *addr);
+
+  /// Copies the live counters, so the instrumented code can be freed.
+  void snapshot();
+
+  /// Returns true if there is collected data which wasn't applied yet.
+  bool isPending() const { return pending; }
+
+  /// Sets entry counts and branch weights of all matching functions of
+  /// `module` and a module profile summary. Returns false if nothing was
+  /// applied. Must be called before optimization.
+  bool apply(llvm::Module &module, const Hashes &hashes);
+
+  /// Returns the number of calls of the instrumented functions so far.
+  std::uint64_t getCallsCount() const;
+
+  void reset();
+};
@@ -17,8 +17,13 @@
 #include "llvm/IR/Verifier.h"
 
 #include "context.h"
+#include "dumper.h"
 
 void fatal(const Context &context, const std::string &reason) {
+  // The dumps collected so far likely show what went wrong.
+  if (auto dumper = JitDumper::getCurrent()) {
+    dumper->deliver();
+  }
   if (nullptr != context.fatalHandler) {
     context.fatalHandler(context.fatalHandlerData, reason.c_str());
   } else {
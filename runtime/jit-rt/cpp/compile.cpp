@@ -13,8 +13,10 @@
 //===----------------------------------------------------------------------===//
 
 #include <cstddef> // size_t
+#include <cstdint> // uint64_t
 
 struct Context;
+struct MemoryStats;
 struct ParamSlice;
 
 #ifdef _WIN32
@@ -33,6 +35,21 @@ struct ParamSlice;
 #define JIT_UNREG_BIND_PAYLOAD                                                 \
   MAKE_JIT_API_CALL(unregisterBindPayloadImplSo,                               \
                     LDC_DYNAMIC_COMPILE_API_VERSION)
+#define JIT_GET_MEMORY_STATS                                                   \
+  MAKE_JIT_API_CALL(getMemoryStatsImplSo, LDC_DYNAMIC_COMPILE_API_VERSION)
+#define JIT_ENTER_GENERATION                                                   \
+  MAKE_JIT_API_CALL(enterGenerationImplSo, LDC_DYNAMIC_COMPILE_API_VERSION)
+#define JIT_LEAVE_GENERATION                                                   \
+  MAKE_JIT_API_CALL(leaveGenerationImplSo, LDC_DYNAMIC_COMPILE_API_VERSION)
+#define JIT_RELEASE_GENERATIONS                                                \
+  MAKE_JIT_API_CALL(releaseGenerationsImplSo,                                  \
+                    LDC_DYNAMIC_COMPILE_API_VERSION)
+#define JIT_GET_PROFILE_CALLS                                                  \
+  MAKE_JIT_API_CALL(getProfileCallsImplSo, LDC_DYNAMIC_COMPILE_API_VERSION)
+#define JIT_CREATE_CONTEXT                                                     \
+  MAKE_JIT_API_CALL(createJitContextImplSo, LDC_DYNAMIC_COMPILE_API_VERSION)
+#define JIT_DESTROY_CONTEXT                                                    \
+  MAKE_JIT_API_CALL(destroyJitContextImplSo, LDC_DYNAMIC_COMPILE_API_VERSION)
 
 extern "C" {
 
@@ -45,19 +62,54 @@ EXTERNAL void JIT_API_ENTRYPOINT(const void *modlist_head,
                                  const Context *context,
                                  std::size_t contextSize);
 
-EXTERNAL void JIT_REG_BIND_PAYLOAD(void *handle, void *originalFunc,
-                                   const ParamSlice *desc, size_t descSize);
+EXTERNAL void JIT_REG_BIND_PAYLOAD(void *jitContext, void *handle,
+                                   void *originalFunc, void *exampleFunc,
+                                   const ParamSlice *params, size_t paramsSize);
+
+EXTERNAL void JIT_UNREG_BIND_PAYLOAD(void *jitContext, void *handle);
+
+EXTERNAL void JIT_GET_MEMORY_STATS(MemoryStats *stats, size_t statsSize);
+
+EXTERNAL unsigned JIT_ENTER_GENERATION();
+
+EXTERNAL void JIT_LEAVE_GENERATION(unsigned generation);
 
-EXTERNAL void JIT_UNREG_BIND_PAYLOAD(void *handle);
+EXTERNAL size_t JIT_RELEASE_GENERATIONS();
+
+EXTERNAL uint64_t JIT_GET_PROFILE_CALLS();
+
+EXTERNAL void *JIT_CREATE_CONTEXT();
+
+EXTERNAL void JIT_DESTROY_CONTEXT(void *jitContext);
 
 void rtCompileProcessImpl(const Context *context, std::size_t contextSize) {
   JIT_API_ENTRYPOINT(dynamiccompile_modules_head, context, contextSize);
 }
 
-void registerBindPayload(void *handle, void *originalFunc,
-                         const ParamSlice *desc, size_t descSize) {
-  JIT_REG_BIND_PAYLOAD(handle, originalFunc, desc, descSize);
+void registerBindPayload(void *jitContext, void *handle, void *originalFunc,
+                         void *exampleFunc, const ParamSlice *params,
+                         size_t paramsSize) {
+  JIT_REG_BIND_PAYLOAD(jitContext, handle, originalFunc, exampleFunc, params,
+                       paramsSize);
 }
 
-void unregisterBindPayload(void *handle) { JIT_UNREG_BIND_PAYLOAD(handle); }
+void unregisterBindPayload(void *jitContext, void *handle) {
+  JIT_UNREG_BIND_PAYLOAD(jitContext, handle);
+}
+
+void getMemoryStats(MemoryStats *stats, size_t statsSize) {
+  JIT_GET_MEMORY_STATS(stats, statsSize);
+}
+
+unsigned enterGeneration() { return JIT_ENTER_GENERATION(); }
+
+void leaveGeneration(unsigned generation) { JIT_LEAVE_GENERATION(generation); }
+
+size_t releaseGenerations() { return JIT_RELEASE_GENERATIONS(); }
+
+uint64_t getProfileCalls() { return JIT_GET_PROFILE_CALLS(); }
+
+void *createJitContext() { return JIT_CREATE_CONTEXT(); }
+
+void destroyJitContext(void *jitContext) { JIT_DESTROY_CONTEXT(jitContext); }
 }
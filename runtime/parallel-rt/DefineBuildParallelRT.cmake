@@ -0,0 +1,18 @@
+# The scheduler for `pragma(LDC_parallel)` foreach loops.
+set(LDC_PARALLELRT_C ${PARALLELRT_DIR}/parallel.c)
+
+function(build_parallel_runtime c_flags ld_flags path_suffix outlist_targets)
+    get_target_suffix("" "${path_suffix}" target_suffix)
+    set(output_path ${CMAKE_BINARY_DIR}/lib${path_suffix})
+
+    add_library(ldc-parallel-rt${target_suffix} STATIC ${LDC_PARALLELRT_C})
+    set_common_library_properties(ldc-parallel-rt${target_suffix}
+        ldc-parallel-rt ${output_path}
+        "${c_flags} -std=gnu99"
+        "${ld_flags}"
+        OFF
+    )
+
+    list(APPEND ${outlist_targets} "ldc-parallel-rt${target_suffix}")
+    set(${outlist_targets} ${${outlist_targets}} PARENT_SCOPE)
+endfunction()
@@ -0,0 +1,223 @@
+//===-- parallel.c --------------------------------------------------------===//
+//
+//                         LDC – the LLVM D compiler
+//
+// This file is distributed under the Boost Software License. See the LICENSE
+// file for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Scheduler for `pragma(LDC_parallel)` foreach loops, which the compiler
+// lowers to a call of `_d_ldc_parallel_for()` with the loop body outlined
+// into a delegate processing a chunk of iterations.
+//
+// The iteration range is split up into one slice per thread. Each thread
+// claims chunks from the front of its own slice, and steals chunks from the
+// other slices once its own one is exhausted. The worker threads are started
+// lazily on first use; their number defaults to the number of online CPUs
+// and can be set via the LDC_PARALLEL_THREADS environment variable.
+//
+// Nested and concurrent parallel loops run serially on the calling thread.
+//
+// The worker threads are registered with druntime (if linked in), so that
+// the GC suspends and scans them. Errors thrown by a loop body are caught by
+// the compiler-generated code and rethrown on the calling thread; for the
+// first one, it calls `_d_ldc_parallel_first_error()`.
+//
+//===----------------------------------------------------------------------===//
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+// Processes the iterations [range[0], range[1]) of a loop.
+typedef void (*ldc_parallel_body_t)(void *context, const size_t *range);
+
+static void runSerially(size_t count, void *context, ldc_parallel_body_t body) {
+  const size_t range[2] = {0, count};
+  body(context, range);
+}
+
+#if defined(_WIN32) || !(defined(__GNUC__) || defined(__clang__))
+
+int _d_ldc_parallel_first_error(size_t *flag) {
+  const int isFirst = !*flag;
+  *flag = 1;
+  return isFirst;
+}
+
+void _d_ldc_parallel_for(size_t count, size_t chunk, void *context,
+                         ldc_parallel_body_t body) {
+  (void)chunk;
+  if (count)
+    runSerially(count, context, body);
+}
+
+#else
+
+#include <pthread.h>
+#include <unistd.h>
+
+// druntime's core.thread, not available with -betterC
+extern void *thread_attachThis(void) __attribute__((weak));
+
+#define MAX_THREADS 256
+#define CACHE_LINE 64
+
+// The not yet claimed iterations [next, end) of a thread's share of the range.
+// `next` may overshoot `end` after the last chunk has been claimed.
+typedef struct {
+  size_t next;
+  size_t end;
+  char padding[CACHE_LINE - 2 * sizeof(size_t)];
+} Slice;
+
+typedef struct {
+  size_t chunk;
+  void *context;
+  ldc_parallel_body_t body;
+  unsigned numSlices;
+} Job;
+
+static Slice slices[MAX_THREADS] __attribute__((aligned(CACHE_LINE)));
+static Job job;
+
+static unsigned numWorkers; // excluding the calling thread
+static pthread_once_t initOnce = PTHREAD_ONCE_INIT;
+static pthread_mutex_t jobMutex = PTHREAD_MUTEX_INITIALIZER;
+
+static pthread_mutex_t stateMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t startCond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t doneCond = PTHREAD_COND_INITIALIZER;
+static unsigned generation; // incremented for each job
+static unsigned pendingWorkers;
+
+static __thread int isInParallelLoop;
+
+int _d_ldc_parallel_first_error(size_t *flag) {
+  return __atomic_exchange_n(flag, 1, __ATOMIC_RELAXED) == 0;
+}
+
+static int claimChunk(Slice *slice, size_t chunk, size_t *range) {
+  if (__atomic_load_n(&slice->next, __ATOMIC_RELAXED) >= slice->end)
+    return 0;
+  const size_t begin = __atomic_fetch_add(&slice->next, chunk, __ATOMIC_RELAXED);
+  if (begin >= slice->end)
+    return 0;
+  range[0] = begin;
+  range[1] = slice->end - begin < chunk ? slice->end : begin + chunk;
+  return 1;
+}
+
+// Runs the chunks of the own slice first, then steals from the others.
+static void participate(unsigned self) {
+  size_t range[2];
+  for (unsigned i = 0; i < job.numSlices; ++i) {
+    Slice *slice = &slices[(self + i) % job.numSlices];
+    while (claimChunk(slice, job.chunk, range))
+      job.body(job.context, range);
+  }
+}
+
+static void *workerMain(void *arg) {
+  const unsigned self = (unsigned)(uintptr_t)arg;
+  unsigned seenGeneration = 0;
+  isInParallelLoop = 1;
+
+  // The thread is never detached, as it runs until the process exits.
+  if (thread_attachThis)
+    thread_attachThis();
+
+  for (;;) {
+    pthread_mutex_lock(&stateMutex);
+    while (generation == seenGeneration)
+      pthread_cond_wait(&startCond, &stateMutex);
+    seenGeneration = generation;
+    pthread_mutex_unlock(&stateMutex);
+
+    participate(self);
+
+    pthread_mutex_lock(&stateMutex);
+    if (--pendingWorkers == 0)
+      pthread_cond_signal(&doneCond);
+    pthread_mutex_unlock(&stateMutex);
+  }
+  return NULL;
+}
+
+static void startWorkers(void) {
+  long numThreads = 0;
+  const char *env = getenv("LDC_PARALLEL_THREADS");
+  if (env)
+    numThreads = atol(env);
+  if (numThreads <= 0)
+    numThreads = sysconf(_SC_NPROCESSORS_ONLN);
+  if (numThreads > MAX_THREADS)
+    numThreads = MAX_THREADS;
+
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+  for (long i = 1; i < numThreads; ++i) {
+    pthread_t thread;
+    if (pthread_create(&thread, &attr, workerMain, (void *)(uintptr_t)i) != 0)
+      break;
+    ++numWorkers;
+  }
+  pthread_attr_destroy(&attr);
+}
+
+void _d_ldc_parallel_for(size_t count, size_t chunk, void *context,
+                         ldc_parallel_body_t body) {
+  if (count == 0)
+    return;
+
+  if (!isInParallelLoop)
+    pthread_once(&initOnce, startWorkers);
+
+  if (isInParallelLoop || numWorkers == 0 || count == 1 ||
+      pthread_mutex_trylock(&jobMutex) != 0) {
+    runSerially(count, context, body);
+    return;
+  }
+
+  const unsigned numSlices = numWorkers + 1;
+  if (chunk == 0) {
+    // aim for ~8 chunks per thread for load balancing
+    chunk = count / (8 * (size_t)numSlices);
+    if (chunk == 0)
+      chunk = 1;
+  }
+
+  job.chunk = chunk;
+  job.context = context;
+  job.body = body;
+  job.numSlices = numSlices;
+  const size_t sliceSize = count / numSlices;
+  const size_t remainder = count % numSlices;
+  size_t begin = 0;
+  for (unsigned i = 0; i < numSlices; ++i) {
+    slices[i].next = begin;
+    begin += sliceSize + (i < remainder);
+    slices[i].end = begin;
+  }
+
+  pthread_mutex_lock(&stateMutex);
+  pendingWorkers = numWorkers;
+  ++generation;
+  pthread_cond_broadcast(&startCond);
+  pthread_mutex_unlock(&stateMutex);
+
+  isInParallelLoop = 1;
+  participate(0);
+  isInParallelLoop = 0;
+
+  pthread_mutex_lock(&stateMutex);
+  while (pendingWorkers != 0)
+    pthread_cond_wait(&doneCond, &stateMutex);
+  pthread_mutex_unlock(&stateMutex);
+
+  pthread_mutex_unlock(&jobMutex);
+}
+
+#endif
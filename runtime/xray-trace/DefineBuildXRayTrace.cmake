@@ -0,0 +1,23 @@
+# The handler for `-fxray-dmd-trace`. XRay is only fully supported on Linux.
+if("${TARGET_SYSTEM}" MATCHES "Linux")
+    set(LDC_XRAYTRACE_C ${XRAYTRACE_DIR}/trace.c)
+
+    function(build_xray_trace_runtime c_flags ld_flags path_suffix outlist_targets)
+        get_target_suffix("" "${path_suffix}" target_suffix)
+        set(output_path ${CMAKE_BINARY_DIR}/lib${path_suffix})
+
+        add_library(ldc-xray-trace${target_suffix} STATIC ${LDC_XRAYTRACE_C})
+        set_common_library_properties(ldc-xray-trace${target_suffix}
+            ldc-xray-trace ${output_path}
+            "${c_flags} -std=c99"
+            "${ld_flags}"
+            OFF
+        )
+
+        list(APPEND ${outlist_targets} "ldc-xray-trace${target_suffix}")
+        set(${outlist_targets} ${${outlist_targets}} PARENT_SCOPE)
+    endfunction()
+else()
+    function(build_xray_trace_runtime c_flags ld_flags path_suffix outlist_targets)
+    endfunction()
+endif()
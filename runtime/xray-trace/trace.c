@@ -0,0 +1,367 @@
+//===-- trace.c -----------------------------------------------------------===//
+//
+//                         LDC – the LLVM D compiler
+//
+// This file is distributed under the Boost Software License. See the LICENSE
+// file for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// XRay handler for `-fxray-dmd-trace`, writing DMD's trace.log format (like
+// druntime's rt.trace for `dmd -profile`).
+//
+// The XRay sleds are only patched if the LDC_TRACE_LOG environment variable is
+// set (to the log file name, or empty for trace.log), so the overhead is
+// negligible otherwise.
+//
+//===----------------------------------------------------------------------===//
+
+#define _GNU_SOURCE // dladdr()
+
+#include <dlfcn.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// The subset of compiler-rt's xray/xray_interface.h used here (stable C ABI),
+// declared manually as the compiler-rt headers aren't necessarily installed.
+enum XRayEntryType {
+  XRAY_ENTRY = 0,
+  XRAY_EXIT = 1,
+  XRAY_TAIL = 2,
+  XRAY_LOG_ARGS_ENTRY = 3,
+};
+int __xray_set_handler(void (*entry)(int32_t, enum XRayEntryType));
+int __xray_patch(void);
+uintptr_t __xray_function_address(int32_t funcId);
+size_t __xray_max_function_id(void);
+
+typedef struct {
+  int32_t funcId;
+  uint64_t count;
+} Edge;
+
+typedef struct {
+  uint64_t calls;
+  uint64_t treeTime; // including callees, in ns
+  uint64_t funcTime; // excluding callees, in ns
+  Edge *callees;     // fan out; the fan in is derived from it
+  size_t numCallees;
+  size_t capCallees;
+} FuncStats;
+
+typedef struct {
+  int32_t funcId;
+  uint64_t start;
+  uint64_t childTime;
+} Frame;
+
+typedef struct ThreadData {
+  FuncStats *stats; // indexed by XRay function ID
+  Frame *stack;
+  size_t stackSize;
+  size_t stackCap;
+  struct ThreadData *prev, *next;
+} ThreadData;
+
+static const char *logFileName = NULL;
+static size_t maxFuncId = 0;
+static pthread_mutex_t globalLock = PTHREAD_MUTEX_INITIALIZER;
+static FuncStats *globalStats = NULL; // of terminated threads
+static ThreadData *liveThreads = NULL;
+static pthread_key_t threadDataKey;
+
+static __thread ThreadData *threadData = NULL;
+static __thread int inHandler = 0;
+
+static uint64_t now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void *checkedRealloc(void *p, size_t size) {
+  p = realloc(p, size);
+  if (!p) {
+    fprintf(stderr, "out of memory in XRay trace handler\n");
+    abort();
+  }
+  return p;
+}
+
+static void addCallee(FuncStats *stats, int32_t callee, uint64_t count) {
+  for (size_t i = 0; i < stats->numCallees; ++i) {
+    if (stats->callees[i].funcId == callee) {
+      stats->callees[i].count += count;
+      return;
+    }
+  }
+  if (stats->numCallees == stats->capCallees) {
+    stats->capCallees = stats->capCallees ? 2 * stats->capCallees : 4;
+    stats->callees = (Edge *)checkedRealloc(
+        stats->callees, stats->capCallees * sizeof(Edge));
+  }
+  stats->callees[stats->numCallees].funcId = callee;
+  stats->callees[stats->numCallees].count = count;
+  ++stats->numCallees;
+}
+
+// Adds the (per-thread) stats `src` to `dst`.
+static void mergeStats(FuncStats *dst, const FuncStats *src) {
+  for (size_t id = 0; id <= maxFuncId; ++id) {
+    dst[id].calls += src[id].calls;
+    dst[id].treeTime += src[id].treeTime;
+    dst[id].funcTime += src[id].funcTime;
+    for (size_t i = 0; i < src[id].numCallees; ++i)
+      addCallee(&dst[id], src[id].callees[i].funcId, src[id].callees[i].count);
+  }
+}
+
+static void freeThreadData(ThreadData *data) {
+  for (size_t id = 0; id <= maxFuncId; ++id)
+    free(data->stats[id].callees);
+  free(data->stats);
+  free(data->stack);
+  free(data);
+}
+
+// Merges the stats of a terminating thread into the global ones.
+static void onThreadExit(void *p) {
+  ThreadData *data = (ThreadData *)p;
+  pthread_mutex_lock(&globalLock);
+  mergeStats(globalStats, data->stats);
+  if (data->prev)
+    data->prev->next = data->next;
+  else
+    liveThreads = data->next;
+  if (data->next)
+    data->next->prev = data->prev;
+  pthread_mutex_unlock(&globalLock);
+  freeThreadData(data);
+}
+
+static ThreadData *getThreadData(void) {
+  if (!threadData) {
+    ThreadData *data = (ThreadData *)calloc(1, sizeof(ThreadData));
+    if (!data)
+      return NULL;
+    data->stats = (FuncStats *)calloc(maxFuncId + 1, sizeof(FuncStats));
+    if (!data->stats) {
+      free(data);
+      return NULL;
+    }
+    pthread_mutex_lock(&globalLock);
+    data->next = liveThreads;
+    if (liveThreads)
+      liveThreads->prev = data;
+    liveThreads = data;
+    pthread_mutex_unlock(&globalLock);
+    pthread_setspecific(threadDataKey, data);
+    threadData = data;
+  }
+  return threadData;
+}
+
+// Pops the top frame, which has exited at `timestamp`, and adds it to the
+// stats.
+static void popFrame(ThreadData *data, uint64_t timestamp) {
+  const Frame frame = data->stack[--data->stackSize];
+  const uint64_t elapsed = timestamp - frame.start;
+  FuncStats *stats = &data->stats[frame.funcId];
+  ++stats->calls;
+  stats->treeTime += elapsed;
+  stats->funcTime +=
+      elapsed - (frame.childTime < elapsed ? frame.childTime : elapsed);
+  if (data->stackSize) {
+    Frame *parent = &data->stack[data->stackSize - 1];
+    parent->childTime += elapsed;
+    addCallee(&data->stats[parent->funcId], frame.funcId, 1);
+  }
+}
+
+static void handleEvent(int32_t funcId, enum XRayEntryType type) {
+  // Ignore the functions called by the handler itself.
+  if (inHandler || funcId <= 0 || (size_t)funcId > maxFuncId)
+    return;
+  inHandler = 1;
+  const uint64_t timestamp = now();
+  ThreadData *data = getThreadData();
+
+  if (!data) {
+    // out of memory, skip the event
+  } else if (type == XRAY_ENTRY || type == XRAY_LOG_ARGS_ENTRY) {
+    if (data->stackSize == data->stackCap) {
+      data->stackCap = data->stackCap ? 2 * data->stackCap : 64;
+      data->stack = (Frame *)checkedRealloc(data->stack,
+                                            data->stackCap * sizeof(Frame));
+    }
+    Frame *frame = &data->stack[data->stackSize++];
+    frame->funcId = funcId;
+    frame->start = timestamp;
+    frame->childTime = 0;
+  } else if (type == XRAY_EXIT || type == XRAY_TAIL) {
+    // Functions unwound by an exception don't have exit events, so pop their
+    // frames (as exiting now) up to the matching one. Exits without a matching
+    // entry (patching while the function was running) are ignored.
+    size_t depth = data->stackSize;
+    while (depth && data->stack[depth - 1].funcId != funcId)
+      --depth;
+    if (depth) {
+      while (data->stackSize >= depth)
+        popFrame(data, timestamp);
+    }
+  }
+
+  inHandler = 0;
+}
+
+static char **names = NULL;
+
+static const char *getName(int32_t funcId) {
+  if (!names[funcId]) {
+    const uintptr_t address = __xray_function_address(funcId);
+    Dl_info info;
+    if (address && dladdr((void *)address, &info) && info.dli_sname) {
+      names[funcId] = strdup(info.dli_sname);
+    } else {
+      char buffer[32];
+      snprintf(buffer, sizeof(buffer), "0x%llx", (unsigned long long)address);
+      names[funcId] = strdup(buffer);
+    }
+  }
+  return names[funcId] ? names[funcId] : "?";
+}
+
+static const FuncStats *sortStats;
+
+static int compareFuncTime(const void *a, const void *b) {
+  const uint64_t ta = sortStats[*(const int32_t *)a].funcTime;
+  const uint64_t tb = sortStats[*(const int32_t *)b].funcTime;
+  return ta < tb ? 1 : ta > tb ? -1 : 0;
+}
+
+static void writeTraceLog(void) {
+  __xray_set_handler(NULL);
+
+  // The data of still running threads is read without synchronization, so it
+  // might be slightly off.
+  pthread_mutex_lock(&globalLock);
+  FuncStats *stats = globalStats;
+  for (ThreadData *data = liveThreads; data; data = data->next)
+    mergeStats(stats, data->stats);
+
+  FILE *log = fopen(logFileName, "w");
+  names = (char **)calloc(maxFuncId + 1, sizeof(char *));
+  int32_t *sorted = (int32_t *)malloc((maxFuncId + 1) * sizeof(int32_t));
+  if (!log || !names || !sorted) {
+    fprintf(stderr, "cannot write trace log %s\n", logFileName);
+    pthread_mutex_unlock(&globalLock);
+    return;
+  }
+
+  // The fan in of each function, derived from the recorded fan out: the
+  // callers of `id` are callers[firstCaller[id] .. firstCaller[id + 1]].
+  size_t *firstCaller = (size_t *)calloc(maxFuncId + 2, sizeof(size_t));
+  size_t numEdges = 0;
+  if (firstCaller) {
+    for (size_t id = 1; id <= maxFuncId; ++id) {
+      for (size_t i = 0; i < stats[id].numCallees; ++i)
+        ++firstCaller[stats[id].callees[i].funcId];
+      numEdges += stats[id].numCallees;
+    }
+    // Now the end of each range, turned into its start while filling below.
+    for (size_t id = 1; id <= maxFuncId; ++id)
+      firstCaller[id] += firstCaller[id - 1];
+    firstCaller[maxFuncId + 1] = numEdges;
+  }
+  Edge *callers = (Edge *)malloc((numEdges ? numEdges : 1) * sizeof(Edge));
+  if (!firstCaller || !callers) {
+    fprintf(stderr, "cannot write trace log %s\n", logFileName);
+    fclose(log);
+    pthread_mutex_unlock(&globalLock);
+    return;
+  }
+  // Filled backwards, so that each range ends up in caller order.
+  for (size_t caller = maxFuncId; caller >= 1; --caller) {
+    for (size_t i = stats[caller].numCallees; i-- > 0;) {
+      Edge *e = &callers[--firstCaller[stats[caller].callees[i].funcId]];
+      e->funcId = (int32_t)caller;
+      e->count = stats[caller].callees[i].count;
+    }
+  }
+
+  // The call graph, with the times in ticks.
+  size_t numSorted = 0;
+  for (size_t id = 1; id <= maxFuncId; ++id) {
+    if (!stats[id].calls)
+      continue;
+    sorted[numSorted++] = (int32_t)id;
+
+    fprintf(log, "------------------\n");
+    for (size_t i = firstCaller[id]; i < firstCaller[id + 1]; ++i) {
+      fprintf(log, "\t%5llu\t%s\n", (unsigned long long)callers[i].count,
+              getName(callers[i].funcId));
+    }
+    fprintf(log, "%s\t%llu\t%llu\t%llu\n", getName((int32_t)id),
+            (unsigned long long)stats[id].calls,
+            (unsigned long long)stats[id].treeTime,
+            (unsigned long long)stats[id].funcTime);
+    for (size_t i = 0; i < stats[id].numCallees; ++i) {
+      fprintf(log, "\t%5llu\t%s\n",
+              (unsigned long long)stats[id].callees[i].count,
+              getName(stats[id].callees[i].funcId));
+    }
+  }
+
+  // The timing table, with the times in microseconds, sorted by function time.
+  sortStats = stats;
+  qsort(sorted, numSorted, sizeof(int32_t), compareFuncTime);
+
+  fprintf(log, "\n======== Timer Is 1000000000 Ticks/Sec, Times are in "
+               "Microsecs ========\n\n");
+  fprintf(log, "  Num          Tree        Func        Per\n"
+               "  Calls        Time        Time        Call\n\n");
+  for (size_t i = 0; i < numSorted; ++i) {
+    const FuncStats *f = &stats[sorted[i]];
+    const uint64_t treeTime = f->treeTime / 1000;
+    const uint64_t funcTime = f->funcTime / 1000;
+    fprintf(log, "%7llu%12llu%12llu%12llu     %s\n",
+            (unsigned long long)f->calls, (unsigned long long)treeTime,
+            (unsigned long long)funcTime,
+            (unsigned long long)(funcTime / f->calls), getName(sorted[i]));
+  }
+
+  free(callers);
+  free(firstCaller);
+  fclose(log);
+  pthread_mutex_unlock(&globalLock);
+}
+
+// Referenced by the linker command line (`-u`) to pull in this object file.
+__attribute__((constructor)) void ldc_xray_trace_init(void) {
+  static int initialized = 0;
+  if (initialized)
+    return;
+  initialized = 1;
+
+  const char *fileName = getenv("LDC_TRACE_LOG");
+  if (!fileName)
+    return; // leave the sleds unpatched
+  logFileName = *fileName ? fileName : "trace.log";
+
+  maxFuncId = __xray_max_function_id();
+  if (maxFuncId == 0)
+    return; // nothing instrumented
+
+  globalStats = (FuncStats *)calloc(maxFuncId + 1, sizeof(FuncStats));
+  if (!globalStats || pthread_key_create(&threadDataKey, onThreadExit) != 0)
+    return;
+
+  __xray_set_handler(handleEvent);
+  atexit(writeTraceLog);
+  __xray_patch();
+}
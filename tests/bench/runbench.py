@@ -0,0 +1,212 @@
+#!/usr/bin/env python
+# Compile-time benchmarks for ldc2 itself.
+#
+# Compiles each benchmark of the corpus a number of times and writes the wall
+# time, peak memory usage and compile time per phase (median of all runs) to a
+# JSON file. The peak memory and the phases are taken from ldc2's
+# `-stats-file` output, so the results of different LDC versions should only
+# be compared for versions supporting it.
+#
+# Usage: runbench.py --ldc2=<path> [--output=<file>] [--runs=<n>]
+#                    [--filter=<regex>] [--dynamic-compile] [-- <extra ldc2 flags>]
+
+from __future__ import print_function
+
+import argparse
+import json
+import os
+import platform
+import re
+import shutil
+import subprocess
+import sys
+import tempfile
+import time
+
+CORPUS_DIR = os.path.join(os.path.dirname(os.path.abspath(__file__)), 'corpus')
+
+# Parameters of the generated corpus.
+NUM_SMALL_MODULES = 300
+NUM_GIANT_FUNCTIONS = 20000
+
+
+def generate_small_modules(work_dir):
+    """Many small modules importing each other, compiled in a single
+    invocation."""
+    files = []
+    for i in range(NUM_SMALL_MODULES):
+        name = 'mod%d' % i
+        path = os.path.join(work_dir, name + '.d')
+        with open(path, 'w') as f:
+            f.write('module %s;\n' % name)
+            if i > 0:
+                f.write('import mod%d;\n' % (i - 1))
+            f.write('struct S%d { int a; long b; string c; }\n' % i)
+            f.write('int f%d(int x) { return x * %d + 1; }\n' % (i, i))
+            f.write('T g%d(T)(T x) { return cast(T)(x + %d); }\n' % (i, i))
+            if i > 0:
+                f.write('int h%d() { return f%d(g%d(%d)) + f%d(1); }\n'
+                        % (i, i, i - 1, i, i - 1))
+        files.append(path)
+    return files
+
+
+def generate_giant_module(work_dir):
+    """A single module with many functions, structs and classes."""
+    path = os.path.join(work_dir, 'giant.d')
+    with open(path, 'w') as f:
+        f.write('module giant;\n')
+        for i in range(NUM_GIANT_FUNCTIONS):
+            f.write('int fun%d(int a, int b)\n{\n' % i)
+            f.write('    int r = a;\n')
+            f.write('    foreach (j; 0 .. b)\n')
+            f.write('        r = (r * %d + j) ^ (r >> 3);\n' % (i % 97 + 1))
+            f.write('    return r%s;\n}\n'
+                    % (' + fun%d(a, b - 1)' % (i - 1) if i % 8 else ''))
+            if i % 16 == 0:
+                f.write('struct Str%d { int x; double y; int[4] z; }\n' % i)
+                f.write('class Cls%d { int v; int get() { return v + fun%d(v, 2); } }\n'
+                        % (i, i))
+    return [path]
+
+
+def generate_empty_module(work_dir):
+    """A trivial module, for the fixed startup overhead of an invocation."""
+    path = os.path.join(work_dir, 'empty.d')
+    with open(path, 'w') as f:
+        f.write('module empty;\nint answer() { return 42; }\n')
+    return [path]
+
+
+def corpus_file(name):
+    return [os.path.join(CORPUS_DIR, name)]
+
+
+# name: (source files generator, additional ldc2 flags, is dynamic-compile
+# benchmark, i.e., link and time the run of the executable too)
+BENCHMARKS = [
+    ('startup', generate_empty_module, ['-c'], False),
+    ('startup-O2', generate_empty_module, ['-c', '-O2'], False),
+    ('templates', lambda d: corpus_file('templates.d'), ['-c'], False),
+    ('templates-O3', lambda d: corpus_file('templates.d'), ['-c', '-O3'], False),
+    ('small-modules', generate_small_modules, ['-c'], False),
+    ('giant-module', generate_giant_module, ['-c'], False),
+    ('giant-module-O3', generate_giant_module, ['-c', '-O3'], False),
+    ('ctfe', lambda d: corpus_file('ctfe.d'), ['-c', '-o-'], False),
+    ('dynamic-compile', lambda d: corpus_file('dynamic_compile.d'),
+     ['-enable-dynamic-compile'], True),
+]
+
+
+def median(values):
+    values = sorted(values)
+    n = len(values)
+    if n == 0:
+        return 0
+    if n % 2:
+        return values[n // 2]
+    return (values[n // 2 - 1] + values[n // 2]) / 2.0
+
+
+def run_timed(cmd, cwd):
+    start = time.time()
+    proc = subprocess.Popen(cmd, cwd=cwd, stdout=subprocess.PIPE,
+                            stderr=subprocess.STDOUT)
+    output = proc.communicate()[0]
+    elapsed = time.time() - start
+    if proc.returncode != 0:
+        sys.stderr.write(output.decode('utf-8', 'replace'))
+        raise RuntimeError('command failed (exit code %d): %s'
+                           % (proc.returncode, ' '.join(cmd)))
+    return elapsed
+
+
+def run_benchmark(args, name, generate, flags, run_executable):
+    work_dir = tempfile.mkdtemp(prefix='ldc2-bench-%s-' % name)
+    try:
+        sources = generate(work_dir)
+        stats_file = os.path.join(work_dir, 'stats.json')
+        exe = os.path.join(work_dir, 'bench' + ('.exe' if os.name == 'nt' else ''))
+        cmd = [args.ldc2, '-stats-file=' + stats_file, '-od=' + work_dir]
+        if run_executable:
+            cmd.append('-of=' + exe)
+        cmd += flags + args.extra_flags + sources
+
+        wall_times = []
+        peak_rss = []
+        run_times = []
+        phases = {}
+        for _ in range(args.runs):
+            wall_times.append(run_timed(cmd, work_dir))
+            with open(stats_file) as f:
+                stats = json.load(f)
+            peak_rss.append(stats.get('peakRSS', 0))
+            for phase, value in stats.get('phases', {}).items():
+                phases.setdefault(phase, []).append(value['us'])
+            if run_executable:
+                run_times.append(run_timed([exe], work_dir))
+
+        result = {
+            'sources': len(sources),
+            'flags': flags + args.extra_flags,
+            'wallTime': median(wall_times),
+            'wallTimes': wall_times,
+            'peakRSS': median(peak_rss),
+            'phases': dict((phase, median(us)) for phase, us in phases.items()),
+        }
+        if run_executable:
+            result['runTime'] = median(run_times)
+        return result
+    finally:
+        shutil.rmtree(work_dir, ignore_errors=True)
+
+
+def ldc2_version(ldc2):
+    output = subprocess.check_output([ldc2, '--version']).decode('utf-8',
+                                                                 'replace')
+    return output.splitlines()[0].strip() if output else ''
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description='Benchmark the compile time and memory usage of ldc2.')
+    parser.add_argument('--ldc2', required=True, help='ldc2 executable')
+    parser.add_argument('--output', default='ldc2-bench.json',
+                        help='JSON output file (default: %(default)s)')
+    parser.add_argument('--runs', type=int, default=3,
+                        help='runs per benchmark (default: %(default)s)')
+    parser.add_argument('--filter', default='',
+                        help='only run the benchmarks matching this regex')
+    parser.add_argument('--dynamic-compile', action='store_true',
+                        help='include the dynamic-compile benchmark')
+    parser.add_argument('extra_flags', nargs='*',
+                        help='additional flags for all ldc2 invocations')
+    args = parser.parse_args()
+
+    results = {}
+    for name, generate, flags, dynamic in BENCHMARKS:
+        if dynamic and not args.dynamic_compile:
+            continue
+        if args.filter and not re.search(args.filter, name):
+            continue
+        print('Running benchmark %s...' % name)
+        sys.stdout.flush()
+        results[name] = run_benchmark(args, name, generate, flags, dynamic)
+        print('  wall time: %.3f s, peak memory: %.1f MB'
+              % (results[name]['wallTime'],
+                 results[name]['peakRSS'] / (1024.0 * 1024.0)))
+
+    report = {
+        'ldc2': ldc2_version(args.ldc2),
+        'host': platform.platform(),
+        'runs': args.runs,
+        'benchmarks': results,
+    }
+    with open(args.output, 'w') as f:
+        json.dump(report, f, indent=2, sort_keys=True)
+        f.write('\n')
+    print('Results written to %s' % args.output)
+
+
+if __name__ == '__main__':
+    main()
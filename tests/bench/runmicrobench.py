@@ -0,0 +1,149 @@
+#!/usr/bin/env python
+# Generated-code microbenchmarks for the D-specific lowering of LDC.
+#
+# Compiles each benchmark program in micro/ (together with micro/harness.d) at
+# every requested optimization level, runs it and collects the reported time
+# per operation. The results are written to a JSON file and compared against a
+# baseline (the results of a previous run on the same machine, e.g., with the
+# LDC version before a change); operations slower than the baseline by more
+# than the threshold are reported as regressions.
+#
+# Usage: runmicrobench.py --ldc2=<path> [--output=<file>]
+#                         [--baseline=<file>] [--save-baseline]
+#                         [--opt=-O2 --opt=-O3] [--threshold=<percent>]
+#                         [--filter=<regex>] [-- <extra ldc2 flags>]
+
+from __future__ import print_function
+
+import argparse
+import glob
+import json
+import os
+import re
+import shutil
+import subprocess
+import sys
+import tempfile
+
+MICRO_DIR = os.path.join(os.path.dirname(os.path.abspath(__file__)), 'micro')
+HARNESS = os.path.join(MICRO_DIR, 'harness.d')
+
+
+def check_output(cmd):
+    proc = subprocess.Popen(cmd, stdout=subprocess.PIPE,
+                            stderr=subprocess.STDOUT)
+    output = proc.communicate()[0].decode('utf-8', 'replace')
+    if proc.returncode != 0:
+        sys.stderr.write(output)
+        raise RuntimeError('command failed (exit code %d): %s'
+                           % (proc.returncode, ' '.join(cmd)))
+    return output
+
+
+def run_program(args, work_dir, source, opt):
+    name = os.path.splitext(os.path.basename(source))[0]
+    exe = os.path.join(work_dir, name + opt.replace('-', '_')
+                       + ('.exe' if os.name == 'nt' else ''))
+    check_output([args.ldc2, opt, '-release', '-od=' + work_dir, '-of=' + exe,
+                  '-I' + MICRO_DIR] + args.extra_flags + [source, HARNESS])
+    results = {}
+    for line in check_output([exe]).splitlines():
+        fields = line.split()
+        if len(fields) == 3 and fields[0] == 'BENCH':
+            results[fields[1]] = float(fields[2])
+    return results
+
+
+def compare(results, baseline, threshold):
+    """Prints the relative change of each operation and returns the number of
+    regressions."""
+    regressions = 0
+    for opt in sorted(results):
+        for name in sorted(results[opt]):
+            ns = results[opt][name]
+            old = baseline.get(opt, {}).get(name)
+            if old is None or old == 0:
+                print('  %-4s %-28s %10.3f ns/op' % (opt, name, ns))
+                continue
+            change = (ns - old) / old * 100
+            marker = ''
+            if change > threshold:
+                marker = '  REGRESSION'
+                regressions += 1
+            elif change < -threshold:
+                marker = '  improvement'
+            print('  %-4s %-28s %10.3f ns/op  (baseline %10.3f, %+6.1f%%)%s'
+                  % (opt, name, ns, old, change, marker))
+    return regressions
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description='Benchmark the code generated by ldc2 for D-specific '
+                    'constructs.')
+    parser.add_argument('--ldc2', required=True, help='ldc2 executable')
+    parser.add_argument('--output', default='ldc2-microbench.json',
+                        help='JSON output file (default: %(default)s)')
+    parser.add_argument('--baseline',
+                        help='JSON file with the baseline results to compare '
+                             'against')
+    parser.add_argument('--save-baseline', action='store_true',
+                        help='store the results as new baseline instead of '
+                             'comparing against it')
+    parser.add_argument('--opt', action='append',
+                        help='optimization levels (default: -O2 and -O3)')
+    parser.add_argument('--threshold', type=float, default=10.0,
+                        help='slowdown in percent reported as regression '
+                             '(default: %(default)s)')
+    parser.add_argument('--filter', default='',
+                        help='only run the benchmark programs matching this '
+                             'regex')
+    parser.add_argument('extra_flags', nargs='*',
+                        help='additional flags for all ldc2 invocations')
+    args = parser.parse_args()
+    opts = args.opt or ['-O2', '-O3']
+
+    sources = [s for s in sorted(glob.glob(os.path.join(MICRO_DIR, '*.d')))
+               if s != HARNESS]
+    if args.filter:
+        sources = [s for s in sources
+                   if re.search(args.filter, os.path.basename(s))]
+
+    results = dict((opt, {}) for opt in opts)
+    work_dir = tempfile.mkdtemp(prefix='ldc2-microbench-')
+    try:
+        for source in sources:
+            for opt in opts:
+                print('Running %s %s...' % (os.path.basename(source), opt))
+                sys.stdout.flush()
+                results[opt].update(run_program(args, work_dir, source, opt))
+    finally:
+        shutil.rmtree(work_dir, ignore_errors=True)
+
+    with open(args.output, 'w') as f:
+        json.dump(results, f, indent=2, sort_keys=True)
+        f.write('\n')
+    print('Results written to %s' % args.output)
+
+    if args.baseline and args.save_baseline:
+        shutil.copyfile(args.output, args.baseline)
+        print('Baseline saved to %s' % args.baseline)
+        return 0
+
+    baseline = {}
+    if args.baseline and os.path.exists(args.baseline):
+        with open(args.baseline) as f:
+            baseline = json.load(f)
+    elif args.baseline:
+        print('Baseline %s not found, use --save-baseline to create it'
+              % args.baseline)
+    regressions = compare(results, baseline, args.threshold)
+    if regressions:
+        print('%d regression(s) of more than %g%%'
+              % (regressions, args.threshold))
+        return 1
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,51 @@
+//===-- eraseLoggingCallsPass.cpp - Erase calls to @logging functions -----===//
+//
+//                         LDC – the LLVM D compiler
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See the LICENSE file for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "plugin_api.h"
+
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/PassManager.h"
+
+using namespace llvm;
+
+namespace {
+
+struct EraseLoggingCallsPass : PassInfoMixin<EraseLoggingCallsPass> {
+  PreservedAnalyses run(Function &F, FunctionAnalysisManager &) {
+    SmallVector<CallInst *, 4> calls;
+    for (auto &BB : F) {
+      for (auto &I : BB) {
+        auto call = dyn_cast<CallInst>(&I);
+        if (!call || !call->use_empty())
+          continue;
+        auto callee = call->getCalledFunction();
+        if (callee && ldc::plugin::hasUDA(*callee, "testPlugin.logging"))
+          calls.push_back(call);
+      }
+    }
+    for (auto call : calls)
+      call->eraseFromParent();
+    return calls.empty() ? PreservedAnalyses::all() : PreservedAnalyses::none();
+  }
+};
+
+void registerCallbacks(ldc::plugin::PluginCallbacks &callbacks) {
+  callbacks.registerDRuntimeOptimizerLateEPCallback(
+      [](FunctionPassManager &fpm, ldc::plugin::OptimizationLevel) {
+        fpm.addPass(EraseLoggingCallsPass());
+      });
+}
+
+} // anonymous namespace
+
+extern "C" ldc::plugin::PluginInfo ldcGetPluginInfo() {
+  return {ldc::plugin::ApiVersion, "EraseLoggingCalls", &registerCallbacks};
+}
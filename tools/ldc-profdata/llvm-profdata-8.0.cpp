@@ -13,6 +13,7 @@
 
 #include "llvm/ADT/SmallSet.h"
 #include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringExtras.h"
 #include "llvm/ADT/StringRef.h"
 #include "llvm/IR/LLVMContext.h"
 #include "llvm/ProfileData/InstrProfReader.h"
@@ -185,6 +186,47 @@ struct WriterContext {
         ErrLock(ErrLock), WriterErrorCodes(WriterErrorCodes) {}
 };
 
+/// LDC: Options to keep merged profiles of D programs small.
+struct ProfileFilter {
+  /// Drop functions whose maximum counter is below this value (0 = keep all).
+  uint64_t MinFunctionCount;
+  /// The `-hash-threshold` of the profile-use compilation (0 = no hashing).
+  unsigned HashThreshold;
+};
+
+/// LDC: Returns whether the profile record name refers to a D symbol that the
+/// compiler hashes with the given `-hash-threshold`, so that the record can't
+/// be matched anymore. (Profiles collected with a different threshold than
+/// the profile-use build contain such unhashed long names.)
+static bool isUnmatchableDSymbol(StringRef Name, unsigned HashThreshold) {
+  if (HashThreshold == 0)
+    return false;
+  // Strip the `<filename>:` prefix of functions with internal linkage, and
+  // the `\1` prefix suppressing the ABI's global symbol prefix.
+  Name = Name.substr(Name.rfind(':') + 1);
+  if (Name.startswith("\1"))
+    Name = Name.drop_front();
+  if (!Name.startswith("_D") || Name.size() <= HashThreshold)
+    return false;
+  // Hashed names contain `33_<MD5 hash>` and may still exceed the threshold.
+  size_t Pos = Name.find("33_");
+  while (Pos != StringRef::npos) {
+    StringRef Hash = Name.substr(Pos + 3, 32);
+    if (Hash.size() == 32 && all_of(Hash, isHexDigit))
+      return false;
+    Pos = Name.find("33_", Pos + 1);
+  }
+  return true;
+}
+
+/// LDC: Returns the maximum counter value of a profile record.
+static uint64_t getMaxCount(const InstrProfRecord &Record) {
+  uint64_t Max = 0;
+  for (uint64_t Count : Record.Counts)
+    Max = std::max(Max, Count);
+  return Max;
+}
+
 /// Determine whether an error is fatal for profile merging.
 static bool isFatalError(instrprof_error IPE) {
   switch (IPE) {
@@ -203,7 +245,7 @@ static bool isFatalError(instrprof_error IPE) {
 
 /// Load an input into a writer context.
 static void loadInput(const WeightedFile &Input, SymbolRemapper *Remapper,
-                      WriterContext *WC) {
+                      const ProfileFilter &Filter, WriterContext *WC) {
   std::unique_lock<std::mutex> CtxGuard{WC->Lock};
 
   // If there's a pending hard error, don't do more work.
@@ -236,6 +278,9 @@ static void loadInput(const WeightedFile &Input, SymbolRemapper *Remapper,
   for (auto &I : *Reader) {
     if (Remapper)
       I.Name = (*Remapper)(I.Name);
+    // LDC: Skip unmatchable records early, keeping the merge contexts small.
+    if (isUnmatchableDSymbol(I.Name, Filter.HashThreshold))
+      continue;
     const StringRef FuncName = I.Name;
     bool Reported = false;
     WC->Writer.addRecord(std::move(I), Input.Weight, [&](Error E) {
@@ -279,11 +324,45 @@ static void mergeWriterContexts(WriterContext *Dst, WriterContext *Src) {
   });
 }
 
+/// LDC: Returns a writer with the records of the merged profile, except for
+/// the cold functions.
+static std::unique_ptr<InstrProfWriter>
+dropColdFunctions(InstrProfWriter &Writer, bool OutputSparse,
+                  uint64_t MinFunctionCount) {
+  auto ReaderOrErr = IndexedInstrProfReader::create(Writer.writeBuffer());
+  if (Error E = ReaderOrErr.takeError())
+    exitWithError(std::move(E));
+  auto Reader = std::move(ReaderOrErr.get());
+
+  auto HotWriter = llvm::make_unique<InstrProfWriter>(OutputSparse);
+  HotWriter->setIsIRLevelProfile(Reader->isIRLevelProfile());
+  uint64_t NumFunctions = 0, NumDropped = 0;
+  for (auto &I : *Reader) {
+    ++NumFunctions;
+    if (getMaxCount(I) < MinFunctionCount) {
+      ++NumDropped;
+      continue;
+    }
+    const std::string FuncName = I.Name;
+    HotWriter->addRecord(std::move(I), 1, [&](Error E) {
+      exitWithError(std::move(E), FuncName);
+    });
+  }
+  if (Error E = Reader->getError())
+    exitWithError(std::move(E));
+
+  errs() << "Dropped " << NumDropped << " of " << NumFunctions
+         << " functions with a maximum count below " << MinFunctionCount
+         << "\n";
+  return HotWriter;
+}
+
 static void mergeInstrProfile(const WeightedFileVector &Inputs,
                               SymbolRemapper *Remapper,
                               StringRef OutputFilename,
                               ProfileFormat OutputFormat, bool OutputSparse,
-                              unsigned NumThreads) {
+                              unsigned NumThreads,
+                              const ProfileFilter &Filter) {
   if (OutputFilename.compare("-") == 0)
     exitWithError("Cannot write indexed profdata format to stdout.");
 
@@ -312,14 +391,14 @@ static void mergeInstrProfile(const WeightedFileVector &Inputs,
 
   if (NumThreads == 1) {
     for (const auto &Input : Inputs)
-      loadInput(Input, Remapper, Contexts[0].get());
+      loadInput(Input, Remapper, Filter, Contexts[0].get());
   } else {
     ThreadPool Pool(NumThreads);
 
     // Load the inputs in parallel (N/NumThreads serial steps).
     unsigned Ctx = 0;
     for (const auto &Input : Inputs) {
-      Pool.async(loadInput, Input, Remapper, Contexts[Ctx].get());
+      Pool.async(loadInput, Input, Remapper, Filter, Contexts[Ctx].get());
       Ctx = (Ctx + 1) % NumThreads;
     }
     Pool.wait();
@@ -358,7 +437,12 @@ static void mergeInstrProfile(const WeightedFileVector &Inputs,
            WC->ErrWhence);
   }
 
-  InstrProfWriter &Writer = Contexts[0]->Writer;
+  std::unique_ptr<InstrProfWriter> HotWriter;
+  if (Filter.MinFunctionCount > 0)
+    HotWriter = dropColdFunctions(Contexts[0]->Writer, OutputSparse,
+                                  Filter.MinFunctionCount);
+  InstrProfWriter &Writer = HotWriter ? *HotWriter : Contexts[0]->Writer;
+
   if (OutputFormat == PF_Text) {
     if (Error E = Writer.writeText(Output))
       exitWithError(std::move(E));
@@ -570,6 +654,16 @@ static int merge_main(int argc, const char *argv[]) {
       cl::desc("Number of merge threads to use (default: autodetect)"));
   cl::alias NumThreadsA("j", cl::desc("Alias for --num-threads"),
                         cl::aliasopt(NumThreads));
+  // LDC-specific options
+  cl::opt<uint64_t> MinFunctionCount(
+      "min-function-count", cl::init(0),
+      cl::desc("Drop functions whose maximum counter is below this value, to "
+               "keep the indexed profile small (only meaningful for -instr)"));
+  cl::opt<unsigned> HashThreshold(
+      "hash-threshold", cl::init(0),
+      cl::desc("Drop unhashed D symbols longer than the `ldc2 "
+               "-hash-threshold` of the profile-use build, which can't match "
+               "(only meaningful for -instr)"));
 
   cl::ParseCommandLineOptions(argc, argv, "LLVM profile data merger\n");
 
@@ -600,7 +694,8 @@ static int merge_main(int argc, const char *argv[]) {
 
   if (ProfileKind == instr)
     mergeInstrProfile(WeightedInputs, Remapper.get(), OutputFilename,
-                      OutputFormat, OutputSparse, NumThreads);
+                      OutputFormat, OutputSparse, NumThreads,
+                      ProfileFilter{MinFunctionCount, HashThreshold});
   else
     mergeSampleProfile(WeightedInputs, Remapper.get(), OutputFilename,
                        OutputFormat);